@@ -43,6 +43,7 @@ public:
 		status_t		CameraAdded(CamDevice* device);
 		status_t		CameraRemoved(CamDevice* device);
 		void			FillDefaultFlavorInfo(flavor_info* info);
+		CamRoster*		Roster() const { return fRoster; }
 
 private:
 	uint32				fInternalIDCounter;
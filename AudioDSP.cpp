@@ -0,0 +1,529 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Audio processing stage: gain, sample format conversion, channel remix
+ * and resampling, with runtime CPU dispatch.
+ *
+ * The SIMD kernels do the same float operations as the scalar ones, in the
+ * same order: int16 <-> float goes through cvtdq2ps / cvtps2dq (round to
+ * nearest even, like lrintf), and values are clamped in float before the
+ * conversion back, so the saturating packs only narrow.
+ */
+
+
+#include "AudioDSP.h"
+
+#include <OS.h>
+#include <math.h>
+#include <string.h>
+#include <syslog.h>
+
+#if defined(__GNUC__) && __GNUC__ >= 5 \
+	&& (defined(__i386__) || defined(__x86_64__))
+#	define AUDIO_DSP_X86 1
+#	include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	define AUDIO_DSP_NEON 1
+#	include <arm_neon.h>
+#endif
+
+
+static const float kS16Max = 32767.0f;
+static const float kS16Min = -32768.0f;
+
+
+// =============================================================================
+// Scalar Kernels
+// =============================================================================
+
+static inline int16
+saturate_s16(float value)
+{
+	if (value > kS16Max)
+		value = kS16Max;
+	else if (value < kS16Min)
+		value = kS16Min;
+	return (int16)lrintf(value);
+}
+
+
+static void
+s16_to_float_scalar(float* dst, const int16* src, int32 count, float gain)
+{
+	for (int32 i = 0; i < count; i++)
+		dst[i] = (float)src[i] * gain;
+}
+
+
+static void
+float_to_s16_scalar(int16* dst, const float* src, int32 count)
+{
+	for (int32 i = 0; i < count; i++)
+		dst[i] = saturate_s16(src[i] * 32768.0f);
+}
+
+
+static void
+s16_gain_scalar(int16* dst, const int16* src, int32 count, float gain)
+{
+	for (int32 i = 0; i < count; i++)
+		dst[i] = saturate_s16((float)src[i] * gain);
+}
+
+
+static void
+mono_to_stereo_scalar(float* dst, const float* src, int32 frames)
+{
+	for (int32 i = 0; i < frames; i++) {
+		dst[2 * i] = src[i];
+		dst[2 * i + 1] = src[i];
+	}
+}
+
+
+static void
+stereo_to_mono_scalar(float* dst, const float* src, int32 frames)
+{
+	for (int32 i = 0; i < frames; i++)
+		dst[i] = (src[2 * i] + src[2 * i + 1]) * 0.5f;
+}
+
+
+#ifdef AUDIO_DSP_X86
+// =============================================================================
+// x86 Kernels (SSE2)
+// =============================================================================
+// Eight samples per step; the tails go through the scalar kernels.
+
+#define X86_TARGET(isa) __attribute__((target(isa)))
+
+
+X86_TARGET("sse2") static void
+s16_to_float_sse2(float* dst, const int16* src, int32 count, float gain)
+{
+	const __m128 kGain = _mm_set1_ps(gain);
+
+	int32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+		// Sign-extend by unpacking into the high half and shifting back
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), kGain));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), kGain));
+	}
+
+	if (i < count)
+		s16_to_float_scalar(dst + i, src + i, count - i, gain);
+}
+
+
+X86_TARGET("sse2") static inline __m128i
+sse2_pack_s16(__m128 lo, __m128 hi)
+{
+	const __m128 kMax = _mm_set1_ps(kS16Max);
+	const __m128 kMin = _mm_set1_ps(kS16Min);
+
+	lo = _mm_max_ps(_mm_min_ps(lo, kMax), kMin);
+	hi = _mm_max_ps(_mm_min_ps(hi, kMax), kMin);
+	return _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+}
+
+
+X86_TARGET("sse2") static void
+float_to_s16_sse2(int16* dst, const float* src, int32 count)
+{
+	const __m128 kScale = _mm_set1_ps(32768.0f);
+
+	int32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128 lo = _mm_mul_ps(_mm_loadu_ps(src + i), kScale);
+		__m128 hi = _mm_mul_ps(_mm_loadu_ps(src + i + 4), kScale);
+		_mm_storeu_si128((__m128i*)(dst + i), sse2_pack_s16(lo, hi));
+	}
+
+	if (i < count)
+		float_to_s16_scalar(dst + i, src + i, count - i);
+}
+
+
+X86_TARGET("sse2") static void
+s16_gain_sse2(int16* dst, const int16* src, int32 count, float gain)
+{
+	const __m128 kGain = _mm_set1_ps(gain);
+
+	int32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128 lo = _mm_cvtepi32_ps(
+			_mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16));
+		__m128 hi = _mm_cvtepi32_ps(
+			_mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16));
+		_mm_storeu_si128((__m128i*)(dst + i),
+			sse2_pack_s16(_mm_mul_ps(lo, kGain), _mm_mul_ps(hi, kGain)));
+	}
+
+	if (i < count)
+		s16_gain_scalar(dst + i, src + i, count - i, gain);
+}
+
+
+X86_TARGET("sse2") static void
+mono_to_stereo_sse2(float* dst, const float* src, int32 frames)
+{
+	int32 i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		__m128 in = _mm_loadu_ps(src + i);
+		_mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(in, in));
+		_mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(in, in));
+	}
+
+	if (i < frames)
+		mono_to_stereo_scalar(dst + 2 * i, src + i, frames - i);
+}
+
+
+X86_TARGET("sse2") static void
+stereo_to_mono_sse2(float* dst, const float* src, int32 frames)
+{
+	const __m128 kHalf = _mm_set1_ps(0.5f);
+
+	int32 i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		__m128 a = _mm_loadu_ps(src + 2 * i);		// L0 R0 L1 R1
+		__m128 b = _mm_loadu_ps(src + 2 * i + 4);	// L2 R2 L3 R3
+		__m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_add_ps(left, right), kHalf));
+	}
+
+	if (i < frames)
+		stereo_to_mono_scalar(dst + i, src + 2 * i, frames - i);
+}
+
+
+static bool
+x86_has_sse2()
+{
+	cpuid_info info;
+	if (get_cpuid(&info, 1, 0) != B_OK)
+		return false;
+	return (info.regs.edx & (1 << 26)) != 0;
+}
+
+#endif	// AUDIO_DSP_X86
+
+
+#ifdef AUDIO_DSP_NEON
+// =============================================================================
+// ARM NEON Kernels
+// =============================================================================
+// vcvtnq (round to nearest) only exists on AArch64; elsewhere the kernels
+// that produce int16 stay scalar, since vcvtq truncates.
+
+static void
+s16_to_float_neon(float* dst, const int16* src, int32 count, float gain)
+{
+	int32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t in = vld1q_s16(src + i);
+		float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(in)));
+		float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(in)));
+		vst1q_f32(dst + i, vmulq_n_f32(lo, gain));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(hi, gain));
+	}
+
+	if (i < count)
+		s16_to_float_scalar(dst + i, src + i, count - i, gain);
+}
+
+
+#ifdef __aarch64__
+static inline int16x8_t
+neon_pack_s16(float32x4_t lo, float32x4_t hi)
+{
+	const float32x4_t kMax = vdupq_n_f32(kS16Max);
+	const float32x4_t kMin = vdupq_n_f32(kS16Min);
+
+	lo = vmaxq_f32(vminq_f32(lo, kMax), kMin);
+	hi = vmaxq_f32(vminq_f32(hi, kMax), kMin);
+	return vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)),
+		vqmovn_s32(vcvtnq_s32_f32(hi)));
+}
+
+
+static void
+float_to_s16_neon(int16* dst, const float* src, int32 count)
+{
+	int32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t lo = vmulq_n_f32(vld1q_f32(src + i), 32768.0f);
+		float32x4_t hi = vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f);
+		vst1q_s16(dst + i, neon_pack_s16(lo, hi));
+	}
+
+	if (i < count)
+		float_to_s16_scalar(dst + i, src + i, count - i);
+}
+
+
+static void
+s16_gain_neon(int16* dst, const int16* src, int32 count, float gain)
+{
+	int32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t in = vld1q_s16(src + i);
+		float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(in)));
+		float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(in)));
+		vst1q_s16(dst + i, neon_pack_s16(vmulq_n_f32(lo, gain),
+			vmulq_n_f32(hi, gain)));
+	}
+
+	if (i < count)
+		s16_gain_scalar(dst + i, src + i, count - i, gain);
+}
+#else
+#	define float_to_s16_neon float_to_s16_scalar
+#	define s16_gain_neon s16_gain_scalar
+#endif	// __aarch64__
+
+
+static void
+mono_to_stereo_neon(float* dst, const float* src, int32 frames)
+{
+	int32 i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		float32x4x2_t out;
+		out.val[0] = vld1q_f32(src + i);
+		out.val[1] = out.val[0];
+		vst2q_f32(dst + 2 * i, out);
+	}
+
+	if (i < frames)
+		mono_to_stereo_scalar(dst + 2 * i, src + i, frames - i);
+}
+
+
+static void
+stereo_to_mono_neon(float* dst, const float* src, int32 frames)
+{
+	int32 i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		float32x4x2_t in = vld2q_f32(src + 2 * i);
+		vst1q_f32(dst + i, vmulq_n_f32(vaddq_f32(in.val[0], in.val[1]),
+			0.5f));
+	}
+
+	if (i < frames)
+		stereo_to_mono_scalar(dst + i, src + 2 * i, frames - i);
+}
+
+#endif	// AUDIO_DSP_NEON
+
+
+// =============================================================================
+// Runtime Dispatch
+// =============================================================================
+
+static const audio_dsp_kernels kScalarKernels = {
+	"scalar", s16_to_float_scalar, float_to_s16_scalar, s16_gain_scalar,
+	mono_to_stereo_scalar, stereo_to_mono_scalar };
+#ifdef AUDIO_DSP_X86
+static const audio_dsp_kernels kSSE2Kernels = {
+	"sse2", s16_to_float_sse2, float_to_s16_sse2, s16_gain_sse2,
+	mono_to_stereo_sse2, stereo_to_mono_sse2 };
+#endif
+#ifdef AUDIO_DSP_NEON
+static const audio_dsp_kernels kNEONKernels = {
+	"neon", s16_to_float_neon, float_to_s16_neon, s16_gain_neon,
+	mono_to_stereo_neon, stereo_to_mono_neon };
+#endif
+
+
+int32
+audio_dsp_available_kernels(const audio_dsp_kernels** kernels,
+	int32 maxKernels)
+{
+	int32 count = 0;
+	if (count < maxKernels)
+		kernels[count++] = &kScalarKernels;
+
+#ifdef AUDIO_DSP_X86
+	if (x86_has_sse2() && count < maxKernels)
+		kernels[count++] = &kSSE2Kernels;
+#endif
+#ifdef AUDIO_DSP_NEON
+	if (count < maxKernels)
+		kernels[count++] = &kNEONKernels;
+#endif
+
+	return count;
+}
+
+
+const audio_dsp_kernels*
+audio_dsp_best_kernels()
+{
+	// Same benign race as the colour converter's dispatch
+	static const audio_dsp_kernels* sBest = NULL;
+	if (sBest != NULL)
+		return sBest;
+
+	const audio_dsp_kernels* kernels[4];
+	int32 count = audio_dsp_available_kernels(kernels, 4);
+	const audio_dsp_kernels* best = kernels[count - 1];
+
+	syslog(LOG_INFO, "AudioDSP: kernels: %s (%d available)\n", best->name,
+		(int)count);
+
+	sBest = best;
+	return best;
+}
+
+
+void
+audio_remix(const audio_dsp_kernels* kernels, float* dst, int32 dstChannels,
+	const float* src, int32 srcChannels, int32 frames)
+{
+	if (dstChannels == srcChannels) {
+		memcpy(dst, src, (size_t)frames * dstChannels * sizeof(float));
+		return;
+	}
+	if (srcChannels == 1 && dstChannels == 2) {
+		kernels->mono_to_stereo(dst, src, frames);
+		return;
+	}
+	if (srcChannels == 2 && dstChannels == 1) {
+		kernels->stereo_to_mono(dst, src, frames);
+		return;
+	}
+
+	for (int32 i = 0; i < frames; i++) {
+		const float* in = src + (size_t)i * srcChannels;
+		float* out = dst + (size_t)i * dstChannels;
+		if (dstChannels == 1) {
+			float sum = 0.0f;
+			for (int32 c = 0; c < srcChannels; c++)
+				sum += in[c];
+			out[0] = sum / srcChannels;
+			continue;
+		}
+		for (int32 c = 0; c < dstChannels; c++)
+			out[c] = in[c < srcChannels ? c : srcChannels - 1];
+	}
+}
+
+
+// =============================================================================
+// Resampler
+// =============================================================================
+// Input frame k of the current block is x[k]; x[-4..-1] are the last frames
+// of the previous block, kept in fHistory. Output j lies at input position
+// p = fPhase + j * step and is interpolated from x[i-1..i+2], i = floor(p).
+// A block of n outputs therefore reads up to x[floor(p_last) + 2], and the
+// next block starts at p_last + step - inputFrames, which is >= step - 3, so
+// the four kept frames always cover x[i-1].
+
+AudioResampler::AudioResampler()
+	:
+	fStep(1.0),
+	fPhase(0.0),
+	fChannels(1)
+{
+	memset(fHistory, 0, sizeof(fHistory));
+}
+
+
+status_t
+AudioResampler::SetRates(double inputRate, double outputRate, int32 channels)
+{
+	if (inputRate <= 0 || outputRate <= 0 || channels < 1
+		|| channels > kMaxChannels)
+		return B_BAD_VALUE;
+
+	fStep = inputRate / outputRate;
+	fChannels = channels;
+	Reset();
+	return B_OK;
+}
+
+
+void
+AudioResampler::Reset()
+{
+	fPhase = 0.0;
+	memset(fHistory, 0, sizeof(fHistory));
+}
+
+
+int32
+AudioResampler::InputFramesFor(int32 outputFrames) const
+{
+	if (outputFrames <= 0)
+		return 0;
+	if (IsPassthrough())
+		return outputFrames;
+
+	int32 frames = (int32)floor(fPhase + (outputFrames - 1) * fStep) + 3;
+	return frames > 0 ? frames : 0;
+}
+
+
+void
+AudioResampler::Process(const float* input, int32 inputFrames, float* output,
+	int32 outputFrames)
+{
+	const int32 channels = fChannels;
+
+	if (IsPassthrough()) {
+		int32 frames = min_c(inputFrames, outputFrames);
+		memcpy(output, input, (size_t)frames * channels * sizeof(float));
+		if (frames < outputFrames) {
+			memset(output + (size_t)frames * channels, 0,
+				(size_t)(outputFrames - frames) * channels * sizeof(float));
+		}
+		return;
+	}
+
+	for (int32 j = 0; j < outputFrames; j++) {
+		double position = fPhase + j * fStep;
+		int32 index = (int32)floor(position);
+		float t = (float)(position - index);
+
+		const float* x[4];
+		for (int32 k = 0; k < 4; k++) {
+			int32 frame = index - 1 + k;
+			// Short blocks are a caller bug; hold the last frame
+			if (frame >= inputFrames)
+				frame = inputFrames - 1;
+			if (frame >= 0)
+				x[k] = input + (size_t)frame * channels;
+			else
+				x[k] = fHistory + (size_t)(frame + kHistory) * channels;
+		}
+
+		float* out = output + (size_t)j * channels;
+		for (int32 c = 0; c < channels; c++) {
+			// Catmull-Rom
+			float x0 = x[0][c], x1 = x[1][c], x2 = x[2][c], x3 = x[3][c];
+			out[c] = x1 + 0.5f * t * (x2 - x0 + t * (2.0f * x0 - 5.0f * x1
+				+ 4.0f * x2 - x3 + t * (3.0f * (x1 - x2) + x3 - x0)));
+		}
+	}
+
+	// Keep the last kHistory frames of history + input
+	if (inputFrames >= kHistory) {
+		memcpy(fHistory, input + (size_t)(inputFrames - kHistory) * channels,
+			kHistory * channels * sizeof(float));
+	} else if (inputFrames > 0) {
+		memmove(fHistory, fHistory + (size_t)inputFrames * channels,
+			(kHistory - inputFrames) * channels * sizeof(float));
+		memcpy(fHistory + (size_t)(kHistory - inputFrames) * channels, input,
+			(size_t)inputFrames * channels * sizeof(float));
+	}
+
+	fPhase += outputFrames * fStep - inputFrames;
+}
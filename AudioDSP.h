@@ -0,0 +1,101 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Audio processing stage: gain, sample format conversion, channel remix
+ * and resampling, with runtime CPU dispatch.
+ */
+#ifndef _AUDIO_DSP_H
+#define _AUDIO_DSP_H
+
+
+#include <SupportDefs.h>
+
+
+// =============================================================================
+// Sample Kernels
+// =============================================================================
+// Float samples are full scale at +-1.0, which is int16 +-32768. Every
+// kernel set produces the same results as the scalar one (up to the last
+// bit of float rounding on FPUs with extended precision); int16 output is
+// rounded to nearest and saturated.
+
+// dst[i] = src[i] * gain; 'gain' includes the 1/32768 scale
+typedef void (*audio_s16_to_float_func)(float* dst, const int16* src,
+	int32 count, float gain);
+// dst[i] = saturate(round(src[i] * 32768))
+typedef void (*audio_float_to_s16_func)(int16* dst, const float* src,
+	int32 count);
+// dst[i] = saturate(round(src[i] * gain)); dst may be src
+typedef void (*audio_s16_gain_func)(int16* dst, const int16* src,
+	int32 count, float gain);
+// Interleaved float frames, 1 -> 2 and 2 -> 1 channels
+typedef void (*audio_remix_func)(float* dst, const float* src, int32 frames);
+
+struct audio_dsp_kernels {
+	const char*				name;
+	audio_s16_to_float_func	s16_to_float;
+	audio_float_to_s16_func	float_to_s16;
+	audio_s16_gain_func		s16_gain;
+	audio_remix_func		mono_to_stereo;
+	audio_remix_func		stereo_to_mono;
+};
+
+// Best kernel set for the running CPU, detected once and cached
+const audio_dsp_kernels*	audio_dsp_best_kernels();
+
+// All kernel sets usable on the running CPU, scalar first (for tests)
+int32	audio_dsp_available_kernels(const audio_dsp_kernels** kernels,
+			int32 maxKernels);
+
+// Any channel count to any other: mono is duplicated, a downmix to mono
+// averages, otherwise channels are copied and missing ones repeat the
+// last source channel. dst and src must not overlap.
+void	audio_remix(const audio_dsp_kernels* kernels, float* dst,
+			int32 dstChannels, const float* src, int32 srcChannels,
+			int32 frames);
+
+
+// =============================================================================
+// Resampler
+// =============================================================================
+// Arbitrary ratio, cubic (Catmull-Rom) interpolation on interleaved float
+// frames. The stream is cut into blocks freely: ask how many input frames
+// the next block of output needs, then hand exactly that many in. The
+// last input frames are kept, so block edges are seamless.
+
+class AudioResampler {
+public:
+	enum {
+		kMaxChannels	= 8
+	};
+
+								AudioResampler();
+
+			status_t			SetRates(double inputRate, double outputRate,
+									int32 channels);
+			void				Reset();
+
+			bool				IsPassthrough() const
+									{ return fStep == 1.0; }
+			double				Step() const { return fStep; }
+
+			int32				InputFramesFor(int32 outputFrames) const;
+			void				Process(const float* input,
+									int32 inputFrames, float* output,
+									int32 outputFrames);
+
+private:
+	enum {
+		kHistory		= 4
+	};
+
+			double				fStep;		// input frames per output frame
+			double				fPhase;		// next output, in input frames
+											// from the next block's start
+			int32				fChannels;
+			float				fHistory[kHistory * kMaxChannels];
+};
+
+
+#endif /* _AUDIO_DSP_H */
@@ -28,9 +28,24 @@
 #define TOUCH(x) ((void)(x))
 
 // Audio buffer configuration
-#define AUDIO_BUFFER_SIZE 512		// Bytes per buffer (smaller for USB timing)
-#define AUDIO_BUFFER_COUNT 16		// Number of buffers in group
-#define AUDIO_RING_BUFFER_SIZE 65536	// 64KB ring buffer for USB data
+#define AUDIO_BUFFER_FRAMES 128		// Frames per buffer (small for USB timing)
+#define AUDIO_MAX_BUFFER_FRAMES 8192	// Largest buffer a consumer may ask for
+#define AUDIO_MIN_BUFFER_COUNT 4	// Buffers in our group, by the latency
+#define AUDIO_MAX_BUFFER_COUNT 64	// downstream (see _BufferCount())
+#define AUDIO_MAX_BACKLOG 50000		// Oldest audio kept buffered (us)
+#define AUDIO_STALL_TIMEOUT 50000	// No data this long: send silence (us)
+#define AUDIO_MIN_RATE 8000.0f		// Output rates the resampler serves
+#define AUDIO_MAX_RATE 192000.0f
+
+
+// Live metrics of the camera this node belongs to, if any
+static inline void
+count_metric(CamDevice* device, cam_metric metric)
+{
+	if (device != NULL)
+		device->Metrics().Add(metric);
+}
+
 
 // Define static member variable
 int32 AudioProducer::fInstances = 0;
@@ -58,6 +73,8 @@ AudioProducer::AudioProducer(
 	fThread = -1;
 	fFrameSync = -1;
 	fProcessingLatency = 0LL;
+	fDownstreamLatency = 0LL;
+	fInternalLatency = 0LL;
 
 	fRunning = false;
 	fConnected = false;
@@ -65,6 +82,17 @@ AudioProducer::AudioProducer(
 
 	fFramesSent = 0;
 	fStartTime = 0;
+	fCaptureLatency = 0;
+	fNextStartTime = 0;
+
+	fDSP = audio_dsp_best_kernels();
+	fDSPDirect = true;
+	fDSPBuffer = NULL;
+	fDSPInput = NULL;
+	fDSPFloat = NULL;
+	fDSPMixed = NULL;
+	fDSPOutput = NULL;
+	fDSPInputFrames = 0;
 
 	fMuted = false;
 	fVolume = 1.0f;
@@ -74,13 +102,6 @@ AudioProducer::AudioProducer(
 	fAudioStats.Reset();
 	fLastStatsReport = 0;
 
-	// Ring buffer for USB audio data
-	fAudioRingBuffer = NULL;
-	fRingBufferSize = AUDIO_RING_BUFFER_SIZE;
-	fRingBufferHead = 0;
-	fRingBufferTail = 0;
-	fRingBufferSem = -1;
-
 	fOutput.destination = media_destination::null;
 
 	AddNodeKind(B_PHYSICAL_INPUT);
@@ -98,16 +119,7 @@ AudioProducer::~AudioProducer()
 			HandleStop();
 	}
 
-	if (fAudioRingBuffer) {
-		free(fAudioRingBuffer);
-		fAudioRingBuffer = NULL;
-	}
-
-	if (fRingBufferSem >= 0) {
-		delete_sem(fRingBufferSem);
-		fRingBufferSem = -1;
-	}
-
+	_FreeDSP();
 	atomic_add(&fInstances, -1);
 }
 
@@ -130,8 +142,13 @@ AudioProducer::AddOn(int32 *internal_id) const
 
 
 status_t
-AudioProducer::HandleMessage(int32 /*message*/, const void* /*data*/, size_t /*size*/)
+AudioProducer::HandleMessage(int32 message, const void* data, size_t size)
 {
+	if (message == WEBCAM_MSG_GET_METRICS) {
+		if (fCamDevice == NULL)
+			return B_BAD_VALUE;
+		return fCamDevice->HandleMetricsRequest(data, size, ID(), Name());
+	}
 	return B_ERROR;
 }
 
@@ -189,11 +206,11 @@ AudioProducer::NodeRegistered()
 	fOutput.destination = media_destination::null;
 	strcpy(fOutput.name, Name());
 
-	// Configure audio format based on device capabilities
-	fOutput.format.type = B_MEDIA_RAW_AUDIO;
-	fOutput.format.u.raw_audio = media_raw_audio_format::wildcard;
-	fOutput.format.u.raw_audio.format = media_raw_audio_format::B_AUDIO_SHORT;
-	fOutput.format.u.raw_audio.byte_order = B_MEDIA_LITTLE_ENDIAN;
+	// The device delivers 16-bit little endian samples; the output can be
+	// any format the processing stage converts that to
+	fDeviceFormat = media_raw_audio_format::wildcard;
+	fDeviceFormat.format = media_raw_audio_format::B_AUDIO_SHORT;
+	fDeviceFormat.byte_order = B_MEDIA_LITTLE_ENDIAN;
 
 	// Get audio parameters from device
 	UVCCamDevice* uvcDev = dynamic_cast<UVCCamDevice*>(fCamDevice);
@@ -201,20 +218,22 @@ AudioProducer::NodeRegistered()
 		uint8 channels = uvcDev->AudioChannels();
 		uint32 sampleRate = uvcDev->AudioSampleRate();
 
-		fOutput.format.u.raw_audio.channel_count = (channels > 0) ? channels : 2;
-		fOutput.format.u.raw_audio.frame_rate = (sampleRate > 0)
+		fDeviceFormat.channel_count = (channels > 0) ? channels : 2;
+		fDeviceFormat.frame_rate = (sampleRate > 0)
 			? (float)sampleRate : 48000.0f;
 
 		syslog(LOG_INFO, "AudioProducer: Using %d ch, %.0f Hz from device\n",
-			(int)fOutput.format.u.raw_audio.channel_count,
-			fOutput.format.u.raw_audio.frame_rate);
+			(int)fDeviceFormat.channel_count, fDeviceFormat.frame_rate);
 	} else {
 		// Default: stereo, 16-bit, 48000 Hz
-		fOutput.format.u.raw_audio.channel_count = 2;
-		fOutput.format.u.raw_audio.frame_rate = 48000.0f;
+		fDeviceFormat.channel_count = 2;
+		fDeviceFormat.frame_rate = 48000.0f;
 		syslog(LOG_WARNING, "AudioProducer: No device info, using defaults\n");
 	}
-	fOutput.format.u.raw_audio.buffer_size = AUDIO_BUFFER_SIZE;
+	fDeviceFormat.buffer_size = AUDIO_BUFFER_FRAMES * 2
+		* fDeviceFormat.channel_count;
+
+	_OpenFormat(&fOutput.format);
 
 	SetPriority(B_REAL_TIME_PRIORITY);
 	Run();
@@ -321,7 +340,7 @@ AudioProducer::FormatSuggestionRequested(
 
 	TOUCH(quality);
 
-	*format = fOutput.format;
+	_PreferredFormat(format);
 	return B_OK;
 }
 
@@ -332,11 +351,12 @@ AudioProducer::FormatProposal(const media_source &output, media_format *format)
 	if (output != fOutput.source)
 		return B_MEDIA_BAD_SOURCE;
 
-	// Accept compatible formats
-	if (format->type != B_MEDIA_RAW_AUDIO)
+	// Fill in what the consumer left open; anything the processing
+	// stage cannot produce gets our preferred format as counter-proposal
+	if (_NegotiateFormat(format) != B_OK) {
+		_PreferredFormat(format);
 		return B_MEDIA_BAD_FORMAT;
-
-	*format = fOutput.format;
+	}
 	return B_OK;
 }
 
@@ -352,40 +372,56 @@ AudioProducer::FormatChangeRequested(const media_source &source,
 	if (source != fOutput.source)
 		return B_MEDIA_BAD_SOURCE;
 
-	// For audio input from USB microphone, format is fixed by hardware
-	// We can only accept compatible formats
 	if (io_format == NULL)
 		return B_BAD_VALUE;
 
-	if (io_format->type != B_MEDIA_RAW_AUDIO)
+	// The microphone's format is fixed, but the processing stage converts
+	// it to whatever the consumer prefers
+	if (_NegotiateFormat(io_format) != B_OK)
 		return B_MEDIA_BAD_FORMAT;
 
-	// Check if requested format is compatible with our output
-	media_raw_audio_format &requested = io_format->u.raw_audio;
-	media_raw_audio_format &supported = fOutput.format.u.raw_audio;
+	if (!fConnected)
+		return B_OK;
 
-	// Sample format must match (we only support 16-bit)
-	if (requested.format != media_raw_audio_format::wildcard.format
-		&& requested.format != supported.format)
-		return B_MEDIA_BAD_FORMAT;
+	BAutolock lock(fLock);
 
-	// Byte order must match
-	if (requested.byte_order != media_raw_audio_format::wildcard.byte_order
-		&& requested.byte_order != supported.byte_order)
-		return B_MEDIA_BAD_FORMAT;
+	media_raw_audio_format& requested = io_format->u.raw_audio;
+	if (requested.format == fConnectedFormat.format
+		&& requested.channel_count == fConnectedFormat.channel_count
+		&& requested.frame_rate == fConnectedFormat.frame_rate
+		&& requested.buffer_size == fConnectedFormat.buffer_size)
+		return B_OK;
 
-	// Channel count must match (hardware limitation)
-	if (requested.channel_count != media_raw_audio_format::wildcard.channel_count
-		&& requested.channel_count != supported.channel_count)
-		return B_MEDIA_BAD_FORMAT;
+	// The generator sizes its buffers once per run
+	if (fRunning)
+		return B_NOT_ALLOWED;
 
-	// Frame rate must match (hardware limitation)
-	if (requested.frame_rate != media_raw_audio_format::wildcard.frame_rate
-		&& requested.frame_rate != supported.frame_rate)
-		return B_MEDIA_BAD_FORMAT;
+	media_raw_audio_format previous = fConnectedFormat;
+	fConnectedFormat = requested;
+	if (_SetUpDSP() != B_OK) {
+		fConnectedFormat = previous;
+		_SetUpDSP();
+		return B_NO_MEMORY;
+	}
+
+	size_t frameSize = (fConnectedFormat.format & 0x0F)
+		* fConnectedFormat.channel_count;
+	fProcessingLatency = (bigtime_t)(fConnectedFormat.buffer_size / frameSize
+		* 1000000LL / fConnectedFormat.frame_rate);
 
-	// Format is compatible - return our exact format
-	*io_format = fOutput.format;
+	if (requested.buffer_size != previous.buffer_size) {
+		delete fBufferGroup;
+		fBufferGroup = new BBufferGroup(fConnectedFormat.buffer_size,
+			_BufferCount());
+		if (fBufferGroup->InitCheck() != B_OK) {
+			delete fBufferGroup;
+			fBufferGroup = NULL;
+			return B_NO_MEMORY;
+		}
+	}
+
+	fOutput.format = *io_format;
+	_UpdateLatency();
 	return B_OK;
 }
 
@@ -448,7 +484,7 @@ AudioProducer::SetBufferGroup(const media_source &for_source,
 		// Recreate default buffer group if needed
 		if (fBufferGroup == NULL && fConnected) {
 			fBufferGroup = new BBufferGroup(fConnectedFormat.buffer_size,
-				AUDIO_BUFFER_COUNT);
+				_BufferCount());
 			if (fBufferGroup->InitCheck() != B_OK) {
 				delete fBufferGroup;
 				fBufferGroup = NULL;
@@ -483,8 +519,9 @@ AudioProducer::PrepareToConnect(const media_source &source,
 	if (fOutput.destination != media_destination::null)
 		return B_MEDIA_ALREADY_CONNECTED;
 
-	if (!format_is_compatible(*format, fOutput.format)) {
-		*format = fOutput.format;
+	if (!format_is_compatible(*format, fOutput.format)
+		|| _NegotiateFormat(format) != B_OK) {
+		_PreferredFormat(format);
 		return B_MEDIA_BAD_FORMAT;
 	}
 
@@ -505,53 +542,45 @@ AudioProducer::Connect(status_t error, const media_source &source,
 	if (fConnected)
 		return;
 
+	media_format agreed = format;
 	if (source != fOutput.source || error < B_OK
-		|| !const_cast<media_format *>(&format)->Matches(&fOutput.format))
+		|| !agreed.Matches(&fOutput.format)
+		|| _NegotiateFormat(&agreed) != B_OK) {
+		fOutput.destination = media_destination::null;
 		return;
+	}
 
 	fOutput.destination = destination;
 	strcpy(io_name, fOutput.name);
 
-	fConnectedFormat = format.u.raw_audio;
+	fConnectedFormat = agreed.u.raw_audio;
+	if (_SetUpDSP() != B_OK) {
+		fOutput.destination = media_destination::null;
+		return;
+	}
+	fOutput.format = agreed;
 
 	// Get latency
 	bigtime_t latency = 0;
 	media_node_id tsID = 0;
 	FindLatencyFor(fOutput.destination, &latency, &tsID);
-	SetEventLatency(latency + 1000);
+	fDownstreamLatency = latency;
 
 	// Calculate buffer duration
 	size_t frameSize = (fConnectedFormat.format & 0x0F) * fConnectedFormat.channel_count;
 	size_t framesPerBuffer = fConnectedFormat.buffer_size / frameSize;
 	fProcessingLatency = (bigtime_t)(framesPerBuffer * 1000000LL / fConnectedFormat.frame_rate);
+	_UpdateLatency();
 
 	// Create buffer group
-	fBufferGroup = new BBufferGroup(fConnectedFormat.buffer_size, AUDIO_BUFFER_COUNT);
+	fBufferGroup = new BBufferGroup(fConnectedFormat.buffer_size, _BufferCount());
 	if (fBufferGroup->InitCheck() < B_OK) {
 		syslog(LOG_ERR, "AudioProducer: BufferGroup InitCheck failed\n");
 		delete fBufferGroup;
 		fBufferGroup = NULL;
-		return;
-	}
-
-	// Allocate ring buffer for USB audio data
-	fAudioRingBuffer = (uint8*)malloc(fRingBufferSize);
-	if (!fAudioRingBuffer) {
-		syslog(LOG_ERR, "AudioProducer: Failed to allocate ring buffer\n");
-		delete fBufferGroup;
-		fBufferGroup = NULL;
-		return;
-	}
-	fRingBufferHead = 0;
-	fRingBufferTail = 0;
-
-	fRingBufferSem = create_sem(0, "audio ring buffer");
-	if (fRingBufferSem < 0) {
-		syslog(LOG_ERR, "AudioProducer: Failed to create ring buffer sem\n");
-		free(fAudioRingBuffer);
-		fAudioRingBuffer = NULL;
-		delete fBufferGroup;
-		fBufferGroup = NULL;
+		_FreeDSP();
+		_OpenFormat(&fOutput.format);
+		fOutput.destination = media_destination::null;
 		return;
 	}
 
@@ -581,18 +610,10 @@ AudioProducer::Disconnect(const media_source &source,
 	fLock.Lock();
 	delete fBufferGroup;
 	fBufferGroup = NULL;
+	_FreeDSP();
 	fLock.Unlock();
 
-	if (fAudioRingBuffer) {
-		free(fAudioRingBuffer);
-		fAudioRingBuffer = NULL;
-	}
-
-	if (fRingBufferSem >= 0) {
-		delete_sem(fRingBufferSem);
-		fRingBufferSem = -1;
-	}
-
+	_OpenFormat(&fOutput.format);
 	fConnected = false;
 }
 
@@ -659,10 +680,15 @@ AudioProducer::LatencyChanged(const media_source &source,
 		const media_destination &destination, bigtime_t new_latency,
 		uint32 flags)
 {
-	TOUCH(source);
-	TOUCH(destination);
-	TOUCH(new_latency);
 	TOUCH(flags);
+
+	if (source != fOutput.source || destination != fOutput.destination)
+		return;
+
+	// The USB transfers are laid out again at the next start; the buffer
+	// group keeps its count until the format changes
+	fDownstreamLatency = new_latency;
+	_UpdateLatency();
 }
 
 
@@ -735,6 +761,9 @@ AudioProducer::HandleStart(bigtime_t performance_time)
 
 	fFramesSent = 0;
 	fStartTime = system_time();
+	fCaptureLatency = 0;
+	fNextStartTime = 0;
+	fResampler.Reset();
 
 	fFrameSync = create_sem(0, "audio frame sync");
 	if (fFrameSync < B_OK) {
@@ -742,7 +771,8 @@ AudioProducer::HandleStart(bigtime_t performance_time)
 		return;
 	}
 
-	// Start USB audio transfer on device
+	// Start USB audio transfer on device, sized for the latency now
+	_UpdateLatency();
 	UVCCamDevice* uvcDev = dynamic_cast<UVCCamDevice*>(fCamDevice);
 	if (uvcDev && uvcDev->HasAudio()) {
 		status_t err = uvcDev->StartAudioTransfer();
@@ -758,7 +788,9 @@ AudioProducer::HandleStart(bigtime_t performance_time)
 
 	fRunning = true;
 
-	fThread = spawn_thread(_audio_generator_, "audio generator", B_REAL_TIME_PRIORITY, this);
+	CamThreadPolicy& policy = fCamDevice->ThreadPolicy();
+	fThread = spawn_thread(_audio_generator_, "audio generator",
+		policy.Priority(CAM_THREAD_AUDIO_PRODUCER), this);
 	if (fThread < B_OK) {
 		syslog(LOG_ERR, "AudioProducer: HandleStart - spawn_thread failed\n");
 		fRunning = false;
@@ -767,6 +799,7 @@ AudioProducer::HandleStart(bigtime_t performance_time)
 		delete_sem(fFrameSync);
 		return;
 	}
+	policy.Apply(fThread, CAM_THREAD_AUDIO_PRODUCER);
 
 	if (resume_thread(fThread) < B_OK) {
 		syslog(LOG_ERR, "AudioProducer: HandleStart - resume_thread failed\n");
@@ -831,122 +864,452 @@ AudioProducer::_audio_generator_(void *data)
 }
 
 
+/* Performance time for a buffer whose first sample was captured at
+ * 'captureTime' (system time, from the device sample clock). As for video,
+ * a slowly tracked capture to send delay is added, so stamps keep the
+ * sample clock's spacing without landing in the past. Buffers of silence
+ * continue the timeline of the last real one. */
+bigtime_t
+AudioProducer::_BufferStartTime(bigtime_t captureTime,
+	bigtime_t bufferDuration)
+{
+	bigtime_t now = system_time();
+	bigtime_t sendTime;
+	if (captureTime > 0 && captureTime <= now) {
+		bigtime_t delay = now - captureTime;
+		if (delay > fCaptureLatency)
+			fCaptureLatency += (delay - fCaptureLatency + 3) / 4;
+		else
+			fCaptureLatency -= (fCaptureLatency - delay) / 64;
+		sendTime = captureTime + fCaptureLatency;
+	} else if (fNextStartTime > 0 && fNextStartTime >= now)
+		sendTime = fNextStartTime;
+	else
+		sendTime = now;
+	fNextStartTime = sendTime + bufferDuration;
+
+	BTimeSource* timeSource = TimeSource();
+	if (timeSource == NULL)
+		return sendTime;
+	return timeSource->PerformanceTimeFor(sendTime);
+}
+
+
+/* Sends a buffer whenever the device ring holds a full one, so delivery
+ * follows the USB clock. Only a device that stops delivering, or one
+ * without audio, falls back to timed buffers of silence. */
 int32
 AudioProducer::AudioGenerator()
 {
 	size_t frameSize = (fConnectedFormat.format & 0x0F) * fConnectedFormat.channel_count;
 	size_t framesPerBuffer = fConnectedFormat.buffer_size / frameSize;
 	bigtime_t bufferDuration = (bigtime_t)(framesPerBuffer * 1000000LL / fConnectedFormat.frame_rate);
+	size_t deviceFrameSize = 2 * fDeviceFormat.channel_count;
+	size_t maxBacklog = (size_t)(AUDIO_MAX_BACKLOG
+		* (int64)fDeviceFormat.frame_rate / 1000000) * deviceFrameSize;
+	if (maxBacklog < 4 * _InputBytesFor(framesPerBuffer))
+		maxBacklog = 4 * _InputBytesFor(framesPerBuffer);
+
+	UVCCamDevice* uvcDev = dynamic_cast<UVCCamDevice*>(fCamDevice);
+	if (uvcDev != NULL && !uvcDev->HasAudio())
+		uvcDev = NULL;
 
 	bigtime_t nextBufferTime = system_time();
 
 	while (fRunning) {
-		status_t err = acquire_sem_etc(fFrameSync, 1, B_ABSOLUTE_TIMEOUT, nextBufferTime);
+		status_t err;
+		if (uvcDev != NULL) {
+			// Device bytes for one output buffer; with resampling this
+			// varies by a frame from buffer to buffer
+			err = uvcDev->WaitAudioData(_InputBytesFor(framesPerBuffer),
+				system_time() + bufferDuration + AUDIO_STALL_TIMEOUT);
+			if (err == B_BAD_SEM_ID || err == B_DEV_NOT_READY) {
+				if (!fRunning)
+					break;
+				snooze(10000);
+				continue;
+			}
+		} else {
+			err = acquire_sem_etc(fFrameSync, 1, B_ABSOLUTE_TIMEOUT,
+				nextBufferTime);
+			if (err == B_BAD_SEM_ID) {
+				if (!fRunning)
+					break;
+				snooze(10000);
+				continue;
+			}
+			if (err == B_OK) {
+				// Timing change signal - recalculate
+				nextBufferTime = system_time() + bufferDuration;
+				continue;
+			}
+		}
 
-		if (err == B_BAD_SEM_ID) {
-			if (!fRunning)
-				break;
-			snooze(10000);
+		if (!fRunning)
+			break;
+
+		if (!fEnabled) {
+			// Nobody listens; don't let stale audio pile up meanwhile
+			if (uvcDev != NULL)
+				uvcDev->DiscardAudioData(0);
+			nextBufferTime = system_time() + bufferDuration;
 			continue;
 		}
 
-		if (err == B_OK) {
-			// Timing change signal - recalculate
+		if (uvcDev == NULL || err != B_OK) {
+			// No device audio, or it stalled: one buffer of silence keeps
+			// the consumer running
+			_SendAudioBuffer(uvcDev, framesPerBuffer, bufferDuration);
 			nextBufferTime = system_time() + bufferDuration;
 			continue;
 		}
 
-		if (!fRunning || !fEnabled)
-			continue;
+		// Fell behind (e.g. the consumer held buffers): drop the oldest
+		// audio rather than carry the latency
+		if (uvcDev->AudioDataAvailable() > maxBacklog) {
+			size_t dropped = uvcDev->DiscardAudioData(maxBacklog / 2);
+			if (dropped > 0) {
+				fAudioStats.overruns++;
+				count_metric(fCamDevice, CAM_METRIC_AUDIO_OVERRUNS);
+				syslog(LOG_DEBUG, "AudioProducer: dropped %zu bytes of "
+					"backlog\n", dropped);
+			}
+		}
 
-		BAutolock _(fLock);
+		while (fRunning && fEnabled
+			&& uvcDev->AudioDataAvailable()
+				>= _InputBytesFor(framesPerBuffer)) {
+			if (!_SendAudioBuffer(uvcDev, framesPerBuffer, bufferDuration))
+				break;
+		}
 
-		if (!fBufferGroup)
-			continue;
+		// Report what capturing really takes once it is more than thought
+		if (fCaptureLatency > fInternalLatency + 1000)
+			_UpdateLatency();
 
-		BBuffer *buffer = fBufferGroup->RequestBuffer(fConnectedFormat.buffer_size,
-			bufferDuration);
-		if (!buffer) {
-			fAudioStats.buffers_dropped++;
-			syslog(LOG_WARNING, "AudioProducer: No buffer available\n");
-			nextBufferTime = system_time() + bufferDuration;
-			continue;
+		// Group 8: Periodic statistics report (every 30 seconds)
+		bigtime_t now = system_time();
+		if (now - fLastStatsReport > 30000000) {
+			LogAudioStats();
+			fLastStatsReport = now;
 		}
+	}
 
-		// Group 8: Record buffer timing
-		fAudioStats.RecordBuffer(system_time());
+	return 0;
+}
 
-		// Fill buffer with audio data from device ring buffer
-		int16 *audioData = (int16 *)buffer->Data();
-		size_t bytesToFill = fConnectedFormat.buffer_size;
 
-		// Read audio data from device
-		UVCCamDevice* uvcDev = dynamic_cast<UVCCamDevice*>(fCamDevice);
-		size_t bytesRead = 0;
-		if (uvcDev != NULL && uvcDev->HasAudio()) {
-			bytesRead = uvcDev->ReadAudioData(audioData, bytesToFill);
-		}
+bool
+AudioProducer::_SendAudioBuffer(UVCCamDevice* device, size_t framesPerBuffer,
+	bigtime_t bufferDuration)
+{
+	BAutolock _(fLock);
+
+	if (!fBufferGroup)
+		return false;
+
+	BBuffer *buffer = fBufferGroup->RequestBuffer(fConnectedFormat.buffer_size,
+		bufferDuration);
+	if (!buffer) {
+		fAudioStats.buffers_dropped++;
+		count_metric(fCamDevice, CAM_METRIC_AUDIO_BUFFERS_DROPPED);
+		syslog(LOG_WARNING, "AudioProducer: No buffer available\n");
+		return false;
+	}
 
-		// Debug: log periodically
-		static int debugCount = 0;
-		if (++debugCount % 100 == 1) {
-			syslog(LOG_INFO, "AudioProducer: read %zu/%zu bytes, first samples: %d %d %d %d\n",
-				bytesRead, bytesToFill,
-				bytesRead >= 2 ? audioData[0] : 0,
-				bytesRead >= 4 ? audioData[1] : 0,
-				bytesRead >= 6 ? audioData[2] : 0,
-				bytesRead >= 8 ? audioData[3] : 0);
-		}
+	// Group 8: Record buffer timing
+	fAudioStats.RecordBuffer(system_time());
+
+	// Read audio data from device: straight into the buffer when no
+	// conversion is needed, otherwise into the processing stage
+	int16* audioData = fDSPDirect ? (int16*)buffer->Data() : fDSPInput;
+	size_t bytesToFill = _InputBytesFor(framesPerBuffer);
+
+	size_t bytesRead = 0;
+	bigtime_t captureTime = 0;
+	if (device != NULL)
+		bytesRead = device->ReadAudioData(audioData, bytesToFill, &captureTime);
+
+	// Debug: log periodically
+	static int debugCount = 0;
+	if (++debugCount % 100 == 1) {
+		syslog(LOG_INFO, "AudioProducer: read %zu/%zu bytes, first samples: %d %d %d %d\n",
+			bytesRead, bytesToFill,
+			bytesRead >= 2 ? audioData[0] : 0,
+			bytesRead >= 4 ? audioData[1] : 0,
+			bytesRead >= 6 ? audioData[2] : 0,
+			bytesRead >= 8 ? audioData[3] : 0);
+	}
 
-		// Fill remaining with silence if not enough data
-		if (bytesRead < bytesToFill) {
-			memset((uint8*)audioData + bytesRead, 0, bytesToFill - bytesRead);
-			if (bytesRead == 0)
-				fAudioStats.underruns++;
+	// Fill remaining with silence if not enough data
+	if (bytesRead < bytesToFill) {
+		memset((uint8*)audioData + bytesRead, 0, bytesToFill - bytesRead);
+		if (bytesRead == 0) {
+			fAudioStats.underruns++;
+			count_metric(fCamDevice, CAM_METRIC_AUDIO_UNDERRUNS);
 		}
+	}
 
-		// Group 8: Record audio levels
-		size_t sampleCount = bytesRead / sizeof(int16);
-		if (sampleCount > 0)
-			fAudioStats.RecordSamples(audioData, sampleCount);
-
-		// Apply volume and mute
-		size_t samplesToProcess = bytesToFill / sizeof(int16);
-		if (fMuted) {
-			memset(audioData, 0, fConnectedFormat.buffer_size);
-		} else if (fVolume < 1.0f) {
-			for (size_t i = 0; i < samplesToProcess; i++) {
-				audioData[i] = (int16)(audioData[i] * fVolume);
+	// Group 8: Record audio levels
+	size_t sampleCount = bytesRead / sizeof(int16);
+	if (sampleCount > 0)
+		fAudioStats.RecordSamples(audioData, sampleCount);
+
+	// Apply volume and mute, convert, remix and resample
+	float gain = fMuted ? 0.0f : fVolume;
+	int32 inputSamples = (int32)(bytesToFill / sizeof(int16));
+	if (fDSPDirect) {
+		if (gain < 1.0f)
+			fDSP->s16_gain(audioData, audioData, inputSamples, gain);
+	} else {
+		int32 deviceChannels = fDeviceFormat.channel_count;
+		int32 outputChannels = fConnectedFormat.channel_count;
+		int32 inputFrames = inputSamples / deviceChannels;
+		int32 outputFrames = (int32)framesPerBuffer;
+		bool floatOutput
+			= fConnectedFormat.format == media_raw_audio_format::B_AUDIO_FLOAT;
+		float* output = floatOutput ? (float*)buffer->Data() : fDSPOutput;
+
+		if (fResampler.IsPassthrough() && outputChannels == deviceChannels) {
+			fDSP->s16_to_float(output, audioData, inputSamples,
+				gain / 32768.0f);
+		} else {
+			fDSP->s16_to_float(fDSPFloat, audioData, inputSamples,
+				gain / 32768.0f);
+			const float* mixed = fDSPFloat;
+			if (outputChannels != deviceChannels) {
+				audio_remix(fDSP, fDSPMixed, outputChannels, fDSPFloat,
+					deviceChannels, inputFrames);
+				mixed = fDSPMixed;
 			}
+			fResampler.Process(mixed, inputFrames, output, outputFrames);
 		}
 
-		// Set buffer header
-		media_header *h = buffer->Header();
-		h->type = B_MEDIA_RAW_AUDIO;
-		h->size_used = fConnectedFormat.buffer_size;
-		h->time_source = TimeSource()->ID();
-		h->start_time = 0;  // Immediate playback for live audio
-
-		if (SendBuffer(buffer, fOutput.source, fOutput.destination) != B_OK) {
-			syslog(LOG_WARNING, "AudioProducer: SendBuffer failed\n");
-			buffer->Recycle();
-			fAudioStats.buffers_dropped++;
-		} else {
-			fAudioStats.buffers_sent++;
+		if (!floatOutput) {
+			fDSP->float_to_s16((int16*)buffer->Data(), output,
+				outputFrames * outputChannels);
 		}
+	}
 
-		fFramesSent += framesPerBuffer;
-		nextBufferTime = system_time() + bufferDuration;
+	// Set buffer header
+	media_header *h = buffer->Header();
+	h->type = B_MEDIA_RAW_AUDIO;
+	h->size_used = fConnectedFormat.buffer_size;
+	h->time_source = TimeSource()->ID();
+	h->start_time = _BufferStartTime(bytesRead > 0 ? captureTime : 0,
+		bufferDuration);
+
+	fFramesSent += framesPerBuffer;
+
+	if (SendBuffer(buffer, fOutput.source, fOutput.destination) != B_OK) {
+		syslog(LOG_WARNING, "AudioProducer: SendBuffer failed\n");
+		buffer->Recycle();
+		fAudioStats.buffers_dropped++;
+		count_metric(fCamDevice, CAM_METRIC_AUDIO_BUFFERS_DROPPED);
+		return false;
+	}
 
-		// Group 8: Periodic statistics report (every 30 seconds)
-		bigtime_t now = system_time();
-		if (now - fLastStatsReport > 30000000) {
-			LogAudioStats();
-			fLastStatsReport = now;
-		}
+	fAudioStats.buffers_sent++;
+	count_metric(fCamDevice, CAM_METRIC_AUDIO_BUFFERS_SENT);
+	return true;
+}
+
+
+// =============================================================================
+// Format Negotiation and Processing Stage
+// =============================================================================
+
+/* Everything the node can produce: the sample format, channel count, rate
+ * and buffer size are left open. */
+void
+AudioProducer::_OpenFormat(media_format* format) const
+{
+	format->type = B_MEDIA_RAW_AUDIO;
+	format->u.raw_audio = media_raw_audio_format::wildcard;
+	format->u.raw_audio.byte_order = B_MEDIA_HOST_ENDIAN;
+}
+
+
+/* Event latency is what sits downstream plus our own: a buffer's worth of
+ * audio and the USB transfer it arrives in, or the capture to send delay
+ * measured while running when that is longer. The device lays its audio
+ * transfers out for the same latency when stopped. */
+void
+AudioProducer::_UpdateLatency()
+{
+	bigtime_t internal = fProcessingLatency;
+	UVCCamDevice* uvcDev = dynamic_cast<UVCCamDevice*>(fCamDevice);
+	if (uvcDev != NULL && uvcDev->HasAudio()) {
+		uvcDev->SetAudioLatency(fProcessingLatency, fDownstreamLatency);
+		internal += uvcDev->AudioTransferLatency();
 	}
+	if (fCaptureLatency > internal)
+		internal = fCaptureLatency;
 
-	return 0;
+	fInternalLatency = internal;
+	SetEventLatency(fDownstreamLatency + internal);
+}
+
+
+/* Our own buffers: as many as the latency downstream holds, one being
+ * filled and two to spare. */
+int32
+AudioProducer::_BufferCount() const
+{
+	bigtime_t duration = max_c(fProcessingLatency, 1);
+	int64 count = (fDownstreamLatency + duration - 1) / duration + 3;
+	return (int32)max_c(AUDIO_MIN_BUFFER_COUNT,
+		min_c(count, AUDIO_MAX_BUFFER_COUNT));
+}
+
+
+/* What the system mixer works in: float at the device's own rate and
+ * channel count, so only the gain and conversion run by default. */
+void
+AudioProducer::_PreferredFormat(media_format* format) const
+{
+	format->type = B_MEDIA_RAW_AUDIO;
+	format->u.raw_audio = media_raw_audio_format::wildcard;
+	format->u.raw_audio.format = media_raw_audio_format::B_AUDIO_FLOAT;
+	format->u.raw_audio.byte_order = B_MEDIA_HOST_ENDIAN;
+	format->u.raw_audio.channel_count = fDeviceFormat.channel_count;
+	format->u.raw_audio.frame_rate = fDeviceFormat.frame_rate;
+	format->u.raw_audio.buffer_size = AUDIO_BUFFER_FRAMES * sizeof(float)
+		* fDeviceFormat.channel_count;
+}
+
+
+/* Fills the wildcards of a proposed format from the preferred one and
+ * checks that the processing stage can produce the rest. */
+status_t
+AudioProducer::_NegotiateFormat(media_format* format) const
+{
+	if (format->type != B_MEDIA_RAW_AUDIO)
+		return B_MEDIA_BAD_FORMAT;
+
+	media_format preferred;
+	_PreferredFormat(&preferred);
+	media_raw_audio_format& requested = format->u.raw_audio;
+	const media_raw_audio_format& wildcard = media_raw_audio_format::wildcard;
+
+	if (requested.format == wildcard.format)
+		requested.format = preferred.u.raw_audio.format;
+	if (requested.byte_order == wildcard.byte_order)
+		requested.byte_order = B_MEDIA_HOST_ENDIAN;
+	if (requested.channel_count == wildcard.channel_count)
+		requested.channel_count = preferred.u.raw_audio.channel_count;
+	if (requested.frame_rate == wildcard.frame_rate)
+		requested.frame_rate = preferred.u.raw_audio.frame_rate;
+
+	if ((requested.format != media_raw_audio_format::B_AUDIO_FLOAT
+			&& requested.format != media_raw_audio_format::B_AUDIO_SHORT)
+		|| requested.byte_order != B_MEDIA_HOST_ENDIAN)
+		return B_MEDIA_BAD_FORMAT;
+
+	// Mono, stereo, or whatever the device has
+	if (requested.channel_count != 1 && requested.channel_count != 2
+		&& requested.channel_count != fDeviceFormat.channel_count)
+		return B_MEDIA_BAD_FORMAT;
+	if (requested.channel_count > AudioResampler::kMaxChannels)
+		return B_MEDIA_BAD_FORMAT;
+
+	if (requested.frame_rate < AUDIO_MIN_RATE
+		|| requested.frame_rate > AUDIO_MAX_RATE)
+		return B_MEDIA_BAD_FORMAT;
+
+	size_t frameSize = (requested.format & 0x0F) * requested.channel_count;
+	if (requested.buffer_size == wildcard.buffer_size)
+		requested.buffer_size = AUDIO_BUFFER_FRAMES * frameSize;
+	if (requested.buffer_size < frameSize
+		|| requested.buffer_size % frameSize != 0
+		|| requested.buffer_size / frameSize > AUDIO_MAX_BUFFER_FRAMES)
+		return B_MEDIA_BAD_FORMAT;
+
+	return B_OK;
+}
+
+
+/* Sets the processing stage up for fConnectedFormat. The scratch buffers
+ * hold one output buffer's worth of device audio. */
+status_t
+AudioProducer::_SetUpDSP()
+{
+	_FreeDSP();
+
+	int32 deviceChannels = fDeviceFormat.channel_count;
+	int32 outputChannels = fConnectedFormat.channel_count;
+	size_t outputFrames = fConnectedFormat.buffer_size
+		/ ((fConnectedFormat.format & 0x0F) * outputChannels);
+
+	status_t status = fResampler.SetRates(fDeviceFormat.frame_rate,
+		fConnectedFormat.frame_rate, outputChannels);
+	if (status != B_OK)
+		return status;
+
+	fDSPDirect = fConnectedFormat.format == fDeviceFormat.format
+		&& outputChannels == deviceChannels && fResampler.IsPassthrough();
+	if (fDSPDirect) {
+		syslog(LOG_INFO, "AudioProducer: output is the device format, %d ch "
+			"%.0f Hz int16\n", (int)outputChannels,
+			fConnectedFormat.frame_rate);
+		return B_OK;
+	}
+
+	// InputFramesFor() never exceeds ceil(frames * step) + 3
+	fDSPInputFrames = (size_t)ceil(outputFrames * fResampler.Step()) + 4;
+	size_t inputSamples = fDSPInputFrames * deviceChannels;
+	size_t bytes = inputSamples * sizeof(int16)
+		+ inputSamples * sizeof(float)
+		+ fDSPInputFrames * outputChannels * sizeof(float)
+		+ outputFrames * outputChannels * sizeof(float);
+	fDSPBuffer = malloc(bytes);
+	if (fDSPBuffer == NULL) {
+		syslog(LOG_ERR, "AudioProducer: no memory for audio processing\n");
+		fDSPInputFrames = 0;
+		return B_NO_MEMORY;
+	}
+
+	// Floats first, so they stay aligned
+	fDSPFloat = (float*)fDSPBuffer;
+	fDSPMixed = fDSPFloat + inputSamples;
+	fDSPOutput = fDSPMixed + fDSPInputFrames * outputChannels;
+	fDSPInput = (int16*)(fDSPOutput + outputFrames * outputChannels);
+
+	syslog(LOG_INFO, "AudioProducer: converting %d ch %.0f Hz int16 to %d ch "
+		"%.0f Hz %s (%s kernels)\n", (int)deviceChannels,
+		fDeviceFormat.frame_rate, (int)outputChannels,
+		fConnectedFormat.frame_rate,
+		fConnectedFormat.format == media_raw_audio_format::B_AUDIO_FLOAT
+			? "float" : "int16", fDSP->name);
+	return B_OK;
+}
+
+
+void
+AudioProducer::_FreeDSP()
+{
+	free(fDSPBuffer);
+	fDSPBuffer = NULL;
+	fDSPInput = NULL;
+	fDSPFloat = NULL;
+	fDSPMixed = NULL;
+	fDSPOutput = NULL;
+	fDSPInputFrames = 0;
+	fDSPDirect = true;
+}
+
+
+/* Device bytes the next output buffer is made from. */
+size_t
+AudioProducer::_InputBytesFor(size_t framesPerBuffer) const
+{
+	size_t frames = framesPerBuffer;
+	if (!fDSPDirect) {
+		frames = fResampler.InputFramesFor((int32)framesPerBuffer);
+		if (frames > fDSPInputFrames)
+			frames = fDSPInputFrames;
+	}
+	return frames * 2 * fDeviceFormat.channel_count;
 }
 
 
@@ -981,4 +1344,14 @@ AudioProducer::LogAudioStats()
 	syslog(LOG_INFO, "AudioProducer levels: peak=%.3f rms=%.3f samples=%llu\n",
 		fAudioStats.peak_level, fAudioStats.rms_level,
 		(unsigned long long)fAudioStats.samples_processed);
+
+	UVCCamDevice* uvcDev = dynamic_cast<UVCCamDevice*>(fCamDevice);
+	if (uvcDev != NULL && uvcDev->HasAudio()) {
+		fAudioStats.drift_ppm = uvcDev->AudioDriftPPM();
+		syslog(LOG_INFO, "AudioProducer clock: drift=%d ppm capture "
+			"latency=%lld us (reported %lld us, transfers %lld us)\n",
+			(int)fAudioStats.drift_ppm, (long long)fCaptureLatency,
+			(long long)fInternalLatency,
+			(long long)uvcDev->AudioTransferLatency());
+	}
 }
@@ -15,7 +15,10 @@
 #include <media/MediaNode.h>
 #include <support/Locker.h>
 
+#include "AudioDSP.h"
+
 class CamDevice;
+class UVCCamDevice;
 
 
 // =============================================================================
@@ -36,6 +39,9 @@ struct audio_timing_stats {
 	uint32		underruns;		// No data available
 	uint32		overruns;		// Too much data
 
+	// Device sample clock against system_time()
+	int32		drift_ppm;
+
 	// Audio levels (RMS)
 	float		peak_level;		// Maximum absolute sample (0.0 - 1.0)
 	float		rms_level;		// Root mean square level
@@ -52,6 +58,7 @@ struct audio_timing_stats {
 		buffers_dropped = 0;
 		underruns = 0;
 		overruns = 0;
+		drift_ppm = 0;
 		peak_level = 0.0f;
 		rms_level = 0.0f;
 		rms_sum = 0.0;
@@ -209,15 +216,49 @@ static	int32				fInstances;
 		sem_id				fFrameSync;
 static	int32				_audio_generator_(void *data);
 		int32				AudioGenerator();
+		bool				_SendAudioBuffer(UVCCamDevice* device,
+								size_t framesPerBuffer,
+								bigtime_t bufferDuration);
+		bigtime_t			_BufferStartTime(bigtime_t captureTime,
+								bigtime_t bufferDuration);
+
+		// Format negotiation and the processing stage
+		void				_OpenFormat(media_format* format) const;
+		void				_PreferredFormat(media_format* format) const;
+		status_t			_NegotiateFormat(media_format* format) const;
+		status_t			_SetUpDSP();
+		void				_FreeDSP();
+		size_t				_InputBytesFor(size_t framesPerBuffer) const;
+
+		// Latency and the buffering it calls for
+		void				_UpdateLatency();
+		int32				_BufferCount() const;
 
 		// Audio timing
 		uint64				fFramesSent;
 		bigtime_t			fStartTime;
-		bigtime_t			fProcessingLatency;
+		bigtime_t			fProcessingLatency;	// one buffer
+		bigtime_t			fDownstreamLatency;
+		bigtime_t			fInternalLatency;	// reported as ours
+		bigtime_t			fCaptureLatency;	// capture stamp to send
+		bigtime_t			fNextStartTime;		// system time, for silence
 
 		// Output and format
 		media_output		fOutput;
 		media_raw_audio_format	fConnectedFormat;
+		media_raw_audio_format	fDeviceFormat;		// what the mic delivers
+
+		// Processing stage: int16 device audio to the connected format.
+		// fDSPDirect means the formats match and only gain is applied.
+		const audio_dsp_kernels*	fDSP;
+		AudioResampler		fResampler;
+		bool				fDSPDirect;
+		void*				fDSPBuffer;			// holds the scratch below
+		int16*				fDSPInput;			// device frames
+		float*				fDSPFloat;			// device frames, float
+		float*				fDSPMixed;			// output channels
+		float*				fDSPOutput;			// output frames, float
+		size_t				fDSPInputFrames;	// scratch capacity
 
 		// State flags
 		bool				fRunning;
@@ -234,13 +275,6 @@ static	int32				_audio_generator_(void *data);
 		float				fVolume;
 		bigtime_t			fLastParamChange;
 
-		// Audio buffer ring
-		uint8*				fAudioRingBuffer;
-		size_t				fRingBufferSize;
-		volatile size_t		fRingBufferHead;
-		volatile size_t		fRingBufferTail;
-		sem_id				fRingBufferSem;
-
 		// Group 8: Audio statistics
 		audio_timing_stats	fAudioStats;
 		bigtime_t			fLastStatsReport;
@@ -14,7 +14,6 @@
 #include "CamBufferingDeframer.h"
 #include "CamDevice.h"
 #include "CamDebug.h"
-#include <Autolock.h>
 #define MAX_TAG_LEN CAMDEFRAMER_MAX_TAG_LEN
 #define MAXFRAMEBUF CAMDEFRAMER_MAX_QUEUED_FRAMES
 
@@ -53,14 +52,15 @@ CamBufferingDeframer::Write(const void *buffer, size_t size)
 		return size; // not enough data anyway
 
 	if (!fCurrentFrame) {
-		BAutolock l(fLocker);
-		if (fFrames.CountItems() < MAXFRAMEBUF)
+		if (QueuedFrames() < MAXFRAMEBUF)
 			fCurrentFrame = AllocFrame();
 		else {
 			PRINT((CH "DROPPED %" B_PRIuSIZE " bytes! "
 				"(too many queued frames)" CT, size));
 			return size; // drop XXX
 		}
+		if (!fCurrentFrame)
+			return size; // arena pool drained
 	}
 
 	for (s = 0; (l - s > (int)fMinFrameSize) && ((i = FindSOF(b + s, l - fMinFrameSize - s, &which)) > -1); s++) {
@@ -94,13 +94,12 @@ CamBufferingDeframer::Write(const void *buffer, size_t size)
 			fCurrentFrame->Write(b + s, e - s);
 
 			// queue it
-			BAutolock f(fLocker);
 			PRINT((CH ": Detaching a frame (%" B_PRIuSIZE " bytes, "
 				"%d to %d / %d)" CT, (size_t)fCurrentFrame->Position(),
 				s, e, l));
 			fCurrentFrame->Seek(0LL, SEEK_SET);
-			fFrames.AddItem(fCurrentFrame);
-			release_sem(fFrameSem);
+			if (!QueueFrame(fCurrentFrame))
+				delete fCurrentFrame;
 			// next Write() will allocate a new one
 			fCurrentFrame = NULL;
 			// discard the frame and everything before it.
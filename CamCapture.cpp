@@ -0,0 +1,393 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * USB transfer capture: file format and background writer.
+ */
+
+
+#include "CamCapture.h"
+
+#include <Autolock.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "CamConfig.h"
+
+
+static const uint8 kPadding[8] = { 0 };
+
+
+static inline size_t
+capture_align(size_t size)
+{
+	return (size + 7) & ~(size_t)7;
+}
+
+
+CamCaptureWriter::CamCaptureWriter()
+	:
+	fFD(-1),
+	fRing(NULL),
+	fRingSize(0),
+	fLock("capture writer"),
+	fPut(0),
+	fHead(0),
+	fTail(0),
+	fWakeup(-1),
+	fWriter(-1),
+	fQuit(0),
+	fSequence(0),
+	fDroppedRecords(0),
+	fWriteErrors(0)
+{
+}
+
+
+CamCaptureWriter::~CamCaptureWriter()
+{
+	Close();
+}
+
+
+status_t
+CamCaptureWriter::Open(const char* path)
+{
+	if (IsOpen())
+		return EALREADY;
+
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return errno;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		status_t status = errno;
+		close(fd);
+		return status;
+	}
+	fFD = fd;
+
+	status_t status = B_OK;
+	if (st.st_size == 0) {
+		cam_capture_file_header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CAM_CAPTURE_MAGIC, sizeof(header.magic));
+		header.version = CAM_CAPTURE_VERSION;
+		header.header_size = sizeof(header);
+		header.created = real_time_clock_usecs();
+		if (write(fFD, &header, sizeof(header)) != (ssize_t)sizeof(header))
+			status = errno;
+	} else
+		status = _FindEnd(st.st_size);
+
+	fRingSize = CamConfig::kCaptureRingSize;
+	if (status == B_OK) {
+		fRing = (uint8*)malloc(fRingSize);
+		if (fRing == NULL)
+			status = B_NO_MEMORY;
+	}
+	if (status == B_OK) {
+		fWakeup = create_sem(0, "capture wakeup");
+		if (fWakeup < B_OK)
+			status = fWakeup;
+	}
+	if (status == B_OK) {
+		fQuit = 0;
+		fWriter = spawn_thread(_writer_thread_, "USB Webcam capture writer",
+			CamConfig::kPriorityCaptureWriter, this);
+		if (fWriter < B_OK)
+			status = fWriter;
+	}
+
+	if (status != B_OK) {
+		syslog(LOG_WARNING, "CamCaptureWriter: cannot capture to %s: %s\n",
+			path, strerror(status));
+		if (fWakeup >= B_OK)
+			delete_sem(fWakeup);
+		fWakeup = -1;
+		fWriter = -1;
+		free(fRing);
+		fRing = NULL;
+		close(fFD);
+		fFD = -1;
+		return status;
+	}
+
+	resume_thread(fWriter);
+	syslog(LOG_INFO, "CamCaptureWriter: capturing to %s (from sequence %u)\n",
+		path, (unsigned)fSequence);
+	return B_OK;
+}
+
+
+void
+CamCaptureWriter::Close()
+{
+	if (!IsOpen())
+		return;
+
+	// The writer drains what the pumps put in before it goes
+	atomic_set(&fQuit, 1);
+	release_sem(fWakeup);
+	status_t result;
+	wait_for_thread(fWriter, &result);
+	delete_sem(fWakeup);
+	fWakeup = -1;
+	fWriter = -1;
+
+	if (fDroppedRecords > 0 || fWriteErrors > 0) {
+		syslog(LOG_WARNING, "CamCaptureWriter: %d records dropped, %d write "
+			"errors\n", (int)fDroppedRecords, (int)fWriteErrors);
+	}
+
+	close(fFD);
+	fFD = -1;
+	free(fRing);
+	fRing = NULL;
+	fPut = fHead = fTail = 0;
+}
+
+
+void
+CamCaptureWriter::AddStream(uint8 stream, uint8 endpoint,
+	const cam_capture_stream_info& info)
+{
+	cam_capture_record record;
+	memset(&record, 0, sizeof(record));
+	record.magic = CAM_CAPTURE_RECORD_MAGIC;
+	record.size = capture_align(sizeof(record) + sizeof(info));
+	record.type = CAM_CAPTURE_STREAM_START;
+	record.stream = stream;
+	record.endpoint = endpoint;
+	record.data_size = sizeof(info);
+	record.submitted = record.completed = system_time();
+
+	if (!_Begin(record.size))
+		return;
+	record.sequence = fSequence++;
+	_Put(&record, sizeof(record));
+	_Put(&info, sizeof(info));
+	_End();
+}
+
+
+void
+CamCaptureWriter::AddTransfer(uint8 stream, uint8 endpoint,
+	const uint8* buffer, size_t slotSize,
+	const usb_iso_packet_descriptor* packets, int32 packetCount,
+	ssize_t status, bigtime_t submitted, bigtime_t completed)
+{
+	if (!IsOpen() || packetCount <= 0)
+		return;
+
+	// Only what the controller wrote to each slot is kept
+	size_t dataSize = 0;
+	for (int32 i = 0; i < packetCount; i++) {
+		size_t length = packets[i].actual_length;
+		dataSize += length < slotSize ? length : slotSize;
+	}
+
+	cam_capture_record record;
+	memset(&record, 0, sizeof(record));
+	record.magic = CAM_CAPTURE_RECORD_MAGIC;
+	record.size = capture_align(sizeof(record)
+		+ packetCount * sizeof(cam_capture_packet) + dataSize);
+	record.type = CAM_CAPTURE_TRANSFER;
+	record.stream = stream;
+	record.endpoint = endpoint;
+	record.packet_count = packetCount;
+	record.slot_size = slotSize;
+	record.status = status < 0 ? (int32)status : B_OK;
+	record.data_size = dataSize;
+	record.submitted = submitted;
+	record.completed = completed;
+
+	if (!_Begin(record.size))
+		return;
+	record.sequence = fSequence++;
+	_Put(&record, sizeof(record));
+	for (int32 i = 0; i < packetCount; i++) {
+		cam_capture_packet packet;
+		packet.status = packets[i].status;
+		packet.request_length = packets[i].request_length;
+		packet.actual_length = packets[i].actual_length;
+		_Put(&packet, sizeof(packet));
+	}
+	for (int32 i = 0; i < packetCount; i++) {
+		size_t length = packets[i].actual_length;
+		_Put(buffer + i * slotSize, length < slotSize ? length : slotSize);
+	}
+	_End();
+}
+
+
+void
+CamCaptureWriter::AddBulk(uint8 stream, uint8 endpoint, const uint8* buffer,
+	ssize_t length, bigtime_t submitted, bigtime_t completed)
+{
+	if (!IsOpen())
+		return;
+
+	size_t dataSize = length > 0 ? length : 0;
+
+	cam_capture_record record;
+	memset(&record, 0, sizeof(record));
+	record.magic = CAM_CAPTURE_RECORD_MAGIC;
+	record.size = capture_align(sizeof(record) + dataSize);
+	record.type = CAM_CAPTURE_TRANSFER;
+	record.stream = stream;
+	record.endpoint = endpoint;
+	record.slot_size = dataSize;
+	record.status = length < 0 ? (int32)length : B_OK;
+	record.data_size = dataSize;
+	record.submitted = submitted;
+	record.completed = completed;
+
+	if (!_Begin(record.size))
+		return;
+	record.sequence = fSequence++;
+	_Put(&record, sizeof(record));
+	_Put(buffer, dataSize);
+	_End();
+}
+
+
+bool
+CamCaptureWriter::_Begin(size_t size)
+{
+	if (!IsOpen())
+		return false;
+
+	fLock.Lock();
+	if (fPut + (int64)size - atomic_get64(&fTail) > (int64)fRingSize) {
+		// The sequence number still moves, so the gap shows in the file
+		fSequence++;
+		fLock.Unlock();
+		int32 dropped = atomic_add(&fDroppedRecords, 1) + 1;
+		if (dropped <= 5 || (dropped % 1000) == 0) {
+			syslog(LOG_WARNING, "CamCaptureWriter: ring full, dropped record "
+				"#%d\n", (int)dropped);
+		}
+		return false;
+	}
+	return true;
+}
+
+
+void
+CamCaptureWriter::_Put(const void* data, size_t size)
+{
+	size_t offset = fPut % fRingSize;
+	size_t first = fRingSize - offset < size ? fRingSize - offset : size;
+	memcpy(fRing + offset, data, first);
+	if (first < size)
+		memcpy(fRing, (const uint8*)data + first, size - first);
+	fPut += size;
+}
+
+
+void
+CamCaptureWriter::_End()
+{
+	_Put(kPadding, capture_align(fPut) - fPut);
+	atomic_set64(&fHead, fPut);
+	fLock.Unlock();
+	release_sem_etc(fWakeup, 1, B_DO_NOT_RESCHEDULE);
+}
+
+
+/* Appending: walks the records already in the file and cuts off a partly
+ * written one at the end, left by a crash. */
+status_t
+CamCaptureWriter::_FindEnd(off_t fileSize)
+{
+	cam_capture_file_header header;
+	if (pread(fFD, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+		|| memcmp(header.magic, CAM_CAPTURE_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != CAM_CAPTURE_VERSION
+		|| header.header_size < sizeof(header))
+		return B_BAD_DATA;
+
+	off_t end = header.header_size;
+	cam_capture_record record;
+	while (end + (off_t)sizeof(record) <= fileSize
+		&& pread(fFD, &record, sizeof(record), end)
+			== (ssize_t)sizeof(record)
+		&& record.magic == CAM_CAPTURE_RECORD_MAGIC
+		&& record.size >= sizeof(record)
+		&& end + record.size <= fileSize) {
+		fSequence = record.sequence + 1;
+		end += record.size;
+	}
+
+	if (end < fileSize) {
+		syslog(LOG_INFO, "CamCaptureWriter: dropping %lld bytes of a partial "
+			"record\n", (long long)(fileSize - end));
+		if (ftruncate(fFD, end) != 0)
+			return errno;
+	}
+	if (lseek(fFD, end, SEEK_SET) != end)
+		return errno;
+	return B_OK;
+}
+
+
+status_t
+CamCaptureWriter::_writer_thread_(void* data)
+{
+	((CamCaptureWriter*)data)->_WriterLoop();
+	return B_OK;
+}
+
+
+void
+CamCaptureWriter::_WriterLoop()
+{
+	while (true) {
+		// Wakes on records, the timeout only batches writes when the pumps
+		// are idle
+		acquire_sem_etc(fWakeup, 1, B_RELATIVE_TIMEOUT, 250000);
+		int32 count;
+		if (get_sem_count(fWakeup, &count) == B_OK && count > 0)
+			acquire_sem_etc(fWakeup, count, B_RELATIVE_TIMEOUT, 0);
+
+		_WriteOut();
+		if (atomic_get(&fQuit) != 0)
+			break;
+	}
+	_WriteOut();
+}
+
+
+void
+CamCaptureWriter::_WriteOut()
+{
+	int64 head = atomic_get64(&fHead);
+	int64 tail = fTail;
+
+	while (tail < head) {
+		size_t offset = tail % fRingSize;
+		size_t size = head - tail;
+		if (size > fRingSize - offset)
+			size = fRingSize - offset;
+
+		ssize_t written = write(fFD, fRing + offset, size);
+		if (written <= 0) {
+			// The space is freed anyway, or the pumps would drop from now on
+			if (atomic_add(&fWriteErrors, 1) < 1) {
+				syslog(LOG_WARNING, "CamCaptureWriter: write failed: %s\n",
+					strerror(written < 0 ? errno : B_IO_ERROR));
+			}
+			written = size;
+		}
+		tail += written;
+		atomic_set64(&fTail, tail);
+	}
+}
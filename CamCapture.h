@@ -0,0 +1,188 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * USB transfer capture: file format and background writer.
+ */
+#ifndef _CAM_CAPTURE_H
+#define _CAM_CAPTURE_H
+
+
+#include <Locker.h>
+#include <OS.h>
+#include <USB3.h>
+
+
+// =============================================================================
+// Capture File Format
+// =============================================================================
+// Every completed transfer of the video and audio endpoints, as the pumps
+// saw it, so a capture replays exactly what the deframer got: the transfer
+// result and times, each packet's status and lengths and the slot size that
+// places packets in the transfer buffer.
+//
+// Little-endian, everything 8 byte aligned, so a mapped file is walked in
+// place with cam_capture_next_record(). The file header comes once; records
+// follow until the end of the file, and a later session appends to it. A
+// record is a cam_capture_record, packet_count cam_capture_packets and
+// data_size bytes: the first actual_length bytes of each packet's slot, in
+// packet order, padded to 8.
+//
+// Enabled with WEBCAM_CAPTURE=<file> (the second camera writes <file>.1,
+// and so on).
+
+#define CAM_CAPTURE_MAGIC		"UVCCAPT"		// 8 bytes with the NUL
+#define CAM_CAPTURE_VERSION		1
+#define CAM_CAPTURE_RECORD_MAGIC	'CAPR'
+
+enum cam_capture_stream {
+	CAM_CAPTURE_VIDEO = 0,
+	CAM_CAPTURE_AUDIO
+};
+
+enum cam_capture_record_type {
+	CAM_CAPTURE_TRANSFER = 0,		// packets and their data
+	CAM_CAPTURE_STREAM_START		// data is a cam_capture_stream_info
+};
+
+struct cam_capture_file_header {
+	char			magic[8];
+	uint32			version;
+	uint32			header_size;
+	int64			created;			// real time, microseconds
+	uint32			reserved[10];
+};
+
+struct cam_capture_record {
+	uint32			magic;
+	uint32			size;				// all of it, padded to 8
+	uint8			type;				// cam_capture_record_type
+	uint8			stream;				// cam_capture_stream
+	uint8			endpoint;			// bEndpointAddress
+	uint8			reserved;
+	uint32			packet_count;		// 0 for bulk and stream records
+	uint32			slot_size;			// buffer bytes per packet
+	int32			status;				// transfer result, < 0 on error
+	uint32			data_size;
+	uint32			sequence;			// per file, gaps are dropped records
+	int64			submitted;			// system_time(), 0 if unknown
+	int64			completed;
+};
+
+struct cam_capture_packet {
+	int32			status;
+	uint16			request_length;
+	uint16			actual_length;
+};
+
+struct cam_capture_stream_info {
+	uint32			fourcc;				// 'YUY2', 'NV12', 'MJPG', 'PCM ' or 0
+	uint32			width;
+	uint32			height;
+	uint32			frame_interval;		// 100 ns units
+	uint32			clock_frequency;	// of PTS/SCR, Hz
+	uint32			sample_rate;
+	uint16			channels;
+	uint16			subframe_size;
+	uint32			bandwidth;			// bytes per (micro)frame, bulk:
+										// payload size
+};
+
+
+// Next record at *offset of a mapped capture, or NULL at its end or at a
+// damaged or partly written record. Starts past the file header.
+static inline const cam_capture_record*
+cam_capture_next_record(const uint8* base, size_t size, size_t* offset)
+{
+	if (*offset < sizeof(cam_capture_file_header))
+		*offset = sizeof(cam_capture_file_header);
+	if (*offset + sizeof(cam_capture_record) > size)
+		return NULL;
+
+	const cam_capture_record* record
+		= (const cam_capture_record*)(base + *offset);
+	if (record->magic != CAM_CAPTURE_RECORD_MAGIC
+		|| record->size < sizeof(cam_capture_record)
+		|| record->size > size - *offset
+		|| sizeof(cam_capture_record) + (size_t)record->packet_count
+			* sizeof(cam_capture_packet) + record->data_size > record->size)
+		return NULL;
+
+	*offset += record->size;
+	return record;
+}
+
+static inline const cam_capture_packet*
+cam_capture_packets(const cam_capture_record* record)
+{
+	return (const cam_capture_packet*)(record + 1);
+}
+
+static inline const uint8*
+cam_capture_data(const cam_capture_record* record)
+{
+	return (const uint8*)(cam_capture_packets(record) + record->packet_count);
+}
+
+
+// =============================================================================
+// Capture Writer
+// =============================================================================
+// The pumps copy records into a ring and go on; a writer thread well below
+// their priority drains it to the file. A record that does not fit in the ring is
+// dropped (and counted) rather than making a pump wait on the disk.
+
+class CamCaptureWriter {
+public:
+								CamCaptureWriter();
+								~CamCaptureWriter();
+
+								// Opens or appends to 'path'
+			status_t			Open(const char* path);
+			void				Close();
+			bool				IsOpen() const { return fFD >= 0; }
+
+			void				AddStream(uint8 stream, uint8 endpoint,
+									const cam_capture_stream_info& info);
+								// An ISO transfer: 'packetCount' slots of
+								// 'slotSize' bytes
+			void				AddTransfer(uint8 stream, uint8 endpoint,
+									const uint8* buffer, size_t slotSize,
+									const usb_iso_packet_descriptor* packets,
+									int32 packetCount, ssize_t status,
+									bigtime_t submitted, bigtime_t completed);
+			void				AddBulk(uint8 stream, uint8 endpoint,
+									const uint8* buffer, ssize_t length,
+									bigtime_t submitted, bigtime_t completed);
+
+			int32				DroppedRecords() const
+									{ return fDroppedRecords; }
+
+private:
+								// A record goes in between _Begin() and
+								// _End(), under fLock
+			bool				_Begin(size_t size);
+			void				_Put(const void* data, size_t size);
+			void				_End();
+			status_t			_FindEnd(off_t fileSize);
+	static	status_t			_writer_thread_(void* data);
+			void				_WriterLoop();
+			void				_WriteOut();
+
+			int					fFD;
+			uint8*				fRing;
+			size_t				fRingSize;
+			BLocker				fLock;			// between the two pumps
+			int64				fPut;			// next ring byte, under fLock
+			int64				fHead;			// complete records up to
+			int64				fTail;			// in the file up to
+			sem_id				fWakeup;
+			thread_id			fWriter;
+			int32				fQuit;
+			uint32				fSequence;
+			int32				fDroppedRecords;
+			int32				fWriteErrors;
+};
+
+
+#endif /* _CAM_CAPTURE_H */
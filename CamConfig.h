@@ -22,6 +22,9 @@ namespace CamConfig {
 static const size_t kUSBBufferSize			= 131072;	// 128KB receive buffer
 static const size_t kUSBMaxPacketSize		= 1024;		// Max isochronous packet
 static const size_t kUSBMaxTransfers		= 16;		// Concurrent transfers
+static const size_t kUSBIsoTransfersInFlight	= 4;	// Queued ISO transfers (<= kUSBMaxTransfers)
+static const size_t kUVCBulkTransferSize	= 2097152;	// 2MB, UVC bulk streaming
+static const size_t kUVCBulkTransfersInFlight	= 3;	// Queued bulk transfers
 
 // Retry configuration
 static const uint32 kUSBMaxRetries			= 3;
@@ -30,6 +33,35 @@ static const bigtime_t kUSBMaxDelay			= 1000000;	// 1s
 static const float kUSBBackoffMultiplier	= 2.0f;
 
 
+// =============================================================================
+// Thread Priorities
+// =============================================================================
+// Default priority of each pipeline stage (see CamThreadPolicy). The USB
+// pumps must beat everything else of the camera, or ISO transfers run dry;
+// producers come next, the CPU heavy decoders stay below real-time.
+
+static const int32 kPriorityAudioPump		= B_REAL_TIME_PRIORITY;			// 120
+static const int32 kPriorityVideoPump		= B_URGENT_PRIORITY;			// 110
+static const int32 kPriorityAudioProducer	= B_URGENT_PRIORITY - 5;		// 105
+static const int32 kPriorityVideoProducer	= B_REAL_TIME_DISPLAY_PRIORITY;	// 100
+static const int32 kPriorityDecoder			= B_URGENT_DISPLAY_PRIORITY;	// 20
+static const int32 kPriorityControlWorker	= B_NORMAL_PRIORITY;			// 10
+static const int32 kPriorityCaptureWriter	= B_NORMAL_PRIORITY;			// 10
+
+
+// =============================================================================
+// Negotiation Cache
+// =============================================================================
+// Probe/commit results kept per device and format (see UVCNegotiationCache)
+
+static const int32 kNegotiationCacheEntries	= 64;		// least recently used go
+static const char* const kNegotiationCacheFile	= "Media/uvc_webcam_negotiation";
+
+// Processing Unit control ranges kept per model (see UVCControlCache)
+static const int32 kControlCacheEntries		= 512;		// oldest go
+static const char* const kControlCacheFile	= "Media/uvc_webcam_controls";
+
+
 // =============================================================================
 // Frame Buffer Configuration
 // =============================================================================
@@ -54,6 +86,26 @@ static const bigtime_t kMinFrameTimeout			= 10000;	// 10ms
 static const bigtime_t kMaxFrameTimeout			= 500000;	// 500ms
 static const bigtime_t kDefaultFrameTimeout		= 100000;	// 100ms
 
+// Minimum spacing of queued SET_CUR batches (camera controls)
+static const bigtime_t kControlMinInterval	= 30000;	// 30ms
+
+// Oldest frame the bounded latency delivery policy still hands out
+static const bigtime_t kBoundedDeliveryMaxAge	= 100000;	// 100ms
+
+// Load shedding on late notices: at most this many frames dropped per one
+// kept, how long the consumer has to keep up before a step back, and how
+// much of the lateness is added to the event latency
+static const int32 kMaxFrameSkip				= 3;
+static const bigtime_t kLateRecoveryInterval	= 1000000;	// 1s
+static const bigtime_t kMaxLatenessPad			= 100000;	// 100ms
+
+// Producer output buffers: one per decoder, the decoded queue, and what the
+// consumer holds for its latency, within these bounds
+static const int32 kMinOutputBuffers			= 3;
+static const int32 kMaxOutputBuffers			= 16;
+// Decode and conversion cost assumed until frames have been timed
+static const bigtime_t kProcessingNsPerPixel	= 4;
+
 // Statistics reporting intervals
 static const bigtime_t kStatsReportInterval		= 30000000;	// 30s
 static const bigtime_t kErrorStatsWindow		= 5000000;	// 5s
@@ -68,6 +120,14 @@ static const float kPacketLossWarning		= 0.05f;	// 5%
 static const float kPacketLossAction		= 0.10f;	// 10%
 static const uint32 kMinPacketsForStats		= 100;
 
+// Bandwidth controller: frame rate steps stop at this rate, loss has to
+// stay below this fraction of the fallback threshold before a step back
+// up, and the wait for it doubles up to the maximum when a step up falls
+// straight back
+static const uint32 kDegradeMinFrameRate	= 5;		// fps
+static const float kRecoveryLossFraction	= 0.5f;
+static const bigtime_t kMaxRecoveryDelay	= 240000000;	// 4 min
+
 // Consecutive error thresholds
 static const uint32 kMaxConsecutiveErrors	= 20;
 static const uint32 kMaxRecoveryAttempts	= 5;
@@ -83,6 +143,11 @@ static const bigtime_t kLogTimeInterval		= 5000000;	// Or every 5s
 static const int32 kMaxInitialLogs			= 5;		// Initial log count
 
 
+// Ring between the pumps and the capture writer (WEBCAM_CAPTURE); about
+// 250ms of 1080p YUY2
+static const size_t kCaptureRingSize		= 16 * 1024 * 1024;
+
+
 // =============================================================================
 // Video Format Configuration
 // =============================================================================
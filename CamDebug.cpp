@@ -5,6 +5,7 @@
 
 #include "CamDebug.h"
 
+#include <OS.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
@@ -60,3 +61,149 @@ SetWebcamDebugLevel(webcam_debug_level level)
 		syslog(LOG_INFO, "[Webcam] Debug level changed to %d\n", level);
 	}
 }
+
+
+// =============================================================================
+// Stage Trace Ring
+// =============================================================================
+
+static const int32 kTraceRingSize = 512;	// power of two
+static const int32 kMaxTraceThreads = 16;
+
+struct trace_record {
+	bigtime_t	when;
+	uint32		event;
+	uint32		arg0;
+	uint32		arg1;
+};
+
+struct trace_ring {
+	int32			owner;		// thread_id, 0 while unclaimed
+	int32			count;		// records ever written (atomic)
+	trace_record	records[kTraceRingSize];
+};
+
+// Untouched rings stay in zero filled pages; a ring is only written by its
+// owner thread, the dump reads it racily, which is fine for diagnostics
+static trace_ring sTraceRings[kMaxTraceThreads];
+static __thread trace_ring* sThreadTraceRing = NULL;
+
+static const char* kTraceEventNames[WEBCAM_TRACE_EVENT_COUNT] = {
+	"transfer done",
+	"packet",
+	"frame complete",
+	"frame dropped",
+	"decode start",
+	"decode end",
+	"send buffer"
+};
+
+
+static trace_ring*
+claim_trace_ring()
+{
+	thread_id self = find_thread(NULL);
+	for (int32 i = 0; i < kMaxTraceThreads; i++) {
+		if (atomic_test_and_set(&sTraceRings[i].owner, self, 0) == 0)
+			return &sTraceRings[i];
+	}
+
+	// All claimed: take over the ring of a thread that has exited (the
+	// pump and decoder threads are respawned with every stream start)
+	for (int32 i = 0; i < kMaxTraceThreads; i++) {
+		int32 owner = atomic_get(&sTraceRings[i].owner);
+		thread_info info;
+		if (get_thread_info(owner, &info) == B_OK)
+			continue;
+		if (atomic_test_and_set(&sTraceRings[i].owner, self, owner) == owner) {
+			atomic_set(&sTraceRings[i].count, 0);
+			return &sTraceRings[i];
+		}
+	}
+	return NULL;
+}
+
+
+void
+WebcamTraceRecord(uint32 event, uint32 arg0, uint32 arg1)
+{
+	trace_ring* ring = sThreadTraceRing;
+	if (ring == NULL) {
+		ring = claim_trace_ring();
+		if (ring == NULL)
+			return;
+		sThreadTraceRing = ring;
+	}
+
+	int32 count = ring->count;
+	trace_record& record = ring->records[count & (kTraceRingSize - 1)];
+	record.when = system_time();
+	record.event = event;
+	record.arg0 = arg0;
+	record.arg1 = arg1;
+	atomic_set(&ring->count, count + 1);
+}
+
+
+struct trace_dump_entry {
+	trace_record	record;
+	int32			thread;
+	int32			index;		// keeps a thread's events in order
+};
+
+
+static int
+compare_trace_entries(const void* _a, const void* _b)
+{
+	const trace_dump_entry* a = (const trace_dump_entry*)_a;
+	const trace_dump_entry* b = (const trace_dump_entry*)_b;
+	if (a->record.when != b->record.when)
+		return a->record.when < b->record.when ? -1 : 1;
+	if (a->thread != b->thread)
+		return a->thread < b->thread ? -1 : 1;
+	return a->index - b->index;
+}
+
+
+void
+DumpWebcamTrace()
+{
+	trace_dump_entry* entries = (trace_dump_entry*)malloc(
+		sizeof(trace_dump_entry) * kTraceRingSize * kMaxTraceThreads);
+	if (entries == NULL)
+		return;
+
+	int32 total = 0;
+	for (int32 i = 0; i < kMaxTraceThreads; i++) {
+		trace_ring& ring = sTraceRings[i];
+		int32 owner = atomic_get(&ring.owner);
+		int32 count = atomic_get(&ring.count);
+		if (owner == 0 || count == 0)
+			continue;
+
+		int32 first = count > kTraceRingSize ? count - kTraceRingSize : 0;
+		for (int32 j = first; j < count; j++) {
+			entries[total].record = ring.records[j & (kTraceRingSize - 1)];
+			entries[total].thread = owner;
+			entries[total].index = j;
+			total++;
+		}
+	}
+
+	qsort(entries, total, sizeof(trace_dump_entry), compare_trace_entries);
+
+	syslog(LOG_INFO, "[Webcam] Trace: %d events\n", (int)total);
+	bigtime_t start = total > 0 ? entries[0].record.when : 0;
+	bigtime_t previous = start;
+	for (int32 i = 0; i < total; i++) {
+		const trace_record& record = entries[i].record;
+		const char* name = record.event < WEBCAM_TRACE_EVENT_COUNT
+			? kTraceEventNames[record.event] : "?";
+		syslog(LOG_INFO, "[Webcam] %8lld us (+%5lld) thread %d: %s %u %u\n",
+			record.when - start, record.when - previous,
+			(int)entries[i].thread, name, record.arg0, record.arg1);
+		previous = record.when;
+	}
+
+	free(entries);
+}
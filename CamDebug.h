@@ -6,6 +6,7 @@
 #define _CAM_DEBUG_H
 
 #include <Debug.h>
+#include <SupportDefs.h>
 #include <syslog.h>
 
 /* Debug logging control - comment out to disable verbose logging */
@@ -61,6 +62,37 @@ void SetWebcamDebugLevel(webcam_debug_level level);
 #define WEBCAM_TRACE(format, ...) WEBCAM_LOG(WEBCAM_DEBUG_TRACE, "TRACE: %s: " format, __FUNCTION__, ##__VA_ARGS__)
 
 
+// Stage trace ring
+//
+// Lock-free per-thread rings of compact timestamped events, for timing the
+// capture pipeline stage by stage without syslog() in the hot paths. Each
+// thread records into a ring of its own, so recording is a few stores.
+// Enabled at WEBCAM_DEBUG=trace; DumpWebcamTrace() writes the merged
+// timeline to syslog (on stream stop, or on request through the node's
+// WEBCAM_MSG_DUMP_TRACE message).
+enum webcam_trace_event {
+	WEBCAM_TRACE_TRANSFER_DONE = 0,	// bytes, transfer slot
+	WEBCAM_TRACE_PACKET,			// payload bytes, header flags
+	WEBCAM_TRACE_FRAME_COMPLETE,	// frame bytes, packets
+	WEBCAM_TRACE_FRAME_DROPPED,		// frame bytes, packets
+	WEBCAM_TRACE_DECODE_START,		// frame bytes, sequence
+	WEBCAM_TRACE_DECODE_END,		// status, sequence
+	WEBCAM_TRACE_SEND_BUFFER,		// status, field sequence
+	WEBCAM_TRACE_EVENT_COUNT
+};
+
+#define WEBCAM_MSG_DUMP_TRACE	'wtrd'
+
+void WebcamTraceRecord(uint32 event, uint32 arg0, uint32 arg1);
+void DumpWebcamTrace();
+
+#define WEBCAM_TRACE_EVENT(event, arg0, arg1) \
+	do { \
+		if (gWebcamDebugLevel >= WEBCAM_DEBUG_TRACE) \
+			WebcamTraceRecord((event), (uint32)(arg0), (uint32)(arg1)); \
+	} while (0)
+
+
 /* Conditional debug macros (legacy) */
 #ifdef DEBUG_LOGGING
 #define DEBUG_PRINT(x) fprintf x
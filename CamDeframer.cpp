@@ -7,18 +7,171 @@
 #include "CamDeframer.h"
 #include "CamDevice.h"
 #include "CamDebug.h"
+#include "CamFrameArena.h"
 #include <Autolock.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
 #define MAX_TAG_LEN CAMDEFRAMER_MAX_TAG_LEN
 #define MAXFRAMEBUF CAMDEFRAMER_MAX_QUEUED_FRAMES
 
 
+CamFrame::CamFrame()
+	: BPositionIO(),
+	fArena(NULL),
+	fData(NULL),
+	fCapacity(0),
+	fLength(0),
+	fPosition(0)
+{
+	fStamp = system_time();
+	fArrival = 0;
+	fCompleted = 0;
+	cam_jpeg_index_reset(&fJpegIndex);
+}
+
+
+CamFrame::CamFrame(CamFrameArena *arena, void *slot, size_t capacity)
+	: BPositionIO(),
+	fArena(arena),
+	fData((uint8 *)slot),
+	fCapacity(capacity),
+	fLength(0),
+	fPosition(0)
+{
+	fStamp = system_time();
+	fArrival = 0;
+	fCompleted = 0;
+	cam_jpeg_index_reset(&fJpegIndex);
+}
+
+
+CamFrame::~CamFrame()
+{
+	if (fArena != NULL)
+		fArena->ReleaseSlot(fData);
+	else
+		free(fData);
+}
+
+
+status_t
+CamFrame::Reserve(size_t capacity)
+{
+	if (capacity <= fCapacity)
+		return B_OK;
+	if (fArena != NULL)
+		return B_NO_MEMORY;
+	uint8 *data = (uint8 *)realloc(fData, capacity);
+	if (data == NULL)
+		return B_NO_MEMORY;
+	fData = data;
+	fCapacity = capacity;
+	return B_OK;
+}
+
+
+ssize_t
+CamFrame::ReadAt(off_t pos, void *buffer, size_t size)
+{
+	if (pos < 0)
+		return B_BAD_VALUE;
+	if ((size_t)pos >= fLength)
+		return 0;
+	if (size > fLength - (size_t)pos)
+		size = fLength - (size_t)pos;
+	memcpy(buffer, fData + pos, size);
+	return size;
+}
+
+
+ssize_t
+CamFrame::WriteAt(off_t pos, const void *buffer, size_t size)
+{
+	if (pos < 0)
+		return B_BAD_VALUE;
+	size_t end = (size_t)pos + size;
+	if (end > fCapacity) {
+		// grow geometrically so a frame only reallocates a few times
+		// before it settles at the stream's frame size
+		size_t capacity = fCapacity * 2;
+		if (capacity < end)
+			capacity = end;
+		if (Reserve(capacity) != B_OK)
+			return B_NO_MEMORY;
+	}
+	if (fLength == 0 && size > 0)
+		fArrival = system_time();
+	memcpy(fData + pos, buffer, size);
+	if (end > fLength)
+		fLength = end;
+	return size;
+}
+
+
+off_t
+CamFrame::Seek(off_t position, uint32 seek_mode)
+{
+	switch (seek_mode) {
+		case SEEK_SET:
+			fPosition = position;
+			break;
+		case SEEK_CUR:
+			fPosition += position;
+			break;
+		case SEEK_END:
+			fPosition = fLength + position;
+			break;
+		default:
+			return B_BAD_VALUE;
+	}
+	if (fPosition < 0)
+		fPosition = 0;
+	return fPosition;
+}
+
+
+off_t
+CamFrame::Position() const
+{
+	return fPosition;
+}
+
+
+status_t
+CamFrame::SetSize(off_t size)
+{
+	if (size < 0)
+		return B_BAD_VALUE;
+	// storage is kept, only the logical length changes
+	if ((size_t)size > fCapacity && Reserve(size) != B_OK)
+		return B_NO_MEMORY;
+	fLength = size;
+	if (size == 0)
+		cam_jpeg_index_reset(&fJpegIndex);
+	return B_OK;
+}
+
+
 CamDeframer::CamDeframer(CamDevice *device)
 	: CamFilterInterface(device),
 	fDevice(device),
 	fState(ST_SYNC),
 	fFrameSem(B_ERROR),
-	fLocker("CamDeframer Framelist lock", true),
+	fFrameIndex(CAMDEFRAMER_MAX_QUEUED_FRAMES + 1),
+	fFramePoolIndex(CAMDEFRAMER_FRAME_POOL_SIZE + 1),
+	fReadLock("CamDeframer read lock", true),
+	fRecycleLock("CamDeframer recycle lock", true),
+	fDeliveryPolicy(FRAME_DELIVERY_FIFO),
+	fMaxFrameAge(CamConfig::kBoundedDeliveryMaxAge),
+	fPolicyDrops(0),
+	fWakeupDebt(0),
+	fFrameSkip(0),
+	fSkipPhase(0),
+	fSkipDrops(0),
+	fArena(NULL),
+	fArenaClass(-1),
 	fPoolHits(0),
 	fPoolMisses(0),
 	fSOFTags(NULL),
@@ -28,10 +181,14 @@ CamDeframer::CamDeframer(CamDevice *device)
 	fLenSOFTags(0),
 	fLenEOFTags(0),
 	fSkipSOFTags(0),
-	fSkipEOFTags(0)
+	fSkipEOFTags(0),
+	fNextTagSet(0)
 {
-	fMinFrameSize = fDevice->MinRawFrameSize();
-	fMaxFrameSize = fDevice->MaxRawFrameSize();
+	cam_tag_set_init(&fTagSets[0], NULL, 0, 0);
+	cam_tag_set_init(&fTagSets[1], NULL, 0, 0);
+	// No device when the benchmark replays a recording
+	fMinFrameSize = fDevice != NULL ? fDevice->MinRawFrameSize() : 0;
+	fMaxFrameSize = fDevice != NULL ? fDevice->MaxRawFrameSize() : 0;
 	fFrameSem = create_sem(0, "CamDeframer sem");
 	fCurrentFrame = AllocFrame();
 }
@@ -40,22 +197,22 @@ CamDeframer::CamDeframer(CamDevice *device)
 CamDeframer::~CamDeframer()
 {
 	delete_sem(fFrameSem);
-	BAutolock l(fLocker);
 
 	// Delete current frame
 	delete fCurrentFrame;
 	fCurrentFrame = NULL;
 
 	// Delete all queued frames
-	while (fFrames.CountItems() > 0) {
-		CamFrame* frame = (CamFrame*)fFrames.RemoveItem((int32)0);
-		delete frame;
+	int32 index;
+	while ((index = fFrameIndex.ReserveRead()) >= 0) {
+		delete fFrames[index];
+		fFrameIndex.CommitRead();
 	}
 
 	// Delete all pooled frames
-	while (fFramePool.CountItems() > 0) {
-		CamFrame* frame = (CamFrame*)fFramePool.RemoveItem((int32)0);
-		delete frame;
+	while ((index = fFramePoolIndex.ReserveRead()) >= 0) {
+		delete fFramePool[index];
+		fFramePoolIndex.CommitRead();
 	}
 
 	// Log pool statistics
@@ -63,8 +220,9 @@ CamDeframer::~CamDeframer()
 		float hitRate = (fPoolHits + fPoolMisses) > 0
 			? 100.0f * fPoolHits / (fPoolHits + fPoolMisses)
 			: 0.0f;
-		syslog(LOG_INFO, "CamDeframer: Pool stats - hits=%d misses=%d (%.1f%% reuse)\n",
-			(int)fPoolHits, (int)fPoolMisses, hitRate);
+		syslog(LOG_INFO, "CamDeframer: Pool stats - hits=%d misses=%d (%.1f%% reuse), "
+			"%d dropped by delivery policy\n",
+			(int)fPoolHits, (int)fPoolMisses, hitRate, (int)fPolicyDrops);
 	}
 }
 
@@ -72,44 +230,44 @@ CamDeframer::~CamDeframer()
 ssize_t
 CamDeframer::Read(void *buffer, size_t size)
 {
-	BAutolock l(fLocker);
-	CamFrame *f = (CamFrame *)fFrames.ItemAt(0);
-	if (!f)
+	BAutolock l(fReadLock);
+	int32 index = fFrameIndex.ReserveRead();
+	if (index < 0)
 		return EIO;
-	return f->Read(buffer, size);
+	return fFrames[index]->Read(buffer, size);
 }
 
 
 ssize_t
 CamDeframer::ReadAt(off_t pos, void *buffer, size_t size)
 {
-	BAutolock l(fLocker);
-	CamFrame *f = (CamFrame *)fFrames.ItemAt(0);
-	if (!f)
+	BAutolock l(fReadLock);
+	int32 index = fFrameIndex.ReserveRead();
+	if (index < 0)
 		return EIO;
-	return f->ReadAt(pos, buffer, size);
+	return fFrames[index]->ReadAt(pos, buffer, size);
 }
 
 
 off_t
 CamDeframer::Seek(off_t position, uint32 seek_mode)
 {
-	BAutolock l(fLocker);
-	CamFrame *f = (CamFrame *)fFrames.ItemAt(0);
-	if (!f)
+	BAutolock l(fReadLock);
+	int32 index = fFrameIndex.ReserveRead();
+	if (index < 0)
 		return EIO;
-	return f->Seek(position, seek_mode);
+	return fFrames[index]->Seek(position, seek_mode);
 }
 
 
 off_t
 CamDeframer::Position() const
 {
-	BAutolock l((BLocker &)fLocker); // need to get rid of const here
-	CamFrame *f = (CamFrame *)fFrames.ItemAt(0);
-	if (!f)
+	BAutolock l((BLocker &)fReadLock); // need to get rid of const here
+	int32 index = ((RingBufferIndex &)fFrameIndex).ReserveRead();
+	if (index < 0)
 		return EIO;
-	return f->Position();
+	return fFrames[index]->Position();
 }
 
 
@@ -154,7 +312,22 @@ CamDeframer::WaitFrame(bigtime_t timeout)
 			syslog(LOG_ERR, "CamDeframer::WaitFrame: INVALID semaphore id=%d\n", fFrameSem);
 		}
 	}
-	return acquire_sem_etc(fFrameSem, 1, B_RELATIVE_TIMEOUT, timeout);
+	while (true) {
+		status_t err = acquire_sem_etc(fFrameSem, 1, B_RELATIVE_TIMEOUT,
+			timeout);
+
+		// The wakeup may belong to a frame the delivery policy dropped
+		// before its count could be taken back; absorb it and keep waiting
+		while (err == B_OK && fFrameIndex.IsEmpty()
+			&& atomic_get(&fWakeupDebt) > 0) {
+			atomic_add(&fWakeupDebt, -1);
+			err = acquire_sem_etc(fFrameSem, 1, B_RELATIVE_TIMEOUT, timeout);
+		}
+
+		// A shed frame used up this wakeup; wait for the next one
+		if (err != B_OK || !_ShedFrame())
+			return err;
+	}
 }
 
 
@@ -162,10 +335,13 @@ status_t
 CamDeframer::GetFrame(CamFrame **frame, bigtime_t *stamp)
 {
 	PRINT((CH "()" CT));
-	BAutolock l(fLocker);
-	CamFrame *f = (CamFrame *)fFrames.RemoveItem((int32)0);
-	if (!f)
+	BAutolock l(fReadLock);
+	_ApplyDeliveryPolicy();
+	int32 index = fFrameIndex.ReserveRead();
+	if (index < 0)
 		return ENOENT;
+	CamFrame *f = fFrames[index];
+	fFrameIndex.CommitRead();
 	*frame = f;
 	*stamp = f->Stamp();
 	return B_OK;
@@ -176,11 +352,13 @@ status_t
 CamDeframer::DropFrame()
 {
 	PRINT((CH "()" CT));
-	BAutolock l(fLocker);
-	CamFrame *f = (CamFrame *)fFrames.RemoveItem((int32)0);
-	if (!f)
+	BAutolock l(fReadLock);
+	int32 index = fFrameIndex.ReserveRead();
+	if (index < 0)
 		return ENOENT;
-	delete f;
+	CamFrame *f = fFrames[index];
+	fFrameIndex.CommitRead();
+	RecycleFrame(f);
 	return B_OK;
 }
 
@@ -188,12 +366,14 @@ CamDeframer::DropFrame()
 status_t
 CamDeframer::Flush()
 {
-	BAutolock l(fLocker);
-
-	// Clear all pending frames from queue
-	while (fFrames.CountItems() > 0) {
-		CamFrame *f = (CamFrame *)fFrames.RemoveItem((int32)0);
-		delete f;
+	BAutolock l(fReadLock);
+
+	// Clear all pending frames from queue, keeping their storage pooled
+	int32 index;
+	while ((index = fFrameIndex.ReserveRead()) >= 0) {
+		CamFrame *f = fFrames[index];
+		fFrameIndex.CommitRead();
+		RecycleFrame(f);
 	}
 
 	// Reset current frame
@@ -205,6 +385,7 @@ CamDeframer::Flush()
 	// Reset semaphore by acquiring any pending counts
 	while (acquire_sem_etc(fFrameSem, 1, B_RELATIVE_TIMEOUT, 0) == B_OK)
 		;
+	atomic_set(&fWakeupDebt, 0);
 
 	fState = ST_SYNC;
 	return B_OK;
@@ -248,6 +429,20 @@ CamDeframer::RegisterEOFTags(const uint8 **tags, int count, size_t len, size_t s
 int
 CamDeframer::FindTags(const uint8 *buf, size_t buflen, const uint8 **tags, int tagcount, size_t taglen, size_t skiplen, int *which)
 {
+	cam_tag_set *set = NULL;
+	for (int i = 0; i < 2; i++) {
+		if (cam_tag_set_is(fTagSets[i], tags, tagcount, taglen))
+			set = &fTagSets[i];
+	}
+	if (set == NULL) {
+		set = &fTagSets[fNextTagSet];
+		fNextTagSet ^= 1;
+		cam_tag_set_init(set, tags, tagcount, taglen);
+	}
+	if (set->tags != NULL)
+		return cam_tag_find(*set, buf, buflen, skiplen, which);
+
+	// Too many tags to index, or empty ones
 	int i, t;
 	// Prevent unsigned underflow if buflen < skiplen
 	if (buflen < skiplen)
@@ -282,24 +477,28 @@ CamDeframer::FindEOF(const uint8 *buf, size_t buflen, int *which)
 CamFrame *
 CamDeframer::AllocFrame()
 {
-	BAutolock l(fLocker);
-
-	// Try to reuse a frame from the pool first
-	if (fFramePool.CountItems() > 0) {
-		CamFrame* frame = (CamFrame*)fFramePool.RemoveItem(
-			fFramePool.CountItems() - 1);
+	// Try to reuse a frame from the pool first. Only the USB thread
+	// takes from the pool, so this needs no lock.
+	int32 index = fFramePoolIndex.ReserveRead();
+	if (index >= 0) {
+		CamFrame* frame = fFramePool[index];
+		fFramePoolIndex.CommitRead();
 		if (frame != NULL) {
 			// Reset frame for reuse
 			frame->Seek(0, SEEK_SET);
 			frame->SetSize(0);
 			frame->fStamp = system_time();
 			fPoolHits++;
+			_CountMetric(CAM_METRIC_POOL_HITS);
 			return frame;
 		}
 	}
 
 	// No pooled frame available, allocate new one
 	fPoolMisses++;
+	_CountMetric(CAM_METRIC_POOL_MISSES);
+	if (fArena != NULL)
+		return NULL;
 	return new CamFrame();
 }
 
@@ -310,14 +509,24 @@ CamDeframer::RecycleFrame(CamFrame* frame)
 	if (frame == NULL)
 		return;
 
-	BAutolock l(fLocker);
+	// Decoder threads recycle concurrently; they only contend with each
+	// other, never with the USB thread
+	BAutolock l(fRecycleLock);
+
+	// A heap frame from before the arena was set up
+	if (frame->Arena() != fArena) {
+		delete frame;
+		return;
+	}
 
 	// Add to pool if not full, otherwise delete
-	if (fFramePool.CountItems() < CAMDEFRAMER_FRAME_POOL_SIZE) {
+	int32 index = fFramePoolIndex.ReserveWrite();
+	if (index >= 0) {
 		// Reset and add to pool
 		frame->Seek(0, SEEK_SET);
 		frame->SetSize(0);
-		fFramePool.AddItem(frame);
+		fFramePool[index] = frame;
+		fFramePoolIndex.CommitWrite();
 	} else {
 		// Pool full, delete the frame
 		delete frame;
@@ -325,10 +534,181 @@ CamDeframer::RecycleFrame(CamFrame* frame)
 }
 
 
+status_t
+CamDeframer::SetFrameArena(CamFrameArena *arena, int32 sizeClass)
+{
+	// Queued frames go back to the pool, then the pool is emptied
+	Flush();
+
+	delete fCurrentFrame;
+	fCurrentFrame = NULL;
+
+	int32 index;
+	while ((index = fFramePoolIndex.ReserveRead()) >= 0) {
+		delete fFramePool[index];
+		fFramePoolIndex.CommitRead();
+	}
+
+	{
+		// Decoders recycle frames of the previous arena while the stream
+		// switches sizes; those have to be told apart
+		BAutolock l(fRecycleLock);
+		fArena = arena;
+		fArenaClass = sizeClass;
+	}
+
+	int32 count = 0;
+	if (arena != NULL) {
+		size_t capacity = arena->SlotSize(sizeClass);
+		while (count < PoolCapacity()) {
+			void *slot = arena->AcquireSlot(sizeClass);
+			if (slot == NULL)
+				break;
+			CamFrame *frame = new(std::nothrow) CamFrame(arena, slot,
+				capacity);
+			if (frame == NULL) {
+				arena->ReleaseSlot(slot);
+				break;
+			}
+			RecycleFrame(frame);
+			count++;
+		}
+		syslog(LOG_INFO, "CamDeframer: %d arena frames of %zu bytes\n",
+			(int)count, capacity);
+	}
+
+	fCurrentFrame = AllocFrame();
+
+	if (arena != NULL && count == 0) {
+		// Nothing to stream into; fall back to heap frames
+		fArena = NULL;
+		fCurrentFrame = AllocFrame();
+		return B_NO_MEMORY;
+	}
+	return B_OK;
+}
+
+
+bool
+CamDeframer::QueueFrame(CamFrame *frame)
+{
+	// Only the USB thread queues, so no lock: the slot is written before
+	// CommitWrite() publishes it to the reader
+	int32 index = fFrameIndex.ReserveWrite();
+	if (index < 0) {
+		_CountMetric(CAM_METRIC_DEFRAMER_DROPS);
+		return false;
+	}
+	bigtime_t arrival = frame->fArrival;
+	frame->fCompleted = system_time();
+	bigtime_t assembly = frame->fCompleted - arrival;
+	fFrames[index] = frame;
+	fFrameIndex.CommitWrite();
+	release_sem_etc(fFrameSem, 1, B_DO_NOT_RESCHEDULE);
+	_CountMetric(CAM_METRIC_FRAMES_ASSEMBLED);
+	if (fDevice != NULL && arrival > 0)
+		fDevice->Metrics().RecordLatency(CAM_LATENCY_ASSEMBLY, assembly);
+	return true;
+}
+
+
+int32
+CamDeframer::QueuedFrames() const
+{
+	return fFrameIndex.Count();
+}
+
+
+void
+CamDeframer::_CountMetric(cam_metric metric, int64 delta)
+{
+	if (fDevice != NULL)
+		fDevice->Metrics().Add(metric, delta);
+}
+
+
+void
+CamDeframer::SetDeliveryPolicy(frame_delivery_policy policy, bigtime_t maxAge)
+{
+	BAutolock l(fReadLock);
+	fDeliveryPolicy = policy;
+	fMaxFrameAge = maxAge;
+	syslog(LOG_INFO, "CamDeframer: delivery policy %d (max age %lld us)\n",
+		(int)policy, maxAge);
+}
+
+
+void
+CamDeframer::SetFrameSkip(int32 skip)
+{
+	if (skip < 0)
+		skip = 0;
+	if (atomic_get_and_set(&fFrameSkip, skip) != skip) {
+		syslog(LOG_INFO, "CamDeframer: frame skip %d (%d shed so far)\n",
+			(int)skip, (int)fSkipDrops);
+	}
+}
+
+
+/* Called from WaitFrame() with one frame's fFrameSem count taken. Drops
+ * the oldest queued frame if the frame skip says so; true if it did. */
+bool
+CamDeframer::_ShedFrame()
+{
+	int32 skip = atomic_get(&fFrameSkip);
+	if (skip <= 0)
+		return false;
+
+	BAutolock l(fReadLock);
+	if (++fSkipPhase > skip) {
+		fSkipPhase = 0;
+		return false;
+	}
+	int32 index = fFrameIndex.ReserveRead();
+	if (index < 0)
+		return false;
+	CamFrame *f = fFrames[index];
+	fFrameIndex.CommitRead();
+	RecycleFrame(f);
+	fSkipDrops++;
+	_CountMetric(CAM_METRIC_SHED_DROPS);
+	return true;
+}
+
+
+/* Called with fReadLock held, before a frame is taken. The newest frame is
+ * never dropped, so a slow reader still gets a picture. */
+void
+CamDeframer::_ApplyDeliveryPolicy()
+{
+	if (fDeliveryPolicy == FRAME_DELIVERY_FIFO)
+		return;
+
+	bigtime_t now = system_time();
+	while (fFrameIndex.Count() > 1) {
+		int32 index = fFrameIndex.ReserveRead();
+		CamFrame *f = fFrames[index];
+		if (fDeliveryPolicy == FRAME_DELIVERY_BOUNDED
+			&& now - f->Stamp() <= fMaxFrameAge)
+			break;
+		fFrameIndex.CommitRead();
+
+		// Each queued frame holds one fFrameSem count; take the dropped
+		// frame's back so WaitFrame() does not wake for it
+		if (acquire_sem_etc(fFrameSem, 1, B_RELATIVE_TIMEOUT, 0) != B_OK)
+			atomic_add(&fWakeupDebt, 1);
+
+		RecycleFrame(f);
+		fPolicyDrops++;
+		_CountMetric(CAM_METRIC_POLICY_DROPS);
+	}
+}
+
+
 int32
 CamDeframer::PoolSize() const
 {
-	return fFramePool.CountItems();
+	return fFramePoolIndex.Count();
 }
 
 
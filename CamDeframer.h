@@ -8,9 +8,14 @@
 #include <OS.h>
 #include <DataIO.h>
 #include <Locker.h>
-#include <List.h>
+#include "CamConfig.h"
 #include "CamFilterInterface.h"
+#include "CamJpegIndex.h"
+#include "CamMetrics.h"
+#include "CamTagSearch.h"
+#include "CamUtils.h"
 class CamDevice;
+class CamFrameArena;
 
 #define CAMDEFRAMER_MAX_TAG_LEN 16
 // Increased from 5 to 8 to reduce queue overflow during USB/Producer latency spikes
@@ -24,14 +29,56 @@ ST_SYNC, /* waiting for start of frame */
 ST_FRAME
 };
 
+/* Which queued frame GetFrame() hands out. Frames skipped by a policy go
+ * straight back to the pool, undecoded. */
+enum frame_delivery_policy {
+	FRAME_DELIVERY_FIFO = 0,	// every frame, oldest first
+	FRAME_DELIVERY_LATEST,		// newest frame, older ones are dropped
+	FRAME_DELIVERY_BOUNDED		// oldest frame not older than the max age
+};
+
 
-/* should have a real Frame class someday */
-class CamFrame : public BMallocIO {
+/* A frame buffer that keeps its storage across SetSize(0), so pooled frames
+ * can be filled in place by the deframers without reallocating.
+ * Buffer()/BufferLength() mirror BMallocIO for existing readers.
+ * A frame built on an arena slot has fixed capacity: writes past it fail
+ * instead of growing, and the slot goes back to the arena on delete. */
+class CamFrame : public BPositionIO {
 public:
-			CamFrame() : BMallocIO() { fStamp = system_time(); };
-virtual		~CamFrame() {};
+			CamFrame();
+			CamFrame(CamFrameArena *arena, void *slot, size_t capacity);
+virtual		~CamFrame();
+
+virtual ssize_t		ReadAt(off_t pos, void *buffer, size_t size);
+virtual ssize_t		WriteAt(off_t pos, const void *buffer, size_t size);
+virtual off_t		Seek(off_t position, uint32 seek_mode);
+virtual off_t		Position() const;
+virtual status_t	SetSize(off_t size);
+
+const void*			Buffer() const { return fData; };
+size_t				BufferLength() const { return fLength; };
+size_t				Capacity() const { return fCapacity; };
+					// grow storage ahead of time, never shrinks
+status_t			Reserve(size_t capacity);
+
 bigtime_t			Stamp() const { return fStamp; };
 bigtime_t			fStamp;
+					// system_time() of the first data written, and of the
+					// frame being queued for decoding (CAM_LATENCY_*)
+bigtime_t			fArrival;
+bigtime_t			fCompleted;
+					// markers of a compressed frame, kept up to date by
+					// its deframer and reset with SetSize(0)
+cam_jpeg_index		fJpegIndex;
+
+CamFrameArena*		Arena() const { return fArena; };
+
+private:
+CamFrameArena*		fArena;
+uint8*				fData;
+size_t				fCapacity;
+size_t				fLength;
+off_t				fPosition;
 };
 
 class CamDeframer : public CamFilterInterface {
@@ -58,6 +105,26 @@ virtual status_t	Flush(); // Clear all pending frames (for resolution changes)
 virtual void		RecycleFrame(CamFrame* frame);  // Return frame to pool
 		int32		PoolSize() const;				// Current pool size
 		int32		PoolCapacity() const;			// Max pool size
+		int32		QueuedFrames() const;			// Waiting for the reader
+
+		void		SetDeliveryPolicy(frame_delivery_policy policy,
+						bigtime_t maxAge = CamConfig::kBoundedDeliveryMaxAge);
+		frame_delivery_policy	DeliveryPolicy() const
+						{ return fDeliveryPolicy; }
+		int32		PolicyDrops() const { return fPolicyDrops; }
+
+					// Load shedding: of every skip + 1 frames WaitFrame()
+					// wakes for, the first 'skip' go back to the pool
+					// undecoded
+		void		SetFrameSkip(int32 skip);
+		int32		FrameSkip() const
+						{ return atomic_get((int32*)&fFrameSkip); }
+		int32		SkipDrops() const { return fSkipDrops; }
+
+					// Rebuild the frame pool on slots of 'sizeClass' in
+					// 'arena' (NULL: back to heap frames that grow). Only
+					// while not streaming and with no frame handed out.
+		status_t	SetFrameArena(CamFrameArena *arena, int32 sizeClass);
 
 status_t	RegisterSOFTags(const uint8 **tags, int count, size_t len, size_t skip);
 status_t	RegisterEOFTags(const uint8 **tags, int count, size_t len, size_t skip);
@@ -69,17 +136,47 @@ int		FindSOF(const uint8 *buf, size_t buflen, int *which=NULL);
 int		FindEOF(const uint8 *buf, size_t buflen, int *which=NULL);
 
 CamFrame	*AllocFrame();
+void		_ApplyDeliveryPolicy();
+bool		_ShedFrame();
+		// Hand a completed frame to the reader; false if the queue is full
+		// (the frame is not taken and stays with the caller)
+bool		QueueFrame(CamFrame *frame);
+		// Into the device's live metrics; no-op without a device
+void		_CountMetric(cam_metric metric, int64 delta = 1);
 
 CamDevice	*fDevice;
 size_t	fMinFrameSize;
 size_t	fMaxFrameSize;
 int	fState;
 sem_id	fFrameSem;
-BList	fFrames;
-BList	fFramePool;		// Pool of recycled frames for reuse
-BLocker	fLocker;
+
+// Queued frames and the free pool are single-producer/single-consumer
+// rings, so the USB thread never waits on a reader. The USB thread is
+// the only writer of fFrames and the only reader of fFramePool; on the
+// other side readers (GetFrame/DropFrame/Flush and the BPositionIO
+// peeks) serialize on fReadLock and recyclers on fRecycleLock.
+CamFrame	*fFrames[CAMDEFRAMER_MAX_QUEUED_FRAMES + 1];
+RingBufferIndex	fFrameIndex;
+CamFrame	*fFramePool[CAMDEFRAMER_FRAME_POOL_SIZE + 1];
+RingBufferIndex	fFramePoolIndex;
+BLocker	fReadLock;
+BLocker	fRecycleLock;
+
+frame_delivery_policy	fDeliveryPolicy;
+bigtime_t	fMaxFrameAge;
+int32	fPolicyDrops;		// frames skipped by the delivery policy
+int32	fWakeupDebt;		// fFrameSem counts of dropped frames still
+							// to be absorbed (atomic)
+int32	fFrameSkip;			// atomic
+int32	fSkipPhase;			// under fReadLock
+int32	fSkipDrops;			// frames shed by the frame skip
 CamFrame	*fCurrentFrame; /* the one we write to*/
 
+// With an arena the pool holds every frame there is: AllocFrame() never
+// falls back to the heap, a drained pool means the frame is dropped
+CamFrameArena	*fArena;
+int32	fArenaClass;
+
 // Statistics for memory optimization monitoring
 int32	fPoolHits;		// Frames reused from pool
 int32	fPoolMisses;	// New allocations required
@@ -94,6 +191,10 @@ size_t		fLenEOFTags;
 size_t		fSkipSOFTags;
 size_t		fSkipEOFTags;
 
+// FindTags() indexes, the last two tag sets it searched (SOF and EOF)
+cam_tag_set	fTagSets[2];
+int			fNextTagSet;
+
 
 
 };
@@ -5,13 +5,22 @@
 
 
 #include "CamDevice.h"
+#include "CamCapture.h"
+#include "CamStill.h"
 #include "CamSensor.h"
 #include "CamDeframer.h"
 #include "CamDebug.h"
+#include "CamConfig.h"
 #include "AddOn.h"
 
 #include <OS.h>
 #include <Autolock.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <math.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
 
 /* PRODUCTION BUILD: Disable all file I/O to prevent BFS corruption */
@@ -51,6 +60,7 @@ struct { const char *name; SensorInstFunc instfunc; } kSensorTable[] = {
 const float CamDevice::kPacketLossThreshold = 0.05f;	// 5% packet loss triggers fallback
 const bigtime_t CamDevice::kStatsWindowSize = 5000000;	// 5 second window
 const uint32 CamDevice::kMinPacketsForStats = 100;		// Min packets before calculating
+int32 CamDevice::sCameraCount = 0;
 
 
 CamDevice::CamDevice(CamDeviceAddon &_addon, BUSBDevice* _device)
@@ -58,6 +68,7 @@ CamDevice::CamDevice(CamDeviceAddon &_addon, BUSBDevice* _device)
 	  fSensor(NULL),
 	  fDeframer(NULL),
 	  fDataInput(NULL),
+	  fPacketInput(NULL),
 	  fBulkIn(NULL),
 	  fIsoIn(NULL),
 	  fIsoMaxPacketSize(0),
@@ -69,15 +80,36 @@ CamDevice::CamDevice(CamDeviceAddon &_addon, BUSBDevice* _device)
 	  fTransferEnabled(0), // Now int32 for atomic operations
 	  fPumpThread(-1),
 	  fLocker("WebcamDeviceLock"),
+	  fTransferLock("WebcamTransferLock"),
+	  fTransferArea("webcam transfer buffer"),
+	  fColorSpace(B_RGB32),
+	  fMJPEGPassthrough(false),
+	  fFrameRate(CamConfig::IntervalToFPS(CamConfig::kDefaultFrameInterval)),
+	  fRegionLock("WebcamRegionLock"),
+	  fHasVisibleRegion(false),
+	  fCrop(0, 0, 1, 1),
 	  fPacketSuccessCount(0),
 	  fPacketErrorCount(0),
 	  fLastStatsReport(0),
 	  fTransferStartTime(0),
 	  fConsecutiveHighLossEvents(0),
+	  fThreadPolicy(atomic_add(&sCameraCount, 1)),
+	  fTimebase(NULL),
+	  fTimebaseMember(-1),
+	  fGroupStart(0),
 	  fFirstTransferLogged(false),
 	  fDroppedFramesLogged(0),
 	  fLogThrottleCounter(0),
-	  fLastLogTime(0)
+	  fLastLogTime(0),
+	  fBulkSlots(NULL),
+	  fBulkSlotCount(0),
+	  fBulkRingArea("webcam bulk ring")
+#ifdef SUPPORT_ISO
+	  ,
+	  fIsoSlots(NULL),
+	  fIsoSlotCount(0),
+	  fIsoRingArea("webcam iso ring")
+#endif
 {
 	// Initialize error histogram
 	fErrorHistogram.Reset();
@@ -88,6 +120,8 @@ CamDevice::CamDevice(CamDeviceAddon &_addon, BUSBDevice* _device)
 	// Initialize error recovery configuration (Group 5)
 	fErrorRecoveryConfig.Reset();
 
+	fPumpSchedule.Reset();
+
 	// Initialize double buffer structure (actual allocation deferred)
 	fDoubleBuffer.initialized = false;
 	// fill in the generic flavor
@@ -101,8 +135,10 @@ CamDevice::CamDevice(CamDeviceAddon &_addon, BUSBDevice* _device)
 	// 1. Table entry with specific VID/PID (most reliable names)
 	// 2. USB descriptor strings (may be generic)
 	// 3. Table entry with class-only match (fallback)
-	const char* usbManufacturer = _device->ManufacturerString();
-	const char* usbProduct = _device->ProductString();
+	// A virtual camera has no device and names itself
+	const char* usbManufacturer = _device != NULL
+		? _device->ManufacturerString() : NULL;
+	const char* usbProduct = _device != NULL ? _device->ProductString() : NULL;
 
 	fFlavorInfoNameStr = "";
 	fFlavorInfoInfoStr = "";
@@ -149,12 +185,29 @@ CamDevice::CamDevice(CamDeviceAddon &_addon, BUSBDevice* _device)
 #ifdef DEBUG_READ_DUMP
 	fDumpFD = open("/boot/home/webcam.out", O_RDONLY, 0644);
 #endif
+	const char* standby = getenv("WEBCAM_WARM_STANDBY");
+	fWarmStandby = standby != NULL && (strcmp(standby, "1") == 0
+		|| strcmp(standby, "on") == 0);
+	// Structured capture of every transfer, written off the USB threads
+	fCapture = NULL;
+	const char* capturePath = getenv("WEBCAM_CAPTURE");
+	if (capturePath != NULL && capturePath[0] != '\0') {
+		BString path(capturePath);
+		if (fThreadPolicy.CameraIndex() > 0)
+			path << "." << fThreadPolicy.CameraIndex();
+		fCapture = new(std::nothrow) CamCaptureWriter;
+		if (fCapture != NULL && fCapture->Open(path.String()) != B_OK) {
+			delete fCapture;
+			fCapture = NULL;
+		}
+	}
 	// CRITICAL FIX: Buffer must be large enough for max isochronous transfer
 	// USB 2.0 High-Speed isochronous: up to 3072 bytes/packet * 8 transactions/microframe
 	// With 32 packet descriptors: 32 * 3072 = 98,304 bytes minimum
 	// Using 128KB (32 pages) for safety margin
 	fBufferLen = 32*B_PAGE_SIZE;
-	fBuffer = (uint8 *)malloc(fBufferLen);
+	fBuffer = fTransferArea.Reserve(fBufferLen) == B_OK
+		? fTransferArea.Data() : NULL;
 }
 
 
@@ -175,7 +228,8 @@ CamDevice::~CamDevice()
 
 	if (fDumpFD >= 0)
 		close(fDumpFD);
-	free(fBuffer);
+	// Both pumps are gone, the writer drains what they left
+	delete fCapture;
 	delete fDeframer;
 	delete fSensor;
 }
@@ -233,9 +287,11 @@ CamDevice::Unplugged()
 
 	// Clear USB pointers (device is being removed)
 	fDevice = NULL;
+	fTransferLock.Lock();
 	fBulkIn = NULL;
 	fIsoIn = NULL;
 	fIsoMaxPacketSize = 0;
+	fTransferLock.Unlock();
 }
 
 
@@ -278,6 +334,13 @@ CamDevice::SupportsIsochronous()
 }
 
 
+uint32
+CamDevice::BulkTransfersInFlight()
+{
+	return 1;
+}
+
+
 status_t
 CamDevice::StartTransfer()
 {
@@ -285,12 +348,17 @@ CamDevice::StartTransfer()
 	PRINT((CH "()" CT));
 	if (atomic_get(&fTransferEnabled))
 		return EALREADY;
-	// Use URGENT_DISPLAY_PRIORITY (120) for timely USB isochronous transfers
-	// Lower priority causes scheduling delays that lead to missed USB frames
+	// Nothing would take the data: the camera stays on its idle alternate
+	// rather than have the pump drop every transfer
+	if (fDataInput == NULL && fCapture == NULL)
+		return B_NO_INIT;
+	// The pump must run ahead of the producers, or scheduling delays turn
+	// into missed USB frames (see CamThreadPolicy)
 	fPumpThread = spawn_thread(_DataPumpThread, "USB Webcam Data Pump",
-		B_URGENT_DISPLAY_PRIORITY, this);
+		fThreadPolicy.Priority(CAM_THREAD_VIDEO_PUMP), this);
 	if (fPumpThread < B_OK)
 		return fPumpThread;
+	fThreadPolicy.Apply(fPumpThread, CAM_THREAD_VIDEO_PUMP);
 	if (fSensor)
 		err = fSensor->StartTransfer();
 	if (err < B_OK)
@@ -316,16 +384,21 @@ CamDevice::StopTransfer()
 	// Use atomic operation to safely signal thread to stop
 	atomic_set(&fTransferEnabled, 0);
 
-	// the thread itself might Lock(), so unlock before waiting
-	// The atomic operation ensures thread-safe access to fTransferEnabled
-	fLocker.Unlock();
+	// The pump never takes fLocker, the caller may keep holding it
 	wait_for_thread(fPumpThread, &err);
-	fLocker.Lock();
 
 	return B_OK;
 }
 
 
+void
+CamDevice::DiscardFrames()
+{
+	if (fDeframer != NULL)
+		fDeframer->Flush();
+}
+
+
 status_t
 CamDevice::SuggestVideoFrame(uint32 &width, uint32 &height)
 {
@@ -359,6 +432,111 @@ CamDevice::SetVideoFrame(BRect frame)
 }
 
 
+status_t
+CamDevice::AcceptFrameRate(float &fps)
+{
+	if (fps <= 0.0f)
+		fps = CamConfig::IntervalToFPS(CamConfig::kDefaultFrameInterval);
+	fFrameRate = fps;
+	return B_OK;
+}
+
+
+bool
+CamDevice::SupportsColorSpace(color_space space)
+{
+	// default FillFrameBuffer() implementations only produce RGB32
+	return space == B_RGB32;
+}
+
+
+status_t
+CamDevice::SetColorSpace(color_space space)
+{
+	if (!SupportsColorSpace(space))
+		return B_MEDIA_BAD_FORMAT;
+	fColorSpace = space;
+	return B_OK;
+}
+
+
+bool
+CamDevice::SupportsMJPEGPassthrough()
+{
+	return false;
+}
+
+
+status_t
+CamDevice::SetMJPEGPassthrough(bool passthrough)
+{
+	if (passthrough && !SupportsMJPEGPassthrough())
+		return B_MEDIA_BAD_FORMAT;
+	fMJPEGPassthrough = passthrough;
+	return B_OK;
+}
+
+
+void
+CamDevice::SetVisibleRegion(const clipping_rect* region)
+{
+	BAutolock _(fRegionLock);
+	fHasVisibleRegion = region != NULL;
+	if (region != NULL)
+		fVisibleRegion = *region;
+}
+
+
+void
+CamDevice::SetCrop(BRect crop)
+{
+	BAutolock _(fRegionLock);
+	fCrop = crop;
+}
+
+
+BRect
+CamDevice::Crop() const
+{
+	BAutolock _(fRegionLock);
+	return fCrop;
+}
+
+
+bool
+CamDevice::DecodeRegion(int32 width, int32 height, clipping_rect* region,
+	bool* blackOutside) const
+{
+	BAutolock _(fRegionLock);
+
+	clipping_rect area = { 0, 0, width - 1, height - 1 };
+	*blackOutside = fCrop.left > 0 || fCrop.top > 0 || fCrop.right < 1
+		|| fCrop.bottom < 1;
+	if (*blackOutside) {
+		area.left = (int32)floorf(fCrop.left * width);
+		area.top = (int32)floorf(fCrop.top * height);
+		area.right = (int32)ceilf(fCrop.right * width) - 1;
+		area.bottom = (int32)ceilf(fCrop.bottom * height) - 1;
+	}
+	if (fHasVisibleRegion) {
+		area.left = max_c(area.left, fVisibleRegion.left);
+		area.top = max_c(area.top, fVisibleRegion.top);
+		area.right = min_c(area.right, fVisibleRegion.right);
+		area.bottom = min_c(area.bottom, fVisibleRegion.bottom);
+	}
+
+	// Whole macro-pixels, so every converter draws the same pixels
+	area.left = max_c(area.left, 0) & ~1;
+	area.top = max_c(area.top, 0);
+	area.right = min_c(area.right | 1, width - 1);
+	area.bottom = min_c(area.bottom, height - 1);
+
+	*region = area;
+	return area.left != 0 || area.top != 0 || area.right != width - 1
+		|| area.bottom != height - 1;
+}
+
+
 status_t
 CamDevice::SetScale(float scale)
 {
@@ -577,6 +755,130 @@ CamDevice::OnTransferSuccess()
 }
 
 
+void
+CamDevice::ApplyThreadPolicy()
+{
+	if (fPumpThread >= B_OK)
+		fThreadPolicy.Apply(fPumpThread, CAM_THREAD_VIDEO_PUMP);
+	for (uint32 i = 0; fBulkSlots != NULL && i < fBulkSlotCount; i++)
+		fThreadPolicy.Apply(fBulkSlots[i].thread, CAM_THREAD_VIDEO_PUMP);
+#ifdef SUPPORT_ISO
+	for (uint32 i = 0; fIsoSlots != NULL && i < fIsoSlotCount; i++)
+		fThreadPolicy.Apply(fIsoSlots[i].thread, CAM_THREAD_VIDEO_PUMP);
+#endif
+}
+
+
+void
+CamDevice::GetCaptureStreamInfo(uint8 stream, cam_capture_stream_info* info)
+{
+	if (stream != CAM_CAPTURE_VIDEO)
+		return;
+	info->width = fVideoFrame.IntegerWidth() + 1;
+	info->height = fVideoFrame.IntegerHeight() + 1;
+	info->bandwidth = fIsoMaxPacketSize;
+}
+
+
+void
+CamDevice::GetMetrics(cam_metrics_snapshot* snapshot)
+{
+	fMetrics.Snapshot(snapshot);
+	if (fDeframer != NULL)
+		snapshot->values[CAM_METRIC_RAW_QUEUE_DEPTH] = fDeframer->QueuedFrames();
+}
+
+
+status_t
+CamDevice::HandleMetricsRequest(const void* data, size_t size, int32 node,
+	const char* name)
+{
+	if (data == NULL || size < sizeof(cam_metrics_request))
+		return B_BAD_VALUE;
+	const cam_metrics_request& request = *(const cam_metrics_request*)data;
+
+	cam_metrics_snapshot snapshot;
+	GetMetrics(&snapshot);
+	status_t status = CamMetrics::SendReply(request, snapshot, node, name);
+	if ((request.flags & CAM_METRICS_RESET_LATENCY) != 0)
+		fMetrics.ResetLatency();
+	return status;
+}
+
+
+status_t
+CamDevice::HandleProbeRequest(const void* data, size_t size, int32 node,
+	const char* name)
+{
+	if (data == NULL || size < sizeof(cam_probe_request))
+		return B_BAD_VALUE;
+	return fLatencyProbe.SendReply(*(const cam_probe_request*)data, node,
+		name);
+}
+
+
+status_t
+CamDevice::CaptureStill(const BMessenger& target, uint32 width,
+	uint32 height, bool decoded, int32 cookie)
+{
+	return B_NOT_SUPPORTED;
+}
+
+
+status_t
+CamDevice::HandleStillRequest(const void* data, size_t size)
+{
+	BMessage request;
+	if (data == NULL || request.Unflatten((const char*)data) != B_OK)
+		return B_BAD_VALUE;
+
+	BMessenger target;
+	if (request.FindMessenger("target", &target) != B_OK
+		|| !target.IsValid())
+		return B_BAD_VALUE;
+
+	int32 width = request.GetInt32("width", 0);
+	int32 height = request.GetInt32("height", 0);
+	int32 cookie = request.GetInt32("cookie", 0);
+	status_t status = CaptureStill(target, width > 0 ? width : 0,
+		height > 0 ? height : 0, request.GetBool("decoded", false), cookie);
+	// Whoever asked hears about it either way
+	if (status != B_OK)
+		SendStillImage(target, cookie, status);
+	return status;
+}
+
+
+/* image carries the picture fields; NULL for a failed capture */
+status_t
+CamDevice::SendStillImage(const BMessenger& target, int32 cookie,
+	status_t status, BMessage* image)
+{
+	BMessage reply(WEBCAM_MSG_STILL_IMAGE);
+	if (image == NULL)
+		image = &reply;
+	image->what = WEBCAM_MSG_STILL_IMAGE;
+	image->AddInt32("status", status);
+	image->AddInt32("cookie", cookie);
+	// A target that stopped reading must not hold the capture up
+	return target.SendMessage(image, (BHandler*)NULL, 1000000);
+}
+
+
+void
+CamDevice::AddCaptureStream(uint8 stream, const BUSBEndpoint* endpoint)
+{
+	if (fCapture == NULL || endpoint == NULL)
+		return;
+
+	cam_capture_stream_info info;
+	memset(&info, 0, sizeof(info));
+	GetCaptureStreamInfo(stream, &info);
+	fCapture->AddStream(stream, endpoint->Descriptor()->endpoint_address,
+		info);
+}
+
+
 status_t
 CamDevice::WaitFrame(bigtime_t timeout)
 {
@@ -595,12 +897,28 @@ CamDevice::GetFrameBitmap(BBitmap **bm, bigtime_t *stamp)
 
 
 status_t
-CamDevice::FillFrameBuffer(BBuffer *buffer, bigtime_t *stamp)
+CamDevice::FillFrameBuffer(BBuffer *buffer, bigtime_t *stamp,
+	uint32 *sequence, cam_frame_times *times)
 {
 	return EINVAL;
 }
 
 
+int32
+CamDevice::FillFrameBufferConcurrency()
+{
+	return 1;
+}
+
+
+void
+CamDevice::SetFrameSkip(int32 skip)
+{
+	if (fDeframer)
+		fDeframer->SetFrameSkip(skip);
+}
+
+
 bool
 CamDevice::Lock()
 {
@@ -806,6 +1124,7 @@ void
 CamDevice::SetDataInput(BDataIO *input)
 {
 	fDataInput = input;
+	fPacketInput = dynamic_cast<CamFilterInterface *>(input);
 }
 
 
@@ -829,18 +1148,37 @@ CamDevice::DataPumpThread()
 			2.0f		// backoff_multiplier
 		};
 
+		AddCaptureStream(CAM_CAPTURE_VIDEO, fBulkIn);
+
+		if (BulkTransfersInFlight() > 1)
+			return BulkRingPump();
+
 		while (atomic_get(&fTransferEnabled)) {
 			ssize_t len = -1;
-			BAutolock lock(fLocker);
+			// One transfer at a time keeps the endpoint and fBuffer
+			// for itself; control requests go on meanwhile
+			BAutolock lock(fTransferLock);
 			if (!lock.IsLocked())
 				break;
 			if (!fBulkIn)
 				break;
+			bigtime_t submitted = system_time();
 #ifndef DEBUG_DISCARD_INPUT
 			// Use retry wrapper for more robust bulk transfers
 			len = BulkTransferWithRetry(fBulkIn, fBuffer, fBufferLen,
 				bulkRetryConfig);
 #endif
+			WEBCAM_TRACE_EVENT(WEBCAM_TRACE_TRANSFER_DONE, len, 0);
+			fMetrics.Add(CAM_METRIC_TRANSFERS);
+			if (len < 0)
+				fMetrics.Add(CAM_METRIC_TRANSFER_ERRORS);
+			else
+				fMetrics.Add(CAM_METRIC_BYTES, len);
+			if (fCapture != NULL) {
+				fCapture->AddBulk(CAM_CAPTURE_VIDEO,
+					fBulkIn->Descriptor()->endpoint_address, fBuffer, len,
+					submitted, system_time());
+			}
 
 			//PRINT((CH ": got %ld bytes" CT, len));
 #ifdef DEBUG_WRITE_DUMP
@@ -861,7 +1199,10 @@ CamDevice::DataPumpThread()
 			}
 
 #ifndef DEBUG_DISCARD_DATA
-			if (fDataInput) {
+			if (fPacketInput != NULL) {
+				fPacketInput->WriteBulk(fBuffer, len,
+					(size_t)len < fBufferLen);
+			} else if (fDataInput) {
 				fDataInput->Write(fBuffer, len);
 			} else {
 				// Data dropped: no consumer connected
@@ -878,29 +1219,50 @@ CamDevice::DataPumpThread()
 		//
 		// Strategy: Start with buffer size from _SelectBestAlternate (conservative)
 		// If transfers succeed, we could grow. If they fail, we shrink further.
+		//
+		// Transfers are queued in a ring of kUSBIsoTransfersInFlight slots:
+		// while one slot is handed to the deframer, the others stay submitted
+		// so the host controller never runs out of microframes to fill.
 
 		const int kMaxPacketDescriptors = 32;  // Array size (max possible)
 		const int kMinPacketDescriptors = 2;   // Minimum viable
-		usb_iso_packet_descriptor packetDescriptors[kMaxPacketDescriptors];
 
 		// Use native MaxPacketSize from device
 		uint32 packetSize = (fIsoMaxPacketSize > 0) ? fIsoMaxPacketSize : 256;
 
 		// Calculate packet count based on EXISTING buffer (set by _SelectBestAlternate)
-		// Don't reallocate - use what we have (conservative for EHCI)
+		// Each slot of the ring gets a buffer of the same size
 		int numPacketDescriptors = fBufferLen / packetSize;
 		if (numPacketDescriptors > kMaxPacketDescriptors)
 			numPacketDescriptors = kMaxPacketDescriptors;
 		if (numPacketDescriptors < kMinPacketDescriptors)
 			numPacketDescriptors = kMinPacketDescriptors;
 
-		// Log transfer setup to syslog
-		syslog(LOG_INFO, "ISO Transfer: buffer=%zu, packets=%d, slotSize=%u\n",
-			fBufferLen, numPacketDescriptors, packetSize);
+		uint32 slotCount = CamConfig::kUSBIsoTransfersInFlight;
+		if (slotCount > CamConfig::kUSBMaxTransfers)
+			slotCount = CamConfig::kUSBMaxTransfers;
+
+		status_t ringStatus = StartIsoTransferRing(slotCount,
+			numPacketDescriptors, fBufferLen, packetSize);
+		if (ringStatus != B_OK) {
+			syslog(LOG_ERR, "ISO Transfer: cannot set up transfer ring: %s\n",
+				strerror(ringStatus));
+			return ringStatus;
+		}
+
+		// StopTransfer() drops fIsoIn before the pump sees the stop, so
+		// the capture keeps the endpoint address it started with
+		fTransferLock.Lock();
+		const BUSBEndpoint* isoIn = fIsoIn;
+		uint8 captureEndpoint = isoIn != NULL
+			? isoIn->Descriptor()->endpoint_address : 0;
+		AddCaptureStream(CAM_CAPTURE_VIDEO, isoIn);
+		fTransferLock.Unlock();
 
-		// Initialize packet descriptors
-		for (int i = 0; i < kMaxPacketDescriptors; i++)
-			packetDescriptors[i].request_length = packetSize;
+		// Log transfer setup to syslog
+		syslog(LOG_INFO, "ISO Transfer: buffer=%zu, packets=%d, slotSize=%u, "
+			"in flight=%" B_PRIu32 "\n", fBufferLen, numPacketDescriptors,
+			packetSize, fIsoSlotCount);
 
 		// Statistics tracking
 		fPacketSuccessCount = 0;
@@ -910,31 +1272,32 @@ CamDevice::DataPumpThread()
 
 		int consecutiveFailures = 0;
 		int32 transferAttempts = 0;
+		uint32 slotIndex = 0;
 
-		while (atomic_get(&fTransferEnabled)) {
-			ssize_t len = -1;
+		// One transfer lasts a microframe per packet
+		bigtime_t pumpDeadline = (bigtime_t)numPacketDescriptors * 125
+			* (fIsoSlotCount > 1 ? fIsoSlotCount - 1 : 1);
+		fPumpSchedule.Reset();
 
-			// Minimize lock scope: only lock during USB transfer
-			// Processing happens outside the lock
-			{
-				BAutolock lock(fLocker);
-				if (!lock.IsLocked())
-					break;
-				if (fIsoIn == NULL)
-					break;
-
-				// OPTIMIZATION: Removed memset() from hot path
-				// Pre-filling buffer is unnecessary because:
-				// 1. We track actual_length for each packet
-				// 2. Only valid data is written to the deframer
-				// 3. Invalid packets are skipped entirely
-				// The deframer handles incomplete frames with its own validation
+		while (atomic_get(&fTransferEnabled)) {
+			usb_iso_transfer_slot* slot = &fIsoSlots[slotIndex];
+			usb_iso_packet_descriptor* packetDescriptors = slot->descriptors;
+
+			// Slots are queued in ring order (see CamSubmitOrder) and
+			// complete in that order, so waiting on the oldest one keeps the
+			// packet stream ordered for the deframer.
+			// The timeout only bounds how long a stop request goes unnoticed.
+			status_t waitStatus = acquire_sem_etc(slot->complete, 1,
+				B_RELATIVE_TIMEOUT, 100000);
+			if (waitStatus == B_TIMED_OUT || waitStatus == B_INTERRUPTED)
+				continue;
+			if (waitStatus != B_OK)
+				break;
 
-				// Isochronous transfer
-				len = fIsoIn->IsochronousTransfer(fBuffer, fBufferLen,
-					packetDescriptors, numPacketDescriptors);
-			}
-			// Lock released here - processing happens unlocked
+			ssize_t len = slot->result;
+			uint8* buffer = slot->buffer;
+			size_t bufferLen = slot->bufferSize;
+			WEBCAM_TRACE_EVENT(WEBCAM_TRACE_TRANSFER_DONE, len, slotIndex);
 
 			// Throttled logging: first 5, then based on time/count threshold
 			transferAttempts++;
@@ -945,8 +1308,8 @@ CamDevice::DataPumpThread()
 
 			if (shouldLog) {
 				fLastLogTime = now;
-				syslog(LOG_INFO, "ISO xfer #%d: len=%zd, pkt[0]=%d/%u\n",
-					(int)transferAttempts, len,
+				syslog(LOG_INFO, "ISO xfer #%d (slot %" B_PRIu32 "): len=%zd, "
+					"pkt[0]=%d/%u\n", (int)transferAttempts, slotIndex, len,
 					packetDescriptors[0].actual_length,
 					packetDescriptors[0].request_length);
 			}
@@ -975,12 +1338,35 @@ CamDevice::DataPumpThread()
 				consecutiveFailures = 0;
 			}
 
+			// Live metrics, whatever becomes of the data
+			fMetrics.Add(CAM_METRIC_TRANSFERS);
+			if (len < 0)
+				fMetrics.Add(CAM_METRIC_TRANSFER_ERRORS);
+			int32 packetErrors = 0;
+			int64 received = 0;
+			for (int i = 0; i < numPacketDescriptors; i++) {
+				if (packetDescriptors[i].status != B_OK)
+					packetErrors++;
+				else
+					received += packetDescriptors[i].actual_length;
+			}
+			fMetrics.Add(CAM_METRIC_PACKETS, numPacketDescriptors);
+			fMetrics.Add(CAM_METRIC_PACKET_ERRORS, packetErrors);
+			fMetrics.Add(CAM_METRIC_BYTES, received);
+
 			//PRINT((CH ": got %d bytes" CT, len));
+			if (fCapture != NULL) {
+				fCapture->AddTransfer(CAM_CAPTURE_VIDEO, captureEndpoint,
+					buffer, bufferLen / numPacketDescriptors,
+					packetDescriptors, numPacketDescriptors, len,
+					slot->submitted,
+					slot->completed);
+			}
 #ifdef DEBUG_WRITE_DUMP
-			write(fDumpFD, fBuffer, len);
+			write(fDumpFD, buffer, len);
 #endif
 #ifdef DEBUG_READ_DUMP
-			if ((len = read(fDumpFD, fBuffer, fBufferLen)) < fBufferLen)
+			if ((len = read(fDumpFD, buffer, bufferLen)) < bufferLen)
 				lseek(fDumpFD, 0LL, SEEK_SET);
 #endif
 
@@ -993,83 +1379,40 @@ CamDevice::DataPumpThread()
 				// PHASE 4 FIX: Use fixed packet offsets (not sequential)
 				// EHCI places data at packet_index * request_length
 
-				// DEBUG: Log first transfer results
-				// DISABLED: File I/O in hot path causes performance issues
-				#if 0
-				static bool firstResultLogged = false;
-				if (!firstResultLogged) {
-					FILE* resultLog = fopen("/boot/home/Desktop/iso_transfer_debug.log", "a");
-// 					fprintf(stderr, "DEBUG: First transfer results (first 5 packets):\n");
-					if (resultLog) {
-	fprintf(resultLog, "\n=== FIRST TRANSFER RESULTS ===\n");
-	fprintf(resultLog, "Transfer returned len=%zd\n", len);
-					}
-					for (int i = 0; i < 5 && i < numPacketDescriptors; i++) {
-	fprintf(stderr, "  packet[%d]: request=%u actual=%d status=0x%x\n",
-							i,
-							packetDescriptors[i].request_length,
-							packetDescriptors[i].actual_length,
-							packetDescriptors[i].status);
-						if (resultLog) {
-	fprintf(resultLog, "  packet[%d]: request=%u actual=%d status=0x%x\n",
-								i,
-								packetDescriptors[i].request_length,
-								packetDescriptors[i].actual_length,
-								packetDescriptors[i].status);
-						}
-					}
-					if (resultLog) {
-	fprintf(resultLog, "==============================\n");
-						fclose(resultLog);
-					}
-					firstResultLogged = true;
-				}
-				#endif
-
 				// CRITICAL FIX: EHCI kernel calculates slot size as DataLength/packet_count
-				// We must ensure: fBufferLen = slotSize * numPacketDescriptors
-				// So: slotSize = fBufferLen / numPacketDescriptors
+				// We must ensure: bufferLen = slotSize * numPacketDescriptors
+				// So: slotSize = bufferLen / numPacketDescriptors
 				// This MUST match request_length if buffer was properly sized
-				size_t slotSize = fBufferLen / numPacketDescriptors;
-
-				// Verify alignment and log packet info (first few times)
-				static int logCount = 0;
-				if (logCount < 5) {
-					logCount++;
-					size_t reqLen = packetDescriptors[0].request_length;
-					syslog(LOG_INFO, "ISO #%d: bufLen=%zu, slots=%d, slotSize=%zu, reqLen=%zu\n",
-						logCount, fBufferLen, numPacketDescriptors, slotSize, reqLen);
-
-					// Log first few packet actual_lengths
-					syslog(LOG_INFO, "  actual_len: [%d, %d, %d, %d, %d, %d, %d, %d]\n",
-						packetDescriptors[0].actual_length,
-						numPacketDescriptors > 1 ? packetDescriptors[1].actual_length : -1,
-						numPacketDescriptors > 2 ? packetDescriptors[2].actual_length : -1,
-						numPacketDescriptors > 3 ? packetDescriptors[3].actual_length : -1,
-						numPacketDescriptors > 4 ? packetDescriptors[4].actual_length : -1,
-						numPacketDescriptors > 5 ? packetDescriptors[5].actual_length : -1,
-						numPacketDescriptors > 6 ? packetDescriptors[6].actual_length : -1,
-						numPacketDescriptors > 7 ? packetDescriptors[7].actual_length : -1);
-				}
+				size_t slotSize = bufferLen / numPacketDescriptors;
 
-				for (int i = 0; i < numPacketDescriptors; i++) {
-					// Calculate offset matching kernel's layout (i * DataLength/packet_count)
-					size_t packetOffset = i * slotSize;
-
-					// PHASE 3: Check if this packet succeeded
-					if (packetDescriptors[i].status != B_OK) {
-						fPacketErrorCount++;
-						// Skip failed packets - data is invalid
-						continue;
+				if (fPacketInput != NULL) {
+					// The deframer takes the whole transfer in one call
+					for (int i = 0; i < numPacketDescriptors; i++) {
+						if (packetDescriptors[i].status != B_OK)
+							fPacketErrorCount++;
 					}
+					fPacketSuccessCount += fPacketInput->WritePackets(buffer,
+						slotSize, packetDescriptors, numPacketDescriptors);
+				} else {
+					for (int i = 0; i < numPacketDescriptors; i++) {
+						// Calculate offset matching kernel's layout (i * DataLength/packet_count)
+						size_t packetOffset = i * slotSize;
+
+						// PHASE 3: Check if this packet succeeded
+						if (packetDescriptors[i].status != B_OK) {
+							fPacketErrorCount++;
+							// Skip failed packets - data is invalid
+							continue;
+						}
 
-					// Direct access to struct member (no copy)
-					int actual_length = packetDescriptors[i].actual_length;
+						// Direct access to struct member (no copy)
+						int actual_length = packetDescriptors[i].actual_length;
 
-					// Bounds check
-					if (actual_length > 0 && packetOffset + actual_length <= fBufferLen) {
-						fDataInput->Write(&fBuffer[packetOffset], actual_length);
-						fPacketSuccessCount++;
+						// Bounds check
+						if (actual_length > 0 && packetOffset + actual_length <= bufferLen) {
+							fDataInput->Write(&buffer[packetOffset], actual_length);
+							fPacketSuccessCount++;
+						}
 					}
 				}
 
@@ -1088,6 +1431,16 @@ CamDevice::DataPumpThread()
 
 					syslog(LOG_INFO, "USB Stats: success=%u errors=%u loss=%.1f%% rate=%.0f pkt/s\n",
 						fPacketSuccessCount, fPacketErrorCount, lossPercent, packetsPerSec);
+					syslog(LOG_INFO, "USB Sched: %s priority %d, %u wakeups, "
+						"%u missed the %lld us deadline, latency avg %lld max "
+						"%lld us\n",
+						CamThreadPolicy::StageName(CAM_THREAD_VIDEO_PUMP),
+						(int)fThreadPolicy.Priority(CAM_THREAD_VIDEO_PUMP),
+						fPumpSchedule.wakeups, fPumpSchedule.deadline_misses,
+						(long long)pumpDeadline,
+						(long long)fPumpSchedule.AverageLatency(),
+						(long long)fPumpSchedule.latency_max);
+					fPumpSchedule.Reset();
 
 					// Warn if packet loss is high (>5% is concerning for video)
 					if (lossPercent > 5.0f) {
@@ -1105,8 +1458,23 @@ CamDevice::DataPumpThread()
 				}
 			}
 #endif
-			//snooze(2000);
+			// The transfers queued behind this one must not run out before
+			// it is back in the queue
+			if (slot->completed > 0) {
+				fPumpSchedule.Record(system_time() - slot->completed,
+					pumpDeadline);
+			}
+
+			// Hand the slot back to its submission thread; it goes to the
+			// tail of the queue behind the transfers still in flight.
+			slot->ticket = fIsoOrder.Take();
+			slot->submitted = system_time();
+			if (release_sem(slot->submit) != B_OK)
+				break;
+			slotIndex = (slotIndex + 1) % fIsoSlotCount;
 		}
+
+		StopIsoTransferRing();
 	}
 #endif
 	else {
@@ -1121,10 +1489,412 @@ int32
 CamDevice::_DataPumpThread(void *_this)
 {
 	CamDevice *dev = (CamDevice *)_this;
+	// A grouped start: every member's first transfer is queued in the
+	// same millisecond
+	bigtime_t start = atomic_get_and_set64(&dev->fGroupStart, 0);
+	if (start > system_time())
+		snooze_until(start, B_SYSTEM_TIMEBASE);
 	return dev->DataPumpThread();
 }
 
 
+// =============================================================================
+// Bulk Transfer Ring
+// =============================================================================
+//
+// The same scheme as the isochronous ring below, for devices that stream
+// over a bulk endpoint: with one BulkTransfer() at a time the endpoint
+// NAKs while the pump deframes, and a device with a small FIFO drops data.
+// The deframer stitches payloads across transfers, so fBulkOrder keeps the
+// slot threads to ring order (see CamSubmitOrder).
+
+
+status_t
+CamDevice::StartBulkTransferRing(uint32 count, size_t bufferSize)
+{
+	if (fBulkSlots != NULL)
+		StopBulkTransferRing();
+
+	if (count == 0)
+		count = 1;
+
+	// One locked area for all slots, each on pages of its own; it stays
+	// when the ring stops, so restarting the stream allocates nothing
+	size_t stride = CamTransferArea::SlotStride(bufferSize);
+	status_t status = fBulkRingArea.Reserve(stride * count);
+	if (status != B_OK)
+		return status;
+
+	status = fBulkOrder.Init("usb bulk turn");
+	if (status != B_OK)
+		return status;
+
+	fBulkSlots = new usb_bulk_transfer_slot[count];
+	fBulkSlotCount = 0;
+
+	for (uint32 i = 0; i < count; i++) {
+		usb_bulk_transfer_slot& slot = fBulkSlots[i];
+		slot.device = this;
+		slot.bufferSize = bufferSize;
+		slot.buffer = fBulkRingArea.Data() + i * stride;
+		slot.submit = create_sem(0, "usb bulk submit");
+		slot.complete = create_sem(0, "usb bulk complete");
+		if (slot.buffer != NULL && slot.submit >= B_OK
+			&& slot.complete >= B_OK) {
+			slot.thread = spawn_thread(_BulkSlotThread, "USB Webcam Bulk Slot",
+				fThreadPolicy.Priority(CAM_THREAD_VIDEO_PUMP), &slot);
+			if (slot.thread >= B_OK)
+				fThreadPolicy.Apply(slot.thread, CAM_THREAD_VIDEO_PUMP);
+		}
+
+		if (slot.thread < B_OK) {
+			if (slot.submit >= B_OK)
+				delete_sem(slot.submit);
+			if (slot.complete >= B_OK)
+				delete_sem(slot.complete);
+			slot = usb_bulk_transfer_slot();
+			syslog(LOG_WARNING, "Bulk Transfer: only %" B_PRIu32 " of %"
+				B_PRIu32 " transfer slots available\n", i, count);
+			break;
+		}
+		fBulkSlotCount++;
+	}
+
+	if (fBulkSlotCount == 0) {
+		delete[] fBulkSlots;
+		fBulkSlots = NULL;
+		fBulkOrder.Uninit();
+		return B_NO_MEMORY;
+	}
+
+	for (uint32 i = 0; i < fBulkSlotCount; i++) {
+		resume_thread(fBulkSlots[i].thread);
+		fBulkSlots[i].ticket = fBulkOrder.Take();
+		fBulkSlots[i].submitted = system_time();
+		release_sem(fBulkSlots[i].submit);
+	}
+
+	return B_OK;
+}
+
+
+void
+CamDevice::StopBulkTransferRing()
+{
+	if (fBulkSlots == NULL)
+		return;
+
+	fBulkOrder.Uninit();
+	for (uint32 i = 0; i < fBulkSlotCount; i++)
+		delete_sem(fBulkSlots[i].submit);
+
+	// A device still streaming completes the queued transfers on its own.
+	// One that stopped leaves them pending: halting the endpoint, which is
+	// also how UVC ends bulk streaming, makes them return.
+	bool halted = false;
+	for (uint32 i = 0; i < fBulkSlotCount; i++) {
+		status_t result;
+		if (wait_for_thread_etc(fBulkSlots[i].thread, B_RELATIVE_TIMEOUT,
+				500000, &result) == B_TIMED_OUT) {
+			if (!halted && fBulkIn != NULL) {
+				syslog(LOG_INFO, "Bulk Transfer: transfers still pending, "
+					"halting the endpoint\n");
+				fBulkIn->ClearStall();
+				halted = true;
+			}
+			wait_for_thread(fBulkSlots[i].thread, &result);
+		}
+		delete_sem(fBulkSlots[i].complete);
+	}
+
+	delete[] fBulkSlots;
+	fBulkSlots = NULL;
+	fBulkSlotCount = 0;
+}
+
+
+int32
+CamDevice::_BulkSlotThread(void *_slot)
+{
+	usb_bulk_transfer_slot *slot = (usb_bulk_transfer_slot *)_slot;
+	return slot->device->BulkSlotThread(slot);
+}
+
+
+int32
+CamDevice::BulkSlotThread(usb_bulk_transfer_slot *slot)
+{
+	while (acquire_sem(slot->submit) == B_OK) {
+		if (fBulkOrder.Enter(slot->ticket) != B_OK)
+			break;
+
+		fTransferLock.Lock();
+		const BUSBEndpoint* endpoint = fBulkIn;
+		fTransferLock.Unlock();
+		if (!atomic_get(&fTransferEnabled) || endpoint == NULL) {
+			fBulkOrder.Leave();
+			slot->result = B_DEV_NOT_READY;
+			release_sem(slot->complete);
+			break;
+		}
+
+		slot->result = endpoint->BulkTransfer(slot->buffer, slot->bufferSize);
+		fBulkOrder.Leave();
+		slot->completed = system_time();
+		release_sem(slot->complete);
+	}
+
+	return B_OK;
+}
+
+
+/* The bulk branch of DataPumpThread() with transfers queued ahead: each
+ * completed transfer goes to the deframer whole, a short one marking the
+ * end of a payload. */
+status_t
+CamDevice::BulkRingPump()
+{
+	uint32 slotCount = BulkTransfersInFlight();
+	if (slotCount > CamConfig::kUSBMaxTransfers)
+		slotCount = CamConfig::kUSBMaxTransfers;
+
+	status_t ringStatus = StartBulkTransferRing(slotCount, fBufferLen);
+	if (ringStatus != B_OK) {
+		syslog(LOG_ERR, "Bulk Transfer: cannot set up transfer ring: %s\n",
+			strerror(ringStatus));
+		return ringStatus;
+	}
+
+	syslog(LOG_INFO, "Bulk Transfer: %zu byte transfers, in flight=%" B_PRIu32
+		"\n", fBufferLen, fBulkSlotCount);
+
+	int consecutiveFailures = 0;
+	uint32 slotIndex = 0;
+
+	while (atomic_get(&fTransferEnabled)) {
+		usb_bulk_transfer_slot* slot = &fBulkSlots[slotIndex];
+
+		status_t waitStatus = acquire_sem_etc(slot->complete, 1,
+			B_RELATIVE_TIMEOUT, 100000);
+		if (waitStatus == B_TIMED_OUT || waitStatus == B_INTERRUPTED)
+			continue;
+		if (waitStatus != B_OK)
+			break;
+
+		ssize_t len = slot->result;
+		WEBCAM_TRACE_EVENT(WEBCAM_TRACE_TRANSFER_DONE, len, slotIndex);
+		if (fCapture != NULL) {
+			fCapture->AddBulk(CAM_CAPTURE_VIDEO,
+				fBulkIn->Descriptor()->endpoint_address, slot->buffer, len,
+				slot->submitted, slot->completed);
+		}
+
+		fMetrics.Add(CAM_METRIC_TRANSFERS);
+		if (len < 0)
+			fMetrics.Add(CAM_METRIC_TRANSFER_ERRORS);
+		else
+			fMetrics.Add(CAM_METRIC_BYTES, len);
+
+		if (len < 0) {
+			PRINT((CH ": BulkIn: %s" CT, strerror(len)));
+			usb_error_type errorType = ClassifyUSBError(len);
+			if (errorType == USB_ERROR_DISCONNECTED)
+				break;
+			if (errorType == USB_ERROR_STALL)
+				fBulkIn->ClearStall();
+			consecutiveFailures++;
+			OnConsecutiveTransferFailures(consecutiveFailures);
+			if (consecutiveFailures == 10) {
+				syslog(LOG_WARNING, "USB: 10 consecutive bulk transfer "
+					"failures (err=%zd)\n", len);
+			}
+			// Whatever payload was in progress is lost with it
+			len = 0;
+		} else if (consecutiveFailures > 0) {
+			OnTransferSuccess();
+			consecutiveFailures = 0;
+		}
+
+#ifndef DEBUG_DISCARD_DATA
+		if (fPacketInput != NULL) {
+			fPacketInput->WriteBulk(slot->buffer, len,
+				(size_t)len < slot->bufferSize);
+		} else if (fDataInput != NULL && len > 0)
+			fDataInput->Write(slot->buffer, len);
+#endif
+
+		slot->ticket = fBulkOrder.Take();
+		slot->submitted = system_time();
+		if (release_sem(slot->submit) != B_OK)
+			break;
+		slotIndex = (slotIndex + 1) % fBulkSlotCount;
+	}
+
+	StopBulkTransferRing();
+	return B_OK;
+}
+
+
+#ifdef SUPPORT_ISO
+// =============================================================================
+// Isochronous Transfer Ring
+// =============================================================================
+//
+// BUSBEndpoint::IsochronousTransfer() only returns once the transfer has
+// completed, so a single pump thread leaves the endpoint idle while it
+// processes packets. Each ring slot gets its own submission thread instead;
+// the pump thread consumes slots in ring order and re-arms them, so
+// count - 1 transfers remain queued while one is being deframed.
+
+
+status_t
+CamDevice::StartIsoTransferRing(uint32 count, int32 packetCount,
+	size_t bufferSize, uint32 packetSize)
+{
+	if (fIsoSlots != NULL)
+		StopIsoTransferRing();
+
+	if (count == 0)
+		count = 1;
+
+	// Like the bulk ring: one locked area, kept across restarts
+	size_t stride = CamTransferArea::SlotStride(bufferSize);
+	status_t status = fIsoRingArea.Reserve(stride * count);
+	if (status != B_OK)
+		return status;
+
+	status = fIsoOrder.Init("usb iso turn");
+	if (status != B_OK)
+		return status;
+
+	fIsoSlots = new usb_iso_transfer_slot[count];
+	fIsoSlotCount = 0;
+
+	for (uint32 i = 0; i < count; i++) {
+		usb_iso_transfer_slot& slot = fIsoSlots[i];
+		slot.device = this;
+		slot.packetCount = packetCount;
+		slot.bufferSize = bufferSize;
+		slot.buffer = fIsoRingArea.Data() + i * stride;
+		slot.descriptors = (usb_iso_packet_descriptor*)malloc(
+			packetCount * sizeof(usb_iso_packet_descriptor));
+		slot.submit = create_sem(0, "usb iso submit");
+		slot.complete = create_sem(0, "usb iso complete");
+		if (slot.buffer != NULL && slot.descriptors != NULL
+			&& slot.submit >= B_OK && slot.complete >= B_OK) {
+			slot.thread = spawn_thread(_IsoSlotThread, "USB Webcam ISO Slot",
+				fThreadPolicy.Priority(CAM_THREAD_VIDEO_PUMP), &slot);
+			if (slot.thread >= B_OK)
+				fThreadPolicy.Apply(slot.thread, CAM_THREAD_VIDEO_PUMP);
+		}
+
+		if (slot.thread < B_OK) {
+			// Graceful degradation: run with the slots we already have
+			free(slot.descriptors);
+			if (slot.submit >= B_OK)
+				delete_sem(slot.submit);
+			if (slot.complete >= B_OK)
+				delete_sem(slot.complete);
+			slot = usb_iso_transfer_slot();
+			syslog(LOG_WARNING, "ISO Transfer: only %" B_PRIu32 " of %"
+				B_PRIu32 " transfer slots available\n", i, count);
+			break;
+		}
+
+		for (int32 j = 0; j < packetCount; j++) {
+			slot.descriptors[j].request_length = packetSize;
+			slot.descriptors[j].actual_length = 0;
+			slot.descriptors[j].status = B_OK;
+		}
+		fIsoSlotCount++;
+	}
+
+	if (fIsoSlotCount == 0) {
+		delete[] fIsoSlots;
+		fIsoSlots = NULL;
+		fIsoOrder.Uninit();
+		return B_NO_MEMORY;
+	}
+
+	// Queue every slot in ring order; the pump consumes them in the same
+	// order, and fIsoOrder keeps the slot threads to it
+	for (uint32 i = 0; i < fIsoSlotCount; i++) {
+		resume_thread(fIsoSlots[i].thread);
+		fIsoSlots[i].ticket = fIsoOrder.Take();
+		fIsoSlots[i].submitted = system_time();
+		release_sem(fIsoSlots[i].submit);
+	}
+
+	return B_OK;
+}
+
+
+void
+CamDevice::StopIsoTransferRing()
+{
+	if (fIsoSlots == NULL)
+		return;
+
+	// Deleting the submit semaphores wakes the idle slot threads, and
+	// fIsoOrder those waiting for their turn. Slots still in
+	// IsochronousTransfer() return once the interface leaves its streaming
+	// alternate setting (see UVCCamDevice::StopTransfer()).
+	fIsoOrder.Uninit();
+	for (uint32 i = 0; i < fIsoSlotCount; i++)
+		delete_sem(fIsoSlots[i].submit);
+
+	for (uint32 i = 0; i < fIsoSlotCount; i++) {
+		status_t result;
+		wait_for_thread(fIsoSlots[i].thread, &result);
+		delete_sem(fIsoSlots[i].complete);
+		free(fIsoSlots[i].descriptors);
+	}
+
+	delete[] fIsoSlots;
+	fIsoSlots = NULL;
+	fIsoSlotCount = 0;
+}
+
+
+int32
+CamDevice::_IsoSlotThread(void *_slot)
+{
+	usb_iso_transfer_slot *slot = (usb_iso_transfer_slot *)_slot;
+	return slot->device->IsoSlotThread(slot);
+}
+
+
+int32
+CamDevice::IsoSlotThread(usb_iso_transfer_slot *slot)
+{
+	while (acquire_sem(slot->submit) == B_OK) {
+		if (fIsoOrder.Enter(slot->ticket) != B_OK)
+			break;
+
+		// The lock is only held to read the endpoint: the transfer must be
+		// able to return when StopTransfer() switches the alternate
+		fTransferLock.Lock();
+		const BUSBEndpoint* endpoint = fIsoIn;
+		fTransferLock.Unlock();
+		if (!atomic_get(&fTransferEnabled) || endpoint == NULL) {
+			fIsoOrder.Leave();
+			slot->result = B_DEV_NOT_READY;
+			release_sem(slot->complete);
+			break;
+		}
+
+		slot->result = endpoint->IsochronousTransfer(slot->buffer,
+			slot->bufferSize, slot->descriptors, slot->packetCount);
+		fIsoOrder.Leave();
+		slot->completed = system_time();
+		release_sem(slot->complete);
+	}
+
+	return B_OK;
+}
+#endif
+
+
 void
 CamDevice::DumpRegs()
 {
@@ -1584,9 +2354,13 @@ CamDevice::LogFrameTimingStats()
 		stats.frame_interval_min,
 		stats.GetAverageInterval(),
 		stats.frame_interval_max);
+	syslog(LOG_INFO, "  Interval: p50=%lld p95=%lld p99=%lld us\n",
+		stats.intervals.Percentile(50), stats.intervals.Percentile(95),
+		stats.intervals.Percentile(99));
 	syslog(LOG_INFO, "  Avg jitter: %lld us\n", stats.GetAverageJitter());
-	syslog(LOG_INFO, "  Processing: avg=%lld max=%lld us\n",
+	syslog(LOG_INFO, "  Processing: avg=%lld p99=%lld max=%lld us\n",
 		stats.GetAverageProcessingTime(),
+		stats.processing.Percentile(99),
 		stats.processing_time_max);
 	syslog(LOG_INFO, "  Adaptive timeout: %lld us\n", stats.adaptive_timeout);
 }
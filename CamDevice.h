@@ -24,15 +24,27 @@
 #include <String.h>
 #include <Rect.h>
 
+#include "CamFrameArena.h"
+#include "CamLatencyProbe.h"
+#include "CamMetrics.h"
+#include "CamThreading.h"
+
 class BBitmap;
 class BBuffer;
 class BDataIO;
+class BMessage;
+class BMessenger;
 class BParameterGroup;
+class CamCaptureWriter;
 class CamRoster;
+class CamDevice;
 class CamDeviceAddon;
 class CamSensor;
+class CamTimebase;
 class CamDeframer;
+class CamFilterInterface;
 class WebCamMediaAddOn;
+struct cam_capture_stream_info;
 
 
 // USB transfer retry configuration
@@ -160,6 +172,76 @@ struct usb_double_buffer {
 };
 
 
+// One entry of the bulk transfer ring, like usb_iso_transfer_slot below:
+// BulkTransfer() blocks as well, so each slot has a submission thread.
+struct usb_bulk_transfer_slot {
+	uint8*				buffer;
+	size_t				bufferSize;
+	ssize_t				result;			// Return of BulkTransfer()
+	uint32				ticket;			// Place in the submission order
+	sem_id				submit;			// Released to queue the transfer
+	sem_id				complete;		// Released when the transfer returns
+	thread_id			thread;
+	CamDevice*			device;
+	bigtime_t			submitted;		// When the transfer was queued
+	bigtime_t			completed;		// When the transfer returned
+
+	usb_bulk_transfer_slot()
+		:
+		buffer(NULL),
+		bufferSize(0),
+		result(0),
+		ticket(0),
+		submit(-1),
+		complete(-1),
+		thread(-1),
+		device(NULL),
+		submitted(0),
+		completed(0)
+	{
+	}
+};
+
+
+#ifdef SUPPORT_ISO
+// One entry of the isochronous transfer ring.
+// IsochronousTransfer() blocks until the transfer completes, so each slot
+// has its own submission thread; the data pump re-arms a slot once its
+// packets have been handed to the deframer, keeping the others queued.
+struct usb_iso_transfer_slot {
+	uint8*				buffer;			// Packet data (packetCount slots)
+	size_t				bufferSize;
+	usb_iso_packet_descriptor*	descriptors;
+	int32				packetCount;
+	ssize_t				result;			// Return of IsochronousTransfer()
+	uint32				ticket;			// Place in the submission order
+	sem_id				submit;			// Released to queue the transfer
+	sem_id				complete;		// Released when the transfer returns
+	thread_id			thread;
+	CamDevice*			device;
+	bigtime_t			submitted;		// When the transfer was queued
+	bigtime_t			completed;		// When the transfer returned
+
+	usb_iso_transfer_slot()
+		:
+		buffer(NULL),
+		bufferSize(0),
+		descriptors(NULL),
+		packetCount(0),
+		result(0),
+		ticket(0),
+		submit(-1),
+		complete(-1),
+		thread(-1),
+		device(NULL),
+		submitted(0),
+		completed(0)
+	{
+	}
+};
+#endif
+
+
 // PHASE 8: Error histogram for tracking error distribution
 struct usb_error_histogram {
 	uint32		counts[USB_ERROR_TYPE_COUNT];
@@ -217,6 +299,11 @@ struct frame_timing_stats {
 	bigtime_t	expected_interval;		// Expected frame interval (1/fps)
 	bigtime_t	jitter_sum;				// Sum of |actual - expected|
 
+	// Distributions behind the adaptive timeout: one late frame moves a
+	// percentile little, where it would set the maximum for good
+	CamHistogram	intervals;
+	CamHistogram	processing;
+
 	// Adaptive timeout support
 	bigtime_t	adaptive_timeout;		// Current adaptive timeout value
 
@@ -230,6 +317,8 @@ struct frame_timing_stats {
 		processing_time_max = 0;
 		expected_interval = 33333;  // Default 30fps
 		jitter_sum = 0;
+		intervals.Reset();
+		processing.Reset();
 		adaptive_timeout = 100000;  // Default 100ms timeout
 	}
 
@@ -240,6 +329,7 @@ struct frame_timing_stats {
 			bigtime_t interval = now - last_frame_time;
 
 			// Update interval statistics
+			intervals.Record(interval);
 			frame_interval_sum += interval;
 			if (interval < frame_interval_min)
 				frame_interval_min = interval;
@@ -253,21 +343,25 @@ struct frame_timing_stats {
 			jitter_sum += jitter;
 
 			// Update adaptive timeout (exponential moving average)
-			// timeout = 2x max observed interval + processing time
-			bigtime_t targetTimeout = frame_interval_max * 2 + processing_time_max;
+			// timeout = 2x the 99th percentile interval + the 99th
+			// percentile processing time
+			bigtime_t targetTimeout = intervals.Percentile(99) * 2
+				+ processing.Percentile(99);
 			adaptive_timeout = (adaptive_timeout * 7 + targetTimeout) / 8;
 
-			// Clamp to reasonable range (10ms - 500ms)
+			// Clamp to a reasonable range: 10ms up to the 2s a fill
+			// waits for a frame
 			if (adaptive_timeout < 10000)
 				adaptive_timeout = 10000;
-			if (adaptive_timeout > 500000)
-				adaptive_timeout = 500000;
+			if (adaptive_timeout > 2000000)
+				adaptive_timeout = 2000000;
 		}
 
 		last_frame_time = now;
 		frame_count++;
 
 		// Update processing time stats
+		processing.Record(processingTime);
 		processing_time_sum += processingTime;
 		if (processingTime > processing_time_max)
 			processing_time_max = processingTime;
@@ -324,17 +418,58 @@ class CamDevice {
 	const flavor_info*	FlavorInfo() const { return &fFlavorInfo; };
 	virtual bool		SupportsBulk();
 	virtual bool		SupportsIsochronous();
+					// bulk transfers the data pump keeps queued; 1 runs them
+					// one at a time
+	virtual uint32		BulkTransfersInFlight();
 	virtual status_t	StartTransfer();
 	virtual status_t	StopTransfer();
 	virtual bool		TransferEnabled() const { return atomic_get((int32*)&fTransferEnabled) != 0; };
+	// Warm standby: the producer keeps the transfer running while it is
+	// connected but stopped, so starting it only waits for the next frame.
+	// Off unless WEBCAM_WARM_STANDBY is set or the parameter turned on.
+			void		SetWarmStandby(bool warm) { fWarmStandby = warm; };
+			bool		WarmStandby() const { return fWarmStandby; };
+	// Drops the frames queued while nobody took them
+			void		DiscardFrames();
 
 	virtual status_t	SuggestVideoFrame(uint32 &width, uint32 &height);
 	virtual status_t	AcceptVideoFrame(uint32 &width, uint32 &height);
 	virtual status_t	SetVideoFrame(BRect rect);
 	virtual BRect		VideoFrame() const { return fVideoFrame; };
+	// frame rate of the video frame AcceptVideoFrame() took: fps comes back
+	// as the nearest one the device has for it, its default for 0
+	virtual status_t	AcceptFrameRate(float &fps);
+	// the rate the device streams at once started, else the accepted one
+			float		FrameRate() const { return fFrameRate; };
 	virtual status_t	SetScale(float scale);
 	virtual status_t	SetVideoParams(float brightness, float contrast, float hue, float red, float green, float blue);
 
+	// output color space of FillFrameBuffer(), negotiated by the producer
+	virtual bool		SupportsColorSpace(color_space space);
+	virtual status_t	SetColorSpace(color_space space);
+			color_space	ColorSpace() const { return fColorSpace; };
+	// FillFrameBuffer() hands the camera's MJPEG frames on as they came,
+	// with Huffman tables if they lack them, instead of a decoded picture;
+	// for an encoded output. Buffers then hold up to a YUY2 frame of the
+	// size plus CAM_JPEG_DHT_SIZE and get size_used set.
+	virtual bool		SupportsMJPEGPassthrough();
+	virtual status_t	SetMJPEGPassthrough(bool passthrough);
+			bool		MJPEGPassthrough() const { return fMJPEGPassthrough; };
+
+	// Part of the frame FillFrameBuffer() decodes: what the consumer's view
+	// shows (VideoClippingChanged(), in frame pixels; NULL for all of it)
+	// and the crop (fractions of the frame, from the crop parameters).
+	// Outside the visible region the buffer is left as it was, outside the
+	// crop it is black.
+			void		SetVisibleRegion(const clipping_rect* region);
+			void		SetCrop(BRect crop);
+			BRect		Crop() const;
+	// The region of a width x height frame to decode, inclusive and on
+	// whole macro-pixels, possibly empty; false if it is the whole frame.
+	// *blackOutside tells whether a crop is set.
+			bool		DecodeRegion(int32 width, int32 height,
+							clipping_rect* region, bool* blackOutside) const;
+
 	virtual void		AddParameters(BParameterGroup *group, int32 &index);
 	virtual status_t	GetParameterValue(int32 id, bigtime_t *last_change, void *value, size_t *size);
 	virtual status_t	SetParameterValue(int32 id, bigtime_t when, const void *value, size_t size);
@@ -379,10 +514,69 @@ class CamDevice {
 	virtual void		OnConsecutiveTransferFailures(uint32 count);
 	virtual void		OnTransferSuccess();
 
+	// Thread priorities and placement of this camera's pipeline. Threads
+	// spawned after a change get it; ApplyThreadPolicy() updates the
+	// running USB threads.
+			CamThreadPolicy&	ThreadPolicy() { return fThreadPolicy; }
+	virtual void		ApplyThreadPolicy();
+			const cam_schedule_stats&	PumpScheduleStats() const
+							{ return fPumpSchedule; }
+
+	// Synchronized capture (see CamTimebase.h): the roster puts grouped
+	// cameras on one timebase, and has their pumps start at one time
+			void		SetTimebase(CamTimebase* timebase, int32 member)
+							{ fTimebase = timebase;
+							  fTimebaseMember = member; }
+			CamTimebase*	Timebase() const { return fTimebase; }
+			int32		TimebaseMember() const { return fTimebaseMember; }
+			void		SetGroupStart(bigtime_t start)
+							{ atomic_set64(&fGroupStart, start); }
+
+	// Live metrics (see CamMetrics.h). GetMetrics() adds the gauges that
+	// are sampled rather than counted; either node hands a
+	// WEBCAM_MSG_GET_METRICS request to HandleMetricsRequest().
+			CamMetrics&	Metrics() { return fMetrics; }
+	virtual void		GetMetrics(cam_metrics_snapshot* snapshot);
+			status_t	HandleMetricsRequest(const void* data, size_t size,
+							int32 node, const char* name);
+
+	// Per-frame latency probe (see CamLatencyProbe.h), filled by the video
+	// node; it hands a WEBCAM_MSG_GET_LATENCY_PROBE request to
+	// HandleProbeRequest()
+			CamLatencyProbe&	LatencyProbe() { return fLatencyProbe; }
+			status_t	HandleProbeRequest(const void* data, size_t size,
+							int32 node, const char* name);
+
+	// Still images while the video runs (see CamStill.h). The video node
+	// hands a WEBCAM_MSG_CAPTURE_STILL request to HandleStillRequest();
+	// CaptureStill() only starts the capture, the image goes to the target
+	// once it is there. The base class has no still pipe.
+	virtual status_t	CaptureStill(const BMessenger& target, uint32 width,
+							uint32 height, bool decoded, int32 cookie);
+			status_t	HandleStillRequest(const void* data, size_t size);
+	static	status_t	SendStillImage(const BMessenger& target, int32 cookie,
+							status_t status, BMessage* image = NULL);
+
+	// What a capture (WEBCAM_CAPTURE, see CamCapture.h) notes about a
+	// stream when it starts
+	virtual void		GetCaptureStreamInfo(uint8 stream,
+							cam_capture_stream_info* info);
+
 	// several ways to get raw frames
 	virtual status_t	WaitFrame(bigtime_t timeout);
 	virtual status_t	GetFrameBitmap(BBitmap **bm, bigtime_t *stamp=NULL);
-	virtual status_t	FillFrameBuffer(BBuffer *buffer, bigtime_t *stamp=NULL);
+	// Sets *sequence to the deframer order of the frame it consumed (even
+	// if filling then failed), so callers running more than one fill at once
+	// can put the buffers back in order. With 'times', also when the frame
+	// arrived and was complete (0 if unknown), for the latency probe.
+	virtual status_t	FillFrameBuffer(BBuffer *buffer, bigtime_t *stamp=NULL,
+							uint32 *sequence=NULL,
+							cam_frame_times *times=NULL);
+	// How many FillFrameBuffer() calls may usefully run in parallel
+	virtual int32		FillFrameBufferConcurrency();
+	// Load shedding: drop 'skip' raw or compressed frames for every one
+	// that is filled, before anything is decoded
+	virtual void		SetFrameSkip(int32 skip);
 
 	// locking
 	bool				Lock();
@@ -418,6 +612,12 @@ class CamDevice {
 	void				SetDataInput(BDataIO *input);
 	virtual status_t	DataPumpThread();
 	static int32		_DataPumpThread(void *_this);
+	static int32		_BulkSlotThread(void *_slot);
+			int32		BulkSlotThread(usb_bulk_transfer_slot *slot);
+#ifdef SUPPORT_ISO
+	static int32		_IsoSlotThread(void *_slot);
+			int32		IsoSlotThread(usb_iso_transfer_slot *slot);
+#endif
 	
 	virtual void		DumpRegs();
 	
@@ -440,6 +640,8 @@ class CamDevice {
 	static	bigtime_t	CalculateBackoffDelay(uint32 attempt,
 									const usb_retry_config& config);
 	CamSensor			*CreateSensor(const char *name);
+			void		AddCaptureStream(uint8 stream,
+							const BUSBEndpoint* endpoint);
 		status_t		fInitStatus;
 		flavor_info		fFlavorInfo;
 		media_format	fMediaFormat;
@@ -448,6 +650,8 @@ class CamDevice {
 		CamSensor*		fSensor;
 		CamDeframer*	fDeframer;
 		BDataIO*		fDataInput; // where data from usb goes, likely fDeframer
+		CamFilterInterface*	fPacketInput;	// fDataInput if it takes whole
+											// transfers, or NULL
 		const BUSBEndpoint*	fBulkIn;
 		const BUSBEndpoint*	fIsoIn;
 		uint32			fIsoMaxPacketSize;
@@ -462,11 +666,27 @@ class CamDevice {
 		bool			fChipIsBigEndian;
 		int32			fTransferEnabled; // Changed to int32 for atomic operations
 		thread_id		fPumpThread;
+		// Two lock domains: fLocker serializes control requests,
+		// parameters and starting and stopping; fTransferLock guards the
+		// endpoints and the transfer buffer the pumps use. Neither is held
+		// across an ISO transfer, and no control request is made under
+		// fTransferLock, so control and streaming do not wait on each other.
 		BLocker			fLocker;
-		uint8			*fBuffer;
+		BLocker			fTransferLock;
+		uint8			*fBuffer;		// In fTransferArea
 		size_t			fBufferLen;
+		CamTransferArea	fTransferArea;
 		BRect			fVideoFrame;
+		color_space		fColorSpace;
+		bool			fMJPEGPassthrough;
+		float			fFrameRate;
+		bool			fWarmStandby;
+		mutable BLocker	fRegionLock;
+		clipping_rect	fVisibleRegion;
+		bool			fHasVisibleRegion;
+		BRect			fCrop;
 		int fDumpFD;
+		CamCaptureWriter*	fCapture;		// NULL unless WEBCAM_CAPTURE is set
 
 		// PHASE 3/4: USB packet statistics for error tracking
 		uint32			fPacketSuccessCount;
@@ -489,6 +709,20 @@ class CamDevice {
 		// Group 5: Error recovery configuration
 		error_recovery_config	fErrorRecoveryConfig;
 
+		// Thread policy, and how punctually the data pump re-arms transfers
+		static int32	sCameraCount;
+		CamThreadPolicy	fThreadPolicy;
+		cam_schedule_stats	fPumpSchedule;
+
+		// Live metrics, from every stage of this camera's pipeline
+		CamMetrics		fMetrics;
+		CamLatencyProbe	fLatencyProbe;
+
+		// Synchronized capture, NULL and -1 outside a group
+		CamTimebase*	fTimebase;
+		int32			fTimebaseMember;
+		int64			fGroupStart;	// the next pump waits until then
+
 		// Debug logging flags (converted from static to instance members)
 		bool			fFirstTransferLogged;
 		int				fDroppedFramesLogged;
@@ -508,6 +742,30 @@ class CamDevice {
 		uint8*			GetActiveBuffer();
 		uint8*			GetReadyBuffer();
 		void			SwapBuffers();
+
+		// Ring of in-flight bulk transfers, owned by the data pump
+		usb_bulk_transfer_slot*	fBulkSlots;
+		uint32			fBulkSlotCount;
+		CamTransferArea	fBulkRingArea;	// Every slot's buffer, kept across
+										// StartTransfer()/StopTransfer()
+		CamSubmitOrder	fBulkOrder;		// Slot threads reach the stack in
+										// ring order
+
+		status_t		StartBulkTransferRing(uint32 count, size_t bufferSize);
+		void			StopBulkTransferRing();
+		status_t		BulkRingPump();
+
+#ifdef SUPPORT_ISO
+		// Ring of in-flight isochronous transfers, owned by the data pump
+		usb_iso_transfer_slot*	fIsoSlots;
+		uint32			fIsoSlotCount;
+		CamTransferArea	fIsoRingArea;	// Same, for the packet data
+		CamSubmitOrder	fIsoOrder;		// Same, for the slot threads
+
+		status_t		StartIsoTransferRing(uint32 count, int32 packetCount,
+							size_t bufferSize, uint32 packetSize);
+		void			StopIsoTransferRing();
+#endif
 };
 
 // the addon itself, that instanciate
@@ -88,6 +88,34 @@ CamFilterInterface::WriteAt(off_t pos, const void *buffer, size_t size)
 }
 
 
+int32
+CamFilterInterface::WritePackets(const uint8 *buffer, size_t slotSize,
+	const usb_iso_packet_descriptor *packets, int32 packetCount)
+{
+	int32 written = 0;
+	for (int32 i = 0; i < packetCount; i++) {
+		size_t length = packets[i].actual_length;
+		if (packets[i].status != B_OK || length == 0 || length > slotSize)
+			continue;
+		Write(buffer + i * slotSize, length);
+		written++;
+	}
+	return written;
+}
+
+
+int32
+CamFilterInterface::WriteBulk(const uint8 *buffer, size_t length,
+	bool shortTransfer)
+{
+	(void)shortTransfer;
+	if (length == 0)
+		return 0;
+	Write(buffer, length);
+	return 1;
+}
+
+
 off_t
 CamFilterInterface::Seek(off_t position, uint32 seek_mode)
 {
@@ -8,6 +8,7 @@
 #include <kernel/OS.h>
 #include <support/DataIO.h>
 #include <interface/Rect.h>
+#include <USB3.h>
 class CamDevice;
 
 class CamFilterInterface : public BPositionIO {
@@ -30,6 +31,16 @@ virtual ssize_t		ReadAt(off_t pos, void *buffer, size_t size);
 
 virtual ssize_t		Write(const void *buffer, size_t size);
 virtual ssize_t		WriteAt(off_t pos, const void *buffer, size_t size);
+	// a whole isochronous transfer, packet i at buffer + i * slotSize;
+	// failed and empty packets are skipped. Returns the packets written.
+	// This one calls Write() per packet.
+virtual int32		WritePackets(const uint8 *buffer, size_t slotSize,
+						const usb_iso_packet_descriptor *packets,
+						int32 packetCount);
+	// a bulk transfer as it came in, 'shortTransfer' when it ended before
+	// the buffer was full. This one calls Write() if it is not empty.
+virtual int32		WriteBulk(const uint8 *buffer, size_t length,
+						bool shortTransfer);
 
 virtual off_t		Seek(off_t position, uint32 seek_mode);
 virtual off_t		Position() const;
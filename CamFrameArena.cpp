@@ -0,0 +1,275 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Preallocated frame storage, sized from the negotiated video format.
+ */
+
+
+#include "CamFrameArena.h"
+
+#include <Autolock.h>
+#include <string.h>
+#include <syslog.h>
+
+
+static inline size_t
+round_to_page(size_t size)
+{
+	return (size + B_PAGE_SIZE - 1) & ~((size_t)B_PAGE_SIZE - 1);
+}
+
+
+CamFrameArena::CamFrameArena(const char* name)
+	:
+	fName(name),
+	fArea(-1),
+	fSize(0),
+	fClassCount(0),
+	fLock("CamFrameArena lock")
+{
+	memset(fClasses, 0, sizeof(fClasses));
+}
+
+
+CamFrameArena::~CamFrameArena()
+{
+	if (fArea >= 0)
+		delete_area(fArea);
+}
+
+
+status_t
+CamFrameArena::SetLayout(const size_t* slotSizes, const int32* slotCounts,
+	int32 classCount)
+{
+	if (classCount <= 0 || classCount > kMaxSizeClasses)
+		return B_BAD_VALUE;
+
+	size_t sizes[kMaxSizeClasses];
+	size_t total = 0;
+	for (int32 i = 0; i < classCount; i++) {
+		if (slotSizes[i] == 0 || slotCounts[i] <= 0
+			|| slotCounts[i] > kMaxSlots)
+			return B_BAD_VALUE;
+		sizes[i] = round_to_page(slotSizes[i]);
+		total += sizes[i] * slotCounts[i];
+	}
+
+	BAutolock _(fLock);
+
+	bool unchanged = fArea >= 0 && fClassCount == classCount;
+	for (int32 i = 0; unchanged && i < classCount; i++) {
+		unchanged = fClasses[i].slotSize == sizes[i]
+			&& fClasses[i].slotCount == slotCounts[i];
+	}
+	if (unchanged)
+		return B_OK;
+
+	for (int32 i = 0; i < fClassCount; i++) {
+		if (fClasses[i].freeCount != fClasses[i].slotCount)
+			return B_BUSY;
+	}
+
+	if (fArea >= 0) {
+		delete_area(fArea);
+		fArea = -1;
+		fSize = 0;
+		fClassCount = 0;
+	}
+
+	// Locked, so the USB thread never takes a page fault on a frame
+	uint8* base;
+	area_id area = create_area(fName, (void**)&base, B_ANY_ADDRESS, total,
+		B_FULL_LOCK, B_READ_AREA | B_WRITE_AREA);
+	if (area < 0) {
+		syslog(LOG_ERR, "CamFrameArena: cannot create %zu byte area: %s\n",
+			total, strerror(area));
+		return area;
+	}
+
+	fArea = area;
+	fSize = total;
+	fClassCount = classCount;
+	for (int32 i = 0; i < classCount; i++) {
+		size_class& sizeClass = fClasses[i];
+		sizeClass.slotSize = sizes[i];
+		sizeClass.slotCount = slotCounts[i];
+		sizeClass.base = base;
+		sizeClass.freeCount = slotCounts[i];
+		// Hand out the lowest slots first
+		for (int32 j = 0; j < slotCounts[i]; j++)
+			sizeClass.free[j] = slotCounts[i] - 1 - j;
+		base += sizes[i] * slotCounts[i];
+	}
+
+	syslog(LOG_INFO, "CamFrameArena: %s: %zu KB in %d size classes\n",
+		fName, total / 1024, (int)classCount);
+	for (int32 i = 0; i < classCount; i++) {
+		syslog(LOG_INFO, "CamFrameArena:   class %d: %d x %zu KB\n", (int)i,
+			(int)fClasses[i].slotCount, fClasses[i].slotSize / 1024);
+	}
+	return B_OK;
+}
+
+
+status_t
+CamFrameArena::Unset()
+{
+	BAutolock _(fLock);
+
+	for (int32 i = 0; i < fClassCount; i++) {
+		if (fClasses[i].freeCount != fClasses[i].slotCount)
+			return B_BUSY;
+	}
+
+	if (fArea >= 0)
+		delete_area(fArea);
+	fArea = -1;
+	fSize = 0;
+	fClassCount = 0;
+	return B_OK;
+}
+
+
+void*
+CamFrameArena::AcquireSlot(int32 sizeClass)
+{
+	BAutolock _(fLock);
+
+	if (sizeClass < 0 || sizeClass >= fClassCount)
+		return NULL;
+
+	size_class& slots = fClasses[sizeClass];
+	if (slots.freeCount == 0)
+		return NULL;
+
+	int32 index = slots.free[--slots.freeCount];
+	return slots.base + (size_t)index * slots.slotSize;
+}
+
+
+void
+CamFrameArena::ReleaseSlot(void* slot)
+{
+	if (slot == NULL)
+		return;
+
+	BAutolock _(fLock);
+
+	uint8* address = (uint8*)slot;
+	for (int32 i = 0; i < fClassCount; i++) {
+		size_class& slots = fClasses[i];
+		size_t span = slots.slotSize * slots.slotCount;
+		if (address < slots.base || address >= slots.base + span)
+			continue;
+
+		size_t offset = address - slots.base;
+		if (offset % slots.slotSize != 0 || slots.freeCount >= slots.slotCount)
+			break;
+		slots.free[slots.freeCount++] = offset / slots.slotSize;
+		return;
+	}
+
+	syslog(LOG_ERR, "CamFrameArena: %s: release of foreign slot %p\n",
+		fName, slot);
+}
+
+
+size_t
+CamFrameArena::SlotSize(int32 sizeClass) const
+{
+	BAutolock _(fLock);
+	if (sizeClass < 0 || sizeClass >= fClassCount)
+		return 0;
+	return fClasses[sizeClass].slotSize;
+}
+
+
+int32
+CamFrameArena::SlotCount(int32 sizeClass) const
+{
+	BAutolock _(fLock);
+	if (sizeClass < 0 || sizeClass >= fClassCount)
+		return 0;
+	return fClasses[sizeClass].slotCount;
+}
+
+
+int32
+CamFrameArena::FreeSlots(int32 sizeClass) const
+{
+	BAutolock _(fLock);
+	if (sizeClass < 0 || sizeClass >= fClassCount)
+		return 0;
+	return fClasses[sizeClass].freeCount;
+}
+
+
+// =============================================================================
+// CamTransferArea
+// =============================================================================
+
+
+CamTransferArea::CamTransferArea(const char* name)
+	:
+	fName(name),
+	fArea(-1),
+	fData(NULL),
+	fSize(0)
+{
+}
+
+
+CamTransferArea::~CamTransferArea()
+{
+	Unset();
+}
+
+
+status_t
+CamTransferArea::Reserve(size_t size)
+{
+	if (size == 0)
+		return B_BAD_VALUE;
+
+	size = round_to_page(size);
+	if (fArea >= 0 && fSize >= size)
+		return B_OK;
+
+	Unset();
+
+	uint8* data;
+	area_id area = create_area(fName, (void**)&data, B_ANY_ADDRESS, size,
+		B_FULL_LOCK, B_READ_AREA | B_WRITE_AREA);
+	if (area < 0) {
+		syslog(LOG_ERR, "CamTransferArea: cannot create %zu byte area %s: "
+			"%s\n", size, fName, strerror(area));
+		return area;
+	}
+
+	fArea = area;
+	fData = data;
+	fSize = size;
+	syslog(LOG_INFO, "CamTransferArea: %s: %zu KB locked\n", fName,
+		size / 1024);
+	return B_OK;
+}
+
+
+void
+CamTransferArea::Unset()
+{
+	if (fArea >= 0)
+		delete_area(fArea);
+	fArea = -1;
+	fData = NULL;
+	fSize = 0;
+}
+
+
+size_t
+CamTransferArea::SlotStride(size_t bufferSize)
+{
+	return round_to_page(bufferSize);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Preallocated frame storage, sized from the negotiated video format.
+ */
+#ifndef _CAM_FRAME_ARENA_H
+#define _CAM_FRAME_ARENA_H
+
+
+#include <OS.h>
+#include <Locker.h>
+
+
+// =============================================================================
+// Frame Arena
+// =============================================================================
+// One locked area cut into fixed-size slots, in a few size classes (raw
+// frames from the deframer, decoded frames for the repeat cache). It is
+// laid out before streaming starts, from the frame size the device
+// committed to, so nothing is allocated while frames are flowing and the
+// footprint follows the resolution in use. Slots are handed out and taken
+// back under a lock; that only happens when frames are created and
+// destroyed, never per frame.
+
+class CamFrameArena {
+public:
+	enum {
+		kMaxSizeClasses	= 4,
+		kMaxSlots		= 32	// per size class
+	};
+
+									CamFrameArena(const char* name);
+									~CamFrameArena();
+
+									// (Re)lay out the arena. Keeps the
+									// current area if the layout is
+									// unchanged; fails with B_BUSY while any
+									// slot is still handed out.
+			status_t				SetLayout(const size_t* slotSizes,
+										const int32* slotCounts,
+										int32 classCount);
+									// Free the area (no slot may be out)
+			status_t				Unset();
+
+			bool					IsSet() const { return fArea >= 0; }
+
+									// NULL when the class is exhausted
+			void*					AcquireSlot(int32 sizeClass);
+			void					ReleaseSlot(void* slot);
+
+			size_t					SlotSize(int32 sizeClass) const;
+			int32					SlotCount(int32 sizeClass) const;
+			int32					FreeSlots(int32 sizeClass) const;
+			size_t					Footprint() const { return fSize; }
+
+private:
+	struct size_class {
+		size_t		slotSize;		// multiple of B_PAGE_SIZE
+		int32		slotCount;
+		uint8*		base;
+		int32		free[kMaxSlots];
+		int32		freeCount;
+	};
+
+			const char*				fName;
+			area_id					fArea;
+			size_t					fSize;
+			size_class				fClasses[kMaxSizeClasses];
+			int32					fClassCount;
+	mutable	BLocker					fLock;
+};
+
+
+// =============================================================================
+// Transfer Area
+// =============================================================================
+// Locked, page aligned memory for buffers handed to the USB stack: a
+// malloc()ed buffer has to be locked and mapped by the stack around every
+// transfer, and can take a page fault on the pump thread. The area only
+// grows; it is kept when streaming stops, so starting again allocates
+// nothing, and freed with its owner.
+
+class CamTransferArea {
+public:
+									CamTransferArea(const char* name);
+									~CamTransferArea();
+
+									// At least size bytes, a whole number
+									// of pages. Keeps the current area if it
+									// is big enough; the contents are not
+									// kept when it grows.
+			status_t				Reserve(size_t size);
+			void					Unset();
+
+			uint8*					Data() const { return fData; }
+			size_t					Size() const { return fSize; }
+
+									// Stride that starts every buffer of a
+									// ring on a page of its own
+	static	size_t					SlotStride(size_t bufferSize);
+
+private:
+			const char*				fName;
+			area_id					fArea;
+			uint8*					fData;
+			size_t					fSize;
+};
+
+
+#endif /* _CAM_FRAME_ARENA_H */
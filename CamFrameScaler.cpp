@@ -0,0 +1,313 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Scales decoded frames for the producer's extra outputs.
+ */
+
+
+#include "CamFrameScaler.h"
+
+#include <new>
+#include <string.h>
+
+
+// Samples averaged at most: 9 partly covered source pairs times 8 rows
+static const int32 kMaxBoxSamples
+	= (CamFrameScaler::kMaxShrink + 1) * CamFrameScaler::kMaxShrink;
+
+
+// (sum * value[n] + (1 << 21)) >> 22 is sum / n rounded half up, exactly,
+// for every sum of n bytes
+static const struct box_reciprocals {
+	uint32	value[kMaxBoxSamples + 1];
+
+	box_reciprocals()
+	{
+		value[0] = 0;
+		for (int32 n = 1; n <= kMaxBoxSamples; n++)
+			value[n] = ((1 << 22) + n - 1) / n;
+	}
+} sReciprocals;
+
+
+static inline uint8
+box_average(uint32 sum, int32 count)
+{
+	return (uint8)((sum * sReciprocals.value[count] + (1 << 21)) >> 22);
+}
+
+
+static inline bool
+is_rgb(color_space space)
+{
+	return space == B_RGB32 || space == B_RGB24 || space == B_RGB16;
+}
+
+
+static inline int32
+bytes_per_pixel(color_space space)
+{
+	switch (space) {
+		case B_RGB32:
+			return 4;
+		case B_RGB24:
+			return 3;
+		default:
+			return 2;
+	}
+}
+
+
+CamFrameScaler::CamFrameScaler()
+	:
+	fSourceSpace(B_NO_COLOR_SPACE),
+	fSourceWidth(0),
+	fSourceHeight(0),
+	fSpace(B_NO_COLOR_SPACE),
+	fWidth(0),
+	fHeight(0),
+	fColumns(NULL),
+	fPairs(NULL)
+{
+}
+
+
+CamFrameScaler::~CamFrameScaler()
+{
+	Unset();
+}
+
+
+bool
+CamFrameScaler::Supports(color_space source, color_space destination)
+{
+	if (is_rgb(source))
+		return is_rgb(destination);
+	return source == B_YCbCr422 && destination == B_YCbCr422;
+}
+
+
+status_t
+CamFrameScaler::SetFormat(color_space sourceSpace, int32 sourceWidth,
+	int32 sourceHeight, color_space space, int32 width, int32 height)
+{
+	Unset();
+
+	if (!Supports(sourceSpace, space))
+		return B_BAD_VALUE;
+	if (sourceWidth <= 0 || sourceHeight <= 0 || width <= 0 || height <= 0
+		|| sourceWidth > kMaxWidth || width > kMaxWidth
+		|| sourceWidth > width * kMaxShrink
+		|| sourceHeight > height * kMaxShrink)
+		return B_BAD_VALUE;
+	// Pairs share their chroma
+	if (space == B_YCbCr422 && ((sourceWidth | width) & 1) != 0)
+		return B_BAD_VALUE;
+
+	fColumns = new(std::nothrow) span[width];
+	if (fColumns == NULL)
+		return B_NO_MEMORY;
+	for (int32 x = 0; x < width; x++) {
+		int32 first = x * sourceWidth / width;
+		int32 end = (x + 1) * sourceWidth / width;
+		fColumns[x].first = first;
+		fColumns[x].count = end > first ? end - first : 1;
+	}
+
+	if (space == B_YCbCr422) {
+		fPairs = new(std::nothrow) span[width / 2];
+		if (fPairs == NULL) {
+			Unset();
+			return B_NO_MEMORY;
+		}
+		for (int32 p = 0; p < width / 2; p++) {
+			const span& left = fColumns[p * 2];
+			const span& right = fColumns[p * 2 + 1];
+			int32 first = left.first / 2;
+			int32 end = (right.first + right.count + 1) / 2;
+			fPairs[p].first = first;
+			fPairs[p].count = end - first;
+		}
+	}
+
+	fSourceSpace = sourceSpace;
+	fSourceWidth = sourceWidth;
+	fSourceHeight = sourceHeight;
+	fSpace = space;
+	fWidth = width;
+	fHeight = height;
+	return B_OK;
+}
+
+
+void
+CamFrameScaler::Unset()
+{
+	delete[] fColumns;
+	delete[] fPairs;
+	fColumns = NULL;
+	fPairs = NULL;
+	fSourceWidth = fSourceHeight = fWidth = fHeight = 0;
+}
+
+
+bool
+CamFrameScaler::Matches(color_space sourceSpace, int32 sourceWidth,
+	int32 sourceHeight) const
+{
+	return IsSet() && sourceSpace == fSourceSpace
+		&& sourceWidth == fSourceWidth && sourceHeight == fSourceHeight;
+}
+
+
+status_t
+CamFrameScaler::Scale(const uint8* source, size_t sourceSize,
+	size_t sourceBytesPerRow, uint8* dst, size_t bytesPerRow) const
+{
+	if (!IsSet() || source == NULL || dst == NULL)
+		return B_NO_INIT;
+
+	size_t rowBytes = (size_t)fSourceWidth * bytes_per_pixel(fSourceSpace);
+	if (sourceBytesPerRow < rowBytes
+		|| sourceSize < sourceBytesPerRow * (fSourceHeight - 1) + rowBytes)
+		return B_BAD_DATA;
+
+	// Column sums of the rows under one output row, at most kMaxShrink of
+	// them: three channels per pixel, or the bytes of a YCbCr row
+	uint16 sums[kMaxWidth * 3];
+
+	for (int32 y = 0; y < fHeight; y++) {
+		int32 first = y * fSourceHeight / fHeight;
+		int32 end = (y + 1) * fSourceHeight / fHeight;
+		int32 rows = end > first ? end - first : 1;
+
+		const uint8* row = source + first * sourceBytesPerRow;
+		switch (fSourceSpace) {
+			case B_RGB32:
+			case B_RGB24:
+			{
+				int32 step = bytes_per_pixel(fSourceSpace);
+				const uint8* pixel = row;
+				for (int32 x = 0; x < fSourceWidth * 3; x += 3) {
+					sums[x] = pixel[0];
+					sums[x + 1] = pixel[1];
+					sums[x + 2] = pixel[2];
+					pixel += step;
+				}
+				for (int32 r = 1; r < rows; r++) {
+					pixel = row + r * sourceBytesPerRow;
+					for (int32 x = 0; x < fSourceWidth * 3; x += 3) {
+						sums[x] += pixel[0];
+						sums[x + 1] += pixel[1];
+						sums[x + 2] += pixel[2];
+						pixel += step;
+					}
+				}
+				break;
+			}
+			case B_RGB16:
+				memset(sums, 0, fSourceWidth * 3 * sizeof(uint16));
+				for (int32 r = 0; r < rows; r++) {
+					const uint8* line = row + r * sourceBytesPerRow;
+					for (int32 x = 0; x < fSourceWidth; x++) {
+						uint16 pixel;
+						memcpy(&pixel, line + x * 2, 2);
+						uint32 b = pixel & 0x1f;
+						uint32 g = (pixel >> 5) & 0x3f;
+						uint32 red = pixel >> 11;
+						sums[x * 3] += (b << 3) | (b >> 2);
+						sums[x * 3 + 1] += (g << 2) | (g >> 4);
+						sums[x * 3 + 2] += (red << 3) | (red >> 2);
+					}
+				}
+				break;
+			default:
+				for (int32 i = 0; i < fSourceWidth * 2; i++)
+					sums[i] = row[i];
+				for (int32 r = 1; r < rows; r++) {
+					const uint8* line = row + r * sourceBytesPerRow;
+					for (int32 i = 0; i < fSourceWidth * 2; i++)
+						sums[i] += line[i];
+				}
+				break;
+		}
+
+		if (fSpace == B_YCbCr422)
+			_ScaleYCbCrRow(sums, rows, dst + y * bytesPerRow);
+		else
+			_ScaleRGBRow(sums, rows, dst + y * bytesPerRow);
+	}
+	return B_OK;
+}
+
+
+void
+CamFrameScaler::_ScaleRGBRow(const uint16* sums, int32 rows, uint8* dst) const
+{
+	for (int32 x = 0; x < fWidth; x++) {
+		const span& column = fColumns[x];
+		const uint16* sum = sums + column.first * 3;
+		uint32 b = 0, g = 0, r = 0;
+		for (int32 i = 0; i < column.count * 3; i += 3) {
+			b += sum[i];
+			g += sum[i + 1];
+			r += sum[i + 2];
+		}
+		int32 count = column.count * rows;
+		uint8 blue = box_average(b, count);
+		uint8 green = box_average(g, count);
+		uint8 red = box_average(r, count);
+
+		switch (fSpace) {
+			case B_RGB32:
+				dst[0] = blue;
+				dst[1] = green;
+				dst[2] = red;
+				dst[3] = 255;
+				dst += 4;
+				break;
+			case B_RGB24:
+				dst[0] = blue;
+				dst[1] = green;
+				dst[2] = red;
+				dst += 3;
+				break;
+			default:
+			{
+				uint16 pixel = (uint16)(((red >> 3) << 11)
+					| ((green >> 2) << 5) | (blue >> 3));
+				memcpy(dst, &pixel, 2);
+				dst += 2;
+				break;
+			}
+		}
+	}
+}
+
+
+/* Y0 Cb Y1 Cr: luma per pixel, chroma per pair */
+void
+CamFrameScaler::_ScaleYCbCrRow(const uint16* sums, int32 rows,
+	uint8* dst) const
+{
+	for (int32 p = 0; p < fWidth / 2; p++) {
+		for (int32 k = 0; k < 2; k++) {
+			const span& column = fColumns[p * 2 + k];
+			uint32 luma = 0;
+			for (int32 i = 0; i < column.count; i++)
+				luma += sums[(column.first + i) * 2];
+			dst[k * 2] = box_average(luma, column.count * rows);
+		}
+
+		const span& pairs = fPairs[p];
+		uint32 cb = 0, cr = 0;
+		for (int32 i = 0; i < pairs.count; i++) {
+			cb += sums[(pairs.first + i) * 4 + 1];
+			cr += sums[(pairs.first + i) * 4 + 3];
+		}
+		dst[1] = box_average(cb, pairs.count * rows);
+		dst[3] = box_average(cr, pairs.count * rows);
+		dst += 4;
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Scales decoded frames for the producer's extra outputs.
+ */
+#ifndef _CAM_FRAME_SCALER_H
+#define _CAM_FRAME_SCALER_H
+
+
+#include <GraphicsDefs.h>
+#include <OS.h>
+
+
+// =============================================================================
+// Frame Scaler
+// =============================================================================
+// Makes a smaller (or, replicating pixels, larger) copy of a decoded output
+// frame in another size and, between the RGB spaces, another color space.
+// Shrinking is a box filter: each output pixel is the average of the
+// source pixels under it, B_YCbCr422 chroma the average of the source pairs
+// under its pair. A vertical pass sums the rows of an output row into a
+// line of column sums on the stack, which the horizontal pass averages from;
+// the source is read once.
+//
+// SetFormat() lays out the column tables; Scale() only reads them, so any
+// number of threads may scale with one scaler at once, as long as none
+// changes the format meanwhile.
+
+class CamFrameScaler {
+public:
+	enum {
+		kMaxShrink		= 8,		// per axis
+		kMaxWidth		= 4096		// source and output
+	};
+
+									CamFrameScaler();
+									~CamFrameScaler();
+
+									// B_RGB32, B_RGB24 and B_RGB16 into each
+									// other, B_YCbCr422 into itself
+	static	bool					Supports(color_space source,
+										color_space destination);
+
+			status_t				SetFormat(color_space sourceSpace,
+										int32 sourceWidth, int32 sourceHeight,
+										color_space space, int32 width,
+										int32 height);
+			void					Unset();
+			bool					IsSet() const { return fColumns != NULL; }
+
+			bool					Matches(color_space sourceSpace,
+										int32 sourceWidth,
+										int32 sourceHeight) const;
+
+									// Rows are bytesPerRow apart; B_BAD_DATA
+									// if the source is shorter than a frame
+			status_t				Scale(const uint8* source,
+										size_t sourceSize,
+										size_t sourceBytesPerRow, uint8* dst,
+										size_t bytesPerRow) const;
+
+private:
+	struct span {
+		uint16		first;
+		uint16		count;
+	};
+
+			void					_ScaleRGBRow(const uint16* sums,
+										int32 rows, uint8* dst) const;
+			void					_ScaleYCbCrRow(const uint16* sums,
+										int32 rows, uint8* dst) const;
+
+			color_space				fSourceSpace;
+			int32					fSourceWidth;
+			int32					fSourceHeight;
+			color_space				fSpace;
+			int32					fWidth;
+			int32					fHeight;
+			span*					fColumns;	// per output pixel
+			span*					fPairs;		// per output pair, YCbCr
+};
+
+
+#endif /* _CAM_FRAME_SCALER_H */
@@ -0,0 +1,311 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * JPEG marker index, built while a frame is assembled.
+ */
+
+
+#include "CamJpegIndex.h"
+
+#include <string.h>
+
+
+static inline uint16
+read_be16(const uint8* data)
+{
+	return (uint16)(data[0] << 8 | data[1]);
+}
+
+
+// DHT segment of the tables ITU T.81 K.3 gives for 8 bit samples: DC and
+// AC luminance (tables 0), DC and AC chrominance (tables 1), each the code
+// count per length and then the values
+static const uint8 kStandardHuffmanTables[CAM_JPEG_DHT_SIZE] = {
+	0xff, 0xc4, 0x01, 0xa2,
+	// DC luminance
+	0x00,
+	0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01,
+	0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b,
+	// DC chrominance
+	0x01,
+	0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b,
+	// AC luminance
+	0x10,
+	0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03,
+	0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d,
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+	0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+	0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+	0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+	0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+	0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+	0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+	0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+	0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+	0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa,
+	// AC chrominance
+	0x11,
+	0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04,
+	0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77,
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+	0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+	0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+	0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+	0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+	0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+	0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+	0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+	0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+	0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+
+// Frame header markers: SOF0..SOF15 but DHT (c4), JPG (c8) and DAC (cc)
+static inline bool
+is_sof_marker(uint8 marker)
+{
+	return marker >= 0xc0 && marker <= 0xcf && marker != 0xc4
+		&& marker != 0xc8 && marker != 0xcc;
+}
+
+
+void
+cam_jpeg_index_reset(cam_jpeg_index* index)
+{
+	index->soi_offset = CAM_JPEG_NONE;
+	index->eoi_offset = CAM_JPEG_NONE;
+	index->sof_offset = CAM_JPEG_NONE;
+	index->sos_offset = CAM_JPEG_NONE;
+	index->width = 0;
+	index->height = 0;
+	index->sof_marker = 0;
+	index->components = 0;
+	memset(index->sampling, 0, sizeof(index->sampling));
+	index->has_dht = false;
+	index->restart_interval = 0;
+	index->restart_count = 0;
+	index->state = CAM_JPEG_SCAN_SOI;
+	index->scanned = 0;
+}
+
+
+/* One marker segment at 'pos'; false until enough of it has arrived.
+ * Moves 'pos' past it. */
+static bool
+parse_segment(cam_jpeg_index* index, const uint8* data, size_t length,
+	size_t& pos)
+{
+	uint8 marker = data[pos + 1];
+
+	// Standalone markers
+	if (marker == 0xd8 || marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) {
+		pos += 2;
+		return true;
+	}
+	if (marker == 0xd9) {
+		index->eoi_offset = pos;
+		index->state = CAM_JPEG_SCAN_DONE;
+		pos += 2;
+		return true;
+	}
+
+	if (pos + 4 > length)
+		return false;
+	uint16 segmentLength = read_be16(data + pos + 2);
+	if (segmentLength < 2) {
+		index->state = CAM_JPEG_SCAN_BROKEN;
+		return false;
+	}
+	size_t end = pos + 2 + segmentLength;
+
+	if (is_sof_marker(marker)) {
+		// P, Y, X, Nf, then Ci, Hi << 4 | Vi, Tqi per component
+		if (end > length)
+			return false;
+		if (segmentLength < 8) {
+			index->state = CAM_JPEG_SCAN_BROKEN;
+			return false;
+		}
+		const uint8* sof = data + pos + 4;
+		if (index->sof_offset == CAM_JPEG_NONE) {
+			index->sof_offset = pos;
+			index->sof_marker = marker;
+			index->height = read_be16(sof + 1);
+			index->width = read_be16(sof + 3);
+			index->components = sof[5];
+			for (uint8 i = 0; i < index->components && i < 3
+				&& 6 + i * 3 + 2 <= segmentLength - 2; i++)
+				index->sampling[i] = sof[6 + i * 3 + 1];
+		}
+	} else if (marker == 0xdd) {
+		if (pos + 6 > length)
+			return false;
+		index->restart_interval = read_be16(data + pos + 4);
+	} else if (marker == 0xc4) {
+		index->has_dht = true;
+	} else if (marker == 0xda) {
+		if (index->sos_offset == CAM_JPEG_NONE)
+			index->sos_offset = pos;
+		// The scan header is skipped as a whole, entropy data follows
+		index->state = CAM_JPEG_SCAN_ENTROPY;
+	}
+
+	pos = end;
+	return true;
+}
+
+
+void
+cam_jpeg_index_update(cam_jpeg_index* index, const uint8* data,
+	size_t length)
+{
+	size_t pos = index->scanned;
+
+	while (pos < length) {
+		switch (index->state) {
+			case CAM_JPEG_SCAN_SOI:
+			{
+				// Some cameras put a few bytes before the JPEG
+				size_t window = length < CAM_JPEG_SOI_WINDOW
+					? length : CAM_JPEG_SOI_WINDOW;
+				const uint8* found = NULL;
+				while (pos + 1 < window) {
+					found = (const uint8*)memchr(data + pos, 0xff,
+						window - 1 - pos);
+					if (found == NULL) {
+						pos = window - 1;
+						break;
+					}
+					pos = found - data;
+					if (data[pos + 1] == 0xd8)
+						break;
+					pos++;
+					found = NULL;
+				}
+				if (found != NULL) {
+					index->soi_offset = pos;
+					index->state = CAM_JPEG_SCAN_HEADER;
+					pos += 2;
+					break;
+				}
+				if (length >= CAM_JPEG_SOI_WINDOW)
+					index->state = CAM_JPEG_SCAN_BROKEN;
+				index->scanned = pos;
+				return;
+			}
+
+			case CAM_JPEG_SCAN_HEADER:
+				if (pos + 2 > length) {
+					index->scanned = pos;
+					return;
+				}
+				if (data[pos] != 0xff) {
+					index->state = CAM_JPEG_SCAN_BROKEN;
+					break;
+				}
+				if (data[pos + 1] == 0xff) {
+					// Fill byte
+					pos++;
+					break;
+				}
+				if (!parse_segment(index, data, length, pos)) {
+					index->scanned = pos;
+					return;
+				}
+				break;
+
+			case CAM_JPEG_SCAN_ENTROPY:
+			{
+				const uint8* found = (const uint8*)memchr(data + pos, 0xff,
+					length - pos);
+				if (found == NULL) {
+					pos = length;
+					break;
+				}
+				pos = found - data;
+				if (pos + 2 > length) {
+					index->scanned = pos;
+					return;
+				}
+				uint8 marker = data[pos + 1];
+				if (marker == 0x00 || marker == 0xff) {
+					// Stuffed data byte, or fill before a marker
+					pos += marker == 0x00 ? 2 : 1;
+				} else if (marker >= 0xd0 && marker <= 0xd7) {
+					if (index->restart_count < CAM_JPEG_MAX_RESTARTS)
+						index->restarts[index->restart_count] = pos;
+					if (index->restart_count < 0xffff)
+						index->restart_count++;
+					pos += 2;
+				} else {
+					// EOI, or the tables and header of a further scan
+					index->state = CAM_JPEG_SCAN_HEADER;
+				}
+				break;
+			}
+
+			default:
+				// Done or broken: whatever follows is not looked at
+				index->scanned = length;
+				return;
+		}
+	}
+
+	index->scanned = pos;
+}
+
+
+size_t
+cam_jpeg_copy_with_tables(const cam_jpeg_index& index, const uint8* data,
+	uint8* dst, size_t capacity)
+{
+	if (!cam_jpeg_index_complete(index) || index.sos_offset == CAM_JPEG_NONE
+		|| index.eoi_offset < index.sos_offset)
+		return 0;
+
+	// Trailing padding after EOI is left behind
+	size_t length = index.eoi_offset + 2 - index.soi_offset;
+	size_t size = length + (index.has_dht ? 0 : CAM_JPEG_DHT_SIZE);
+	if (size > capacity)
+		return 0;
+
+	const uint8* jpeg = data + index.soi_offset;
+	if (index.has_dht) {
+		memcpy(dst, jpeg, length);
+		return size;
+	}
+
+	size_t head = index.sos_offset - index.soi_offset;
+	memcpy(dst, jpeg, head);
+	memcpy(dst + head, kStandardHuffmanTables, CAM_JPEG_DHT_SIZE);
+	memcpy(dst + head + CAM_JPEG_DHT_SIZE, jpeg + head, length - head);
+	return size;
+}
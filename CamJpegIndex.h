@@ -0,0 +1,87 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * JPEG marker index, built while a frame is assembled.
+ */
+#ifndef _CAM_JPEG_INDEX_H
+#define _CAM_JPEG_INDEX_H
+
+
+#include <SupportDefs.h>
+
+
+// =============================================================================
+// JPEG Frame Index
+// =============================================================================
+// The deframer feeds every payload of a compressed frame through
+// cam_jpeg_index_update(), which walks the markers once, as the bytes
+// arrive, and never looks at a byte twice. Validation and decode setup
+// read the result instead of scanning the frame again, and the restart
+// marker offsets are where a frame can be split between decoders.
+//
+// Offsets are from the start of the frame. Marker segments are parsed in
+// place in the frame buffer, so a segment split across payloads is taken
+// up once the rest of it has arrived.
+
+#define CAM_JPEG_NONE				0xffffffff	// offset not seen
+#define CAM_JPEG_SOI_WINDOW			2048		// SOI must start within
+#define CAM_JPEG_MAX_RESTARTS		128
+
+enum cam_jpeg_scan_state {
+	CAM_JPEG_SCAN_SOI = 0,		// looking for the start of image
+	CAM_JPEG_SCAN_HEADER,		// marker segments
+	CAM_JPEG_SCAN_ENTROPY,		// entropy coded data after SOS
+	CAM_JPEG_SCAN_DONE,			// EOI seen
+	CAM_JPEG_SCAN_BROKEN		// no SOI in the window, or a bad segment
+};
+
+struct cam_jpeg_index {
+	uint32			soi_offset;
+	uint32			eoi_offset;
+	uint32			sof_offset;
+	uint32			sos_offset;			// first SOS marker
+	uint16			width;				// from SOF
+	uint16			height;
+	uint8			sof_marker;			// 0xc0 baseline, 0xc2 progressive...
+	uint8			components;
+	uint8			sampling[3];		// H << 4 | V of the first three
+	bool			has_dht;
+	uint16			restart_interval;	// MCUs, from DRI; 0 without
+	uint16			restart_count;		// RSTn markers seen
+	uint32			restarts[CAM_JPEG_MAX_RESTARTS];
+										// offsets of the first of them
+
+	uint8			state;				// cam_jpeg_scan_state
+	uint32			scanned;			// bytes walked so far
+};
+
+void	cam_jpeg_index_reset(cam_jpeg_index* index);
+
+// Walks frame bytes scanned..length-1; 'data' is the whole frame so far
+void	cam_jpeg_index_update(cam_jpeg_index* index, const uint8* data,
+			size_t length);
+
+// Whether the index has seen SOI, a frame header and EOI
+static inline bool
+cam_jpeg_index_complete(const cam_jpeg_index& index)
+{
+	return index.state == CAM_JPEG_SCAN_DONE
+		&& index.sof_offset != CAM_JPEG_NONE;
+}
+
+
+// The standard Huffman tables of ITU T.81 K.3 as one DHT segment, marker
+// included. MJPEG cameras often leave them out and rely on the decoder
+// knowing them; a JPEG handed on as-is has to carry them.
+#define CAM_JPEG_DHT_SIZE			420
+
+// Copies the JPEG of a complete frame, SOI to EOI, to 'dst' and puts in
+// the standard DHT segment before the first scan if the frame has none.
+// Returns the bytes written; 0 if the index is not complete or they do not
+// fit in 'capacity'.
+size_t	cam_jpeg_copy_with_tables(const cam_jpeg_index& index,
+			const uint8* data, uint8* dst, size_t capacity);
+
+
+#endif /* _CAM_JPEG_INDEX_H */
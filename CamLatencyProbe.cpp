@@ -0,0 +1,123 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Per-frame timestamps from USB to SendBuffer(), for latency checks.
+ */
+
+
+#include "CamLatencyProbe.h"
+
+#include <Autolock.h>
+#include <Message.h>
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+
+CamLatencyProbe::CamLatencyProbe()
+	:
+	fEnabled(0),
+	fLock("webcam latency probe"),
+	fNext(0),
+	fCount(0)
+{
+	memset(fFrames, 0, sizeof(fFrames));
+
+	const char* probe = getenv("WEBCAM_LATENCY_PROBE");
+	if (probe != NULL && (strcmp(probe, "1") == 0
+			|| strcmp(probe, "on") == 0))
+		fEnabled = 1;
+}
+
+
+void
+CamLatencyProbe::SetEnabled(bool enabled)
+{
+	if (enabled && !IsEnabled()) {
+		// Frames from an earlier run would look like gaps
+		BAutolock _(fLock);
+		fNext = 0;
+		fCount = 0;
+	}
+	atomic_set(&fEnabled, enabled ? 1 : 0);
+}
+
+
+void
+CamLatencyProbe::Record(const cam_frame_times& times)
+{
+	BAutolock _(fLock);
+	fFrames[fNext] = times;
+	fNext = (fNext + 1) % kFrames;
+	if (fCount < kFrames)
+		fCount++;
+}
+
+
+int32
+CamLatencyProbe::Read(uint32 after, cam_frame_times* times, int32 max,
+	uint32* newest) const
+{
+	BAutolock _(fLock);
+	*newest = fCount > 0 ? fFrames[(fNext + kFrames - 1) % kFrames].sequence
+		: 0;
+
+	int32 count = 0;
+	for (int32 i = 0; i < fCount && count < max; i++) {
+		const cam_frame_times& frame
+			= fFrames[(fNext + kFrames - fCount + i) % kFrames];
+		// Numbers wrap; anything up to half the range ahead is newer
+		if ((int32)(frame.sequence - after) > 0)
+			times[count++] = frame;
+	}
+	return count;
+}
+
+
+status_t
+CamLatencyProbe::SendReply(const cam_probe_request& request, int32 node,
+	const char* name)
+{
+	if ((request.flags & CAM_PROBE_ENABLE) != 0)
+		SetEnabled(true);
+
+	cam_frame_times* frames = new(std::nothrow) cam_frame_times[kFrames];
+	if (frames == NULL)
+		return B_NO_MEMORY;
+	uint32 newest;
+	int32 count = Read(request.after, frames, kFrames, &newest);
+
+	BMessage reply(WEBCAM_MSG_LATENCY_PROBE);
+	reply.AddInt32("cookie", request.cookie);
+	reply.AddInt32("node", node);
+	reply.AddString("name", name);
+	reply.AddBool("enabled", IsEnabled());
+	reply.AddInt32("newest", (int32)newest);
+	reply.AddInt32("count", count);
+	status_t status = B_OK;
+	if (count > 0) {
+		status = reply.AddData("frames", B_RAW_TYPE, frames,
+			count * sizeof(cam_frame_times), false);
+	}
+	delete[] frames;
+
+	if ((request.flags & CAM_PROBE_DISABLE) != 0)
+		SetEnabled(false);
+	if (status != B_OK)
+		return status;
+
+	ssize_t size = reply.FlattenedSize();
+	char* buffer = new(std::nothrow) char[size];
+	if (buffer == NULL)
+		return B_NO_MEMORY;
+	status = reply.Flatten(buffer, size);
+	if (status == B_OK) {
+		// A reader that went away must not stall the node's control loop
+		status = write_port_etc(request.reply_port, WEBCAM_MSG_LATENCY_PROBE,
+			buffer, size, B_RELATIVE_TIMEOUT, 100000);
+	}
+	delete[] buffer;
+	return status;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Per-frame timestamps from USB to SendBuffer(), for latency checks.
+ */
+#ifndef _CAM_LATENCY_PROBE_H
+#define _CAM_LATENCY_PROBE_H
+
+
+#include <Locker.h>
+#include <OS.h>
+#include <SupportDefs.h>
+
+
+// =============================================================================
+// Latency Probe
+// =============================================================================
+// A diagnostic mode: the video node notes, for every frame it sends, when
+// each stage had it, all in system_time():
+//
+//   capture		the frame stamp: the device's capture time (PTS/SCR) or,
+//					without one, its first data
+//   arrival		first data off USB
+//   completed		last transfer done, frame queued for decoding
+//   decode_start	a decoder took it
+//   decoded		the decoder was done
+//   sent			handed to SendBuffer()
+//
+// The times go with the buffer, in the media_header's user_data (type
+// WEBCAM_PROBE_USER_DATA, a cam_frame_times), and into a table of the last
+// frames sent, by field_sequence, which tools read from the node. A
+// repeated frame (the camera sent none in time) has arrival and completed
+// 0. The metrics histograms hold the same stages folded together; the
+// probe is for distributions per frame and per camera, say after an
+// upgrade.
+//
+// On with WEBCAM_LATENCY_PROBE=1, or from the first request that asks.
+//
+// Query: write a cam_probe_request to the video node's control port with
+// code WEBCAM_MSG_GET_LATENCY_PROBE. The reply, a flattened BMessage with
+// what WEBCAM_MSG_LATENCY_PROBE written to request.reply_port, has the
+// frames sent after request.after, oldest first: "frames" (B_RAW_TYPE, an
+// array of cam_frame_times), "count", "newest" (the last field_sequence
+// sent; it starts over with the node), "enabled", "cookie", "node" and
+// "name". tests/latency_probe.cpp reads it for every camera.
+
+#define WEBCAM_MSG_GET_LATENCY_PROBE	'wlpg'
+#define WEBCAM_MSG_LATENCY_PROBE		'wlpr'
+#define WEBCAM_PROBE_USER_DATA			'wlat'
+
+enum {
+	CAM_PROBE_ENABLE	= 0x01,		// turn the probe on first
+	CAM_PROBE_DISABLE	= 0x02		// and off after the reply
+};
+
+struct cam_probe_request {
+	port_id		reply_port;
+	int32		cookie;			// echoed in the reply
+	uint32		after;			// field_sequence last seen, 0 for all
+	uint32		flags;			// CAM_PROBE_*
+};
+
+struct cam_frame_times {
+	uint32		sequence;		// field_sequence of the buffer
+	uint32		reserved;
+	bigtime_t	capture;
+	bigtime_t	arrival;
+	bigtime_t	completed;
+	bigtime_t	decode_start;
+	bigtime_t	decoded;
+	bigtime_t	sent;
+};
+
+
+class CamLatencyProbe {
+public:
+	enum {
+		kFrames = 512		// 8s at 60 fps
+	};
+
+								CamLatencyProbe();
+
+			bool				IsEnabled() const
+									{ return atomic_get(
+										(int32*)&fEnabled) != 0; }
+			void				SetEnabled(bool enabled);
+
+								// From the thread that sends the frames
+			void				Record(const cam_frame_times& times);
+
+								// Up to 'max' frames sent after the one
+								// numbered 'after', oldest first; *newest
+								// gets the last number recorded
+			int32				Read(uint32 after, cam_frame_times* times,
+									int32 max, uint32* newest) const;
+
+								// Answers a WEBCAM_MSG_GET_LATENCY_PROBE
+								// request
+			status_t			SendReply(const cam_probe_request& request,
+									int32 node, const char* name);
+
+private:
+			int32				fEnabled;
+	mutable	BLocker				fLock;
+			cam_frame_times		fFrames[kFrames];	// ring, under fLock
+			int32				fNext;
+			int32				fCount;
+};
+
+
+#endif /* _CAM_LATENCY_PROBE_H */
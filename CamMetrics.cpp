@@ -0,0 +1,285 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Live per-camera metrics, readable at any time.
+ */
+
+
+#include "CamMetrics.h"
+
+#include <Message.h>
+
+#include <new>
+#include <stdio.h>
+#include <string.h>
+
+
+static const char* const kMetricNames[CAM_METRIC_COUNT] = {
+	"usb.transfers",
+	"usb.transfer_errors",
+	"usb.packets",
+	"usb.packet_errors",
+	"usb.bytes",
+	"deframer.frames",
+	"deframer.drops",
+	"deframer.shed_drops",
+	"deframer.policy_drops",
+	"deframer.error_drops",
+	"deframer.pool_hits",
+	"deframer.pool_misses",
+	"deframer.queue_depth",
+	"decode.frames",
+	"decode.drops",
+	"decode.time_us",
+	"decode.time_max_us",
+	"video.frames_sent",
+	"video.drops",
+	"video.watchdog_timeouts",
+	"video.queue_depth",
+	"video.fps_milli",
+	"video.first_frame_us",
+	"audio.buffers_sent",
+	"audio.buffers_dropped",
+	"audio.underruns",
+	"audio.overruns",
+	"sync.skew_us"
+};
+
+
+static const char* const kLatencyNames[CAM_LATENCY_COUNT] = {
+	"latency.assembly",
+	"latency.decode",
+	"latency.delivery",
+	"latency.end_to_end",
+	"latency.first_frame",
+	"latency.sync_skew"
+};
+
+
+// =============================================================================
+// CamHistogram
+// =============================================================================
+
+CamHistogram::CamHistogram()
+	:
+	fCount(0),
+	fMax(0)
+{
+	memset(fBuckets, 0, sizeof(fBuckets));
+}
+
+
+void
+CamHistogram::Reset()
+{
+	for (int32 i = 0; i < kBucketCount; i++)
+		atomic_set(&fBuckets[i], 0);
+	atomic_set64(&fCount, 0);
+	atomic_set64(&fMax, 0);
+}
+
+
+bigtime_t
+CamHistogram::_BucketTop(int32 bucket)
+{
+	if (bucket < kSubBuckets)
+		return bucket;
+	int32 shift = bucket / kSubBuckets - 1;
+	bigtime_t low = (bigtime_t)(kSubBuckets + bucket % kSubBuckets) << shift;
+	return low + ((bigtime_t)1 << shift) - 1;
+}
+
+
+bigtime_t
+CamHistogram::Percentile(int32 percent) const
+{
+	int32 counts[kBucketCount];
+	int64 total = 0;
+	for (int32 i = 0; i < kBucketCount; i++) {
+		counts[i] = atomic_get((int32*)&fBuckets[i]);
+		total += counts[i];
+	}
+	if (total == 0)
+		return 0;
+
+	// The smallest value at least 'percent' of the samples do not exceed
+	int64 rank = (total * percent + 99) / 100;
+	if (rank < 1)
+		rank = 1;
+	int64 seen = 0;
+	int32 bucket = 0;
+	for (; bucket < kBucketCount - 1; bucket++) {
+		seen += counts[bucket];
+		if (seen >= rank)
+			break;
+	}
+
+	bigtime_t top = _BucketTop(bucket);
+	bigtime_t max = Max();
+	return top < max ? top : max;
+}
+
+
+void
+CamHistogram::Summarize(cam_latency_summary* summary) const
+{
+	summary->count = Count();
+	summary->p50 = Percentile(50);
+	summary->p95 = Percentile(95);
+	summary->p99 = Percentile(99);
+	summary->max = Max();
+}
+
+
+// =============================================================================
+// CamMetrics
+// =============================================================================
+
+
+CamMetrics::CamMetrics()
+	:
+	fSince(system_time()),
+	fRateStart(0),
+	fRateFrames(0)
+{
+	memset(fValues, 0, sizeof(fValues));
+}
+
+
+void
+CamMetrics::RecordFrameSent(bigtime_t now)
+{
+	int64 frames = atomic_add64(&fValues[CAM_METRIC_FRAMES_SENT], 1) + 1;
+
+	if (fRateStart == 0) {
+		fRateStart = now;
+		fRateFrames = frames;
+		return;
+	}
+	bigtime_t elapsed = now - fRateStart;
+	if (elapsed < 1000000)
+		return;
+
+	Set(CAM_METRIC_OUTPUT_FPS,
+		(frames - fRateFrames) * 1000000000LL / elapsed);
+	fRateStart = now;
+	fRateFrames = frames;
+}
+
+
+void
+CamMetrics::Snapshot(cam_metrics_snapshot* snapshot) const
+{
+	snapshot->when = system_time();
+	snapshot->since = fSince;
+	for (int32 i = 0; i < CAM_METRIC_COUNT; i++)
+		snapshot->values[i] = Get((cam_metric)i);
+	for (int32 i = 0; i < CAM_LATENCY_COUNT; i++)
+		fLatency[i].Summarize(&snapshot->latency[i]);
+}
+
+
+void
+CamMetrics::ResetLatency()
+{
+	for (int32 i = 0; i < CAM_LATENCY_COUNT; i++)
+		fLatency[i].Reset();
+}
+
+
+const char*
+CamMetrics::Name(cam_metric metric)
+{
+	if (metric < 0 || metric >= CAM_METRIC_COUNT)
+		return "unknown";
+	return kMetricNames[metric];
+}
+
+
+const char*
+CamMetrics::Name(cam_latency_stage stage)
+{
+	if (stage < 0 || stage >= CAM_LATENCY_COUNT)
+		return "unknown";
+	return kLatencyNames[stage];
+}
+
+
+/* Beside the raw values: "when" and "since" (system_time()); for each
+ * latency stage, "<stage>.count" and "<stage>.p50", ".p95", ".p99" and
+ * ".max" in us; and "video.fps", "usb.packet_loss" (0..1),
+ * "decode.time_avg_us" and "deframer.pool_hit_rate" (0..1), worked out over
+ * the whole run. */
+status_t
+CamMetrics::Archive(const cam_metrics_snapshot& snapshot, BMessage* message)
+{
+	status_t status = message->AddInt64("when", snapshot.when);
+	if (status == B_OK)
+		status = message->AddInt64("since", snapshot.since);
+	for (int32 i = 0; i < CAM_METRIC_COUNT && status == B_OK; i++)
+		status = message->AddInt64(kMetricNames[i], snapshot.values[i]);
+	for (int32 i = 0; i < CAM_LATENCY_COUNT && status == B_OK; i++) {
+		const cam_latency_summary& latency = snapshot.latency[i];
+		const struct {
+			const char*	suffix;
+			int64		value;
+		} fields[] = {
+			{ "count", latency.count },
+			{ "p50", latency.p50 },
+			{ "p95", latency.p95 },
+			{ "p99", latency.p99 },
+			{ "max", latency.max }
+		};
+		for (size_t j = 0; j < sizeof(fields) / sizeof(fields[0])
+				&& status == B_OK; j++) {
+			char name[64];
+			snprintf(name, sizeof(name), "%s.%s", kLatencyNames[i],
+				fields[j].suffix);
+			status = message->AddInt64(name, fields[j].value);
+		}
+	}
+	if (status != B_OK)
+		return status;
+
+	const int64* values = snapshot.values;
+	int64 packets = values[CAM_METRIC_PACKETS];
+	int64 decoded = values[CAM_METRIC_FRAMES_DECODED];
+	int64 allocations = values[CAM_METRIC_POOL_HITS]
+		+ values[CAM_METRIC_POOL_MISSES];
+
+	message->AddFloat("video.fps", values[CAM_METRIC_OUTPUT_FPS] / 1000.0f);
+	message->AddFloat("usb.packet_loss", packets > 0
+		? (float)values[CAM_METRIC_PACKET_ERRORS] / packets : 0.0f);
+	message->AddFloat("decode.time_avg_us", decoded > 0
+		? (float)values[CAM_METRIC_DECODE_TIME] / decoded : 0.0f);
+	return message->AddFloat("deframer.pool_hit_rate", allocations > 0
+		? (float)values[CAM_METRIC_POOL_HITS] / allocations : 1.0f);
+}
+
+
+status_t
+CamMetrics::SendReply(const cam_metrics_request& request,
+	const cam_metrics_snapshot& snapshot, int32 node, const char* name)
+{
+	BMessage reply(WEBCAM_MSG_METRICS);
+	reply.AddInt32("cookie", request.cookie);
+	reply.AddInt32("node", node);
+	reply.AddString("name", name);
+	status_t status = Archive(snapshot, &reply);
+	if (status != B_OK)
+		return status;
+
+	ssize_t size = reply.FlattenedSize();
+	char* buffer = new(std::nothrow) char[size];
+	if (buffer == NULL)
+		return B_NO_MEMORY;
+	status = reply.Flatten(buffer, size);
+	if (status == B_OK) {
+		// A reader that went away must not stall the node's control loop
+		status = write_port_etc(request.reply_port, WEBCAM_MSG_METRICS,
+			buffer, size, B_RELATIVE_TIMEOUT, 100000);
+	}
+	delete[] buffer;
+	return status;
+}
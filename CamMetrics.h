@@ -0,0 +1,260 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Live per-camera metrics, readable at any time.
+ */
+#ifndef _CAM_METRICS_H
+#define _CAM_METRICS_H
+
+
+#include <OS.h>
+
+
+class BMessage;
+
+
+// =============================================================================
+// Live Metrics
+// =============================================================================
+// One set of counters per camera, bumped with atomic adds where things
+// happen: the USB pump, the deframer, the decoders and the producers. No
+// lock is taken to record or to read them. Counters only grow, from when the
+// device was plugged in; a reader takes two snapshots and divides by the
+// time between them. Gauges (queue depths, the output frame rate) hold the
+// last value.
+//
+// The syslog reports (LogFrameTimingStats(), LogErrorStatistics(),
+// LogAudioStats()) keep their own windowed structs; these are for tools.
+//
+// Beside the counters, a latency histogram per pipeline stage gives the
+// percentiles that averages and maxima hide; these start over on request.
+//
+// Query: write a cam_metrics_request to the control port of either node of
+// the camera with code WEBCAM_MSG_GET_METRICS. The reply is a flattened
+// BMessage with what WEBCAM_MSG_METRICS, written to request.reply_port with
+// the same code: one int64 per metric, under its Name(), the latency
+// summaries, and the derived float fields listed in CamMetrics::Archive().
+
+#define WEBCAM_MSG_GET_METRICS	'wmtg'
+#define WEBCAM_MSG_METRICS		'wmtr'
+
+enum {
+	CAM_METRICS_RESET_LATENCY	= 0x01	// histograms start over after the
+										// reply
+};
+
+struct cam_metrics_request {
+	port_id		reply_port;
+	int32		cookie;			// echoed in the reply
+	uint32		flags;			// CAM_METRICS_*
+};
+
+enum cam_metric {
+	// USB
+	CAM_METRIC_TRANSFERS = 0,			// completed transfers
+	CAM_METRIC_TRANSFER_ERRORS,			// failed as a whole
+	CAM_METRIC_PACKETS,					// ISO packets
+	CAM_METRIC_PACKET_ERRORS,			// ISO packets with an error status
+	CAM_METRIC_BYTES,					// payload received
+
+	// Deframer
+	CAM_METRIC_FRAMES_ASSEMBLED,		// queued for the decoders
+	CAM_METRIC_DEFRAMER_DROPS,			// no room to queue
+	CAM_METRIC_SHED_DROPS,				// dropped by the frame skip
+	CAM_METRIC_POLICY_DROPS,			// dropped by the delivery policy
+	CAM_METRIC_ERROR_DROPS,				// damaged in transfer, not queued
+	CAM_METRIC_POOL_HITS,				// frames reused from the pool
+	CAM_METRIC_POOL_MISSES,
+	CAM_METRIC_RAW_QUEUE_DEPTH,			// gauge: frames waiting to decode
+
+	// Decode
+	CAM_METRIC_FRAMES_DECODED,
+	CAM_METRIC_DECODE_DROPS,			// the fill failed
+	CAM_METRIC_DECODE_TIME,				// us, sum over decoded frames
+	CAM_METRIC_DECODE_TIME_MAX,			// us
+
+	// Video output
+	CAM_METRIC_FRAMES_SENT,
+	CAM_METRIC_OUTPUT_DROPS,			// out of order, overrun, send failed
+	CAM_METRIC_WATCHDOG_TIMEOUTS,		// no frame for a while
+	CAM_METRIC_OUTPUT_QUEUE_DEPTH,		// gauge: buffers waiting to be sent
+	CAM_METRIC_OUTPUT_FPS,				// gauge: frames per 1000 s, last
+										// second
+	CAM_METRIC_FIRST_FRAME_TIME,		// gauge: us from the last start to
+										// its first frame sent
+
+	// Audio output
+	CAM_METRIC_AUDIO_BUFFERS_SENT,
+	CAM_METRIC_AUDIO_BUFFERS_DROPPED,
+	CAM_METRIC_AUDIO_UNDERRUNS,
+	CAM_METRIC_AUDIO_OVERRUNS,
+
+	// Synchronized capture (see CamTimebase.h)
+	CAM_METRIC_SYNC_SKEW,				// gauge: us the last frame was
+										// captured after the reference
+										// camera's nearest one
+
+	CAM_METRIC_COUNT
+};
+
+// Where a frame's time goes, each measured on its own
+enum cam_latency_stage {
+	CAM_LATENCY_ASSEMBLY = 0,			// first data off USB -> frame queued
+	CAM_LATENCY_DECODE,					// frame queued -> decoded
+	CAM_LATENCY_DELIVERY,				// decoded -> SendBuffer()
+	CAM_LATENCY_END_TO_END,				// frame stamp -> SendBuffer()
+	CAM_LATENCY_FIRST_FRAME,			// node start -> first SendBuffer(),
+										// one sample per start
+	CAM_LATENCY_SYNC_SKEW,				// capture time apart from the
+										// reference camera's frame, either
+										// way
+
+	CAM_LATENCY_COUNT
+};
+
+struct cam_latency_summary {
+	int64		count;
+	bigtime_t	p50;
+	bigtime_t	p95;
+	bigtime_t	p99;
+	bigtime_t	max;
+};
+
+struct cam_metrics_snapshot {
+	bigtime_t	when;
+	bigtime_t	since;					// the counters started
+	int64		values[CAM_METRIC_COUNT];
+	cam_latency_summary	latency[CAM_LATENCY_COUNT];
+};
+
+
+// =============================================================================
+// Latency Histogram
+// =============================================================================
+// Fixed memory, log bucketed: exact below 8 us, then 8 buckets per power of
+// two, so a percentile is at most 12.5% high. Recording is lock free and
+// safe from any number of threads; a reader sees each bucket atomically,
+// not all of them at one instant, which percentiles do not mind.
+
+class CamHistogram {
+public:
+								CamHistogram();
+
+			void				Record(bigtime_t value);
+			void				Reset();
+
+			int64				Count() const
+									{ return atomic_get64((int64*)&fCount); }
+			bigtime_t			Max() const
+									{ return atomic_get64((int64*)&fMax); }
+								// Upper bound of the bucket the percentile
+								// falls in, no more than Max(); 0 if empty
+			bigtime_t			Percentile(int32 percent) const;
+			void				Summarize(cam_latency_summary* summary) const;
+
+private:
+	enum {
+		kSubBucketBits	= 3,
+		kSubBuckets		= 1 << kSubBucketBits,
+		kBucketCount	= kSubBuckets * 30	// up to 2^32 us
+	};
+
+	static	int32				_BucketFor(bigtime_t value);
+	static	bigtime_t			_BucketTop(int32 bucket);
+
+			int32				fBuckets[kBucketCount];
+			int64				fCount;
+			int64				fMax;
+};
+
+
+inline int32
+CamHistogram::_BucketFor(bigtime_t value)
+{
+	if (value < kSubBuckets)
+		return value > 0 ? (int32)value : 0;
+	int32 bit = 63 - __builtin_clzll((uint64)value);
+	int32 bucket = (bit - kSubBucketBits + 1) * kSubBuckets
+		+ (int32)((value >> (bit - kSubBucketBits)) & (kSubBuckets - 1));
+	return bucket < kBucketCount ? bucket : kBucketCount - 1;
+}
+
+
+inline void
+CamHistogram::Record(bigtime_t value)
+{
+	if (value < 0)
+		value = 0;
+	atomic_add(&fBuckets[_BucketFor(value)], 1);
+	atomic_add64(&fCount, 1);
+
+	int64 current = atomic_get64(&fMax);
+	while (value > current) {
+		int64 previous = atomic_test_and_set64(&fMax, value, current);
+		if (previous == current)
+			break;
+		current = previous;
+	}
+}
+
+
+class CamMetrics {
+public:
+								CamMetrics();
+
+			void				Add(cam_metric metric, int64 delta = 1)
+									{ atomic_add64(&fValues[metric], delta); }
+			void				Set(cam_metric metric, int64 value)
+									{ atomic_set64(&fValues[metric], value); }
+			void				RecordMax(cam_metric metric, int64 value);
+			int64				Get(cam_metric metric) const
+									{ return atomic_get64(
+										(int64*)&fValues[metric]); }
+
+								// From the one thread that sends frames:
+								// counts it and updates the FPS gauge
+			void				RecordFrameSent(bigtime_t now);
+
+			void				RecordLatency(cam_latency_stage stage,
+										bigtime_t latency)
+									{ fLatency[stage].Record(latency); }
+			const CamHistogram&	Latency(cam_latency_stage stage) const
+									{ return fLatency[stage]; }
+			void				ResetLatency();
+
+			void				Snapshot(cam_metrics_snapshot* snapshot) const;
+
+	static	const char*			Name(cam_metric metric);
+	static	const char*			Name(cam_latency_stage stage);
+	static	status_t			Archive(const cam_metrics_snapshot& snapshot,
+									BMessage* message);
+								// Answers a WEBCAM_MSG_GET_METRICS request
+	static	status_t			SendReply(const cam_metrics_request& request,
+									const cam_metrics_snapshot& snapshot,
+									int32 node, const char* name);
+
+private:
+			int64				fValues[CAM_METRIC_COUNT];
+			CamHistogram		fLatency[CAM_LATENCY_COUNT];
+			bigtime_t			fSince;
+			bigtime_t			fRateStart;		// RecordFrameSent() only
+			int64				fRateFrames;
+};
+
+
+inline void
+CamMetrics::RecordMax(cam_metric metric, int64 value)
+{
+	int64 current = atomic_get64(&fValues[metric]);
+	while (value > current) {
+		int64 previous = atomic_test_and_set64(&fValues[metric], value,
+			current);
+		if (previous == current)
+			break;
+		current = previous;
+	}
+}
+
+
+#endif /* _CAM_METRICS_H */
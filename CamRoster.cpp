@@ -8,8 +8,12 @@
 #include "AddOn.h"
 #include "CamDevice.h"
 #include "CamDebug.h"
+#include "addons/virtual/VirtualCamDevice.h"
 
 #include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
 #include <OS.h>
 
 #undef B_WEBCAM_MKINTFUNC
@@ -22,16 +26,34 @@ extern "C" status_t get_webcam_addon_##modname(WebCamMediaAddOn* webcam, CamDevi
 CamRoster::CamRoster(WebCamMediaAddOn* _addon)
 	: BUSBRoster(),
 	fLocker("WebcamRosterLock"),
-	fAddon(_addon)
+	fAddon(_addon),
+	fVirtualAddon(NULL),
+	fSyncAll(false)
 {
 	PRINT((CH "()" CT));
+	const char* sync = getenv("WEBCAM_SYNC");
+	fSyncAll = sync != NULL && (strcmp(sync, "1") == 0
+		|| strcmp(sync, "on") == 0);
+
 	LoadInternalAddons();
 	LoadExternalAddons();
+	LoadVirtualCameras();
 }
 
 
 CamRoster::~CamRoster()
 {
+	// USB cameras went with Stop(), the virtual ones go with the roster
+	for (int32 i = 0; i < fVirtualCameras.CountItems(); i++) {
+		CamDevice* cam = (CamDevice*)fVirtualCameras.ItemAt(i);
+		fCameras.RemoveItem(cam);
+		LeaveSyncGroup(cam);
+		cam->Unplugged();
+		delete cam;
+	}
+	fVirtualCameras.MakeEmpty();
+	delete fVirtualAddon;
+
 	// Clean up device parameter cache
 	for (int32 i = 0; i < fDeviceCache.CountItems(); i++) {
 		device_params_cache* cache =
@@ -92,6 +114,8 @@ CamRoster::DeviceAdded(BUSBDevice* _device)
 			}
 
 			fCameras.AddItem(cam);
+			if (fSyncAll)
+				JoinSyncGroup(cam);
 			fAddon->CameraAdded(cam);
 			return B_OK;
 		}
@@ -120,6 +144,7 @@ CamRoster::DeviceRemoved(BUSBDevice* _device)
 			CacheDeviceParams(cam);
 
 			fCameras.RemoveItem(i);
+			LeaveSyncGroup(cam);
 
 			// PHASE 2: Proper cleanup on device disconnect
 			// First, stop all transfers and wait for threads to finish
@@ -228,6 +253,135 @@ CamRoster::LoadExternalAddons()
 }
 
 
+/* Cameras without hardware, from WEBCAM_VIRTUAL (see VirtualCamSource.h).
+ * They are there before the add-on counts its flavors, so the add-on is not
+ * told about them. */
+status_t
+CamRoster::LoadVirtualCameras()
+{
+	const char* spec = getenv("WEBCAM_VIRTUAL");
+	if (spec == NULL || spec[0] == '\0')
+		return B_OK;
+
+	virtual_cam_config configs[VIRTUAL_CAM_MAX_CAMERAS];
+	int32 count = virtual_cam_parse_config(spec, configs,
+		VIRTUAL_CAM_MAX_CAMERAS);
+	if (count == 0)
+		return B_BAD_VALUE;
+
+	fVirtualAddon = new(std::nothrow) VirtualCamDeviceAddon(fAddon);
+	if (fVirtualAddon == NULL)
+		return B_NO_MEMORY;
+
+	for (int32 i = 0; i < count; i++) {
+		VirtualCamDevice* cam = fVirtualAddon->InstantiateVirtual(*this,
+			configs[i]);
+		if (cam == NULL)
+			return B_NO_MEMORY;
+		status_t err = cam->InitCheck();
+		if (err < B_OK) {
+			syslog(LOG_ERR, "CamRoster: virtual camera %d: %s\n", (int)i,
+				strerror(err));
+			delete cam;
+			continue;
+		}
+		fCameras.AddItem(cam);
+		fVirtualCameras.AddItem(cam);
+		if (fSyncAll)
+			JoinSyncGroup(cam);
+	}
+	return B_OK;
+}
+
+
+status_t
+CamRoster::JoinSyncGroup(CamDevice* cam)
+{
+	if (cam == NULL)
+		return B_BAD_VALUE;
+	if (cam->Timebase() == &fTimebase)
+		return B_OK;
+
+	int32 member = fTimebase.Join();
+	if (member < 0) {
+		syslog(LOG_WARNING, "CamRoster: sync group full, %s not added\n",
+			cam->FlavorInfo()->name);
+		return B_NO_MEMORY;
+	}
+	cam->SetTimebase(&fTimebase, member);
+	syslog(LOG_INFO, "CamRoster: %s is sync group member %d%s\n",
+		cam->FlavorInfo()->name, (int)member,
+		fTimebase.CountMembers() == 1 ? " (reference)" : "");
+	return B_OK;
+}
+
+
+void
+CamRoster::LeaveSyncGroup(CamDevice* cam)
+{
+	if (cam == NULL || cam->Timebase() != &fTimebase)
+		return;
+
+	fTimebase.Leave(cam->TimebaseMember());
+	cam->SetTimebase(NULL, -1);
+}
+
+
+/* The USB stack takes no start frame for isochronous transfers, so the
+ * pumps are released together instead: the streams stop, and start again
+ * with each pump waiting for the one time before it queues anything. The
+ * lead covers what starting takes before that, selecting the alternate
+ * setting included. Cameras that do not stream are left to their nodes. */
+status_t
+CamRoster::StartSyncGroup()
+{
+	const bigtime_t kStartLead = 200000;
+
+	BList members;
+	for (int32 i = 0; i < fCameras.CountItems(); i++) {
+		CamDevice* cam = (CamDevice*)fCameras.ItemAt(i);
+		if (cam != NULL && cam->Timebase() == &fTimebase
+			&& cam->TransferEnabled())
+			members.AddItem(cam);
+	}
+	if (members.IsEmpty())
+		return B_NO_INIT;
+
+	// None may be streaming yet when the first one starts
+	for (int32 i = 0; i < members.CountItems(); i++) {
+		CamDevice* cam = (CamDevice*)members.ItemAt(i);
+		cam->Lock();
+		cam->StopTransfer();
+		cam->Unlock();
+	}
+
+	bigtime_t start = fTimebase.ScheduleStart(kStartLead);
+	status_t result = B_OK;
+	for (int32 i = 0; i < members.CountItems(); i++) {
+		CamDevice* cam = (CamDevice*)members.ItemAt(i);
+		cam->Lock();
+		cam->SetGroupStart(start);
+		status_t err = cam->StartTransfer();
+		if (err != B_OK) {
+			cam->SetGroupStart(0);
+			syslog(LOG_ERR, "CamRoster: sync start of %s failed: %s\n",
+				cam->FlavorInfo()->name, strerror(err));
+			result = err;
+		}
+		cam->Unlock();
+	}
+
+	bigtime_t late = system_time() - start;
+	if (late > 0) {
+		syslog(LOG_WARNING, "CamRoster: sync start %lld us late, the "
+			"cameras started apart\n", (long long)late);
+	}
+	syslog(LOG_INFO, "CamRoster: %d cameras start streaming at %lld\n",
+		(int)members.CountItems(), (long long)start);
+	return result;
+}
+
+
 // PHASE 3: Device tracking implementation
 
 device_identity
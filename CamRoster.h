@@ -11,9 +11,11 @@
 #include <String.h>
 
 #include "CamDevice.h"
+#include "CamTimebase.h"
 
 class WebCamMediaAddOn;
 class CamDeviceAddon;
+class VirtualCamDeviceAddon;
 
 
 // PHASE 3: Device identification for reconnection support
@@ -54,11 +56,19 @@ public:
 	// those must be called with Lock()
 			CamDevice*	CameraAt(int32 index);
 
+	// Synchronized capture (see CamTimebase.h); also with Lock(). With
+	// WEBCAM_SYNC=1 every camera joins the group as it is added.
+			status_t	JoinSyncGroup(CamDevice* cam);
+			void		LeaveSyncGroup(CamDevice* cam);
+	// Restarts the grouped cameras that stream so that their pumps queue
+	// their first transfers in the same millisecond
+			status_t	StartSyncGroup();
 
 
 private:
 			status_t	LoadInternalAddons();
 			status_t	LoadExternalAddons();
+			status_t	LoadVirtualCameras();
 
 	// PHASE 3: Device tracking for reconnection
 			device_identity	GetDeviceIdentity(BUSBDevice* device);
@@ -74,6 +84,10 @@ private:
 	BList				fCamerasAddons;
 	BList				fCameras;
 	BList				fDeviceCache;	// List of device_params_cache*
+	VirtualCamDeviceAddon*	fVirtualAddon;	// NULL without WEBCAM_VIRTUAL
+	BList				fVirtualCameras;	// in fCameras as well
+	CamTimebase			fTimebase;			// of the sync group
+	bool				fSyncAll;			// WEBCAM_SYNC
 };
 
 #endif
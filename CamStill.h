@@ -0,0 +1,38 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Still image capture while the video stream runs.
+ */
+#ifndef _CAM_STILL_H
+#define _CAM_STILL_H
+
+
+// Request: write a flattened BMessage to the control port of the video node
+// with code WEBCAM_MSG_CAPTURE_STILL. Its fields:
+//   "target"	messenger	where the image goes (required)
+//   "width"	int32		size wanted, 0 or missing for the largest the
+//   "height"	int32		camera offers; the nearest one is taken
+//   "decoded"	bool		B_RGB32 pixels rather than what the camera sent
+//   "cookie"	int32		echoed in the reply
+//
+// The request only starts the capture. The image is sent to the target as
+// a WEBCAM_MSG_STILL_IMAGE message, a few hundred milliseconds later:
+//   "status"	int32		B_OK, or why there is no image
+//   "cookie"	int32
+//   "width"	int32
+//   "height"	int32
+//   "mime"		string		"image/jpeg", or "image/x-raw" with:
+//   "color_space" int32	B_RGB32 when decoded, else B_YCbCr422
+//   "bytes_per_row" int32
+//   "data"		B_RAW_TYPE	the image
+//
+// Only cameras with a still pipe (UVC still capture method 2 or 3) take
+// stills at a size of their own; the others answer B_NOT_SUPPORTED, and a
+// video frame is the still there. The video stream keeps running.
+
+#define WEBCAM_MSG_CAPTURE_STILL	'wstc'
+#define WEBCAM_MSG_STILL_IMAGE		'wsti'
+
+
+#endif /* _CAM_STILL_H */
@@ -15,19 +15,27 @@
 #include "CamStreamingDeframer.h"
 #include "CamDevice.h"
 #include "CamDebug.h"
-#include <Autolock.h>
+#include <stdlib.h>
+#include <string.h>
 #define MAX_TAG_LEN CAMDEFRAMER_MAX_TAG_LEN
 #define MAXFRAMEBUF CAMDEFRAMER_MAX_QUEUED_FRAMES
 
+// Smallest residual buffer, a few isochronous packets
+#define MIN_RESIDUAL_CAPACITY 4096
+
 
 CamStreamingDeframer::CamStreamingDeframer(CamDevice *device)
-	: CamDeframer(device)
+	: CamDeframer(device),
+	fResidual(NULL),
+	fResidualSize(0),
+	fResidualCapacity(0)
 {
 }
 
 
 CamStreamingDeframer::~CamStreamingDeframer()
 {
+	free(fResidual);
 }
 
 
@@ -42,29 +50,32 @@ CamStreamingDeframer::Write(const void *buffer, size_t size)
 	int bufsize = size;
 	bool detach = false;
 	bool discard = false;
-	//PRINT((CH "(%p, %d); state=%s framesz=%u queued=%u" CT, buffer, size, (fState==ST_SYNC)?"sync":"frame", (size_t)(fCurrentFrame?(fCurrentFrame->Position()):-1), (size_t)fInputBuff.Position()));
+	//PRINT((CH "(%p, %d); state=%s framesz=%u queued=%u" CT, buffer, size, (fState==ST_SYNC)?"sync":"frame", (size_t)(fCurrentFrame?(fCurrentFrame->Position()):-1), fResidualSize));
 	if (!fCurrentFrame) {
-		BAutolock l(fLocker);
-		if (fFrames.CountItems() < MAXFRAMEBUF)
+		if (QueuedFrames() < MAXFRAMEBUF)
 			fCurrentFrame = AllocFrame();
 		else {
 			PRINT((CH "DROPPED %" B_PRIuSIZE " bytes! "
 				"(too many queued frames)" CT, size));
 			return size; // drop XXX
 		}
+		if (!fCurrentFrame)
+			return size; // arena pool drained
 	}
 
 	// update in case resolution changed
 	fMinFrameSize = fDevice->MinRawFrameSize();
 	fMaxFrameSize = fDevice->MaxRawFrameSize();
 
-	if (fInputBuff.Position()) {
+	if (fResidualSize > 0) {
 		// residual data ? append to it
-		fInputBuff.Write(buffer, size);
-		// and use it as input buf
-		buf = (uint8 *)fInputBuff.Buffer();
-		bufsize = fInputBuff.BufferLength();
-		end = bufsize;
+		if (_AppendResidual(buffer, size)) {
+			// and use it as input buf
+			buf = fResidual;
+			bufsize = fResidualSize;
+			end = bufsize;
+		} else
+			fResidualSize = 0;
 	}
 	// whole buffer belongs to a frame, simple
 	if (fState == ST_FRAME) {
@@ -73,8 +84,7 @@ CamStreamingDeframer::Write(const void *buffer, size_t size)
 			|| (size_t)(position + bufsize) < fMinFrameSize) {
 			// no residual data, and
 			fCurrentFrame->Write(buf, bufsize);
-			fInputBuff.Seek(0LL, SEEK_SET);
-			fInputBuff.SetSize(0);
+			fResidualSize = 0;
 			return size;
 		}
 	}
@@ -175,19 +185,14 @@ CamStreamingDeframer::Write(const void *buffer, size_t size)
 			detach = true;
 		}
 		if (detach) {
-			BAutolock f(fLocker);
 			PRINT((CH ": Detaching a frame "
 				"(%" B_PRIuSIZE " bytes, end = %d, )" CT,
 				(size_t)fCurrentFrame->Position(), end));
 			fCurrentFrame->Seek(0LL, SEEK_SET);
-			if (discard) {
+			if (discard || !QueueFrame(fCurrentFrame))
 				delete fCurrentFrame;
-			} else {
-				fFrames.AddItem(fCurrentFrame);
-				release_sem(fFrameSem);
-			}
 			fCurrentFrame = NULL;
-			if (fFrames.CountItems() < MAXFRAMEBUF) {
+			if (QueuedFrames() < MAXFRAMEBUF) {
 				fCurrentFrame = AllocFrame();
 			}
 			fState = ST_SYNC;
@@ -198,16 +203,53 @@ CamStreamingDeframer::Write(const void *buffer, size_t size)
 
 
 	// put the remainder in input buff, discarding old data
-#if 0
-	fInputBuff.Seek(0LL, SEEK_SET);
-	if (bufsize - end > 0)
-		fInputBuff.Write(buf+end, bufsize - end);
-#endif
-	BMallocIO m;
-	m.Write(buf+end, bufsize - end);
-	fInputBuff.Seek(0LL, SEEK_SET);
-	if (bufsize - end > 0)
-		fInputBuff.Write(m.Buffer(), bufsize - end);
-	fInputBuff.SetSize(bufsize - end);
+	if (bufsize > end)
+		_KeepResidual(buf + end, bufsize - end);
+	else
+		fResidualSize = 0;
 	return size;
 }
+
+
+bool
+CamStreamingDeframer::_ReserveResidual(size_t size)
+{
+	if (size <= fResidualCapacity)
+		return true;
+	size_t capacity = fResidualCapacity * 2;
+	if (capacity < MIN_RESIDUAL_CAPACITY)
+		capacity = MIN_RESIDUAL_CAPACITY;
+	if (capacity < size)
+		capacity = size;
+	uint8 *residual = (uint8 *)realloc(fResidual, capacity);
+	if (residual == NULL)
+		return false;
+	fResidual = residual;
+	fResidualCapacity = capacity;
+	return true;
+}
+
+
+bool
+CamStreamingDeframer::_AppendResidual(const void *data, size_t size)
+{
+	if (!_ReserveResidual(fResidualSize + size))
+		return false;
+	memcpy(fResidual + fResidualSize, data, size);
+	fResidualSize += size;
+	return true;
+}
+
+
+/* 'data' may be the end of the residual itself: it is then no larger than
+ * the storage, which does not move */
+void
+CamStreamingDeframer::_KeepResidual(const uint8 *data, size_t size)
+{
+	if (!_ReserveResidual(size)) {
+		fResidualSize = 0;
+		return;
+	}
+	memmove(fResidual, data, size);
+	fResidualSize = size;
+}
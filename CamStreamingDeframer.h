@@ -16,8 +16,16 @@ virtual 	~CamStreamingDeframer();
 virtual ssize_t		Write(const void *buffer, size_t size);
 
 private:
-
-BMallocIO	fInputBuff;
+bool		_ReserveResidual(size_t size);
+bool		_AppendResidual(const void *data, size_t size);
+void		_KeepResidual(const uint8 *data, size_t size);
+
+// Input a Write() left for the next one, which is appended to it. Its
+// storage is kept and only grows, so a stream reallocates it a few times
+// at the start and then never.
+uint8		*fResidual;
+size_t		fResidualSize;
+size_t		fResidualCapacity;
 
 
 };
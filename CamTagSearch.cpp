@@ -0,0 +1,112 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Multi-pattern search for the start and end of frame tags.
+ */
+
+
+#include "CamTagSearch.h"
+
+#include <string.h>
+
+
+// Bytes checked by table after memchr() stops, before it is tried again
+static const size_t kTableWindow = 64;
+
+
+bool
+cam_tag_set_init(cam_tag_set* set, const uint8** tags, int count,
+	size_t length)
+{
+	set->tags = NULL;
+	set->count = 0;
+	set->length = 0;
+	set->first_byte = -1;
+	if (count <= 0 || count > CAM_TAG_MAX_TAGS || length == 0)
+		return false;
+
+	memset(set->first, 0, sizeof(set->first));
+	// A tag of one byte matches whatever follows it
+	memset(set->second, length > 1 ? 0 : 0xff, sizeof(set->second));
+	for (int t = 0; t < count; t++) {
+		set->first[tags[t][0]] |= 1 << t;
+		if (length > 1)
+			set->second[tags[t][1]] |= 1 << t;
+	}
+
+	set->first_byte = tags[0][0];
+	for (int t = 1; t < count; t++) {
+		if (tags[t][0] != set->first_byte) {
+			set->first_byte = -1;
+			break;
+		}
+	}
+
+	set->tags = tags;
+	set->count = count;
+	set->length = length;
+	return true;
+}
+
+
+bool
+cam_tag_set_is(const cam_tag_set& set, const uint8** tags, int count,
+	size_t length)
+{
+	return set.tags == tags && set.count == count && set.length == length;
+}
+
+
+int
+cam_tag_find(const cam_tag_set& set, const uint8* data, size_t size,
+	size_t skip, int* which)
+{
+	if (size < skip || size < set.length)
+		return -1;
+	size_t last = size - skip;
+	if (last > size - set.length)
+		last = size - set.length;
+
+	size_t offset = 0;
+	while (offset <= last) {
+		if (set.first_byte >= 0 && last - offset >= kTableWindow) {
+			const uint8* found = (const uint8*)memchr(data + offset,
+				set.first_byte, last - offset + 1);
+			if (found == NULL)
+				return -1;
+			offset = found - data;
+		}
+
+		// Where memchr() stops often, it costs more than it skips: the
+		// bytes after a stop, or all of them without a shared first byte,
+		// are checked in pairs, one lookup per byte
+		size_t windowEnd = set.first_byte >= 0
+			&& last - offset > kTableWindow ? offset + kTableWindow : last;
+		uint16 candidates = 0;
+		while (offset <= windowEnd) {
+			candidates = set.first[data[offset]];
+			if (candidates != 0 && set.length > 1)
+				candidates &= set.second[data[offset + 1]];
+			if (candidates != 0)
+				break;
+			offset++;
+		}
+		if (candidates == 0)
+			continue;
+
+		for (int t = 0; candidates != 0; t++, candidates >>= 1) {
+			if ((candidates & 1) == 0)
+				continue;
+			// The two first bytes are known to match
+			if (set.length <= 2 || memcmp(data + offset + 2,
+					set.tags[t] + 2, set.length - 2) == 0) {
+				if (which != NULL)
+					*which = t;
+				return offset;
+			}
+		}
+		offset++;
+	}
+	return -1;
+}
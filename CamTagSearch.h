@@ -0,0 +1,53 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Multi-pattern search for the start and end of frame tags.
+ */
+#ifndef _CAM_TAG_SEARCH_H
+#define _CAM_TAG_SEARCH_H
+
+
+#include <SupportDefs.h>
+
+
+// =============================================================================
+// Frame Tag Search
+// =============================================================================
+// Cameras without a payload header mark their frames with a few tags of a
+// fixed length in the byte stream, and the deframer looks for them in every
+// byte. A tag set indexes its tags by their first two bytes, one bit per
+// tag, so a search compares only the tags whose two first bytes are there:
+// bytes no tag starts with are skipped by memchr() when all tags start
+// alike (the C library's is vectorized), else by one table lookup each;
+// after memchr() stops, the next bytes are looked up too, so data full of
+// the first byte does not call it every other byte.
+
+#define CAM_TAG_MAX_TAGS	16		// one bit each in the tables
+
+struct cam_tag_set {
+	const uint8**	tags;
+	int				count;
+	size_t			length;
+	int				first_byte;		// all tags start with it, -1 if not
+	uint16			first[256];		// per byte value, the tags starting
+	uint16			second[256];	// with it, and having it second
+};
+
+// Indexes 'count' tags of 'length' bytes; false for more than
+// CAM_TAG_MAX_TAGS or tags of 0 bytes. The tags are not copied.
+bool	cam_tag_set_init(cam_tag_set* set, const uint8** tags, int count,
+			size_t length);
+
+// Whether 'set' was built from these tags
+bool	cam_tag_set_is(const cam_tag_set& set, const uint8** tags, int count,
+			size_t length);
+
+// Offset of the first tag in 'data', starting at most at size - skip and
+// whole within 'size', as CamDeframer::FindTags(); -1 if there is none.
+// 'which' is the tag found, the lowest index if several match there.
+int		cam_tag_find(const cam_tag_set& set, const uint8* data, size_t size,
+			size_t skip, int* which = NULL);
+
+
+#endif /* _CAM_TAG_SEARCH_H */
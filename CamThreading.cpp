@@ -0,0 +1,290 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Per-camera thread priorities and CPU placement.
+ */
+
+
+#include "CamThreading.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "CamConfig.h"
+
+// Newer Haiku has the glibc style affinity calls; older releases have
+// no way to bind a thread to a CPU, and pinning is then left out
+#if defined(__HAIKU__) && defined(CPU_SETSIZE) && defined(CPU_SET)
+#	define CAM_HAVE_THREAD_AFFINITY 1
+#endif
+
+
+static const char* const kStageNames[CAM_THREAD_STAGE_COUNT] = {
+	"audio pump",
+	"video pump",
+	"audio producer",
+	"video producer",
+	"decoder"
+};
+
+static const char* const kStageVariables[CAM_THREAD_STAGE_COUNT] = {
+	"WEBCAM_PRIORITY_AUDIO_PUMP",
+	"WEBCAM_PRIORITY_VIDEO_PUMP",
+	"WEBCAM_PRIORITY_AUDIO_PRODUCER",
+	"WEBCAM_PRIORITY_VIDEO_PRODUCER",
+	"WEBCAM_PRIORITY_DECODER"
+};
+
+static const int32 kStagedPriorities[CAM_THREAD_STAGE_COUNT] = {
+	CamConfig::kPriorityAudioPump,
+	CamConfig::kPriorityVideoPump,
+	CamConfig::kPriorityAudioProducer,
+	CamConfig::kPriorityVideoProducer,
+	CamConfig::kPriorityDecoder
+};
+
+// What the threads were spawned with before there was a policy
+static const int32 kLegacyPriorities[CAM_THREAD_STAGE_COUNT] = {
+	B_REAL_TIME_PRIORITY,
+	B_URGENT_DISPLAY_PRIORITY,
+	B_REAL_TIME_PRIORITY,
+	B_NORMAL_PRIORITY,
+	B_NORMAL_PRIORITY
+};
+
+
+static status_t
+set_thread_core(thread_id thread, int32 core)
+{
+#ifdef CAM_HAVE_THREAD_AFFINITY
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	if (sched_setaffinity(thread, sizeof(set), &set) != 0)
+		return errno;
+	return B_OK;
+#else
+	(void)thread;
+	(void)core;
+	return B_NOT_SUPPORTED;
+#endif
+}
+
+
+CamThreadPolicy::CamThreadPolicy(int32 cameraIndex)
+	:
+	fCameraIndex(cameraIndex),
+	fMode(CAM_THREADS_STAGED)
+{
+	memset(fOverrides, 0, sizeof(fOverrides));
+	_ReadEnvironment();
+}
+
+
+void
+CamThreadPolicy::SetMode(cam_thread_mode mode)
+{
+	if (mode < CAM_THREADS_STAGED || mode > CAM_THREADS_LEGACY)
+		return;
+	fMode = mode;
+}
+
+
+int32
+CamThreadPolicy::Priority(cam_thread_stage stage) const
+{
+	if (stage < 0 || stage >= CAM_THREAD_STAGE_COUNT)
+		return B_NORMAL_PRIORITY;
+	if (fOverrides[stage] > 0)
+		return fOverrides[stage];
+	if (fMode == CAM_THREADS_LEGACY)
+		return kLegacyPriorities[stage];
+	return kStagedPriorities[stage];
+}
+
+
+void
+CamThreadPolicy::SetPriority(cam_thread_stage stage, int32 priority)
+{
+	if (stage < 0 || stage >= CAM_THREAD_STAGE_COUNT)
+		return;
+	if (priority > B_REAL_TIME_PRIORITY)
+		priority = B_REAL_TIME_PRIORITY;
+	fOverrides[stage] = priority > 0 ? priority : 0;
+}
+
+
+int32
+CamThreadPolicy::Core() const
+{
+	if (fMode != CAM_THREADS_PINNED)
+		return -1;
+
+	system_info info;
+	if (get_system_info(&info) != B_OK || info.cpu_count < 2)
+		return -1;
+
+	// Start at CPU 1: CPU 0 takes most interrupts and only gets a camera
+	// once every other CPU has one
+	return (fCameraIndex + 1) % info.cpu_count;
+}
+
+
+status_t
+CamThreadPolicy::Apply(thread_id thread, cam_thread_stage stage) const
+{
+	if (thread < 0)
+		return B_BAD_THREAD_ID;
+
+	status_t status = set_thread_priority(thread, Priority(stage));
+	if (status < B_OK)
+		return status;
+
+	// The decoders run in parallel, binding them would serialize them
+	int32 core = Core();
+	if (core < 0 || stage == CAM_THREAD_DECODER)
+		return B_OK;
+
+	status_t pinned = set_thread_core(thread, core);
+	static int32 sPinFailuresLogged = 0;
+	if (pinned != B_OK && atomic_add(&sPinFailuresLogged, 1) < 1) {
+		syslog(LOG_WARNING, "CamThreadPolicy: cannot pin threads to a CPU: "
+			"%s\n", strerror(pinned));
+	}
+	return B_OK;
+}
+
+
+const char*
+CamThreadPolicy::StageName(cam_thread_stage stage)
+{
+	if (stage < 0 || stage >= CAM_THREAD_STAGE_COUNT)
+		return "unknown";
+	return kStageNames[stage];
+}
+
+
+void
+CamThreadPolicy::_ReadEnvironment()
+{
+	const char* mode = getenv("WEBCAM_THREADS");
+	if (mode != NULL) {
+		if (strcmp(mode, "staged") == 0)
+			fMode = CAM_THREADS_STAGED;
+		else if (strcmp(mode, "pinned") == 0)
+			fMode = CAM_THREADS_PINNED;
+		else if (strcmp(mode, "legacy") == 0)
+			fMode = CAM_THREADS_LEGACY;
+		else {
+			syslog(LOG_WARNING, "CamThreadPolicy: unknown WEBCAM_THREADS "
+				"\"%s\"\n", mode);
+		}
+	}
+
+	for (int32 i = 0; i < CAM_THREAD_STAGE_COUNT; i++) {
+		const char* value = getenv(kStageVariables[i]);
+		if (value == NULL)
+			continue;
+		int32 priority = atoi(value);
+		if (priority < 1 || priority > B_REAL_TIME_PRIORITY) {
+			syslog(LOG_WARNING, "CamThreadPolicy: ignoring %s=%s\n",
+				kStageVariables[i], value);
+			continue;
+		}
+		fOverrides[i] = priority;
+	}
+}
+
+
+// =============================================================================
+// CamSubmitOrder
+// =============================================================================
+
+
+CamSubmitOrder::CamSubmitOrder()
+	:
+	fTurnSem(-1),
+	fNextTicket(0),
+	fTurn(0),
+	fWaiting(0),
+	fCallThread(0)
+{
+}
+
+
+CamSubmitOrder::~CamSubmitOrder()
+{
+	Uninit();
+}
+
+
+status_t
+CamSubmitOrder::Init(const char* name)
+{
+	Uninit();
+	fNextTicket = 0;
+	atomic_set(&fTurn, 0);
+	atomic_set(&fWaiting, 0);
+	atomic_set(&fCallThread, 0);
+	fTurnSem = create_sem(0, name);
+	return fTurnSem >= B_OK ? B_OK : fTurnSem;
+}
+
+
+void
+CamSubmitOrder::Uninit()
+{
+	if (fTurnSem >= B_OK)
+		delete_sem(fTurnSem);
+	fTurnSem = -1;
+}
+
+
+status_t
+CamSubmitOrder::Enter(uint32 ticket)
+{
+	atomic_add(&fWaiting, 1);
+	while (atomic_get(&fTurn) != (int32)ticket) {
+		// The timeout only covers a wakeup that went to another waiter
+		status_t status = acquire_sem_etc(fTurnSem, 1, B_RELATIVE_TIMEOUT,
+			1000);
+		if (status != B_OK && status != B_TIMED_OUT
+			&& status != B_INTERRUPTED) {
+			atomic_add(&fWaiting, -1);
+			return status;
+		}
+	}
+	atomic_add(&fWaiting, -1);
+
+	// The previous transfer has to be in the stack's hands first: its
+	// thread blocked in the call, or back out of it
+	for (;;) {
+		thread_id previous = atomic_get(&fCallThread);
+		thread_info info;
+		if (previous == 0 || get_thread_info(previous, &info) != B_OK
+			|| (info.state != B_THREAD_RUNNING
+				&& info.state != B_THREAD_READY))
+			break;
+		snooze(10);
+	}
+
+	atomic_set(&fCallThread, find_thread(NULL));
+	atomic_set(&fTurn, (int32)(ticket + 1));
+	int32 waiting = atomic_get(&fWaiting);
+	if (waiting > 0)
+		release_sem_etc(fTurnSem, waiting, B_DO_NOT_RESCHEDULE);
+	return B_OK;
+}
+
+
+void
+CamSubmitOrder::Leave()
+{
+	// Unless a later thread entered meanwhile
+	thread_id self = find_thread(NULL);
+	atomic_test_and_set(&fCallThread, 0, self);
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Per-camera thread priorities and CPU placement, pump scheduling
+ * statistics, and the order transfers are submitted in.
+ */
+#ifndef _CAM_THREADING_H
+#define _CAM_THREADING_H
+
+
+#include <OS.h>
+
+
+// =============================================================================
+// Thread Policy
+// =============================================================================
+// Every camera runs a video pump (plus ISO submitters), an audio pump, two
+// producers and the MJPEG decoders. The policy gives each stage its own
+// priority, so with several cameras the producers never preempt a USB pump,
+// and can keep one camera's pumps and producers on one core.
+//
+// Defaults come from CamConfig; the environment overrides them:
+//   WEBCAM_THREADS=staged|pinned|legacy
+//   WEBCAM_PRIORITY_AUDIO_PUMP=n, ..._VIDEO_PUMP, ..._AUDIO_PRODUCER,
+//   ..._VIDEO_PRODUCER, ..._DECODER (1..120)
+// The mode is also a device parameter.
+
+enum cam_thread_stage {
+	CAM_THREAD_AUDIO_PUMP = 0,		// audio pump and its ISO submitters
+	CAM_THREAD_VIDEO_PUMP,			// data pump and its ISO submitters
+	CAM_THREAD_AUDIO_PRODUCER,
+	CAM_THREAD_VIDEO_PRODUCER,
+	CAM_THREAD_DECODER,
+	CAM_THREAD_STAGE_COUNT
+};
+
+enum cam_thread_mode {
+	CAM_THREADS_STAGED = 0,			// priorities by stage
+	CAM_THREADS_PINNED,				// same, camera kept on one core
+	CAM_THREADS_LEGACY				// the fixed priorities of old
+};
+
+
+class CamThreadPolicy {
+public:
+								CamThreadPolicy(int32 cameraIndex);
+
+			int32				CameraIndex() const { return fCameraIndex; }
+
+			void				SetMode(cam_thread_mode mode);
+			cam_thread_mode		Mode() const { return fMode; }
+
+			int32				Priority(cam_thread_stage stage) const;
+								// Overrides the mode's priority for a stage
+			void				SetPriority(cam_thread_stage stage,
+									int32 priority);
+
+								// Core this camera's threads are pinned
+								// to, or -1
+			int32				Core() const;
+
+								// Sets the stage priority (and core) of a
+								// running thread
+			status_t			Apply(thread_id thread,
+									cam_thread_stage stage) const;
+
+	static	const char*			StageName(cam_thread_stage stage);
+
+private:
+			void				_ReadEnvironment();
+
+			int32				fCameraIndex;
+			cam_thread_mode		fMode;
+			int32				fOverrides[CAM_THREAD_STAGE_COUNT];	// 0: none
+};
+
+
+// =============================================================================
+// Scheduling Statistics
+// =============================================================================
+// Latency from a transfer completing to its pump having handed it back.
+// The deadline is how long the transfers still queued behind it take; a
+// pump that needs longer leaves the endpoint without a transfer.
+
+struct cam_schedule_stats {
+	uint32		wakeups;
+	uint32		deadline_misses;
+	bigtime_t	latency_sum;
+	bigtime_t	latency_max;
+
+	void Reset() {
+		wakeups = 0;
+		deadline_misses = 0;
+		latency_sum = 0;
+		latency_max = 0;
+	}
+
+	void Record(bigtime_t latency, bigtime_t deadline) {
+		wakeups++;
+		latency_sum += latency;
+		if (latency > latency_max)
+			latency_max = latency;
+		if (latency > deadline)
+			deadline_misses++;
+	}
+
+	bigtime_t AverageLatency() const {
+		return wakeups > 0 ? latency_sum / wakeups : 0;
+	}
+};
+
+
+// =============================================================================
+// Ordered Submission
+// =============================================================================
+// IsochronousTransfer() and BulkTransfer() only return once the transfer
+// is done, so the transfer rings keep several queued with one thread per
+// slot. The pumps take them back in ring order, and the host controller
+// runs them in the order they reach the stack, so the threads must get
+// there in ring order as well, on every submission.
+//
+// The thread handing the slots out (the pump) gives each submission the
+// next ticket, in ring order. A slot thread calls Enter() with its ticket
+// before the transfer and Leave() once it returned; Enter() waits for the
+// turn of that ticket, and then for the thread of the previous one to be
+// blocked in the stack. A blocked transfer is queued, or waits on a lock of
+// the stack, which hands out in arrival order, so nothing after it can get
+// ahead of it.
+
+class CamSubmitOrder {
+public:
+								CamSubmitOrder();
+								~CamSubmitOrder();
+
+								// Before the slots are handed out; ticket
+								// numbers start over
+			status_t			Init(const char* name);
+								// Fails every Enter(), waiting or not
+			void				Uninit();
+
+								// From the one thread handing out slots
+			uint32				Take() { return fNextTicket++; }
+
+			status_t			Enter(uint32 ticket);
+			void				Leave();
+
+private:
+			sem_id				fTurnSem;
+			uint32				fNextTicket;
+			int32				fTurn;			// ticket that may enter
+			int32				fWaiting;		// threads in Enter()
+			int32				fCallThread;	// entered last, 0 once out
+};
+
+
+#endif /* _CAM_THREADING_H */
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * One timeline for the frames of cameras recording together.
+ */
+
+
+#include "CamTimebase.h"
+
+#include <string.h>
+
+
+// A reference frame older than this says the reference stopped streaming
+static const bigtime_t kStaleReference = 1000000;
+
+
+CamTimebase::CamTimebase()
+	:
+	fStartTime(0)
+{
+	memset(fMembers, 0, sizeof(fMembers));
+}
+
+
+int32
+CamTimebase::Join()
+{
+	for (int32 i = 0; i < kMaxMembers; i++) {
+		if (atomic_get(&fMembers[i].used) != 0)
+			continue;
+		atomic_set64(&fMembers[i].latency, 0);
+		atomic_set64(&fMembers[i].last_stamp, 0);
+		atomic_set64(&fMembers[i].interval, 0);
+		atomic_set(&fMembers[i].used, 1);
+		return i;
+	}
+	return -1;
+}
+
+
+void
+CamTimebase::Leave(int32 member)
+{
+	if (member < 0 || member >= kMaxMembers)
+		return;
+	atomic_set(&fMembers[member].used, 0);
+	atomic_set64(&fMembers[member].latency, 0);
+}
+
+
+int32
+CamTimebase::CountMembers() const
+{
+	int32 count = 0;
+	for (int32 i = 0; i < kMaxMembers; i++) {
+		if (atomic_get((int32*)&fMembers[i].used) != 0)
+			count++;
+	}
+	return count;
+}
+
+
+bigtime_t
+CamTimebase::ScheduleStart(bigtime_t lead)
+{
+	bigtime_t start = (system_time() + lead + 999) / 1000 * 1000;
+	atomic_set64(&fStartTime, start);
+	return start;
+}
+
+
+void
+CamTimebase::SetCaptureLatency(int32 member, bigtime_t latency)
+{
+	if (member >= 0 && member < kMaxMembers)
+		atomic_set64(&fMembers[member].latency, latency);
+}
+
+
+bigtime_t
+CamTimebase::CaptureLatency() const
+{
+	bigtime_t latency = 0;
+	for (int32 i = 0; i < kMaxMembers; i++) {
+		if (atomic_get((int32*)&fMembers[i].used) == 0)
+			continue;
+		bigtime_t memberLatency
+			= atomic_get64((int64*)&fMembers[i].latency);
+		if (memberLatency > latency)
+			latency = memberLatency;
+	}
+	return latency;
+}
+
+
+bool
+CamTimebase::AddFrame(int32 member, bigtime_t stamp, bigtime_t interval,
+	bigtime_t* skew)
+{
+	if (member < 0 || member >= kMaxMembers || stamp <= 0)
+		return false;
+
+	atomic_set64(&fMembers[member].last_stamp, stamp);
+	atomic_set64(&fMembers[member].interval, interval);
+
+	int32 reference = _Reference();
+	if (reference < 0 || reference == member)
+		return false;
+
+	bigtime_t referenceStamp
+		= atomic_get64(&fMembers[reference].last_stamp);
+	bigtime_t referenceInterval
+		= atomic_get64(&fMembers[reference].interval);
+	if (referenceStamp <= 0 || referenceInterval <= 0
+		|| stamp - referenceStamp > kStaleReference
+		|| referenceStamp - stamp > kStaleReference)
+		return false;
+
+	// Nearest reference frame, on its cadence from the last one seen; the
+	// one captured with this frame may not have been sent yet
+	bigtime_t offset = stamp - referenceStamp + referenceInterval / 2;
+	bigtime_t frames = offset / referenceInterval;
+	if (offset < 0 && offset % referenceInterval != 0)
+		frames--;
+	*skew = stamp - referenceStamp - frames * referenceInterval;
+	return true;
+}
+
+
+int32
+CamTimebase::_Reference() const
+{
+	for (int32 i = 0; i < kMaxMembers; i++) {
+		if (atomic_get((int32*)&fMembers[i].used) != 0)
+			return i;
+	}
+	return -1;
+}
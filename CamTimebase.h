@@ -0,0 +1,90 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * One timeline for the frames of cameras recording together.
+ */
+#ifndef _CAM_TIMEBASE_H
+#define _CAM_TIMEBASE_H
+
+
+#include <OS.h>
+#include <SupportDefs.h>
+
+
+// =============================================================================
+// Shared Timebase
+// =============================================================================
+// Each camera stamps its frames with the capture time its device clock
+// gives (PTS/SCR, see UVCClockRecovery), else the arrival of its first
+// packet, both in system_time(). What differs between cameras is the
+// delay each producer adds before a frame is due, which it tracks on its
+// own; that puts frames captured at one instant tens of milliseconds apart
+// on the consumers' timeline. Members of a timebase stamp their frames
+// with the longest of their capture to send delays instead, so frames
+// captured together are due together and a muxer pairs them by start_time.
+//
+// Members start their streams at one instant (ScheduleStart()), on a
+// millisecond, i.e. USB frame, boundary, and the skew of each frame
+// against the reference camera's nearest one (the first member) is
+// reported through the camera's metrics.
+//
+// Joining and leaving is up to the roster, under its lock; the per frame
+// calls are lock free, from each member's sending thread.
+//
+// Grouped start: write to the control port of any grouped camera's video
+// node with code WEBCAM_MSG_SYNC_START and no data, once the nodes run.
+
+#define WEBCAM_MSG_SYNC_START	'wsys'
+
+class CamTimebase {
+public:
+	enum {
+		kMaxMembers = 8
+	};
+
+								CamTimebase();
+
+								// A member index, or -1 when full
+			int32				Join();
+			void				Leave(int32 member);
+			int32				CountMembers() const;
+
+								// The next millisecond at least 'lead'
+								// from now; members' pumps wait for it
+			bigtime_t			ScheduleStart(bigtime_t lead);
+			bigtime_t			StartTime() const
+									{ return atomic_get64(
+										(int64*)&fStartTime); }
+
+								// The member's own capture to send delay
+			void				SetCaptureLatency(int32 member,
+									bigtime_t latency);
+								// The delay all members stamp with
+			bigtime_t			CaptureLatency() const;
+
+								// A member's frame captured at 'stamp',
+								// its frames 'interval' apart. *skew is
+								// the capture time against the reference's
+								// nearest frame; false if there is none
+								// to compare with (or this is the
+								// reference).
+			bool				AddFrame(int32 member, bigtime_t stamp,
+									bigtime_t interval, bigtime_t* skew);
+
+private:
+	struct member {
+		int32			used;
+		int64			latency;
+		int64			last_stamp;		// of the last frame
+		int64			interval;
+	};
+
+			int32				_Reference() const;
+
+			member				fMembers[kMaxMembers];
+			int64				fStartTime;
+};
+
+
+#endif /* _CAM_TIMEBASE_H */
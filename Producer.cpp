@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <malloc.h>
 #include <math.h>
+#include <new>
 #include <stdio.h>
 #include <string.h>
 #include <sys/uio.h>
@@ -14,6 +15,7 @@
 
 #include <media/Buffer.h>
 #include <media/BufferGroup.h>
+#include <media/MediaFormats.h>
 #include <media/ParameterWeb.h>
 #include <media/TimeSource.h>
 
@@ -23,8 +25,16 @@
 //XXX: change interface
 #include <interface/Bitmap.h>
 
+#include "AddOn.h"
+#include "CamConfig.h"
+#include "CamDebug.h"
 #include "CamDevice.h"
+#include "CamFrameScaler.h"
+#include "CamJpegIndex.h"
+#include "CamRoster.h"
 #include "CamSensor.h"
+#include "CamStill.h"
+#include "CamTimebase.h"
 
 #define SINGLE_PARAMETER_GROUP 1
 
@@ -71,10 +81,201 @@
 //#define FIELD_RATE 29.97f  // Use for NTSC compatibility if needed
 //#define FIELD_RATE 5.0f    // Low framerate for debugging only
 
+// FrameGenerator() is woken by each decoded frame; after this many frame
+// intervals without one it counts a miss and logs. Once the device has
+// timed enough frames its adaptive timeout is used instead.
+static const int32 kFrameWatchdogFrames = 4;
+static const uint32 kWatchdogTimedFrames = 30;
+
+// Frames between updates of fProcessingLatency from the decode histogram
+static const uint32 kLatencyUpdateFrames = 32;
+
+// Buffers already on their way when the frame skip goes up still arrive
+// late; late notices within this many frame intervals count as one
+static const int32 kLateNoticeHoldoffFrames = 4;
+
+// FillFrameBuffer() left the sequence alone: no frame consumed, or a device
+// that does not number its frames
+static const uint32 kNoSequence = 0xffffffff;
+
+// Posted to our control port by a decoder that saw the device change its
+// frame size; handled by _SwitchFormat()
+static const int32 kMsgSwitchFormat = 'wswf';
+
 // Define static member variable
 int32 VideoProducer::fInstances = 0;
 
 
+/* Output color spaces: B_RGB32, B_RGB24 or B_RGB16 (converted/decoded),
+ * B_YCbCr422 (YUY2 passed through from the camera, or decoded MJPEG) or
+ * B_YCbCr420 (decoded MJPEG, three bytes per pixel pair) */
+static inline uint32
+bytes_per_row(color_space space, uint32 width)
+{
+	switch (space) {
+		case B_YCbCr420:
+			return (width + 1) / 2 * 3;
+		case B_YCbCr422:
+			return (width + 1) / 2 * 4;
+		case B_RGB16:
+			return width * 2;
+		case B_RGB24:
+			return width * 3;
+		default:
+			return width * 4;
+	}
+}
+
+
+/* Most an MJPEG frame passed on takes: a sane one is smaller than the YUY2
+ * frame of its size, and the device may add the Huffman tables */
+static inline size_t
+encoded_frame_size(uint32 width, uint32 height)
+{
+	return (size_t)width * height * 2 + CAM_JPEG_DHT_SIZE;
+}
+
+
+/* The MJPEG encoding as the installed codecs know it */
+static status_t
+get_mjpeg_format(media_format* format)
+{
+	media_format_description description;
+	description.family = B_AVI_FORMAT_FAMILY;
+	description.u.avi.codec = 'MJPG';
+
+	BMediaFormats formats;
+	status_t err = formats.InitCheck();
+	if (err == B_OK)
+		err = formats.GetFormatFor(description, format);
+	return err;
+}
+
+
+/* Bounding box of a clipping list: bands of rows, top to bottom from row
+ * 0, each an int16 count of x pairs, the number of rows the band spans,
+ * then the pairs' left and right edges, inclusive. False for a list that
+ * does not parse that way; a list that shows nothing gives an empty box. */
+static bool
+clipping_bounds(const int16* data, int32 count, clipping_rect* bounds)
+{
+	bounds->left = bounds->top = 0;
+	bounds->right = bounds->bottom = -1;
+	bool empty = true;
+	int32 row = 0;
+	int32 i = 0;
+	while (i < count) {
+		if (i + 2 > count)
+			return false;
+		int32 pairs = data[i];
+		int32 rows = data[i + 1];
+		i += 2;
+		if (pairs < 0 || rows < 0 || i + pairs * 2 > count)
+			return false;
+
+		for (int32 j = 0; j < pairs && rows > 0; j++) {
+			int32 left = data[i + j * 2];
+			int32 right = data[i + j * 2 + 1];
+			if (right < left)
+				continue;
+			if (empty) {
+				bounds->left = left;
+				bounds->top = row;
+				bounds->right = right;
+				empty = false;
+			} else {
+				bounds->left = min_c(bounds->left, left);
+				bounds->right = max_c(bounds->right, right);
+			}
+			bounds->bottom = row + rows - 1;
+		}
+		i += pairs * 2;
+		row += rows;
+	}
+	return true;
+}
+
+
+/* Whether every buffer of 'group' takes 'size' bytes */
+static status_t
+group_fits(BBufferGroup* group, size_t size)
+{
+	int32 count;
+	status_t err = group->CountBuffers(&count);
+	if (err != B_OK)
+		return err;
+	if (count <= 0)
+		return B_BAD_VALUE;
+	BBuffer **buffers = new(std::nothrow) BBuffer *[count];
+	if (buffers == NULL)
+		return B_NO_MEMORY;
+	err = group->GetBufferList(count, buffers);
+	for (int32 i = 0; err == B_OK && i < count; i++) {
+		if (buffers[i]->SizeAvailable() < size)
+			err = B_BAD_VALUE;
+	}
+	delete[] buffers;
+	if (err != B_OK) {
+		syslog(LOG_WARNING, "Producer: SetBufferGroup: %d buffer(s) "
+			"rejected, need %zu bytes each: %s\n", (int)count, size,
+			strerror(err));
+	}
+	return err;
+}
+
+
+/* The header of a buffer the decode stage fills, 'size' bytes of video */
+static void
+init_video_header(media_header* header, size_t size, uint32 lineCount)
+{
+	header->type = B_MEDIA_RAW_VIDEO;
+	header->size_used = size;
+	header->file_pos = 0;
+	header->orig_size = 0;
+	header->data_offset = 0;
+	header->u.raw_video.field_gamma = 1.0;
+	header->u.raw_video.field_number = 0;
+	header->u.raw_video.pulldown_number = 0;
+	header->u.raw_video.first_active_line = 1;
+	header->u.raw_video.line_count = lineCount;
+	header->user_data_type = 0;
+}
+
+
+/* The header of an MJPEG frame passed on; the device sets size_used */
+static void
+init_encoded_video_header(media_header* header, uint32 lineCount)
+{
+	header->type = B_MEDIA_ENCODED_VIDEO;
+	header->size_used = 0;
+	header->file_pos = 0;
+	header->orig_size = 0;
+	header->data_offset = 0;
+	header->u.encoded_video.field_flags = B_MEDIA_KEY_FRAME;
+	header->u.encoded_video.first_active_line = 1;
+	header->u.encoded_video.line_count = lineCount;
+	header->user_data_type = 0;
+}
+
+
+static inline const char*
+color_space_name(color_space space)
+{
+	switch (space) {
+		case B_YCbCr422:
+			return "B_YCbCr422";
+		case B_YCbCr420:
+			return "B_YCbCr420";
+		case B_RGB24:
+			return "B_RGB24";
+		case B_RGB16:
+			return "B_RGB16";
+		default:
+			return "B_RGB32";
+	}
+}
+
+
 VideoProducer::VideoProducer(
 		BMediaAddOn *addon, CamDevice *dev, const char *name, int32 internal_id)
 	: BMediaNode(name),
@@ -97,24 +298,58 @@ VideoProducer::VideoProducer(
 	fCamDevice = dev;
 
 	fBufferGroup = NULL;
+	fOwnBufferGroup = true;
 
 	fThread = -1;
 	fFrameSync = -1;
+	fActiveFillers = 0;
+	fFillersIdle = create_sem(0, "decoders idle");
+	fParkDecoders = false;
+	fDecodeThreadCount = 0;
+	fDecodedHead = 0;
+	fDecodedCount = 0;
+	fReorderCount = 0;
+	fNextSequence = 0;
+	fHaveSequence = false;
 	fProcessingLatency = 0LL;
+	fCaptureLatency = 0LL;
+	fDownstreamLatency = 0LL;
+	fLatenessPad = 0LL;
+	fFrameSkip = 0;
+	fLastLateNotice = 0LL;
+	fLastSkipChange = 0LL;
 
 	fRunning = false;
 	fConnected = false;
 	fEnabled = false;
+	fEncoded = false;
+	fSwitchPending = 0;
+	fFirstFrameStart = 0;
+	fWarmStart = false;
 
 	// CRITICAL FIX: Initialize timing variables to avoid garbage values
 	// causing TimeSource overflow crashes in BMediaEventLooper
 	fFrame = 0;
 	fFrameBase = 0;
+	fCaptureLatency = 0;
 	fPerformanceTimeBase = 0;  // Will be set properly in HandleStart()
 	fStartRealTime = 0;
 
 	fOutput.destination = media_destination::null;
 
+	for (int32 i = 0; i < kMaxScaledOutputs; i++) {
+		scaled_output &scaled = fScaled[i];
+		scaled.output.destination = media_destination::null;
+		memset(&scaled.format, 0, sizeof(scaled.format));
+		scaled.group = NULL;
+		scaled.ownGroup = true;
+		scaled.connected = false;
+		scaled.enabled = false;
+		scaled.downstreamLatency = 0;
+	}
+	fScaledConnected = 0;
+	fHasVisibleRegion = false;
+
 	// CRITICAL FIX: Initialize fConnectedFormat with default dimensions
 	// so that queries for "current format" return sensible values even
 	// before a connection is established. BubiCam reads this to show
@@ -138,10 +373,16 @@ VideoProducer::~VideoProducer()
 {
 	/* Clean up after ourselves, in case the application didn't make us
 	 * do so. */
+	for (int32 i = 0; i < kMaxScaledOutputs; i++) {
+		if (fScaled[i].connected)
+			_DisconnectScaled(fScaled[i]);
+	}
 	if (fConnected)
 		Disconnect(fOutput.source, fOutput.destination);
 	if (fRunning)
 		HandleStop();
+	if (fFillersIdle >= B_OK)
+		delete_sem(fFillersIdle);
 
 	/* FIX BUG 7: Always decrement counter since we always increment in constructor.
 	 * Counter is now for debugging/statistics only, not for access control. */
@@ -167,8 +408,42 @@ VideoProducer::AddOn(int32 *internal_id) const
 
 
 status_t
-VideoProducer::HandleMessage(int32 /*message*/, const void* /*data*/, size_t /*size*/)
+VideoProducer::HandleMessage(int32 message, const void* data, size_t size)
 {
+	if (message == WEBCAM_MSG_DUMP_TRACE) {
+		DumpWebcamTrace();
+		return B_OK;
+	}
+	if (message == WEBCAM_MSG_GET_METRICS) {
+		if (fCamDevice == NULL)
+			return B_BAD_VALUE;
+		return fCamDevice->HandleMetricsRequest(data, size, ID(), Name());
+	}
+	if (message == WEBCAM_MSG_GET_LATENCY_PROBE) {
+		if (fCamDevice == NULL)
+			return B_BAD_VALUE;
+		return fCamDevice->HandleProbeRequest(data, size, ID(), Name());
+	}
+	if (message == WEBCAM_MSG_CAPTURE_STILL) {
+		if (fCamDevice == NULL)
+			return B_BAD_VALUE;
+		return fCamDevice->HandleStillRequest(data, size);
+	}
+	if (message == WEBCAM_MSG_SYNC_START) {
+		WebCamMediaAddOn* addOn = dynamic_cast<WebCamMediaAddOn*>(fAddOn);
+		if (fCamDevice == NULL || fCamDevice->Timebase() == NULL
+			|| addOn == NULL || addOn->Roster() == NULL)
+			return B_BAD_VALUE;
+		CamRoster* roster = addOn->Roster();
+		roster->Lock();
+		status_t status = roster->StartSyncGroup();
+		roster->Unlock();
+		return status;
+	}
+	if (message == kMsgSwitchFormat) {
+		_SwitchFormat();
+		return B_OK;
+	}
 	return B_ERROR;
 }
 
@@ -184,7 +459,8 @@ VideoProducer::Preroll()
 void
 VideoProducer::SetTimeSource(BTimeSource* /*time_source*/)
 {
-	/* Tell frame generation thread to recalculate delay value */
+	/* Wake the frame generation thread; it picks up the new time source
+	 * with the next frame */
 	/* FIX: Check semaphore is valid before releasing */
 	if (fFrameSync >= 0)
 		release_sem(fFrameSync);
@@ -282,6 +558,12 @@ VideoProducer::NodeRegistered()
 			fConnectedFormat.display.line_width = width;
 			fConnectedFormat.display.line_count = height;
 			fConnectedFormat.display.bytes_per_row = width * 4;
+			// The camera's default rate for the size
+			float fieldRate = 0.0f;
+			if (fCamDevice->AcceptFrameRate(fieldRate) == B_OK) {
+				fOutput.format.u.raw_video.field_rate = fieldRate;
+				fConnectedFormat.field_rate = fieldRate;
+			}
 			syslog(LOG_INFO, "Producer: NodeRegistered - video dimensions set to %ux%u, bpr=%u\n",
 				width, height, width * 4);
 		} else {
@@ -296,6 +578,23 @@ VideoProducer::NodeRegistered()
 		}
 	}
 
+	/* The scaled outputs take their size from fOutput once that is
+	 * connected */
+	for (int32 i = 0; i < kMaxScaledOutputs; i++) {
+		media_output &output = fScaled[i].output;
+		output.node = Node();
+		output.source.port = ControlPort();
+		output.source.id = i + 1;
+		output.destination = media_destination::null;
+		snprintf(output.name, sizeof(output.name), "%s (scaled %d)", Name(),
+			(int)(i + 1));
+		output.format.type = B_MEDIA_RAW_VIDEO;
+		output.format.u.raw_video = media_raw_video_format::wildcard;
+		output.format.u.raw_video.interlace = 1;
+		output.format.u.raw_video.display.format = B_RGB32;
+		output.format.u.raw_video.field_rate = FIELD_RATE;
+	}
+
 	/* Start the BMediaEventLooper control loop */
 	syslog(LOG_INFO, "Producer: NodeRegistered - calling Run()\n");
 	SetPriority(B_REAL_TIME_PRIORITY);
@@ -374,6 +673,12 @@ VideoProducer::SetRunMode(run_mode mode)
 	// Allow mode changes - we're using our own TimeSource now so it should be safe
 	fprintf(stderr, "VideoProducer::SetRunMode: Setting mode to %d\n", mode);
 	BMediaEventLooper::SetRunMode(mode);
+
+	// Only the modes that may lose frames shed them
+	if (mode != B_DROP_DATA && mode != B_DECREASE_PRECISION) {
+		BAutolock _(fLock);
+		_SetFrameSkip(0);
+	}
 }
 
 
@@ -439,22 +744,35 @@ status_t
 VideoProducer::FormatSuggestionRequested(
 		media_type type, int32 quality, media_format *format)
 {
+	TOUCH(quality);
+
+	if (type == B_MEDIA_ENCODED_VIDEO) {
+		uint32 width = 0, height = 0;
+		float fieldRate = 0.0f;
+		if (fCamDevice != NULL) {
+			fCamDevice->SuggestVideoFrame(width, height);
+			fCamDevice->AcceptFrameRate(fieldRate);
+		}
+		return _EncodedFormat(width, height, fieldRate, format);
+	}
+
 	if (type != B_MEDIA_RAW_VIDEO)
 		return B_MEDIA_BAD_FORMAT;
 
-	TOUCH(quality);
-
 	PRINTF(1, ("FormatSuggestionRequested() %" B_PRIu32 "x%" B_PRIu32 "\n", \
 			format->u.raw_video.display.line_width, \
 			format->u.raw_video.display.line_count));
 
 	*format = fOutput.format;
 	uint32 width, height;
+	float fieldRate = 0.0f;
 	if (fCamDevice && fCamDevice->SuggestVideoFrame(width, height) == B_OK) {
 		format->u.raw_video.display.line_width = width;
 		format->u.raw_video.display.line_count = height;
+		if (fCamDevice->AcceptFrameRate(fieldRate) != B_OK)
+			fieldRate = 0.0f;
 	}
-	format->u.raw_video.field_rate = FIELD_RATE;
+	format->u.raw_video.field_rate = fieldRate > 0.0f ? fieldRate : FIELD_RATE;
 	return B_OK;
 }
 
@@ -480,6 +798,16 @@ VideoProducer::FormatProposal(const media_source &output, media_format *format)
 	fprintf(stderr, "  Height: %u\n", format->u.raw_video.display.line_count);
 	fprintf(stderr, "  Field rate: %.2f fps\n", format->u.raw_video.field_rate);
 
+	if (scaled_output* scaled = _ScaledOutput(output)) {
+		BAutolock _(fLock);
+		err = _NegotiateScaledFormat(*scaled, format);
+	fprintf(stderr, "Scaled output %d: %ux%u, %s\n", (int)output.id,
+			format->u.raw_video.display.line_width,
+			format->u.raw_video.display.line_count, strerror(err));
+	fprintf(stderr, "=== FormatProposal END ===\n\n");
+		return err;
+	}
+
 	if (output != fOutput.source) {
 	fprintf(stderr, "ERROR: Bad source - expected port=%d id=%d\n",
 				fOutput.source.port, fOutput.source.id);
@@ -487,6 +815,17 @@ VideoProducer::FormatProposal(const media_source &output, media_format *format)
 		return B_MEDIA_BAD_SOURCE;
 	}
 
+	if (format->type == B_MEDIA_ENCODED_VIDEO) {
+		err = _NegotiateEncodedFormat(format);
+	fprintf(stderr, "Encoded MJPEG %ux%u: %s\n",
+			format->u.encoded_video.output.display.line_width,
+			format->u.encoded_video.output.display.line_count,
+			strerror(err));
+	fprintf(stderr, "=== FormatProposal END ===\n\n");
+		return err;
+	}
+	_UseRawOutput();
+
 	PRINTF(1, ("FormatProposal() %" B_PRIu32 "x%" B_PRIu32 "\n", \
 			format->u.raw_video.display.line_width, \
 			format->u.raw_video.display.line_count));
@@ -501,12 +840,22 @@ VideoProducer::FormatProposal(const media_source &output, media_format *format)
 	uint32 height = format->u.raw_video.display.line_count;
 
 	// Check basic format compatibility (type and colorspace only)
+	// B_YCbCr422 is offered when the camera can stream YUY2, which is then
+	// passed through without colour conversion, or MJPEG, which then skips
+	// the RGB conversion of the decode, as B_YCbCr420 does; B_RGB24 and
+	// B_RGB16 are narrower conversion outputs, when the device can write
+	// them.
+	color_space requested = format->u.raw_video.display.format;
+	color_space space = B_RGB32;
 	bool basicCompatible = true;
 	if (format->type != B_MEDIA_RAW_VIDEO && format->type != B_MEDIA_UNKNOWN_TYPE)
 		basicCompatible = false;
-	if (format->u.raw_video.display.format != 0 &&
-		format->u.raw_video.display.format != B_RGB32 &&
-		format->u.raw_video.display.format != B_RGB32_BIG)
+	if (requested != 0 && requested != B_RGB32 && fCamDevice != NULL
+		&& fCamDevice->SupportsColorSpace(requested))
+		space = requested;
+	else if (requested != 0 &&
+		requested != B_RGB32 &&
+		requested != B_RGB32_BIG)
 		basicCompatible = false;
 
 	err = basicCompatible ? B_OK : B_MEDIA_BAD_FORMAT;
@@ -514,17 +863,28 @@ VideoProducer::FormatProposal(const media_source &output, media_format *format)
 	fprintf(stderr, "Format compatibility check: %s\n",
 			err == B_OK ? "OK" : "BAD_FORMAT");
 
-	// Copy our output format as base, then adjust resolution
+	// Copy our output format as base, then adjust colorspace, resolution
+	// and frame rate
+	float fieldRate = format->u.raw_video.field_rate;
 	*format = fOutput.format;
+	format->type = B_MEDIA_RAW_VIDEO;
+	format->u.raw_video.display.format = space;
 
 	if (err == B_OK && fCamDevice) {
+		// The colorspace decides which stream format AcceptVideoFrame() picks
+		fCamDevice->SetColorSpace(space);
 	fprintf(stderr, "Calling AcceptVideoFrame(%u, %u)\n", width, height);
 		err = fCamDevice->AcceptVideoFrame(width, height);
 	fprintf(stderr, "AcceptVideoFrame result: %s\n", strerror(err));
+		// The rate the mode has nearest the consumer's, 60 and 59.94 too
+		if (err >= B_OK)
+			err = fCamDevice->AcceptFrameRate(fieldRate);
 		if (err >= B_OK) {
 			format->u.raw_video.display.line_width = width;
 			format->u.raw_video.display.line_count = height;
-			format->u.raw_video.display.bytes_per_row = width * 4;
+			format->u.raw_video.display.bytes_per_row
+				= bytes_per_row(space, width);
+			format->u.raw_video.field_rate = fieldRate;
 
 			/* FIX: Update fOutput.format to match the accepted resolution.
 			 * Without this, PrepareToConnect's format_is_compatible() check
@@ -534,8 +894,12 @@ VideoProducer::FormatProposal(const media_source &output, media_format *format)
 			 */
 			fOutput.format.u.raw_video.display.line_width = width;
 			fOutput.format.u.raw_video.display.line_count = height;
-			fOutput.format.u.raw_video.display.bytes_per_row = width * 4;
-			fprintf(stderr, "Updated fOutput.format to %ux%u\n", width, height);
+			fOutput.format.u.raw_video.display.format = space;
+			fOutput.format.u.raw_video.display.bytes_per_row
+				= bytes_per_row(space, width);
+			fOutput.format.u.raw_video.field_rate = fieldRate;
+			fprintf(stderr, "Updated fOutput.format to %ux%u @ %.2f fps\n",
+				width, height, fieldRate);
 		}
 	}
 
@@ -544,7 +908,8 @@ VideoProducer::FormatProposal(const media_source &output, media_format *format)
 			format->u.raw_video.display.line_count));
 
 	fprintf(stderr, "Producer responds:\n");
-	fprintf(stderr, "  Color space: 0x%08x (B_RGB32)\n", format->u.raw_video.display.format);
+	fprintf(stderr, "  Color space: 0x%08x (%s)\n", format->u.raw_video.display.format,
+			color_space_name(format->u.raw_video.display.format));
 	fprintf(stderr, "  Width: %u\n", format->u.raw_video.display.line_width);
 	fprintf(stderr, "  Height: %u\n", format->u.raw_video.display.line_count);
 	fprintf(stderr, "  Result: %s (%d)\n", strerror(err), err);
@@ -561,7 +926,7 @@ VideoProducer::FormatChangeRequested(const media_source &source,
 		int32 *_deprecated_)
 {
 	TOUCH(destination); TOUCH(io_format); TOUCH(_deprecated_);
-	if (source != fOutput.source)
+	if (source != fOutput.source && _ScaledOutput(source) == NULL)
 		return B_MEDIA_BAD_SOURCE;
 
 	return B_ERROR;
@@ -574,10 +939,15 @@ VideoProducer::GetNextOutput(int32 *cookie, media_output *out_output)
 	if (!out_output)
 		return B_BAD_VALUE;
 
-	if ((*cookie) != 0)
+	if (*cookie < 0 || *cookie > kMaxScaledOutputs)
 		return B_BAD_INDEX;
 
-	*out_output = fOutput;
+	if (*cookie == 0)
+		*out_output = fOutput;
+	else {
+		BAutolock _(fLock);
+		*out_output = fScaled[*cookie - 1].output;
+	}
 	(*cookie)++;
 	return B_OK;
 }
@@ -592,13 +962,35 @@ VideoProducer::DisposeOutputCookie(int32 cookie)
 }
 
 
+/* A consumer group gets the frames decoded straight into its buffers,
+ * a BBitmap-backed one for instance; NULL goes back to our own. */
 status_t
 VideoProducer::SetBufferGroup(const media_source &for_source,
 		BBufferGroup *group)
 {
-	TOUCH(for_source); TOUCH(group);
+	if (scaled_output* scaled = _ScaledOutput(for_source))
+		return _SetScaledBufferGroup(*scaled, group);
+	if (for_source != fOutput.source)
+		return B_MEDIA_BAD_SOURCE;
+	if (!fConnected)
+		return B_MEDIA_NOT_CONNECTED;
 
-	return B_ERROR;
+	if (group != NULL) {
+		// Every buffer has to take a whole frame
+		status_t err = group_fits(group, _FrameBufferSize());
+		if (err != B_OK)
+			return err;
+	}
+
+	_ReleaseBufferGroup();
+	if (group == NULL)
+		return _CreateBufferGroup();
+
+	syslog(LOG_INFO, "Producer: using the consumer's buffer group\n");
+	BAutolock _(fLock);
+	fBufferGroup = group;
+	fOwnBufferGroup = false;
+	return B_OK;
 }
 
 
@@ -607,10 +999,51 @@ VideoProducer::VideoClippingChanged(const media_source &for_source,
 		int16 num_shorts, int16 *clip_data,
 		const media_video_display_info &display, int32 *_deprecated_)
 {
-	TOUCH(for_source); TOUCH(num_shorts); TOUCH(clip_data);
-	TOUCH(display); TOUCH(_deprecated_);
+	TOUCH(_deprecated_);
 
-	return B_ERROR;
+	// Whatever these show, they are scaled from all of fOutput's frame
+	if (_ScaledOutput(for_source) != NULL)
+		return B_OK;
+
+	if (for_source != fOutput.source || !fConnected || fCamDevice == NULL)
+		return B_MEDIA_BAD_SOURCE;
+
+	/* Only the part of the frame the view shows gets decoded. Anything
+	 * that does not parse as a clipping list shows all of it. */
+	BAutolock _(fLock);
+	clipping_rect visible;
+	if (num_shorts <= 0 || clip_data == NULL
+		|| !clipping_bounds(clip_data, num_shorts, &visible)) {
+		fHasVisibleRegion = false;
+		_ApplyVisibleRegion();
+		return B_OK;
+	}
+
+	// The view may show the frame scaled
+	const media_video_display_info& frame = fConnectedFormat.display;
+	if (display.line_width > 0 && display.line_count > 0
+		&& (display.line_width != frame.line_width
+			|| display.line_count != frame.line_count)) {
+		visible.left = visible.left * (int32)frame.line_width
+			/ (int32)display.line_width;
+		visible.right = ((visible.right + 1) * (int32)frame.line_width
+			+ (int32)display.line_width - 1) / (int32)display.line_width - 1;
+		visible.top = visible.top * (int32)frame.line_count
+			/ (int32)display.line_count;
+		visible.bottom = ((visible.bottom + 1) * (int32)frame.line_count
+			+ (int32)display.line_count - 1) / (int32)display.line_count - 1;
+	}
+
+	static int32 sClippingLog = 0;
+	if (++sClippingLog <= 5) {
+		syslog(LOG_INFO, "Producer: %s: decoding %" B_PRId32 ",%" B_PRId32
+			" - %" B_PRId32 ",%" B_PRId32 " of the frame\n", Name(),
+			visible.left, visible.top, visible.right, visible.bottom);
+	}
+	fVisibleRegion = visible;
+	fHasVisibleRegion = true;
+	_ApplyVisibleRegion();
+	return B_OK;
 }
 
 
@@ -641,6 +1074,20 @@ VideoProducer::PrepareToConnect(const media_source &source,
 			format->u.raw_video.display.line_width, \
 			format->u.raw_video.display.line_count));
 
+	if (scaled_output* scaled = _ScaledOutput(source)) {
+		BAutolock _(fLock);
+		if (scaled->output.destination != media_destination::null)
+			return B_MEDIA_ALREADY_CONNECTED;
+		err = _NegotiateScaledFormat(*scaled, format);
+		if (err != B_OK)
+			return err;
+		scaled->output.format = *format;
+		scaled->output.destination = destination;
+		*out_source = scaled->output.source;
+		strlcpy(out_name, scaled->output.name, B_MEDIA_NAME_LENGTH);
+		return B_OK;
+	}
+
 	if (fConnected) {
 		PRINTF(0, ("PrepareToConnect: Already connected\n"));
 	fprintf(stderr, "ERROR: Already connected\n");
@@ -660,6 +1107,32 @@ VideoProducer::PrepareToConnect(const media_source &source,
 		return B_MEDIA_ALREADY_CONNECTED;
 	}
 
+	// MJPEG as the camera sends it, no decode
+	if (format->type == B_MEDIA_ENCODED_VIDEO) {
+		err = _NegotiateEncodedFormat(format);
+		if (err != B_OK)
+			return err;
+		*out_source = fOutput.source;
+		strlcpy(out_name, fOutput.name, B_MEDIA_NAME_LENGTH);
+		fOutput.destination = destination;
+		return B_OK;
+	}
+	_UseRawOutput();
+
+	/* A consumer may ask for native YCbCr422, or a narrower RGB, here
+	 * without going through FormatProposal() first */
+	color_space requested = format->u.raw_video.display.format;
+	if (requested != 0 && requested != B_RGB32 && fCamDevice != NULL
+		&& fCamDevice->SupportsColorSpace(requested)
+		&& fOutput.format.u.raw_video.display.format != requested) {
+		fOutput.format.u.raw_video.display.format = requested;
+		fOutput.format.u.raw_video.display.bytes_per_row = 0;
+	}
+	// and a frame rate of its own, which AcceptFrameRate() puts on one the
+	// camera has
+	if (format->u.raw_video.field_rate > 0.0f)
+		fOutput.format.u.raw_video.field_rate = format->u.raw_video.field_rate;
+
 	/* The format parameter comes in with the suggested format, and may be
 	 * specialized as desired by the node */
 	if (!format_is_compatible(*format, fOutput.format)) {
@@ -688,7 +1161,19 @@ VideoProducer::PrepareToConnect(const media_source &source,
 		format->u.raw_video.display.line_count = 0;
 	}
 #endif
+	if (format->u.raw_video.display.format == 0)
+		format->u.raw_video.display.format
+			= fOutput.format.u.raw_video.display.format;
+	if (fCamDevice == NULL
+		|| !fCamDevice->SupportsColorSpace(format->u.raw_video.display.format))
+		format->u.raw_video.display.format = B_RGB32;
+
 	if (fCamDevice) {
+		err = fCamDevice->SetColorSpace(format->u.raw_video.display.format);
+		if (err < B_OK) {
+	fprintf(stderr, "ERROR: SetColorSpace failed\n");
+			return err;
+		}
 	fprintf(stderr, "Calling AcceptVideoFrame(%u, %u)\n",
 				format->u.raw_video.display.line_width,
 				format->u.raw_video.display.line_count);
@@ -701,6 +1186,9 @@ VideoProducer::PrepareToConnect(const media_source &source,
 	fprintf(stderr, "=== PrepareToConnect END (AcceptVideoFrame error) ===\n\n");
 			return err;
 		}
+		err = fCamDevice->AcceptFrameRate(format->u.raw_video.field_rate);
+		if (err < B_OK)
+			return err;
 	}
 
 	if (format->u.raw_video.field_rate == 0)
@@ -709,11 +1197,9 @@ VideoProducer::PrepareToConnect(const media_source &source,
 	// CRITICAL FIX: Ensure bytes_per_row is set (needed for buffer allocation)
 	if (format->u.raw_video.display.bytes_per_row == 0) {
 		// Calculate based on colorspace and width
-		uint32 bytesPerPixel = 4;  // Default to B_RGB32
-		if (format->u.raw_video.display.format == B_YCbCr422)
-			bytesPerPixel = 2;
-		format->u.raw_video.display.bytes_per_row =
-			format->u.raw_video.display.line_width * bytesPerPixel;
+		format->u.raw_video.display.bytes_per_row = bytes_per_row(
+			format->u.raw_video.display.format,
+			format->u.raw_video.display.line_width);
 	}
 
 	// CRITICAL FIX: Save the negotiated format in fOutput.format
@@ -761,6 +1247,15 @@ VideoProducer::Connect(status_t error, const media_source &source,
 			format.u.raw_video.display.line_width, \
 			format.u.raw_video.display.line_count));
 
+	if (scaled_output* scaled = _ScaledOutput(source)) {
+		_ConnectScaled(*scaled, error, destination, format, io_name);
+		if (fCamDevice != NULL) {
+			BAutolock lock(fCamDevice->Locker());
+			_UpdateTransfer();
+		}
+		return;
+	}
+
 	if (fConnected) {
 		PRINTF(0, ("Connect: Already connected\n"));
 	fprintf(stderr, "ERROR: Already connected\n");
@@ -818,46 +1313,54 @@ VideoProducer::Connect(status_t error, const media_source &source,
 	} else {
 		fConnectedFormat = format.u.raw_video;
 	}
+	// The frame size of encoded video is in its output format, which
+	// lies where raw video's format does
+	fEncoded = fOutput.format.type == B_MEDIA_ENCODED_VIDEO;
+	if (fEncoded)
+		fConnectedFormat = fOutput.format.u.encoded_video.output;
 
 	/* get the latency */
 	bigtime_t latency = 0;
 	media_node_id tsID = 0;
 	FindLatencyFor(fOutput.destination, &latency, &tsID);
 	#define NODE_LATENCY 1000
-	SetEventLatency(latency + NODE_LATENCY);
-
-	uint32 *buffer, *p, f = 3;
-	p = buffer = (uint32 *)malloc(4 * fConnectedFormat.display.line_count *
-			fConnectedFormat.display.line_width);
-	if (!buffer) {
-		PRINTF(0, ("Connect: Out of memory\n"));
-		return;
+	{
+		BAutolock _(fLock);
+		fDownstreamLatency = latency;
+		fLatenessPad = 0;
+		_SetFrameSkip(0);
+		_UpdateEventLatency();
+
+		// Frame timing of the previous format says nothing about this one
+		fCamDevice->ResetFrameTimingStats();
+		if (fConnectedFormat.field_rate > 0.0f)
+			fCamDevice->SetExpectedFrameRate(fConnectedFormat.field_rate);
+
+		// Scaled outputs connected first scale from this format
+		_SetUpScalers();
 	}
-	bigtime_t now = system_time();
-	for (uint32 y=0;y<fConnectedFormat.display.line_count;y++)
-		for (uint32 x=0;x<fConnectedFormat.display.line_width;x++)
-			*(p++) = ((((x+y)^0^x)+f) & 0xff) * (0x01010101 & fColor);
-	fProcessingLatency = system_time() - now;
-	free(buffer);
+
+	// Until FrameGenerator() times real frames
+	fProcessingLatency = (bigtime_t)fConnectedFormat.display.line_width
+		* fConnectedFormat.display.line_count
+		* CamConfig::kProcessingNsPerPixel / 1000;
 
 	/* Create the buffer group */
-	size_t bufferSize = 4 * fConnectedFormat.display.line_width *
-			fConnectedFormat.display.line_count;
-	fprintf(stderr, "Creating buffer group: size=%zu count=8\n", bufferSize);
-	fBufferGroup = new BBufferGroup(bufferSize, 8);
-	if (fBufferGroup->InitCheck() < B_OK) {
-	fprintf(stderr, "ERROR: BufferGroup InitCheck failed: %s\n",
-					strerror(fBufferGroup->InitCheck()));
-		delete fBufferGroup;
-		fBufferGroup = NULL;
+	if (_CreateBufferGroup() != B_OK) {
 	fprintf(stderr, "=== Connect END (buffer group failed) ===\n\n");
 		return;
 	}
-	fprintf(stderr, "BufferGroup created successfully\n");
 
 	fConnected = true;
 	fEnabled = true;
 
+	// Negotiated and streaming now if the node runs or the camera is to
+	// stay warm
+	if (fCamDevice != NULL) {
+		BAutolock lock(fCamDevice->Locker());
+		_UpdateTransfer();
+	}
+
 	syslog(LOG_INFO, "Producer: Connect SUCCESS! fConnected=true fEnabled=true bufferGroup=%p\n", fBufferGroup);
 	fprintf(stderr, "Connection established successfully!\n");
 	fprintf(stderr, "  fConnected: %s\n", fConnected ? "TRUE" : "FALSE");
@@ -875,6 +1378,16 @@ VideoProducer::Disconnect(const media_source &source,
 {
 	PRINTF(1, ("Disconnect()\n"));
 
+	if (scaled_output* scaled = _ScaledOutput(source)) {
+		if (scaled->connected && destination == scaled->output.destination)
+			_DisconnectScaled(*scaled);
+		if (fCamDevice != NULL) {
+			BAutolock lock(fCamDevice->Locker());
+			_UpdateTransfer();
+		}
+		return;
+	}
+
 	if (!fConnected) {
 		PRINTF(0, ("Disconnect: Not connected\n"));
 		return;
@@ -890,14 +1403,36 @@ VideoProducer::Disconnect(const media_source &source,
 	if (fRunning)
 		HandleStop();
 #endif
+	// ...and a warm standby ends with the connection
+	if (fCamDevice != NULL) {
+		BAutolock lock(fCamDevice->Locker());
+		if (fCamDevice->TransferEnabled())
+			fCamDevice->StopTransfer();
+	}
 
 	fEnabled = false;
 	fOutput.destination = media_destination::null;
 
-	fLock.Lock();
-		delete fBufferGroup;
-		fBufferGroup = NULL;
-	fLock.Unlock();
+	_ReleaseBufferGroup();
+
+	{
+		BAutolock _(fLock);
+		_SetFrameSkip(0);
+		fLatenessPad = 0;
+
+		// No decoder scales without fBufferGroup
+		for (int32 i = 0; i < kMaxScaledOutputs; i++)
+			fScaled[i].scaler.Unset();
+		fHasVisibleRegion = false;
+		_ApplyVisibleRegion();
+	}
+
+	/* Back to the default so the next connection can use MJPEG again */
+	if (fCamDevice)
+		fCamDevice->SetColorSpace(B_RGB32);
+	_UseRawOutput();
+	fOutput.format.u.raw_video.display.format = B_RGB32;
+	fEncoded = false;
 
 	fConnected = false;
 }
@@ -907,7 +1442,37 @@ void
 VideoProducer::LateNoticeReceived(const media_source &source,
 		bigtime_t how_much, bigtime_t performance_time)
 {
-	TOUCH(source); TOUCH(how_much); TOUCH(performance_time);
+	TOUCH(performance_time);
+
+	if (source != fOutput.source || how_much <= 0)
+		return;
+
+	// Offline there is no deadline to be late for
+	run_mode mode = RunMode();
+	if (mode == B_OFFLINE)
+		return;
+
+	BAutolock _(fLock);
+	bigtime_t now = system_time();
+	fLastLateNotice = now;
+
+	// Lateness is time our latency did not account for
+	if (fLatenessPad < CamConfig::kMaxLatenessPad) {
+		fLatenessPad += how_much;
+		if (fLatenessPad > CamConfig::kMaxLatenessPad)
+			fLatenessPad = CamConfig::kMaxLatenessPad;
+		_UpdateEventLatency();
+	}
+
+	// Recording wants every frame, and B_INCREASE_LATENCY trades latency
+	// rather than frames
+	if (mode != B_DROP_DATA && mode != B_DECREASE_PRECISION)
+		return;
+
+	bigtime_t frameDuration = _FrameDuration();
+	if (fFrameSkip < CamConfig::kMaxFrameSkip
+		&& now - fLastSkipChange >= kLateNoticeHoldoffFrames * frameDuration)
+		_SetFrameSkip(fFrameSkip + 1);
 }
 
 
@@ -917,10 +1482,19 @@ VideoProducer::EnableOutput(const media_source &source, bool enabled,
 {
 	TOUCH(_deprecated_);
 
-	if (source != fOutput.source)
+	if (scaled_output* scaled = _ScaledOutput(source)) {
+		BAutolock _(fLock);
+		scaled->enabled = enabled;
+	} else if (source == fOutput.source)
+		fEnabled = enabled;
+	else
 		return;
 
-	fEnabled = enabled;
+	// A disabled output costs no USB bandwidth
+	if (fCamDevice != NULL) {
+		BAutolock lock(fCamDevice->Locker());
+		_UpdateTransfer();
+	}
 }
 
 
@@ -947,7 +1521,22 @@ VideoProducer::LatencyChanged(const media_source &source,
 		const media_destination &destination, bigtime_t new_latency,
 		uint32 flags)
 {
-	TOUCH(source); TOUCH(destination); TOUCH(new_latency); TOUCH(flags);
+	TOUCH(flags);
+
+	// Read when the scaled output's group is next created
+	if (scaled_output* scaled = _ScaledOutput(source)) {
+		BAutolock _(fLock);
+		if (destination == scaled->output.destination)
+			scaled->downstreamLatency = new_latency;
+		return;
+	}
+
+	if (source != fOutput.source || destination != fOutput.destination)
+		return;
+
+	BAutolock _(fLock);
+	fDownstreamLatency = new_latency;
+	_UpdateEventLatency();
 }
 
 
@@ -1022,57 +1611,15 @@ VideoProducer::SetParameterValue(
 			if ((err < B_OK) && (fCamDevice->Sensor())) {
 				err = fCamDevice->Sensor()->SetParameterValue(id, when, value, size);
 			}
+			if (err >= B_OK)
+				_UpdateTransfer();
 
-			/* FIX BUG 10: Aggiorna fOutput.format quando cambia la risoluzione.
-			 * Senza questo fix, SetParameterValue aggiornava solo lo stato interno
-			 * del device (fVideoFrame) ma non fOutput.format del Producer.
-			 * Questo causava il fallimento di FormatProposal() perché
-			 * format_is_compatible() confrontava la nuova risoluzione richiesta
-			 * con la vecchia fOutput.format ancora impostata alla risoluzione iniziale.
-			 */
-			if (err >= B_OK) {
-				BRect frame = fCamDevice->VideoFrame();
-				uint32 newWidth = (uint32)(frame.Width() + 1);
-				uint32 newHeight = (uint32)(frame.Height() + 1);
-
-				/* Aggiorna solo se le dimensioni sono effettivamente cambiate */
-				if (fOutput.format.u.raw_video.display.line_width != newWidth ||
-				    fOutput.format.u.raw_video.display.line_count != newHeight) {
-
-					fOutput.format.u.raw_video.display.line_width = newWidth;
-					fOutput.format.u.raw_video.display.line_count = newHeight;
-					fConnectedFormat.display.line_width = newWidth;
-					fConnectedFormat.display.line_count = newHeight;
-
-					syslog(LOG_INFO, "Producer: fOutput.format updated to %ux%u\n",
-						newWidth, newHeight);
-
-					/* FIX: Recreate buffer group for new resolution.
-					 * The old buffer group has buffers sized for the old resolution.
-					 * We need new buffers sized for the new resolution.
-					 */
-					if (fConnected && fBufferGroup != NULL) {
-						size_t newBufferSize = 4 * newWidth * newHeight;
-						syslog(LOG_INFO, "Producer: Recreating buffer group for new size %zu bytes\n",
-							newBufferSize);
-
-						/* Delete old buffer group */
-						delete fBufferGroup;
-						fBufferGroup = NULL;
-
-						/* Create new buffer group with proper size */
-						fBufferGroup = new BBufferGroup(newBufferSize, 8);
-						if (fBufferGroup->InitCheck() < B_OK) {
-							syslog(LOG_ERR, "Producer: Failed to recreate buffer group: %s\n",
-								strerror(fBufferGroup->InitCheck()));
-							delete fBufferGroup;
-							fBufferGroup = NULL;
-						} else {
-							syslog(LOG_INFO, "Producer: Buffer group recreated successfully\n");
-						}
-					}
-				}
-			}
+			/* FIX BUG 10: a resolution parameter changes the device's
+			 * frame; fOutput.format has to follow or FormatProposal()
+			 * compares against the old size. While connected the
+			 * consumer is switched over too, see _SwitchFormat(). */
+			if (err >= B_OK)
+				_SwitchFormat();
 	}
 
 	if (err >= B_OK)
@@ -1113,6 +1660,16 @@ VideoProducer::HandleStart(bigtime_t performance_time)
 	// Use the passed performance_time which comes from the media kit
 	fPerformanceTimeBase = performance_time;
 	fStartRealTime = system_time();  // Track real time at start for proper offset calculation
+	fFirstFrameStart = fStartRealTime;
+
+	// A warm standby transfer runs already; what it queued while the node
+	// was stopped is stale
+	{
+		BAutolock lock(fCamDevice->Locker());
+		fWarmStart = fCamDevice->TransferEnabled();
+		if (fWarmStart)
+			fCamDevice->DiscardFrames();
+	}
 
 	fFrameSync = create_sem(0, "frame synchronization");
 	if (fFrameSync < B_OK) {
@@ -1125,13 +1682,16 @@ VideoProducer::HandleStart(bigtime_t performance_time)
 	// The thread checks fRunning in its loop condition
 	fRunning = true;
 
-	fThread = spawn_thread(_frame_generator_, "frame generator", B_NORMAL_PRIORITY, this);
+	CamThreadPolicy& policy = fCamDevice->ThreadPolicy();
+	fThread = spawn_thread(_frame_generator_, "frame generator",
+		policy.Priority(CAM_THREAD_VIDEO_PRODUCER), this);
 	if (fThread < B_OK) {
 		syslog(LOG_ERR, "Producer: HandleStart - spawn_thread failed: %d\n", fThread);
 		fRunning = false;
 		delete_sem(fFrameSync);
 		return;
 	}
+	policy.Apply(fThread, CAM_THREAD_VIDEO_PRODUCER);
 	syslog(LOG_INFO, "Producer: HandleStart - thread spawned: %d\n", fThread);
 
 	if (resume_thread(fThread) < B_OK) {
@@ -1143,9 +1703,41 @@ VideoProducer::HandleStart(bigtime_t performance_time)
 	}
 	syslog(LOG_INFO, "Producer: HandleStart - thread resumed\n");
 
+	// One decoder unless the device can fill several buffers at once
+	// (parallel MJPEG decode)
+	int32 decoders = fCamDevice->FillFrameBufferConcurrency();
+	if (decoders < 1)
+		decoders = 1;
+	if (decoders > kMaxDecodeThreads)
+		decoders = kMaxDecodeThreads;
+
+	fReorderCount = 0;
+	fHaveSequence = false;
+	fDecodeThreadCount = 0;
+	for (int32 i = 0; i < decoders; i++) {
+		thread_id thread = spawn_thread(_frame_decoder_, "frame decoder",
+			policy.Priority(CAM_THREAD_DECODER), this);
+		if (thread >= B_OK)
+			policy.Apply(thread, CAM_THREAD_DECODER);
+		if (thread >= B_OK && resume_thread(thread) < B_OK) {
+			kill_thread(thread);
+			thread = B_ERROR;
+		}
+		if (thread < B_OK) {
+			// Frames are still produced as long as one decoder runs
+			syslog(LOG_ERR, "Producer: HandleStart - decoder thread failed: %s\n",
+				strerror(thread));
+			break;
+		}
+		fDecodeThreads[fDecodeThreadCount++] = thread;
+	}
+	syslog(LOG_INFO, "Producer: HandleStart - %d decoder(s) spawned\n",
+		(int)fDecodeThreadCount);
+
+	// Unless no consumer takes frames yet
 	{
 		BAutolock lock(fCamDevice->Locker());
-		fCamDevice->StartTransfer();
+		_UpdateTransfer();
 	}
 	syslog(LOG_INFO, "Producer: HandleStart COMPLETE! fRunning=true\n");
 }
@@ -1182,11 +1774,31 @@ VideoProducer::HandleStop(void)
 		syslog(LOG_INFO, "Producer: HandleStop - thread exited cleanly\n");
 	}
 
+	// The decoders notice fRunning within one FillFrameBuffer() timeout
+	for (int32 i = 0; i < fDecodeThreadCount; i++) {
+		waitResult = wait_for_thread_etc(fDecodeThreads[i], B_RELATIVE_TIMEOUT,
+			5000000, &threadStatus);
+		if (waitResult == B_TIMED_OUT) {
+			syslog(LOG_WARNING, "Producer: HandleStop - decoder timeout, killing\n");
+			kill_thread(fDecodeThreads[i]);
+		}
+	}
+	fDecodeThreadCount = 0;
+	{
+		BAutolock lock(fLock);
+		_FlushDecodedBuffers();
+		fActiveFillers = 0;
+	}
+
+	// The transfer stops, unless it stays warm for the next start
 	if (fCamDevice) {
 		BAutolock lock(fCamDevice->Locker());
-		fCamDevice->StopTransfer();
+		_UpdateTransfer();
 	}
 
+	if (gWebcamDebugLevel >= WEBCAM_DEBUG_TRACE)
+		DumpWebcamTrace();
+
 	syslog(LOG_INFO, "Producer: HandleStop COMPLETE\n");
 }
 
@@ -1217,6 +1829,87 @@ VideoProducer::HandleSeek(bigtime_t performance_time)
 }
 
 
+/* Whether a consumer takes frames: fOutput's, or a scaled output's */
+bool
+VideoProducer::_WantsFrames()
+{
+	BAutolock _(fLock);
+	if (!fConnected)
+		return false;
+	if (fEnabled)
+		return true;
+	for (int32 i = 0; i < kMaxScaledOutputs; i++) {
+		if (fScaled[i].connected && fScaled[i].enabled)
+			return true;
+	}
+	return false;
+}
+
+
+/* Called with the device locked. While the node runs the transfer runs as
+ * long as a consumer takes frames; while it is stopped, only as the warm
+ * standby of a connected output. Otherwise the camera idles on its zero
+ * bandwidth alternate with no pump thread, which frees the bus for other
+ * cameras, until a connect or an enable restarts it. */
+void
+VideoProducer::_UpdateTransfer()
+{
+	if (fCamDevice == NULL)
+		return;
+
+	bool stream = fRunning ? _WantsFrames()
+		: fConnected && fCamDevice->WarmStandby();
+	if (stream) {
+		if (fCamDevice->TransferEnabled()
+			|| fCamDevice->StartTransfer() != B_OK)
+			return;
+		if (fRunning) {
+			// Timed like a cold start
+			fWarmStart = false;
+			fFirstFrameStart = system_time();
+			syslog(LOG_INFO, "Producer: Consumer back, camera streaming\n");
+		} else
+			syslog(LOG_INFO, "Producer: Warm standby, camera streaming\n");
+	} else if (fCamDevice->TransferEnabled()) {
+		fCamDevice->StopTransfer();
+		if (fRunning)
+			syslog(LOG_INFO, "Producer: No consumer, camera idle\n");
+	}
+}
+
+
+/* How long a frame lasts at the rate the camera committed to, which a
+ * bandwidth limit may have made slower than the negotiated field_rate */
+bigtime_t
+VideoProducer::_FrameDuration() const
+{
+	float fieldRate = fCamDevice != NULL ? fCamDevice->FrameRate() : 0.0f;
+	if (fieldRate <= 0.0f)
+		fieldRate = fConnectedFormat.field_rate;
+	return CamConfig::FPSToInterval(fieldRate);
+}
+
+
+size_t
+VideoProducer::_FrameBufferSize() const
+{
+	return _FrameBufferSize(fConnectedFormat);
+}
+
+
+size_t
+VideoProducer::_FrameBufferSize(const media_raw_video_format &format) const
+{
+	if (fEncoded) {
+		return encoded_frame_size(format.display.line_width,
+			format.display.line_count);
+	}
+	return (size_t)bytes_per_row(format.display.format,
+			format.display.line_width)
+		* format.display.line_count;
+}
+
+
 void
 VideoProducer::_UpdateStats()
 {
@@ -1227,6 +1920,8 @@ VideoProducer::_UpdateStats()
 	fInfoString = "FPS: ";
 	fInfoString << fps << " virt, "
 		<< rfps << " real, missed: " << fStats[0].missed;
+	if (fFrameSkip > 0)
+		fInfoString << ", shedding " << fFrameSkip << "/" << fFrameSkip + 1;
 	memcpy(&fStats[1], &fStats[0], sizeof(fStats[0]));
 	fLastColorChange = system_time();
 	BroadcastNewParameterValue(fLastColorChange, P_INFO,
@@ -1234,6 +1929,32 @@ VideoProducer::_UpdateStats()
 }
 
 
+/* Called with fLock held. */
+void
+VideoProducer::_UpdateEventLatency()
+{
+	SetEventLatency(fDownstreamLatency + NODE_LATENCY + fLatenessPad);
+}
+
+
+/* Called with fLock held. The device drops 'skip' frames for every one it
+ * fills, before they are converted or decoded. */
+void
+VideoProducer::_SetFrameSkip(int32 skip)
+{
+	if (skip == fFrameSkip)
+		return;
+
+	syslog(LOG_INFO, "Producer: %s load shedding, frame skip %d -> %d\n",
+		skip > fFrameSkip ? "consumer is late," : "consumer keeps up,",
+		(int)fFrameSkip, (int)skip);
+	fFrameSkip = skip;
+	fLastSkipChange = system_time();
+	if (fCamDevice)
+		fCamDevice->SetFrameSkip(skip);
+}
+
+
 /* The following functions form the thread that generates frames. You should
  * replace this with the code that interfaces to your hardware. */
 int32
@@ -1241,12 +1962,20 @@ VideoProducer::FrameGenerator()
 {
 	syslog(LOG_INFO, "Producer: FrameGenerator STARTED! connected=%d enabled=%d\n", fConnected, fEnabled);
 
-	bigtime_t wait_until = system_time();
 	int frameLog = 0;  // Log first 10 frames (reset each time thread starts)
 
 	while (fRunning) {
-		status_t err = acquire_sem_etc(fFrameSync, 1, B_ABSOLUTE_TIMEOUT,
-				wait_until);
+		/* Delivery is driven by frame arrival: FrameDecoder() releases
+		 * fFrameSync for every buffer it queues. The timeout is only a
+		 * watchdog for a stalled camera. Timing changes also release the
+		 * semaphore; with nothing queued we just go round again. */
+		bigtime_t frameDuration = _FrameDuration();
+		bigtime_t watchdog = kFrameWatchdogFrames * frameDuration;
+		if (fCamDevice->GetFrameTimingStats().frame_count
+				>= kWatchdogTimedFrames)
+			watchdog = fCamDevice->GetAdaptiveTimeout();
+		status_t err = acquire_sem_etc(fFrameSync, 1, B_RELATIVE_TIMEOUT,
+				watchdog);
 
 		// Handle semaphore errors gracefully
 		if (err == B_BAD_SEM_ID) {
@@ -1263,123 +1992,55 @@ VideoProducer::FrameGenerator()
 		if (err == B_INTERRUPTED) {
 			continue;  // Retry on signal
 		}
-		if ((err != B_OK) && (err != B_TIMED_OUT)) {
+		if (err == B_TIMED_OUT) {
+			if (fEnabled && frameLog < 10) {
+				syslog(LOG_WARNING, "Producer: Frame %u: watchdog, no frame for %lld us\n",
+					fFrame, watchdog);
+				frameLog++;
+			}
+			if (fEnabled) {
+				fStats[0].missed++;
+				fCamDevice->Metrics().Add(CAM_METRIC_WATCHDOG_TIMEOUTS);
+				_UpdateStats();
+			}
+			continue;
+		}
+		if (err != B_OK) {
 			syslog(LOG_WARNING, "Producer: FrameGenerator - sem error %d, continuing\n", err);
 			snooze(10000);
 			continue;  // Don't exit on transient errors
 		}
 
-		fFrame++;
-
 		BTimeSource* timeSource = TimeSource();
 		if (!timeSource) {
 			syslog(LOG_ERR, "Producer: FrameGenerator - NO TIME SOURCE! Frame %u, exiting\n", fFrame);
 			break;
 		}
 
-		bigtime_t frameDuration = (bigtime_t)(1000000 / fConnectedFormat.field_rate);
-		// For real camera: don't drop "late" frames - process all available frames
-		// The camera produces frames at its own rate, we should display them all
-		wait_until = system_time() + frameDuration;
+		BAutolock _(fLock);
 
-		// Only skip if semaphore was explicitly released (timing change signal)
-		if (err == B_OK) {
-			if (frameLog < 10) {
-				syslog(LOG_INFO, "Producer: Frame %u: sem acquired (timing change), skip\n", fFrame);
-				frameLog++;
-			}
+		decoded_frame frame;
+		if (!_DequeueDecodedBuffer(&frame))
 			continue;
-		}
 
-		if (!fRunning || !fEnabled) {
-			if (frameLog < 10) {
-				syslog(LOG_INFO, "Producer: Frame %u: not running/enabled (%d/%d)\n", fFrame, fRunning, fEnabled);
-				frameLog++;
-			}
+		if (!fRunning) {
+			_RecycleFrame(frame);
 			continue;
 		}
+		BBuffer *buffer = frame.buffer;
+		bigtime_t stamp = frame.stamp;
+		bigtime_t decoded = frame.decoded;
 
-		BAutolock _(fLock);
+		fFrame++;
 
-		if (!fBufferGroup) {
-			if (frameLog < 10) {
-				syslog(LOG_WARNING, "Producer: Frame %u: NO BUFFER GROUP!\n", fFrame);
-				frameLog++;
-			}
-			continue;
-		}
+		bigtime_t now = system_time();
+		media_header *h = buffer->Header();
+		h->time_source = timeSource->ID();
+		if (h->type == B_MEDIA_ENCODED_VIDEO)
+			h->u.encoded_video.field_sequence = fFrame;
+		else
+			h->u.raw_video.field_sequence = fFrame;
 
-		/* Fetch a buffer from the buffer group */
-		BBuffer *buffer = fBufferGroup->RequestBuffer(
-						4 * fConnectedFormat.display.line_width *
-						fConnectedFormat.display.line_count, 0LL);
-		if (!buffer) {
-			if (frameLog < 10) {
-				syslog(LOG_WARNING, "Producer: Frame %u: RequestBuffer failed\n", fFrame);
-				frameLog++;
-			}
-			continue;
-		}
-
-		/* Fill out the details about this buffer. */
-		media_header *h = buffer->Header();
-		h->type = B_MEDIA_RAW_VIDEO;
-		h->time_source = TimeSource()->ID();
-		h->size_used = 4 * fConnectedFormat.display.line_width *
-						fConnectedFormat.display.line_count;
-		/* For a buffer originating from a device, you might want to calculate
-		 * this based on the PerformanceTimeFor the time your buffer arrived at
-		 * the hardware (plus any applicable adjustments). */
-		/*
-		h->start_time = fPerformanceTimeBase +
-						(bigtime_t)
-							((fFrame - fFrameBase) *
-							(1000000 / fConnectedFormat.field_rate));
-		*/
-		h->file_pos = 0;
-		h->orig_size = 0;
-		h->data_offset = 0;
-		h->u.raw_video.field_gamma = 1.0;
-		h->u.raw_video.field_sequence = fFrame;
-		h->u.raw_video.field_number = 0;
-		h->u.raw_video.pulldown_number = 0;
-		h->u.raw_video.first_active_line = 1;
-		h->u.raw_video.line_count = fConnectedFormat.display.line_count;
-
-		// This is where we fill the video buffer.
-
-		//NO! must be called without lock!
-		//BAutolock lock(fCamDevice->Locker());
-
-		bigtime_t now = system_time();
-		bigtime_t stamp = 0;
-		if (fCamDevice) {
-			err = fCamDevice->FillFrameBuffer(buffer, &stamp);
-			if (err < B_OK) {
-				if (frameLog < 10) {
-					syslog(LOG_WARNING, "Producer: FillFrameBuffer FAILED #%d: %s\n", frameLog, strerror(err));
-					frameLog++;
-				}
-				fStats[0].missed++;
-				buffer->Recycle();
-				continue;
-			}
-			if (frameLog < 10) {
-				syslog(LOG_INFO, "Producer: FillFrameBuffer OK #%d\n", frameLog);
-				frameLog++;
-			}
-		} else {
-			buffer->Recycle();
-			continue;
-		}
-#ifdef UseGetFrameBitmap
-		BBitmap *bm;
-		err = fCamDevice->GetFrameBitmap(&bm, &stamp);
-		if (err >= B_OK) {
-			;//XXX handle error
-			fStats[0].missed++;
-		}
-#endif
 		fStats[0].frames = fFrame;
 		fStats[0].actual++;;
 		fStats[0].stamp = system_time();
@@ -1388,30 +2049,113 @@ VideoProducer::FrameGenerator()
 		// FIX: Use current performance time for live video
 		// CodyCam drops frames when start_time=0, interpreting it as "too late"
 		// Instead, calculate the proper performance time from the TimeSource
+		// The frame stamp is the capture time recovered from the device
+		// clock. Keep its spacing, shifted by a slowly tracked capture to
+		// send delay, so decode and queueing jitter stay out of start_time
+		// without stamping buffers in the past.
+		bigtime_t sendTime = system_time();
+		if (stamp > 0 && stamp <= sendTime) {
+			bigtime_t delay = sendTime - stamp;
+			if (delay > fCaptureLatency)
+				fCaptureLatency += (delay - fCaptureLatency + 3) / 4;
+			else
+				fCaptureLatency -= (fCaptureLatency - delay) / 64;
+			sendTime = stamp + fCaptureLatency;
+
+			// Grouped, the longest delay of the group, so frames of its
+			// cameras captured together are due together
+			CamTimebase* timebase = fCamDevice->Timebase();
+			if (timebase != NULL) {
+				int32 member = fCamDevice->TimebaseMember();
+				timebase->SetCaptureLatency(member, fCaptureLatency);
+				sendTime = stamp + timebase->CaptureLatency();
+
+				float fps = fCamDevice->FrameRate();
+				bigtime_t skew;
+				if (fps > 0 && timebase->AddFrame(member, stamp,
+						(bigtime_t)(1000000 / fps), &skew)) {
+					CamMetrics& metrics = fCamDevice->Metrics();
+					metrics.Set(CAM_METRIC_SYNC_SKEW, skew);
+					metrics.RecordLatency(CAM_LATENCY_SYNC_SKEW,
+						skew < 0 ? -skew : skew);
+				}
+			}
+		}
 		{
 			BTimeSource* ts = TimeSource();
 			if (ts != NULL) {
 				// Get current performance time - this tells the consumer
 				// "display this frame at this performance time"
-				h->start_time = ts->PerformanceTimeFor(system_time());
+				h->start_time = ts->PerformanceTimeFor(sendTime);
 			} else {
 				// Fallback: use fPerformanceTimeBase + elapsed time
 				bigtime_t elapsed = system_time() - fStartRealTime;
 				h->start_time = fPerformanceTimeBase + elapsed;
 			}
 		}
-		fProcessingLatency = system_time() - now;
-		fProcessingLatency /= 10;
+		// What a frame takes from complete to decoded, tail included
+		if ((fFrame % kLatencyUpdateFrames) == 0) {
+			bigtime_t decodeLatency = fCamDevice->Metrics()
+				.Latency(CAM_LATENCY_DECODE).Percentile(95);
+			if (decodeLatency > 0)
+				fProcessingLatency = decodeLatency;
+		}
+
+		// Step the shedding back down once late notices have stopped
+		if (fFrameSkip > 0
+			&& now - fLastLateNotice > CamConfig::kLateRecoveryInterval
+			&& now - fLastSkipChange > CamConfig::kLateRecoveryInterval)
+			_SetFrameSkip(fFrameSkip - 1);
+
+		// The scaled outputs get the same stamps
+		_SendScaledBuffers(frame, *h);
+
+		if (!fEnabled) {
+			buffer->Recycle();
+			_UpdateStats();
+			continue;
+		}
+
+		// Probing, the frame's times go with it; the header is the
+		// consumer's once sent
+		CamLatencyProbe& probe = fCamDevice->LatencyProbe();
+		bool probing = probe.IsEnabled();
+		if (probing) {
+			frame.times.sequence = fFrame;
+			frame.times.sent = system_time();
+			if (sizeof(frame.times) <= sizeof(h->user_data)) {
+				memcpy(h->user_data, &frame.times, sizeof(frame.times));
+				h->user_data_type = WEBCAM_PROBE_USER_DATA;
+			}
+		}
 
 		/* Send the buffer on down to the consumer */
 		status_t sendErr = SendBuffer(buffer, fOutput.source, fOutput.destination);
+		WEBCAM_TRACE_EVENT(WEBCAM_TRACE_SEND_BUFFER, sendErr, fFrame);
 		if (sendErr < B_OK) {
 			if (frameLog < 10) {
 				syslog(LOG_WARNING, "Producer: Frame %u: SendBuffer FAILED: %s\n", fFrame, strerror(sendErr));
 				frameLog++;
 			}
 			buffer->Recycle();
+			fCamDevice->Metrics().Add(CAM_METRIC_OUTPUT_DROPS);
 		} else {
+			bigtime_t sent = system_time();
+			CamMetrics& metrics = fCamDevice->Metrics();
+			metrics.RecordFrameSent(sent);
+			metrics.RecordLatency(CAM_LATENCY_DELIVERY, sent - decoded);
+			if (probing)
+				probe.Record(frame.times);
+			if (stamp > 0 && stamp <= sent)
+				metrics.RecordLatency(CAM_LATENCY_END_TO_END, sent - stamp);
+			if (fFirstFrameStart > 0) {
+				bigtime_t firstFrame = sent - fFirstFrameStart;
+				fFirstFrameStart = 0;
+				metrics.Set(CAM_METRIC_FIRST_FRAME_TIME, firstFrame);
+				metrics.RecordLatency(CAM_LATENCY_FIRST_FRAME, firstFrame);
+				syslog(LOG_INFO, "Producer: First frame %lld ms after a %s "
+					"start\n", firstFrame / 1000, fWarmStart ? "warm" : "cold");
+			}
 			if (frameLog < 10) {
 				syslog(LOG_INFO, "Producer: Frame %u: SendBuffer OK!\n", fFrame);
 				frameLog++;
@@ -1431,3 +2175,964 @@ VideoProducer::_frame_generator_(void *data)
 {
 	return ((VideoProducer *)data)->FrameGenerator();
 }
+
+
+/* Decode stage. Waits for the deframer, converts or decodes the frame into
+ * a buffer from our group and queues it for FrameGenerator(). This runs
+ * without fLock held, so colour conversion and MJPEG decode never block
+ * delivery. Several of these may run at once; fActiveFillers keeps the
+ * buffer group alive while any of them fills one of its buffers, and
+ * _FillDone() tells _DetachGroup() when the last one is done. */
+int32
+VideoProducer::FrameDecoder()
+{
+	syslog(LOG_INFO, "Producer: FrameDecoder STARTED\n");
+
+	int decodeLog = 0;
+
+	while (fRunning) {
+		if (!fCamDevice) {
+			snooze(10000);
+			continue;
+		}
+
+		/* The scaled outputs' groups are held like fBufferGroup, by
+		 * fActiveFillers, until the frame is queued */
+		BBufferGroup *group;
+		BBufferGroup *scaledGroups[kMaxScaledOutputs];
+		size_t size;
+		bool encoded;
+		bool switchFormat = false;
+		{
+			BAutolock _(fLock);
+			group = fBufferGroup;
+			size = _FrameBufferSize();
+			encoded = fEncoded;
+			bool wanted = fEnabled;
+			for (int32 i = 0; i < kMaxScaledOutputs; i++) {
+				scaled_output &scaled = fScaled[i];
+				scaledGroups[i] = scaled.enabled && scaled.scaler.IsSet()
+					? scaled.group : NULL;
+				if (scaledGroups[i] != NULL)
+					wanted = true;
+			}
+			// fOutput's buffer is decoded into even when only scaled
+			// outputs take the frame; none while a group is detached
+			if (!wanted || fParkDecoders)
+				group = NULL;
+			// No buffer takes a frame of a new size until _SwitchFormat()
+			// has run on the control thread
+			if (group != NULL && _FrameSizeChanged()) {
+				group = NULL;
+				switchFormat
+					= atomic_test_and_set(&fSwitchPending, 1, 0) == 0;
+			}
+			if (group)
+				atomic_add(&fActiveFillers, 1);
+		}
+		if (switchFormat && write_port_etc(ControlPort(), kMsgSwitchFormat,
+				NULL, 0, B_RELATIVE_TIMEOUT, 0) != B_OK)
+			atomic_set(&fSwitchPending, 0);
+		if (!group) {
+			snooze(10000);
+			continue;
+		}
+
+		/* All buffers may be downstream; give them a frame to come back */
+		BBuffer *buffer = group->RequestBuffer(size, 50000LL);
+		if (!buffer) {
+			if (decodeLog < 10) {
+				syslog(LOG_WARNING, "Producer: FrameDecoder - RequestBuffer failed\n");
+				decodeLog++;
+			}
+			_FillDone();
+			continue;
+		}
+
+		/* Fill out the details about this buffer. */
+		if (encoded) {
+			init_encoded_video_header(buffer->Header(),
+				fConnectedFormat.display.line_count);
+		} else {
+			init_video_header(buffer->Header(), size,
+				fConnectedFormat.display.line_count);
+		}
+
+		// This is where we fill the video buffer.
+
+		//NO! must be called without lock!
+		//BAutolock lock(fCamDevice->Locker());
+
+		bigtime_t stamp = 0;
+		uint32 sequence = kNoSequence;
+		cam_frame_times times;
+		memset(&times, 0, sizeof(times));
+		bigtime_t decodeStart = system_time();
+		status_t err = fCamDevice->FillFrameBuffer(buffer, &stamp, &sequence,
+			&times);
+		bigtime_t decoded = system_time();
+		bigtime_t decodeTime = decoded - decodeStart;
+		WEBCAM_TRACE_EVENT(WEBCAM_TRACE_DECODE_END, err, sequence);
+		CamMetrics& metrics = fCamDevice->Metrics();
+		if (err < B_OK)
+			metrics.Add(CAM_METRIC_DECODE_DROPS);
+		else {
+			metrics.Add(CAM_METRIC_FRAMES_DECODED);
+			metrics.Add(CAM_METRIC_DECODE_TIME, decodeTime);
+			metrics.RecordMax(CAM_METRIC_DECODE_TIME_MAX, decodeTime);
+		}
+		if (err < B_OK) {
+			if (decodeLog < 10) {
+				syslog(LOG_WARNING, "Producer: FillFrameBuffer FAILED #%d: %s\n",
+					decodeLog, strerror(err));
+				decodeLog++;
+			}
+			fStats[0].missed++;
+			buffer->Recycle();
+			buffer = NULL;
+		} else if (decodeLog < 10) {
+			syslog(LOG_INFO, "Producer: FillFrameBuffer OK #%d\n", decodeLog);
+			decodeLog++;
+		}
+#ifdef UseGetFrameBitmap
+		BBitmap *bm;
+		err = fCamDevice->GetFrameBitmap(&bm, &stamp);
+		if (err >= B_OK) {
+			;//XXX handle error
+			fStats[0].missed++;
+		}
+#endif
+
+		decoded_frame frame;
+		frame.buffer = buffer;
+		frame.stamp = stamp;
+		frame.sequence = sequence;
+		frame.decoded = decoded;
+		frame.times = times;
+		frame.times.capture = stamp;
+		frame.times.decode_start = decodeStart;
+		frame.times.decoded = decoded;
+		for (int32 i = 0; i < kMaxScaledOutputs; i++)
+			frame.scaled[i] = NULL;
+		if (buffer != NULL)
+			_FillScaledBuffers(buffer, scaledGroups, frame.scaled);
+
+		BAutolock _(fLock);
+		if (buffer != NULL && group != fBufferGroup) {
+			// The group is being replaced, don't queue its buffers
+			_RecycleFrame(frame);
+			frame.buffer = NULL;
+			for (int32 i = 0; i < kMaxScaledOutputs; i++)
+				frame.scaled[i] = NULL;
+		}
+		if (frame.buffer != NULL)
+			fCamDevice->RecordFrameTiming(decodeTime);
+		// A failed fill still used up its frame's place in the order
+		if (frame.buffer != NULL || sequence != kNoSequence)
+			_QueueDecodedBuffer(frame);
+		_FillDone();
+	}
+
+	syslog(LOG_INFO, "Producer: FrameDecoder exited\n");
+	return B_OK;
+}
+
+
+int32
+VideoProducer::_frame_decoder_(void *data)
+{
+	return ((VideoProducer *)data)->FrameDecoder();
+}
+
+
+/* Called with fLock held. Decoders finish out of order, so buffers wait
+ * here until every earlier frame is in. A gap is given up on once each
+ * decoder has a frame waiting behind it; frames older than the last one
+ * sent are dropped. */
+void
+VideoProducer::_QueueDecodedBuffer(const decoded_frame &frame)
+{
+	if (frame.sequence == kNoSequence) {
+		// Device does not number its frames, keep arrival order
+		_PushDecodedBuffer(frame);
+		return;
+	}
+
+	if (!fHaveSequence) {
+		fNextSequence = frame.sequence;
+		fHaveSequence = true;
+	}
+	if ((int32)(frame.sequence - fNextSequence) < 0) {
+		if (frame.buffer != NULL) {
+			_RecycleFrame(frame);
+			fStats[0].missed++;
+			fCamDevice->Metrics().Add(CAM_METRIC_OUTPUT_DROPS);
+		}
+		return;
+	}
+
+	fReorder[fReorderCount++] = frame;
+
+	while (fReorderCount > 0) {
+		int32 next = -1;
+		int32 oldest = 0;
+		for (int32 i = 0; i < fReorderCount; i++) {
+			if (fReorder[i].sequence == fNextSequence)
+				next = i;
+			if ((int32)(fReorder[i].sequence - fReorder[oldest].sequence) < 0)
+				oldest = i;
+		}
+		if (next < 0) {
+			if (fReorderCount < fDecodeThreadCount)
+				break;
+			next = oldest;
+		}
+
+		if (fReorder[next].buffer != NULL)
+			_PushDecodedBuffer(fReorder[next]);
+		fNextSequence = fReorder[next].sequence + 1;
+		fReorder[next] = fReorder[--fReorderCount];
+	}
+}
+
+
+/* Called with fLock held. If FrameGenerator fell behind, the oldest frame
+ * is dropped so that we always deliver the most recent one. */
+void
+VideoProducer::_PushDecodedBuffer(const decoded_frame &frame)
+{
+	if (frame.buffer == NULL)
+		return;
+
+	if (fDecodedCount == kDecodedQueueDepth) {
+		_RecycleFrame(fDecoded[fDecodedHead]);
+		fDecodedHead = (fDecodedHead + 1) % kDecodedQueueDepth;
+		fDecodedCount--;
+		fStats[0].missed++;
+		fCamDevice->Metrics().Add(CAM_METRIC_OUTPUT_DROPS);
+	} else
+		release_sem(fFrameSync);
+
+	int32 tail = (fDecodedHead + fDecodedCount) % kDecodedQueueDepth;
+	fDecoded[tail] = frame;
+	fDecodedCount++;
+	fCamDevice->Metrics().Set(CAM_METRIC_OUTPUT_QUEUE_DEPTH, fDecodedCount);
+}
+
+
+/* Called with fLock held. */
+bool
+VideoProducer::_DequeueDecodedBuffer(decoded_frame *frame)
+{
+	if (fDecodedCount == 0)
+		return false;
+
+	*frame = fDecoded[fDecodedHead];
+	fDecodedHead = (fDecodedHead + 1) % kDecodedQueueDepth;
+	fDecodedCount--;
+	if (fCamDevice != NULL)
+		fCamDevice->Metrics().Set(CAM_METRIC_OUTPUT_QUEUE_DEPTH, fDecodedCount);
+	return true;
+}
+
+
+/* Called with fLock held. Returns queued buffers to their group, e.g.
+ * before it is deleted. */
+void
+VideoProducer::_FlushDecodedBuffers()
+{
+	decoded_frame frame;
+	while (_DequeueDecodedBuffer(&frame))
+		_RecycleFrame(frame);
+
+	for (int32 i = 0; i < fReorderCount; i++)
+		_RecycleFrame(fReorder[i]);
+	fReorderCount = 0;
+	fHaveSequence = false;
+
+	if (fFrameSync >= 0) {
+		while (acquire_sem_etc(fFrameSync, 1, B_RELATIVE_TIMEOUT, 0) == B_OK)
+			;
+	}
+	fDecodedHead = 0;
+}
+
+
+/* A frame's buffers back to their groups, scaled ones included */
+void
+VideoProducer::_RecycleFrame(const decoded_frame &frame)
+{
+	if (frame.buffer != NULL)
+		frame.buffer->Recycle();
+	for (int32 i = 0; i < kMaxScaledOutputs; i++) {
+		if (frame.scaled[i] != NULL)
+			frame.scaled[i]->Recycle();
+	}
+}
+
+
+/* Takes fBufferGroup away from the decoders and waits until none of them
+ * is still filling one of its buffers. The returned group is the caller's
+ * to dispose of, see _ReleaseBufferGroup(). */
+BBufferGroup *
+VideoProducer::_DetachBufferGroup()
+{
+	return _DetachGroup(&fBufferGroup);
+}
+
+
+/* Sets *group, fBufferGroup or a scaled output's, to NULL under fLock and
+ * waits for the decoders that may still fill a buffer of it. Queued frames
+ * go back to their groups, whichever output they are for. Must not be
+ * called with fLock held: the decoders take it to finish. */
+BBufferGroup *
+VideoProducer::_DetachGroup(BBufferGroup **_group)
+{
+	BBufferGroup *group;
+	{
+		BAutolock _(fLock);
+		group = *_group;
+		*_group = NULL;
+		_FlushDecodedBuffers();
+		// fActiveFillers counts the fills of every group; with no new ones
+		// it gets to 0 even while other outputs stream
+		fParkDecoders = true;
+	}
+	// Left from fills that ended while nothing waited
+	int32 stale;
+	if (get_sem_count(fFillersIdle, &stale) == B_OK && stale > 0)
+		acquire_sem_etc(fFillersIdle, stale, B_RELATIVE_TIMEOUT, 0);
+
+	// A fill is bounded by the device's frame timeout (2s for UVC), but
+	// the group may only go once the last one is done, however long
+	bigtime_t warnAt = system_time() + 3000000;
+	while (atomic_get(&fActiveFillers) > 0) {
+		status_t status = acquire_sem_etc(fFillersIdle, 1, B_RELATIVE_TIMEOUT,
+			100000);
+		if (status != B_OK && status != B_TIMED_OUT
+			&& status != B_INTERRUPTED)
+			snooze(1000);
+		if (warnAt != 0 && system_time() >= warnAt) {
+			syslog(LOG_WARNING, "Producer: %d decoder(s) still filling, "
+				"waiting for them\n", (int)atomic_get(&fActiveFillers));
+			warnAt = 0;
+		}
+	}
+
+	BAutolock _(fLock);
+	_FlushDecodedBuffers();
+	fParkDecoders = false;
+	return group;
+}
+
+
+/* A decoder is done with the groups it held. */
+void
+VideoProducer::_FillDone()
+{
+	if (atomic_add(&fActiveFillers, -1) == 1)
+		release_sem_etc(fFillersIdle, 1, B_DO_NOT_RESCHEDULE);
+}
+
+
+/* Detaches the group, and deletes it if it is ours: a consumer's group
+ * stays the consumer's. */
+void
+VideoProducer::_ReleaseBufferGroup()
+{
+	BBufferGroup *group = _DetachBufferGroup();
+	if (fOwnBufferGroup)
+		delete group;
+	fOwnBufferGroup = true;
+}
+
+
+/* Buffers in circulation at once: one per decoder filling, the decoded
+ * queue, what the consumer holds to cover its latency, and the one it is
+ * showing. More only adds queueing. */
+int32
+VideoProducer::_BufferCount(bigtime_t downstreamLatency) const
+{
+	int32 decoders = fCamDevice != NULL
+		? fCamDevice->FillFrameBufferConcurrency() : 1;
+	if (decoders < 1)
+		decoders = 1;
+	if (decoders > kMaxDecodeThreads)
+		decoders = kMaxDecodeThreads;
+
+	bigtime_t frameDuration = _FrameDuration();
+	int32 downstream = (int32)((downstreamLatency + frameDuration - 1)
+		/ frameDuration);
+
+	int32 count = decoders + kDecodedQueueDepth + downstream + 1;
+	if (count < CamConfig::kMinOutputBuffers)
+		count = CamConfig::kMinOutputBuffers;
+	if (count > CamConfig::kMaxOutputBuffers)
+		count = CamConfig::kMaxOutputBuffers;
+	return count;
+}
+
+
+/* Our own group, sized to _BufferCount(). The buffers are allocated once,
+ * in locked areas the Media Kit clones into the consumer, so a frame never
+ * pages in on the way. */
+status_t
+VideoProducer::_CreateBufferGroup()
+{
+	BBufferGroup *group;
+	status_t err = _NewBufferGroup(_FrameBufferSize(), &group);
+	if (err != B_OK)
+		return err;
+
+	BAutolock _(fLock);
+	fBufferGroup = group;
+	fOwnBufferGroup = true;
+	return B_OK;
+}
+
+
+/* A group for frames of size bytes, not yet handed to the decoders */
+status_t
+VideoProducer::_NewBufferGroup(size_t size, BBufferGroup **_group)
+{
+	int32 count = _BufferCount(fDownstreamLatency);
+	BBufferGroup *group = new(std::nothrow) BBufferGroup(size, count,
+		B_ANY_ADDRESS, B_FULL_LOCK);
+	status_t err = group != NULL ? group->InitCheck() : B_NO_MEMORY;
+	if (err != B_OK) {
+		syslog(LOG_ERR, "Producer: cannot create %d buffers of %zu bytes: "
+			"%s\n", (int)count, size, strerror(err));
+		delete group;
+		return err;
+	}
+
+	syslog(LOG_INFO, "Producer: %d buffers of %zu bytes (downstream "
+		"latency %lld us)\n", (int)count, size, (long long)fDownstreamLatency);
+	*_group = group;
+	return B_OK;
+}
+
+
+/* MJPEG encoded video of width x height, as the camera sends it; each
+ * frame stands alone */
+status_t
+VideoProducer::_EncodedFormat(uint32 width, uint32 height, float fieldRate,
+	media_format *format)
+{
+	if (fCamDevice == NULL || !fCamDevice->SupportsMJPEGPassthrough())
+		return B_MEDIA_BAD_FORMAT;
+
+	media_format mjpeg;
+	status_t err = get_mjpeg_format(&mjpeg);
+	if (err != B_OK) {
+		syslog(LOG_WARNING, "Producer: no codec knows MJPEG, no encoded "
+			"output: %s\n", strerror(err));
+		return B_MEDIA_BAD_FORMAT;
+	}
+
+	media_encoded_video_format &encoded = mjpeg.u.encoded_video;
+	encoded.output = fOutput.format.u.raw_video;
+	encoded.output.display.format = B_NO_COLOR_SPACE;
+	encoded.output.display.line_width = width;
+	encoded.output.display.line_count = height;
+	encoded.output.display.bytes_per_row = 0;
+	encoded.output.field_rate = fieldRate > 0.0f ? fieldRate : FIELD_RATE;
+	encoded.frame_size = encoded_frame_size(width, height);
+	encoded.max_bit_rate = encoded.frame_size * 8.0f
+		* encoded.output.field_rate;
+	encoded.forward_history = 0;
+	encoded.backward_history = 0;
+	*format = mjpeg;
+	return B_OK;
+}
+
+
+/* fOutput as MJPEG passed on from the camera: the device copies its frames
+ * rather than decode them. Only the sizes of the MJPEG modes are taken. */
+status_t
+VideoProducer::_NegotiateEncodedFormat(media_format *format)
+{
+	media_format mjpeg;
+	status_t err = _EncodedFormat(0, 0, 0.0f, &mjpeg);
+	if (err != B_OK)
+		return err;
+	uint32 encoding = format->u.encoded_video.encoding;
+	if (encoding != 0 && encoding != mjpeg.u.encoded_video.encoding)
+		return B_MEDIA_BAD_FORMAT;
+
+	uint32 width = format->u.encoded_video.output.display.line_width;
+	uint32 height = format->u.encoded_video.output.display.line_count;
+	float fieldRate = format->u.encoded_video.output.field_rate;
+	fCamDevice->SetMJPEGPassthrough(true);
+	err = fCamDevice->AcceptVideoFrame(width, height);
+	if (err >= B_OK)
+		err = fCamDevice->AcceptFrameRate(fieldRate);
+	if (err < B_OK) {
+		fCamDevice->SetMJPEGPassthrough(false);
+		return err;
+	}
+
+	_EncodedFormat(width, height, fieldRate, format);
+	fOutput.format = *format;
+	return B_OK;
+}
+
+
+/* fOutput back to raw video, after an encoded proposal or connection */
+void
+VideoProducer::_UseRawOutput()
+{
+	if (fCamDevice != NULL)
+		fCamDevice->SetMJPEGPassthrough(false);
+	if (fOutput.format.type == B_MEDIA_RAW_VIDEO)
+		return;
+
+	// The frame size stays, raw video's format lies where encoded output is
+	media_video_display_info &display = fOutput.format.u.raw_video.display;
+	fOutput.format.type = B_MEDIA_RAW_VIDEO;
+	display.format = B_RGB32;
+	display.bytes_per_row = bytes_per_row(B_RGB32, display.line_width);
+}
+
+
+/* True once the device's frame is no longer the size fOutput is at */
+bool
+VideoProducer::_FrameSizeChanged() const
+{
+	BRect frame = fCamDevice->VideoFrame();
+	return (uint32)frame.IntegerWidth() + 1
+			!= fConnectedFormat.display.line_width
+		|| (uint32)frame.IntegerHeight() + 1
+			!= fConnectedFormat.display.line_count;
+}
+
+
+/* Follows the device to a new frame size, from the resolution parameter or
+ * a bandwidth fallback, without stopping. The new group is allocated next
+ * to the old one; the old one is then detached between two frames, so
+ * nothing decoded at the old size is sent once the consumer has the new
+ * format, and the new one takes over. A consumer that keeps its format has
+ * the device put back to it. Runs on the control thread. */
+void
+VideoProducer::_SwitchFormat()
+{
+	if (fCamDevice == NULL)
+		return;
+
+	BRect frame = fCamDevice->VideoFrame();
+	uint32 width = frame.IntegerWidth() + 1;
+	uint32 height = frame.IntegerHeight() + 1;
+	uint32 oldWidth = fConnectedFormat.display.line_width;
+	uint32 oldHeight = fConnectedFormat.display.line_count;
+	if (width == oldWidth && height == oldHeight) {
+		atomic_set(&fSwitchPending, 0);
+		return;
+	}
+
+	media_format format = fOutput.format;
+	media_raw_video_format *video = &format.u.raw_video;
+	if (fEncoded) {
+		if (_EncodedFormat(width, height, fConnectedFormat.field_rate,
+				&format) != B_OK) {
+			_RestoreVideoFrame(oldWidth, oldHeight);
+			return;
+		}
+		video = &format.u.encoded_video.output;
+	} else {
+		video->display.line_width = width;
+		video->display.line_count = height;
+		video->display.bytes_per_row = bytes_per_row(video->display.format,
+			width);
+	}
+
+	if (!fConnected) {
+		BAutolock _(fLock);
+		fOutput.format = format;
+		fConnectedFormat.display.line_width = width;
+		fConnectedFormat.display.line_count = height;
+		fConnectedFormat.display.bytes_per_row
+			= video->display.bytes_per_row;
+		atomic_set(&fSwitchPending, 0);
+		syslog(LOG_INFO, "Producer: fOutput.format updated to %ux%u\n",
+			width, height);
+		return;
+	}
+
+	bigtime_t start = system_time();
+	BBufferGroup *group;
+	if (_NewBufferGroup(_FrameBufferSize(*video), &group) != B_OK) {
+		_RestoreVideoFrame(oldWidth, oldHeight);
+		return;
+	}
+
+	bool ownGroup = fOwnBufferGroup;
+	BBufferGroup *oldGroup = _DetachBufferGroup();
+
+	status_t err = ChangeFormat(fOutput.source, fOutput.destination,
+		&format);
+	if (err != B_OK) {
+		syslog(LOG_WARNING, "Producer: the consumer keeps %ux%u (%s), the "
+			"camera goes back to it\n", oldWidth, oldHeight, strerror(err));
+		delete group;
+		{
+			BAutolock _(fLock);
+			fBufferGroup = oldGroup;
+		}
+		_RestoreVideoFrame(oldWidth, oldHeight);
+		return;
+	}
+
+	{
+		BAutolock _(fLock);
+		fOutput.format = format;
+		fConnectedFormat = *video;
+		fBufferGroup = group;
+		fOwnBufferGroup = true;
+		_SetUpScalers();
+	}
+	// A consumer's group was for the old size; it can hand in another
+	if (ownGroup)
+		delete oldGroup;
+	atomic_set(&fSwitchPending, 0);
+
+	syslog(LOG_INFO, "Producer: switched from %ux%u to %ux%u in %lld us\n",
+		oldWidth, oldHeight, width, height,
+		(long long)(system_time() - start));
+}
+
+
+/* Puts the device back to the size fOutput is at. If it cannot go back
+ * the decoders stay idle rather than ask for the switch again. */
+void
+VideoProducer::_RestoreVideoFrame(uint32 width, uint32 height)
+{
+	BAutolock lock(fCamDevice->Locker());
+	bool streaming = fCamDevice->TransferEnabled();
+	if (streaming)
+		fCamDevice->StopTransfer();
+	status_t err = fCamDevice->AcceptVideoFrame(width, height);
+	if (streaming)
+		fCamDevice->StartTransfer();
+	if (err != B_OK) {
+		syslog(LOG_ERR, "Producer: cannot put the camera back to %ux%u: "
+			"%s\n", width, height, strerror(err));
+		return;
+	}
+	atomic_set(&fSwitchPending, 0);
+}
+
+
+/* Called with fLock held. fOutput's visible region is only decoded alone
+ * while no scaled output needs the rest of the frame. */
+void
+VideoProducer::_ApplyVisibleRegion()
+{
+	if (fCamDevice == NULL)
+		return;
+	fCamDevice->SetVisibleRegion(fHasVisibleRegion && fScaledConnected == 0
+		? &fVisibleRegion : NULL);
+}
+
+
+/* Scaled outputs */
+
+
+VideoProducer::scaled_output *
+VideoProducer::_ScaledOutput(const media_source &source)
+{
+	if (source.port != ControlPort() || source.id < 1
+		|| source.id > kMaxScaledOutputs)
+		return NULL;
+	return &fScaled[source.id - 1];
+}
+
+
+/* Called with fLock held. The frame is scaled from fOutput's, so its color
+ * space decides: an RGB one gives any of B_RGB32, B_RGB24 and B_RGB16,
+ * B_YCbCr422 only itself. A wildcard size is half of fOutput's. On
+ * B_MEDIA_BAD_FORMAT, 'format' is what would be taken instead. */
+status_t
+VideoProducer::_NegotiateScaledFormat(scaled_output &scaled,
+	media_format *format)
+{
+	const media_raw_video_format &source = fConnected
+		? fConnectedFormat : fOutput.format.u.raw_video;
+	color_space sourceSpace = source.display.format;
+	int32 sourceWidth = source.display.line_width;
+	int32 sourceHeight = source.display.line_count;
+
+	status_t err = B_OK;
+	if (format->type != B_MEDIA_RAW_VIDEO
+		&& format->type != B_MEDIA_UNKNOWN_TYPE)
+		err = B_MEDIA_BAD_FORMAT;
+
+	color_space space = format->u.raw_video.display.format;
+	if (space == 0)
+		space = sourceSpace == B_YCbCr422 ? B_YCbCr422 : B_RGB32;
+	int32 width = format->u.raw_video.display.line_width;
+	int32 height = format->u.raw_video.display.line_count;
+	if (width <= 0 || height <= 0) {
+		width = (sourceWidth / 2) & ~1;
+		height = sourceHeight / 2;
+	}
+
+	CamFrameScaler probe;
+	if (probe.SetFormat(sourceSpace, sourceWidth, sourceHeight, space,
+			width, height) != B_OK) {
+		syslog(LOG_WARNING, "Producer: %s: cannot scale %dx%d %s to %dx%d "
+			"%s\n", scaled.output.name, (int)sourceWidth, (int)sourceHeight,
+			color_space_name(sourceSpace), (int)width, (int)height,
+			color_space_name(space));
+		err = B_MEDIA_BAD_FORMAT;
+		space = sourceSpace == B_YCbCr422 ? B_YCbCr422 : B_RGB32;
+		width = (sourceWidth / 2) & ~1;
+		height = sourceHeight / 2;
+	}
+
+	*format = scaled.output.format;
+	format->u.raw_video.display.format = space;
+	format->u.raw_video.display.line_width = width;
+	format->u.raw_video.display.line_count = height;
+	format->u.raw_video.display.bytes_per_row = bytes_per_row(space, width);
+	format->u.raw_video.field_rate = source.field_rate > 0.0f
+		? source.field_rate : FIELD_RATE;
+	return err;
+}
+
+
+/* Called with fLock held, while no decoder can scale for 'scaled': before
+ * its group exists, or while fBufferGroup is NULL. Scales from
+ * fConnectedFormat; without a scaler, as with encoded MJPEG, the output
+ * gets no frames. */
+void
+VideoProducer::_SetUpScaler(scaled_output &scaled)
+{
+	if (!scaled.connected || fEncoded) {
+		scaled.scaler.Unset();
+		return;
+	}
+
+	const media_video_display_info &display = scaled.format.display;
+	status_t err = scaled.scaler.SetFormat(fConnectedFormat.display.format,
+		fConnectedFormat.display.line_width,
+		fConnectedFormat.display.line_count, display.format,
+		display.line_width, display.line_count);
+	if (err != B_OK) {
+		syslog(LOG_WARNING, "Producer: %s: cannot scale %ux%u %s to %ux%u "
+			"%s, the output gets no frames: %s\n", scaled.output.name,
+			fConnectedFormat.display.line_width,
+			fConnectedFormat.display.line_count,
+			color_space_name(fConnectedFormat.display.format),
+			display.line_width, display.line_count,
+			color_space_name(display.format), strerror(err));
+	}
+}
+
+
+/* Called with fLock held, see _SetUpScaler() */
+void
+VideoProducer::_SetUpScalers()
+{
+	for (int32 i = 0; i < kMaxScaledOutputs; i++)
+		_SetUpScaler(fScaled[i]);
+}
+
+
+status_t
+VideoProducer::_CreateScaledGroup(scaled_output &scaled)
+{
+	size_t size = (size_t)scaled.format.display.bytes_per_row
+		* scaled.format.display.line_count;
+	int32 count = _BufferCount(scaled.downstreamLatency);
+	BBufferGroup *group = new(std::nothrow) BBufferGroup(size, count,
+		B_ANY_ADDRESS, B_FULL_LOCK);
+	status_t err = group != NULL ? group->InitCheck() : B_NO_MEMORY;
+	if (err != B_OK) {
+		syslog(LOG_ERR, "Producer: %s: cannot create %d buffers of %zu "
+			"bytes: %s\n", scaled.output.name, (int)count, size,
+			strerror(err));
+		delete group;
+		return err;
+	}
+
+	BAutolock _(fLock);
+	scaled.group = group;
+	scaled.ownGroup = true;
+	return B_OK;
+}
+
+
+void
+VideoProducer::_ReleaseScaledGroup(scaled_output &scaled)
+{
+	BBufferGroup *group = _DetachGroup(&scaled.group);
+	if (scaled.ownGroup)
+		delete group;
+	scaled.ownGroup = true;
+}
+
+
+/* Runs on a decoder thread, without fLock, while fActiveFillers holds
+ * 'groups'. Scales the filled 'source' into a buffer of each of them; an
+ * output whose buffers are all downstream skips the frame rather than
+ * hold up fOutput's. */
+void
+VideoProducer::_FillScaledBuffers(BBuffer *source, BBufferGroup **groups,
+	BBuffer **scaled)
+{
+	size_t sourceBytesPerRow = bytes_per_row(fConnectedFormat.display.format,
+		fConnectedFormat.display.line_width);
+
+	for (int32 i = 0; i < kMaxScaledOutputs; i++) {
+		scaled[i] = NULL;
+		if (groups[i] == NULL)
+			continue;
+
+		const media_video_display_info &display = fScaled[i].format.display;
+		size_t size = (size_t)display.bytes_per_row * display.line_count;
+		BBuffer *buffer = groups[i]->RequestBuffer(size, 0);
+		if (buffer == NULL) {
+			fCamDevice->Metrics().Add(CAM_METRIC_OUTPUT_DROPS);
+			continue;
+		}
+
+		status_t err = fScaled[i].scaler.Scale((const uint8 *)source->Data(),
+			source->Header()->size_used, sourceBytesPerRow,
+			(uint8 *)buffer->Data(), display.bytes_per_row);
+		if (err != B_OK) {
+			buffer->Recycle();
+			fCamDevice->Metrics().Add(CAM_METRIC_OUTPUT_DROPS);
+			continue;
+		}
+		init_video_header(buffer->Header(), size, display.line_count);
+		scaled[i] = buffer;
+	}
+}
+
+
+/* Called with fLock held, from FrameGenerator(): sends the scaled buffers
+ * of 'frame' with the times of fOutput's 'header'. */
+void
+VideoProducer::_SendScaledBuffers(const decoded_frame &frame,
+	const media_header &header)
+{
+	for (int32 i = 0; i < kMaxScaledOutputs; i++) {
+		BBuffer *buffer = frame.scaled[i];
+		if (buffer == NULL)
+			continue;
+
+		scaled_output &scaled = fScaled[i];
+		if (!scaled.connected || !scaled.enabled) {
+			buffer->Recycle();
+			continue;
+		}
+
+		media_header *h = buffer->Header();
+		h->time_source = header.time_source;
+		h->start_time = header.start_time;
+		h->u.raw_video.field_sequence = header.u.raw_video.field_sequence;
+		if (SendBuffer(buffer, scaled.output.source,
+				scaled.output.destination) < B_OK) {
+			buffer->Recycle();
+			fCamDevice->Metrics().Add(CAM_METRIC_OUTPUT_DROPS);
+		}
+	}
+}
+
+
+void
+VideoProducer::_ConnectScaled(scaled_output &scaled, status_t error,
+	const media_destination &destination, const media_format &format,
+	char *io_name)
+{
+	if (error < B_OK || scaled.connected
+		|| destination != scaled.output.destination) {
+		BAutolock _(fLock);
+		if (!scaled.connected)
+			scaled.output.destination = media_destination::null;
+		return;
+	}
+
+	// As for fOutput, the Media Kit may pass a zeroed format here
+	if (format.u.raw_video.display.line_width != 0
+		&& format.u.raw_video.display.line_count != 0)
+		scaled.output.format = format;
+	strlcpy(io_name, scaled.output.name, B_MEDIA_NAME_LENGTH);
+
+	bigtime_t latency = 0;
+	media_node_id tsID = 0;
+	FindLatencyFor(destination, &latency, &tsID);
+	{
+		BAutolock _(fLock);
+		scaled.format = scaled.output.format.u.raw_video;
+		if (scaled.format.display.bytes_per_row == 0) {
+			scaled.format.display.bytes_per_row = bytes_per_row(
+				scaled.format.display.format,
+				scaled.format.display.line_width);
+		}
+		scaled.downstreamLatency = latency;
+		scaled.connected = true;
+		// Otherwise set up once fOutput connects
+		if (fConnected)
+			_SetUpScaler(scaled);
+	}
+
+	if (_CreateScaledGroup(scaled) != B_OK) {
+		BAutolock _(fLock);
+		scaled.scaler.Unset();
+		scaled.connected = false;
+		scaled.output.destination = media_destination::null;
+		return;
+	}
+
+	BAutolock _(fLock);
+	scaled.enabled = true;
+	fScaledConnected++;
+	// The whole frame is decoded from now on
+	_ApplyVisibleRegion();
+	syslog(LOG_INFO, "Producer: %s connected, %ux%u %s\n", scaled.output.name,
+		scaled.format.display.line_width, scaled.format.display.line_count,
+		color_space_name(scaled.format.display.format));
+}
+
+
+void
+VideoProducer::_DisconnectScaled(scaled_output &scaled)
+{
+	// Waits for the decoders still scaling into the group
+	_ReleaseScaledGroup(scaled);
+
+	BAutolock _(fLock);
+	scaled.scaler.Unset();
+	scaled.connected = false;
+	scaled.enabled = false;
+	scaled.output.destination = media_destination::null;
+	fScaledConnected--;
+	_ApplyVisibleRegion();
+}
+
+
+status_t
+VideoProducer::_SetScaledBufferGroup(scaled_output &scaled,
+	BBufferGroup *group)
+{
+	if (!scaled.connected)
+		return B_MEDIA_NOT_CONNECTED;
+
+	if (group != NULL) {
+		status_t err = group_fits(group,
+			(size_t)scaled.format.display.bytes_per_row
+				* scaled.format.display.line_count);
+		if (err != B_OK)
+			return err;
+	}
+
+	_ReleaseScaledGroup(scaled);
+	if (group == NULL)
+		return _CreateScaledGroup(scaled);
+
+	BAutolock _(fLock);
+	scaled.group = group;
+	scaled.ownGroup = false;
+	return B_OK;
+}
@@ -14,6 +14,10 @@
 #include <support/Locker.h>
 #include <support/String.h>
 
+#include "CamFrameScaler.h"
+#include "CamLatencyProbe.h"
+
+class BBuffer;
 class CamDevice;
 class BParameter;
 class BTextParameter;
@@ -112,6 +116,24 @@ private:
 		void				HandleSeek(bigtime_t performance_time);
 
 		void				_UpdateStats();
+		void				_UpdateEventLatency();
+		void				_SetFrameSkip(int32 skip);
+		bool				_WantsFrames();
+		void				_UpdateTransfer();
+		bigtime_t			_FrameDuration() const;
+		size_t				_FrameBufferSize() const;
+		size_t				_FrameBufferSize(
+								const media_raw_video_format &format)
+								const;
+		void				_ApplyVisibleRegion();
+		status_t			_EncodedFormat(uint32 width, uint32 height,
+								float fieldRate, media_format *format);
+		status_t			_NegotiateEncodedFormat(media_format *format);
+		void				_UseRawOutput();
+		bool				_FrameSizeChanged() const;
+		void				_SwitchFormat();
+		void				_RestoreVideoFrame(uint32 width,
+								uint32 height);
 
 static	int32				fInstances;
 
@@ -123,12 +145,104 @@ static	int32				fInstances;
 
 		BLocker				fLock;
 			BBufferGroup	*fBufferGroup;
+		bool				fOwnBufferGroup;	// false: the consumer's,
+												// from SetBufferGroup()
 
 		thread_id			fThread;
-		sem_id				fFrameSync;
+		sem_id				fFrameSync;		// released per decoded frame
 static	int32				_frame_generator_(void *data);
 		int32				FrameGenerator();
 
+		/* Decode stage: fills buffers as soon as the deframer completes a
+		 * frame, so FrameGenerator only stamps and sends them. With MJPEG
+		 * several decoder threads fill in parallel and their buffers are put
+		 * back in frame order. */
+		enum {
+			kDecodedQueueDepth	= 2,
+			kMaxDecodeThreads	= 4,
+			kMaxScaledOutputs	= 2
+		};
+		struct decoded_frame {
+			BBuffer*		buffer;		// NULL: frame lost while filling
+			BBuffer*		scaled[kMaxScaledOutputs];	// or NULL
+			bigtime_t		stamp;
+			uint32			sequence;
+			bigtime_t		decoded;	// system_time() the fill ended
+			cam_frame_times	times;		// for the latency probe
+		};
+		int32				fActiveFillers;	// decoders holding a buffer
+											// of fBufferGroup, and the
+											// scaled groups (atomic)
+		sem_id				fFillersIdle;	// released as fActiveFillers
+											// drops to 0
+		bool				fParkDecoders;	// no decoder takes a group
+											// (under fLock)
+		thread_id			fDecodeThreads[kMaxDecodeThreads];
+		int32				fDecodeThreadCount;
+		decoded_frame		fDecoded[kDecodedQueueDepth];	// under fLock
+		int32				fDecodedHead;
+		int32				fDecodedCount;
+		decoded_frame		fReorder[kMaxDecodeThreads];	// under fLock
+		int32				fReorderCount;
+		uint32				fNextSequence;
+		bool				fHaveSequence;
+static	int32				_frame_decoder_(void *data);
+		int32				FrameDecoder();
+		void				_QueueDecodedBuffer(
+								const decoded_frame &frame);
+		void				_PushDecodedBuffer(
+								const decoded_frame &frame);
+		bool				_DequeueDecodedBuffer(decoded_frame *frame);
+		void				_FlushDecodedBuffers();
+static	void				_RecycleFrame(const decoded_frame &frame);
+		BBufferGroup*		_DetachBufferGroup();
+		BBufferGroup*		_DetachGroup(BBufferGroup **group);
+		void				_FillDone();
+		void				_ReleaseBufferGroup();
+		int32				_BufferCount(bigtime_t downstreamLatency) const;
+		status_t			_NewBufferGroup(size_t size,
+								BBufferGroup **_group);
+		status_t			_CreateBufferGroup();
+
+		/* Scaled outputs: the frame the decoders fill for fOutput is
+		 * scaled, on the decoder thread, into a buffer of each connected
+		 * one, in its own size and color space; the camera data is decoded
+		 * once. They need fOutput connected to get frames. Source ids 1 to
+		 * kMaxScaledOutputs, fOutput is 0. */
+		struct scaled_output {
+			media_output			output;
+			media_raw_video_format	format;		// once connected
+			BBufferGroup			*group;
+			bool					ownGroup;
+			bool					connected;
+			bool					enabled;
+			bigtime_t				downstreamLatency;
+			CamFrameScaler			scaler;		// set while fOutput is
+		};
+		scaled_output		fScaled[kMaxScaledOutputs];	// under fLock
+		int32				fScaledConnected;
+		clipping_rect		fVisibleRegion;		// fOutput's, applied while
+		bool				fHasVisibleRegion;	// no scaled one is connected
+
+		scaled_output*		_ScaledOutput(const media_source &source);
+		status_t			_NegotiateScaledFormat(scaled_output &scaled,
+								media_format *format);
+		void				_SetUpScaler(scaled_output &scaled);
+		void				_SetUpScalers();
+		status_t			_CreateScaledGroup(scaled_output &scaled);
+		void				_ReleaseScaledGroup(scaled_output &scaled);
+		void				_FillScaledBuffers(BBuffer *source,
+								BBufferGroup **groups, BBuffer **scaled);
+		void				_SendScaledBuffers(const decoded_frame &frame,
+								const media_header &header);
+		void				_ConnectScaled(scaled_output &scaled,
+								status_t error,
+								const media_destination &destination,
+								const media_format &format, char *io_name);
+		void				_DisconnectScaled(scaled_output &scaled);
+		status_t			_SetScaledBufferGroup(scaled_output &scaled,
+								BBufferGroup *group);
+
 		/* The remaining variables should be declared volatile, but they
 		 * are not here to improve the legibility of the sample code. */
 		uint32				fFrame;
@@ -136,11 +250,28 @@ static	int32				_frame_generator_(void *data);
 		bigtime_t			fPerformanceTimeBase;
 		bigtime_t			fStartRealTime;  // Real time when node started
 		bigtime_t			fProcessingLatency;
+		bigtime_t			fCaptureLatency;	// capture stamp to send
+		bigtime_t			fFirstFrameStart;	// HandleStart(), until its
+												// first frame is sent
+		bool				fWarmStart;			// the transfer was running
+
+		/* Load shedding, driven by LateNoticeReceived(): the device drops
+		 * frames before decoding them while the consumer is late, and the
+		 * lateness seen is added to the event latency. Under fLock. */
+		bigtime_t			fDownstreamLatency;
+		bigtime_t			fLatenessPad;
+		int32				fFrameSkip;
+		bigtime_t			fLastLateNotice;
+		bigtime_t			fLastSkipChange;
 		media_output		fOutput;
 		media_raw_video_format	fConnectedFormat;
 		bool				fRunning;
 		bool				fConnected;
 		bool				fEnabled;
+		bool				fEncoded;	// fOutput is MJPEG passed on
+		int32				fSwitchPending;	// a decoder saw the device
+										// change its frame size,
+										// until _SwitchFormat() (atomic)
 
 		enum {
 			 P_COLOR,
@@ -7,9 +7,16 @@
 
 
 #include "UVCCamDevice.h"
+#include "CamCapture.h"
+#include "UVCControlCache.h"
 #include "UVCDeframer.h"
+#include "UVCMJPEGDecode.h"
+#include "UVCNegotiationCache.h"
 #include "CamDebug.h"
 
+#include <Autolock.h>
+#include <Message.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
@@ -20,6 +27,10 @@
 #define TRACE(x...) do {} while(0)
 //#define TRACE(x...) printf(x)
 
+#ifndef USB_DESCRIPTOR_ENDPOINT_SS_COMPANION
+#define USB_DESCRIPTOR_ENDPOINT_SS_COMPANION	0x30
+#endif
+
 
 usb_webcam_support_descriptor kSupportedDevices[] = {
 	// Specific VID/PID devices first (higher priority than generic class match)
@@ -56,47 +67,77 @@ usbvc_guid kYUY2Guid = {0x59, 0x55, 0x59, 0x32, 0x00, 0x00, 0x10, 0x00, 0x80,
 	0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
 usbvc_guid kNV12Guid = {0x4e, 0x56, 0x31, 0x32, 0x00, 0x00, 0x10, 0x00, 0x80,
 	0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+usbvc_guid kUYVYGuid = {0x55, 0x59, 0x56, 0x59, 0x00, 0x00, 0x10, 0x00, 0x80,
+	0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
 
 
-// =============================================================================
-// Global YUV to RGB Lookup Tables
-// =============================================================================
-// Pre-computed tables eliminate per-pixel multiplications in color conversion.
-// Uses BT.601 coefficients: R = 1.164(Y-16) + 1.596(V-128)
-//                           G = 1.164(Y-16) - 0.391(U-128) - 0.813(V-128)
-//                           B = 1.164(Y-16) + 2.018(U-128)
-
-yuv_rgb_lookup_tables gYuvRgbTables;
+/* Bytes of a frame in the output color spaces FillFrameBuffer() produces */
+static inline size_t
+output_frame_size(color_space space, int32 width, int32 height)
+{
+	switch (space) {
+		case B_YCbCr422:
+		case B_YCbCr420:
+			return mjpeg_yuv_bytes_per_row(space, width) * height;
+		case B_RGB16:
+			return (size_t)width * height * 2;
+		case B_RGB24:
+			return (size_t)width * height * 3;
+		default:
+			return (size_t)width * height * 4;
+	}
+}
 
 
-void
-yuv_rgb_lookup_tables::Initialize()
+/* Black over columns [first, end) of an output row; first is even unless
+ * it is the end of the row */
+static void
+black_span(uint8* row, color_space space, int32 first, int32 end)
 {
-	if (initialized)
+	if (first >= end)
 		return;
 
-	for (int i = 0; i < 256; i++) {
-		// Y contribution (same for R, G, B)
-		// y_table[i] = 298 * (i - 16), unshifted for combining with U/V
-		// Max value: 298 * 239 = 71222 (requires int32)
-		y_table[i] = 298 * (i - 16);
-
-		// U contribution to B: 516 * (u - 128)
-		// Range: -66048 to +65532 (requires int32)
-		u_b_table[i] = 516 * (i - 128);
-
-		// U contribution to G: -100 * (u - 128)
-		u_g_table[i] = -100 * (i - 128);
+	switch (space) {
+		case B_YCbCr422:
+			for (int32 i = first / 2; i < (end + 1) / 2; i++) {
+				row[i * 4] = row[i * 4 + 2] = 16;
+				row[i * 4 + 1] = row[i * 4 + 3] = 128;
+			}
+			break;
+		case B_YCbCr420:
+			for (int32 i = first / 2; i < (end + 1) / 2; i++) {
+				row[i * 3] = 128;
+				row[i * 3 + 1] = row[i * 3 + 2] = 16;
+			}
+			break;
+		default:
+		{
+			size_t bytesPerPixel = output_frame_size(space, 1, 1);
+			memset(row + first * bytesPerPixel, 0,
+				(end - first) * bytesPerPixel);
+			break;
+		}
+	}
+}
 
-		// V contribution to R: 409 * (v - 128)
-		v_r_table[i] = 409 * (i - 128);
 
-		// V contribution to G: -208 * (v - 128)
-		v_g_table[i] = -208 * (i - 128);
+/* Black over what lies outside 'region' of a width x height output frame,
+ * the region as CamDevice::DecodeRegion() gives it */
+static void
+black_outside_region(uint8* dst, color_space space, int32 width,
+	int32 height, const clipping_rect& region)
+{
+	size_t pitch = output_frame_size(space, width, 1);
+	bool empty = region.left > region.right || region.top > region.bottom;
+	for (int32 row = 0; row < height; row++) {
+		uint8* out = dst + row * pitch;
+		if (empty || row < region.top || row > region.bottom) {
+			black_span(out, space, 0, width);
+			continue;
+		}
+		black_span(out, space, 0, region.left);
+		black_span(out, space, region.right + 1, width);
 	}
-
-	initialized = true;
-	syslog(LOG_INFO, "UVCCamDevice: YUV-RGB lookup tables initialized (~5KB)\n");
 }
 
 
@@ -107,6 +148,8 @@ print_guid(const usbvc_guid guid)
 		printf("YUY2");
 	else if (!memcmp(guid, kNV12Guid, sizeof(usbvc_guid)))
 		printf("NV12");
+	else if (!memcmp(guid, kUYVYGuid, sizeof(usbvc_guid)))
+		printf("UYVY");
 	else {
 		printf("%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:"
 			"%02x:%02x:%02x:%02x", guid[0], guid[1], guid[2], guid[3], guid[4],
@@ -123,8 +166,27 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 	fCurrentVideoAlternate(0),
 	fUncompressedFormatIndex(1),
 	fUncompressedFrameIndex(1),
+	fNV12FormatIndex(0),
+	fNV12FrameIndex(0),
+	fUncompressedLayout(YUV422_YUYV),
+	fUncompressedMatrix(YUV_MATRIX_BT601),
+	fNV12Matrix(YUV_MATRIX_BT601),
+	fMJPEGMatrix(YUV_MATRIX_BT601),
+	fParsingFormat(UVC_PARSED_NONE),
+	fMaxVideoFrameSize(0),
+	fMaxPayloadTransferSize(0),
+	fCommittedFrameInterval(0),
+	fRequestedFrameInterval(0),
+	fAlternatePolicy(UVC_ALTERNATE_MINIMUM),
 	fJpegDecompressor(NULL),
 	fIsMJPEG(false),
+	fIsNV12(false),
+	fSourceWidth(0),
+	fSourceHeight(0),
+	fFillLock("UVC frame fill lock"),
+	fFillSequence(0),
+	fJpegDecoderCount(0),
+	fJpegDecoderLock("UVC MJPEG decoder lock"),
 	// FIX BUG 6: Inizializza contatori diagnostici per istanza
 	fFillFrameCount(0),
 	fFillFrameSuccess(0),
@@ -147,26 +209,54 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 	fAudioFeatureUnitID(0),
 	fAudioTransferRunning(false),
 	fAudioPumpThread(-1),
-	fAudioBuffer(NULL),
-	fAudioBufferLen(0),
-	fAudioRingBuffer(NULL),
-	fAudioRingSize(0),
-	fAudioRingHead(0),
-	fAudioRingTail(0),
+	fAudioRingData(NULL),
+	fAudioRingArea("webcam audio ring"),
+	fAudioPacketSize(0),
+	fAudioTransferCount(0),
+	fAudioBlocksSubmitted(0),
+	fAudioBlocksCompleted(0),
+	fAudioBlocksConsumed(0),
+	fAudioBytesAvailable(0),
+	fAudioReadPacket(0),
+	fAudioReadOffset(0),
+	fAudioSpaceSem(-1),
+	fAudioClockLock("UVC audio clock"),
+	fAudioBytesReceived(0),
+	fAudioBytesRead(0),
 	fSelectedResolutionIndex(0),
 	fResolutionParameterID(0),
 	fResolutionTransitionStart(0),
 	fAudioRingSem(-1),
 	// Frame validation state (Feature 1)
-	fLastValidFrame(NULL),
-	fLastValidFrameSize(0),
-	fLastValidWidth(0),
-	fLastValidHeight(0),
+	fLastFrame(NULL),
+	fSpareFrame(NULL),
+	fFrameCacheLock("UVC decoded frame cache"),
+	fFrameArena("UVC frame arena"),
+	fSpareFrameArena("UVC spare frame arena"),
+	fStreamArena(&fFrameArena),
 	fConsecutiveBadFrames(0),
 	fFrameRepeatEnabled(true),
 	// Processing Unit controls (Feature 2)
 	fProcessingUnitID(0),
 	fControlsInitialized(false),
+	fControlValuesRead(0),
+	fControlThread(-1),
+	fControlSem(-1),
+	fControlLock("uvc control queue"),
+	fControlQuit(false),
+	fControlsSent(0),
+	fControlsCoalesced(0),
+	fStatusThread(-1),
+	fStatusQuit(0),
+	fStatusEvents(0),
+	fStillMethod(0),
+	fStillEndpointAddress(0),
+	fStillIn(NULL),
+	fStillSizeCount(0),
+	fStillBusy(0),
+	fStillThread(-1),
+	fStillDecoded(false),
+	fStillCookie(0),
 	// Resolution fallback state (Feature 3)
 	fCurrentResolutionLevel(0),
 	fTargetResolutionLevel(0),
@@ -179,11 +269,18 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 	fFallbackWarningShown(false),
 	fLastPacketSuccessCount(0),
 	fLastPacketErrorCount(0),
+	fDegradePolicy(UVC_DEGRADE_RESOLUTION),
+	fDegradeStepCount(0),
+	fFrameIntervalLimit(0),
+	fRecoveryDelay(0),
+	fLastRecoveryTime(0),
+	fBandwidthShortfall(false),
 	// High-bandwidth auto-detection state
 	fHighBandwidthTested(false),
 	fHighBandwidthWorks(true),		// Assume it works until proven otherwise
 	fHighBandwidthFailures(0),
 	fUsingHighBandwidth(false),
+	fSSCompanionCount(0),
 	// MJPEG frame size monitoring
 	fMJPEGFrameSizeSum(0),
 	fMJPEGFrameSizeCount(0),
@@ -192,12 +289,19 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 {
 	// Initialize frame validation stats
 	memset(&fValidationStats, 0, sizeof(fValidationStats));
+	memset(fPendingControls, 0, sizeof(fPendingControls));
+	memset(&fConvertKernel, 0, sizeof(fConvertKernel));
+	memset(fJpegYUVScratch, 0, sizeof(fJpegYUVScratch));
+	fAudioPumpSchedule.Reset();
+	uvc_audio_layout_for(0, 0, &fAudioLayout);
 
 	// Initialize fallback config with defaults
 	_InitializeFallbackConfig();
 
-	// Initialize YUV-RGB lookup tables (once, shared across all instances)
+	// Initialize YUV-RGB lookup tables and measure the conversion kernels
+	// (once, shared across all instances)
 	gYuvRgbTables.Initialize();
+	yuy2_rgb32_best_kernel();
 
 	fDeframer = new UVCDeframer(this);
 	SetDataInput(fDeframer);
@@ -265,7 +369,8 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 				printf("UVCCamDevice: Found %u descriptors in base interface\n", descCount);
 
 				// If no frames found, try alternates (some devices put descriptors there)
-				if (fUncompressedFrames.CountItems() == 0 && fMJPEGFrames.CountItems() == 0) {
+				if (fUncompressedFrames.CountItems() == 0 && fMJPEGFrames.CountItems() == 0
+					&& fNV12Frames.CountItems() == 0) {
 					printf("UVCCamDevice: No frames in base, checking alternates...\n");
 					for (uint32 alt = 0; alt < interface->CountAlternates(); alt++) {
 						const BUSBInterface* alternate = interface->AlternateAt(alt);
@@ -282,21 +387,48 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 							_ParseVideoStreaming((const usbvc_class_descriptor*)generic,
 								generic->generic.length);
 						}
-						if (fUncompressedFrames.CountItems() > 0 || fMJPEGFrames.CountItems() > 0)
+						if (fUncompressedFrames.CountItems() > 0 || fMJPEGFrames.CountItems() > 0
+							|| fNV12Frames.CountItems() > 0)
 							break;
 					}
 				}
 
-				printf("UVCCamDevice: Total frames found: uncompressed=%d, mjpeg=%d\n",
-					(int)fUncompressedFrames.CountItems(), (int)fMJPEGFrames.CountItems());
+				printf("UVCCamDevice: Total frames found: uncompressed=%d, nv12=%d, mjpeg=%d\n",
+					(int)fUncompressedFrames.CountItems(), (int)fNV12Frames.CountItems(),
+					(int)fMJPEGFrames.CountItems());
+
+				// Method 3 stills have a bulk endpoint of their own, which
+				// is not the video one
+				for (uint32 k = 0; fStillEndpointAddress != 0
+					&& k < interface->CountEndpoints(); k++) {
+					const BUSBEndpoint* e = interface->EndpointAt(k);
+					if (e && e->IsBulk() && e->IsInput()
+						&& e->Descriptor()->endpoint_address
+							== fStillEndpointAddress)
+						fStillIn = e;
+				}
 
 				for (uint32 k = 0; k < interface->CountEndpoints(); k++) {
 					const BUSBEndpoint* e = interface->EndpointAt(k);  // FIX BUG 1: era 'i', corretto in 'k'
+					if (e != NULL && e == fStillIn)
+						continue;
 					if (e && e->IsIsochronous() && e->IsInput()) {
 						fIsoIn = e;
 						break;
 					}
+					// Bulk streaming interfaces have their endpoint in
+					// alternate 0 and no other alternates to pick from
+					if (e && e->IsBulk() && e->IsInput()) {
+						fBulkIn = e;
+						syslog(LOG_INFO, "UVCCamDevice: Bulk video endpoint "
+							"0x%02x, %u byte packets\n",
+							e->Descriptor()->endpoint_address,
+							(unsigned)e->MaxPacketSize());
+						break;
+					}
 				}
+
+				_ReadSuperSpeedCompanions(config, interface);
 			} else if (interface->Class() == USB_AUDIO_DEVICE_CLASS
 				&& interface->Subclass() == USB_AUDIO_INTERFACE_AUDIOCONTROL) {
 				// Found Audio Control interface
@@ -345,7 +477,8 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 
 	// TASK 1: Fallback for AUKEY PC-LM1E (VID:0x1BCF PID:0x0001)
 	// If USB descriptor parsing failed, hardcode the known resolutions
-	if (fMJPEGFrames.CountItems() == 0 && fUncompressedFrames.CountItems() == 0) {
+	if (fMJPEGFrames.CountItems() == 0 && fUncompressedFrames.CountItems() == 0
+		&& fNV12Frames.CountItems() == 0) {
 		syslog(LOG_WARNING, "UVCCamDevice: USB descriptor parsing found no frames, using hardcoded fallback\n");
 		uint16 vendorID = fDevice->VendorID();
 		uint16 productID = fDevice->ProductID();
@@ -380,8 +513,8 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 
 			fMJPEGFormatIndex = 2;  // Actual camera MJPEG format index
 			for (size_t i = 0; i < sizeof(mjpegFrames)/sizeof(mjpegFrames[0]); i++) {
-				usb_video_frame_descriptor* desc = new usb_video_frame_descriptor;
-				memset(desc, 0, sizeof(*desc));
+				usb_video_frame_descriptor* desc = (usb_video_frame_descriptor*)
+					calloc(1, sizeof(usb_video_frame_descriptor));
 				desc->frame_index = i + 1;
 				desc->capabilities = 0;
 				desc->width = mjpegFrames[i].width;
@@ -410,8 +543,8 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 
 			fUncompressedFormatIndex = 1;  // Actual camera YUY2 format index
 			for (size_t i = 0; i < sizeof(yuy2Frames)/sizeof(yuy2Frames[0]); i++) {
-				usb_video_frame_descriptor* desc = new usb_video_frame_descriptor;
-				memset(desc, 0, sizeof(*desc));
+				usb_video_frame_descriptor* desc = (usb_video_frame_descriptor*)
+					calloc(1, sizeof(usb_video_frame_descriptor));
 				desc->frame_index = i + 1;
 				desc->capabilities = 0;
 				desc->width = yuy2Frames[i].width;
@@ -449,12 +582,34 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 	if (fJpegDecompressor == NULL) {
 		syslog(LOG_WARNING, "UVCCamDevice: tjInitDecompress failed - MJPEG disabled\n");
 		/* Continue anyway - YUY2 format will still work */
+	} else {
+		// One more handle per CPU, so 1080p MJPEG frames can decode in
+		// parallel (TurboJPEG handles are not thread safe)
+		system_info info;
+		int32 decoders = 1;
+		if (get_system_info(&info) == B_OK)
+			decoders = (int32)info.cpu_count;
+		if (decoders > kMaxMJPEGDecoders)
+			decoders = kMaxMJPEGDecoders;
+
+		memset(fJpegDecoderBusy, 0, sizeof(fJpegDecoderBusy));
+		fJpegDecoders[0] = fJpegDecompressor;
+		fJpegDecoderCount = 1;
+		while (fJpegDecoderCount < decoders) {
+			tjhandle decoder = tjInitDecompress();
+			if (decoder == NULL)
+				break;
+			fJpegDecoders[fJpegDecoderCount++] = decoder;
+		}
+		syslog(LOG_INFO, "UVCCamDevice: %d MJPEG decoder(s)\n",
+			(int)fJpegDecoderCount);
 	}
 
 	// FIX BUG 3: Impostare fInitStatus solo dopo parsing completo
 	// Requisito minimo: avere almeno un formato video disponibile
 	// (interfacce possono avere indice 0, quindi non controlliamo > 0)
-	if (fUncompressedFrames.CountItems() > 0 || fMJPEGFrames.CountItems() > 0) {
+	if (fUncompressedFrames.CountItems() > 0 || fMJPEGFrames.CountItems() > 0
+		|| fNV12Frames.CountItems() > 0) {
 		fInitStatus = B_OK;
 
 		// FIX: Initialize fIsMJPEG based on available formats
@@ -463,15 +618,17 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 			fIsMJPEG = true;
 		else
 			fIsMJPEG = false;
+		fIsNV12 = fUncompressedFrames.CountItems() == 0;
 
 		syslog(LOG_INFO, "UVCCamDevice: Init OK - ctrl=%u stream=%u frames=%d+%d format=%s\n",
 			fControlIndex, fStreamingIndex,
 			(int)fUncompressedFrames.CountItems(), (int)fMJPEGFrames.CountItems(),
-			fIsMJPEG ? "MJPEG" : "YUY2");
-		syslog(LOG_INFO, "UVCCamDevice: Format indices: MJPEG=%d, Uncompressed=%d\n",
-			fMJPEGFormatIndex, fUncompressedFormatIndex);
+			fIsMJPEG ? "MJPEG" : fIsNV12 ? "NV12" : "YUY2");
+		syslog(LOG_INFO, "UVCCamDevice: Format indices: MJPEG=%d, Uncompressed=%d, "
+			"NV12=%d (%d frames)\n", fMJPEGFormatIndex, fUncompressedFormatIndex,
+			(int)fNV12FormatIndex, (int)fNV12Frames.CountItems());
 		// Log frame indices for each resolution
-		BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+		BList* frameList = _StreamFrames();
 		for (int32 i = 0; i < frameList->CountItems(); i++) {
 			const usb_video_frame_descriptor* desc =
 				(const usb_video_frame_descriptor*)frameList->ItemAt(i);
@@ -479,6 +636,8 @@ UVCCamDevice::UVCCamDevice(CamDeviceAddon& _addon, BUSBDevice* _device)
 				syslog(LOG_INFO, "UVCCamDevice:   [%d] %ux%u frame_index=%u\n",
 					(int)i, desc->width, desc->height, desc->frame_index);
 		}
+
+		_StartStatusReader();
 	} else {
 		syslog(LOG_ERR, "UVCCamDevice: Init FAILED - no video frames available\n");
 	}
@@ -489,49 +648,58 @@ UVCCamDevice::~UVCCamDevice()
 {
 	printf("UVCCamDevice::~UVCCamDevice() - Destroying device\n");
 
+	// Settings still queued are dropped, the device is going away
+	_StopStatusReader();
+	_StopControlWorker();
+
+	// A still capture gives up after kStillTimeout at most, a method 3
+	// one by halting its endpoint
+	if (fStillThread >= 0) {
+		status_t result;
+		wait_for_thread(fStillThread, &result);
+	}
+
 	// Stop audio transfer if running
 	if (fAudioTransferRunning) {
 		StopAudioTransfer();
 	}
 
 	// Cleanup audio resources
-	if (fAudioBuffer) {
-		free(fAudioBuffer);
-		fAudioBuffer = NULL;
-	}
-	if (fAudioRingBuffer) {
-		free(fAudioRingBuffer);
-		fAudioRingBuffer = NULL;
-	}
-	if (fAudioRingSem >= 0) {
-		delete_sem(fAudioRingSem);
-		fAudioRingSem = -1;
-	}
-
-	// Cleanup TurboJPEG decompressor
+	_StopAudioTransfers();
+
+	// Cleanup TurboJPEG decompressor; the extra parallel handles first
+	for (int32 i = 1; i < fJpegDecoderCount; i++)
+		tjDestroy(fJpegDecoders[i]);
+	fJpegDecoderCount = 0;
+	for (int32 i = 0; i < kMaxMJPEGDecoders; i++)
+		mjpeg_yuv_scratch_free(&fJpegYUVScratch[i]);
 	if (fJpegDecompressor) {
 		tjDestroy(fJpegDecompressor);
 		fJpegDecompressor = NULL;
 		fprintf(stderr, "UVCCamDevice: TurboJPEG decompressor destroyed\n");
 	}
 
-	// CRITICAL FIX: Free frame descriptors allocated with new
-	// These were allocated in lines 251 and 254, must be freed to avoid memory leak
-	for (int32 i = 0; i < fUncompressedFrames.CountItems(); i++) {
-		delete (usb_video_frame_descriptor*)fUncompressedFrames.ItemAt(i);
-	}
+	// CRITICAL FIX: Free frame descriptors, from copy_frame_descriptor() or
+	// the hardcoded fallback, to avoid a memory leak
+	for (int32 i = 0; i < fUncompressedFrames.CountItems(); i++)
+		free(fUncompressedFrames.ItemAt(i));
 	fUncompressedFrames.MakeEmpty();
 
-	for (int32 i = 0; i < fMJPEGFrames.CountItems(); i++) {
-		delete (usb_video_frame_descriptor*)fMJPEGFrames.ItemAt(i);
-	}
+	for (int32 i = 0; i < fNV12Frames.CountItems(); i++)
+		free(fNV12Frames.ItemAt(i));
+	fNV12Frames.MakeEmpty();
+
+	for (int32 i = 0; i < fMJPEGFrames.CountItems(); i++)
+		free(fMJPEGFrames.ItemAt(i));
 	fMJPEGFrames.MakeEmpty();
 
 	// Cleanup frame validation cache (Feature 1)
-	if (fLastValidFrame) {
-		delete[] fLastValidFrame;
-		fLastValidFrame = NULL;
-	}
+	_DropDecodedFrames();
+
+	// The deframer outlives us (CamDevice deletes it); take its frames
+	// off the arena before the arena goes
+	if (fDeframer != NULL)
+		fDeframer->SetFrameArena(NULL, -1);
 
 	// Cleanup processing controls (Feature 2)
 	for (int32 i = 0; i < fProcessingControls.CountItems(); i++) {
@@ -543,6 +711,31 @@ UVCCamDevice::~UVCCamDevice()
 }
 
 
+/* A frame descriptor with all of its discrete intervals: the struct has
+ * room for three. Freed with free(). */
+static usb_video_frame_descriptor*
+copy_frame_descriptor(const usb_video_frame_descriptor* descriptor,
+	size_t length)
+{
+	size_t size = max_c(length, sizeof(usb_video_frame_descriptor));
+	usb_video_frame_descriptor* copy
+		= (usb_video_frame_descriptor*)calloc(1, size);
+	if (copy == NULL)
+		return NULL;
+	memcpy(copy, descriptor, min_c(length, size));
+
+	// Only the intervals the descriptor really holds
+	if (copy->frame_interval_type > 0) {
+		size_t offset = offsetof(usb_video_frame_descriptor,
+			discrete_frame_intervals);
+		size_t fit = length > offset ? (length - offset) / sizeof(uint32) : 0;
+		if (copy->frame_interval_type > fit)
+			copy->frame_interval_type = fit;
+	}
+	return copy;
+}
+
+
 void
 UVCCamDevice::_ParseVideoStreaming(const usbvc_class_descriptor* _descriptor,
 	size_t len)
@@ -559,6 +752,7 @@ UVCCamDevice::_ParseVideoStreaming(const usbvc_class_descriptor* _descriptor,
 				printf("\tDynamic Format Change supported\n");
 			printf("\toutput terminal id=%d\n", descriptor->terminal_link);
 			printf("\tstill capture method=%d\n", descriptor->still_capture_method);
+			fStillMethod = descriptor->still_capture_method;
 			if (descriptor->trigger_support) {
 				printf("\ttrigger button fixed to still capture=%s\n",
 					descriptor->trigger_usage ? "no" : "yes");
@@ -583,7 +777,23 @@ UVCCamDevice::_ParseVideoStreaming(const usbvc_class_descriptor* _descriptor,
 		{
 			const usbvc_format_descriptor* descriptor
 				= (const usbvc_format_descriptor*)_descriptor;
-			fUncompressedFormatIndex = descriptor->formatIndex;
+			const uint8* guid = descriptor->uncompressed.format;
+			if (memcmp(guid, kNV12Guid, sizeof(usbvc_guid)) == 0) {
+				fNV12FormatIndex = descriptor->formatIndex;
+				fParsingFormat = UVC_PARSED_NV12;
+			} else if (memcmp(guid, kYUY2Guid, sizeof(usbvc_guid)) == 0
+				|| memcmp(guid, kUYVYGuid, sizeof(usbvc_guid)) == 0) {
+				fUncompressedFormatIndex = descriptor->formatIndex;
+				fUncompressedLayout = memcmp(guid, kUYVYGuid,
+					sizeof(usbvc_guid)) == 0 ? YUV422_UYVY : YUV422_YUYV;
+				fParsingFormat = UVC_PARSED_YUV422;
+			} else {
+				// Its frames would be converted as YUY2 otherwise
+				syslog(LOG_INFO, "UVCCamDevice: skipping uncompressed format "
+					"%d, not a supported pixel format\n",
+					descriptor->formatIndex);
+				fParsingFormat = UVC_PARSED_NONE;
+			}
 			printf("VS_FORMAT_UNCOMPRESSED:\tbFormatIdx=%d,#frmdesc=%d,guid=",
 				descriptor->formatIndex, descriptor->numFrameDescriptors);
 			print_guid(descriptor->uncompressed.format);
@@ -615,14 +825,25 @@ UVCCamDevice::_ParseVideoStreaming(const usbvc_class_descriptor* _descriptor,
 		{
 			const usb_video_frame_descriptor* descriptor
 				= (const usb_video_frame_descriptor*)_descriptor;
+			usb_video_frame_descriptor* copy
+				= copy_frame_descriptor(descriptor, len);
+			if (copy == NULL)
+				break;
 			if (_descriptor->descriptorSubtype == USB_VIDEO_VS_FRAME_UNCOMPRESSED) {
 				printf("VS_FRAME_UNCOMPRESSED:");
-				fUncompressedFrames.AddItem(
-					new usb_video_frame_descriptor(*descriptor));
+				if (fParsingFormat == UVC_PARSED_NV12) {
+					fNV12Frames.AddItem(copy);
+					copy = NULL;
+				} else if (fParsingFormat == UVC_PARSED_YUV422) {
+					fUncompressedFrames.AddItem(copy);
+					copy = NULL;
+				}
 			} else {
 				printf("VS_FRAME_MJPEG:");
-				fMJPEGFrames.AddItem(new usb_video_frame_descriptor(*descriptor));
+				fMJPEGFrames.AddItem(copy);
+				copy = NULL;
 			}
+			free(copy);
 			printf("\tbFrameIdx=%d,stillsupported=%s,"
 				"fixedframerate=%s\n", descriptor->frame_index,
 				(descriptor->capabilities & 1) ? "yes" : "no",
@@ -690,6 +911,16 @@ UVCCamDevice::_ParseVideoStreaming(const usbvc_class_descriptor* _descriptor,
 				case 5: printf("SMPTE 240M\n"); break;
 				default: printf("Invalid (%d)\n", descriptor->matrix_coefficients);
 			}
+
+			// Follows the frames of the format it describes
+			yuv_matrix matrix
+				= yuv_matrix_from_uvc(descriptor->matrix_coefficients);
+			if (fParsingFormat == UVC_PARSED_MJPEG)
+				fMJPEGMatrix = matrix;
+			else if (fParsingFormat == UVC_PARSED_NV12)
+				fNV12Matrix = matrix;
+			else if (fParsingFormat == UVC_PARSED_YUV422)
+				fUncompressedMatrix = matrix;
 			break;
 		}
 		case USB_VIDEO_VS_OUTPUT_HEADER:
@@ -731,6 +962,7 @@ UVCCamDevice::_ParseVideoStreaming(const usbvc_class_descriptor* _descriptor,
 				printf("compression%d: %d\n", i,
 					descriptor->CompressionPatterns()[i]);
 			}
+			_AddStillSizes(descriptor);
 			break;
 		}
 		case USB_VIDEO_VS_FORMAT_MJPEG:
@@ -738,6 +970,7 @@ UVCCamDevice::_ParseVideoStreaming(const usbvc_class_descriptor* _descriptor,
 			const usbvc_format_descriptor* descriptor
 				= (const usbvc_format_descriptor*)_descriptor;
 			fMJPEGFormatIndex = descriptor->formatIndex;
+			fParsingFormat = UVC_PARSED_MJPEG;
 			printf("VS_FORMAT_MJPEG:\tbFormatIdx=%d,#frmdesc=%d\n",
 				descriptor->formatIndex, descriptor->numFrameDescriptors);
 			printf("\t#flgs=%d,optfrmidx=%d,aspRX=%d,aspRY=%d\n",
@@ -1021,6 +1254,13 @@ UVCCamDevice::_ParseAudioStreaming(const usb_audio_class_descriptor* _descriptor
 }
 
 
+bool
+UVCCamDevice::SupportsBulk()
+{
+	return fBulkIn != NULL;
+}
+
+
 bool
 UVCCamDevice::SupportsIsochronous()
 {
@@ -1028,18 +1268,83 @@ UVCCamDevice::SupportsIsochronous()
 }
 
 
+/* WEBCAM_BULK_TRANSFERS sets how many, 1 for the plain transfer loop */
+uint32
+UVCCamDevice::BulkTransfersInFlight()
+{
+	uint32 count = CamConfig::kUVCBulkTransfersInFlight;
+	const char* env = getenv("WEBCAM_BULK_TRANSFERS");
+	if (env != NULL && atoi(env) > 0)
+		count = atoi(env);
+	return count;
+}
+
+
 status_t
 UVCCamDevice::StartTransfer()
 {
-	status_t err = _ProbeCommitFormat();
-	if (err != B_OK)
-		return err;
+	usb_video_probe_and_commit_controls request;
+	_BuildProbeRequest(&request);
+
+	// The cache is for ISO alternates, bulk has none to choose
+	uvc_negotiation_key key;
+	bool cacheable = fBulkIn == NULL && _NegotiationKey(request, &key);
+
+	// A negotiation done before for the same request is committed as is
+	uvc_negotiation negotiation;
+	bool reused = false;
+	if (cacheable
+		&& UVCNegotiationCache::Default().Lookup(key, &negotiation)) {
+		status_t err = _CommitFormat(negotiation.committed,
+			negotiation.length);
+		if (err == B_OK) {
+			err = _UseAlternate(negotiation.alternate, negotiation.endpoint,
+				negotiation.bandwidth);
+		}
+		if (err == B_OK) {
+			syslog(LOG_INFO, "UVCCamDevice: Reused negotiation: format=%d "
+				"frame=%d interval=%u alternate %u (%u bytes)\n",
+				negotiation.committed.format_index,
+				negotiation.committed.frame_index,
+				negotiation.committed.frame_interval,
+				negotiation.alternate, negotiation.bandwidth);
+			reused = true;
+		} else {
+			syslog(LOG_WARNING, "UVCCamDevice: Cached negotiation rejected "
+				"(%s), negotiating again\n", strerror(err));
+			UVCNegotiationCache::Default().Remove(key);
+		}
+	}
 
-	err = _SelectBestAlternate();
-	if (err != B_OK)
-		return err;
+	if (!reused) {
+		memset(&negotiation, 0, sizeof(negotiation));
+		status_t err = _ProbeCommitFormat(request, &negotiation);
+		if (err != B_OK)
+			return err;
+
+		if (fBulkIn != NULL)
+			err = _UseBulkEndpoint();
+		else
+			err = _SelectBestAlternate(&negotiation);
+		if (err != B_OK)
+			return err;
+
+		if (cacheable)
+			UVCNegotiationCache::Default().Store(key, negotiation);
+	}
 
-	return CamDevice::StartTransfer();
+	// A failed arena only costs the no-allocation guarantee
+	_SetUpFrameArena();
+	{
+		BAutolock fillLock(fFillLock);
+		_SelectConvertKernel();
+	}
+
+	// Nothing streams after all: the bandwidth is not held for it
+	status_t err = CamDevice::StartTransfer();
+	if (err != B_OK && err != EALREADY)
+		_SelectIdleAlternate();
+	return err;
 }
 
 
@@ -1047,7 +1352,13 @@ status_t
 UVCCamDevice::StopTransfer()
 {
 	_SelectIdleAlternate();
-	return CamDevice::StopTransfer();
+	status_t err = CamDevice::StopTransfer();
+
+	// Bulk streaming has no alternate to leave: like SET_INTERFACE(0) for
+	// ISO, a CLEAR_FEATURE(ENDPOINT_HALT) tells the device to stop
+	if (err == B_OK && fBulkIn != NULL)
+		fBulkIn->ClearStall();
+	return err;
 }
 
 
@@ -1061,7 +1372,7 @@ UVCCamDevice::SuggestVideoFrame(uint32& width, uint32& height)
 	const char* safeMode = getenv("WEBCAM_SAFE_MODE");
 	if (safeMode != NULL && (strcmp(safeMode, "1") == 0 || strcmp(safeMode, "yes") == 0)) {
 		// Use lowest resolution available
-		BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+		BList* frameList = _StreamFrames();
 		int32 count = frameList->CountItems();
 		if (count > 0) {
 			// Find smallest resolution
@@ -1089,16 +1400,16 @@ UVCCamDevice::SuggestVideoFrame(uint32& width, uint32& height)
 	}
 
 	// Task 2: Use the selected resolution index
-	BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+	BList* frameList = _StreamFrames();
 
 	// First check if fIsMJPEG needs to be initialized
 	if (fMJPEGFrames.CountItems() > 0)
 		fIsMJPEG = true;
-	else if (fUncompressedFrames.CountItems() > 0)
+	else if (fUncompressedFrames.CountItems() > 0 || fNV12Frames.CountItems() > 0)
 		fIsMJPEG = false;
 
 	// Re-select the frame list after determining format
-	frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+	frameList = _StreamFrames();
 
 	// Use the selected resolution if available
 	if (frameList->CountItems() > 0) {
@@ -1132,12 +1443,25 @@ UVCCamDevice::SuggestVideoFrame(uint32& width, uint32& height)
 status_t
 UVCCamDevice::AcceptVideoFrame(uint32& width, uint32& height)
 {
-	int32 uncompressedCount = fUncompressedFrames.CountItems();
+	int32 uncompressedCount = fUncompressedFrames.CountItems()
+		+ fNV12Frames.CountItems();
 	int32 mjpegCount = fMJPEGFrames.CountItems();
+	fSourceWidth = 0;
+	fSourceHeight = 0;
+	fRequestedFrameInterval = 0;
 
 	// Prefer MJPEG over YUY2 for USB webcams
-	// Prefer MJPEG (better bandwidth usage) over uncompressed
-	if (mjpegCount > 0)
+	// Prefer MJPEG (better bandwidth usage) over uncompressed, unless the
+	// consumer negotiated native YCbCr422 in a size YUY2 can feed as-is,
+	// or B_RGB16, which TurboJPEG cannot decode to. MJPEG passthrough
+	// takes the MJPEG modes as they are.
+	if (MJPEGPassthrough())
+		fIsMJPEG = true;
+	else if (fColorSpace == B_YCbCr422 && _PassYUY2Through(width, height))
+		fIsMJPEG = false;
+	else if (fColorSpace == B_RGB16 && uncompressedCount > 0)
+		fIsMJPEG = false;
+	else if (mjpegCount > 0)
 		fIsMJPEG = true;
 	else if (uncompressedCount > 0)
 		fIsMJPEG = false;
@@ -1153,6 +1477,7 @@ UVCCamDevice::AcceptVideoFrame(uint32& width, uint32& height)
 		}
 		// Try MJPEG first (less bandwidth), then fall back to uncompressed
 		fIsMJPEG = true;
+		fIsNV12 = false;
 		fMJPEGFormatIndex = 1;
 		fMJPEGFrameIndex = 1;
 		fUncompressedFormatIndex = 1;
@@ -1161,8 +1486,11 @@ UVCCamDevice::AcceptVideoFrame(uint32& width, uint32& height)
 		return B_OK;
 	}
 
+	// NV12 carries the same picture in 12 instead of 16 bits per pixel
+	fIsNV12 = !fIsMJPEG && _PreferNV12(width, height);
+
 	// Search in the appropriate frame list
-	BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+	BList* frameList = _StreamFrames();
 	int32 frameCount = frameList->CountItems();
 
 	// Use fSelectedResolutionIndex if width/height not specified
@@ -1197,10 +1525,14 @@ UVCCamDevice::AcceptVideoFrame(uint32& width, uint32& height)
 			if (fIsMJPEG) {
 				fMJPEGFrameIndex = descriptor->frame_index;
 			} else {
-				fUncompressedFrameIndex = descriptor->frame_index;
-				// Set expected frame size for YUY2
+				if (fIsNV12)
+					fNV12FrameIndex = descriptor->frame_index;
+				else
+					fUncompressedFrameIndex = descriptor->frame_index;
+				// Set expected frame size for YUY2 or NV12
 				if (fDeframer) {
-					((UVCDeframer*)fDeframer)->SetExpectedFrameSize(width * height * 2);
+					((UVCDeframer*)fDeframer)->SetExpectedFrameSize(
+						_UncompressedFrameSize(width, height));
 				}
 			}
 			SetVideoFrame(BRect(0, 0, width - 1, height - 1));
@@ -1208,16 +1540,146 @@ UVCCamDevice::AcceptVideoFrame(uint32& width, uint32& height)
 		}
 	}
 
+	// MJPEG: a mode 2, 4 or 8 times the requested size decodes straight to
+	// it with DCT scaling; take the smallest such mode
+	if (MJPEGPassthrough())
+		return B_ERROR;
+	if (fIsMJPEG) {
+		for (uint32 scale = 2; scale <= 8; scale *= 2) {
+			for (int32 i = 0; i < frameCount; i++) {
+				const usb_video_frame_descriptor* descriptor
+					= (const usb_video_frame_descriptor*)frameList->ItemAt(i);
+				if (descriptor->width != width * scale
+					|| descriptor->height != height * scale)
+					continue;
+
+				syslog(LOG_INFO, "UVCCamDevice::AcceptVideoFrame: %ux%u via "
+					"MJPEG %ux%u scaled 1/%u\n", width, height,
+					descriptor->width, descriptor->height, scale);
+				fMJPEGFrameIndex = descriptor->frame_index;
+				SetVideoFrame(BRect(0, 0, width - 1, height - 1));
+				return B_OK;
+			}
+		}
+	}
+
+	// Otherwise a larger YUY2 mode, shrunk while it is converted
+	if (_AcceptDownscaledFrame(width, height))
+		return B_OK;
+
 	return B_ERROR;
 }
 
 
+/* The interval the frame descriptor advertises nearest to 1 / fps, 59.94
+ * and 29.97 included; the probe asks for it. Without a descriptor the
+ * camera's rate is not known, and fps is taken as it is. */
+status_t
+UVCCamDevice::AcceptFrameRate(float& fps)
+{
+	const usb_video_frame_descriptor* frame = _CurrentFrameDescriptor();
+	if (frame == NULL) {
+		fRequestedFrameInterval = 0;
+		return CamDevice::AcceptFrameRate(fps);
+	}
+
+	uint32 interval = frame->default_frame_interval;
+	if (fps > 0.0f)
+		interval = _NearestFrameInterval(frame,
+			(uint32)(10000000.0f / fps + 0.5f));
+	if (interval == 0)
+		return B_ERROR;
+	fRequestedFrameInterval = interval;
+	fps = 10000000.0f / interval;
+	syslog(LOG_INFO, "UVCCamDevice: Frame rate %.2f fps (interval %u)\n",
+		fps, interval);
+	return CamDevice::AcceptFrameRate(fps);
+}
+
+
+/* No mode has the requested size: takes the smallest YUY2 mode of the same
+ * shape, at most kYUV422MaxDownscale times as large each way, and has the
+ * conversion box filter it down, reading each source byte once. Not NV12,
+ * which the filter does not read, nor outputs only MJPEG decodes to. */
+bool
+UVCCamDevice::_AcceptDownscaledFrame(uint32 width, uint32 height)
+{
+	if (fColorSpace != B_YCbCr422 && !yuv422_rgb_supports(fColorSpace))
+		return false;
+
+	const usb_video_frame_descriptor* best = NULL;
+	for (int32 i = 0; i < fUncompressedFrames.CountItems(); i++) {
+		const usb_video_frame_descriptor* descriptor
+			= (const usb_video_frame_descriptor*)fUncompressedFrames.ItemAt(i);
+		if (!yuv422_downscale_supported(descriptor->width, descriptor->height,
+				width, height))
+			continue;
+		// The same aspect ratio within 1%, nothing gets stretched
+		int64 across = (int64)descriptor->width * height;
+		int64 down = (int64)descriptor->height * width;
+		if ((across > down ? across - down : down - across) * 100 > across)
+			continue;
+		if (best == NULL || (uint32)descriptor->width * descriptor->height
+				< (uint32)best->width * best->height)
+			best = descriptor;
+	}
+	if (best == NULL)
+		return false;
+
+	fIsMJPEG = false;
+	fIsNV12 = false;
+	fUncompressedFrameIndex = best->frame_index;
+	fSourceWidth = best->width;
+	fSourceHeight = best->height;
+	if (fDeframer) {
+		((UVCDeframer*)fDeframer)->SetExpectedFrameSize(
+			_UncompressedFrameSize(fSourceWidth, fSourceHeight));
+	}
+
+	syslog(LOG_INFO, "UVCCamDevice::AcceptVideoFrame: %ux%u via YUY2 %ux%u "
+		"downscaled\n", width, height, fSourceWidth, fSourceHeight);
+	SetVideoFrame(BRect(0, 0, width - 1, height - 1));
+	return true;
+}
+
+
+bool
+UVCCamDevice::SupportsMJPEGPassthrough()
+{
+	// Needs no decompressor
+	return fMJPEGFrames.CountItems() > 0;
+}
+
+
+bool
+UVCCamDevice::SupportsColorSpace(color_space space)
+{
+	// B_YCbCr422 is the YUY2 stream passed through without conversion, or
+	// MJPEG decoded to its YCbCr planes like B_YCbCr420; B_RGB24 comes out
+	// of both conversion paths, B_RGB16 only out of the YUV kernels
+	bool decodesYUV = fMJPEGFrames.CountItems() > 0 && fJpegDecompressor != NULL;
+	switch (space) {
+		case B_YCbCr422:
+			return fUncompressedFrames.CountItems() > 0 || decodesYUV;
+		case B_YCbCr420:
+			return decodesYUV;
+		case B_RGB16:
+			return fUncompressedFrames.CountItems() > 0
+				|| fNV12Frames.CountItems() > 0;
+		case B_RGB24:
+			return true;
+		default:
+			return CamDevice::SupportsColorSpace(space);
+	}
+}
+
+
 // PHASE 4: Resolution fallback implementation
 status_t
 UVCCamDevice::ReduceResolution()
 {
 	// Get the list of available frames
-	BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+	BList* frameList = _StreamFrames();
 	if (frameList->CountItems() <= 1) {
 		syslog(LOG_WARNING, "UVCCamDevice::ReduceResolution: "
 			"Already at minimum resolution (only 1 resolution available)\n");
@@ -1264,10 +1726,8 @@ UVCCamDevice::ReduceResolution()
 		"Reducing resolution from %ux%u to %ux%u due to high packet loss\n",
 		currentWidth, currentHeight, bestWidth, bestHeight);
 
-	// Apply the new resolution
-	uint32 newWidth = bestWidth;
-	uint32 newHeight = bestHeight;
-	status_t result = AcceptVideoFrame(newWidth, newHeight);
+	// Apply the new resolution; the producer follows on its own
+	status_t result = _SwitchVideoFrame(bestWidth, bestHeight);
 
 	if (result == B_OK) {
 		// Reset packet statistics after resolution change
@@ -1286,38 +1746,39 @@ UVCCamDevice::ReduceResolution()
 }
 
 
-status_t
-UVCCamDevice::_ProbeCommitFormat()
+void
+UVCCamDevice::_BuildProbeRequest(usb_video_probe_and_commit_controls* _request)
 {
-	if (fDevice == NULL)
-		return B_ERROR;
-
-	usb_video_probe_and_commit_controls request;
+	usb_video_probe_and_commit_controls& request = *_request;
 	memset(&request, 0, sizeof(request));
 	request._hint.frame_interval = 1;
 
 	/* FIX: Use frame interval from device descriptor instead of hardcoded 30fps */
 	uint32 frameInterval = 333333;  // Default 30 fps
-	BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
-	uint32 frameIndex = fIsMJPEG ? fMJPEGFrameIndex : fUncompressedFrameIndex;
+	BList* frameList = _StreamFrames();
+	uint32 frameIndex = _StreamFrameIndex();
 
 	if (frameIndex > 0 && frameIndex <= (uint32)frameList->CountItems()) {
 		const usb_video_frame_descriptor* frameDesc =
 			(const usb_video_frame_descriptor*)frameList->ItemAt(frameIndex - 1);
 		if (frameDesc != NULL) {
-			/* Use default_frame_interval from descriptor */
-			frameInterval = frameDesc->default_frame_interval;
-			syslog(LOG_INFO, "UVCCamDevice: Using device frame interval %u (%.1f fps)\n",
+			/* The interval AcceptFrameRate() took, on what this frame
+			 * advertises, or its default_frame_interval */
+			frameInterval = fRequestedFrameInterval != 0
+				? _NearestFrameInterval(frameDesc, fRequestedFrameInterval)
+				: frameDesc->default_frame_interval;
+			syslog(LOG_INFO, "UVCCamDevice: Using device frame interval %u (%.2f fps)\n",
 				frameInterval, 10000000.0f / frameInterval);
 
-			/* For YUY2 (uncompressed), adapt FPS to available bandwidth.
+			/* For YUY2 and NV12 (uncompressed), adapt FPS to available bandwidth.
 			 * High-bandwidth endpoints are now supported with modified EHCI.
 			 * Calculate max achievable FPS and request that if lower than default.
 			 */
 			if (!fIsMJPEG) {
 				uint32 maxBandwidth = _GetMaxAvailableBandwidth();
 				if (maxBandwidth > 0) {
-					uint32 frameSize = frameDesc->width * frameDesc->height * 2;
+					uint32 frameSize = _UncompressedFrameSize(frameDesc->width,
+						frameDesc->height);
 					// USB 2.0 high-speed: 8000 microframes/second
 					uint32 bytesPerSecond = maxBandwidth * 8000;
 					float maxFps = (float)bytesPerSecond / frameSize;
@@ -1332,28 +1793,76 @@ UVCCamDevice::_ProbeCommitFormat()
 
 					// If adapted interval is larger (slower fps), use it
 					if (adaptedInterval > frameInterval) {
-						syslog(LOG_INFO, "UVCCamDevice: YUY2 bandwidth check: max=%u bytes/uframe, frameSize=%u\n",
-							maxBandwidth, frameSize);
+						syslog(LOG_INFO, "UVCCamDevice: %s bandwidth check: max=%u bytes/uframe, frameSize=%u\n",
+							fIsNV12 ? "NV12" : "YUY2", maxBandwidth, frameSize);
 						syslog(LOG_INFO, "UVCCamDevice: Adapting FPS: %.1f -> %.1f (interval %u -> %u)\n",
 							10000000.0f / frameInterval, safeFps, frameInterval, adaptedInterval);
 						frameInterval = adaptedInterval;
 					} else {
-						syslog(LOG_INFO, "UVCCamDevice: YUY2 bandwidth OK: max=%u bytes/uframe (%.1f MB/s), requesting %.1f fps\n",
-							maxBandwidth, bytesPerSecond / 1048576.0f, 10000000.0f / frameInterval);
+						syslog(LOG_INFO, "UVCCamDevice: %s bandwidth OK: max=%u bytes/uframe (%.1f MB/s), requesting %.1f fps\n",
+							fIsNV12 ? "NV12" : "YUY2", maxBandwidth, bytesPerSecond / 1048576.0f, 10000000.0f / frameInterval);
 					}
 				}
 			}
 		}
 	}
+
+	// The bandwidth controller's frame rate cap, on an interval the frame
+	// descriptor advertises
+	if (fFrameIntervalLimit > frameInterval) {
+		uint32 limited = _LimitFrameInterval(_CurrentFrameDescriptor(),
+			fFrameIntervalLimit);
+		syslog(LOG_INFO, "UVCCamDevice: Frame rate capped: %.1f -> %.1f fps\n",
+			10000000.0f / frameInterval, 10000000.0f / limited);
+		frameInterval = limited;
+	}
 	request.frame_interval = frameInterval;
 
 	if (fIsMJPEG) {
 		request.format_index = fMJPEGFormatIndex;
 		request.frame_index = fMJPEGFrameIndex;
+	} else if (fIsNV12) {
+		request.format_index = fNV12FormatIndex;
+		request.frame_index = fNV12FrameIndex;
 	} else {
 		request.format_index = fUncompressedFormatIndex;
 		request.frame_index = fUncompressedFrameIndex;
 	}
+}
+
+
+bool
+UVCCamDevice::_NegotiationKey(
+	const usb_video_probe_and_commit_controls& request,
+	uvc_negotiation_key* key)
+{
+	const char* mode = getenv("WEBCAM_NEGOTIATION_CACHE");
+	if (mode != NULL && (strcmp(mode, "0") == 0 || strcmp(mode, "off") == 0))
+		return false;
+	if (fDevice == NULL)
+		return false;
+
+	key->identity.vendor_id = fDevice->VendorID();
+	key->identity.product_id = fDevice->ProductID();
+	const char* serial = fDevice->SerialNumberString();
+	key->identity.serial_number = serial != NULL ? serial : "";
+	key->device_version = fDevice->Version();
+	key->format_index = request.format_index;
+	key->frame_index = request.frame_index;
+	key->frame_interval = request.frame_interval;
+	key->high_bandwidth = _ShouldUseHighBandwidth();
+	key->alternate_policy = _EffectiveAlternatePolicy();
+	return true;
+}
+
+
+status_t
+UVCCamDevice::_ProbeCommitFormat(
+	const usb_video_probe_and_commit_controls& request,
+	uvc_negotiation* negotiation)
+{
+	if (fDevice == NULL)
+		return B_ERROR;
 
 	size_t length = fHeaderDescriptor->version > 0x100 ? 34 : 26;
 
@@ -1366,7 +1875,8 @@ UVCCamDevice::_ProbeCommitFormat()
 	// SET_CUR Probe
 	size_t actualLength = fDevice->ControlTransfer(
 		USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_OUT, USB_VIDEO_RC_SET_CUR,
-		USB_VIDEO_VS_PROBE_CONTROL << 8, fStreamingIndex, length, &request);
+		USB_VIDEO_VS_PROBE_CONTROL << 8, fStreamingIndex, length,
+		(void*)&request);
 	if (actualLength != length) {
 		syslog(LOG_ERR, "UVC Probe SET_CUR failed: expected %zu, got %zu\n", length, actualLength);
 		return B_ERROR;
@@ -1404,8 +1914,26 @@ UVCCamDevice::_ProbeCommitFormat()
 	// CRITICAL FIX: Commit must use NEGOTIATED values from response, not original request!
 	// The device may have modified parameters during probe negotiation.
 	// Using request instead of response causes format mismatch and corrupted frames.
+	status_t err = _CommitFormat(response, length);
+	if (err != B_OK)
+		return err;
+
+	negotiation->committed = response;
+	negotiation->length = length;
+	return B_OK;
+}
+
+
+status_t
+UVCCamDevice::_CommitFormat(
+	const usb_video_probe_and_commit_controls& committed, size_t length)
+{
+	if (fDevice == NULL)
+		return B_ERROR;
+
 	// SET_CUR Commit with negotiated parameters
-	actualLength = fDevice->ControlTransfer(
+	usb_video_probe_and_commit_controls response = committed;
+	size_t actualLength = fDevice->ControlTransfer(
 		USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_OUT, USB_VIDEO_RC_SET_CUR,
 		USB_VIDEO_VS_COMMIT_CONTROL << 8, fStreamingIndex, length, &response);
 	if (actualLength != length) {
@@ -1415,12 +1943,139 @@ UVCCamDevice::_ProbeCommitFormat()
 
 	fMaxVideoFrameSize = response.max_video_frame_size;
 	fMaxPayloadTransferSize = response.max_payload_transfer_size;
+	fCommittedFrameInterval = response.frame_interval;
+	// Frame timing and the adaptive timeouts follow the rate the camera
+	// took, which bandwidth limits may have made slower than the asked one
+	if (fCommittedFrameInterval > 0) {
+		fFrameRate = 10000000.0f / fCommittedFrameInterval;
+		SetExpectedFrameRate(fFrameRate);
+	}
+
+	// PTS/SCR tick rate: UVC 1.1 reports it in the commit block, 1.0 only
+	// in the VC header
+	uint32 clockFrequency = fHeaderDescriptor->clockFrequency;
+	if (length >= 34 && response.clock_frequency != 0)
+		clockFrequency = response.clock_frequency;
+	((UVCDeframer*)fDeframer)->SetClockFrequency(clockFrequency);
 
 	syslog(LOG_INFO, "UVC Commit successful: maxPayload=%u\n", fMaxPayloadTransferSize);
 	return B_OK;
 }
 
 
+/* The USB Kit has endpoint and interface descriptors, but not the
+ * SuperSpeed endpoint companions after them: they are read from the raw
+ * configuration descriptor and kept for the streaming interface. On a
+ * high speed port the device reports a configuration without them. */
+void
+UVCCamDevice::_ReadSuperSpeedCompanions(const BUSBConfiguration* config,
+	const BUSBInterface* streaming)
+{
+	fSSCompanionCount = 0;
+	if (config == NULL || streaming == NULL || streaming->Descriptor() == NULL)
+		return;
+
+	uint8 header[sizeof(usb_configuration_descriptor)];
+	size_t length = fDevice->GetDescriptor(USB_DESCRIPTOR_CONFIGURATION,
+		config->Index(), 0, header, sizeof(header));
+	if (length < sizeof(header))
+		return;
+	size_t totalLength = header[2] | (header[3] << 8);
+	if (totalLength <= sizeof(header))
+		return;
+
+	uint8* data = (uint8*)malloc(totalLength);
+	if (data == NULL)
+		return;
+	length = fDevice->GetDescriptor(USB_DESCRIPTOR_CONFIGURATION,
+		config->Index(), 0, data, totalLength);
+	if (length > totalLength)
+		length = 0;
+
+	uint8 streamingNumber = streaming->Descriptor()->interface_number;
+	int32 interfaceNumber = -1;
+	int32 alternateSetting = -1;
+	int32 endpointAddress = -1;		// endpoint a companion would belong to
+
+	for (size_t pos = 0; pos + 2 <= length; pos += data[pos]) {
+		uint8 descriptorLength = data[pos];
+		uint8 type = data[pos + 1];
+		if (descriptorLength < 2 || pos + descriptorLength > length)
+			break;
+
+		if (type == USB_DESCRIPTOR_INTERFACE && descriptorLength >= 9) {
+			interfaceNumber = data[pos + 2];
+			alternateSetting = data[pos + 3];
+			endpointAddress = -1;
+		} else if (type == USB_DESCRIPTOR_ENDPOINT && descriptorLength >= 7) {
+			endpointAddress = data[pos + 2];
+		} else if (type == USB_DESCRIPTOR_ENDPOINT_SS_COMPANION
+			&& descriptorLength >= 6 && endpointAddress >= 0
+			&& interfaceNumber == streamingNumber
+			&& fSSCompanionCount < kMaxSSCompanions) {
+			uvc_ss_companion& companion = fSSCompanions[fSSCompanionCount++];
+			companion.alternate = alternateSetting;
+			companion.endpoint = endpointAddress;
+			companion.max_burst = data[pos + 2];
+			companion.mult = data[pos + 3] & 0x3;
+			companion.bytes_per_interval = data[pos + 4] | (data[pos + 5] << 8);
+			endpointAddress = -1;
+
+			syslog(LOG_INFO, "UVCCamDevice: SuperSpeed alt %u EP 0x%02x: "
+				"burst %u, mult %u, %u bytes/interval\n", companion.alternate,
+				companion.endpoint, companion.max_burst + 1, companion.mult + 1,
+				companion.bytes_per_interval);
+		}
+	}
+
+	free(data);
+}
+
+
+/* Bytes per service interval of an ISO input endpoint of 'alternate'.
+ * SuperSpeed bursts are not the USB 2 high-bandwidth mult the EHCI
+ * workaround is about, so callers only gate USB 2 endpoints on it. */
+bool
+UVCCamDevice::_IsoEndpointBandwidth(const BUSBInterface* alternate,
+	const BUSBEndpoint* endpoint, uvc_iso_bandwidth* bandwidth) const
+{
+	if (alternate == NULL || endpoint == NULL || !endpoint->IsIsochronous()
+		|| !endpoint->IsInput())
+		return false;
+
+	// USB 2.0: bits 12:11 are the additional transactions per microframe
+	uint32 rawMaxPacketSize = endpoint->MaxPacketSize();
+	bandwidth->packet_size = rawMaxPacketSize & 0x7FF;
+	bandwidth->packets = ((rawMaxPacketSize >> 11) & 0x3) + 1;
+	bandwidth->bytes = bandwidth->packet_size * bandwidth->packets;
+	bandwidth->superspeed = false;
+
+	if (fSSCompanionCount == 0 || alternate->Descriptor() == NULL
+		|| endpoint->Descriptor() == NULL)
+		return true;
+
+	uint8 alternateSetting = alternate->Descriptor()->alternate_setting;
+	uint8 address = endpoint->Descriptor()->endpoint_address;
+	for (int32 i = 0; i < fSSCompanionCount; i++) {
+		const uvc_ss_companion& companion = fSSCompanions[i];
+		if (companion.alternate != alternateSetting
+			|| companion.endpoint != address)
+			continue;
+
+		// SuperSpeed: wMaxPacketSize is 1024 without mult bits, a service
+		// interval carries bursts of up to 16 packets, up to 3 of them
+		bandwidth->packets = (companion.max_burst + 1) * (companion.mult + 1);
+		uint32 maxBytes = bandwidth->packet_size * bandwidth->packets;
+		bandwidth->bytes = companion.bytes_per_interval;
+		if (bandwidth->bytes == 0 || bandwidth->bytes > maxBytes)
+			bandwidth->bytes = maxBytes;
+		bandwidth->superspeed = true;
+		break;
+	}
+	return true;
+}
+
+
 uint32
 UVCCamDevice::_GetMaxAvailableBandwidth()
 {
@@ -1451,24 +2106,19 @@ UVCCamDevice::_GetMaxAvailableBandwidth()
 			if (endpoint == NULL)
 				continue;
 
-			if (!endpoint->IsIsochronous() || !endpoint->IsInput())
+			uvc_iso_bandwidth bandwidth;
+			if (!_IsoEndpointBandwidth(alternate, endpoint, &bandwidth))
 				continue;
 
-			// Decode wMaxPacketSize for USB 2.0 high-bandwidth
-			uint32 rawMaxPacketSize = endpoint->MaxPacketSize();
-			uint32 basePacketSize = rawMaxPacketSize & 0x7FF;
-			uint32 transactions = ((rawMaxPacketSize >> 11) & 0x3) + 1;
-			uint32 totalBandwidth = basePacketSize * transactions;
-
 			// Use same auto-detection logic as _SelectBestAlternate
 			bool allowHighBandwidth = _ShouldUseHighBandwidth();
 
-			if (transactions > 1 && !allowHighBandwidth)
+			if (!bandwidth.superspeed && bandwidth.packets > 1
+				&& !allowHighBandwidth)
 				continue;
 
-			uint32 effectiveBandwidth = (transactions > 1 && allowHighBandwidth) ? totalBandwidth : basePacketSize;
-			if (effectiveBandwidth > maxBandwidth)
-				maxBandwidth = effectiveBandwidth;
+			if (bandwidth.bytes > maxBandwidth)
+				maxBandwidth = bandwidth.bytes;
 		}
 	}
 
@@ -1476,8 +2126,19 @@ UVCCamDevice::_GetMaxAvailableBandwidth()
 }
 
 
+uvc_alternate_policy
+UVCCamDevice::_EffectiveAlternatePolicy() const
+{
+	const char* maxBandwidth = getenv("WEBCAM_MAX_BANDWIDTH");
+	if (maxBandwidth != NULL && (strcmp(maxBandwidth, "1") == 0
+			|| strcmp(maxBandwidth, "yes") == 0))
+		return UVC_ALTERNATE_MAXIMUM;
+	return fAlternatePolicy;
+}
+
+
 status_t
-UVCCamDevice::_SelectBestAlternate()
+UVCCamDevice::_SelectBestAlternate(uvc_negotiation* negotiation)
 {
 	if (fDevice == NULL)
 		return B_ERROR;
@@ -1494,16 +2155,34 @@ UVCCamDevice::_SelectBestAlternate()
 		requiredBandwidth = fMaxPayloadTransferSize;
 		syslog(LOG_INFO, "UVCCamDevice: Required bandwidth from probe: %u bytes\n",
 			requiredBandwidth);
-	}
+	} else if (fMaxVideoFrameSize > 0 && fCommittedFrameInterval > 0) {
+		/* No payload size committed: one frame per interval, spread over
+		 * the microframes, plus a payload header in each packet */
+		uint64 bytesPerSecond = (uint64)fMaxVideoFrameSize * 10000000
+			/ fCommittedFrameInterval;
+		requiredBandwidth = (uint32)((bytesPerSecond + 7999) / 8000) + 12;
+		syslog(LOG_INFO, "UVCCamDevice: Required bandwidth from frame size: "
+			"%u bytes\n", requiredBandwidth);
+	}
+
+	/* With several cameras on one controller, each must reserve only the
+	 * periodic bandwidth its stream needs, or the first one to start
+	 * starves the others. The largest alternate is only picked on request
+	 * or when nothing smaller is known to fit. */
+	uvc_alternate_policy policy = _EffectiveAlternatePolicy();
 
 	/* Scan all alternates and log bandwidth options */
 	syslog(LOG_INFO, "UVCCamDevice: Scanning %u alternate settings for bandwidth\n",
 		(unsigned)streaming->CountAlternates());
 
-	// Select LARGEST bandwidth alternate for best quality
-	uint32 bestBandwidth = 0;
-	uint32 alternateIndex = 0;
-	uint32 endpointIndex = 0;
+	// Largest alternate, and the smallest one that carries the payload
+	uint32 largestBandwidth = 0;
+	uint32 largestAlternate = 0;
+	uint32 largestEndpoint = 0;
+	uint32 fitBandwidth = 0;
+	uint32 fitTransactions = 0;
+	uint32 fitAlternate = 0;
+	uint32 fitEndpoint = 0;
 
 	for (uint32 i = 0; i < streaming->CountAlternates(); i++) {
 		const BUSBInterface* alternate = streaming->AlternateAt(i);
@@ -1511,17 +2190,18 @@ UVCCamDevice::_SelectBestAlternate()
 		for (uint32 j = 0; j < alternate->CountEndpoints(); j++) {
 			const BUSBEndpoint* endpoint = alternate->EndpointAt(j);
 
-			if (!endpoint->IsIsochronous() || !endpoint->IsInput())
+			// wMaxPacketSize for USB 2.0 high-bandwidth endpoints, the
+			// companion descriptor for SuperSpeed ones
+			uvc_iso_bandwidth bandwidth;
+			if (!_IsoEndpointBandwidth(alternate, endpoint, &bandwidth))
 				continue;
+			uint32 transactions = bandwidth.packets;
 
-			// Decode wMaxPacketSize for USB 2.0 high-bandwidth endpoints
-			uint32 rawMaxPacketSize = endpoint->MaxPacketSize();
-			uint32 basePacketSize = rawMaxPacketSize & 0x7FF;
-			uint32 transactions = ((rawMaxPacketSize >> 11) & 0x3) + 1;
-			uint32 maxPacketSize = basePacketSize * transactions;
-
-			syslog(LOG_INFO, "UVCCamDevice: Alt %u EP %u: raw=0x%04x base=%u trans=%u total=%u bytes\n",
-				i, j, rawMaxPacketSize, basePacketSize, transactions, maxPacketSize);
+			syslog(LOG_INFO, "UVCCamDevice: Alt %u EP %u: raw=0x%04x base=%u "
+				"%s=%u total=%u bytes\n", i, j,
+				(unsigned)endpoint->MaxPacketSize(), bandwidth.packet_size,
+				bandwidth.superspeed ? "ss packets" : "trans", transactions,
+				bandwidth.bytes);
 
 			/* HIGH-BANDWIDTH ENDPOINT HANDLING:
 			 *
@@ -1536,33 +2216,64 @@ UVCCamDevice::_SelectBestAlternate()
 			 *
 			 * If high-bandwidth fails, _OnHighBandwidthFailure() will disable it
 			 * and the stream will restart with low-bandwidth mode.
+			 *
+			 * SuperSpeed bursts go through the xHCI burst fields (TBC/TLBPC,
+			 * patch 0003), never EHCI, so they are not gated on this.
 			 */
 			bool allowHighBandwidth = _ShouldUseHighBandwidth();
 
-			if (transactions > 1 && !allowHighBandwidth) {
+			if (!bandwidth.superspeed && transactions > 1
+				&& !allowHighBandwidth) {
 				syslog(LOG_INFO, "UVCCamDevice: Skipping high-bandwidth endpoint (mult=%u) - %s\n",
 					transactions,
 					(fHighBandwidthTested && !fHighBandwidthWorks) ? "EHCI detected" : "disabled");
 				continue;  // Skip this endpoint
 			}
 
-			if (transactions > 1) {
-				syslog(LOG_INFO, "UVCCamDevice: Trying high-bandwidth endpoint (mult=%u, %u bytes/uframe)\n",
-					transactions, maxPacketSize);
-			}
+			// Bytes per interval (includes mult or burst factor) for the
+			// comparison, so high-bandwidth endpoints are properly considered
+			uint32 effectiveBandwidth = bandwidth.bytes;
 
-			// Use maxPacketSize (includes mult factor) for bandwidth comparison
-			// This ensures high-bandwidth endpoints are properly considered
-			uint32 effectiveBandwidth = (transactions > 1 && allowHighBandwidth) ? maxPacketSize : basePacketSize;
+			if (effectiveBandwidth > largestBandwidth) {
+				largestBandwidth = effectiveBandwidth;
+				largestEndpoint = j;
+				largestAlternate = i;
+			}
 
-			if (effectiveBandwidth > bestBandwidth) {
-				bestBandwidth = effectiveBandwidth;
-				endpointIndex = j;
-				alternateIndex = i;
+			// Among equal fits, fewer transactions per microframe are
+			// easier on the controller
+			if (requiredBandwidth > 0 && effectiveBandwidth >= requiredBandwidth
+				&& (fitBandwidth == 0 || effectiveBandwidth < fitBandwidth
+					|| (effectiveBandwidth == fitBandwidth
+						&& transactions < fitTransactions))) {
+				fitBandwidth = effectiveBandwidth;
+				fitTransactions = transactions;
+				fitEndpoint = j;
+				fitAlternate = i;
 			}
 		}
 	}
 
+	uint32 bestBandwidth = largestBandwidth;
+	uint32 alternateIndex = largestAlternate;
+	uint32 endpointIndex = largestEndpoint;
+	if (policy == UVC_ALTERNATE_MINIMUM) {
+		if (fitBandwidth > 0) {
+			bestBandwidth = fitBandwidth;
+			alternateIndex = fitAlternate;
+			endpointIndex = fitEndpoint;
+		} else if (requiredBandwidth > 0 && largestBandwidth > 0) {
+			syslog(LOG_WARNING, "UVCCamDevice: No alternate carries %u bytes "
+				"per microframe, using the largest (%u)\n", requiredBandwidth,
+				largestBandwidth);
+		}
+	}
+
+	syslog(LOG_INFO, "UVCCamDevice: Alternate policy %s: required %u, "
+		"selected %u of up to %u bytes/uframe\n",
+		policy == UVC_ALTERNATE_MINIMUM ? "minimum" : "maximum",
+		requiredBandwidth, bestBandwidth, largestBandwidth);
+
 	/* Log bandwidth selection result */
 	/* FIX BUG 9: Rimosso messaggio obsoleto - ora usiamo high-bandwidth */
 
@@ -1588,24 +2299,61 @@ UVCCamDevice::_SelectBestAlternate()
 	syslog(LOG_INFO, "UVCCamDevice: Using alternate %u with endpoint %u (bandwidth %u bytes)\n",
 		alternateIndex, endpointIndex, bestBandwidth);
 
-	// WORKAROUND for Haiku bug in BUSBInterface::SetAlternate()
-	// The bug causes a double-free when the number of endpoints changes between alternates.
-	// See USBInterface_fix.patch for the proper fix to submit to Haiku.
-	//
-	// Mitigation strategy:
-	// 1. Only call SetAlternate if truly necessary (already implemented above)
-	// 2. If we must change, try to minimize the impact by staying on similar alternates
-	// 3. Log extensively to help diagnose crashes
-	if (fCurrentVideoAlternate != alternateIndex) {
-		syslog(LOG_INFO, "UVCCamDevice: Changing alternate from %u to %u (Haiku bug risk!)\n",
-			fCurrentVideoAlternate, alternateIndex);
+	status_t err = _UseAlternate(alternateIndex, endpointIndex, bestBandwidth);
+	if (err != B_OK)
+		return err;
 
-		// Log endpoint counts to help diagnose the Haiku bug
-		const BUSBInterface* oldAlt = streaming->AlternateAt(fCurrentVideoAlternate);
-		const BUSBInterface* newAlt = streaming->AlternateAt(alternateIndex);
-		if (oldAlt && newAlt) {
-			syslog(LOG_INFO, "UVCCamDevice: Endpoint count: old=%u new=%u\n",
-				(unsigned)oldAlt->CountEndpoints(), (unsigned)newAlt->CountEndpoints());
+	negotiation->alternate = alternateIndex;
+	negotiation->endpoint = endpointIndex;
+	negotiation->bandwidth = bestBandwidth;
+	return B_OK;
+}
+
+
+status_t
+UVCCamDevice::_UseAlternate(uint32 alternateIndex, uint32 endpointIndex,
+	uint32 bandwidth)
+{
+	if (fDevice == NULL)
+		return B_ERROR;
+
+	const BUSBConfiguration* config = fDevice->ActiveConfiguration();
+	const BUSBInterface* streaming = config->InterfaceAt(fStreamingIndex);
+	if (streaming == NULL)
+		return B_BAD_INDEX;
+
+	// A cached choice must still name an ISO input endpoint of that size
+	const BUSBInterface* target = streaming->AlternateAt(alternateIndex);
+	const BUSBEndpoint* targetEndpoint = target != NULL
+		? target->EndpointAt(endpointIndex) : NULL;
+	if (targetEndpoint == NULL || !targetEndpoint->IsIsochronous()
+		|| !targetEndpoint->IsInput())
+		return B_BAD_INDEX;
+	uvc_iso_bandwidth endpointBandwidth;
+	if (!_IsoEndpointBandwidth(target, targetEndpoint, &endpointBandwidth))
+		return B_BAD_INDEX;
+	if (bandwidth != endpointBandwidth.packet_size
+		&& bandwidth != endpointBandwidth.bytes)
+		return B_BAD_VALUE;
+
+	// WORKAROUND for Haiku bug in BUSBInterface::SetAlternate()
+	// The bug causes a double-free when the number of endpoints changes between alternates.
+	// See USBInterface_fix.patch for the proper fix to submit to Haiku.
+	//
+	// Mitigation strategy:
+	// 1. Only call SetAlternate if truly necessary (already implemented above)
+	// 2. If we must change, try to minimize the impact by staying on similar alternates
+	// 3. Log extensively to help diagnose crashes
+	if (fCurrentVideoAlternate != alternateIndex) {
+		syslog(LOG_INFO, "UVCCamDevice: Changing alternate from %u to %u (Haiku bug risk!)\n",
+			fCurrentVideoAlternate, alternateIndex);
+
+		// Log endpoint counts to help diagnose the Haiku bug
+		const BUSBInterface* oldAlt = streaming->AlternateAt(fCurrentVideoAlternate);
+		const BUSBInterface* newAlt = streaming->AlternateAt(alternateIndex);
+		if (oldAlt && newAlt) {
+			syslog(LOG_INFO, "UVCCamDevice: Endpoint count: old=%u new=%u\n",
+				(unsigned)oldAlt->CountEndpoints(), (unsigned)newAlt->CountEndpoints());
 		}
 
 		status_t setAltResult = ((BUSBInterface*)streaming)->SetAlternate(alternateIndex);
@@ -1623,8 +2371,9 @@ UVCCamDevice::_SelectBestAlternate()
 			return B_BAD_INDEX;
 	}
 
+	BAutolock transferLock(fTransferLock);
 	fIsoIn = streaming->EndpointAt(endpointIndex);
-	fIsoMaxPacketSize = bestBandwidth;
+	fIsoMaxPacketSize = bandwidth;
 
 	// Buffer size must be exactly packetSize * numPackets for EHCI alignment
 	// OPTIMIZATION: Use 32 packets (max) to reduce transfer overhead and improve
@@ -1632,22 +2381,24 @@ UVCCamDevice::_SelectBestAlternate()
 	const uint32 kInitialPackets = 32;
 	uint32 requiredBufferSize = fIsoMaxPacketSize * kInitialPackets;
 
-	if (requiredBufferSize != fBufferLen || fBuffer == NULL) {
-		free(fBuffer);
-		fBuffer = (uint8*)malloc(requiredBufferSize);
-		if (fBuffer == NULL)
-			return B_NO_MEMORY;
-		fBufferLen = requiredBufferSize;
-	}
+	// The area only grows, so switching alternates does not reallocate
+	status_t status = fTransferArea.Reserve(requiredBufferSize);
+	if (status != B_OK)
+		return status;
+	fBuffer = fTransferArea.Data();
+	fBufferLen = requiredBufferSize;
 
-	// Track if we're using high-bandwidth for auto-detection
-	// Check the selected endpoint to see if it's high-bandwidth
+	// Track if we're using high-bandwidth for auto-detection. Only USB 2
+	// mult counts: a SuperSpeed burst failing says nothing about EHCI.
 	if (fIsoIn != NULL) {
-		uint32 rawMaxPacketSize = fIsoIn->MaxPacketSize();
-		uint32 transactions = ((rawMaxPacketSize >> 11) & 0x3) + 1;
-		fUsingHighBandwidth = (transactions > 1);
+		uint32 transactions = endpointBandwidth.packets;
+		fUsingHighBandwidth = !endpointBandwidth.superspeed && transactions > 1;
 		if (fUsingHighBandwidth) {
 			syslog(LOG_INFO, "UVCCamDevice: High-bandwidth mode active (mult=%u)\n", transactions);
+		} else if (endpointBandwidth.superspeed) {
+			syslog(LOG_INFO, "UVCCamDevice: SuperSpeed ISO, %u packets of %u "
+				"bytes, %u bytes/interval\n", transactions,
+				endpointBandwidth.packet_size, endpointBandwidth.bytes);
 		}
 	}
 
@@ -1696,6 +2447,7 @@ UVCCamDevice::_SelectIdleAlternate()
 	}
 
 	// Invalidate endpoint references - the endpoint is no longer valid for transfers
+	BAutolock transferLock(fTransferLock);
 	fIsoIn = NULL;
 	fIsoMaxPacketSize = 0;
 
@@ -1703,6 +2455,49 @@ UVCCamDevice::_SelectIdleAlternate()
 }
 
 
+/* Bulk payloads only have their header at the start, and a transfer only
+ * ends between payloads when it is a whole number of them: the transfers
+ * are sized to that, up to about a frame. */
+status_t
+UVCCamDevice::_UseBulkEndpoint()
+{
+	if (fBulkIn == NULL)
+		return B_BAD_INDEX;
+
+	size_t packetSize = fBulkIn->MaxPacketSize();
+	if (packetSize == 0)
+		packetSize = 512;
+	size_t payloadSize = fMaxPayloadTransferSize;
+
+	size_t transferSize = CamConfig::kUVCBulkTransferSize;
+	if (fMaxVideoFrameSize > 0
+		&& fMaxVideoFrameSize + payloadSize < transferSize)
+		transferSize = fMaxVideoFrameSize + payloadSize;
+	if (payloadSize > 0) {
+		if (transferSize < payloadSize)
+			transferSize = payloadSize;
+		transferSize -= transferSize % payloadSize;
+	}
+	// The device may send a full packet at the end of any payload
+	transferSize = (transferSize + packetSize - 1) / packetSize * packetSize;
+
+	BAutolock transferLock(fTransferLock);
+	if (fTransferArea.Reserve(transferSize) != B_OK) {
+		fBuffer = NULL;
+		fBufferLen = 0;
+		return B_NO_MEMORY;
+	}
+	fBuffer = fTransferArea.Data();
+	fBufferLen = transferSize;
+
+	((UVCDeframer*)fDeframer)->SetBulkPayloadSize(payloadSize);
+
+	syslog(LOG_INFO, "UVCCamDevice: Bulk streaming, %zu byte transfers of "
+		"%zu byte payloads\n", transferSize, payloadSize);
+	return B_OK;
+}
+
+
 /* Audio Transfer Methods */
 
 status_t
@@ -1772,52 +2567,30 @@ UVCCamDevice::StartAudioTransfer()
 			(int)sampleRate, (int)transferred);
 	}
 
-	// Allocate ring buffer for audio data (64KB)
-	fAudioRingSize = 65536;
-	fAudioRingBuffer = (uint8*)malloc(fAudioRingSize);
-	if (!fAudioRingBuffer) {
-		syslog(LOG_ERR, "UVCCamDevice::StartAudioTransfer: Failed to allocate ring buffer\n");
-		_SelectAudioIdleAlternate();
-		return B_NO_MEMORY;
-	}
-	fAudioRingHead = 0;
-	fAudioRingTail = 0;
-
-	// Create semaphore for ring buffer synchronization
-	fAudioRingSem = create_sem(0, "audio ring buffer");
-	if (fAudioRingSem < 0) {
-		syslog(LOG_ERR, "UVCCamDevice::StartAudioTransfer: Failed to create semaphore\n");
-		free(fAudioRingBuffer);
-		fAudioRingBuffer = NULL;
+	err = _StartAudioTransfers();
+	if (err != B_OK) {
+		syslog(LOG_ERR, "UVCCamDevice::StartAudioTransfer: Failed to set up "
+			"audio ring: %s\n", strerror(err));
 		_SelectAudioIdleAlternate();
-		return B_ERROR;
+		return err;
 	}
 
 	// Mark as running before starting thread
 	fAudioTransferRunning = true;
 
 	// Start audio pump thread
+	fAudioPumpSchedule.Reset();
 	fAudioPumpThread = spawn_thread(_audio_pump_thread_, "audio pump",
-		B_REAL_TIME_PRIORITY, this);
-	if (fAudioPumpThread < 0) {
-		syslog(LOG_ERR, "UVCCamDevice::StartAudioTransfer: Failed to spawn thread\n");
-		fAudioTransferRunning = false;
-		delete_sem(fAudioRingSem);
-		fAudioRingSem = -1;
-		free(fAudioRingBuffer);
-		fAudioRingBuffer = NULL;
-		_SelectAudioIdleAlternate();
-		return B_ERROR;
-	}
-
-	if (resume_thread(fAudioPumpThread) != B_OK) {
-		syslog(LOG_ERR, "UVCCamDevice::StartAudioTransfer: Failed to resume thread\n");
+		fThreadPolicy.Priority(CAM_THREAD_AUDIO_PUMP), this);
+	fThreadPolicy.Apply(fAudioPumpThread, CAM_THREAD_AUDIO_PUMP);
+	if (fAudioPumpThread < 0 || resume_thread(fAudioPumpThread) != B_OK) {
+		syslog(LOG_ERR, "UVCCamDevice::StartAudioTransfer: Failed to start "
+			"pump thread\n");
 		fAudioTransferRunning = false;
-		kill_thread(fAudioPumpThread);
-		delete_sem(fAudioRingSem);
-		fAudioRingSem = -1;
-		free(fAudioRingBuffer);
-		fAudioRingBuffer = NULL;
+		if (fAudioPumpThread >= 0)
+			kill_thread(fAudioPumpThread);
+		fAudioPumpThread = -1;
+		_StopAudioTransfers();
 		_SelectAudioIdleAlternate();
 		return B_ERROR;
 	}
@@ -1835,24 +2608,15 @@ UVCCamDevice::StopAudioTransfer()
 	// Signal thread to stop
 	fAudioTransferRunning = false;
 
-	// Wake up thread if waiting on semaphore
-	if (fAudioRingSem >= 0) {
-		delete_sem(fAudioRingSem);
-		fAudioRingSem = -1;
-	}
-
-	// Wait for thread to exit
+	// Wait for thread to exit; it polls fAudioTransferRunning at least
+	// every 100ms while waiting on a transfer or for ring space
 	if (fAudioPumpThread >= 0) {
 		status_t threadStatus;
 		wait_for_thread_etc(fAudioPumpThread, B_RELATIVE_TIMEOUT, 5000000, &threadStatus);
 		fAudioPumpThread = -1;
 	}
 
-	// Free ring buffer
-	if (fAudioRingBuffer) {
-		free(fAudioRingBuffer);
-		fAudioRingBuffer = NULL;
-	}
+	_StopAudioTransfers();
 
 	// Set audio interface to idle
 	_SelectAudioIdleAlternate();
@@ -1861,50 +2625,314 @@ UVCCamDevice::StopAudioTransfer()
 }
 
 
-size_t
-UVCCamDevice::ReadAudioData(void* buffer, size_t size)
+void
+uvc_audio_layout_for(bigtime_t bufferDuration, bigtime_t downstreamLatency,
+	uvc_audio_layout* layout)
 {
-	if (fAudioRingBuffer == NULL || buffer == NULL || size == 0)
-		return 0;
+	// Enough queued to ride out this much of a late pump, and a ring of at
+	// least this much audio, as the producer keeps a backlog
+	const int32 kQueuedMilliseconds = 24;
+	const int32 kRingMilliseconds = 256;
 
-	// FIX BUG 4: Usare operazioni atomiche per il ring buffer
-	// Wait for enough data (with timeout)
-	int retries = 50;  // 50 x 1ms = 50ms max wait
-	size_t available = 0;
+	int32 packets = 8;
+	if (downstreamLatency > 0) {
+		packets = (int32)((downstreamLatency + bufferDuration) / 4000);
+		packets = max_c(4, min_c(packets, kAudioMaxPacketsPerTransfer));
+	}
 
-	while (retries-- > 0) {
-		int32 head = atomic_get(&fAudioRingHead);
-		int32 tail = atomic_get(&fAudioRingTail);
+	int32 inFlight = (kQueuedMilliseconds + packets - 1) / packets + 1;
+	inFlight = max_c(2, min_c(inFlight, kAudioMaxTransfersInFlight));
+
+	// Twice what the consumer takes at once, besides the queued blocks
+	int32 consumed = (int32)((bufferDuration + packets * 1000 - 1)
+		/ (packets * 1000));
+	int32 blocks = max_c(kRingMilliseconds / packets, 2 * consumed + inFlight);
+	blocks = max_c(inFlight + 2, min_c(blocks, kAudioMaxRingBlocks));
+
+	layout->packets_per_transfer = packets;
+	layout->transfers_in_flight = inFlight;
+	layout->ring_blocks = blocks;
+}
+
+
+status_t
+UVCCamDevice::SetAudioLatency(bigtime_t bufferDuration,
+	bigtime_t downstreamLatency)
+{
+	if (fAudioTransferRunning)
+		return B_BUSY;
+
+	uvc_audio_layout_for(bufferDuration, downstreamLatency, &fAudioLayout);
+	return B_OK;
+}
+
+
+/* Lays out the audio ring and starts one submission thread per in-flight
+ * transfer. Packets are sized for one USB frame of audio plus one sample
+ * frame of slack, as adaptive endpoints send at 44.1kHz one extra frame now
+ * and then; the host controller writes each at packet index * size. */
+status_t
+UVCCamDevice::_StartAudioTransfers()
+{
+	size_t frameBytes = fAudioChannels * fAudioSubFrameSize;
+	size_t packetSize = (fAudioSampleRate / 1000 + 1) * frameBytes;
+	if (packetSize == 0 || packetSize > fAudioMaxPacketSize)
+		packetSize = fAudioMaxPacketSize;
+	if (packetSize == 0)
+		return B_BAD_VALUE;
+
+	size_t blockSize = packetSize * fAudioLayout.packets_per_transfer;
+	// The host controller writes straight into the ring, so it is locked;
+	// the area outlives the stream and is reused when audio starts again
+	status_t status = fAudioRingArea.Reserve(blockSize
+		* fAudioLayout.ring_blocks);
+	if (status != B_OK)
+		return status;
+	fAudioRingData = fAudioRingArea.Data();
+
+	fAudioPacketSize = packetSize;
+	for (int32 i = 0; i < fAudioLayout.ring_blocks; i++)
+		fAudioBlocks[i].data = fAudioRingData + i * blockSize;
+	fAudioBlocksSubmitted = 0;
+	fAudioBlocksCompleted = 0;
+	fAudioBlocksConsumed = 0;
+	fAudioBytesAvailable = 0;
+	fAudioReadPacket = 0;
+	fAudioReadOffset = 0;
+	fAudioBytesReceived = 0;
+	fAudioBytesRead = 0;
+	{
+		BAutolock _(fAudioClockLock);
+		fAudioClock.SetFrequency(fAudioSampleRate);
+	}
+
+	fAudioRingSem = create_sem(0, "audio ring data");
+	fAudioSpaceSem = create_sem(0, "audio ring space");
+	if (fAudioRingSem < 0 || fAudioSpaceSem < 0) {
+		_StopAudioTransfers();
+		return B_NO_MORE_SEMS;
+	}
+
+	if (fAudioOrder.Init("audio transfer turn") != B_OK) {
+		_StopAudioTransfers();
+		return B_NO_MORE_SEMS;
+	}
+
+	fAudioTransferCount = 0;
+	for (int32 i = 0; i < fAudioLayout.transfers_in_flight; i++) {
+		uvc_audio_transfer& transfer = fAudioTransfers[fAudioTransferCount];
+		transfer.device = this;
+		transfer.block = -1;
+		transfer.ticket = 0;
+		transfer.result = 0;
+		transfer.submitted = 0;
+		transfer.completed = 0;
+		transfer.submit = create_sem(0, "audio transfer submit");
+		transfer.complete = create_sem(0, "audio transfer complete");
+		transfer.thread = -1;
+		if (transfer.submit >= 0 && transfer.complete >= 0) {
+			transfer.thread = spawn_thread(_audio_transfer_thread_,
+				"audio transfer", fThreadPolicy.Priority(CAM_THREAD_AUDIO_PUMP),
+				&transfer);
+			fThreadPolicy.Apply(transfer.thread, CAM_THREAD_AUDIO_PUMP);
+		}
+		if (transfer.thread < 0) {
+			if (transfer.submit >= 0)
+				delete_sem(transfer.submit);
+			if (transfer.complete >= 0)
+				delete_sem(transfer.complete);
+			break;
+		}
+		resume_thread(transfer.thread);
+		fAudioTransferCount++;
+	}
+
+	if (fAudioTransferCount == 0) {
+		_StopAudioTransfers();
+		return B_NO_MORE_THREADS;
+	}
+
+	syslog(LOG_INFO, "UVCCamDevice: Audio ring %d x %d packets of %zu bytes, "
+		"%d transfers in flight\n", (int)fAudioLayout.ring_blocks,
+		(int)fAudioLayout.packets_per_transfer, packetSize,
+		(int)fAudioTransferCount);
+	return B_OK;
+}
+
+
+void
+UVCCamDevice::_StopAudioTransfers()
+{
+	// Deleting the submit semaphores ends the idle transfer threads, and
+	// the turn semaphore those waiting to queue; one still in
+	// IsochronousTransfer() exits when its packets are done
+	fAudioOrder.Uninit();
+	for (int32 i = 0; i < fAudioTransferCount; i++)
+		delete_sem(fAudioTransfers[i].submit);
+	for (int32 i = 0; i < fAudioTransferCount; i++) {
+		status_t result;
+		wait_for_thread(fAudioTransfers[i].thread, &result);
+		delete_sem(fAudioTransfers[i].complete);
+	}
+	fAudioTransferCount = 0;
+
+	if (fAudioRingSem >= 0) {
+		delete_sem(fAudioRingSem);
+		fAudioRingSem = -1;
+	}
+	if (fAudioSpaceSem >= 0) {
+		delete_sem(fAudioSpaceSem);
+		fAudioSpaceSem = -1;
+	}
+
+	fAudioRingData = NULL;
+	fAudioBytesAvailable = 0;
+}
 
-		if (head >= tail)
-			available = head - tail;
-		else
-			available = fAudioRingSize - tail + head;
 
-		if (available >= size)
+int32
+UVCCamDevice::_audio_transfer_thread_(void* data)
+{
+	uvc_audio_transfer* transfer = (uvc_audio_transfer*)data;
+	UVCCamDevice* device = transfer->device;
+
+	while (acquire_sem(transfer->submit) == B_OK) {
+		// The pump takes the blocks back in the order it handed them out
+		if (device->fAudioOrder.Enter(transfer->ticket) != B_OK)
 			break;
 
-		snooze(1000);  // Wait 1ms for more data
+		const BUSBEndpoint* endpoint = device->fAudioIsoIn;
+		if (!device->fAudioTransferRunning || endpoint == NULL)
+			transfer->result = B_DEV_NOT_READY;
+		else {
+			uvc_audio_block& block = device->fAudioBlocks[transfer->block];
+			int32 packets = device->fAudioLayout.packets_per_transfer;
+			transfer->result = endpoint->IsochronousTransfer(block.data,
+				device->fAudioPacketSize * packets, block.descriptors,
+				packets);
+		}
+		device->fAudioOrder.Leave();
+		transfer->completed = system_time();
+		release_sem(transfer->complete);
 	}
 
-	if (available == 0)
+	return B_OK;
+}
+
+
+/* Reader side: hands the current block back to the pump. */
+void
+UVCCamDevice::_ConsumeAudioBlock()
+{
+	fAudioReadPacket = 0;
+	fAudioReadOffset = 0;
+	atomic_add(&fAudioBlocksConsumed, 1);
+
+	// Keep the semaphore at one count, the pump only waits when stalled
+	int32 count;
+	if (get_sem_count(fAudioSpaceSem, &count) == B_OK && count <= 0)
+		release_sem_etc(fAudioSpaceSem, 1, B_DO_NOT_RESCHEDULE);
+}
+
+
+size_t
+UVCCamDevice::ReadAudioData(void* buffer, size_t size, bigtime_t* captureTime)
+{
+	if (fAudioRingData == NULL || buffer == NULL || size == 0)
 		return 0;
 
-	// Read up to 'size' bytes (or whatever is available)
-	size_t toRead = (available < size) ? available : size;
-	int32 tail = atomic_get(&fAudioRingTail);
-	size_t firstChunk = fAudioRingSize - tail;
+	if (captureTime != NULL) {
+		size_t frameBytes = fAudioChannels * fAudioSubFrameSize;
+		uint32 frame = (uint32)(fAudioBytesRead / frameBytes);
+		BAutolock _(fAudioClockLock);
+		if (!fAudioClock.DeviceToSystem(frame, captureTime)) {
+			// Not locked yet: assume what is buffered arrived just now
+			*captureTime = system_time() - (bigtime_t)AudioDataAvailable()
+				* 1000000 / ((bigtime_t)fAudioSampleRate * frameBytes);
+		}
+	}
+
+	uint8* output = (uint8*)buffer;
+	size_t copied = 0;
+	int32 completed = atomic_get(&fAudioBlocksCompleted);
 
-	if (firstChunk >= toRead) {
-		memcpy(buffer, fAudioRingBuffer + tail, toRead);
-	} else {
-		memcpy(buffer, fAudioRingBuffer + tail, firstChunk);
-		memcpy((uint8*)buffer + firstChunk, fAudioRingBuffer, toRead - firstChunk);
+	// Straight out of the blocks the transfers wrote, packet by packet
+	while (copied < size && fAudioBlocksConsumed != completed) {
+		uvc_audio_block& block = fAudioBlocks[(uint32)fAudioBlocksConsumed
+			% fAudioLayout.ring_blocks];
+		if (fAudioReadPacket == fAudioLayout.packets_per_transfer) {
+			_ConsumeAudioBlock();
+			continue;
+		}
+
+		size_t length = block.descriptors[fAudioReadPacket].actual_length;
+		if (fAudioReadOffset >= length) {
+			fAudioReadPacket++;
+			fAudioReadOffset = 0;
+			continue;
+		}
+
+		size_t chunk = min_c(length - fAudioReadOffset, size - copied);
+		memcpy(output + copied, block.data
+			+ fAudioReadPacket * fAudioPacketSize + fAudioReadOffset, chunk);
+		copied += chunk;
+		fAudioReadOffset += chunk;
+	}
+
+	atomic_add(&fAudioBytesAvailable, -(int32)copied);
+	fAudioBytesRead += copied;
+	return copied;
+}
+
+
+status_t
+UVCCamDevice::WaitAudioData(size_t bytes, bigtime_t deadline)
+{
+	while (AudioDataAvailable() < bytes) {
+		if (!fAudioTransferRunning)
+			return B_DEV_NOT_READY;
+		status_t err = acquire_sem_etc(fAudioRingSem, 1, B_ABSOLUTE_TIMEOUT,
+			deadline);
+		if (err != B_OK)
+			return err;
 	}
+	return B_OK;
+}
+
+
+size_t
+UVCCamDevice::DiscardAudioData(size_t keep)
+{
+	if (fAudioRingData == NULL)
+		return 0;
+
+	size_t dropped = 0;
+	int32 completed = atomic_get(&fAudioBlocksCompleted);
+	while (fAudioBlocksConsumed != completed
+		&& AudioDataAvailable() - dropped > keep) {
+		uvc_audio_block& block = fAudioBlocks[(uint32)fAudioBlocksConsumed
+			% fAudioLayout.ring_blocks];
+		int32 packets = fAudioLayout.packets_per_transfer;
+		size_t left = 0;
+		for (int32 i = fAudioReadPacket; i < packets; i++)
+			left += block.descriptors[i].actual_length;
+		if (fAudioReadPacket < packets)
+			left -= min_c(fAudioReadOffset, left);
+		dropped += left;
+		_ConsumeAudioBlock();
+	}
+
+	atomic_add(&fAudioBytesAvailable, -(int32)dropped);
+	fAudioBytesRead += dropped;
+	return dropped;
+}
 
-	atomic_set(&fAudioRingTail, (tail + toRead) % fAudioRingSize);
 
-	return toRead;
+int32
+UVCCamDevice::AudioDriftPPM() const
+{
+	BAutolock _(fAudioClockLock);
+	return fAudioClock.DriftPPM();
 }
 
 
@@ -2040,20 +3068,9 @@ UVCCamDevice::_SelectAudioAlternate()
 
 	fAudioMaxPacketSize = bestBandwidth;
 
-	// Allocate audio buffer for isochronous transfers
-	const uint32 kAudioPackets = 16;
-	fAudioBufferLen = fAudioMaxPacketSize * kAudioPackets;
-	fAudioBuffer = (uint8*)malloc(fAudioBufferLen);
-	if (fAudioBuffer == NULL) {
-		syslog(LOG_ERR, "UVCCamDevice: Failed to allocate %u bytes for "
-			"audio buffer\n", (unsigned)fAudioBufferLen);
-		fAudioIsoIn = NULL;
-		return B_NO_MEMORY;
-	}
-
-	syslog(LOG_INFO, "UVCCamDevice: Audio ready: %u Hz, %u ch, buffer %u bytes\n",
+	syslog(LOG_INFO, "UVCCamDevice: Audio ready: %u Hz, %u ch, max packet %u bytes\n",
 		(unsigned)fAudioSampleRate, (unsigned)fAudioChannels,
-		(unsigned)fAudioBufferLen);
+		(unsigned)fAudioMaxPacketSize);
 
 	return B_OK;
 }
@@ -2073,12 +3090,6 @@ UVCCamDevice::_SelectAudioIdleAlternate()
 	fAudioIsoIn = NULL;
 	fAudioMaxPacketSize = 0;
 
-	if (fAudioBuffer != NULL) {
-		free(fAudioBuffer);
-		fAudioBuffer = NULL;
-		fAudioBufferLen = 0;
-	}
-
 	return B_OK;
 }
 
@@ -2093,66 +3104,113 @@ UVCCamDevice::_audio_pump_thread_(void* data)
 int32
 UVCCamDevice::AudioPumpThread()
 {
-	if (fAudioIsoIn == NULL || fAudioBuffer == NULL || fAudioRingBuffer == NULL)
+	if (fAudioIsoIn == NULL || fAudioRingData == NULL)
 		return B_ERROR;
 
-	// Use multiple packets like FreeBSD (but fewer due to EHCI issues)
-	const uint32 kPacketsPerTransfer = 16;
-	usb_iso_packet_descriptor packetDescs[kPacketsPerTransfer];
-
-	// Calculate expected bytes per packet based on sample rate
-	// 48kHz * 2ch * 2bytes / 1000 frames = 192 bytes per frame (1ms)
-	// For USB full-speed: 1 packet per frame = 192 bytes max
-	uint32 bytesPerPacket = (fAudioSampleRate * fAudioChannels * 2) / 1000;
-	if (bytesPerPacket == 0)
-		bytesPerPacket = 192;  // fallback for 48kHz stereo
-	if (bytesPerPacket > fAudioMaxPacketSize)
-		bytesPerPacket = fAudioMaxPacketSize;
-
-	// Retry configuration (similar to video transfer retry logic)
-	const uint32 kMaxRetries = 3;
+	// Backoff after failed transfers (similar to video transfer retry logic)
 	const bigtime_t kInitialBackoff = 1000;		// 1ms
 	const bigtime_t kMaxBackoff = 10000;		// 10ms
 
 	uint32 consecutiveErrors = 0;
 	bigtime_t currentBackoff = kInitialBackoff;
 
+	AddCaptureStream(CAM_CAPTURE_AUDIO, fAudioIsoIn);
+
+	// A packet is one millisecond of audio; a completed transfer must be
+	// handled before the ones still queued behind it run out
+	const int32 packets = fAudioLayout.packets_per_transfer;
+	const int32 ringBlocks = fAudioLayout.ring_blocks;
+	const bigtime_t deadline = (bigtime_t)packets * 1000
+		* (fAudioTransferCount > 1 ? fAudioTransferCount - 1 : 1);
+
 	// Statistics for logging
 	uint32 transferCount = 0;
 	uint32 errorCount = 0;
+	uint32 stallCount = 0;
 	bigtime_t lastLogTime = system_time();
 
 	while (fAudioTransferRunning) {
-		// Initialize packet descriptors
-		for (uint32 i = 0; i < kPacketsPerTransfer; i++) {
-			packetDescs[i].request_length = bytesPerPacket;
-			packetDescs[i].actual_length = 0;
-			packetDescs[i].status = B_OK;
+		// Keep every transfer queued as long as the ring has free blocks
+		while (fAudioBlocksSubmitted - fAudioBlocksCompleted < fAudioTransferCount
+			&& fAudioBlocksSubmitted - atomic_get(&fAudioBlocksConsumed)
+				< ringBlocks) {
+			uvc_audio_transfer& transfer = fAudioTransfers[
+				(uint32)fAudioBlocksSubmitted % fAudioTransferCount];
+			int32 index = (uint32)fAudioBlocksSubmitted % ringBlocks;
+			uvc_audio_block& block = fAudioBlocks[index];
+			for (int32 i = 0; i < packets; i++) {
+				block.descriptors[i].request_length = fAudioPacketSize;
+				block.descriptors[i].actual_length = 0;
+				block.descriptors[i].status = B_OK;
+			}
+			transfer.block = index;
+			transfer.ticket = fAudioOrder.Take();
+			transfer.submitted = system_time();
+			release_sem(transfer.submit);
+			fAudioBlocksSubmitted++;
 		}
 
-		// Perform isochronous transfer with retry logic
-		ssize_t transferred = -1;
-		uint32 retryCount = 0;
+		if (fAudioBlocksSubmitted == fAudioBlocksCompleted) {
+			// The reader is a whole ring behind; wait for it to free a block
+			stallCount++;
+			status_t err = acquire_sem_etc(fAudioSpaceSem, 1,
+				B_RELATIVE_TIMEOUT, 100000);
+			if (err != B_OK && err != B_TIMED_OUT && err != B_INTERRUPTED)
+				break;
+			continue;
+		}
 
-		while (retryCount < kMaxRetries && fAudioTransferRunning) {
-			transferred = fAudioIsoIn->IsochronousTransfer(fAudioBuffer,
-				bytesPerPacket * kPacketsPerTransfer, packetDescs,
-				kPacketsPerTransfer);
+		// fAudioOrder queues the transfers in ring order; they complete in it
+		uvc_audio_transfer& transfer = fAudioTransfers[
+			(uint32)fAudioBlocksCompleted % fAudioTransferCount];
+		status_t err = acquire_sem_etc(transfer.complete, 1,
+			B_RELATIVE_TIMEOUT, 100000);
+		if (err == B_TIMED_OUT || err == B_INTERRUPTED)
+			continue;
+		if (err != B_OK)
+			break;
 
-			if (transferred >= 0)
-				break;
+		transferCount++;
 
-			// Transient error - retry with backoff
-			retryCount++;
-			if (retryCount < kMaxRetries) {
-				snooze(currentBackoff);
-				currentBackoff = min_c(currentBackoff * 2, kMaxBackoff);
-			}
+		// Only successful packets count; the reader goes by actual_length
+		uvc_audio_block& block = fAudioBlocks[transfer.block];
+		if (fCapture != NULL) {
+			fCapture->AddTransfer(CAM_CAPTURE_AUDIO,
+				fAudioIsoIn->Descriptor()->endpoint_address, block.data,
+				fAudioPacketSize, block.descriptors, packets,
+				transfer.result, transfer.submitted, transfer.completed);
+		}
+		size_t bytes = 0;
+		for (int32 i = 0; i < packets; i++) {
+			usb_iso_packet_descriptor& packet = block.descriptors[i];
+			if (transfer.result < 0 || packet.status != B_OK
+				|| packet.actual_length > fAudioPacketSize)
+				packet.actual_length = 0;
+			bytes += packet.actual_length;
 		}
 
-		transferCount++;
+		// The last sample of the block was captured no later than the
+		// transfer completed; the clock fit takes the lower envelope of
+		// that delay, as for the video SCR
+		if (bytes > 0) {
+			fAudioBytesReceived += bytes;
+			size_t frameBytes = fAudioChannels * fAudioSubFrameSize;
+			BAutolock _(fAudioClockLock);
+			fAudioClock.AddSample((uint32)(fAudioBytesReceived / frameBytes),
+				system_time());
+		}
+
+		atomic_add(&fAudioBytesAvailable, (int32)bytes);
+		atomic_add(&fAudioBlocksCompleted, 1);
+
+		int32 count;
+		if (get_sem_count(fAudioRingSem, &count) == B_OK && count <= 0)
+			release_sem_etc(fAudioRingSem, 1, B_DO_NOT_RESCHEDULE);
 
-		if (transferred < 0) {
+		fAudioPumpSchedule.Record(system_time() - transfer.completed,
+			deadline);
+
+		if (transfer.result < 0) {
 			errorCount++;
 			consecutiveErrors++;
 
@@ -2164,11 +3222,9 @@ UVCCamDevice::AudioPumpThread()
 			}
 
 			snooze(currentBackoff);
-			continue;
-		}
-
-		// Success - reset error tracking
-		if (consecutiveErrors > 0) {
+			currentBackoff = min_c(currentBackoff * 2, kMaxBackoff);
+		} else if (consecutiveErrors > 0) {
+			// Success - reset error tracking
 			consecutiveErrors = 0;
 			currentBackoff = kInitialBackoff;
 		}
@@ -2176,51 +3232,29 @@ UVCCamDevice::AudioPumpThread()
 		// Periodic statistics logging (every 30 seconds)
 		bigtime_t now = system_time();
 		if (now - lastLogTime > 30000000) {
-			if (errorCount > 0) {
+			if (errorCount > 0 || stallCount > 0) {
 				syslog(LOG_INFO,
-					"UVCCamDevice: Audio stats: %u transfers, %u errors (%.1f%%)\n",
+					"UVCCamDevice: Audio stats: %u transfers, %u errors (%.1f%%), "
+					"%u ring full stalls\n",
 					(unsigned)transferCount, (unsigned)errorCount,
-					100.0f * errorCount / transferCount);
+					100.0f * errorCount / transferCount, (unsigned)stallCount);
 			}
+			syslog(LOG_INFO, "UVCCamDevice: Audio clock drift %d ppm\n",
+				(int)AudioDriftPPM());
+			syslog(LOG_INFO, "UVCCamDevice: Audio sched: priority %d, %u "
+				"wakeups, %u missed the %lld us deadline, latency avg %lld "
+				"max %lld us\n",
+				(int)fThreadPolicy.Priority(CAM_THREAD_AUDIO_PUMP),
+				(unsigned)fAudioPumpSchedule.wakeups,
+				(unsigned)fAudioPumpSchedule.deadline_misses,
+				(long long)deadline,
+				(long long)fAudioPumpSchedule.AverageLatency(),
+				(long long)fAudioPumpSchedule.latency_max);
+			fAudioPumpSchedule.Reset();
 			lastLogTime = now;
 			transferCount = 0;
 			errorCount = 0;
-		}
-
-		// Copy received audio data to ring buffer using atomic operations
-		for (uint32 i = 0; i < kPacketsPerTransfer; i++) {
-			if (packetDescs[i].status != B_OK || packetDescs[i].actual_length == 0)
-				continue;
-
-			uint8* packetData = fAudioBuffer + (i * bytesPerPacket);
-			size_t packetLen = packetDescs[i].actual_length;
-
-			// Calculate space in ring buffer
-			int32 head = atomic_get(&fAudioRingHead);
-			int32 tail = atomic_get(&fAudioRingTail);
-			size_t space;
-
-			if (head >= tail)
-				space = fAudioRingSize - head + tail - 1;
-			else
-				space = tail - head - 1;
-
-			if (space < packetLen) {
-				// Ring buffer overflow - data lost
-				continue;
-			}
-
-			// Copy to ring buffer (handle wraparound)
-			size_t firstChunk = fAudioRingSize - head;
-			if (firstChunk >= packetLen) {
-				memcpy(fAudioRingBuffer + head, packetData, packetLen);
-			} else {
-				memcpy(fAudioRingBuffer + head, packetData, firstChunk);
-				memcpy(fAudioRingBuffer, packetData + firstChunk,
-					packetLen - firstChunk);
-			}
-
-			atomic_set(&fAudioRingHead, (head + packetLen) % fAudioRingSize);
+			stallCount = 0;
 		}
 	}
 
@@ -2233,7 +3267,6 @@ UVCCamDevice::_AddProcessingParameter(BParameterGroup* group,
 	int32 index, const usb_video_processing_unit_descriptor* descriptor)
 {
 	BParameterGroup* subgroup;
-	uint16 wValue = 0; // Control Selector
 	float minValue = 0.0;
 	float maxValue = 100.0;
 	if (descriptor->control_size >= 1) {
@@ -2299,17 +3332,8 @@ UVCCamDevice::_AddProcessingParameter(BParameterGroup* group,
 	if (descriptor->control_size >= 2) {
 		if (descriptor->controls[1] & 1) {
 			// debug_printf("\tBACKLIGHT COMPENSATION\n");
-			int16 data;
-			wValue = USB_VIDEO_PU_BACKLIGHT_COMPENSATION_CONTROL << 8;
-			fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-				USB_VIDEO_RC_GET_MAX, wValue, fControlRequestIndex, sizeof(data), &data);
-			maxValue = (float)data;
-			fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-				USB_VIDEO_RC_GET_MIN, wValue, fControlRequestIndex, sizeof(data), &data);
-			minValue = (float)data;
-			fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-				USB_VIDEO_RC_GET_CUR, wValue, fControlRequestIndex, sizeof(data), &data);
-			fBacklightCompensation = (float)data;
+			_ControlRange(USB_VIDEO_PU_BACKLIGHT_COMPENSATION_CONTROL,
+				&minValue, &maxValue);
 			subgroup = group->MakeGroup("Backlight Compensation");
 			if (maxValue - minValue == 1) { // Binary Switch
 				fBinaryBacklightCompensation = true;
@@ -2330,13 +3354,6 @@ UVCCamDevice::_AddProcessingParameter(BParameterGroup* group,
 		}
 		if (descriptor->controls[1] & 4) {
 			// debug_printf("\tPOWER LINE FREQUENCY\n");
-			wValue = USB_VIDEO_PU_POWER_LINE_FREQUENCY_CONTROL << 8;
-			int8 data;
-			if (fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-					USB_VIDEO_RC_GET_CUR, wValue, fControlRequestIndex, sizeof(data), &data)
-				== sizeof(data)) {
-				fPowerlineFrequency = data;
-			}
 			subgroup = group->MakeGroup("Power Line Frequency");
 			/* FIX: Use discrete parameter instead of continuous slider */
 			BDiscreteParameter* plf = subgroup->MakeDiscreteParameter(index + 13,
@@ -2373,32 +3390,15 @@ UVCCamDevice::_AddParameter(BParameterGroup* group,
 {
 	float minValue = 0.0;
 	float maxValue = 100.0;
-	float currValue = 0.0;
-	int16 data;
-
-	wValue <<= 8;
-
-	if (fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-		USB_VIDEO_RC_GET_MAX, wValue, fControlRequestIndex, sizeof(data), &data)
-		== sizeof(data)) {
-		maxValue = (float)data;
-	}
-	if (fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-		USB_VIDEO_RC_GET_MIN, wValue, fControlRequestIndex, sizeof(data), &data)
-		== sizeof(data)) {
-		minValue = (float)data;
-	}
-	if (fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-		USB_VIDEO_RC_GET_CUR, wValue, fControlRequestIndex, sizeof(data), &data)
-		== sizeof(data)) {
-		currValue = (float)data;
-	}
+	_ControlRange(wValue, &minValue, &maxValue);
 
 	*subgroup = group->MakeGroup(name);
 	(*subgroup)->MakeContinuousParameter(index,
 		B_MEDIA_RAW_VIDEO, name, B_GAIN, "", minValue, maxValue,
 		1.0 / (maxValue - minValue));
-	return currValue;
+
+	// The current value is read when the parameter is first asked for
+	return minValue;
 }
 
 
@@ -2406,15 +3406,133 @@ uint8
 UVCCamDevice::_AddAutoParameter(BParameterGroup* subgroup, int32 index,
 	uint16 wValue)
 {
-	uint8 data;
-	wValue <<= 8;
-
-	fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-		USB_VIDEO_RC_GET_CUR, wValue, fControlRequestIndex, 1, &data);
+	(void)wValue;
 	subgroup->MakeDiscreteParameter(index, B_MEDIA_RAW_VIDEO, "Auto",
 		B_ENABLE);
 
-	return data;
+	// Read on first use, like the other controls
+	return 0;
+}
+
+
+status_t
+UVCCamDevice::_ControlRange(uint16 selector, float* minValue, float* maxValue)
+{
+	// Ranges are a property of the model and firmware; a known camera
+	// builds its parameter web without asking
+	uvc_control_model model;
+	memset(&model, 0, sizeof(model));
+	model.vendor_id = fDevice->VendorID();
+	model.product_id = fDevice->ProductID();
+	model.device_version = fDevice->Version();
+	model.unit_id = fProcessingUnitID;
+
+	uvc_control_range range;
+	if (UVCControlCache::Default().Lookup(model, selector, &range)) {
+		*minValue = range.min_value;
+		*maxValue = range.max_value;
+		return B_OK;
+	}
+
+	int16 data;
+	bool haveMax = fDevice->ControlTransfer(
+		USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN, USB_VIDEO_RC_GET_MAX,
+		selector << 8, fControlRequestIndex, sizeof(data), &data)
+			== sizeof(data);
+	if (haveMax)
+		range.max_value = data;
+	bool haveMin = fDevice->ControlTransfer(
+		USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN, USB_VIDEO_RC_GET_MIN,
+		selector << 8, fControlRequestIndex, sizeof(data), &data)
+			== sizeof(data);
+	if (haveMin)
+		range.min_value = data;
+
+	if (haveMax)
+		*maxValue = range.max_value;
+	if (haveMin)
+		*minValue = range.min_value;
+	if (!haveMin || !haveMax)
+		return B_ERROR;
+
+	// Only complete answers are remembered, a glitch is retried next time
+	UVCControlCache::Default().Store(model, selector, range);
+	return B_OK;
+}
+
+
+void
+UVCCamDevice::_LoadControlValue(uint16 selector, float* value)
+{
+	if ((atomic_get(&fControlValuesRead) & (1L << selector)) != 0)
+		return;
+
+	int16 data;
+	if (fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
+			USB_VIDEO_RC_GET_CUR, selector << 8, fControlRequestIndex,
+			sizeof(data), &data) == sizeof(data)) {
+		*value = (float)data;
+		atomic_or(&fControlValuesRead, 1L << selector);
+	}
+}
+
+
+void
+UVCCamDevice::_LoadControlValue(uint16 selector, int* value, size_t length)
+{
+	if ((atomic_get(&fControlValuesRead) & (1L << selector)) != 0)
+		return;
+
+	int16 data = 0;
+	if (length == 1) {
+		int8 byte;
+		if (fDevice->ControlTransfer(USB_REQTYPE_CLASS
+				| USB_REQTYPE_INTERFACE_IN, USB_VIDEO_RC_GET_CUR, selector << 8,
+				fControlRequestIndex, 1, &byte) != 1)
+			return;
+		data = byte;
+	} else if (fDevice->ControlTransfer(USB_REQTYPE_CLASS
+			| USB_REQTYPE_INTERFACE_IN, USB_VIDEO_RC_GET_CUR, selector << 8,
+			fControlRequestIndex, sizeof(data), &data) != sizeof(data))
+		return;
+
+	*value = data;
+	atomic_or(&fControlValuesRead, 1L << selector);
+}
+
+
+/* " @ 60, 30, 29.97 fps": the rates a frame descriptor advertises, or
+ * their range */
+static void
+append_frame_rates(BString& label, const usb_video_frame_descriptor* frame)
+{
+	uint32 intervals[2];
+	const uint32* list = frame->discrete_frame_intervals;
+	int32 count = frame->frame_interval_type;
+	const char* separator = ", ";
+	if (count == 0) {
+		intervals[0] = frame->continuous.min_frame_interval;
+		intervals[1] = frame->continuous.max_frame_interval;
+		list = intervals;
+		count = 2;
+		separator = "-";
+	}
+
+	int32 added = 0;
+	for (int32 i = 0; i < count; i++) {
+		if (list[i] == 0)
+			continue;
+		char rate[16];
+		float fps = 10000000.0f / list[i];
+		if (fps - (int32)(fps + 0.5f) < 0.005f
+			&& (int32)(fps + 0.5f) - fps < 0.005f)
+			snprintf(rate, sizeof(rate), "%d", (int)(fps + 0.5f));
+		else
+			snprintf(rate, sizeof(rate), "%.2f", fps);
+		label << (added++ == 0 ? " @ " : separator) << rate;
+	}
+	if (added > 0)
+		label << " fps";
 }
 
 
@@ -2434,7 +3552,8 @@ UVCCamDevice::AddParameters(BParameterGroup* group, int32& index)
 	if (fIsMJPEG) {
 		formatInfo = "Format: MJPEG (compressed)";
 	} else {
-		formatInfo = "Format: YUY2 (uncompressed)";
+		formatInfo = fIsNV12 ? "Format: NV12 (uncompressed)"
+			: "Format: YUY2 (uncompressed)";
 	}
 
 	/* Add format type as text */
@@ -2442,7 +3561,7 @@ UVCCamDevice::AddParameters(BParameterGroup* group, int32& index)
 		formatInfo.String(), "Format", 64);
 
 	/* Add resolution selector as discrete parameter (Task 2) */
-	BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+	BList* frameList = _StreamFrames();
 	if (frameList->CountItems() > 0) {
 		fResolutionParameterID = index + 14;  // Store parameter ID for later
 
@@ -2456,10 +3575,7 @@ UVCCamDevice::AddParameters(BParameterGroup* group, int32& index)
 			if (frameDesc != NULL) {
 				BString resName;
 				resName << frameDesc->width << "x" << frameDesc->height;
-				if (frameDesc->default_frame_interval > 0) {
-					float fps = 10000000.0f / frameDesc->default_frame_interval;
-					resName << " @ " << (int)fps << " fps";
-				}
+				append_frame_rates(resName, frameDesc);
 				resParam->AddItem(i, resName.String());
 			}
 		}
@@ -2473,6 +3589,38 @@ UVCCamDevice::AddParameters(BParameterGroup* group, int32& index)
 			(int)frameList->CountItems(), (int)fSelectedResolutionIndex);
 	}
 
+	/* Frame delivery policy: FIFO shows every frame, the others trade
+	 * frames for latency after a stall */
+	BDiscreteParameter* deliveryParam = videoGroup->MakeDiscreteParameter(
+		index + 16, B_MEDIA_RAW_VIDEO, "Frame delivery", B_GENERIC);
+	deliveryParam->AddItem(FRAME_DELIVERY_FIFO, "Every frame");
+	deliveryParam->AddItem(FRAME_DELIVERY_LATEST, "Latest frame only");
+	deliveryParam->AddItem(FRAME_DELIVERY_BOUNDED, "Bounded latency");
+
+	/* Thread scheduling: real-time priorities by pipeline stage */
+	BDiscreteParameter* threadParam = videoGroup->MakeDiscreteParameter(
+		index + 17, B_MEDIA_RAW_VIDEO, "Scheduling", B_GENERIC);
+	threadParam->AddItem(CAM_THREADS_STAGED, "Real-time by stage");
+	threadParam->AddItem(CAM_THREADS_PINNED, "Real-time, one core per camera");
+	threadParam->AddItem(CAM_THREADS_LEGACY, "Fixed priorities");
+
+	/* Standby: warm keeps the camera streaming while the node is stopped,
+	 * so video shows within a frame or two of starting */
+	BDiscreteParameter* standbyParam = videoGroup->MakeDiscreteParameter(
+		index + 22, B_MEDIA_RAW_VIDEO, "Standby", B_GENERIC);
+	standbyParam->AddItem(0, "Cold (camera off when stopped)");
+	standbyParam->AddItem(1, "Warm (camera streams when stopped)");
+
+	/* Region of interest, in percent of the frame: only that part is
+	 * decoded and converted, the rest of the picture is black */
+	BParameterGroup* cropGroup = group->MakeGroup("Region of Interest");
+	static const char* const kCropNames[4]
+		= { "Crop left", "Crop top", "Crop width", "Crop height" };
+	for (int32 i = 0; i < 4; i++) {
+		cropGroup->MakeContinuousParameter(index + 18 + i, B_MEDIA_RAW_VIDEO,
+			kCropNames[i], B_GENERIC, "%", 0, 100, 1);
+	}
+
 	const BUSBConfiguration* config;
 	const BUSBInterface* interface;
 	uint8 buffer[1024];
@@ -2483,7 +3631,9 @@ UVCCamDevice::AddParameters(BParameterGroup* group, int32& index)
 		config = fDevice->ConfigurationAt(i);
 		if (config == NULL)
 			continue;
-		fDevice->SetConfiguration(config);
+		// Each SET_CONFIGURATION is a round trip that resets the interfaces
+		if (fDevice->ActiveConfiguration() != config)
+			fDevice->SetConfiguration(config);
 		for (uint32 j = 0; j < config->CountInterfaces(); j++) {
 			interface = config->InterfaceAt(j);
 			if (interface == NULL)
@@ -2507,6 +3657,8 @@ UVCCamDevice::AddParameters(BParameterGroup* group, int32& index)
 			}
 		}
 	}
+
+	UVCControlCache::Default().Flush();
 }
 
 
@@ -2517,12 +3669,11 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 	printf("UVCCAmDevice::GetParameterValue(%" B_PRId32 ")\n", id - fFirstParameterID);
 	float* currValue;
 	int* currValueInt;
-	int16 data;
-	uint16 wValue = 0;
 	switch (id - fFirstParameterID) {
 		case 0:
 			// debug_printf("\tBrightness:\n");
 			// debug_printf("\tValue = %f\n",fBrightness);
+			_LoadControlValue(USB_VIDEO_PU_BRIGHTNESS_CONTROL, &fBrightness);
 			*size = sizeof(float);
 			currValue = (float*)value;
 			*currValue = fBrightness;
@@ -2531,6 +3682,7 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 		case 1:
 			// debug_printf("\tContrast:\n");
 			// debug_printf("\tValue = %f\n",fContrast);
+			_LoadControlValue(USB_VIDEO_PU_CONTRAST_CONTROL, &fContrast);
 			*size = sizeof(float);
 			currValue = (float*)value;
 			*currValue = fContrast;
@@ -2539,6 +3691,7 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 		case 2:
 			// debug_printf("\tHue:\n");
 			// debug_printf("\tValue = %f\n",fHue);
+			_LoadControlValue(USB_VIDEO_PU_HUE_CONTROL, &fHue);
 			*size = sizeof(float);
 			currValue = (float*)value;
 			*currValue = fHue;
@@ -2547,6 +3700,7 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 		case 4:
 			// debug_printf("\tSaturation:\n");
 			// debug_printf("\tValue = %f\n",fSaturation);
+			_LoadControlValue(USB_VIDEO_PU_SATURATION_CONTROL, &fSaturation);
 			*size = sizeof(float);
 			currValue = (float*)value;
 			*currValue = fSaturation;
@@ -2555,6 +3709,7 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 		case 5:
 			// debug_printf("\tSharpness:\n");
 			// debug_printf("\tValue = %f\n",fSharpness);
+			_LoadControlValue(USB_VIDEO_PU_SHARPNESS_CONTROL, &fSharpness);
 			*size = sizeof(float);
 			currValue = (float*)value;
 			*currValue = fSharpness;
@@ -2562,6 +3717,7 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 			return B_OK;
 		case 6:
 			// Gamma
+			_LoadControlValue(USB_VIDEO_PU_GAMMA_CONTROL, &fGamma);
 			*size = sizeof(float);
 			currValue = (float*)value;
 			*currValue = fGamma;
@@ -2569,14 +3725,16 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 			return B_OK;
 		case 7:
 			// debug_printf("\tWB Temperature:\n");
+			// Auto white balance moves it; the status interrupt reports
+			// that, without one it is read every time
+			if (fStatusThread < 0 || atomic_get(&fStatusQuit) != 0) {
+				atomic_and(&fControlValuesRead,
+					~(1L << USB_VIDEO_PU_WHITE_BALANCE_TEMPERATURE_CONTROL));
+			}
+			_LoadControlValue(USB_VIDEO_PU_WHITE_BALANCE_TEMPERATURE_CONTROL,
+				&fWBTemp);
 			*size = sizeof(float);
 			currValue = (float*)value;
-			wValue = USB_VIDEO_PU_WHITE_BALANCE_TEMPERATURE_CONTROL << 8;
-			if (fDevice->ControlTransfer(USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN,
-				USB_VIDEO_RC_GET_CUR, wValue, fControlRequestIndex, sizeof(data), &data)
-				== sizeof(data)) {
-				fWBTemp = (float)data;
-			}
 			// debug_printf("\tValue = %f\n",fWBTemp);
 			*currValue = fWBTemp;
 			*last_change = fLastParameterChanges;
@@ -2584,12 +3742,21 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 		case 8:
 			// debug_printf("\tWB Temperature Auto:\n");
 			// debug_printf("\tValue = %d\n",fWBTempAuto);
+			_LoadControlValue(
+				USB_VIDEO_PU_WHITE_BALANCE_TEMPERATURE_AUTO_CONTROL,
+				&fWBTempAuto, 1);
 			*size = sizeof(int);
 			currValueInt = ((int*)value);
 			*currValueInt = fWBTempAuto;
 			*last_change = fLastParameterChanges;
 			return B_OK;
 		case 11:
+			if ((atomic_get(&fControlValuesRead)
+					& (1L << USB_VIDEO_PU_BACKLIGHT_COMPENSATION_CONTROL)) == 0) {
+				_LoadControlValue(USB_VIDEO_PU_BACKLIGHT_COMPENSATION_CONTROL,
+					&fBacklightCompensationBinary, sizeof(int16));
+				fBacklightCompensation = fBacklightCompensationBinary;
+			}
 			if (!fBinaryBacklightCompensation) {
 				// debug_printf("\tBacklight Compensation:\n");
 				// debug_printf("\tValue = %f\n",fBacklightCompensation);
@@ -2608,6 +3775,7 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 		case 12:
 			// debug_printf("\tGain:\n");
 			// debug_printf("\tValue = %f\n",fGain);
+			_LoadControlValue(USB_VIDEO_PU_GAIN_CONTROL, &fGain);
 			*size = sizeof(float);
 			currValue = (float*)value;
 			*currValue = fGain;
@@ -2615,6 +3783,8 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 			return B_OK;
 		case 13:
 			/* FIX: Return int for discrete parameter */
+			_LoadControlValue(USB_VIDEO_PU_POWER_LINE_FREQUENCY_CONTROL,
+				&fPowerlineFrequency, 1);
 			*size = sizeof(int);
 			currValueInt = (int*)value;
 			*currValueInt = fPowerlineFrequency;
@@ -2627,6 +3797,43 @@ UVCCamDevice::GetParameterValue(int32 id, bigtime_t* last_change, void* value,
 			*currValueInt = fSelectedResolutionIndex;
 			*last_change = fLastParameterChanges;
 			return B_OK;
+		case 16:
+			/* Frame delivery policy */
+			*size = sizeof(int);
+			currValueInt = (int*)value;
+			*currValueInt = fDeframer != NULL
+				? fDeframer->DeliveryPolicy() : FRAME_DELIVERY_FIFO;
+			*last_change = fLastParameterChanges;
+			return B_OK;
+		case 17:
+			/* Thread scheduling mode */
+			*size = sizeof(int);
+			currValueInt = (int*)value;
+			*currValueInt = fThreadPolicy.Mode();
+			*last_change = fLastParameterChanges;
+			return B_OK;
+		case 18:
+		case 19:
+		case 20:
+		case 21:
+		{
+			/* Region of interest left, top, width and height */
+			BRect crop = Crop();
+			float values[4] = { crop.left, crop.top, crop.Width(),
+				crop.Height() };
+			*size = sizeof(float);
+			currValue = (float*)value;
+			*currValue = values[id - fFirstParameterID - 18] * 100;
+			*last_change = fLastParameterChanges;
+			return B_OK;
+		}
+		case 22:
+			/* Warm standby */
+			*size = sizeof(int);
+			currValueInt = (int*)value;
+			*currValueInt = WarmStandby() ? 1 : 0;
+			*last_change = fLastParameterChanges;
+			return B_OK;
 
 	}
 	return B_BAD_VALUE;
@@ -2732,6 +3939,74 @@ UVCCamDevice::SetParameterValue(int32 id, bigtime_t when, const void* value,
 			fLastParameterChanges = when;
 			return _SetParameterValue(USB_VIDEO_PU_POWER_LINE_FREQUENCY_CONTROL,
 				(int8)fPowerlineFrequency);
+		case 16:
+		{
+			/* Frame delivery policy */
+			if (!value || (size != sizeof(int)))
+				return B_BAD_VALUE;
+			int policy = *((int*)value);
+			if (policy < FRAME_DELIVERY_FIFO || policy > FRAME_DELIVERY_BOUNDED)
+				return B_BAD_VALUE;
+			if (fDeframer == NULL)
+				return B_NO_INIT;
+			fDeframer->SetDeliveryPolicy((frame_delivery_policy)policy);
+			fLastParameterChanges = when;
+			return B_OK;
+		}
+		case 17:
+		{
+			/* Thread scheduling mode; the producers pick it up when they
+			 * next start */
+			if (!value || (size != sizeof(int)))
+				return B_BAD_VALUE;
+			int mode = *((int*)value);
+			if (mode < CAM_THREADS_STAGED || mode > CAM_THREADS_LEGACY)
+				return B_BAD_VALUE;
+			fThreadPolicy.SetMode((cam_thread_mode)mode);
+			ApplyThreadPolicy();
+			fLastParameterChanges = when;
+			return B_OK;
+		}
+		case 18:
+		case 19:
+		case 20:
+		case 21:
+		{
+			/* Region of interest; an edge moved keeps the opposite one
+			 * where it is, and the region stays within the frame */
+			if (!value || (size != sizeof(float)))
+				return B_BAD_VALUE;
+			float fraction = *((float*)value) / 100;
+			if (fraction < 0)
+				fraction = 0;
+			if (fraction > 1)
+				fraction = 1;
+			BRect crop = Crop();
+			switch (id - fFirstParameterID) {
+				case 18:
+					crop.left = min_c(fraction, crop.right - 0.01f);
+					break;
+				case 19:
+					crop.top = min_c(fraction, crop.bottom - 0.01f);
+					break;
+				case 20:
+					crop.right = min_c(crop.left + max_c(fraction, 0.01f), 1);
+					break;
+				case 21:
+					crop.bottom = min_c(crop.top + max_c(fraction, 0.01f), 1);
+					break;
+			}
+			SetCrop(crop);
+			fLastParameterChanges = when;
+			return B_OK;
+		}
+		case 22:
+			/* Warm standby; the producer starts or stops the transfer */
+			if (!value || (size != sizeof(int)))
+				return B_BAD_VALUE;
+			SetWarmStandby(*((int*)value) != 0);
+			fLastParameterChanges = when;
+			return B_OK;
 		case 14:
 		{
 			/* Resolution selector (Task 2 & 3) */
@@ -2739,7 +4014,7 @@ UVCCamDevice::SetParameterValue(int32 id, bigtime_t when, const void* value,
 				return B_BAD_VALUE;
 
 			int32 newIndex = *((int*)value);
-			BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+			BList* frameList = _StreamFrames();
 
 			/* Validate index */
 			if (newIndex < 0 || newIndex >= frameList->CountItems()) {
@@ -2764,11 +4039,15 @@ UVCCamDevice::SetParameterValue(int32 id, bigtime_t when, const void* value,
 					if (fIsMJPEG) {
 						fMJPEGFrameIndex = frameDesc->frame_index;
 					} else {
-						fUncompressedFrameIndex = frameDesc->frame_index;
-						/* Set expected frame size for YUY2 deframer */
+						if (fIsNV12)
+							fNV12FrameIndex = frameDesc->frame_index;
+						else
+							fUncompressedFrameIndex = frameDesc->frame_index;
+						/* Set expected frame size for the YUY2 or NV12 deframer */
 						if (fDeframer) {
 							((UVCDeframer*)fDeframer)->SetExpectedFrameSize(
-								frameDesc->width * frameDesc->height * 2);
+								_UncompressedFrameSize(frameDesc->width,
+									frameDesc->height));
 						}
 					}
 
@@ -2780,6 +4059,8 @@ UVCCamDevice::SetParameterValue(int32 id, bigtime_t when, const void* value,
 					 */
 					uint32 newWidth = frameDesc->width;
 					uint32 newHeight = frameDesc->height;
+					fSourceWidth = 0;
+					fSourceHeight = 0;
 					SetVideoFrame(BRect(0, 0, newWidth - 1, newHeight - 1));
 					syslog(LOG_INFO, "UVCCamDevice: VideoFrame updated to %ux%u (frame_index=%u)\n",
 						newWidth, newHeight, frameDesc->frame_index);
@@ -2830,41 +4111,472 @@ UVCCamDevice::SetParameterValue(int32 id, bigtime_t when, const void* value,
 status_t
 UVCCamDevice::_SetParameterValue(uint16 wValue, int16 setValue)
 {
-	return (fDevice->ControlTransfer(USB_REQTYPE_CLASS
-		| USB_REQTYPE_INTERFACE_OUT, USB_VIDEO_RC_SET_CUR, wValue << 8, fControlRequestIndex,
-		sizeof(setValue), &setValue)) == sizeof(setValue);
+	return _QueueControl(wValue, setValue, sizeof(setValue));
 }
 
 
 status_t
 UVCCamDevice::_SetParameterValue(uint16 wValue, int8 setValue)
 {
-	return (fDevice->ControlTransfer(USB_REQTYPE_CLASS
-		| USB_REQTYPE_INTERFACE_OUT, USB_VIDEO_RC_SET_CUR, wValue << 8, fControlRequestIndex,
-		sizeof(setValue), &setValue)) == sizeof(setValue);
+	return _QueueControl(wValue, setValue, sizeof(setValue));
+}
+
+
+// =============================================================================
+// Control Worker
+// =============================================================================
+// SET_CUR requests are not sent on the caller's thread, which holds the
+// device lock and the node's control port: a dragged slider would issue
+// one per step. Each selector keeps only its newest value, and the worker
+// sends at most one batch per kControlMinInterval.
+
+
+status_t
+UVCCamDevice::_QueueControl(uint16 selector, int16 value, size_t length)
+{
+	if (selector >= kMaxControlSelectors)
+		return B_BAD_VALUE;
+
+	// What was set is the current value, no need to read it back
+	atomic_or(&fControlValuesRead, 1L << selector);
+
+	BAutolock lock(fControlLock);
+	if (fControlThread < 0) {
+		status_t status = _StartControlWorker();
+		if (status != B_OK)
+			return status;
+	}
+
+	uvc_pending_control& pending = fPendingControls[selector];
+	bool wasPending = pending.pending;
+	pending.value = value;
+	pending.length = length;
+	pending.pending = true;
+
+	if (wasPending)
+		fControlsCoalesced++;
+	else
+		release_sem_etc(fControlSem, 1, B_DO_NOT_RESCHEDULE);
+	return B_OK;
+}
+
+
+status_t
+UVCCamDevice::_StartControlWorker()
+{
+	fControlSem = create_sem(0, "uvc control requests");
+	if (fControlSem < B_OK)
+		return fControlSem;
+
+	fControlQuit = false;
+	fControlThread = spawn_thread(_control_worker_thread_, "uvc controls",
+		CamConfig::kPriorityControlWorker, this);
+	if (fControlThread < B_OK || resume_thread(fControlThread) < B_OK) {
+		status_t status = fControlThread < B_OK ? fControlThread : B_ERROR;
+		if (fControlThread >= B_OK)
+			kill_thread(fControlThread);
+		fControlThread = -1;
+		delete_sem(fControlSem);
+		fControlSem = -1;
+		return status;
+	}
+	return B_OK;
+}
+
+
+void
+UVCCamDevice::_StopControlWorker()
+{
+	thread_id thread;
+	{
+		BAutolock lock(fControlLock);
+		thread = fControlThread;
+		if (thread < 0)
+			return;
+		fControlQuit = true;
+		release_sem(fControlSem);
+	}
+
+	status_t result;
+	wait_for_thread(thread, &result);
+
+	syslog(LOG_INFO, "UVCCamDevice: Control worker sent %u requests, "
+		"coalesced %u\n", (unsigned)fControlsSent,
+		(unsigned)fControlsCoalesced);
+
+	BAutolock lock(fControlLock);
+	fControlThread = -1;
+	delete_sem(fControlSem);
+	fControlSem = -1;
+}
+
+
+int32
+UVCCamDevice::_control_worker_thread_(void* data)
+{
+	((UVCCamDevice*)data)->_ControlWorker();
+	return 0;
+}
+
+
+void
+UVCCamDevice::_ControlWorker()
+{
+	bigtime_t lastBatch = 0;
+
+	while (acquire_sem(fControlSem) == B_OK) {
+		// Let a fast moving slider settle into one request per interval
+		bigtime_t wait = lastBatch + CamConfig::kControlMinInterval
+			- system_time();
+		if (wait > 0)
+			snooze(wait);
+
+		uvc_pending_control batch[kMaxControlSelectors];
+		int32 count = 0;
+		{
+			BAutolock lock(fControlLock);
+			if (fControlQuit)
+				break;
+			for (int32 i = 0; i < kMaxControlSelectors; i++) {
+				if (!fPendingControls[i].pending)
+					continue;
+				batch[count] = fPendingControls[i];
+				batch[count].selector = i;
+				count++;
+				fPendingControls[i].pending = false;
+			}
+		}
+		// Values queued together were counted once each
+		if (count > 1)
+			acquire_sem_etc(fControlSem, count - 1, B_RELATIVE_TIMEOUT, 0);
+
+		for (int32 i = 0; i < count; i++) {
+			int16 value16 = batch[i].value;
+			int8 value8 = (int8)batch[i].value;
+			void* value = batch[i].length == 1 ? (void*)&value8
+				: (void*)&value16;
+			ssize_t result = fDevice->ControlTransfer(
+				USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_OUT,
+				USB_VIDEO_RC_SET_CUR, batch[i].selector << 8,
+				fControlRequestIndex, batch[i].length, value);
+			fControlsSent++;
+			if (result == (ssize_t)batch[i].length)
+				continue;
+
+			// Refused: show what the camera really has, the next
+			// GetParameterValue() reads it back
+			atomic_and(&fControlValuesRead, ~(1L << batch[i].selector));
+			fLastParameterChanges = system_time();
+			static int32 sControlFailuresLogged = 0;
+			if (atomic_add(&sControlFailuresLogged, 1) < 5) {
+				syslog(LOG_WARNING, "UVCCamDevice: SET_CUR of control %u "
+					"failed: %s\n", (unsigned)batch[i].selector,
+					strerror(result < 0 ? (status_t)result : B_ERROR));
+			}
+		}
+		lastBatch = system_time();
+	}
+}
+
+
+// =============================================================================
+// Status Interrupt
+// =============================================================================
+// GetParameterValue() answers from the values read once, or set by us; the
+// camera reports what it changes itself on the VideoControl interrupt
+// endpoint, so polling costs no control transfer. Range changes are only
+// logged, the ranges are cached per model.
+
+
+void
+UVCCamDevice::_StartStatusReader()
+{
+	if (fInterruptIn == NULL || fStatusThread >= 0)
+		return;
+
+	atomic_set(&fStatusQuit, 0);
+	fStatusThread = spawn_thread(_status_reader_thread_, "uvc status",
+		CamConfig::kPriorityControlWorker, this);
+	if (fStatusThread < B_OK || resume_thread(fStatusThread) < B_OK) {
+		syslog(LOG_WARNING, "UVCCamDevice: No status reader: %s\n",
+			strerror(fStatusThread < B_OK ? fStatusThread : B_ERROR));
+		if (fStatusThread >= B_OK)
+			kill_thread(fStatusThread);
+		fStatusThread = -1;
+	}
+}
+
+
+void
+UVCCamDevice::_StopStatusReader()
+{
+	if (fStatusThread < 0)
+		return;
+
+	// The transfer waits for the next event; halting the endpoint, as for
+	// the bulk ring, makes it return
+	atomic_set(&fStatusQuit, 1);
+	status_t result;
+	if (wait_for_thread_etc(fStatusThread, B_RELATIVE_TIMEOUT, 500000,
+			&result) == B_TIMED_OUT) {
+		fInterruptIn->ClearStall();
+		wait_for_thread(fStatusThread, &result);
+	}
+	fStatusThread = -1;
+
+	syslog(LOG_INFO, "UVCCamDevice: Status reader saw %u events\n",
+		(unsigned)fStatusEvents);
+}
+
+
+int32
+UVCCamDevice::_status_reader_thread_(void* data)
+{
+	((UVCCamDevice*)data)->_StatusReader();
+	return 0;
+}
+
+
+void
+UVCCamDevice::_StatusReader()
+{
+	int32 failures = 0;
+	while (atomic_get(&fStatusQuit) == 0) {
+		uvc_control_status status;
+		ssize_t length = fInterruptIn->InterruptTransfer(&status,
+			sizeof(status));
+		if (atomic_get(&fStatusQuit) != 0)
+			break;
+
+		if (length < 0) {
+			// A stall is cleared and retried; a camera that keeps failing
+			// falls back to reading the values that may move
+			if (++failures > 5) {
+				syslog(LOG_WARNING, "UVCCamDevice: Status interrupt failed: "
+					"%s, reader stopped\n", strerror((status_t)length));
+				atomic_set(&fStatusQuit, 1);
+				break;
+			}
+			fInterruptIn->ClearStall();
+			snooze(100000);
+			continue;
+		}
+		failures = 0;
+
+		fStatusEvents++;
+		// VideoStreaming packets (the still button) are not used
+		if (length >= 5 && status.status_type == 1)
+			_HandleControlStatus(status, length);
+	}
+}
+
+
+void
+UVCCamDevice::_HandleControlStatus(const uvc_control_status& status,
+	size_t length)
+{
+	if (status.event != 0 || status.originator != fProcessingUnitID
+		|| status.selector >= kMaxControlSelectors)
+		return;
+
+	switch (status.attribute) {
+		case 0:
+		{
+			if (length < 6)
+				return;
+			// A setting still queued is newer than what the camera reports
+			{
+				BAutolock lock(fControlLock);
+				if (fPendingControls[status.selector].pending)
+					return;
+			}
+			int16 value = length == 6 ? (int8)status.value[0]
+				: (int16)(status.value[0] | (status.value[1] << 8));
+			if (_StoreControlValue(status.selector, value))
+				fLastParameterChanges = system_time();
+			break;
+		}
+		case 2:
+			// An asynchronous setting failed: read back what it is
+			atomic_and(&fControlValuesRead, ~(1L << status.selector));
+			fLastParameterChanges = system_time();
+			break;
+		default:
+			syslog(LOG_INFO, "UVCCamDevice: Control %u attribute %u "
+				"changed\n", (unsigned)status.selector,
+				(unsigned)status.attribute);
+			break;
+	}
+}
+
+
+/* The value the camera has for a control, into the member
+ * GetParameterValue() answers with; false for a control not shown. */
+bool
+UVCCamDevice::_StoreControlValue(uint16 selector, int16 value)
+{
+	switch (selector) {
+		case USB_VIDEO_PU_BRIGHTNESS_CONTROL:
+			fBrightness = value;
+			break;
+		case USB_VIDEO_PU_CONTRAST_CONTROL:
+			fContrast = value;
+			break;
+		case USB_VIDEO_PU_HUE_CONTROL:
+			fHue = value;
+			break;
+		case USB_VIDEO_PU_SATURATION_CONTROL:
+			fSaturation = value;
+			break;
+		case USB_VIDEO_PU_SHARPNESS_CONTROL:
+			fSharpness = value;
+			break;
+		case USB_VIDEO_PU_GAMMA_CONTROL:
+			fGamma = value;
+			break;
+		case USB_VIDEO_PU_WHITE_BALANCE_TEMPERATURE_CONTROL:
+			fWBTemp = value;
+			break;
+		case USB_VIDEO_PU_WHITE_BALANCE_TEMPERATURE_AUTO_CONTROL:
+			fWBTempAuto = value;
+			break;
+		case USB_VIDEO_PU_BACKLIGHT_COMPENSATION_CONTROL:
+			fBacklightCompensation = value;
+			fBacklightCompensationBinary = value;
+			break;
+		case USB_VIDEO_PU_GAIN_CONTROL:
+			fGain = value;
+			break;
+		case USB_VIDEO_PU_POWER_LINE_FREQUENCY_CONTROL:
+			fPowerlineFrequency = value;
+			break;
+		default:
+			return false;
+	}
+	atomic_or(&fControlValuesRead, 1L << selector);
+	return true;
 }
 
 
 // FIX BUG 6: Contatori ora sono membri di istanza (vedi header)
 
 status_t
-UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
+UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp,
+	uint32* sequence, cam_frame_times* times)
 {
-	fFillFrameCount++;
+	mjpeg_decode_job job;
+	job.frame = NULL;
+	job.arrival = 0;
+	job.completed = 0;
+
+	// Wait outside fFillLock so that other threads can finish their fills
+	// meanwhile; the frame order is fixed when the frame is dequeued
+	status_t err = fDeframer != NULL ? fDeframer->WaitFrame(2000000) : B_ERROR;
+	{
+		BAutolock fillLock(fFillLock);
+		err = _FillFrameBufferLocked(buffer, err, stamp, sequence, &job);
+		if (times != NULL) {
+			times->arrival = job.arrival;
+			times->completed = job.completed;
+		}
+		if (err < B_OK || job.frame == NULL) {
+			if (err == B_OK && job.completed > 0) {
+				Metrics().RecordLatency(CAM_LATENCY_DECODE,
+					system_time() - job.completed);
+			}
+			return err;
+		}
+	}
+
+	// The decode is the expensive part; it runs unlocked on a handle of
+	// its own while other threads fetch and decode the following frames
+	tjhandle decoder = _AcquireJpegDecoder();
+	err = _DecompressMJPEG(decoder, job.dst,
+		(const unsigned char*)job.frame->Buffer(), job.frame->BufferLength(),
+		job.width, job.height, &job.frame->fJpegIndex, &job.region);
+	_ReleaseJpegDecoder(decoder);
+	if (err == B_OK && job.blackOutside) {
+		black_outside_region(job.dst, fColorSpace, job.width, job.height,
+			job.region);
+	}
+
+	// Recycle frame back to pool for reuse (reduces allocations)
+	if (fDeframer != NULL)
+		fDeframer->RecycleFrame(job.frame);
+	else
+		delete job.frame;
+
+	if (err == B_OK && job.valid) {
+		_CacheDecodedFrame(job.dst,
+			output_frame_size(fColorSpace, job.width, job.height), job.width,
+			job.height, job.sequence);
+	} else if (err != B_OK)
+		_RepeatLastFrame(buffer, job.width, job.height);
+
+	Metrics().RecordLatency(CAM_LATENCY_DECODE, system_time() - job.completed);
+	return B_OK;
+}
+
+
+int32
+UVCCamDevice::FillFrameBufferConcurrency()
+{
+	// YUY2 conversion is cheap and stays serialized under fFillLock
+	if (!fIsMJPEG)
+		return 1;
+	return fJpegDecoderCount > 0 ? fJpegDecoderCount : 1;
+}
+
+
+/* Decoders are handed out under fFillLock; there are never more fills in
+ * flight than handles, but fall back to sharing handle 0 serialized if a
+ * caller runs more threads than FillFrameBufferConcurrency() said. */
+tjhandle
+UVCCamDevice::_AcquireJpegDecoder()
+{
+	fFillLock.Lock();
+	for (int32 i = 1; i < fJpegDecoderCount; i++) {
+		if (!fJpegDecoderBusy[i]) {
+			fJpegDecoderBusy[i] = true;
+			fFillLock.Unlock();
+			return fJpegDecoders[i];
+		}
+	}
+	fFillLock.Unlock();
+
+	fJpegDecoderLock.Lock();
+	return fJpegDecompressor;
+}
+
+
+void
+UVCCamDevice::_ReleaseJpegDecoder(tjhandle decoder)
+{
+	if (decoder == fJpegDecompressor) {
+		fJpegDecoderLock.Unlock();
+		return;
+	}
 
-	// Debug: verify fDeframer
-	static int32 sDeframerCheck = 0;
-	if (++sDeframerCheck <= 3) {
-		syslog(LOG_INFO, "FillFrameBuffer: fDeframer=%p this=%p\n",
-			(void*)fDeframer, (void*)this);
+	BAutolock _(fFillLock);
+	for (int32 i = 1; i < fJpegDecoderCount; i++) {
+		if (fJpegDecoders[i] == decoder)
+			fJpegDecoderBusy[i] = false;
 	}
+}
+
+
+status_t
+UVCCamDevice::_FillFrameBufferLocked(BBuffer* buffer, status_t waitResult,
+	bigtime_t* stamp, uint32* sequence, mjpeg_decode_job* job)
+{
+	fFillFrameCount++;
 
 	if (fDeframer == NULL) {
 		syslog(LOG_ERR, "FillFrameBuffer: fDeframer is NULL!\n");
 		return B_ERROR;
 	}
 
-	status_t err = fDeframer->WaitFrame(2000000);
+	status_t err = waitResult;
 	if (err < B_OK) {
 		fFillFrameTimeout++;
 		// Report every 10 timeouts
@@ -2881,6 +4593,18 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 			_OnHighBandwidthFailure();
 		}
 
+		// Resend the last good frame rather than nothing; it takes the
+		// next place in the frame order like a real frame would
+		int32 w = (int32)(VideoFrame().right - VideoFrame().left + 1);
+		int32 h = (int32)(VideoFrame().bottom - VideoFrame().top + 1);
+		if (_RepeatLastFrame(buffer, w, h)) {
+			*stamp = system_time();
+			if (sequence != NULL)
+				*sequence = fFillSequence;
+			fFillSequence++;
+			return B_OK;
+		}
+
 		return err;
 	}
 
@@ -2888,26 +4612,33 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 	err = fDeframer->GetFrame(&f, stamp);
 	if (err < B_OK)
 		return err;
+	job->arrival = f->fArrival;
+	job->completed = f->fCompleted;
+	uint32 frameSequence = fFillSequence++;
+	if (sequence != NULL)
+		*sequence = frameSequence;
+	WEBCAM_TRACE_EVENT(WEBCAM_TRACE_DECODE_START, f->BufferLength(),
+		frameSequence);
 
 	fFillFrameSuccess++;
 
 	int32 w = (int32)(VideoFrame().right - VideoFrame().left + 1);
 	int32 h = (int32)(VideoFrame().bottom - VideoFrame().top + 1);
-	size_t bufferSize = (size_t)w * h * 4;
-
-	// DEBUG: Log buffer size info to check for stride issues
-	static int32 sBufSizeLog = 0;
-	if (++sBufSizeLog <= 3) {
-		size_t available = buffer->SizeAvailable();
-		size_t expectedStride = (size_t)w * 4;
-		size_t actualStride = (h > 1) ? (available / h) : expectedStride;
-		syslog(LOG_INFO, "Buffer info: available=%zu needed=%zu w=%d h=%d expectedStride=%zu actualStride=%zu\n",
-			available, bufferSize, (int)w, (int)h, expectedStride, actualStride);
-		if (actualStride != expectedStride) {
-			syslog(LOG_WARNING, "Buffer STRIDE MISMATCH! expected=%zu actual=%zu diff=%d\n",
-				expectedStride, actualStride, (int)(actualStride - expectedStride));
-		}
-	}
+	// B_YCbCr422 output passes the YUY2 frame through, 2 bytes per pixel;
+	// from MJPEG it is decoded like the other spaces
+	bool passthrough = (fColorSpace == B_YCbCr422 && !fIsMJPEG);
+	// Encoded output: the JPEG is copied, not decoded
+	bool mjpegPassthrough = fIsMJPEG && MJPEGPassthrough();
+	size_t bufferSize = mjpegPassthrough
+		? 0 : output_frame_size(fColorSpace, w, h);
+	// What the camera sends, when a larger YUY2 mode is shrunk to w x h
+	bool downscale = !fIsMJPEG && fSourceWidth != 0;
+	int32 sourceWidth = downscale ? (int32)fSourceWidth : w;
+	int32 sourceHeight = downscale ? (int32)fSourceHeight : h;
+	// Only what the consumer shows or asked for is decoded
+	clipping_rect region;
+	bool blackOutside;
+	DecodeRegion(w, h, &region, &blackOutside);
 
 	/* Task 6: Check if buffer is large enough for current resolution */
 	if (buffer->SizeAvailable() < bufferSize) {
@@ -2915,7 +4646,7 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 		if (++sBufferTooSmall <= 5 || (sBufferTooSmall % 100) == 0) {
 			syslog(LOG_WARNING, "FillFrameBuffer: Buffer too small #%d: need %zu, have %zu (%dx%d)\n",
 				(int)sBufferTooSmall, bufferSize, buffer->SizeAvailable(), (int)w, (int)h);
-			syslog(LOG_WARNING, "FillFrameBuffer: Resolution may have changed - restart stream for new buffers\n");
+			syslog(LOG_WARNING, "FillFrameBuffer: Buffer from before a resolution switch, frame dropped\n");
 		}
 		// Recycle frame back to pool instead of deleting
 		if (fDeframer != NULL)
@@ -2929,7 +4660,8 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 	fValidationStats.frames_validated++;
 	frame_validation_result validation;
 	if (fIsMJPEG) {
-		validation = _ValidateMJPEGFrame((const uint8*)f->Buffer(), f->BufferLength());
+		validation = _ValidateMJPEGFrame((const uint8*)f->Buffer(),
+			f->BufferLength(), &f->fJpegIndex);
 
 		// MJPEG frame size monitoring for auto-fallback
 		// Track frame sizes to detect if bandwidth is insufficient
@@ -2956,12 +4688,12 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 			if (avgSize < fExpectedMJPEGMinSize * 30 / 100) {
 				syslog(LOG_WARNING, "UVCCamDevice: MJPEG frames too small! avg=%zu, expected>%zu\n",
 					avgSize, fExpectedMJPEGMinSize);
-				syslog(LOG_WARNING, "UVCCamDevice: Bandwidth insufficient, triggering resolution fallback\n");
+				syslog(LOG_WARNING, "UVCCamDevice: Bandwidth insufficient, triggering fallback\n");
 
-				// Reset counters and trigger fallback
+				// Reset counters, the controller steps down below
 				fMJPEGFrameSizeSum = 0;
 				fMJPEGFrameSizeCount = 0;
-				ReduceResolution();
+				fBandwidthShortfall = true;
 			} else {
 				// Reset counters for next window
 				fMJPEGFrameSizeSum = 0;
@@ -2969,7 +4701,8 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 			}
 		}
 	} else {
-		validation = _ValidateYUY2Frame((const uint8*)f->Buffer(), f->BufferLength(), w, h);
+		validation = _ValidateUncompressedFrame((const uint8*)f->Buffer(),
+			f->BufferLength(), sourceWidth, sourceHeight);
 	}
 
 	// Update validation statistics based on result
@@ -3016,6 +4749,32 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 			"consider lowering resolution\n", fConsecutiveBadFrames);
 	}
 
+	// Encoded output gets the JPEG as it came; a damaged one is dropped,
+	// there is no picture to repeat or to decode part of
+	if (mjpegPassthrough) {
+		size_t length = 0;
+		if (validation == FRAME_VALID)
+			length = _CopyMJPEGFrame(f, buffer);
+		if (fDeframer != NULL)
+			fDeframer->RecycleFrame(f);
+		else
+			delete f;
+		if (length == 0)
+			return B_BAD_DATA;
+		buffer->Header()->size_used = length;
+		return B_OK;
+	}
+
+	// A damaged frame gets the last good one instead, when there is one;
+	// copying it beats decoding garbage over a blue fill
+	if (validation != FRAME_VALID && _RepeatLastFrame(buffer, w, h)) {
+		if (fDeframer != NULL)
+			fDeframer->RecycleFrame(f);
+		else
+			delete f;
+		return B_OK;
+	}
+
 	if (buffer->SizeAvailable() >= bufferSize) {
 		unsigned char* dst = (unsigned char*)buffer->Data();
 
@@ -3023,7 +4782,9 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 		// For valid frames, MJPEG decompression or YUY2 conversion will
 		// overwrite the entire buffer, making pre-fill unnecessary.
 		// This saves ~300KB of memory writes per frame at 320x240.
-		bool needsPreFill = (validation != FRAME_VALID);
+		// Passthrough pads short frames itself, unless it downscales.
+		bool needsPreFill = (validation != FRAME_VALID)
+			&& (!passthrough || downscale);
 
 		if (needsPreFill) {
 			// Use fast memset for pre-fill (dark blue pattern)
@@ -3031,20 +4792,41 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 			memset(dst, 0x40, bufferSize);
 		}
 
-		if (fIsMJPEG) {
+		if (passthrough) {
+			// Native YCbCr422: the YUY2 frame is already the output
+			// format, no colour conversion needed
+			if (downscale) {
+				_DownscaleYUV422(dst, (const unsigned char*)f->Buffer(),
+					f->BufferLength(), w, h, region);
+			} else {
+				_CopyYUY2Frame(dst, (const unsigned char*)f->Buffer(),
+					f->BufferLength(), w, h, region);
+			}
+			if (blackOutside)
+				black_outside_region(dst, fColorSpace, w, h, region);
+
+			if (validation == FRAME_VALID)
+				_CacheDecodedFrame(dst, bufferSize, w, h, frameSequence);
+		} else if (fIsMJPEG) {
 			// For MJPEG, validation already happened above
 			// If invalid and frame repeat enabled, we still try to decompress
-			// as partial MJPEG might produce some valid data
-			_DecompressMJPEGtoRGB32(dst,
-				(const unsigned char*)f->Buffer(), f->BufferLength(), w, h);
-
-			// Cache valid frames for potential frame repeat
-			if (validation == FRAME_VALID) {
-				_CacheValidFrame((const uint8*)f->Buffer(), f->BufferLength(), w, h);
-			}
+			// as partial MJPEG might produce some valid data.
+			// FillFrameBuffer() decodes it once fFillLock is released and
+			// recycles the frame afterwards, caching the decoded picture
+			// if the frame was valid.
+			job->frame = f;
+			job->dst = dst;
+			job->width = w;
+			job->height = h;
+			job->sequence = frameSequence;
+			job->valid = (validation == FRAME_VALID);
+			job->region = region;
+			job->blackOutside = blackOutside;
+			return B_OK;
 		} else {
-			// Check for incomplete YUY2 data
-			size_t expectedYUY2 = (size_t)w * h * 2;
+			// Check for incomplete YUY2 (or NV12) data
+			size_t expectedYUY2 = _UncompressedFrameSize(sourceWidth,
+				sourceHeight);
 			size_t actualYUY2 = f->BufferLength();
 
 			if (actualYUY2 < expectedYUY2) {
@@ -3069,7 +4851,7 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 					yuy2Data[8], yuy2Data[9], yuy2Data[10], yuy2Data[11],
 					yuy2Data[12], yuy2Data[13], yuy2Data[14], yuy2Data[15]);
 				// Check row 2 start (offset = w*2 = 640 for 320 width)
-				size_t row2Offset = (size_t)w * 2;
+				size_t row2Offset = (size_t)sourceWidth * 2;
 				if (actualYUY2 > row2Offset + 16) {
 					syslog(LOG_INFO, "YUY2 row2 (offset %zu): %02x %02x %02x %02x %02x %02x %02x %02x\n",
 						row2Offset, yuy2Data[row2Offset], yuy2Data[row2Offset+1],
@@ -3081,13 +4863,22 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 
 			// Pass actual size so conversion can calculate correct stride
 			// (some webcams add padding to each row)
-			_ConvertYUY2toRGB32(dst,
-				(unsigned char*)f->Buffer(), actualYUY2, w, h);
+			if (downscale) {
+				_DownscaleYUV422(dst, (const unsigned char*)f->Buffer(),
+					actualYUY2, w, h, region);
+			} else if (fIsNV12) {
+				_ConvertNV12toRGB(dst, (const unsigned char*)f->Buffer(),
+					actualYUY2, w, h, region);
+			} else {
+				_ConvertYUV422toRGB(dst,
+					(unsigned char*)f->Buffer(), actualYUY2, w, h, region);
+			}
+			if (blackOutside)
+				black_outside_region(dst, fColorSpace, w, h, region);
 
 			// Cache valid frames
-			if (validation == FRAME_VALID) {
-				_CacheValidFrame((const uint8*)f->Buffer(), f->BufferLength(), w, h);
-			}
+			if (validation == FRAME_VALID)
+				_CacheDecodedFrame(dst, bufferSize, w, h, frameSequence);
 		}
 	}
 
@@ -3101,43 +4892,141 @@ UVCCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp)
 }
 
 
-// Optimized inline clamp function using branchless technique
-static inline uint8
-clamp255(int32 v)
+BList*
+UVCCamDevice::_StreamFrames()
 {
-	// Branchless clamp: faster than conditional on most CPUs
-	v = v < 0 ? 0 : v;
-	return (uint8)(v > 255 ? 255 : v);
+	if (fIsMJPEG)
+		return &fMJPEGFrames;
+	return fIsNV12 ? &fNV12Frames : &fUncompressedFrames;
 }
 
 
-void
-UVCCamDevice::_ConvertYUY2toRGB32(unsigned char* dst, unsigned char* src,
-	size_t srcSize, int32 width, int32 height)
+uint32
+UVCCamDevice::_StreamFrameIndex() const
 {
-	// Optimized YUY2 to RGB32 conversion using pre-computed lookup tables.
-	// Eliminates per-pixel multiplications - only table lookups and additions.
-	// YUY2 format: Y0 U Y1 V (4 bytes = 2 pixels)
-
-	if (!dst || !src || width <= 0 || height <= 0)
-		return;
+	if (fIsMJPEG)
+		return fMJPEGFrameIndex;
+	return fIsNV12 ? fNV12FrameIndex : fUncompressedFrameIndex;
+}
 
-	// Ensure lookup tables are initialized
-	if (!gYuvRgbTables.initialized) {
-		gYuvRgbTables.Initialize();
-	}
 
-	// Cache table pointers for faster access in inner loop
-	const int32* yTable = gYuvRgbTables.y_table;
-	const int32* uBTable = gYuvRgbTables.u_b_table;
-	const int32* uGTable = gYuvRgbTables.u_g_table;
-	const int32* vRTable = gYuvRgbTables.v_r_table;
-	const int32* vGTable = gYuvRgbTables.v_g_table;
+size_t
+UVCCamDevice::_UncompressedFrameSize(int32 width, int32 height) const
+{
+	if (fIsNV12)
+		return nv12_frame_size(width, height);
+	return (size_t)width * height * 2;
+}
 
-	size_t srcStride = (size_t)width * 2;  // YUY2: 2 bytes per pixel
-	size_t dstStride = (size_t)width * 4;  // RGB32: 4 bytes per pixel
 
-	// Enhanced YUY2 diagnostics to detect byte order issues
+/* B_YCbCr422 takes YUY2 as it comes where the camera has it in the size,
+ * and MJPEG decoded to its planes otherwise, which is how large modes
+ * that uncompressed would not fit the bus at a usable rate get there */
+bool
+UVCCamDevice::_PassYUY2Through(uint32 width, uint32 height)
+{
+	if (fUncompressedFrames.CountItems() == 0)
+		return false;
+	if (fMJPEGFrames.CountItems() == 0 || fJpegDecompressor == NULL
+		|| width == 0 || height == 0)
+		return true;
+
+	for (int32 i = 0; i < fUncompressedFrames.CountItems(); i++) {
+		const usb_video_frame_descriptor* descriptor
+			= (const usb_video_frame_descriptor*)fUncompressedFrames.ItemAt(i);
+		if (descriptor->width == width && descriptor->height == height)
+			return true;
+	}
+	return false;
+}
+
+
+/* Streams NV12 instead of YUY2 where the camera has both at this size:
+ * the same picture in three quarters of the bandwidth, so higher frame
+ * rates fit the endpoint. B_YCbCr422 passes YUY2 through and keeps it.
+ * WEBCAM_NV12=0 sticks to YUY2. */
+bool
+UVCCamDevice::_PreferNV12(uint32 width, uint32 height)
+{
+	if (fNV12Frames.CountItems() == 0 || fColorSpace == B_YCbCr422)
+		return false;
+	if (fUncompressedFrames.CountItems() == 0)
+		return true;
+
+	const char* nv12 = getenv("WEBCAM_NV12");
+	if (nv12 != NULL && strcmp(nv12, "0") == 0)
+		return false;
+
+	for (int32 i = 0; i < fNV12Frames.CountItems(); i++) {
+		const usb_video_frame_descriptor* descriptor
+			= (const usb_video_frame_descriptor*)fNV12Frames.ItemAt(i);
+		if (descriptor->width == width && descriptor->height == height)
+			return true;
+	}
+	return false;
+}
+
+
+/* Picks the YUV kernel for the uncompressed stream and the output color
+ * space: layout from the format GUID (NV12 is woven into YUYV), matrix
+ * from its color matching descriptor. WEBCAM_YUV_MATRIX=601|709 and
+ * WEBCAM_YUV_RANGE=full|limited override cameras that describe themselves
+ * wrong. Under fFillLock. */
+void
+UVCCamDevice::_SelectConvertKernel()
+{
+	yuv422_format format;
+	format.layout = fIsNV12 ? YUV422_YUYV : fUncompressedLayout;
+	format.matrix = fIsNV12 ? fNV12Matrix : fUncompressedMatrix;
+	format.range = YUV_RANGE_LIMITED;
+	format.destination = fColorSpace;
+
+	const char* matrix = getenv("WEBCAM_YUV_MATRIX");
+	if (matrix != NULL && strcmp(matrix, "709") == 0)
+		format.matrix = YUV_MATRIX_BT709;
+	else if (matrix != NULL && strcmp(matrix, "601") == 0)
+		format.matrix = YUV_MATRIX_BT601;
+	const char* range = getenv("WEBCAM_YUV_RANGE");
+	if (range != NULL && strcmp(range, "full") == 0)
+		format.range = YUV_RANGE_FULL;
+
+	if (!yuv422_rgb_best_kernel(format, &fConvertKernel)) {
+		// Not a conversion output (B_YCbCr422 passes through)
+		memset(&fConvertKernel, 0, sizeof(fConvertKernel));
+		return;
+	}
+
+	syslog(LOG_INFO, "UVCCamDevice: %s %s %s range -> color space 0x%x, "
+		"%s kernel\n", fIsNV12 ? "NV12"
+			: format.layout == YUV422_UYVY ? "UYVY" : "YUYV",
+		yuv_matrix_name(format.matrix),
+		format.range == YUV_RANGE_FULL ? "full" : "limited",
+		(unsigned)format.destination, fConvertKernel.name);
+}
+
+
+void
+UVCCamDevice::_ConvertYUV422toRGB(unsigned char* dst, unsigned char* src,
+	size_t srcSize, int32 width, int32 height, const clipping_rect& region)
+{
+	// YUV 4:2:2 to the output RGB format, one row at a time through the
+	// kernel _SelectConvertKernel() picked for this CPU and stream.
+	// YUY2 format: Y0 U Y1 V (4 bytes = 2 pixels)
+
+	if (!dst || !src || width <= 0 || height <= 0)
+		return;
+
+	// The color space may have been renegotiated since StartTransfer()
+	if (fConvertKernel.convert == NULL
+		|| fConvertKernel.destination != fColorSpace)
+		_SelectConvertKernel();
+	if (fConvertKernel.convert == NULL)
+		return;
+
+	size_t srcStride = (size_t)width * 2;  // YUY2: 2 bytes per pixel
+	size_t dstStride = (size_t)width * fConvertKernel.bytes_per_pixel;
+
+	// Enhanced YUY2 diagnostics to detect byte order issues
 	static int32 sYUY2Diag = 0;
 	if (++sYUY2Diag <= 5) {
 		// Analyze first few pixels to detect YUYV vs UYVY
@@ -3219,44 +5108,81 @@ UVCCamDevice::_ConvertYUY2toRGB32(unsigned char* dst, unsigned char* src,
 	}
 #endif
 
-	// Row-by-row conversion for proper stride handling
-	for (int32 row = 0; row < height; row++) {
-		const unsigned char* srcRow = src + row * srcStride;
-		unsigned char* dstRow = dst + row * dstStride;
+	yuv422_to_rgb_region(fConvertKernel, dst, src, srcSize, width, height,
+		region);
+}
 
-		// Check source bounds for this row
-		if ((size_t)(srcRow - src) + srcStride > srcSize)
-			break;
 
-		// Process this row (width pixels = width/2 YUY2 macro-pixels)
-		for (int32 x = 0; x < width; x += 2) {
-			// Read YUY2 macro-pixel (2 pixels)
-			uint8 y0 = srcRow[0];
-			uint8 u  = srcRow[1];
-			uint8 y1 = srcRow[2];
-			uint8 v  = srcRow[3];
-			srcRow += 4;
+void
+UVCCamDevice::_ConvertNV12toRGB(unsigned char* dst, const unsigned char* src,
+	size_t srcSize, int32 width, int32 height, const clipping_rect& region)
+{
+	if (!dst || !src || width <= 0 || height <= 0)
+		return;
+
+	if (fConvertKernel.convert == NULL
+		|| fConvertKernel.destination != fColorSpace)
+		_SelectConvertKernel();
+	if (fConvertKernel.convert == NULL)
+		return;
+
+	nv12_to_rgb_region(fConvertKernel, dst, src, srcSize, width, height,
+		region);
+}
+
+
+/* The output of a larger YUY2 mode, see _AcceptDownscaledFrame(): the box
+ * filter runs inside the conversion, or alone for B_YCbCr422, which gets
+ * the whole frame */
+void
+UVCCamDevice::_DownscaleYUV422(unsigned char* dst, const unsigned char* src,
+	size_t srcSize, int32 width, int32 height, const clipping_rect& region)
+{
+	if (!dst || !src || width <= 0 || height <= 0)
+		return;
 
-			// Lookup pre-computed values (no multiplications!)
-			int32 yVal0 = yTable[y0];
-			int32 yVal1 = yTable[y1];
-			int32 uB = uBTable[u];
-			int32 uG = uGTable[u];
-			int32 vR = vRTable[v];
-			int32 vG = vGTable[v];
+	if (fColorSpace == B_YCbCr422) {
+		yuv422_downscale_frame(fUncompressedLayout, dst, width, height, src,
+			srcSize, fSourceWidth, fSourceHeight);
+		return;
+	}
 
-			// Pixel 0: BGRA (combine Y with U/V contributions, then shift)
-			dstRow[0] = clamp255((yVal0 + uB + 128) >> 8);           // B
-			dstRow[1] = clamp255((yVal0 + uG + vG + 128) >> 8);      // G
-			dstRow[2] = clamp255((yVal0 + vR + 128) >> 8);           // R
-			dstRow[3] = 255;                                          // A
+	if (fConvertKernel.convert == NULL
+		|| fConvertKernel.destination != fColorSpace)
+		_SelectConvertKernel();
+	if (fConvertKernel.convert == NULL)
+		return;
 
-			// Pixel 1: BGRA
-			dstRow[4] = clamp255((yVal1 + uB + 128) >> 8);           // B
-			dstRow[5] = clamp255((yVal1 + uG + vG + 128) >> 8);      // G
-			dstRow[6] = clamp255((yVal1 + vR + 128) >> 8);           // R
-			dstRow[7] = 255;                                          // A
-			dstRow += 8;
+	yuv422_downscale_to_rgb_region(fConvertKernel, fUncompressedLayout, dst,
+		width, height, src, srcSize, fSourceWidth, fSourceHeight, region);
+}
+
+
+void
+UVCCamDevice::_CopyYUY2Frame(unsigned char* dst, const unsigned char* src,
+	size_t srcSize, int32 width, int32 height, const clipping_rect& region)
+{
+	// YUY2 passthrough for B_YCbCr422 output, the rows and columns of the
+	// region only. Short frames are padded with black (Y=0x00, U/V=0x80)
+	// like the deframer does, so rows stay aligned.
+	if (!dst || width <= 0 || height <= 0)
+		return;
+	if (region.left > region.right || region.top > region.bottom)
+		return;
+
+	size_t stride = (size_t)width * 2;
+	size_t rowBytes = (size_t)(region.right - region.left + 1) * 2;
+	for (int32 row = region.top; row <= region.bottom; row++) {
+		size_t offset = row * stride + (size_t)region.left * 2;
+		size_t copySize = 0;
+		if (src != NULL && offset < srcSize) {
+			copySize = srcSize - offset < rowBytes ? srcSize - offset
+				: rowBytes;
+			memcpy(dst + offset, src + offset, copySize);
+		}
+		for (size_t i = copySize & ~(size_t)1; i < rowBytes; i += 2) {
+			dst[offset + i] = 0x00;
+			dst[offset + i + 1] = 0x80;
 		}
 	}
 }
@@ -3264,60 +5190,64 @@ UVCCamDevice::_ConvertYUY2toRGB32(unsigned char* dst, unsigned char* src,
 
 // FIX BUG 6: Contatori MJPEG ora sono membri di istanza (vedi header)
 
-void
-UVCCamDevice::_DecompressMJPEGtoRGB32(unsigned char* dst,
-                                       const unsigned char* src,
-                                       size_t srcSize,
-                                       int32 width, int32 height)
-{
-	fMjpegAttempts++;
 
-	if (!fJpegDecompressor || !dst || !src || srcSize == 0 || width <= 0 || height <= 0)
-		return;
+/* Runs without fFillLock, possibly on several threads at once: counters
+ * are updated atomically and all TurboJPEG calls use 'decompressor'. */
+status_t
+UVCCamDevice::_DecompressMJPEG(tjhandle decompressor, unsigned char* dst,
+	const unsigned char* src, size_t srcSize, int32 width, int32 height,
+	const cam_jpeg_index* index, const clipping_rect* region)
+{
+	atomic_add(&fMjpegAttempts, 1);
 
-	// Find JPEG SOI marker (0xFF 0xD8) - UVC may have header before JPEG data
-	const unsigned char* jpegStart = src;
-	size_t jpegSize = srcSize;
-	size_t scanLimit = srcSize < 2048 ? srcSize : 2048;
+	if (!decompressor || !dst || !src || srcSize == 0 || width <= 0 || height <= 0)
+		return B_BAD_VALUE;
 
-	for (size_t i = 0; i < scanLimit - 1; i++) {
-		if (src[i] == 0xFF && src[i + 1] == 0xD8) {
-			jpegStart = src + i;
-			jpegSize = srcSize - i;
+	mjpeg_frame_info info;
+	switch (mjpeg_parse_frame(decompressor, src, srcSize, width, height,
+			&info, index)) {
+		case MJPEG_PARSE_OK:
 			break;
+
+		case MJPEG_PARSE_NO_SOI:
+		{
+			int32 noSOI = atomic_add(&fMjpegNoSOI, 1) + 1;
+			// Log first few failures and then periodically
+			if (noSOI <= 5 || (noSOI % 100) == 0) {
+				syslog(LOG_WARNING, "MJPEG: No SOI marker #%d, srcSize=%zu, first bytes=[%02x %02x %02x %02x]\n",
+					(int)noSOI, srcSize,
+					srcSize > 0 ? src[0] : 0, srcSize > 1 ? src[1] : 0,
+					srcSize > 2 ? src[2] : 0, srcSize > 3 ? src[3] : 0);
+			}
+			return B_BAD_DATA;
 		}
-	}
 
-	// Verify we found JPEG data
-	if (jpegStart[0] != 0xFF || jpegStart[1] != 0xD8) {
-		fMjpegNoSOI++;
-		// Log first few failures and then periodically
-		if (fMjpegNoSOI <= 5 || (fMjpegNoSOI % 100) == 0) {
-			syslog(LOG_WARNING, "MJPEG: No SOI marker #%d, srcSize=%zu, first bytes=[%02x %02x %02x %02x]\n",
-				(int)fMjpegNoSOI, srcSize,
-				srcSize > 0 ? src[0] : 0, srcSize > 1 ? src[1] : 0,
-				srcSize > 2 ? src[2] : 0, srcSize > 3 ? src[3] : 0);
+		case MJPEG_PARSE_BAD_HEADER:
+		{
+			int32 errors = atomic_add(&fMjpegDecompressErrors, 1) + 1;
+			if (errors <= 5 || (errors % 100) == 0) {
+				syslog(LOG_WARNING, "MJPEG: Header decode failed #%d: %s\n",
+					(int)errors, tjGetErrorStr2(decompressor));
+			}
+			return B_BAD_DATA;
 		}
-		return;
-	}
 
-	/* Task 5: Enhanced MJPEG decompression for various resolutions */
-	/* First, get actual JPEG dimensions from header */
-	int jpegWidth = 0, jpegHeight = 0, jpegSubsamp = 0, jpegColorspace = 0;
-	int headerResult = tjDecompressHeader3(fJpegDecompressor, jpegStart, jpegSize,
-		&jpegWidth, &jpegHeight, &jpegSubsamp, &jpegColorspace);
+		case MJPEG_PARSE_TOO_LARGE:
+			syslog(LOG_ERR, "MJPEG: JPEG too large for buffer: JPEG=%dx%d, buffer=%dx%d, skipping\n",
+				info.width, info.height, (int)width, (int)height);
+			return B_BAD_DATA;
+	}
 
-	if (headerResult != 0) {
-		fMjpegDecompressErrors++;
-		if (fMjpegDecompressErrors <= 5 || (fMjpegDecompressErrors % 100) == 0) {
-			syslog(LOG_WARNING, "MJPEG: Header decode failed #%d: %s\n",
-				(int)fMjpegDecompressErrors, tjGetErrorStr2(fJpegDecompressor));
+	if (info.decode_width != info.width || info.decode_height != info.height) {
+		static int32 sScaledLog = 0;
+		if (++sScaledLog <= 3) {
+			syslog(LOG_INFO, "MJPEG: DCT scaled decode %dx%d -> %dx%d\n",
+				info.width, info.height, info.decode_width, info.decode_height);
 		}
-		return;
 	}
 
 	/* Warn if JPEG dimensions don't match expected output */
-	if (jpegWidth != width || jpegHeight != height) {
+	if (info.decode_width != width || info.decode_height != height) {
 		/* Check if we're in resolution transition grace period (500ms after change) */
 		bigtime_t now = system_time();
 		bool inTransition = (fResolutionTransitionStart > 0) &&
@@ -3328,50 +5258,35 @@ UVCCamDevice::_DecompressMJPEGtoRGB32(unsigned char* dst,
 			static int32 sTransitionSkipped = 0;
 			if (++sTransitionSkipped <= 3) {
 				syslog(LOG_INFO, "MJPEG: Skipping transition frame #%d (JPEG=%dx%d, expected=%dx%d)\n",
-					(int)sTransitionSkipped, jpegWidth, jpegHeight, (int)width, (int)height);
+					(int)sTransitionSkipped, info.width, info.height, (int)width, (int)height);
 			}
-			return;
+			return B_BAD_DATA;
 		}
 
 		static int32 sDimensionMismatch = 0;
 		if (++sDimensionMismatch <= 5 || (sDimensionMismatch % 100) == 0) {
 			syslog(LOG_WARNING, "MJPEG: Dimension mismatch #%d: JPEG=%dx%d, expected=%dx%d\n",
-				(int)sDimensionMismatch, jpegWidth, jpegHeight, (int)width, (int)height);
-		}
-		/* If JPEG is larger than buffer, we cannot decompress - skip frame */
-		if (jpegWidth > width || jpegHeight > height) {
-			syslog(LOG_ERR, "MJPEG: JPEG too large for buffer: JPEG=%dx%d, buffer=%dx%d, skipping\n",
-				jpegWidth, jpegHeight, (int)width, (int)height);
-			return;
+				(int)sDimensionMismatch, info.width, info.height, (int)width, (int)height);
 		}
 	}
 
-	/* FIX: Use actual JPEG dimensions for decompression, not expected dimensions.
-	 * When JPEG dimensions differ from expected, using expected width for pitch
-	 * causes horizontal offset/stair-step artifacts because TurboJPEG writes
-	 * jpegWidth pixels per row but the pitch assumes width pixels per row.
-	 *
-	 * Strategy: Decompress to actual JPEG dimensions with matching pitch.
-	 * If JPEG is smaller, it will appear in top-left corner on the dark blue
-	 * background (buffer was pre-filled in FillFrameBuffer).
-	 */
-	int decompressWidth = jpegWidth;
-	int decompressHeight = jpegHeight;
-	int decompressPitch = decompressWidth * 4;
-
-	// If JPEG matches expected, use expected dimensions (normal case)
-	if (jpegWidth == width && jpegHeight == height) {
-		decompressWidth = width;
-		decompressHeight = height;
-		decompressPitch = width * 4;
+	int result;
+	if (mjpeg_decode_yuv_supports(fColorSpace)) {
+		// The planes belong to the handle, whose decode this one is
+		mjpeg_yuv_scratch* scratch = &fJpegYUVScratch[0];
+		for (int32 i = 1; i < fJpegDecoderCount; i++) {
+			if (fJpegDecoders[i] == decompressor)
+				scratch = &fJpegYUVScratch[i];
+		}
+		result = mjpeg_decode_yuv(decompressor, info, scratch, dst, width,
+			height, fColorSpace, region);
+	} else {
+		result = mjpeg_decode_rgb(decompressor, info, dst, width, height,
+			fColorSpace, region);
 	}
 
-	// Decompress directly to BGRA (RGB32 on Haiku)
-	int result = tjDecompress2(fJpegDecompressor, jpegStart, jpegSize, dst,
-	              decompressWidth, decompressPitch, decompressHeight, TJPF_BGRA, TJFLAG_FASTDCT);
-
 	if (result == 0) {
-		fMjpegSuccess++;
+		int32 success = atomic_add(&fMjpegSuccess, 1) + 1;
 
 		/* Clear resolution transition state on first successful frame */
 		if (fResolutionTransitionStart > 0) {
@@ -3382,19 +5297,21 @@ UVCCamDevice::_DecompressMJPEGtoRGB32(unsigned char* dst,
 		}
 
 		/* Log periodic success stats at high resolutions */
-		if (width >= 1280 && (fMjpegSuccess % 300) == 0) {
+		if (width >= 1280 && (success % 300) == 0) {
 			syslog(LOG_INFO, "MJPEG %dx%d: %d frames decoded (errors: %d, no SOI: %d)\n",
-				(int)width, (int)height, (int)fMjpegSuccess,
+				(int)width, (int)height, (int)success,
 				(int)fMjpegDecompressErrors, (int)fMjpegNoSOI);
 		}
 	} else {
-		fMjpegDecompressErrors++;
-		if (fMjpegDecompressErrors <= 5 || (fMjpegDecompressErrors % 100) == 0) {
+		int32 errors = atomic_add(&fMjpegDecompressErrors, 1) + 1;
+		if (errors <= 5 || (errors % 100) == 0) {
 			syslog(LOG_WARNING, "MJPEG: Decompress failed #%d at %dx%d: %s (src=%zu bytes)\n",
-				(int)fMjpegDecompressErrors, (int)width, (int)height,
-				tjGetErrorStr2(fJpegDecompressor), jpegSize);
+				(int)errors, (int)width, (int)height,
+				tjGetErrorStr2(decompressor), info.jpeg_size);
 		}
 	}
+
+	return result == 0 ? B_OK : B_ERROR;
 }
 
 
@@ -3404,13 +5321,23 @@ UVCCamDevice::_DecompressMJPEGtoRGB32(unsigned char* dst,
 
 
 frame_validation_result
-UVCCamDevice::_ValidateMJPEGFrame(const uint8* data, size_t size)
+UVCCamDevice::_ValidateMJPEGFrame(const uint8* data, size_t size,
+	const cam_jpeg_index* index)
 {
 	// Check minimum size
 	if (size < kMinMJPEGFrameSize) {
 		return FRAME_CORRUPTED_TRUNCATED;
 	}
 
+	// The deframer has walked the markers already
+	if (index != NULL && index->state != CAM_JPEG_SCAN_SOI) {
+		if (index->soi_offset == CAM_JPEG_NONE)
+			return FRAME_CORRUPTED_NO_SOI;
+		if (index->eoi_offset == CAM_JPEG_NONE)
+			return FRAME_CORRUPTED_NO_EOI;
+		return FRAME_VALID;
+	}
+
 	// Check for SOI marker (0xFF 0xD8) at start
 	if (data[0] != 0xFF || data[1] != 0xD8) {
 		return FRAME_CORRUPTED_NO_SOI;
@@ -3436,11 +5363,11 @@ UVCCamDevice::_ValidateMJPEGFrame(const uint8* data, size_t size)
 
 
 frame_validation_result
-UVCCamDevice::_ValidateYUY2Frame(const uint8* data, size_t size,
+UVCCamDevice::_ValidateUncompressedFrame(const uint8* data, size_t size,
 	int32 width, int32 height)
 {
 	(void)data;  // Unused for now, just size check
-	size_t expectedSize = (size_t)width * height * 2;  // YUY2 is 2 bytes per pixel
+	size_t expectedSize = _UncompressedFrameSize(width, height);
 
 	if (size < (expectedSize * kMinYUY2FramePercent / 100)) {
 		return FRAME_INCOMPLETE;
@@ -3450,6 +5377,31 @@ UVCCamDevice::_ValidateYUY2Frame(const uint8* data, size_t size,
 }
 
 
+/* The JPEG of a valid frame into 'buffer', with the standard Huffman
+ * tables if the camera left them out; 0 if it does not fit */
+size_t
+UVCCamDevice::_CopyMJPEGFrame(CamFrame* frame, BBuffer* buffer)
+{
+	const uint8* data = (const uint8*)frame->Buffer();
+	cam_jpeg_index index = frame->fJpegIndex;
+	if (index.state == CAM_JPEG_SCAN_SOI) {
+		// Not indexed while it was assembled
+		cam_jpeg_index_reset(&index);
+		cam_jpeg_index_update(&index, data, frame->BufferLength());
+	}
+
+	size_t length = cam_jpeg_copy_with_tables(index, data,
+		(uint8*)buffer->Data(), buffer->SizeAvailable());
+	if (length == 0) {
+		syslog(LOG_WARNING, "UVCCamDevice: MJPEG frame of %zu bytes not "
+			"passed on (%s)\n", frame->BufferLength(),
+			cam_jpeg_index_complete(index) ? "buffer too small"
+				: "incomplete");
+	}
+	return length;
+}
+
+
 bool
 UVCCamDevice::_FindJpegMarker(const uint8* data, size_t size,
 	uint8 marker, size_t* position)
@@ -3465,44 +5417,182 @@ UVCCamDevice::_FindJpegMarker(const uint8* data, size_t size,
 }
 
 
+/* Keeps a copy of the frame just produced, in the output format, for
+ * _RepeatLastFrame(). Decoders finish out of order, so only a newer frame
+ * replaces the cached one. All of this is skipped with frame repeat off. */
 void
-UVCCamDevice::_CacheValidFrame(const uint8* data, size_t size,
-	int32 width, int32 height)
+UVCCamDevice::_CacheDecodedFrame(const uint8* data, size_t size,
+	int32 width, int32 height, uint32 sequence)
 {
-	// Reallocate if size changed
-	if (fLastValidFrame == NULL || fLastValidFrameSize < size) {
-		delete[] fLastValidFrame;
-		fLastValidFrame = new(std::nothrow) uint8[size];
-		if (fLastValidFrame == NULL) {
-			fLastValidFrameSize = 0;
+	if (!fFrameRepeatEnabled)
+		return;
+
+	DecodedFrame* frame;
+	{
+		BAutolock _(fFrameCacheLock);
+		if (fLastFrame != NULL && fLastFrame->fSize > 0
+			&& (int32)(sequence - fLastFrame->fSequence) <= 0
+			&& fLastFrame->fWidth == width && fLastFrame->fHeight == height)
+			return;
+		frame = fSpareFrame;
+		fSpareFrame = NULL;
+	}
+
+	if (frame != NULL && frame->fCapacity < size) {
+		frame->ReleaseReference();
+		frame = NULL;
+	}
+	CamFrameArena* arena = fStreamArena;
+	if (frame == NULL && arena->SlotSize(kArenaDecodedFrames) >= size) {
+		void* slot = arena->AcquireSlot(kArenaDecodedFrames);
+		if (slot != NULL) {
+			frame = new(std::nothrow) DecodedFrame(arena, slot,
+				arena->SlotSize(kArenaDecodedFrames));
+			if (frame == NULL)
+				arena->ReleaseSlot(slot);
+		}
+	}
+	if (frame == NULL) {
+		frame = new(std::nothrow) DecodedFrame(size);
+		if (frame == NULL || frame->fCapacity < size) {
+			if (frame != NULL)
+				frame->ReleaseReference();
 			return;
 		}
 	}
 
-	memcpy(fLastValidFrame, data, size);
-	fLastValidFrameSize = size;
-	fLastValidWidth = width;
-	fLastValidHeight = height;
+	memcpy(frame->fData, data, size);
+	frame->fSize = size;
+	frame->fWidth = width;
+	frame->fHeight = height;
+	frame->fColorSpace = fColorSpace;
+	frame->fSequence = sequence;
+
+	BAutolock _(fFrameCacheLock);
+	DecodedFrame* old = fLastFrame;
+	fLastFrame = frame;
 	fValidationStats.last_valid_frame_time = system_time();
+
+	// Reuse the old storage next time unless a repeat still copies from it
+	if (old != NULL) {
+		if (fSpareFrame == NULL && old->CountReferences() == 1)
+			fSpareFrame = old;
+		else
+			old->ReleaseReference();
+	}
 }
 
 
+/* Fills 'buffer' with the last cached frame if it matches the current
+ * format. The copy runs unlocked on a reference of its own. */
 bool
-UVCCamDevice::_UseLastValidFrame(uint8* dst, size_t dstSize)
+UVCCamDevice::_RepeatLastFrame(BBuffer* buffer, int32 width, int32 height)
 {
-	if (fLastValidFrame == NULL || fLastValidFrameSize == 0) {
+	if (!fFrameRepeatEnabled || buffer == NULL || MJPEGPassthrough())
 		return false;
+
+	DecodedFrame* frame;
+	{
+		BAutolock _(fFrameCacheLock);
+		frame = fLastFrame;
+		if (frame == NULL)
+			return false;
+		frame->AcquireReference();
 	}
+	BReference<DecodedFrame> reference(frame, true);
 
-	// For RGB32 output, we need to decompress/convert the cached frame
-	// This simplified version just copies if dst is large enough
-	if (dstSize >= fLastValidFrameSize) {
-		memcpy(dst, fLastValidFrame, fLastValidFrameSize);
-		fValidationStats.frames_repeated++;
-		return true;
+	if (frame->fWidth != width || frame->fHeight != height
+		|| frame->fColorSpace != fColorSpace
+		|| buffer->SizeAvailable() < frame->fSize)
+		return false;
+
+	memcpy(buffer->Data(), frame->fData, frame->fSize);
+	atomic_add((int32*)&fValidationStats.frames_repeated, 1);
+	return true;
+}
+
+
+void
+UVCCamDevice::_DropDecodedFrames()
+{
+	BAutolock _(fFrameCacheLock);
+	if (fLastFrame != NULL)
+		fLastFrame->ReleaseReference();
+	if (fSpareFrame != NULL)
+		fSpareFrame->ReleaseReference();
+	fLastFrame = NULL;
+	fSpareFrame = NULL;
+}
+
+
+/* Lays the frame arena out for the format just committed: raw frame slots
+ * of dwMaxVideoFrameSize for the deframer, and output sized slots for the
+ * frame repeat cache. Runs before the pump thread starts, so no new frame
+ * is in flight. On a resolution switch the decoders can still hold frames
+ * of the old size; the new layout then goes into the other arena, and the
+ * old one is freed once they are back. */
+status_t
+UVCCamDevice::_SetUpFrameArena()
+{
+	if (fDeframer == NULL)
+		return B_NO_INIT;
+
+	// Some devices commit a zero dwMaxVideoFrameSize; an uncompressed
+	// frame of the mode is the most a sane MJPEG frame takes too
+	size_t rawSize = fMaxVideoFrameSize;
+	if (rawSize == 0) {
+		BList* frameList = _StreamFrames();
+		uint32 frameIndex = _StreamFrameIndex();
+		const usb_video_frame_descriptor* descriptor = NULL;
+		if (frameIndex > 0 && frameIndex <= (uint32)frameList->CountItems()) {
+			descriptor = (const usb_video_frame_descriptor*)
+				frameList->ItemAt(frameIndex - 1);
+		}
+		if (descriptor != NULL)
+			rawSize = (size_t)descriptor->width * descriptor->height * 2;
 	}
 
-	return false;
+	BRect frame = VideoFrame();
+	size_t decodedSize = output_frame_size(fColorSpace,
+		frame.IntegerWidth() + 1, frame.IntegerHeight() + 1);
+
+	// Both users let go of their slots first, or the layout cannot change
+	fDeframer->SetFrameArena(NULL, -1);
+	_DropDecodedFrames();
+
+	CamFrameArena* other = fStreamArena == &fFrameArena
+		? &fSpareFrameArena : &fFrameArena;
+	if (rawSize == 0) {
+		fStreamArena->Unset();
+		other->Unset();
+		return B_BAD_VALUE;
+	}
+
+	size_t sizes[kArenaClassCount] = { rawSize, decodedSize };
+	int32 counts[kArenaClassCount]
+		= { kArenaRawFrameSlots, kArenaDecodedFrameSlots };
+	int32 classCount = fFrameRepeatEnabled ? kArenaClassCount : 1;
+	status_t err = fStreamArena->SetLayout(sizes, counts, classCount);
+	if (err == B_BUSY) {
+		err = other->SetLayout(sizes, counts, classCount);
+		if (err == B_OK) {
+			syslog(LOG_INFO, "UVCCamDevice: frames of the previous size "
+				"still out, laid out the other frame arena\n");
+			CamFrameArena* previous = fStreamArena;
+			fStreamArena = other;
+			other = previous;
+		}
+	}
+	// B_BUSY: the arena of the previous switch is not empty yet, it goes
+	// on the next one
+	other->Unset();
+	if (err != B_OK) {
+		syslog(LOG_WARNING, "UVCCamDevice: no frame arena (%s), frames come "
+			"from the heap\n", strerror(err));
+		return err;
+	}
+
+	return fDeframer->SetFrameArena(fStreamArena, kArenaRawFrames);
 }
 
 
@@ -3549,31 +5639,12 @@ UVCCamDevice::_ProbeControlRange(uint16 selector, camera_control_info* info)
 	ssize_t result;
 	int16 value;
 
-	// GET_MIN
-	result = fDevice->ControlTransfer(
-		USB_REQTYPE_INTERFACE_IN | USB_REQTYPE_CLASS,
-		USB_VIDEO_RC_GET_MIN,
-		selector << 8,
-		(fProcessingUnitID << 8) | fControlIndex,
-		sizeof(value), &value);
-	if (result >= 0) {
-		info->min_value = value;
-	} else {
-		info->min_value = 0;
-	}
-
-	// GET_MAX
-	result = fDevice->ControlTransfer(
-		USB_REQTYPE_INTERFACE_IN | USB_REQTYPE_CLASS,
-		USB_VIDEO_RC_GET_MAX,
-		selector << 8,
-		(fProcessingUnitID << 8) | fControlIndex,
-		sizeof(value), &value);
-	if (result >= 0) {
-		info->max_value = value;
-	} else {
-		info->max_value = 100;
-	}
+	// GET_MIN, GET_MAX (cached per model)
+	float minValue = 0;
+	float maxValue = 100;
+	_ControlRange(selector, &minValue, &maxValue);
+	info->min_value = (int16)minValue;
+	info->max_value = (int16)maxValue;
 
 	// GET_DEF
 	result = fDevice->ControlTransfer(
@@ -3681,14 +5752,7 @@ UVCCamDevice::_SetControlValue(uint16 selector, int16 value)
 		return B_BAD_VALUE;
 	}
 
-	ssize_t result = fDevice->ControlTransfer(
-		USB_REQTYPE_INTERFACE_OUT | USB_REQTYPE_CLASS,
-		USB_VIDEO_RC_SET_CUR,
-		selector << 8,
-		(fProcessingUnitID << 8) | fControlIndex,
-		sizeof(value), &value);
-
-	return (result >= 0) ? B_OK : (status_t)result;
+	return _QueueControl(selector, value, sizeof(value));
 }
 
 
@@ -3701,10 +5765,13 @@ void
 UVCCamDevice::_InitializeFallbackConfig()
 {
 	fFallbackConfig.error_threshold_percent = 10.0f;	// 10% packet loss triggers fallback
+	fFallbackConfig.recovery_threshold_percent
+		= fFallbackConfig.error_threshold_percent * CamConfig::kRecoveryLossFraction;
 	fFallbackConfig.evaluation_interval = 5000000;		// 5 seconds
 	fFallbackConfig.min_packets_for_eval = 100;			// Need at least 100 packets
 	fFallbackConfig.auto_recovery_enabled = true;
 	fFallbackConfig.recovery_delay = 30000000;			// 30 seconds of stability before recovery
+	fRecoveryDelay = fFallbackConfig.recovery_delay;
 }
 
 
@@ -3713,6 +5780,18 @@ UVCCamDevice::_EvaluatePacketLoss()
 {
 	bigtime_t now = system_time();
 
+	// Too small MJPEG frames: the camera already squeezes its frames into
+	// the bandwidth it has, no need to wait for the window
+	if (fBandwidthShortfall) {
+		fBandwidthShortfall = false;
+		_DegradeStream();
+		fStableStartTime = 0;
+		fEvalWindowStartTime = now;
+		fEvalWindowPackets = 0;
+		fEvalWindowErrors = 0;
+		return;
+	}
+
 	// Start new evaluation window if needed
 	if (fEvalWindowStartTime == 0) {
 		fEvalWindowStartTime = now;
@@ -3739,22 +5818,24 @@ UVCCamDevice::_EvaluatePacketLoss()
 
 	if (lossPercent > fFallbackConfig.error_threshold_percent) {
 		// High packet loss - trigger fallback
-		if (!fFallbackActive || fCurrentResolutionLevel < _GetMaxResolutionLevel()) {
-			syslog(LOG_WARNING, "UVCCamDevice: Packet loss %.1f%% exceeds threshold %.1f%%, "
-				"triggering resolution fallback\n",
-				lossPercent, fFallbackConfig.error_threshold_percent);
-			_TriggerResolutionFallback();
-		}
+		syslog(LOG_WARNING, "UVCCamDevice: Packet loss %.1f%% exceeds threshold %.1f%%, "
+			"triggering fallback\n",
+			lossPercent, fFallbackConfig.error_threshold_percent);
+		_DegradeStream();
 		fStableStartTime = 0;  // Reset stability timer
-	} else {
+	} else if (lossPercent <= fFallbackConfig.recovery_threshold_percent) {
 		// Good connection - check for recovery opportunity
 		if (fStableStartTime == 0) {
 			fStableStartTime = now;
 		} else if (fFallbackConfig.auto_recovery_enabled &&
 			fFallbackActive &&
-			(now - fStableStartTime) > fFallbackConfig.recovery_delay) {
-			_AttemptResolutionRecovery();
+			(now - fStableStartTime) > fRecoveryDelay) {
+			_RecoverStream();
 		}
+	} else {
+		// Between the two thresholds: not bad enough to step down, not good
+		// enough to count towards a step up
+		fStableStartTime = 0;
 	}
 
 	// Reset window
@@ -3764,6 +5845,36 @@ UVCCamDevice::_EvaluatePacketLoss()
 }
 
 
+/* Moves the stream to width x height. The camera only takes a new commit
+ * with streaming stopped, so the transfer is restarted; frames of the old
+ * size still queued are dropped, the MJPEG decoder skips the ones the
+ * camera sent before it switched, and VideoProducer follows with a format
+ * change on the next frame, without the node stopping. */
+status_t
+UVCCamDevice::_SwitchVideoFrame(uint32 width, uint32 height)
+{
+	bool streaming = TransferEnabled();
+	if (streaming) {
+		StopTransfer();
+		snooze(50000);  // 50ms for camera to process
+	}
+
+	status_t result = AcceptVideoFrame(width, height);
+	if (result != B_OK) {
+		// Keep streaming the old size
+		if (streaming)
+			StartTransfer();
+		return result;
+	}
+
+	fResolutionTransitionStart = system_time();
+	if (fDeframer != NULL)
+		fDeframer->Flush();
+
+	return streaming ? StartTransfer() : B_OK;
+}
+
+
 status_t
 UVCCamDevice::_TriggerResolutionFallback()
 {
@@ -3785,31 +5896,16 @@ UVCCamDevice::_TriggerResolutionFallback()
 	syslog(LOG_INFO, "UVCCamDevice: Falling back to resolution level %d (%ux%u)\n",
 		(int)fTargetResolutionLevel, newWidth, newHeight);
 
-	// FIX: Actually apply the resolution change by restarting the transfer
-	// Stop current transfer
-	if (TransferEnabled()) {
-		StopTransfer();
-		snooze(50000);  // 50ms for camera to process
-	}
-
-	// Apply the new resolution
-	status_t result = AcceptVideoFrame(newWidth, newHeight);
+	status_t result = _SwitchVideoFrame(newWidth, newHeight);
 	if (result != B_OK) {
-		syslog(LOG_ERR, "UVCCamDevice: Failed to set fallback resolution: %s\n",
+		syslog(LOG_ERR, "UVCCamDevice: Failed to apply fallback resolution: %s\n",
 			strerror(result));
 		return result;
 	}
 
 	// Update current level to match target
 	fCurrentResolutionLevel = fTargetResolutionLevel;
-
-	// Restart transfer with new resolution
-	result = StartTransfer();
-	if (result != B_OK) {
-		syslog(LOG_ERR, "UVCCamDevice: Failed to restart transfer after fallback: %s\n",
-			strerror(result));
-		return result;
-	}
+	_PushDegradeStep(UVC_DEGRADE_STEP_RESOLUTION, 0);
 
 	fFallbackActive = true;
 	fLastFallbackTime = system_time();
@@ -3835,15 +5931,9 @@ UVCCamDevice::_AttemptResolutionRecovery()
 	syslog(LOG_INFO, "UVCCamDevice: Connection stable, attempting recovery to level %d (%ux%u)\n",
 		(int)fTargetResolutionLevel, newWidth, newHeight);
 
-	// FIX: Actually apply the resolution change
-	if (TransferEnabled()) {
-		StopTransfer();
-		snooze(50000);
-	}
-
-	status_t result = AcceptVideoFrame(newWidth, newHeight);
+	status_t result = _SwitchVideoFrame(newWidth, newHeight);
 	if (result != B_OK) {
-		syslog(LOG_ERR, "UVCCamDevice: Failed to set recovery resolution: %s\n",
+		syslog(LOG_ERR, "UVCCamDevice: Failed to apply recovery resolution: %s\n",
 			strerror(result));
 		fStableStartTime = 0;
 		return result;
@@ -3851,30 +5941,306 @@ UVCCamDevice::_AttemptResolutionRecovery()
 
 	fCurrentResolutionLevel = fTargetResolutionLevel;
 
-	result = StartTransfer();
+	// Mark that we're no longer in fallback once every step is undone
+	if (fDegradeStepCount == 0) {
+		fFallbackActive = false;
+	}
+
+	fStableStartTime = 0;  // Reset for next recovery attempt
+	syslog(LOG_INFO, "UVCCamDevice: Resolution recovery applied successfully\n");
+
+	return B_OK;
+}
+
+
+uvc_degrade_policy
+UVCCamDevice::_EffectiveDegradePolicy() const
+{
+	const char* policy = getenv("WEBCAM_DEGRADE_POLICY");
+	if (policy != NULL) {
+		if (strcmp(policy, "fps") == 0)
+			return UVC_DEGRADE_FRAME_RATE;
+		if (strcmp(policy, "resolution") == 0)
+			return UVC_DEGRADE_RESOLUTION;
+		if (strcmp(policy, "balanced") == 0)
+			return UVC_DEGRADE_BALANCED;
+	}
+	return fDegradePolicy;
+}
+
+
+/* One step down when the stream does not fit the bus: a longer frame
+ * interval or a smaller frame size, as the policy says. When the preferred
+ * kind has nothing left to give up the other one is taken. */
+status_t
+UVCCamDevice::_DegradeStream()
+{
+	// Resolution levels count from the frame the stream runs at, not
+	// from the largest one
+	if (fDegradeStepCount == 0) {
+		uint32 frameIndex = _StreamFrameIndex();
+		fCurrentResolutionLevel = frameIndex > 0 ? frameIndex - 1 : 0;
+	}
+
+	// A step up that falls straight back waits twice as long next time
+	bigtime_t now = system_time();
+	if (fLastRecoveryTime != 0 && now - fLastRecoveryTime < fRecoveryDelay
+		&& fRecoveryDelay < CamConfig::kMaxRecoveryDelay) {
+		fRecoveryDelay *= 2;
+		if (fRecoveryDelay > CamConfig::kMaxRecoveryDelay)
+			fRecoveryDelay = CamConfig::kMaxRecoveryDelay;
+		syslog(LOG_INFO, "UVCCamDevice: Recovery did not hold, next one "
+			"after %" B_PRIdBIGTIME " s\n", fRecoveryDelay / 1000000);
+	}
+	fLastRecoveryTime = 0;
+
+	uvc_degrade_policy policy = _EffectiveDegradePolicy();
+	bool frameRateFirst = policy == UVC_DEGRADE_FRAME_RATE;
+	if (policy == UVC_DEGRADE_BALANCED) {
+		frameRateFirst = fDegradeStepCount == 0
+			|| fDegradeSteps[fDegradeStepCount - 1].kind
+				== UVC_DEGRADE_STEP_RESOLUTION;
+	}
+
+	status_t result = frameRateFirst
+		? _StepFrameRate() : _TriggerResolutionFallback();
+	if (result != B_OK) {
+		result = frameRateFirst
+			? _TriggerResolutionFallback() : _StepFrameRate();
+	}
+	return result;
+}
+
+
+/* Undoes the last step _DegradeStream() took, after the stream has been
+ * stable for fRecoveryDelay. */
+status_t
+UVCCamDevice::_RecoverStream()
+{
+	if (fDegradeStepCount == 0) {
+		fFallbackActive = false;
+		return B_OK;
+	}
+
+	uvc_degrade_step step = fDegradeSteps[--fDegradeStepCount];
+	fLastRecoveryTime = system_time();
+
+	if (step.kind == UVC_DEGRADE_STEP_RESOLUTION)
+		return _AttemptResolutionRecovery();
+
+	syslog(LOG_INFO, "UVCCamDevice: Connection stable, restoring frame rate "
+		"cap %.1f fps\n", step.previous > 0
+			? 10000000.0f / step.previous : 0.0f);
+	fFrameIntervalLimit = step.previous;
+
+	if (TransferEnabled()) {
+		StopTransfer();
+		snooze(50000);
+	}
+	status_t result = StartTransfer();
+	fStableStartTime = 0;
 	if (result != B_OK) {
 		syslog(LOG_ERR, "UVCCamDevice: Failed to restart transfer after recovery: %s\n",
 			strerror(result));
-		fStableStartTime = 0;
 		return result;
 	}
 
-	// Mark that we're no longer in fallback if we're back to original resolution
-	if (fCurrentResolutionLevel == 0) {
+	if (fDegradeStepCount == 0)
 		fFallbackActive = false;
-	}
+	return B_OK;
+}
 
-	fStableStartTime = 0;  // Reset for next recovery attempt
-	syslog(LOG_INFO, "UVCCamDevice: Resolution recovery applied successfully\n");
 
+/* Caps the frame rate at the next longer interval the frame descriptor
+ * advertises, down to CamConfig::kDegradeMinFrameRate. */
+status_t
+UVCCamDevice::_StepFrameRate()
+{
+	const usb_video_frame_descriptor* frame = _CurrentFrameDescriptor();
+	if (frame == NULL)
+		return B_ERROR;
+
+	uint32 interval = fCommittedFrameInterval;
+	if (fFrameIntervalLimit > interval)
+		interval = fFrameIntervalLimit;
+	if (interval == 0)
+		interval = frame->default_frame_interval;
+
+	uint32 next = _NextFrameInterval(frame, interval, true);
+	if (next == 0 || next > 10000000 / CamConfig::kDegradeMinFrameRate)
+		return B_ERROR;
+	if (!_PushDegradeStep(UVC_DEGRADE_STEP_FRAME_RATE, fFrameIntervalLimit))
+		return B_ERROR;
+
+	uint32 previous = fFrameIntervalLimit;
+	fFrameIntervalLimit = next;
+	syslog(LOG_INFO, "UVCCamDevice: Falling back to %.1f fps at %ux%u\n",
+		10000000.0f / next, frame->width, frame->height);
+
+	if (TransferEnabled()) {
+		StopTransfer();
+		snooze(50000);  // 50ms for camera to process
+	}
+	status_t result = StartTransfer();
+	if (result != B_OK) {
+		syslog(LOG_ERR, "UVCCamDevice: Failed to restart transfer after fallback: %s\n",
+			strerror(result));
+		fFrameIntervalLimit = previous;
+		fDegradeStepCount--;
+		return result;
+	}
+
+	fFallbackActive = true;
+	fLastFallbackTime = system_time();
+	fFallbackWarningShown = false;
 	return B_OK;
 }
 
 
+bool
+UVCCamDevice::_PushDegradeStep(uint8 kind, uint32 previous)
+{
+	if (fDegradeStepCount >= kMaxDegradeSteps)
+		return false;
+	fDegradeSteps[fDegradeStepCount].kind = kind;
+	fDegradeSteps[fDegradeStepCount].previous = previous;
+	fDegradeStepCount++;
+	return true;
+}
+
+
+const usb_video_frame_descriptor*
+UVCCamDevice::_CurrentFrameDescriptor()
+{
+	BList* frameList = _StreamFrames();
+	uint32 frameIndex = _StreamFrameIndex();
+	if (frameIndex == 0 || frameIndex > (uint32)frameList->CountItems())
+		return NULL;
+	return (const usb_video_frame_descriptor*)frameList->ItemAt(frameIndex - 1);
+}
+
+
+/* The advertised interval next to 'interval': the shortest one longer than
+ * it, or the longest one shorter. 0 if there is none. A continuous range
+ * is walked in steps of a third of the frame rate. */
+uint32
+UVCCamDevice::_NextFrameInterval(const usb_video_frame_descriptor* frame,
+	uint32 interval, bool longer) const
+{
+	if (frame == NULL)
+		return 0;
+
+	if (frame->frame_interval_type > 0) {
+		uint32 best = 0;
+		for (uint8 i = 0; i < frame->frame_interval_type; i++) {
+			uint32 candidate = frame->discrete_frame_intervals[i];
+			if (longer ? (candidate > interval
+					&& (best == 0 || candidate < best))
+				: (candidate < interval && candidate > best))
+				best = candidate;
+		}
+		return best;
+	}
+
+	uint32 minimum = frame->continuous.min_frame_interval;
+	uint32 maximum = frame->continuous.max_frame_interval;
+	uint32 step = frame->continuous.frame_interval_step;
+	if (step == 0)
+		step = 1;
+
+	uint64 target = longer ? (uint64)interval * 3 / 2 : (uint64)interval * 2 / 3;
+	if (target < minimum)
+		target = minimum;
+	if (target > maximum)
+		target = maximum;
+	// On the step grid, rounded away from 'interval'
+	uint64 steps = (target - minimum) / step;
+	if (longer && minimum + steps * step < target)
+		steps++;
+	uint64 next = minimum + steps * step;
+	if (next > maximum)
+		next = maximum;
+
+	if (longer ? next <= interval : next >= interval)
+		return 0;
+	return (uint32)next;
+}
+
+
+/* The advertised interval closest to 'interval'. */
+uint32
+UVCCamDevice::_NearestFrameInterval(const usb_video_frame_descriptor* frame,
+	uint32 interval) const
+{
+	if (frame == NULL)
+		return interval;
+
+	if (frame->frame_interval_type > 0) {
+		uint32 best = frame->default_frame_interval;
+		uint32 bestDistance = UINT32_MAX;
+		for (uint8 i = 0; i < frame->frame_interval_type; i++) {
+			uint32 candidate = frame->discrete_frame_intervals[i];
+			uint32 distance = candidate > interval
+				? candidate - interval : interval - candidate;
+			if (distance < bestDistance) {
+				best = candidate;
+				bestDistance = distance;
+			}
+		}
+		return best;
+	}
+
+	uint32 minimum = frame->continuous.min_frame_interval;
+	uint32 maximum = frame->continuous.max_frame_interval;
+	uint32 step = frame->continuous.frame_interval_step;
+	if (step == 0)
+		step = 1;
+	if (interval <= minimum)
+		return minimum;
+	uint64 next = minimum
+		+ ((uint64)interval - minimum + step / 2) / step * step;
+	return next < maximum ? (uint32)next : maximum;
+}
+
+
+/* The shortest advertised interval at or above 'limit', or the longest
+ * one if they are all shorter. */
+uint32
+UVCCamDevice::_LimitFrameInterval(const usb_video_frame_descriptor* frame,
+	uint32 limit) const
+{
+	if (frame == NULL)
+		return limit;
+
+	if (frame->frame_interval_type > 0) {
+		uint32 best = 0;
+		uint32 longest = 0;
+		for (uint8 i = 0; i < frame->frame_interval_type; i++) {
+			uint32 candidate = frame->discrete_frame_intervals[i];
+			if (candidate >= limit && (best == 0 || candidate < best))
+				best = candidate;
+			if (candidate > longest)
+				longest = candidate;
+		}
+		return best != 0 ? best : longest;
+	}
+
+	uint32 minimum = frame->continuous.min_frame_interval;
+	uint32 maximum = frame->continuous.max_frame_interval;
+	uint32 step = frame->continuous.frame_interval_step;
+	if (step == 0)
+		step = 1;
+	if (limit <= minimum)
+		return minimum;
+	uint64 next = minimum + ((uint64)limit - minimum + step - 1) / step * step;
+	return next < maximum ? (uint32)next : maximum;
+}
+
+
 void
 UVCCamDevice::_GetResolutionAtLevel(int32 level, uint32* width, uint32* height)
 {
-	BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+	BList* frameList = _StreamFrames();
 
 	// Level 0 = first (usually highest) resolution
 	// Higher levels = lower resolutions (later in list)
@@ -3906,7 +6272,7 @@ UVCCamDevice::_GetResolutionAtLevel(int32 level, uint32* width, uint32* height)
 int32
 UVCCamDevice::_GetMaxResolutionLevel()
 {
-	BList* frameList = fIsMJPEG ? &fMJPEGFrames : &fUncompressedFrames;
+	BList* frameList = _StreamFrames();
 	int32 count = frameList->CountItems();
 	return (count > 0) ? count - 1 : 0;
 }
@@ -3936,6 +6302,42 @@ UVCCamDevice::OnTransferSuccess()
 }
 
 
+void
+UVCCamDevice::ApplyThreadPolicy()
+{
+	CamDevice::ApplyThreadPolicy();
+
+	if (fAudioPumpThread >= 0)
+		fThreadPolicy.Apply(fAudioPumpThread, CAM_THREAD_AUDIO_PUMP);
+	for (int32 i = 0; i < fAudioTransferCount; i++)
+		fThreadPolicy.Apply(fAudioTransfers[i].thread, CAM_THREAD_AUDIO_PUMP);
+}
+
+
+void
+UVCCamDevice::GetCaptureStreamInfo(uint8 stream,
+	cam_capture_stream_info* info)
+{
+	CamDevice::GetCaptureStreamInfo(stream, info);
+
+	if (stream == CAM_CAPTURE_AUDIO) {
+		info->fourcc = 'PCM ';
+		info->sample_rate = fAudioSampleRate;
+		info->channels = fAudioChannels;
+		info->subframe_size = fAudioSubFrameSize;
+		info->bandwidth = fAudioPacketSize;
+		return;
+	}
+
+	info->fourcc = fIsMJPEG ? 'MJPG' : fIsNV12 ? 'NV12' : 'YUY2';
+	info->frame_interval = fCommittedFrameInterval;
+	if (fBulkIn != NULL)
+		info->bandwidth = fMaxPayloadTransferSize;
+	if (fDeframer != NULL)
+		info->clock_frequency = ((UVCDeframer*)fDeframer)->ClockFrequency();
+}
+
+
 bool
 UVCCamDevice::_ShouldUseHighBandwidth()
 {
@@ -4001,6 +6403,410 @@ UVCCamDevice::_ResetHighBandwidthState()
 }
 
 
+// =============================================================================
+// Still Image Capture
+// =============================================================================
+// Method 2 cameras send the still in the video stream, between two frames,
+// with STI set in its payload headers (see UVCDeframer::ExpectStill());
+// method 3 ones on a bulk endpoint of their own. Either way the still size
+// is committed with the still probe/commit controls and the still is asked
+// for with the trigger control, while the video keeps streaming. Method 1
+// stills are just the next video frame, so they are left to the client.
+
+
+/* The image size patterns of a VS_STILL_IMAGE_FRAME, for the format being
+ * parsed; it follows that format's frame descriptors. */
+void
+UVCCamDevice::_AddStillSizes(
+	const usb_video_still_image_frame_descriptor* descriptor)
+{
+	uint8 formatIndex;
+	if (fParsingFormat == UVC_PARSED_MJPEG)
+		formatIndex = fMJPEGFormatIndex;
+	else if (fParsingFormat == UVC_PARSED_YUV422)
+		formatIndex = fUncompressedFormatIndex;
+	else
+		return;
+
+	if (descriptor->endpoint_address != 0)
+		fStillEndpointAddress = descriptor->endpoint_address;
+
+	for (uint8 i = 0; i < descriptor->num_image_size_patterns
+		&& fStillSizeCount < kMaxStillSizes; i++) {
+		uvc_still_size& size = fStillSizes[fStillSizeCount++];
+		size.width = descriptor->_pattern_size[i].width;
+		size.height = descriptor->_pattern_size[i].height;
+		size.format = fParsingFormat;
+		size.format_index = formatIndex;
+		size.frame_index = i + 1;
+		// The first pattern, the best quality the camera offers
+		size.compression_index
+			= descriptor->NumCompressionPatterns() > 0 ? 1 : 0;
+		syslog(LOG_INFO, "UVCCamDevice: %s still %ux%u\n",
+			fParsingFormat == UVC_PARSED_MJPEG ? "MJPEG" : "YUV",
+			size.width, size.height);
+	}
+}
+
+
+/* Of the still sizes of the format streaming, the one closest in pixels to
+ * width x height; the largest for 0 x 0 */
+const uvc_still_size*
+UVCCamDevice::_NearestStillSize(uint32 width, uint32 height) const
+{
+	uvc_parsed_format format = fIsMJPEG ? UVC_PARSED_MJPEG
+		: fIsNV12 ? UVC_PARSED_NV12 : UVC_PARSED_YUV422;
+	uint64 wanted = (uint64)width * height;
+
+	const uvc_still_size* best = NULL;
+	uint64 bestDistance = 0;
+	for (int32 i = 0; i < fStillSizeCount; i++) {
+		const uvc_still_size& size = fStillSizes[i];
+		if (size.format != format)
+			continue;
+		if (size.width == width && size.height == height)
+			return &size;
+		uint64 pixels = (uint64)size.width * size.height;
+		uint64 distance = wanted == 0 ? ~pixels
+			: pixels > wanted ? pixels - wanted : wanted - pixels;
+		if (best == NULL || distance < bestDistance) {
+			best = &size;
+			bestDistance = distance;
+		}
+	}
+	return best;
+}
+
+
+status_t
+UVCCamDevice::CaptureStill(const BMessenger& target, uint32 width,
+	uint32 height, bool decoded, int32 cookie)
+{
+	if (fStillMethod < 2 || (fStillMethod == 3 && fStillIn == NULL))
+		return B_NOT_SUPPORTED;
+	// The camera takes the trigger while it streams only
+	if (!TransferEnabled())
+		return B_NOT_ALLOWED;
+
+	const uvc_still_size* size = _NearestStillSize(width, height);
+	if (size == NULL)
+		return B_NOT_SUPPORTED;
+
+	if (atomic_test_and_set(&fStillBusy, 1, 0) != 0)
+		return B_BUSY;
+	if (fStillThread >= 0) {
+		// The previous capture has ended, fStillBusy says
+		status_t result;
+		wait_for_thread(fStillThread, &result);
+		fStillThread = -1;
+	}
+
+	fStillTarget = target;
+	fStillRequest = *size;
+	fStillDecoded = decoded;
+	fStillCookie = cookie;
+
+	thread_id thread = spawn_thread(_still_capture_thread_, "UVC still",
+		B_NORMAL_PRIORITY, this);
+	if (thread < 0) {
+		atomic_set(&fStillBusy, 0);
+		return thread;
+	}
+	fStillThread = thread;
+	resume_thread(thread);
+	return B_OK;
+}
+
+
+int32
+UVCCamDevice::_still_capture_thread_(void* data)
+{
+	((UVCCamDevice*)data)->_CaptureStill();
+	return 0;
+}
+
+
+void
+UVCCamDevice::_CaptureStill()
+{
+	const uvc_still_size size = fStillRequest;
+	UVCDeframer* deframer = (UVCDeframer*)fDeframer;
+	bool inStream = fStillMethod == 2;
+	bigtime_t start = system_time();
+
+	uint32 maxPayload = 0;
+	status_t status = _CommitStill(size, &maxPayload);
+	if (status == B_OK && inStream)
+		deframer->ExpectStill(true);
+
+	if (status == B_OK) {
+		// 1: transmit the still, 2: on the still bulk endpoint
+		uint8 trigger = inStream ? 1 : 2;
+		size_t actualLength = fDevice->ControlTransfer(
+			USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_OUT,
+			USB_VIDEO_RC_SET_CUR,
+			USB_VIDEO_VS_STILL_IMAGE_TRIGGER_CONTROL << 8, fStreamingIndex,
+			sizeof(trigger), &trigger);
+		if (actualLength != sizeof(trigger))
+			status = B_ERROR;
+	}
+
+	CamFrame* still = NULL;
+	if (status == B_OK) {
+		status = inStream ? deframer->WaitStill(kStillTimeout, &still)
+			: _ReadBulkStill(maxPayload, &still);
+	}
+	if (inStream)
+		deframer->ExpectStill(false);
+
+	BMessage image;
+	if (status == B_OK)
+		status = _ArchiveStill(*still, size, fStillDecoded, &image);
+	delete still;
+
+	if (status == B_OK) {
+		syslog(LOG_INFO, "UVCCamDevice: %ux%u still in %lld ms\n",
+			size.width, size.height,
+			(long long)(system_time() - start) / 1000);
+	} else {
+		syslog(LOG_WARNING, "UVCCamDevice: no %ux%u still: %s\n",
+			size.width, size.height, strerror(status));
+	}
+	SendStillImage(fStillTarget, fStillCookie, status,
+		status == B_OK ? &image : NULL);
+	atomic_set(&fStillBusy, 0);
+}
+
+
+status_t
+UVCCamDevice::_CommitStill(const uvc_still_size& size, uint32* _maxPayload)
+{
+	if (fDevice == NULL)
+		return B_ERROR;
+
+	uvc_still_probe probe;
+	memset(&probe, 0, sizeof(probe));
+	probe.format_index = size.format_index;
+	probe.frame_index = size.frame_index;
+	probe.compression_index = size.compression_index;
+
+	size_t length = sizeof(probe);
+	size_t actualLength = fDevice->ControlTransfer(
+		USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_OUT, USB_VIDEO_RC_SET_CUR,
+		USB_VIDEO_VS_STILL_PROBE_CONTROL << 8, fStreamingIndex, length,
+		&probe);
+	if (actualLength != length) {
+		syslog(LOG_ERR, "UVC Still probe SET_CUR failed: expected %zu, got "
+			"%zu\n", length, actualLength);
+		return B_ERROR;
+	}
+
+	actualLength = fDevice->ControlTransfer(
+		USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_IN, USB_VIDEO_RC_GET_CUR,
+		USB_VIDEO_VS_STILL_PROBE_CONTROL << 8, fStreamingIndex, length,
+		&probe);
+	if (actualLength != length) {
+		syslog(LOG_ERR, "UVC Still probe GET_CUR failed: expected %zu, got "
+			"%zu\n", length, actualLength);
+		return B_ERROR;
+	}
+
+	actualLength = fDevice->ControlTransfer(
+		USB_REQTYPE_CLASS | USB_REQTYPE_INTERFACE_OUT, USB_VIDEO_RC_SET_CUR,
+		USB_VIDEO_VS_STILL_COMMIT_CONTROL << 8, fStreamingIndex, length,
+		&probe);
+	if (actualLength != length) {
+		syslog(LOG_ERR, "UVC Still commit failed: expected %zu, got %zu\n",
+			length, actualLength);
+		return B_ERROR;
+	}
+
+	syslog(LOG_INFO, "UVC Still committed: format=%d frame=%d "
+		"maxVideoFrameSize=%u maxPayloadTransfer=%u\n", probe.format_index,
+		probe.frame_index, (unsigned)probe.max_video_frame_size,
+		(unsigned)probe.max_payload_transfer_size);
+	*_maxPayload = probe.max_payload_transfer_size;
+	return B_OK;
+}
+
+
+/* Method 3: one payload per bulk transfer, header first, until EOF. A
+ * camera that never sends it would leave the transfer waiting for good;
+ * after kStillTimeout the endpoint is halted, as in _StopStatusReader(),
+ * which makes it return. */
+status_t
+UVCCamDevice::_ReadBulkStill(uint32 maxPayload, CamFrame** _still)
+{
+	uvc_still_read read;
+	read.device = this;
+	read.payloadSize = maxPayload > 0 ? maxPayload : 64 * 1024;
+	read.payload = (uint8*)malloc(read.payloadSize);
+	read.still = new(std::nothrow) CamFrame();
+	read.quit = 0;
+	read.status = B_TIMED_OUT;
+	if (read.payload == NULL || read.still == NULL) {
+		free(read.payload);
+		delete read.still;
+		return B_NO_MEMORY;
+	}
+
+	status_t status;
+	thread_id reader = spawn_thread(_still_reader_thread_, "UVC still reader",
+		B_NORMAL_PRIORITY, &read);
+	if (reader < 0)
+		status = reader;
+	else {
+		resume_thread(reader);
+		status_t result;
+		if (wait_for_thread_etc(reader, B_RELATIVE_TIMEOUT, kStillTimeout,
+				&result) == B_TIMED_OUT) {
+			atomic_set(&read.quit, 1);
+			fStillIn->ClearStall();
+			wait_for_thread(reader, &result);
+		}
+		status = read.status;
+	}
+
+	free(read.payload);
+	if (status != B_OK) {
+		delete read.still;
+		return status;
+	}
+	*_still = read.still;
+	return B_OK;
+}
+
+
+int32
+UVCCamDevice::_still_reader_thread_(void* data)
+{
+	uvc_still_read* read = (uvc_still_read*)data;
+	const BUSBEndpoint* endpoint = read->device->fStillIn;
+	uint8* payload = read->payload;
+
+	while (atomic_get(&read->quit) == 0) {
+		ssize_t length = endpoint->BulkTransfer(payload, read->payloadSize);
+		if (atomic_get(&read->quit) != 0)
+			break;
+		if (length < 0) {
+			read->status = length;
+			break;
+		}
+		if (length < 2 || payload[0] < 2 || payload[0] > length)
+			continue;
+		size_t dataSize = length - payload[0];
+		if (read->still->Write(payload + payload[0], dataSize)
+				!= (ssize_t)dataSize) {
+			read->status = B_NO_MEMORY;
+			break;
+		}
+		if ((payload[1] & 0x02) != 0 && read->still->Position() > 0) {
+			read->status = B_OK;
+			break;
+		}
+	}
+	return 0;
+}
+
+
+/* The still as the reply fields of CamStill.h: a JPEG as it came, with the
+ * Huffman tables MJPEG cameras leave out, or pixels */
+status_t
+UVCCamDevice::_ArchiveStill(const CamFrame& still, const uvc_still_size& size,
+	bool decoded, BMessage* image)
+{
+	const uint8* data = (const uint8*)still.Buffer();
+	size_t length = still.BufferLength();
+	bool mjpeg = size.format == UVC_PARSED_MJPEG;
+
+	if (mjpeg && !decoded) {
+		cam_jpeg_index index;
+		cam_jpeg_index_reset(&index);
+		cam_jpeg_index_update(&index, data, length);
+		size_t capacity = length + CAM_JPEG_DHT_SIZE;
+		uint8* jpeg = (uint8*)malloc(capacity);
+		if (jpeg == NULL)
+			return B_NO_MEMORY;
+		size_t jpegLength = cam_jpeg_copy_with_tables(index, data, jpeg,
+			capacity);
+		status_t status = jpegLength > 0 ? B_OK : B_BAD_DATA;
+		if (status == B_OK) {
+			image->AddString("mime", "image/jpeg");
+			image->AddInt32("width", size.width);
+			image->AddInt32("height", size.height);
+			status = image->AddData("data", B_RAW_TYPE, jpeg, jpegLength);
+		}
+		free(jpeg);
+		return status;
+	}
+
+	int32 width = size.width;
+	int32 height = size.height;
+	if (!decoded) {
+		size_t bytesPerRow = width * 2;
+		if (length < bytesPerRow * height)
+			return B_BAD_DATA;
+		image->AddString("mime", "image/x-raw");
+		image->AddInt32("width", width);
+		image->AddInt32("height", height);
+		image->AddInt32("color_space", B_YCbCr422);
+		image->AddInt32("bytes_per_row", bytesPerRow);
+		return image->AddData("data", B_RAW_TYPE, data, bytesPerRow * height);
+	}
+
+	tjhandle decompressor = NULL;
+	mjpeg_frame_info info;
+	if (mjpeg) {
+		// The JPEG says how large it is, whatever the descriptor claims
+		decompressor = tjInitDecompress();
+		if (decompressor == NULL)
+			return B_NO_MEMORY;
+		if (mjpeg_parse_frame(decompressor, data, length, 0xffff, 0xffff,
+				&info) != MJPEG_PARSE_OK) {
+			tjDestroy(decompressor);
+			return B_BAD_DATA;
+		}
+		width = info.decode_width;
+		height = info.decode_height;
+	}
+
+	size_t bytesPerRow = width * 4;
+	uint8* pixels = (uint8*)malloc(bytesPerRow * height);
+	status_t status = pixels != NULL ? B_OK : B_NO_MEMORY;
+	if (status == B_OK && mjpeg) {
+		if (mjpeg_decode_rgb(decompressor, info, pixels, width, height,
+				B_RGB32) != 0)
+			status = B_BAD_DATA;
+	} else if (status == B_OK) {
+		yuv422_format format;
+		format.layout = fUncompressedLayout;
+		format.matrix = fUncompressedMatrix;
+		format.range = YUV_RANGE_LIMITED;
+		format.destination = B_RGB32;
+		yuv422_rgb_kernel kernel;
+		if (length < (size_t)width * 2 * height
+			|| !yuv422_rgb_best_kernel(format, &kernel))
+			status = B_BAD_DATA;
+		else
+			yuv422_to_rgb_frame(kernel, pixels, data, length, width, height);
+	}
+	if (decompressor != NULL)
+		tjDestroy(decompressor);
+
+	if (status == B_OK) {
+		image->AddString("mime", "image/x-raw");
+		image->AddInt32("width", width);
+		image->AddInt32("height", height);
+		image->AddInt32("color_space", B_RGB32);
+		image->AddInt32("bytes_per_row", bytesPerRow);
+		status = image->AddData("data", B_RAW_TYPE, pixels,
+			bytesPerRow * height);
+	}
+	free(pixels);
+	return status;
+}
+
+
 UVCCamDeviceAddon::UVCCamDeviceAddon(WebCamMediaAddOn* webcam)
 	: CamDeviceAddon(webcam)
 {
@@ -9,9 +9,17 @@
 
 
 #include "CamDevice.h"
+#include "CamFrameArena.h"
 #include "USB_video.h"
 #include "USB_audio.h"
+#include "UVCClock.h"
+#include "UVCColorConvert.h"
+#include "UVCMJPEGDecode.h"
+#include "UVCNegotiationCache.h"
 #include <usb/USB_video.h>
+#include <Messenger.h>
+#include <Referenceable.h>
+#include <new>
 #include <turbojpeg.h>
 
 
@@ -21,40 +29,250 @@ const size_t kMinYUY2FramePercent = 90;			// Frame YUY2 < 90% = incomplete
 const uint32 kMaxConsecutiveBadFrames = 10;		// Report after N bad frames
 const uint32 kFrameValidationReportInterval = 30;	// Seconds between stats reports
 
+// Parallel MJPEG decode
+const int32 kMaxMJPEGDecoders = 4;				// TurboJPEG handles (and
+												// concurrent fills)
 
-// =============================================================================
-// YUV to RGB Lookup Tables for Optimized Color Conversion
-// =============================================================================
-// Pre-computed tables eliminate per-pixel multiplications and clipping.
-// Total memory: ~3KB for all tables combined.
+// Frame arena size classes, laid out in StartTransfer()
+enum {
+	kArenaRawFrames = 0,		// deframer frames, dwMaxVideoFrameSize
+	kArenaDecodedFrames,		// frame repeat cache, output format
+	kArenaClassCount
+};
+const int32 kArenaRawFrameSlots = 10;			// 1 filling, 8 queued, 1 decoding
+const int32 kArenaDecodedFrameSlots = 3;		// cached, spare, one being repeated
+
+
+// How _SelectBestAlternate() sizes the video ISO reservation
+enum uvc_alternate_policy {
+	UVC_ALTERNATE_MINIMUM = 0,	// smallest alternate carrying the committed
+								// payload, so several cameras share a bus
+	UVC_ALTERNATE_MAXIMUM		// largest the controller takes (one camera)
+};
+
+
+// What one service interval of an ISO input endpoint carries. USB 2
+// endpoints encode it in wMaxPacketSize; on SuperSpeed it comes from the
+// endpoint companion descriptor that follows the endpoint.
+struct uvc_iso_bandwidth {
+	uint32		packet_size;		// wMaxPacketSize bits 10:0
+	uint32		packets;			// per interval: mult, or burst * mult
+	uint32		bytes;				// what one packet descriptor receives
+	bool		superspeed;
+};
+
+// A SuperSpeed endpoint companion of the video streaming interface
+struct uvc_ss_companion {
+	uint8		alternate;			// bAlternateSetting
+	uint8		endpoint;			// bEndpointAddress
+	uint8		max_burst;			// bMaxBurst: packets per burst - 1
+	uint8		mult;				// bmAttributes 1:0: bursts - 1
+	uint16		bytes_per_interval;	// wBytesPerInterval
+};
+const int32 kMaxSSCompanions = 32;
+
+
+// What the bandwidth controller gives up first when the stream does not
+// fit the bus (see _DegradeStream())
+enum uvc_degrade_policy {
+	UVC_DEGRADE_RESOLUTION = 0,	// next smaller frame size, then frame rate
+	UVC_DEGRADE_FRAME_RATE,		// next longer frame interval, then size
+	UVC_DEGRADE_BALANCED		// one of each in turn, frame rate first
+};
+
+// A step the controller took, undone last first by _RecoverStream()
+enum uvc_degrade_kind {
+	UVC_DEGRADE_STEP_RESOLUTION = 0,
+	UVC_DEGRADE_STEP_FRAME_RATE
+};
+
+struct uvc_degrade_step {
+	uint8		kind;				// uvc_degrade_kind
+	uint32		previous;			// interval limit before a rate step
+};
+const int32 kMaxDegradeSteps = 32;
+
+
+// The VS_FORMAT_* descriptor the frame and color matching descriptors that
+// follow it belong to, while parsing
+enum uvc_parsed_format {
+	UVC_PARSED_NONE = 0,		// a format this driver does not stream
+	UVC_PARSED_YUV422,			// YUY2 or UYVY
+	UVC_PARSED_NV12,
+	UVC_PARSED_MJPEG
+};
+
+
+// Still image capture (VS_STILL_IMAGE_FRAME, still methods 2 and 3)
+const int32 kMaxStillSizes = 16;
+const bigtime_t kStillTimeout = 5000000;		// trigger to last byte
+
+struct uvc_still_size {
+	uint16				width;
+	uint16				height;
+	uvc_parsed_format	format;			// of the video format it belongs to
+	uint8				format_index;
+	uint8				frame_index;		// image size pattern, from 1
+	uint8				compression_index;	// 0 if none offered
+};
 
-struct yuv_rgb_lookup_tables {
-	// Y contribution to R,G,B (same value for all three)
-	// y_table[i] = 298 * (i - 16) [unshifted, combined with U/V before shift]
-	// Note: Uses int32 because max value (298*219=65262) exceeds int16 range
-	int32	y_table[256];
+// VS_STILL_PROBE_CONTROL and VS_STILL_COMMIT_CONTROL
+struct uvc_still_probe {
+	uint8				format_index;
+	uint8				frame_index;
+	uint8				compression_index;
+	uint32				max_video_frame_size;
+	uint32				max_payload_transfer_size;
+} _PACKED;
+
+
+// Processing Unit control selectors are below 0x20 (UVC 1.5 has 0x13)
+const int32 kMaxControlSelectors = 32;
+
+// A SET_CUR waiting for the control worker
+struct uvc_pending_control {
+	uint16			selector;
+	int16			value;
+	uint8			length;			// 1 or 2 bytes
+	bool			pending;
+};
 
-	// U contribution to B: u_b_table[i] = 516 * (i - 128)
-	int32	u_b_table[256];
+// A status interrupt packet from the VideoControl interface (UVC 1.5,
+// 2.4.2.2); the value follows for a value change
+struct uvc_control_status {
+	uint8			status_type;	// 1: VideoControl, 2: VideoStreaming
+	uint8			originator;		// bEntityID
+	uint8			event;			// 0: control change
+	uint8			selector;
+	uint8			attribute;		// 0: value, 1: info, 2: failure,
+									// 3: minimum, 4: maximum
+	uint8			value[4];
+} _PACKED;
+
+
+// Audio ring: each ISO transfer lands in place in one block of the ring.
+// A packet is one millisecond of audio (full speed); the layout in use
+// follows the consumer's latency within these bounds.
+const int32 kAudioMaxPacketsPerTransfer = 16;
+const int32 kAudioMaxTransfersInFlight = 8;
+const int32 kAudioMaxRingBlocks = 64;
+
+struct uvc_audio_layout {
+	int32			packets_per_transfer;	// ms of audio per transfer
+	int32			transfers_in_flight;	// queued on the endpoint
+	int32			ring_blocks;
+};
 
-	// U contribution to G: u_g_table[i] = -100 * (i - 128)
-	int32	u_g_table[256];
+// Layout for a consumer that takes 'bufferDuration' of audio at a time and
+// has 'downstreamLatency' after it; 0 for an unknown latency gets the
+// default of 8 ms transfers, 4 in flight and a 256 ms ring. Transfers take
+// a quarter of the latency, 4 ms at the least: audio is only readable once
+// its transfer completes, so this is the latency the ring adds.
+void	uvc_audio_layout_for(bigtime_t bufferDuration,
+			bigtime_t downstreamLatency, uvc_audio_layout* layout);
 
-	// V contribution to R: v_r_table[i] = 409 * (i - 128)
-	int32	v_r_table[256];
 
-	// V contribution to G: v_g_table[i] = -208 * (i - 128)
-	int32	v_g_table[256];
+class CamFrame;
+class UVCCamDevice;
 
-	bool	initialized;
+// One block of the audio ring. The host controller writes packet i at
+// data + i * packet size; actual_length says how much of it is audio.
+struct uvc_audio_block {
+	uint8*						data;
+	usb_iso_packet_descriptor	descriptors[kAudioMaxPacketsPerTransfer];
+};
 
-	yuv_rgb_lookup_tables() : initialized(false) {}
+// One of the in-flight audio transfers. IsochronousTransfer() blocks, so
+// each has a thread that submits whatever block the pump assigns it.
+struct uvc_audio_transfer {
+	UVCCamDevice*	device;
+	thread_id		thread;
+	sem_id			submit;
+	sem_id			complete;
+	int32			block;
+	uint32			ticket;			// place in the submission order
+	ssize_t			result;
+	bigtime_t		submitted;		// when the transfer was queued
+	bigtime_t		completed;		// when the transfer returned
+};
 
-	void Initialize();
+// A method 3 still being read off the still endpoint. BulkTransfer() has
+// no timeout, so a thread of its own reads while the still thread keeps
+// the time.
+struct uvc_still_read {
+	UVCCamDevice*	device;
+	uint8*			payload;
+	size_t			payloadSize;
+	CamFrame*		still;
+	int32			quit;			// set when the time is up (atomic)
+	status_t		status;			// the reader's, once it has exited
 };
 
-// Global lookup tables (shared across all instances)
-extern yuv_rgb_lookup_tables gYuvRgbTables;
+// An MJPEG frame FillFrameBuffer() decodes after dropping fFillLock
+struct mjpeg_decode_job {
+	CamFrame*		frame;
+	unsigned char*	dst;
+	int32			width;
+	int32			height;
+	uint32			sequence;
+	bool			valid;		// passed frame validation
+	bigtime_t		arrival;	// CamFrame::fArrival, likewise
+	bigtime_t		completed;	// CamFrame::fCompleted of the frame
+								// filled, also when it is not decoded
+								// here; 0 for none
+	clipping_rect	region;		// CamDevice::DecodeRegion()
+	bool			blackOutside;
+};
+
+
+// The last good frame in output format, for frame repeat. Reference
+// counted so a repeat can copy out of it unlocked while a decoder
+// publishes a newer one.
+class DecodedFrame : public BReferenceable {
+public:
+						DecodedFrame(size_t capacity)
+							:
+							fArena(NULL),
+							fData(new(std::nothrow) uint8[capacity]),
+							fCapacity(fData != NULL ? capacity : 0),
+							fSize(0),
+							fWidth(0),
+							fHeight(0),
+							fColorSpace(B_NO_COLOR_SPACE),
+							fSequence(0)
+						{
+						}
+						// On an arena slot, returned to it on delete
+						DecodedFrame(CamFrameArena* arena, void* slot,
+							size_t capacity)
+							:
+							fArena(arena),
+							fData((uint8*)slot),
+							fCapacity(capacity),
+							fSize(0),
+							fWidth(0),
+							fHeight(0),
+							fColorSpace(B_NO_COLOR_SPACE),
+							fSequence(0)
+						{
+						}
+	virtual				~DecodedFrame()
+						{
+							if (fArena != NULL)
+								fArena->ReleaseSlot(fData);
+							else
+								delete[] fData;
+						}
+
+			CamFrameArena*	fArena;
+			uint8*		fData;
+			size_t		fCapacity;
+			size_t		fSize;
+			int32		fWidth;
+			int32		fHeight;
+			color_space	fColorSpace;
+			uint32		fSequence;
+};
 
 
 // Frame validation result codes
@@ -84,6 +302,7 @@ struct frame_validation_stats {
 // Resolution fallback configuration
 struct resolution_fallback_config {
 	float		error_threshold_percent;	// Error threshold (default 10%)
+	float		recovery_threshold_percent;	// Loss below which it is stable
 	bigtime_t	evaluation_interval;		// Evaluation window (default 5s)
 	uint32		min_packets_for_eval;		// Minimum packets before deciding
 	bool		auto_recovery_enabled;		// Attempt to recover if stable
@@ -113,13 +332,18 @@ public:
 									BUSBDevice* _device);
 	virtual						~UVCCamDevice();
 
+	virtual bool				SupportsBulk();
 	virtual bool				SupportsIsochronous();
+	virtual uint32				BulkTransfersInFlight();
 	virtual status_t			StartTransfer();
 	virtual status_t			StopTransfer();
 	virtual status_t			SuggestVideoFrame(uint32 &width,
 									uint32 &height);
 	virtual status_t			AcceptVideoFrame(uint32 &width,
 									uint32 &height);
+	virtual status_t			AcceptFrameRate(float &fps);
+	virtual bool				SupportsColorSpace(color_space space);
+	virtual bool				SupportsMJPEGPassthrough();
 	virtual void				AddParameters(BParameterGroup *group,
 									int32 &index);
 	virtual status_t			GetParameterValue(int32 id,
@@ -128,7 +352,10 @@ public:
 	virtual status_t			SetParameterValue(int32 id, bigtime_t when,
 									const void *value, size_t size);
 	virtual status_t			FillFrameBuffer(BBuffer *buffer,
-									bigtime_t *stamp = NULL);
+									bigtime_t *stamp = NULL,
+									uint32 *sequence = NULL,
+									cam_frame_times *times = NULL);
+	virtual int32				FillFrameBufferConcurrency();
 
 
 	// PHASE 4: Override packet loss resolution fallback
@@ -137,6 +364,27 @@ public:
 	// High-bandwidth auto-detection overrides
 	virtual void				OnConsecutiveTransferFailures(uint32 count);
 	virtual void				OnTransferSuccess();
+	virtual void				ApplyThreadPolicy();
+	virtual void				GetCaptureStreamInfo(uint8 stream,
+									cam_capture_stream_info* info);
+	virtual status_t			CaptureStill(const BMessenger& target,
+									uint32 width, uint32 height, bool decoded,
+									int32 cookie);
+
+	// ISO alternate selection, applied by the next StartTransfer().
+	// WEBCAM_MAX_BANDWIDTH=1 forces UVC_ALTERNATE_MAXIMUM.
+			void				SetAlternatePolicy(uvc_alternate_policy policy)
+									{ fAlternatePolicy = policy; }
+			uvc_alternate_policy	AlternatePolicy() const
+									{ return fAlternatePolicy; }
+
+	// Bandwidth controller policy, for the next step it takes.
+	// WEBCAM_DEGRADE_POLICY=fps|resolution|balanced overrides it.
+			void				SetDegradePolicy(uvc_degrade_policy policy)
+									{ fDegradePolicy = policy; }
+			uvc_degrade_policy	DegradePolicy() const
+									{ return fDegradePolicy; }
+
 	// Audio support
 			bool				HasAudio() const { return fHasAudio; }
 			uint8				AudioChannels() const { return fAudioChannels; }
@@ -146,11 +394,43 @@ public:
 	// Audio transfer control
 			status_t			StartAudioTransfer();
 			status_t			StopAudioTransfer();
-			size_t				ReadAudioData(void* buffer, size_t size);
+								// Sizes the transfers and the ring the next
+								// StartAudioTransfer() sets up; B_BUSY while
+								// audio runs
+			status_t			SetAudioLatency(bigtime_t bufferDuration,
+									bigtime_t downstreamLatency);
+								// Capture to readable, for the layout set
+			bigtime_t			AudioTransferLatency() const
+									{ return (bigtime_t)fAudioLayout
+										.packets_per_transfer * 1000; }
+								// Consumer side of the audio ring, one
+								// reader thread. Read never blocks; Wait
+								// returns once 'bytes' are buffered.
+								// 'captureTime' gets the system time the
+								// first sample read was captured at.
+			size_t				ReadAudioData(void* buffer, size_t size,
+									bigtime_t* captureTime = NULL);
+			status_t			WaitAudioData(size_t bytes,
+									bigtime_t deadline);
+			size_t				AudioDataAvailable() const
+									{ return (size_t)atomic_get(
+										(int32*)&fAudioBytesAvailable); }
+								// Drop whole buffered blocks until at most
+								// 'keep' bytes are left; returns bytes dropped
+			size_t				DiscardAudioData(size_t keep);
+								// Audio sample clock against system_time(),
+								// in parts per million
+			int32				AudioDriftPPM() const;
+			const cam_schedule_stats&	AudioPumpScheduleStats() const
+									{ return fAudioPumpSchedule; }
 
 private:
 			status_t			_SelectAudioAlternate();
 			status_t			_SelectAudioIdleAlternate();
+			status_t			_StartAudioTransfers();
+			void				_StopAudioTransfers();
+			void				_ConsumeAudioBlock();
+static		int32				_audio_transfer_thread_(void* data);
 			void				_ParseVideoControl(
 									const usbvc_class_descriptor* descriptor,
 									size_t len);
@@ -163,15 +443,64 @@ private:
 			void				_ParseAudioStreaming(
 									const usb_audio_class_descriptor* descriptor,
 									size_t len);
-			status_t			_ProbeCommitFormat();
-			status_t			_SelectBestAlternate();
+			void				_BuildProbeRequest(
+									usb_video_probe_and_commit_controls* request);
+			bool				_NegotiationKey(
+									const usb_video_probe_and_commit_controls&
+										request,
+									uvc_negotiation_key* key);
+			status_t			_ProbeCommitFormat(
+									const usb_video_probe_and_commit_controls&
+										request,
+									uvc_negotiation* negotiation);
+			status_t			_CommitFormat(
+									const usb_video_probe_and_commit_controls&
+										committed,
+									size_t length);
+			uvc_alternate_policy	_EffectiveAlternatePolicy() const;
+			status_t			_SelectBestAlternate(
+									uvc_negotiation* negotiation);
+			status_t			_UseAlternate(uint32 alternateIndex,
+									uint32 endpointIndex, uint32 bandwidth);
 			status_t			_SelectIdleAlternate();
-			void 				_ConvertYUY2toRGB32(unsigned char *dst,
+			status_t			_UseBulkEndpoint();
+			BList*				_StreamFrames();
+			uint32				_StreamFrameIndex() const;
+			size_t				_UncompressedFrameSize(int32 width,
+									int32 height) const;
+			bool				_PreferNV12(uint32 width, uint32 height);
+			bool				_PassYUY2Through(uint32 width,
+									uint32 height);
+			void				_SelectConvertKernel();
+			void 				_ConvertYUV422toRGB(unsigned char *dst,
 									unsigned char *src, size_t srcSize,
-									int32 width, int32 height);
-			void				_DecompressMJPEGtoRGB32(unsigned char* dst,
+									int32 width, int32 height,
+									const clipping_rect& region);
+			void				_ConvertNV12toRGB(unsigned char* dst,
 									const unsigned char* src, size_t srcSize,
-									int32 width, int32 height);
+									int32 width, int32 height,
+									const clipping_rect& region);
+			status_t			_FillFrameBufferLocked(BBuffer *buffer,
+									status_t waitResult, bigtime_t *stamp,
+									uint32 *sequence, mjpeg_decode_job *job);
+			status_t			_DecompressMJPEG(tjhandle decompressor,
+									unsigned char* dst,
+									const unsigned char* src, size_t srcSize,
+									int32 width, int32 height,
+									const cam_jpeg_index* index = NULL,
+									const clipping_rect* region = NULL);
+			tjhandle			_AcquireJpegDecoder();
+			void				_ReleaseJpegDecoder(tjhandle decoder);
+			void				_CopyYUY2Frame(unsigned char* dst,
+									const unsigned char* src, size_t srcSize,
+									int32 width, int32 height,
+									const clipping_rect& region);
+			bool				_AcceptDownscaledFrame(uint32 width,
+									uint32 height);
+			void				_DownscaleYUV422(unsigned char* dst,
+									const unsigned char* src, size_t srcSize,
+									int32 width, int32 height,
+									const clipping_rect& region);
 
 			void				_AddProcessingParameter(BParameterGroup* group,
 									int32 index,
@@ -182,22 +511,71 @@ private:
 									uint16 wValue, const char* name);
 			uint8 				_AddAutoParameter(BParameterGroup* subgroup,
 									int32 index, uint16 wValue);
+			status_t			_ControlRange(uint16 selector,
+									float* minValue, float* maxValue);
+			void				_LoadControlValue(uint16 selector,
+									float* value);
+			void				_LoadControlValue(uint16 selector,
+									int* value, size_t length);
 			status_t			_SetParameterValue(uint16 wValue,
 									int16 setValue);
 			status_t			_SetParameterValue(uint16 wValue,
 									int8 setValue);
 
+	// Control worker
+			status_t			_QueueControl(uint16 selector, int16 value,
+									size_t length);
+			status_t			_StartControlWorker();
+			void				_StopControlWorker();
+	static	int32				_control_worker_thread_(void* data);
+			void				_ControlWorker();
+
+	// Status interrupt
+			void				_StartStatusReader();
+			void				_StopStatusReader();
+	static	int32				_status_reader_thread_(void* data);
+			void				_StatusReader();
+			void				_HandleControlStatus(
+									const uvc_control_status& status,
+									size_t length);
+			bool				_StoreControlValue(uint16 selector,
+									int16 value);
+
+	// Still image capture
+			void				_AddStillSizes(
+									const usb_video_still_image_frame_descriptor*
+										descriptor);
+			const uvc_still_size*	_NearestStillSize(uint32 width,
+									uint32 height) const;
+			status_t			_CommitStill(const uvc_still_size& size,
+									uint32* _maxPayload);
+			status_t			_ReadBulkStill(uint32 maxPayload,
+									CamFrame** _still);
+			status_t			_ArchiveStill(const CamFrame& still,
+									const uvc_still_size& size, bool decoded,
+									BMessage* image);
+	static	int32				_still_capture_thread_(void* data);
+	static	int32				_still_reader_thread_(void* data);
+			void				_CaptureStill();
+
 	// Frame validation methods (Feature 1)
 			frame_validation_result	_ValidateMJPEGFrame(const uint8* data,
-									size_t size);
-			frame_validation_result	_ValidateYUY2Frame(const uint8* data,
+									size_t size,
+									const cam_jpeg_index* index = NULL);
+			frame_validation_result	_ValidateUncompressedFrame(const uint8* data,
 									size_t size, int32 width, int32 height);
 			bool				_FindJpegMarker(const uint8* data, size_t size,
 									uint8 marker, size_t* position);
-			void				_CacheValidFrame(const uint8* data, size_t size,
+			size_t				_CopyMJPEGFrame(CamFrame* frame,
+									BBuffer* buffer);
+			void				_CacheDecodedFrame(const uint8* data,
+									size_t size, int32 width, int32 height,
+									uint32 sequence);
+			bool				_RepeatLastFrame(BBuffer* buffer,
 									int32 width, int32 height);
-			bool				_UseLastValidFrame(uint8* dst, size_t dstSize);
+			void				_DropDecodedFrames();
 			void				_ReportValidationStats();
+			status_t			_SetUpFrameArena();
 
 	// Camera control methods (Feature 2)
 			status_t			_ProbeControlRange(uint16 selector,
@@ -212,8 +590,26 @@ private:
 
 	// Resolution fallback methods (Feature 3)
 			void				_EvaluatePacketLoss();
+			status_t			_SwitchVideoFrame(uint32 width,
+									uint32 height);
 			status_t			_TriggerResolutionFallback();
 			status_t			_AttemptResolutionRecovery();
+			uvc_degrade_policy	_EffectiveDegradePolicy() const;
+			status_t			_DegradeStream();
+			status_t			_RecoverStream();
+			status_t			_StepFrameRate();
+			bool				_PushDegradeStep(uint8 kind,
+									uint32 previous);
+			const usb_video_frame_descriptor*	_CurrentFrameDescriptor();
+			uint32				_NextFrameInterval(
+									const usb_video_frame_descriptor* frame,
+									uint32 interval, bool longer) const;
+			uint32				_LimitFrameInterval(
+									const usb_video_frame_descriptor* frame,
+									uint32 limit) const;
+			uint32				_NearestFrameInterval(
+									const usb_video_frame_descriptor* frame,
+									uint32 interval) const;
 			void				_GetResolutionAtLevel(int32 level,
 									uint32* width, uint32* height);
 			int32				_GetMaxResolutionLevel();
@@ -221,6 +617,13 @@ private:
 
 	// Bandwidth calculation (YUY2 adaptive FPS support)
 			uint32				_GetMaxAvailableBandwidth();
+			void				_ReadSuperSpeedCompanions(
+									const BUSBConfiguration* config,
+									const BUSBInterface* streaming);
+			bool				_IsoEndpointBandwidth(
+									const BUSBInterface* alternate,
+									const BUSBEndpoint* endpoint,
+									uvc_iso_bandwidth* bandwidth) const;
 
 	// High-bandwidth auto-detection
 			bool				_ShouldUseHighBandwidth();
@@ -237,12 +640,26 @@ private:
 			uint32				fCurrentVideoAlternate;  // Track current alternate to avoid re-setting
 			uint32				fUncompressedFormatIndex;
 			uint32				fUncompressedFrameIndex;
+			uint32				fNV12FormatIndex;
+			uint32				fNV12FrameIndex;
 			uint32				fMJPEGFormatIndex;
 			uint32				fMJPEGFrameIndex;
+			yuv422_layout		fUncompressedLayout;	// from the format GUID
+			yuv_matrix			fUncompressedMatrix;	// from VS_COLORFORMAT
+			yuv_matrix			fNV12Matrix;
+			yuv_matrix			fMJPEGMatrix;
+			uvc_parsed_format	fParsingFormat;		// owner of the frame and
+													// color descriptors
+			yuv422_rgb_kernel	fConvertKernel;			// under fFillLock
 			uint32				fMaxVideoFrameSize;
 			uint32				fMaxPayloadTransferSize;
+			uint32				fCommittedFrameInterval;	// 100ns units
+			uint32				fRequestedFrameInterval;	// 100ns, 0 =
+															// the default
+			uvc_alternate_policy	fAlternatePolicy;
 
-			BList				fUncompressedFrames;
+			BList				fUncompressedFrames;	// YUY2 or UYVY
+			BList				fNV12Frames;
 			BList				fMJPEGFrames;
 
 			float				fBrightness;
@@ -265,6 +682,22 @@ private:
 			// MJPEG decompression support
 			tjhandle			fJpegDecompressor;
 			bool				fIsMJPEG;
+			bool				fIsNV12;		// of the uncompressed formats
+			uint32				fSourceWidth;	// a larger YUY2 mode shrunk
+			uint32				fSourceHeight;	// to VideoFrame(), or 0
+
+			// FillFrameBuffer() runs under fFillLock except for waiting
+			// and the MJPEG decode itself, so several frames can decode at once, each
+			// on its own TurboJPEG handle (fJpegDecoders[0] is
+			// fJpegDecompressor)
+			BLocker				fFillLock;
+			uint32				fFillSequence;
+			tjhandle			fJpegDecoders[kMaxMJPEGDecoders];
+			bool				fJpegDecoderBusy[kMaxMJPEGDecoders];
+			mjpeg_yuv_scratch	fJpegYUVScratch[kMaxMJPEGDecoders];
+									// planes of B_YCbCr decodes, per handle
+			int32				fJpegDecoderCount;
+			BLocker				fJpegDecoderLock;	// for fJpegDecoders[0]
 
 			// FIX BUG 6: Contatori diagnostici per istanza (non statici)
 			int32				fFillFrameCount;
@@ -300,29 +733,53 @@ private:
 			// Audio transfer state
 			bool				fAudioTransferRunning;
 			thread_id			fAudioPumpThread;
-			uint8*				fAudioBuffer;
-			size_t				fAudioBufferLen;
 
-			// Audio ring buffer for data exchange
-			// FIX BUG 4: Usare int32 per operazioni atomiche
-			uint8*				fAudioRingBuffer;
-			size_t				fAudioRingSize;
-			int32				fAudioRingHead;  // Atomico: scritto da producer, letto da consumer
-			int32				fAudioRingTail;  // Atomico: letto da producer, scritto da consumer
+			// Audio ring, single producer (pump thread) and single
+			// consumer (ReadAudioData() caller). Block counters only grow;
+			// block n is fAudioBlocks[n % fAudioLayout.ring_blocks].
+			uint8*				fAudioRingData;		// In fAudioRingArea,
+														// NULL when stopped
+			CamTransferArea		fAudioRingArea;
+			size_t				fAudioPacketSize;	// request_length
+			uvc_audio_layout	fAudioLayout;		// set while stopped
+			uvc_audio_block		fAudioBlocks[kAudioMaxRingBlocks];
+			uvc_audio_transfer	fAudioTransfers[kAudioMaxTransfersInFlight];
+			int32				fAudioTransferCount;
+			CamSubmitOrder		fAudioOrder;		// queues them in ring order
+			int32				fAudioBlocksSubmitted;	// pump only
+			int32				fAudioBlocksCompleted;	// atomic, pump writes
+			int32				fAudioBlocksConsumed;	// atomic, reader writes
+			int32				fAudioBytesAvailable;	// atomic
+			int32				fAudioReadPacket;		// reader only
+			size_t				fAudioReadOffset;		// reader only
+			sem_id				fAudioSpaceSem;			// block consumed
+			cam_schedule_stats	fAudioPumpSchedule;		// pump writes
+
+			// Audio sample clock: sample frames received against the time
+			// each block completed, fitted like the video PTS/SCR clock
+			UVCClockRecovery	fAudioClock;			// under fAudioClockLock
+	mutable	BLocker				fAudioClockLock;
+			int64				fAudioBytesReceived;	// pump only
+			int64				fAudioBytesRead;		// reader only, incl.
+														// discarded
 
 			// Resolution selection (Task 2)
 			int32				fSelectedResolutionIndex;  // Index into current frame list
 			int32				fResolutionParameterID;    // Parameter ID for resolution selector
 			bigtime_t			fResolutionTransitionStart; // Time when resolution change started
 
-			sem_id				fAudioRingSem;
+			sem_id				fAudioRingSem;			// block completed
 
 			// Frame validation state (Feature 1)
 			frame_validation_stats	fValidationStats;
-			uint8*				fLastValidFrame;
-			size_t				fLastValidFrameSize;
-			int32				fLastValidWidth;
-			int32				fLastValidHeight;
+			DecodedFrame*		fLastFrame;		// under fFrameCacheLock
+			DecodedFrame*		fSpareFrame;	// storage for the next one
+			BLocker				fFrameCacheLock;
+			CamFrameArena		fFrameArena;
+			CamFrameArena		fSpareFrameArena;	// the next layout, while
+													// fFrameArena still has
+													// frames out, or back
+			CamFrameArena*		fStreamArena;	// the one of the two in use
 			uint32				fConsecutiveBadFrames;
 			bool				fFrameRepeatEnabled;
 
@@ -330,6 +787,39 @@ private:
 			BList				fProcessingControls;	// List of camera_control_info*
 			uint8				fProcessingUnitID;
 			bool				fControlsInitialized;
+			int32				fControlValuesRead;		// bit per selector:
+														// GET_CUR done or set
+
+			// Control worker: queued SET_CUR, newest value per selector
+			thread_id			fControlThread;
+			sem_id				fControlSem;		// one count per pending
+			BLocker				fControlLock;
+			bool				fControlQuit;
+			uvc_pending_control	fPendingControls[kMaxControlSelectors];
+			uint32				fControlsSent;
+			uint32				fControlsCoalesced;	// overwritten unsent
+
+			// Status interrupt reader: control changes the camera made
+			// itself (auto white balance, a refused setting) update the
+			// values GetParameterValue() answers with
+			thread_id			fStatusThread;
+			int32				fStatusQuit;		// set to stop it, or by it
+												// when the endpoint fails
+			uint32				fStatusEvents;
+
+			// Still image capture: what the descriptors offer, and the
+			// one request being served (fStillBusy, atomic)
+			uint8				fStillMethod;		// bStillCaptureMethod
+			uint8				fStillEndpointAddress;	// method 3
+			const BUSBEndpoint*	fStillIn;
+			uvc_still_size		fStillSizes[kMaxStillSizes];
+			int32				fStillSizeCount;
+			int32				fStillBusy;
+			thread_id			fStillThread;
+			BMessenger			fStillTarget;
+			uvc_still_size		fStillRequest;
+			bool				fStillDecoded;
+			int32				fStillCookie;
 
 			// Resolution fallback state (Feature 3)
 			resolution_fallback_config	fFallbackConfig;
@@ -345,12 +835,26 @@ private:
 			uint32				fLastPacketSuccessCount;	// For delta calculation
 			uint32				fLastPacketErrorCount;
 
+			// Bandwidth controller on top of it
+			uvc_degrade_policy	fDegradePolicy;
+			uvc_degrade_step	fDegradeSteps[kMaxDegradeSteps];
+			int32				fDegradeStepCount;
+			uint32				fFrameIntervalLimit;	// 100ns, 0 = none
+			bigtime_t			fRecoveryDelay;			// grows on flapping
+			bigtime_t			fLastRecoveryTime;
+			bool				fBandwidthShortfall;	// MJPEG frames too
+														// small, step now
+
 			// High-bandwidth auto-detection state
 			bool				fHighBandwidthTested;		// Have we tried high-bandwidth?
 			bool				fHighBandwidthWorks;		// Did it work?
 			uint32				fHighBandwidthFailures;		// Consecutive failures
 			bool				fUsingHighBandwidth;		// Currently using high-bandwidth?
 
+			// SuperSpeed ISO endpoints of the streaming interface
+			uvc_ss_companion	fSSCompanions[kMaxSSCompanions];
+			int32				fSSCompanionCount;
+
 			// MJPEG frame size monitoring (for auto-fallback)
 			size_t				fMJPEGFrameSizeSum;			// Sum of recent frame sizes
 			uint32				fMJPEGFrameSizeCount;		// Count of frames measured
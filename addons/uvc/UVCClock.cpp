@@ -0,0 +1,187 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Device clock recovery from UVC payload header PTS/SCR fields.
+ */
+
+
+#include "UVCClock.h"
+
+#include <OS.h>
+#include <syslog.h>
+
+
+// Crystal tolerance is ~100ppm; anything further off is a bad fit
+static const double kMaxDriftRatio = 0.002;
+
+// A sample this far from the current fit means the device clock jumped
+// (stream restart, device reset): start over rather than bending the fit
+static const bigtime_t kMaxSampleError = 100000;
+
+
+UVCClockRecovery::UVCClockRecovery()
+	:
+	fFrequency(0)
+{
+	Reset();
+}
+
+
+void
+UVCClockRecovery::SetFrequency(uint32 hz)
+{
+	if (hz != fFrequency)
+		syslog(LOG_INFO, "UVCClock: device clock %u Hz\n", hz);
+	fFrequency = hz;
+	Reset();
+}
+
+
+void
+UVCClockRecovery::Reset()
+{
+	fHead = 0;
+	fCount = 0;
+	fLastSTC = 0;
+	fLastDevice = 0;
+	fSlope = fFrequency > 0 ? 1000000.0 / fFrequency : 0.0;
+	fAnchorDevice = 0;
+	fAnchorSystem = 0;
+}
+
+
+void
+UVCClockRecovery::AddSample(uint32 stc, bigtime_t systemTime)
+{
+	if (fFrequency == 0)
+		return;
+
+	int64 device = stc;
+	if (fCount > 0) {
+		// The STC wraps every 2^32 ticks (~2 minutes at 30MHz); a signed
+		// delta unwraps it as long as samples come more often than that
+		int32 delta = (int32)(stc - fLastSTC);
+		device = fLastDevice + delta;
+
+		bigtime_t predicted = fAnchorSystem
+			+ (bigtime_t)((device - fAnchorDevice) * fSlope);
+		bigtime_t error = systemTime - predicted;
+		if (delta < 0 || (IsLocked()
+				&& (error > kMaxSampleError || error < -kMaxSampleError))) {
+			syslog(LOG_INFO, "UVCClock: clock discontinuity (delta=%d, "
+				"error=%lld us), resyncing\n", (int)delta, error);
+			Reset();
+			device = stc;
+		}
+	}
+
+	int32 index;
+	if (fCount < kMaxSamples)
+		index = (fHead + fCount++) % kMaxSamples;
+	else {
+		index = fHead;
+		fHead = (fHead + 1) % kMaxSamples;
+	}
+	fSamples[index].device = device;
+	fSamples[index].system = systemTime;
+
+	fLastSTC = stc;
+	fLastDevice = device;
+
+	_UpdateFit();
+}
+
+
+bool
+UVCClockRecovery::DeviceToSystem(uint32 pts, bigtime_t* systemTime) const
+{
+	if (fFrequency == 0 || !IsLocked())
+		return false;
+
+	// The PTS is a little before the latest SCR, or after it if the frame
+	// started in a packet without one; either way well within 2^31 ticks
+	int64 device = fLastDevice + (int32)(pts - fLastSTC);
+	*systemTime = fAnchorSystem
+		+ (bigtime_t)((device - fAnchorDevice) * fSlope);
+	return true;
+}
+
+
+int32
+UVCClockRecovery::DriftPPM() const
+{
+	if (fFrequency == 0)
+		return 0;
+
+	// A fast device clock means fewer microseconds per tick
+	double nominal = 1000000.0 / fFrequency;
+	return (int32)((nominal / fSlope - 1.0) * 1000000.0);
+}
+
+
+void
+UVCClockRecovery::_UpdateFit()
+{
+	const double nominal = 1000000.0 / fFrequency;
+	const clock_sample& oldest = fSamples[fHead];
+	const clock_sample& newest = fSamples[(fHead + fCount - 1) % kMaxSamples];
+
+	// Lower convex hull of the samples (they are in device time order).
+	// No sample arrives before the real clock, so the real line lies on
+	// or below all of them; of the hull edges, the one spanning the mean
+	// device time is the line closest to the samples overall.
+	int32 hull[kMaxSamples];
+	int32 hullCount = 0;
+	int64 deviceSum = 0;
+	for (int32 i = 0; i < fCount; i++) {
+		int32 index = (fHead + i) % kMaxSamples;
+		const clock_sample& p = fSamples[index];
+		deviceSum += p.device - oldest.device;
+
+		while (hullCount >= 2) {
+			const clock_sample& o = fSamples[hull[hullCount - 2]];
+			const clock_sample& a = fSamples[hull[hullCount - 1]];
+			double cross = (double)(a.device - o.device) * (p.system - o.system)
+				- (double)(a.system - o.system) * (p.device - o.device);
+			if (cross > 0)
+				break;
+			hullCount--;
+		}
+		hull[hullCount++] = index;
+	}
+
+	double slope = nominal;
+	if (fCount >= kMinSamples
+		&& newest.device - oldest.device > (int64)fFrequency / 4) {
+		int64 mean = oldest.device + deviceSum / fCount;
+		int32 edge;
+		for (edge = 0; edge < hullCount - 2; edge++) {
+			if (fSamples[hull[edge + 1]].device >= mean)
+				break;
+		}
+
+		const clock_sample& a = fSamples[hull[edge]];
+		const clock_sample& b = fSamples[hull[edge + 1]];
+		double measured = b.device > a.device
+			? (double)(b.system - a.system) / (b.device - a.device) : 0.0;
+		if (measured > nominal * (1.0 - kMaxDriftRatio)
+			&& measured < nominal * (1.0 + kMaxDriftRatio))
+			slope = measured;
+	}
+
+	// Offset: the lower envelope for that slope, projected to the newest
+	// sample. Only hull points can be on it.
+	bigtime_t anchor = newest.system;
+	for (int32 i = 0; i < hullCount; i++) {
+		const clock_sample& s = fSamples[hull[i]];
+		bigtime_t projected = s.system
+			+ (bigtime_t)((newest.device - s.device) * slope);
+		if (projected < anchor)
+			anchor = projected;
+	}
+
+	fSlope = slope;
+	fAnchorDevice = newest.device;
+	fAnchorSystem = anchor;
+}
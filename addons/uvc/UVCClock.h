@@ -0,0 +1,79 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Device clock recovery from UVC payload header PTS/SCR fields.
+ */
+#ifndef _UVC_CLOCK_H
+#define _UVC_CLOCK_H
+
+
+#include <SupportDefs.h>
+
+
+// =============================================================================
+// UVC Device Clock Recovery
+// =============================================================================
+// The payload header SCR carries the device's source time clock (STC, in
+// dwClockFrequency ticks) at the time the packet was sent, the PTS the STC
+// value at which the frame was captured. Pairing each SCR with the host
+// time the packet arrived gives a noisy STC -> system_time() mapping; the
+// noise is USB scheduling/completion delay, which is never negative. So the
+// rate is taken from a window of samples and the offset from the sample
+// with the least delay (the lower envelope), which converges on the real
+// capture time instead of averaging in the delay.
+
+class UVCClockRecovery {
+public:
+								UVCClockRecovery();
+
+			void				SetFrequency(uint32 hz);
+			uint32				Frequency() const { return fFrequency; }
+
+								// Forget all samples (stream restart)
+			void				Reset();
+
+								// One SCR sample and its host arrival time
+			void				AddSample(uint32 stc, bigtime_t systemTime);
+
+								// Map a PTS to system_time(). Fails until
+								// enough samples have been collected.
+			bool				DeviceToSystem(uint32 pts,
+									bigtime_t* systemTime) const;
+
+			bool				IsLocked() const
+									{ return fCount >= kMinSamples; }
+								// Recovered device rate against nominal,
+								// in parts per million
+			int32				DriftPPM() const;
+
+private:
+			void				_UpdateFit();
+
+	enum {
+		kMaxSamples	= 256,	// ~8s of one sample per frame at 30fps
+		kMinSamples	= 4
+	};
+
+	struct clock_sample {
+		int64		device;		// unwrapped STC
+		bigtime_t	system;
+	};
+
+			clock_sample		fSamples[kMaxSamples];
+			int32				fHead;		// oldest sample
+			int32				fCount;
+
+			uint32				fFrequency;
+			uint32				fLastSTC;
+			int64				fLastDevice;
+
+			// Current fit: system = fAnchorSystem
+			//		+ (device - fAnchorDevice) * fSlope
+			double				fSlope;		// microseconds per tick
+			int64				fAnchorDevice;
+			bigtime_t			fAnchorSystem;
+};
+
+
+#endif /* _UVC_CLOCK_H */
@@ -0,0 +1,1471 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * YUY2 to RGB32 row converters with runtime CPU dispatch.
+ *
+ * All kernels implement the same fixed-point BT.601 conversion as the
+ * lookup tables:
+ *   B = clamp((298 * (Y - 16) + 516 * (U - 128) + 128) >> 8)
+ *   G = clamp((298 * (Y - 16) - 100 * (U - 128) - 208 * (V - 128) + 128) >> 8)
+ *   R = clamp((298 * (Y - 16) + 409 * (V - 128) + 128) >> 8)
+ * The intermediate sums need 18 bits, so the SIMD kernels multiply 16-bit
+ * (Y, U/V) pairs into 32-bit lanes (pmaddwd / vmull) and rely on the
+ * saturating packs for the final clamp, which keeps them bit-exact.
+ */
+
+
+#include "UVCColorConvert.h"
+
+#include <OS.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#if defined(__GNUC__) && __GNUC__ >= 5 \
+	&& (defined(__i386__) || defined(__x86_64__))
+#	define UVC_CONVERT_X86 1
+#	include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	define UVC_CONVERT_NEON 1
+#	include <arm_neon.h>
+#endif
+
+
+// =============================================================================
+// Global YUV to RGB Lookup Tables
+// =============================================================================
+// Pre-computed tables eliminate per-pixel multiplications in color conversion.
+// Uses BT.601 coefficients: R = 1.164(Y-16) + 1.596(V-128)
+//                           G = 1.164(Y-16) - 0.391(U-128) - 0.813(V-128)
+//                           B = 1.164(Y-16) + 2.018(U-128)
+
+yuv_rgb_lookup_tables gYuvRgbTables;
+
+
+void
+yuv_rgb_lookup_tables::Initialize()
+{
+	if (initialized)
+		return;
+
+	for (int i = 0; i < 256; i++) {
+		// Y contribution (same for R, G, B)
+		// y_table[i] = 298 * (i - 16), unshifted for combining with U/V
+		// Max value: 298 * 239 = 71222 (requires int32)
+		y_table[i] = 298 * (i - 16);
+
+		// U contribution to B: 516 * (u - 128)
+		// Range: -66048 to +65532 (requires int32)
+		u_b_table[i] = 516 * (i - 128);
+
+		// U contribution to G: -100 * (u - 128)
+		u_g_table[i] = -100 * (i - 128);
+
+		// V contribution to R: 409 * (v - 128)
+		v_r_table[i] = 409 * (i - 128);
+
+		// V contribution to G: -208 * (v - 128)
+		v_g_table[i] = -208 * (i - 128);
+	}
+
+	initialized = true;
+	syslog(LOG_INFO, "UVCCamDevice: YUV-RGB lookup tables initialized (~5KB)\n");
+}
+
+// =============================================================================
+// Conversion Parameters
+// =============================================================================
+// 8.8 fixed point, the BT.601 limited set being the lookup table one:
+//   B = clamp((kY * (Y - kYOffset) + kBU * (U - 128) + 128) >> 8)
+//   G = clamp((kY * (Y - kYOffset) + kGU * (U - 128) + kGV * (V - 128)
+//       + 128) >> 8)
+//   R = clamp((kY * (Y - kYOffset) + kRV * (V - 128) + 128) >> 8)
+
+template<int kMatrix, int kRange> struct yuv_coefficients;
+
+template<> struct yuv_coefficients<YUV_MATRIX_BT601, YUV_RANGE_LIMITED> {
+	enum { kY = 298, kYOffset = 16, kRV = 409, kGU = -100, kGV = -208,
+		kBU = 516 };
+};
+
+template<> struct yuv_coefficients<YUV_MATRIX_BT709, YUV_RANGE_LIMITED> {
+	enum { kY = 298, kYOffset = 16, kRV = 459, kGU = -55, kGV = -136,
+		kBU = 541 };
+};
+
+template<> struct yuv_coefficients<YUV_MATRIX_BT601, YUV_RANGE_FULL> {
+	enum { kY = 256, kYOffset = 0, kRV = 359, kGU = -88, kGV = -183,
+		kBU = 454 };
+};
+
+template<> struct yuv_coefficients<YUV_MATRIX_BT709, YUV_RANGE_FULL> {
+	enum { kY = 256, kYOffset = 0, kRV = 403, kGU = -48, kGV = -120,
+		kBU = 475 };
+};
+
+
+// Byte offsets within a macro-pixel
+template<int kLayout> struct yuv422_offsets;
+
+template<> struct yuv422_offsets<YUV422_YUYV> {
+	enum { kY0 = 0, kU = 1, kY1 = 2, kV = 3 };
+};
+
+template<> struct yuv422_offsets<YUV422_UYVY> {
+	enum { kU = 0, kY0 = 1, kV = 2, kY1 = 3 };
+};
+
+
+// One output pixel
+template<int kSpace> struct rgb_pixel;
+
+template<> struct rgb_pixel<B_RGB32> {
+	enum { kBytes = 4 };
+	static inline uint8* Store(uint8* dst, uint8 b, uint8 g, uint8 r)
+	{
+		dst[0] = b;
+		dst[1] = g;
+		dst[2] = r;
+		dst[3] = 255;
+		return dst + 4;
+	}
+};
+
+template<> struct rgb_pixel<B_RGB24> {
+	enum { kBytes = 3 };
+	static inline uint8* Store(uint8* dst, uint8 b, uint8 g, uint8 r)
+	{
+		dst[0] = b;
+		dst[1] = g;
+		dst[2] = r;
+		return dst + 3;
+	}
+};
+
+template<> struct rgb_pixel<B_RGB16> {
+	enum { kBytes = 2 };
+	static inline uint8* Store(uint8* dst, uint8 b, uint8 g, uint8 r)
+	{
+		// 5-6-5, little endian
+		uint16 pixel = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+		dst[0] = (uint8)pixel;
+		dst[1] = (uint8)(pixel >> 8);
+		return dst + 2;
+	}
+};
+
+
+// =============================================================================
+// Scalar Kernels (reference)
+// =============================================================================
+
+// Optimized inline clamp function using branchless technique
+static inline uint8
+clamp255(int32 v)
+{
+	// Branchless clamp: faster than conditional on most CPUs
+	v = v < 0 ? 0 : v;
+	return (uint8)(v > 255 ? 255 : v);
+}
+
+
+void
+yuy2_to_rgb32_row_scalar(uint8* dst, const uint8* src, int32 pairs)
+{
+	// Ensure lookup tables are initialized
+	if (!gYuvRgbTables.initialized)
+		gYuvRgbTables.Initialize();
+
+	// Cache table pointers for faster access in inner loop
+	const int32* yTable = gYuvRgbTables.y_table;
+	const int32* uBTable = gYuvRgbTables.u_b_table;
+	const int32* uGTable = gYuvRgbTables.u_g_table;
+	const int32* vRTable = gYuvRgbTables.v_r_table;
+	const int32* vGTable = gYuvRgbTables.v_g_table;
+
+	for (int32 x = 0; x < pairs; x++) {
+		// Read YUY2 macro-pixel (2 pixels)
+		uint8 y0 = src[0];
+		uint8 u  = src[1];
+		uint8 y1 = src[2];
+		uint8 v  = src[3];
+		src += 4;
+
+		// Lookup pre-computed values (no multiplications!)
+		int32 yVal0 = yTable[y0];
+		int32 yVal1 = yTable[y1];
+		int32 uB = uBTable[u];
+		int32 uG = uGTable[u];
+		int32 vR = vRTable[v];
+		int32 vG = vGTable[v];
+
+		// Pixel 0: BGRA (combine Y with U/V contributions, then shift)
+		dst[0] = clamp255((yVal0 + uB + 128) >> 8);           // B
+		dst[1] = clamp255((yVal0 + uG + vG + 128) >> 8);      // G
+		dst[2] = clamp255((yVal0 + vR + 128) >> 8);           // R
+		dst[3] = 255;                                          // A
+
+		// Pixel 1: BGRA
+		dst[4] = clamp255((yVal1 + uB + 128) >> 8);           // B
+		dst[5] = clamp255((yVal1 + uG + vG + 128) >> 8);      // G
+		dst[6] = clamp255((yVal1 + vR + 128) >> 8);           // R
+		dst[7] = 255;                                          // A
+		dst += 8;
+	}
+}
+
+
+// The same sums as the table kernel with the coefficients as immediates
+template<int kLayout, int kMatrix, int kRange, int kSpace>
+static void
+yuv422_row_scalar(uint8* dst, const uint8* src, int32 pairs)
+{
+	typedef yuv_coefficients<kMatrix, kRange> C;
+	typedef yuv422_offsets<kLayout> L;
+
+	for (int32 x = 0; x < pairs; x++) {
+		int32 u = src[L::kU] - 128;
+		int32 v = src[L::kV] - 128;
+		int32 y0 = C::kY * (src[L::kY0] - C::kYOffset);
+		int32 y1 = C::kY * (src[L::kY1] - C::kYOffset);
+		src += 4;
+
+		int32 b = C::kBU * u + 128;
+		int32 g = C::kGU * u + C::kGV * v + 128;
+		int32 r = C::kRV * v + 128;
+
+		dst = rgb_pixel<kSpace>::Store(dst, clamp255((y0 + b) >> 8),
+			clamp255((y0 + g) >> 8), clamp255((y0 + r) >> 8));
+		dst = rgb_pixel<kSpace>::Store(dst, clamp255((y1 + b) >> 8),
+			clamp255((y1 + g) >> 8), clamp255((y1 + r) >> 8));
+	}
+}
+
+
+#ifdef UVC_CONVERT_X86
+// =============================================================================
+// x86 Kernels (SSE2 / SSSE3 / AVX2)
+// =============================================================================
+// Input words are prepared as (Y', C') pairs per output pixel, where
+// Y' = Y - kYOffset and C' = U - 128 or V - 128. One pmaddwd then yields
+// the full 32-bit channel sum for four pixels.
+
+#define X86_TARGET(isa) __attribute__((target(isa)))
+
+
+// Converts (Y', U') and (Y', V') word pairs for four pixels into four
+// 32-bit B, G and R sums, already rounded and shifted.
+template<class C>
+X86_TARGET("sse2") static inline void
+sse2_channels(__m128i yu, __m128i yv, __m128i& b, __m128i& g, __m128i& r)
+{
+	const __m128i kB = _mm_setr_epi16(C::kY, C::kBU, C::kY, C::kBU,
+		C::kY, C::kBU, C::kY, C::kBU);
+	const __m128i kGU = _mm_setr_epi16(C::kY, C::kGU, C::kY, C::kGU,
+		C::kY, C::kGU, C::kY, C::kGU);
+	const __m128i kGV = _mm_setr_epi16(0, C::kGV, 0, C::kGV, 0, C::kGV,
+		0, C::kGV);
+	const __m128i kR = _mm_setr_epi16(C::kY, C::kRV, C::kY, C::kRV,
+		C::kY, C::kRV, C::kY, C::kRV);
+	const __m128i kRound = _mm_set1_epi32(128);
+
+	b = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu, kB), kRound), 8);
+	g = _mm_add_epi32(_mm_madd_epi16(yu, kGU), _mm_madd_epi16(yv, kGV));
+	g = _mm_srai_epi32(_mm_add_epi32(g, kRound), 8);
+	r = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv, kR), kRound), 8);
+}
+
+
+// Packs eight pixels of 32-bit channel sums (pixels 0-3 in b0, g0, r0)
+// into the destination format
+template<int kSpace> struct x86_rgb_store;
+
+template<> struct x86_rgb_store<B_RGB32> {
+	X86_TARGET("sse2") static inline void
+	Store(uint8* dst, __m128i b0, __m128i g0, __m128i r0,
+		__m128i b1, __m128i g1, __m128i r1)
+	{
+		// packs keeps the small signed range, packus does the 0..255 clamp
+		__m128i b = _mm_packs_epi32(b0, b1);
+		__m128i g = _mm_packs_epi32(g0, g1);
+		__m128i r = _mm_packs_epi32(r0, r1);
+
+		__m128i br = _mm_packus_epi16(b, r);
+		__m128i ga = _mm_packus_epi16(g, _mm_set1_epi16(255));
+		__m128i bg = _mm_unpacklo_epi8(br, ga);
+		__m128i ra = _mm_unpackhi_epi8(br, ga);
+
+		_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(bg, ra));
+	}
+};
+
+template<> struct x86_rgb_store<B_RGB24> {
+	X86_TARGET("ssse3") static inline void
+	Store(uint8* dst, __m128i b0, __m128i g0, __m128i r0,
+		__m128i b1, __m128i g1, __m128i r1)
+	{
+		const __m128i kDropAlpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+			12, 13, 14, -1, -1, -1, -1);
+
+		__m128i br = _mm_packus_epi16(_mm_packs_epi32(b0, b1),
+			_mm_packs_epi32(r0, r1));
+		__m128i ga = _mm_packus_epi16(_mm_packs_epi32(g0, g1),
+			_mm_setzero_si128());
+		__m128i bg = _mm_unpacklo_epi8(br, ga);
+		__m128i ra = _mm_unpackhi_epi8(br, ga);
+		__m128i lo = _mm_shuffle_epi8(_mm_unpacklo_epi16(bg, ra), kDropAlpha);
+		__m128i hi = _mm_shuffle_epi8(_mm_unpackhi_epi16(bg, ra), kDropAlpha);
+
+		// 24 bytes exactly, never past the end of the row
+		_mm_storeu_si128((__m128i*)dst, _mm_or_si128(lo, _mm_slli_si128(hi, 12)));
+		_mm_storel_epi64((__m128i*)(dst + 16), _mm_srli_si128(hi, 4));
+	}
+};
+
+template<> struct x86_rgb_store<B_RGB16> {
+	X86_TARGET("sse2") static inline void
+	Store(uint8* dst, __m128i b0, __m128i g0, __m128i r0,
+		__m128i b1, __m128i g1, __m128i r1)
+	{
+		const __m128i kZero = _mm_setzero_si128();
+		const __m128i kMax = _mm_set1_epi16(255);
+
+		__m128i b = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(b0, b1),
+			kZero), kMax);
+		__m128i g = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(g0, g1),
+			kZero), kMax);
+		__m128i r = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(r0, r1),
+			kZero), kMax);
+
+		__m128i pixel = _mm_and_si128(_mm_slli_epi16(r, 8),
+			_mm_set1_epi16((short)0xf800));
+		pixel = _mm_or_si128(pixel, _mm_and_si128(_mm_slli_epi16(g, 3),
+			_mm_set1_epi16(0x07e0)));
+		pixel = _mm_or_si128(pixel, _mm_srli_epi16(b, 3));
+		_mm_storeu_si128((__m128i*)dst, pixel);
+	}
+};
+
+
+// The word shuffles of the SSE2 kernel, and the biases subtracted before
+// them, for each layout
+template<int kLayout> struct sse2_layout;
+
+template<> struct sse2_layout<YUV422_YUYV> {
+	// words 0 1 2 1 -> (Y0,U) (Y1,U), words 0 3 2 3 -> (Y0,V) (Y1,V)
+	enum { kYU = _MM_SHUFFLE(1, 2, 1, 0), kYV = _MM_SHUFFLE(3, 2, 3, 0),
+		kFirstIsY = 1 };
+};
+
+template<> struct sse2_layout<YUV422_UYVY> {
+	// words 1 0 3 0 -> (Y0,U) (Y1,U), words 1 2 3 2 -> (Y0,V) (Y1,V)
+	enum { kYU = _MM_SHUFFLE(0, 3, 0, 1), kYV = _MM_SHUFFLE(2, 3, 2, 1),
+		kFirstIsY = 0 };
+};
+
+
+template<int kLayout, int kMatrix, int kRange, int kSpace>
+X86_TARGET("sse2") static void
+yuv422_row_sse2(uint8* dst, const uint8* src, int32 pairs)
+{
+	typedef yuv_coefficients<kMatrix, kRange> C;
+	typedef sse2_layout<kLayout> L;
+
+	const __m128i kZero = _mm_setzero_si128();
+	const int16 even = L::kFirstIsY ? C::kYOffset : 128;
+	const int16 odd = L::kFirstIsY ? 128 : C::kYOffset;
+	const __m128i kBias = _mm_setr_epi16(even, odd, even, odd, even, odd,
+		even, odd);
+
+	int32 x = 0;
+	for (; x + 4 <= pairs; x += 4) {
+		__m128i in = _mm_loadu_si128((const __m128i*)src);
+		__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(in, kZero), kBias);
+		__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(in, kZero), kBias);
+
+		__m128i yuLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, L::kYU),
+			L::kYU);
+		__m128i yvLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, L::kYV),
+			L::kYV);
+		__m128i yuHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, L::kYU),
+			L::kYU);
+		__m128i yvHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, L::kYV),
+			L::kYV);
+
+		__m128i b0, g0, r0, b1, g1, r1;
+		sse2_channels<C>(yuLo, yvLo, b0, g0, r0);
+		sse2_channels<C>(yuHi, yvHi, b1, g1, r1);
+		x86_rgb_store<kSpace>::Store(dst, b0, g0, r0, b1, g1, r1);
+
+		src += 16;
+		dst += 8 * rgb_pixel<kSpace>::kBytes;
+	}
+
+	if (x < pairs)
+		yuv422_row_scalar<kLayout, kMatrix, kRange, kSpace>(dst, src, pairs - x);
+}
+
+
+// pshufb masks building (Y', C') words straight from the macro-pixel bytes,
+// per layout: (Y, U) and (Y, V) for pixels 0-3, then for pixels 4-7
+static const int8 kPairMasks[2][4][16] = {
+	{	// YUYV
+		{ 0, -1, 1, -1, 2, -1, 1, -1, 4, -1, 5, -1, 6, -1, 5, -1 },
+		{ 0, -1, 3, -1, 2, -1, 3, -1, 4, -1, 7, -1, 6, -1, 7, -1 },
+		{ 8, -1, 9, -1, 10, -1, 9, -1, 12, -1, 13, -1, 14, -1, 13, -1 },
+		{ 8, -1, 11, -1, 10, -1, 11, -1, 12, -1, 15, -1, 14, -1, 15, -1 }
+	},
+	{	// UYVY
+		{ 1, -1, 0, -1, 3, -1, 0, -1, 5, -1, 4, -1, 7, -1, 4, -1 },
+		{ 1, -1, 2, -1, 3, -1, 2, -1, 5, -1, 6, -1, 7, -1, 6, -1 },
+		{ 9, -1, 8, -1, 11, -1, 8, -1, 13, -1, 12, -1, 15, -1, 12, -1 },
+		{ 9, -1, 10, -1, 11, -1, 10, -1, 13, -1, 14, -1, 15, -1, 14, -1 }
+	}
+};
+
+
+template<int kLayout, int kMatrix, int kRange, int kSpace>
+X86_TARGET("ssse3") static void
+yuv422_row_ssse3(uint8* dst, const uint8* src, int32 pairs)
+{
+	typedef yuv_coefficients<kMatrix, kRange> C;
+
+	const __m128i kBias = _mm_setr_epi16(C::kYOffset, 128, C::kYOffset, 128,
+		C::kYOffset, 128, C::kYOffset, 128);
+	const __m128i kYULo = _mm_loadu_si128((const __m128i*)kPairMasks[kLayout][0]);
+	const __m128i kYVLo = _mm_loadu_si128((const __m128i*)kPairMasks[kLayout][1]);
+	const __m128i kYUHi = _mm_loadu_si128((const __m128i*)kPairMasks[kLayout][2]);
+	const __m128i kYVHi = _mm_loadu_si128((const __m128i*)kPairMasks[kLayout][3]);
+
+	int32 x = 0;
+	for (; x + 4 <= pairs; x += 4) {
+		__m128i in = _mm_loadu_si128((const __m128i*)src);
+		__m128i yuLo = _mm_sub_epi16(_mm_shuffle_epi8(in, kYULo), kBias);
+		__m128i yvLo = _mm_sub_epi16(_mm_shuffle_epi8(in, kYVLo), kBias);
+		__m128i yuHi = _mm_sub_epi16(_mm_shuffle_epi8(in, kYUHi), kBias);
+		__m128i yvHi = _mm_sub_epi16(_mm_shuffle_epi8(in, kYVHi), kBias);
+
+		__m128i b0, g0, r0, b1, g1, r1;
+		sse2_channels<C>(yuLo, yvLo, b0, g0, r0);
+		sse2_channels<C>(yuHi, yvHi, b1, g1, r1);
+		x86_rgb_store<kSpace>::Store(dst, b0, g0, r0, b1, g1, r1);
+
+		src += 16;
+		dst += 8 * rgb_pixel<kSpace>::kBytes;
+	}
+
+	if (x < pairs)
+		yuv422_row_scalar<kLayout, kMatrix, kRange, kSpace>(dst, src, pairs - x);
+}
+
+
+template<int kLayout, int kMatrix, int kRange, int kSpace>
+X86_TARGET("avx2") static void
+yuv422_row_avx2(uint8* dst, const uint8* src, int32 pairs)
+{
+	// Same math as SSSE3 on two 128-bit lanes (pixels 0-7 and 8-15).
+	// All shuffles, madds and packs stay within a lane, so only the final
+	// store needs a cross-lane permute.
+	typedef yuv_coefficients<kMatrix, kRange> C;
+
+	const __m256i kBias = _mm256_setr_epi16(C::kYOffset, 128, C::kYOffset,
+		128, C::kYOffset, 128, C::kYOffset, 128, C::kYOffset, 128,
+		C::kYOffset, 128, C::kYOffset, 128, C::kYOffset, 128);
+	const __m256i kYULo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*)kPairMasks[kLayout][0]));
+	const __m256i kYVLo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*)kPairMasks[kLayout][1]));
+	const __m256i kYUHi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*)kPairMasks[kLayout][2]));
+	const __m256i kYVHi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*)kPairMasks[kLayout][3]));
+	const __m256i kB = _mm256_setr_epi16(C::kY, C::kBU, C::kY, C::kBU,
+		C::kY, C::kBU, C::kY, C::kBU, C::kY, C::kBU, C::kY, C::kBU,
+		C::kY, C::kBU, C::kY, C::kBU);
+	const __m256i kGU = _mm256_setr_epi16(C::kY, C::kGU, C::kY, C::kGU,
+		C::kY, C::kGU, C::kY, C::kGU, C::kY, C::kGU, C::kY, C::kGU,
+		C::kY, C::kGU, C::kY, C::kGU);
+	const __m256i kGV = _mm256_setr_epi16(0, C::kGV, 0, C::kGV, 0, C::kGV,
+		0, C::kGV, 0, C::kGV, 0, C::kGV, 0, C::kGV, 0, C::kGV);
+	const __m256i kR = _mm256_setr_epi16(C::kY, C::kRV, C::kY, C::kRV,
+		C::kY, C::kRV, C::kY, C::kRV, C::kY, C::kRV, C::kY, C::kRV,
+		C::kY, C::kRV, C::kY, C::kRV);
+	const __m256i kRound = _mm256_set1_epi32(128);
+	const __m256i kAlpha = _mm256_set1_epi16(255);
+
+	int32 x = 0;
+	for (; x + 8 <= pairs; x += 8) {
+		__m256i in = _mm256_loadu_si256((const __m256i*)src);
+		__m256i yu[2], yv[2], b[2], g[2], r[2];
+		yu[0] = _mm256_sub_epi16(_mm256_shuffle_epi8(in, kYULo), kBias);
+		yv[0] = _mm256_sub_epi16(_mm256_shuffle_epi8(in, kYVLo), kBias);
+		yu[1] = _mm256_sub_epi16(_mm256_shuffle_epi8(in, kYUHi), kBias);
+		yv[1] = _mm256_sub_epi16(_mm256_shuffle_epi8(in, kYVHi), kBias);
+
+		for (int i = 0; i < 2; i++) {
+			b[i] = _mm256_srai_epi32(_mm256_add_epi32(
+				_mm256_madd_epi16(yu[i], kB), kRound), 8);
+			g[i] = _mm256_add_epi32(_mm256_madd_epi16(yu[i], kGU),
+				_mm256_madd_epi16(yv[i], kGV));
+			g[i] = _mm256_srai_epi32(_mm256_add_epi32(g[i], kRound), 8);
+			r[i] = _mm256_srai_epi32(_mm256_add_epi32(
+				_mm256_madd_epi16(yv[i], kR), kRound), 8);
+		}
+
+		if (kSpace == B_RGB32) {
+			__m256i br = _mm256_packus_epi16(_mm256_packs_epi32(b[0], b[1]),
+				_mm256_packs_epi32(r[0], r[1]));
+			__m256i ga = _mm256_packus_epi16(_mm256_packs_epi32(g[0], g[1]),
+				kAlpha);
+			__m256i bg = _mm256_unpacklo_epi8(br, ga);
+			__m256i ra = _mm256_unpackhi_epi8(br, ga);
+			// per lane: out0 = pixels 0-3 | 8-11, out1 = pixels 4-7 | 12-15
+			__m256i out0 = _mm256_unpacklo_epi16(bg, ra);
+			__m256i out1 = _mm256_unpackhi_epi16(bg, ra);
+
+			_mm256_storeu_si256((__m256i*)dst,
+				_mm256_permute2x128_si256(out0, out1, 0x20));
+			_mm256_storeu_si256((__m256i*)(dst + 32),
+				_mm256_permute2x128_si256(out0, out1, 0x31));
+		} else {
+			// Narrower formats pack per lane: the low lanes hold pixels
+			// 0-7, the high lanes 8-15
+			x86_rgb_store<kSpace>::Store(dst,
+				_mm256_castsi256_si128(b[0]), _mm256_castsi256_si128(g[0]),
+				_mm256_castsi256_si128(r[0]), _mm256_castsi256_si128(b[1]),
+				_mm256_castsi256_si128(g[1]), _mm256_castsi256_si128(r[1]));
+			x86_rgb_store<kSpace>::Store(dst + 8 * rgb_pixel<kSpace>::kBytes,
+				_mm256_extracti128_si256(b[0], 1),
+				_mm256_extracti128_si256(g[0], 1),
+				_mm256_extracti128_si256(r[0], 1),
+				_mm256_extracti128_si256(b[1], 1),
+				_mm256_extracti128_si256(g[1], 1),
+				_mm256_extracti128_si256(r[1], 1));
+		}
+
+		src += 32;
+		dst += 16 * rgb_pixel<kSpace>::kBytes;
+	}
+
+	if (x < pairs)
+		yuv422_row_ssse3<kLayout, kMatrix, kRange, kSpace>(dst, src, pairs - x);
+}
+
+
+static inline uint64
+x86_xgetbv()
+{
+	uint32 eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64)edx << 32) | eax;
+}
+
+
+static void
+x86_detect_features(bool& sse2, bool& ssse3, bool& avx2)
+{
+	sse2 = ssse3 = avx2 = false;
+
+	cpuid_info info;
+	if (get_cpuid(&info, 0, 0) != B_OK)
+		return;
+	uint32 maxLeaf = info.eax_0.max_eax;
+
+	if (get_cpuid(&info, 1, 0) != B_OK)
+		return;
+	uint32 ecx = info.regs.ecx;
+	uint32 edx = info.regs.edx;
+
+	sse2 = (edx & (1 << 26)) != 0;
+	ssse3 = (ecx & (1 << 9)) != 0;
+
+	// AVX2 also needs the OS to save YMM state (OSXSAVE + XCR0 bits 1-2)
+	bool osxsave = (ecx & (1 << 27)) != 0;
+	bool avx = (ecx & (1 << 28)) != 0;
+	if (maxLeaf >= 7 && osxsave && avx && (x86_xgetbv() & 0x6) == 0x6
+		&& get_cpuid(&info, 7, 0) == B_OK)
+		avx2 = (info.regs.ebx & (1 << 5)) != 0;
+}
+
+#endif	// UVC_CONVERT_X86
+
+
+#ifdef UVC_CONVERT_NEON
+// =============================================================================
+// ARM NEON Kernels
+// =============================================================================
+
+// One channel for eight pixels: kY * y + k1 * c1 + k2 * c2, rounded,
+// shifted and clamped to 0..255
+template<class C>
+static inline uint8x8_t
+neon_channel(int16x8_t y, int16x8_t c1, int16_t k1, int16x8_t c2, int16_t k2)
+{
+	int32x4_t lo = vmull_n_s16(vget_low_s16(y), C::kY);
+	lo = vmlal_n_s16(lo, vget_low_s16(c1), k1);
+	lo = vmlal_n_s16(lo, vget_low_s16(c2), k2);
+
+	int32x4_t hi = vmull_n_s16(vget_high_s16(y), C::kY);
+	hi = vmlal_n_s16(hi, vget_high_s16(c1), k1);
+	hi = vmlal_n_s16(hi, vget_high_s16(c2), k2);
+
+	// vrshrn adds 128 before the shift, vqmovun clamps
+	return vqmovun_s16(vcombine_s16(vrshrn_n_s32(lo, 8), vrshrn_n_s32(hi, 8)));
+}
+
+
+static inline uint8x16_t
+neon_interleave(uint8x8_t even, uint8x8_t odd)
+{
+	uint8x8x2_t z = vzip_u8(even, odd);
+	return vcombine_u8(z.val[0], z.val[1]);
+}
+
+
+static inline uint16x8_t
+neon_rgb565(uint8x8_t b, uint8x8_t g, uint8x8_t r)
+{
+	uint16x8_t pixel = vshll_n_u8(r, 8);
+	pixel = vsriq_n_u16(pixel, vshll_n_u8(g, 8), 5);
+	return vsriq_n_u16(pixel, vshll_n_u8(b, 8), 11);
+}
+
+
+template<int kLayout, int kMatrix, int kRange, int kSpace>
+static void
+yuv422_row_neon(uint8* dst, const uint8* src, int32 pairs)
+{
+	typedef yuv_coefficients<kMatrix, kRange> C;
+	typedef yuv422_offsets<kLayout> L;
+
+	const int16x8_t kYBias = vdupq_n_s16(C::kYOffset);
+	const int16x8_t kCBias = vdupq_n_s16(128);
+
+	int32 x = 0;
+	for (; x + 8 <= pairs; x += 8) {
+		// val[i] = byte i of each macro-pixel
+		uint8x8x4_t in = vld4_u8(src);
+		int16x8_t y0 = vsubq_s16(
+			vreinterpretq_s16_u16(vmovl_u8(in.val[L::kY0])), kYBias);
+		int16x8_t u = vsubq_s16(
+			vreinterpretq_s16_u16(vmovl_u8(in.val[L::kU])), kCBias);
+		int16x8_t y1 = vsubq_s16(
+			vreinterpretq_s16_u16(vmovl_u8(in.val[L::kY1])), kYBias);
+		int16x8_t v = vsubq_s16(
+			vreinterpretq_s16_u16(vmovl_u8(in.val[L::kV])), kCBias);
+
+		uint8x16_t b = neon_interleave(
+			neon_channel<C>(y0, u, C::kBU, v, 0),
+			neon_channel<C>(y1, u, C::kBU, v, 0));
+		uint8x16_t g = neon_interleave(
+			neon_channel<C>(y0, u, C::kGU, v, C::kGV),
+			neon_channel<C>(y1, u, C::kGU, v, C::kGV));
+		uint8x16_t r = neon_interleave(
+			neon_channel<C>(y0, v, C::kRV, u, 0),
+			neon_channel<C>(y1, v, C::kRV, u, 0));
+
+		if (kSpace == B_RGB32) {
+			uint8x16x4_t out;
+			out.val[0] = b;
+			out.val[1] = g;
+			out.val[2] = r;
+			out.val[3] = vdupq_n_u8(255);
+			vst4q_u8(dst, out);
+		} else if (kSpace == B_RGB24) {
+			uint8x16x3_t out;
+			out.val[0] = b;
+			out.val[1] = g;
+			out.val[2] = r;
+			vst3q_u8(dst, out);
+		} else {
+			vst1q_u16((uint16_t*)dst, neon_rgb565(vget_low_u8(b),
+				vget_low_u8(g), vget_low_u8(r)));
+			vst1q_u16((uint16_t*)(dst + 16), neon_rgb565(vget_high_u8(b),
+				vget_high_u8(g), vget_high_u8(r)));
+		}
+
+		src += 32;
+		dst += 16 * rgb_pixel<kSpace>::kBytes;
+	}
+
+	if (x < pairs)
+		yuv422_row_scalar<kLayout, kMatrix, kRange, kSpace>(dst, src, pairs - x);
+}
+
+#endif	// UVC_CONVERT_NEON
+
+
+// =============================================================================
+// Runtime Dispatch
+// =============================================================================
+
+#define YUY2_KERNEL(isa) \
+	yuv422_row_##isa<YUV422_YUYV, YUV_MATRIX_BT601, YUV_RANGE_LIMITED, B_RGB32>
+
+static const yuy2_rgb32_kernel kScalarKernel = {
+	"scalar", yuy2_to_rgb32_row_scalar };
+#ifdef UVC_CONVERT_X86
+static const yuy2_rgb32_kernel kSSE2Kernel = {
+	"sse2", YUY2_KERNEL(sse2) };
+static const yuy2_rgb32_kernel kSSSE3Kernel = {
+	"ssse3", YUY2_KERNEL(ssse3) };
+static const yuy2_rgb32_kernel kAVX2Kernel = {
+	"avx2", YUY2_KERNEL(avx2) };
+#endif
+#ifdef UVC_CONVERT_NEON
+static const yuy2_rgb32_kernel kNEONKernel = {
+	"neon", YUY2_KERNEL(neon) };
+#endif
+
+
+int32
+yuy2_rgb32_available_kernels(const yuy2_rgb32_kernel** kernels,
+	int32 maxKernels)
+{
+	int32 count = 0;
+	if (count < maxKernels)
+		kernels[count++] = &kScalarKernel;
+
+#ifdef UVC_CONVERT_X86
+	bool sse2, ssse3, avx2;
+	x86_detect_features(sse2, ssse3, avx2);
+	if (sse2 && count < maxKernels)
+		kernels[count++] = &kSSE2Kernel;
+	if (sse2 && ssse3 && count < maxKernels)
+		kernels[count++] = &kSSSE3Kernel;
+	if (sse2 && ssse3 && avx2 && count < maxKernels)
+		kernels[count++] = &kAVX2Kernel;
+#endif
+#ifdef UVC_CONVERT_NEON
+	if (count < maxKernels)
+		kernels[count++] = &kNEONKernel;
+#endif
+
+	return count;
+}
+
+
+const yuy2_rgb32_kernel*
+yuy2_rgb32_best_kernel()
+{
+	// The one yuv422_rgb_best_kernel() measured fastest for YUY2 -> RGB32,
+	// as a table kernel when that is the scalar one
+	static const yuy2_rgb32_kernel* sBest = NULL;
+	if (sBest != NULL)
+		return sBest;
+
+	const yuy2_rgb32_kernel* kernels[8];
+	int32 count = yuy2_rgb32_available_kernels(kernels, 8);
+	const yuy2_rgb32_kernel* best = kernels[0];
+
+	yuv422_format format = { YUV422_YUYV, YUV_MATRIX_BT601,
+		YUV_RANGE_LIMITED, B_RGB32 };
+	yuv422_rgb_kernel chosen;
+	if (yuv422_rgb_best_kernel(format, &chosen)) {
+		for (int32 i = 0; i < count; i++) {
+			if (strcmp(kernels[i]->name, chosen.name) == 0)
+				best = kernels[i];
+		}
+	}
+
+	sBest = best;
+	return best;
+}
+
+
+void
+yuy2_to_rgb32_frame(const yuy2_rgb32_kernel* kernel, uint8* dst,
+	const uint8* src, size_t srcSize, int32 width, int32 height)
+{
+	yuv422_rgb_kernel generic = { kernel->name, kernel->convert, B_RGB32, 4 };
+	yuv422_to_rgb_frame(generic, dst, src, srcSize, width, height);
+}
+
+
+// The instantiations for one format, one per ISA, in kernel order
+struct yuv422_kernel_set {
+	yuv422_rgb_row_func	scalar;
+	yuv422_rgb_row_func	sse2;		// NULL where the ISA has no kernel
+	yuv422_rgb_row_func	ssse3;
+	yuv422_rgb_row_func	avx2;
+	yuv422_rgb_row_func	neon;
+	uint32				bytes_per_pixel;
+};
+
+
+template<int kLayout, int kMatrix, int kRange, int kSpace>
+static void
+yuv422_kernels(yuv422_kernel_set& set)
+{
+	memset(&set, 0, sizeof(set));
+	set.scalar = yuv422_row_scalar<kLayout, kMatrix, kRange, kSpace>;
+#ifdef UVC_CONVERT_X86
+	// SSE2 has no byte shuffle to drop the alpha with
+	if (kSpace != B_RGB24)
+		set.sse2 = yuv422_row_sse2<kLayout, kMatrix, kRange, kSpace>;
+	set.ssse3 = yuv422_row_ssse3<kLayout, kMatrix, kRange, kSpace>;
+	set.avx2 = yuv422_row_avx2<kLayout, kMatrix, kRange, kSpace>;
+#endif
+#ifdef UVC_CONVERT_NEON
+	set.neon = yuv422_row_neon<kLayout, kMatrix, kRange, kSpace>;
+#endif
+	set.bytes_per_pixel = rgb_pixel<kSpace>::kBytes;
+}
+
+
+template<int kLayout, int kMatrix, int kRange>
+static bool
+yuv422_kernels_for_space(color_space space, yuv422_kernel_set& set)
+{
+	switch (space) {
+		case B_RGB32:
+			yuv422_kernels<kLayout, kMatrix, kRange, B_RGB32>(set);
+			return true;
+		case B_RGB24:
+			yuv422_kernels<kLayout, kMatrix, kRange, B_RGB24>(set);
+			return true;
+		case B_RGB16:
+			yuv422_kernels<kLayout, kMatrix, kRange, B_RGB16>(set);
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+template<int kLayout>
+static bool
+yuv422_kernels_for_matrix(const yuv422_format& format, yuv422_kernel_set& set)
+{
+	bool full = format.range == YUV_RANGE_FULL;
+	if (format.matrix == YUV_MATRIX_BT709) {
+		return full
+			? yuv422_kernels_for_space<kLayout, YUV_MATRIX_BT709,
+				YUV_RANGE_FULL>(format.destination, set)
+			: yuv422_kernels_for_space<kLayout, YUV_MATRIX_BT709,
+				YUV_RANGE_LIMITED>(format.destination, set);
+	}
+	return full
+		? yuv422_kernels_for_space<kLayout, YUV_MATRIX_BT601,
+			YUV_RANGE_FULL>(format.destination, set)
+		: yuv422_kernels_for_space<kLayout, YUV_MATRIX_BT601,
+			YUV_RANGE_LIMITED>(format.destination, set);
+}
+
+
+bool
+yuv422_rgb_supports(color_space destination)
+{
+	return destination == B_RGB32 || destination == B_RGB24
+		|| destination == B_RGB16;
+}
+
+
+int32
+yuv422_rgb_available_kernels(const yuv422_format& format,
+	yuv422_rgb_kernel* kernels, int32 maxKernels)
+{
+	yuv422_kernel_set set;
+	bool found = format.layout == YUV422_UYVY
+		? yuv422_kernels_for_matrix<YUV422_UYVY>(format, set)
+		: yuv422_kernels_for_matrix<YUV422_YUYV>(format, set);
+	if (!found)
+		return 0;
+
+	struct {
+		const char*			name;
+		yuv422_rgb_row_func	convert;
+		bool				usable;
+	} candidates[] = {
+		{ "scalar", set.scalar, true },
+		{ "sse2", set.sse2, false },
+		{ "ssse3", set.ssse3, false },
+		{ "avx2", set.avx2, false },
+		{ "neon", set.neon, set.neon != NULL }
+	};
+
+#ifdef UVC_CONVERT_X86
+	// CPUID does not change under us, detect once
+	static int32 sFeatures = -1;
+	if (sFeatures < 0) {
+		bool sse2, ssse3, avx2;
+		x86_detect_features(sse2, ssse3, avx2);
+		sFeatures = (sse2 ? 1 : 0) | (sse2 && ssse3 ? 2 : 0)
+			| (sse2 && ssse3 && avx2 ? 4 : 0);
+	}
+	candidates[1].usable = (sFeatures & 1) != 0;
+	candidates[2].usable = (sFeatures & 2) != 0;
+	candidates[3].usable = (sFeatures & 4) != 0;
+#endif
+
+	int32 count = 0;
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		if (!candidates[i].usable || candidates[i].convert == NULL
+			|| count >= maxKernels)
+			continue;
+		kernels[count].name = candidates[i].name;
+		kernels[count].convert = candidates[i].convert;
+		kernels[count].destination = format.destination;
+		kernels[count].bytes_per_pixel = set.bytes_per_pixel;
+		count++;
+	}
+	return count;
+}
+
+
+// =============================================================================
+// Kernel Selection
+// =============================================================================
+// The widest ISA is not always the fastest: AVX2 lowers the clock of some
+// CPUs, and a kernel that is memory bound on one machine is not on the
+// next. So the kernel of a format is picked by measurement, once per format
+// for the life of the add-on (YUY2 -> RGB32 when the first device is set
+// up, the others on first use): each kernel is checked against the scalar
+// one on a test row, then timed converting it, and the fastest correct one
+// is kept. WEBCAM_CONVERT_KERNEL=scalar|sse2|ssse3|avx2|neon takes that
+// kernel instead, for the formats that have it.
+
+static const int32 kSelectPairs = 512;		// test row, 1024 pixels
+static const int32 kSelectRounds = 64;		// conversions per timed run
+static const int32 kSelectRuns = 3;			// the fastest run counts
+static const int32 kFormatCount = 2 * 2 * 2 * 3;
+
+// Per format, index + 1 of the kernel picked, 0 until measured (atomic)
+static int32 sSelectedKernels[kFormatCount];
+
+
+static int32
+format_slot(const yuv422_format& format)
+{
+	int32 space;
+	switch (format.destination) {
+		case B_RGB32:
+			space = 0;
+			break;
+		case B_RGB24:
+			space = 1;
+			break;
+		case B_RGB16:
+			space = 2;
+			break;
+		default:
+			return -1;
+	}
+	return ((format.layout * 2 + format.matrix) * 2 + format.range) * 3
+		+ space;
+}
+
+
+static const char*
+format_space_name(color_space space)
+{
+	switch (space) {
+		case B_RGB32:
+			return "RGB32";
+		case B_RGB24:
+			return "RGB24";
+		case B_RGB16:
+			return "RGB16";
+		default:
+			return "?";
+	}
+}
+
+
+/* Index of the kernel to use among 'kernels', scalar first */
+static int32
+select_kernel(const yuv422_format& format, const yuv422_rgb_kernel* kernels,
+	int32 count)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "%s %s %s -> %s",
+		format.layout == YUV422_UYVY ? "UYVY" : "YUYV",
+		yuv_matrix_name(format.matrix),
+		format.range == YUV_RANGE_FULL ? "full" : "limited",
+		format_space_name(format.destination));
+
+	size_t rowSize = kSelectPairs * 2 * kernels[0].bytes_per_pixel;
+	uint8* src = (uint8*)malloc(kSelectPairs * 4);
+	uint8* reference = (uint8*)malloc(rowSize);
+	uint8* output = (uint8*)malloc(rowSize);
+	if (src == NULL || reference == NULL || output == NULL) {
+		// The widest one, as before there was a measurement
+		free(src);
+		free(reference);
+		free(output);
+		return count - 1;
+	}
+
+	uint32 seed = 0x2545f491;
+	for (int32 i = 0; i < kSelectPairs * 4; i++) {
+		seed = seed * 1664525 + 1013904223;
+		src[i] = (uint8)(seed >> 24);
+	}
+	kernels[0].convert(reference, src, kSelectPairs);
+
+	const char* forced = getenv("WEBCAM_CONVERT_KERNEL");
+	int32 best = 0;
+	bigtime_t bestTime = B_INFINITE_TIMEOUT;
+	char report[128] = "";
+	size_t reportLength = 0;
+	for (int32 k = 0; k < count; k++) {
+		memset(output, 0xcc, rowSize);
+		kernels[k].convert(output, src, kSelectPairs);
+		if (memcmp(output, reference, rowSize) != 0) {
+			syslog(LOG_WARNING, "UVCColorConvert: %s kernel for %s does not "
+				"match the scalar one, not used\n", kernels[k].name, name);
+			continue;
+		}
+		if (forced != NULL && strcmp(forced, kernels[k].name) == 0) {
+			syslog(LOG_INFO, "UVCColorConvert: %s: %s kernel "
+				"(WEBCAM_CONVERT_KERNEL)\n", name, kernels[k].name);
+			best = k;
+			bestTime = 0;
+			break;
+		}
+
+		bigtime_t fastest = B_INFINITE_TIMEOUT;
+		for (int32 run = 0; run < kSelectRuns; run++) {
+			bigtime_t start = system_time();
+			for (int32 round = 0; round < kSelectRounds; round++)
+				kernels[k].convert(output, src, kSelectPairs);
+			bigtime_t elapsed = system_time() - start;
+			if (elapsed < fastest)
+				fastest = elapsed;
+		}
+		if (fastest < bestTime) {
+			best = k;
+			bestTime = fastest;
+		}
+		if (reportLength < sizeof(report)) {
+			reportLength += snprintf(report + reportLength,
+				sizeof(report) - reportLength, "%s%s %.2f",
+				reportLength > 0 ? ", " : "", kernels[k].name,
+				fastest * 1000.0 / (kSelectRounds * kSelectPairs * 2));
+		}
+	}
+
+	if (bestTime != 0) {
+		if (forced != NULL) {
+			syslog(LOG_WARNING, "UVCColorConvert: no %s kernel for %s "
+				"(WEBCAM_CONVERT_KERNEL)\n", forced, name);
+		}
+		syslog(LOG_INFO, "UVCColorConvert: %s: %s kernel (ns/pixel: %s)\n",
+			name, kernels[best].name, report);
+	}
+
+	free(src);
+	free(reference);
+	free(output);
+	return best;
+}
+
+
+bool
+yuv422_rgb_best_kernel(const yuv422_format& format, yuv422_rgb_kernel* kernel)
+{
+	yuv422_rgb_kernel kernels[8];
+	int32 count = yuv422_rgb_available_kernels(format, kernels, 8);
+	int32 slot = format_slot(format);
+	if (count == 0 || slot < 0)
+		return false;
+
+	// Measuring is idempotent, so a race between two first callers only
+	// means measuring twice
+	int32 selected = atomic_get(&sSelectedKernels[slot]);
+	if (selected == 0) {
+		selected = select_kernel(format, kernels, count) + 1;
+		atomic_set(&sSelectedKernels[slot], selected);
+	}
+
+	*kernel = kernels[selected - 1];
+	return true;
+}
+
+
+void
+yuv422_to_rgb_frame(const yuv422_rgb_kernel& kernel, uint8* dst,
+	const uint8* src, size_t srcSize, int32 width, int32 height)
+{
+	clipping_rect frame = { 0, 0, width - 1, height - 1 };
+	yuv422_to_rgb_region(kernel, dst, src, srcSize, width, height, frame);
+}
+
+
+/* The macro-pixels [*firstPair, *endPair) and rows [*top, *bottom] of
+ * 'region' within the frame; false if none */
+static bool
+region_pairs(const clipping_rect& region, int32 width, int32 height,
+	int32* firstPair, int32* endPair, int32* top, int32* bottom)
+{
+	int32 left = region.left > 0 ? region.left : 0;
+	int32 right = region.right < width - 1 ? region.right : width - 1;
+	*top = region.top > 0 ? region.top : 0;
+	*bottom = region.bottom < height - 1 ? region.bottom : height - 1;
+	*firstPair = left / 2;
+	*endPair = right / 2 + 1;
+	return left <= right && *top <= *bottom;
+}
+
+
+void
+yuv422_to_rgb_region(const yuv422_rgb_kernel& kernel, uint8* dst,
+	const uint8* src, size_t srcSize, int32 width, int32 height,
+	const clipping_rect& region)
+{
+	int32 firstPair, endPair, top, bottom;
+	if (!region_pairs(region, width, height, &firstPair, &endPair, &top,
+			&bottom))
+		return;
+
+	size_t srcStride = (size_t)width * 2;
+	size_t dstStride = (size_t)width * kernel.bytes_per_pixel;
+	size_t dstOffset = (size_t)firstPair * 2 * kernel.bytes_per_pixel;
+
+	// Row-by-row conversion for proper stride handling
+	for (int32 row = top; row <= bottom; row++) {
+		// Check source bounds for this row
+		if ((size_t)row * srcStride + srcStride > srcSize)
+			break;
+
+		kernel.convert(dst + row * dstStride + dstOffset,
+			src + row * srcStride + firstPair * 4, endPair - firstPair);
+	}
+}
+
+
+// Y0 U Y1 V out of a luma row and its chroma row, 'pairs' macro-pixels
+static void
+nv12_weave_row(uint8* out, const uint8* y, const uint8* uv, int32 pairs)
+{
+	int32 i = 0;
+#ifdef __SSE2__
+	// Byte interleave of luma and chroma is exactly YUYV
+	for (; i + 8 <= pairs; i += 8) {
+		__m128i luma = _mm_loadu_si128((const __m128i*)(y + i * 2));
+		__m128i chroma = _mm_loadu_si128((const __m128i*)(uv + i * 2));
+		_mm_storeu_si128((__m128i*)(out + i * 4),
+			_mm_unpacklo_epi8(luma, chroma));
+		_mm_storeu_si128((__m128i*)(out + i * 4 + 16),
+			_mm_unpackhi_epi8(luma, chroma));
+	}
+#endif
+	for (; i < pairs; i++) {
+		out[i * 4] = y[i * 2];
+		out[i * 4 + 1] = uv[i * 2];
+		out[i * 4 + 2] = y[i * 2 + 1];
+		out[i * 4 + 3] = uv[i * 2 + 1];
+	}
+}
+
+
+void
+nv12_to_rgb_frame(const yuv422_rgb_kernel& kernel, uint8* dst,
+	const uint8* src, size_t srcSize, int32 width, int32 height)
+{
+	clipping_rect frame = { 0, 0, width - 1, height - 1 };
+	nv12_to_rgb_region(kernel, dst, src, srcSize, width, height, frame);
+}
+
+
+void
+nv12_to_rgb_region(const yuv422_rgb_kernel& kernel, uint8* dst,
+	const uint8* src, size_t srcSize, int32 width, int32 height,
+	const clipping_rect& region)
+{
+	static const int32 kChunkPairs = 256;
+	uint8 woven[kChunkPairs * 4];
+
+	int32 firstPair, endPair, top, bottom;
+	if (!region_pairs(region, width, height, &firstPair, &endPair, &top,
+			&bottom))
+		return;
+
+	// An odd last column reads the pixel of the padding, as in YUY2
+	size_t lumaStride = (size_t)width;
+	size_t chromaStride = (size_t)((width + 1) & ~1);
+	size_t dstStride = (size_t)width * kernel.bytes_per_pixel;
+	const uint8* chromaPlane = src + lumaStride * height;
+	// The odd last pixel is done on its own below
+	bool oddLast = (width & 1) != 0 && endPair > width / 2;
+	if (endPair > width / 2)
+		endPair = width / 2;
+
+	for (int32 row = top; row <= bottom; row++) {
+		size_t chromaOffset = lumaStride * height + chromaStride * (row / 2);
+		if ((size_t)(row + 1) * lumaStride > srcSize
+			|| chromaOffset + chromaStride > srcSize)
+			break;
+
+		const uint8* y = src + row * lumaStride;
+		const uint8* uv = chromaPlane + chromaStride * (row / 2);
+		uint8* out = dst + row * dstStride;
+		for (int32 done = firstPair; done < endPair; done += kChunkPairs) {
+			int32 count = endPair - done < kChunkPairs
+				? endPair - done : kChunkPairs;
+			nv12_weave_row(woven, y + done * 2, uv + done * 2, count);
+			kernel.convert(out + done * 2 * kernel.bytes_per_pixel, woven,
+				count);
+		}
+		if (oddLast) {
+			// The last pixel alone, its pair partner repeating it
+			uint8 last[4] = { y[width - 1], uv[width - 1],
+				y[width - 1], uv[width] };
+			uint8 pixels[8];
+			kernel.convert(pixels, last, 1);
+			memcpy(out + (width - 1) * kernel.bytes_per_pixel, pixels,
+				kernel.bytes_per_pixel);
+		}
+	}
+}
+
+
+// =============================================================================
+// YUV 4:2:2 Downscaling
+// =============================================================================
+// Each output pixel is the plain average of the source pixels under it
+// (a box filter), its chroma the average of the source pairs under its
+// macro-pixel. A row is reduced a chunk at a time into L1 and converted
+// there, so the source is read once and nothing full size is written.
+
+// Samples averaged at most: 9 partly covered source pairs times 8 rows
+static const int32 kMaxBoxSamples = (kYUV422MaxDownscale + 1) * kYUV422MaxDownscale;
+
+// (sum * value[n] + (1 << 21)) >> 22 is sum / n rounded half up, exactly,
+// for every sum of n bytes; the reciprocal has to be rounded up for that
+static const struct box_reciprocals {
+	uint32	value[kMaxBoxSamples + 1];
+
+	box_reciprocals()
+	{
+		value[0] = 0;
+		for (int32 n = 1; n <= kMaxBoxSamples; n++)
+			value[n] = ((1 << 22) + n - 1) / n;
+	}
+} sBoxReciprocals;
+
+
+static inline uint8
+box_average(uint32 sum, int32 count)
+{
+	return (uint8)((sum * sBoxReciprocals.value[count] + (1 << 21)) >> 22);
+}
+
+
+bool
+yuv422_downscale_supported(int32 srcWidth, int32 srcHeight, int32 width,
+	int32 height)
+{
+	if (width <= 0 || height <= 0 || (width & 1) != 0 || (srcWidth & 1) != 0)
+		return false;
+	return srcWidth >= width && srcHeight >= height
+		&& (srcWidth > width || srcHeight > height)
+		&& srcWidth <= width * kYUV422MaxDownscale
+		&& srcHeight <= height * kYUV422MaxDownscale;
+}
+
+
+/* Exactly 2:1 both ways: output macro-pixel i out of source pairs 2i and
+ * 2i + 1 of rows 'a' and 'b'; 'out' holds [firstPair, endPair) */
+static void
+halve_row(uint8* out, const uint8* a, const uint8* b, int32 firstPair,
+	int32 endPair, yuv422_layout layout)
+{
+	int32 i = firstPair;
+	int yOffset = layout == YUV422_YUYV ? 0 : 1;
+#ifdef __SSE2__
+	// Words s0..s7 are one output pair's source bytes, summed over both
+	// rows; luma sits in the even words for YUYV, the odd ones for UYVY
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	const __m128i lumaMask = _mm_set1_epi32(
+		layout == YUV422_YUYV ? 0x0000ffff : (int)0xffff0000);
+	for (; i + 2 <= endPair; i += 2) {
+		__m128i ra = _mm_loadu_si128((const __m128i*)(a + i * 8));
+		__m128i rb = _mm_loadu_si128((const __m128i*)(b + i * 8));
+		__m128i sums[2] = {
+			_mm_add_epi16(_mm_unpacklo_epi8(ra, zero),
+				_mm_unpacklo_epi8(rb, zero)),
+			_mm_add_epi16(_mm_unpackhi_epi8(ra, zero),
+				_mm_unpackhi_epi8(rb, zero))
+		};
+		for (int k = 0; k < 2; k++) {
+			// Luma: (s0 + s2, s4 + s6) resp. (s1 + s3, s5 + s7);
+			// chroma: (s1 + s5, s3 + s7) resp. (s0 + s4, s2 + s6)
+			__m128i luma = _mm_add_epi16(
+				_mm_shuffle_epi32(sums[k], _MM_SHUFFLE(3, 3, 2, 0)),
+				_mm_shuffle_epi32(sums[k], _MM_SHUFFLE(3, 3, 3, 1)));
+			__m128i chroma = _mm_add_epi16(sums[k],
+				_mm_shuffle_epi32(sums[k], _MM_SHUFFLE(3, 3, 3, 2)));
+			sums[k] = _mm_or_si128(_mm_and_si128(luma, lumaMask),
+				_mm_andnot_si128(lumaMask, chroma));
+		}
+		__m128i both = _mm_unpacklo_epi64(sums[0], sums[1]);
+		both = _mm_srli_epi16(_mm_add_epi16(both, two), 2);
+		_mm_storel_epi64((__m128i*)(out + (i - firstPair) * 4),
+			_mm_packus_epi16(both, zero));
+	}
+#endif
+	for (; i < endPair; i++) {
+		const uint8* s = a + i * 8;
+		const uint8* t = b + i * 8;
+		for (int k = 0; k < 4; k++) {
+			// Luma from both pixels of its source pair, chroma from the
+			// same byte of both pairs
+			int first = (k & 1) == yOffset ? (k >> 1) * 4 + yOffset : k;
+			int second = (k & 1) == yOffset ? first + 2 : k + 4;
+			out[(i - firstPair) * 4 + k] = (uint8)((s[first] + s[second] + t[first]
+				+ t[second] + 2) >> 2);
+		}
+	}
+}
+
+
+/* Any ratio: output macro-pixels [firstPair, endPair) of a row 'width'
+ * wide, from the 'rows' source rows starting at 'src' */
+static void
+box_row(uint8* out, const uint8* src, size_t srcStride, int32 rows,
+	int32 srcWidth, int32 width, int32 firstPair, int32 endPair,
+	yuv422_layout layout)
+{
+	int yOffset = layout == YUV422_YUYV ? 0 : 1;
+	int uOffset = 1 - yOffset;
+	for (int32 i = firstPair; i < endPair; i++) {
+		// Source columns [x0, x1) under the left and [x1, x2) under the
+		// right pixel, never empty when downscaling
+		int32 x0 = 2 * i * srcWidth / width;
+		int32 x1 = (2 * i + 1) * srcWidth / width;
+		int32 x2 = (2 * i + 2) * srcWidth / width;
+		int32 pair0 = x0 / 2;
+		int32 pair1 = (x2 + 1) / 2;
+
+		uint32 luma0 = 0, luma1 = 0, u = 0, v = 0;
+		for (int32 r = 0; r < rows; r++) {
+			const uint8* line = src + r * srcStride;
+			for (int32 x = x0; x < x1; x++)
+				luma0 += line[x * 2 + yOffset];
+			for (int32 x = x1; x < x2; x++)
+				luma1 += line[x * 2 + yOffset];
+			for (int32 q = pair0; q < pair1; q++) {
+				u += line[q * 4 + uOffset];
+				v += line[q * 4 + uOffset + 2];
+			}
+		}
+
+		uint8* pair = out + (i - firstPair) * 4;
+		pair[yOffset] = box_average(luma0, (x1 - x0) * rows);
+		pair[yOffset + 2] = box_average(luma1, (x2 - x1) * rows);
+		pair[uOffset] = box_average(u, (pair1 - pair0) * rows);
+		pair[uOffset + 2] = box_average(v, (pair1 - pair0) * rows);
+	}
+}
+
+
+/* Output row 'row', macro-pixels [firstPair, endPair), into 'out'; false if
+ * the source is too short for it */
+static bool
+downscale_row(uint8* out, const uint8* src, size_t srcSize, int32 srcWidth,
+	int32 srcHeight, int32 width, int32 height, int32 row, int32 firstPair,
+	int32 endPair, yuv422_layout layout)
+{
+	size_t srcStride = (size_t)srcWidth * 2;
+	int32 top = row * srcHeight / height;
+	int32 bottom = (row + 1) * srcHeight / height;
+	if ((size_t)bottom * srcStride > srcSize)
+		return false;
+
+	const uint8* first = src + top * srcStride;
+	if (srcWidth == width * 2 && bottom - top == 2)
+		halve_row(out, first, first + srcStride, firstPair, endPair, layout);
+	else {
+		box_row(out, first, srcStride, bottom - top, srcWidth, width,
+			firstPair, endPair, layout);
+	}
+	return true;
+}
+
+
+void
+yuv422_downscale_to_rgb_frame(const yuv422_rgb_kernel& kernel,
+	yuv422_layout layout, uint8* dst, int32 width, int32 height,
+	const uint8* src, size_t srcSize, int32 srcWidth, int32 srcHeight)
+{
+	clipping_rect frame = { 0, 0, width - 1, height - 1 };
+	yuv422_downscale_to_rgb_region(kernel, layout, dst, width, height, src,
+		srcSize, srcWidth, srcHeight, frame);
+}
+
+
+void
+yuv422_downscale_to_rgb_region(const yuv422_rgb_kernel& kernel,
+	yuv422_layout layout, uint8* dst, int32 width, int32 height,
+	const uint8* src, size_t srcSize, int32 srcWidth, int32 srcHeight,
+	const clipping_rect& region)
+{
+	static const int32 kChunkPairs = 256;
+	uint8 reduced[kChunkPairs * 4];
+
+	int32 firstPair, endPair, top, bottom;
+	if (!yuv422_downscale_supported(srcWidth, srcHeight, width, height)
+		|| !region_pairs(region, width, height, &firstPair, &endPair, &top,
+			&bottom))
+		return;
+
+	size_t dstStride = (size_t)width * kernel.bytes_per_pixel;
+	for (int32 row = top; row <= bottom; row++) {
+		uint8* out = dst + row * dstStride;
+		for (int32 done = firstPair; done < endPair; done += kChunkPairs) {
+			int32 count = endPair - done < kChunkPairs
+				? endPair - done : kChunkPairs;
+			if (!downscale_row(reduced, src, srcSize, srcWidth, srcHeight,
+					width, height, row, done, done + count, layout))
+				return;
+			kernel.convert(out + done * 2 * kernel.bytes_per_pixel, reduced,
+				count);
+		}
+	}
+}
+
+
+void
+yuv422_downscale_frame(yuv422_layout layout, uint8* dst, int32 width,
+	int32 height, const uint8* src, size_t srcSize, int32 srcWidth,
+	int32 srcHeight)
+{
+	if (!yuv422_downscale_supported(srcWidth, srcHeight, width, height))
+		return;
+
+	for (int32 row = 0; row < height; row++) {
+		if (!downscale_row(dst + row * (size_t)width * 2, src, srcSize,
+				srcWidth, srcHeight, width, height, row, 0, width / 2,
+				layout))
+			break;
+	}
+}
+
+
+yuv_matrix
+yuv_matrix_from_uvc(uint8 matrixCoefficients)
+{
+	// 1 is BT.709 and 5 (SMPTE 240M) is near enough to it; 0
+	// (unspecified), FCC and the BT.601 variants take the UVC default
+	switch (matrixCoefficients) {
+		case 1:
+		case 5:
+			return YUV_MATRIX_BT709;
+		default:
+			return YUV_MATRIX_BT601;
+	}
+}
+
+
+const char*
+yuv_matrix_name(yuv_matrix matrix)
+{
+	return matrix == YUV_MATRIX_BT709 ? "BT.709" : "BT.601";
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * YUV 4:2:2 to RGB row converters with runtime CPU dispatch.
+ */
+#ifndef _UVC_COLOR_CONVERT_H
+#define _UVC_COLOR_CONVERT_H
+
+
+#include <GraphicsDefs.h>
+#include <SupportDefs.h>
+
+
+// =============================================================================
+// YUV to RGB Lookup Tables for Optimized Color Conversion
+// =============================================================================
+// Pre-computed tables eliminate per-pixel multiplications and clipping.
+// Total memory: ~5KB for all tables combined.
+
+struct yuv_rgb_lookup_tables {
+	// Y contribution to R,G,B (same value for all three)
+	// y_table[i] = 298 * (i - 16) [unshifted, combined with U/V before shift]
+	// Note: Uses int32 because max value (298*219=65262) exceeds int16 range
+	int32	y_table[256];
+
+	// U contribution to B: u_b_table[i] = 516 * (i - 128)
+	int32	u_b_table[256];
+
+	// U contribution to G: u_g_table[i] = -100 * (i - 128)
+	int32	u_g_table[256];
+
+	// V contribution to R: v_r_table[i] = 409 * (i - 128)
+	int32	v_r_table[256];
+
+	// V contribution to G: v_g_table[i] = -208 * (i - 128)
+	int32	v_g_table[256];
+
+	bool	initialized;
+
+	yuv_rgb_lookup_tables() : initialized(false) {}
+
+	void Initialize();
+};
+
+// Global lookup tables (shared across all instances)
+extern yuv_rgb_lookup_tables gYuvRgbTables;
+
+
+// =============================================================================
+// YUY2 -> RGB32 Row Kernels
+// =============================================================================
+// Every kernel converts 'pairs' YUY2 macro-pixels (Y0 U Y1 V, 4 bytes) into
+// 2 * pairs BGRA pixels. The SIMD kernels use the same fixed-point BT.601
+// math as the table path and must produce bit-identical output; the table
+// kernel is the fallback and the reference.
+
+typedef void (*yuy2_rgb32_row_func)(uint8* dst, const uint8* src,
+	int32 pairs);
+
+struct yuy2_rgb32_kernel {
+	const char*			name;
+	yuy2_rgb32_row_func	convert;
+};
+
+// Table based scalar kernel, always available
+void	yuy2_to_rgb32_row_scalar(uint8* dst, const uint8* src, int32 pairs);
+
+// Fastest kernel on the running CPU, as yuv422_rgb_best_kernel() picks it
+const yuy2_rgb32_kernel*	yuy2_rgb32_best_kernel();
+
+// All kernels usable on the running CPU, scalar first (for tests/benchmarks)
+int32	yuy2_rgb32_available_kernels(const yuy2_rgb32_kernel** kernels,
+			int32 maxKernels);
+
+// Converts a width x height frame row by row; rows past the end of a short
+// source are left alone
+void	yuy2_to_rgb32_frame(const yuy2_rgb32_kernel* kernel, uint8* dst,
+			const uint8* src, size_t srcSize, int32 width, int32 height);
+
+
+// =============================================================================
+// YUV 4:2:2 -> RGB Kernels per Stream and Output Format
+// =============================================================================
+// One kernel per source layout, matrix, range and destination, specialized
+// at compile time so the inner loops carry no per-pixel format decisions.
+// The YUYV, BT.601 limited, B_RGB32 kernels are the yuy2_rgb32 ones above.
+// Every ISA's kernel matches the scalar one of its format bit for bit.
+
+enum yuv422_layout {
+	YUV422_YUYV = 0,			// Y0 U Y1 V (YUY2)
+	YUV422_UYVY					// U Y0 V Y1
+};
+
+enum yuv_matrix {
+	YUV_MATRIX_BT601 = 0,		// SMPTE 170M, BT.470-2, the UVC default
+	YUV_MATRIX_BT709
+};
+
+enum yuv_range {
+	YUV_RANGE_LIMITED = 0,		// Y 16..235, C 16..240
+	YUV_RANGE_FULL				// 0..255
+};
+
+struct yuv422_format {
+	yuv422_layout	layout;
+	yuv_matrix		matrix;
+	yuv_range		range;
+	color_space		destination;	// B_RGB32, B_RGB24 or B_RGB16
+};
+
+typedef yuy2_rgb32_row_func yuv422_rgb_row_func;
+
+struct yuv422_rgb_kernel {
+	const char*			name;		// ISA
+	yuv422_rgb_row_func	convert;	// 'pairs' macro-pixels per call
+	color_space			destination;
+	uint32				bytes_per_pixel;
+};
+
+// Whether there are kernels writing 'destination' at all
+bool	yuv422_rgb_supports(color_space destination);
+
+// All kernels for 'format' usable on the running CPU, scalar first; 0 if
+// the destination is not supported
+int32	yuv422_rgb_available_kernels(const yuv422_format& format,
+			yuv422_rgb_kernel* kernels, int32 maxKernels);
+
+// Fastest correct one of them, measured on the first call for a format
+// (see Kernel Selection in UVCColorConvert.cpp), or the one named by
+// WEBCAM_CONVERT_KERNEL; false if there is none
+bool	yuv422_rgb_best_kernel(const yuv422_format& format,
+			yuv422_rgb_kernel* kernel);
+
+// Converts a width x height frame row by row like yuy2_to_rgb32_frame()
+void	yuv422_to_rgb_frame(const yuv422_rgb_kernel& kernel, uint8* dst,
+			const uint8* src, size_t srcSize, int32 width, int32 height);
+
+// Only the pixels of 'region' (inclusive, left rounded down to a whole
+// macro-pixel), into the same place of the width x height frame; the rest
+// of dst is left alone
+void	yuv422_to_rgb_region(const yuv422_rgb_kernel& kernel, uint8* dst,
+			const uint8* src, size_t srcSize, int32 width, int32 height,
+			const clipping_rect& region);
+
+// NV12 (a Y plane, then one interleaved U V plane at half height) through a
+// YUYV kernel: each chroma row is woven into the two luma rows it belongs
+// to a few hundred pixels at a time, so the YUYV copy stays in L1. Rows
+// past the end of a short source are left alone.
+void	nv12_to_rgb_frame(const yuv422_rgb_kernel& kernel, uint8* dst,
+			const uint8* src, size_t srcSize, int32 width, int32 height);
+void	nv12_to_rgb_region(const yuv422_rgb_kernel& kernel, uint8* dst,
+			const uint8* src, size_t srcSize, int32 width, int32 height,
+			const clipping_rect& region);
+
+// Box filtered downscale of a srcWidth x srcHeight YUV 4:2:2 frame in
+// 'layout', fused with the conversion: each output row is reduced a few
+// hundred pixels at a time into L1 and converted from there, so the source
+// is read once and never copied at full size. 2:1 both ways has its own
+// SIMD path. Any ratio yuv422_downscale_supported() accepts; rows past the
+// end of a short source are left alone.
+static const int32 kYUV422MaxDownscale = 8;		// per axis
+
+bool	yuv422_downscale_supported(int32 srcWidth, int32 srcHeight,
+			int32 width, int32 height);
+void	yuv422_downscale_to_rgb_frame(const yuv422_rgb_kernel& kernel,
+			yuv422_layout layout, uint8* dst, int32 width, int32 height,
+			const uint8* src, size_t srcSize, int32 srcWidth,
+			int32 srcHeight);
+void	yuv422_downscale_to_rgb_region(const yuv422_rgb_kernel& kernel,
+			yuv422_layout layout, uint8* dst, int32 width, int32 height,
+			const uint8* src, size_t srcSize, int32 srcWidth,
+			int32 srcHeight, const clipping_rect& region);
+// The same filter, staying in 'layout' (for the YUY2 passthrough)
+void	yuv422_downscale_frame(yuv422_layout layout, uint8* dst, int32 width,
+			int32 height, const uint8* src, size_t srcSize, int32 srcWidth,
+			int32 srcHeight);
+
+// Bytes of a width x height NV12 frame
+static inline size_t
+nv12_frame_size(int32 width, int32 height)
+{
+	return (size_t)width * height + (size_t)((width + 1) & ~1) * ((height + 1) / 2);
+}
+
+// bMatrixCoefficients of a VS_COLORFORMAT descriptor
+yuv_matrix	yuv_matrix_from_uvc(uint8 matrixCoefficients);
+
+const char*	yuv_matrix_name(yuv_matrix matrix);
+
+
+#endif /* _UVC_COLOR_CONVERT_H */
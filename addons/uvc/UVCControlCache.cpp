@@ -0,0 +1,228 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Processing Unit control ranges, remembered per camera model so the
+ * parameter web of a known device is built without control transfers.
+ */
+
+
+#include "UVCControlCache.h"
+
+#include <Autolock.h>
+#include <Directory.h>
+#include <File.h>
+#include <FindDirectory.h>
+#include <Message.h>
+#include <Path.h>
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "CamConfig.h"
+
+
+static const uint32 kControlCacheWhat = 'uvCC';
+
+
+UVCControlCache&
+UVCControlCache::Default()
+{
+	static UVCControlCache sCache;
+	return sCache;
+}
+
+
+UVCControlCache::UVCControlCache()
+	:
+	fLock("uvc control cache"),
+	fEnabled(true),
+	fPersistent(false),
+	fLoaded(false),
+	fDirty(false)
+{
+	const char* mode = getenv("WEBCAM_CONTROL_CACHE");
+	if (mode != NULL) {
+		fEnabled = strcmp(mode, "0") != 0 && strcmp(mode, "off") != 0;
+		fPersistent = strcmp(mode, "disk") == 0;
+	}
+}
+
+
+UVCControlCache::~UVCControlCache()
+{
+	for (int32 i = 0; i < fEntries.CountItems(); i++)
+		delete (entry*)fEntries.ItemAt(i);
+	fEntries.MakeEmpty();
+}
+
+
+bool
+UVCControlCache::Lookup(const uvc_control_model& model, uint8 selector,
+	uvc_control_range* range)
+{
+	if (!fEnabled)
+		return false;
+
+	BAutolock lock(fLock);
+	if (fPersistent && !fLoaded)
+		_Load();
+
+	entry* found = _Find(model, selector);
+	if (found == NULL)
+		return false;
+
+	*range = found->range;
+	return true;
+}
+
+
+void
+UVCControlCache::Store(const uvc_control_model& model, uint8 selector,
+	const uvc_control_range& range)
+{
+	if (!fEnabled)
+		return;
+
+	BAutolock lock(fLock);
+	if (fPersistent && !fLoaded)
+		_Load();
+
+	entry* found = _Find(model, selector);
+	if (found == NULL) {
+		if (fEntries.CountItems() >= CamConfig::kControlCacheEntries)
+			delete (entry*)fEntries.RemoveItem((int32)0);
+		found = new(std::nothrow) entry;
+		if (found == NULL)
+			return;
+		found->model = model;
+		found->selector = selector;
+		if (!fEntries.AddItem(found)) {
+			delete found;
+			return;
+		}
+	} else if (found->range.min_value == range.min_value
+		&& found->range.max_value == range.max_value)
+		return;
+
+	found->range = range;
+	fDirty = true;
+}
+
+
+void
+UVCControlCache::Flush()
+{
+	BAutolock lock(fLock);
+	if (fPersistent && fDirty)
+		_Save();
+	fDirty = false;
+}
+
+
+UVCControlCache::entry*
+UVCControlCache::_Find(const uvc_control_model& model, uint8 selector)
+{
+	for (int32 i = 0; i < fEntries.CountItems(); i++) {
+		entry* candidate = (entry*)fEntries.ItemAt(i);
+		if (candidate->selector == selector && candidate->model == model)
+			return candidate;
+	}
+	return NULL;
+}
+
+
+// Settings file: one flattened BMessage, entries as parallel arrays
+static status_t
+control_cache_path(BPath& path)
+{
+	status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+	if (status != B_OK)
+		return status;
+	return path.Append(CamConfig::kControlCacheFile);
+}
+
+
+void
+UVCControlCache::_Load()
+{
+	fLoaded = true;
+
+	BPath path;
+	if (control_cache_path(path) != B_OK)
+		return;
+
+	BFile file(path.Path(), B_READ_ONLY);
+	BMessage archive;
+	if (file.InitCheck() != B_OK || archive.Unflatten(&file) != B_OK
+		|| archive.what != kControlCacheWhat)
+		return;
+
+	// A short or damaged entry ends the list
+	for (int32 i = 0; i < CamConfig::kControlCacheEntries; i++) {
+		int32 vendor, product, version, unit, selector, minValue, maxValue;
+		if (archive.FindInt32("vendor", i, &vendor) != B_OK
+			|| archive.FindInt32("product", i, &product) != B_OK
+			|| archive.FindInt32("version", i, &version) != B_OK
+			|| archive.FindInt32("unit", i, &unit) != B_OK
+			|| archive.FindInt32("selector", i, &selector) != B_OK
+			|| archive.FindInt32("min", i, &minValue) != B_OK
+			|| archive.FindInt32("max", i, &maxValue) != B_OK)
+			break;
+
+		entry* loaded = new(std::nothrow) entry;
+		if (loaded == NULL)
+			break;
+		loaded->model.vendor_id = (uint16)vendor;
+		loaded->model.product_id = (uint16)product;
+		loaded->model.device_version = (uint16)version;
+		loaded->model.unit_id = (uint8)unit;
+		loaded->selector = (uint8)selector;
+		loaded->range.min_value = (int16)minValue;
+		loaded->range.max_value = (int16)maxValue;
+		if (!fEntries.AddItem(loaded))
+			delete loaded;
+	}
+
+	syslog(LOG_INFO, "UVCControlCache: loaded %d control ranges from %s\n",
+		(int)fEntries.CountItems(), path.Path());
+}
+
+
+void
+UVCControlCache::_Save()
+{
+	BPath path;
+	if (control_cache_path(path) != B_OK)
+		return;
+
+	BMessage archive(kControlCacheWhat);
+	for (int32 i = 0; i < fEntries.CountItems(); i++) {
+		const entry* saved = (const entry*)fEntries.ItemAt(i);
+		archive.AddInt32("vendor", saved->model.vendor_id);
+		archive.AddInt32("product", saved->model.product_id);
+		archive.AddInt32("version", saved->model.device_version);
+		archive.AddInt32("unit", saved->model.unit_id);
+		archive.AddInt32("selector", saved->selector);
+		archive.AddInt32("min", saved->range.min_value);
+		archive.AddInt32("max", saved->range.max_value);
+	}
+
+	BPath parent;
+	if (path.GetParent(&parent) == B_OK)
+		create_directory(parent.Path(), 0755);
+
+	BFile file(path.Path(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+	status_t status = file.InitCheck();
+	if (status == B_OK)
+		status = archive.Flatten(&file);
+	if (status != B_OK) {
+		static int32 sSaveFailuresLogged = 0;
+		if (atomic_add(&sSaveFailuresLogged, 1) < 1) {
+			syslog(LOG_WARNING, "UVCControlCache: cannot write %s: %s\n",
+				path.Path(), strerror(status));
+		}
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Processing Unit control ranges, remembered per camera model so the
+ * parameter web of a known device is built without control transfers.
+ */
+#ifndef _UVC_CONTROL_CACHE_H
+#define _UVC_CONTROL_CACHE_H
+
+
+#include <List.h>
+#include <Locker.h>
+
+
+// =============================================================================
+// Control Range Cache
+// =============================================================================
+// GET_MIN/GET_MAX answers do not change for a model and firmware, unlike
+// current values (which are read when a parameter is first asked for).
+// Entries live for the add-on's lifetime, which covers hot-plug; with
+// WEBCAM_CONTROL_CACHE=disk they are kept in the user settings directory,
+// which also covers media_addon_server restarts. =off disables the cache.
+
+struct uvc_control_model {
+	uint16			vendor_id;
+	uint16			product_id;
+	uint16			device_version;		// bcdDevice
+	uint8			unit_id;
+
+	bool operator==(const uvc_control_model& other) const {
+		return vendor_id == other.vendor_id
+			&& product_id == other.product_id
+			&& device_version == other.device_version
+			&& unit_id == other.unit_id;
+	}
+};
+
+struct uvc_control_range {
+	int16			min_value;
+	int16			max_value;
+};
+
+
+class UVCControlCache {
+public:
+	static	UVCControlCache&	Default();
+
+			bool				Enabled() const { return fEnabled; }
+
+			bool				Lookup(const uvc_control_model& model,
+									uint8 selector, uvc_control_range* range);
+			void				Store(const uvc_control_model& model,
+									uint8 selector,
+									const uvc_control_range& range);
+								// Writes new entries to disk, if persistent
+			void				Flush();
+
+private:
+	struct entry {
+		uvc_control_model	model;
+		uint8				selector;
+		uvc_control_range	range;
+	};
+
+								UVCControlCache();
+								~UVCControlCache();
+
+			entry*				_Find(const uvc_control_model& model,
+									uint8 selector);
+			void				_Load();
+			void				_Save();
+
+			BLocker				fLock;
+			BList				fEntries;		// entry*, oldest first
+			bool				fEnabled;
+			bool				fPersistent;
+			bool				fLoaded;
+			bool				fDirty;
+};
+
+
+#endif /* _UVC_CONTROL_CACHE_H */
@@ -10,6 +10,8 @@
 #include "CamDevice.h"
 
 #include <Autolock.h>
+#include <new>
+#include <string.h>
 #include <syslog.h>
 
 #define MAX_TAG_LEN CAMDEFRAMER_MAX_TAG_LEN
@@ -21,34 +23,37 @@ UVCDeframer::UVCDeframer(CamDevice* device)
 	fFrameCount(0),
 	fID(0),
 	fExpectedFrameSize(0),
-	fFixedBuffer(NULL),
-	fFixedBufferSize(0),
-	fFixedBufferPos(0),
 	fFramesCompleted(0),
 	fFramesIncomplete(0),
 	fFIDChanges(0),
 	fQueueOverflows(0),
 	fPacketsThisFrame(0),
 	fTotalBytesThisFrame(0),
-	fLastDiagReport(0)
+	fLastDiagReport(0),
+	fFrameBad(false),
+	fFrameBadReason(NULL),
+	fFramesDiscarded(0),
+	fPayloadLost(false),
+	fSawEOF(false),
+	fFramePTS(0),
+	fHaveFramePTS(false),
+	fFrameClockSampled(false),
+	fBulkPayloadSize(0),
+	fBulkPayloadPos(0),
+	fStill(NULL),
+	fStillDone(NULL),
+	fExpectStill(0),
+	fStillSem(create_sem(0, "UVC still")),
+	fStillLock("UVC still lock")
 {
-	// Allocate fixed buffer for YUY2 frames (max 1920x1080x2 = 4MB)
-	fFixedBufferSize = 4 * 1024 * 1024;
-	fFixedBuffer = (uint8*)malloc(fFixedBufferSize);
-	if (fFixedBuffer) {
-		syslog(LOG_INFO, "UVCDeframer: Allocated %zu byte fixed buffer\n", fFixedBufferSize);
-	} else {
-		syslog(LOG_ERR, "UVCDeframer: Failed to allocate fixed buffer!\n");
-	}
 }
 
 
 UVCDeframer::~UVCDeframer()
 {
-	if (fFixedBuffer) {
-		free(fFixedBuffer);
-		fFixedBuffer = NULL;
-	}
+	delete_sem(fStillSem);
+	delete fStill;
+	delete fStillDone;
 }
 
 
@@ -60,6 +65,7 @@ UVCDeframer::GetStats() const
 	stats.frames_incomplete = fFramesIncomplete;
 	stats.fid_changes = fFIDChanges;
 	stats.queue_overflows = fQueueOverflows;
+	stats.frames_discarded = fFramesDiscarded;
 	stats.last_report_time = fLastDiagReport;
 	stats.expected_frame_size = fExpectedFrameSize;
 	return stats;
@@ -73,6 +79,7 @@ UVCDeframer::ResetStats()
 	fFramesIncomplete = 0;
 	fFIDChanges = 0;
 	fQueueOverflows = 0;
+	fFramesDiscarded = 0;
 	fLastDiagReport = system_time();
 }
 
@@ -81,28 +88,59 @@ void
 UVCDeframer::SetExpectedFrameSize(size_t size)
 {
 	fExpectedFrameSize = size;
+
+	// Grow the frame being assembled now, so the first frame at a new
+	// resolution does not reallocate while packets are arriving
+	if (fCurrentFrame != NULL && size > 0)
+		fCurrentFrame->Reserve(size);
+
 	syslog(LOG_INFO, "UVCDeframer: SetExpectedFrameSize(%zu) this=%p fFrameSem=%d\n",
 		size, (void*)this, fFrameSem);
 }
 
 
+void
+UVCDeframer::SetClockFrequency(uint32 hz)
+{
+	fClock.SetFrequency(hz);
+	fHaveFramePTS = false;
+	fFrameClockSampled = false;
+}
+
+
+/* Replace the allocation time stamp with the capture time the device
+ * reported, once the clock mapping has settled. */
+void
+UVCDeframer::_StampFrame(CamFrame* frame)
+{
+	bigtime_t captureTime;
+	if (fHaveFramePTS && fClock.DeviceToSystem(fFramePTS, &captureTime))
+		frame->fStamp = captureTime;
+
+	fHaveFramePTS = false;
+	fFrameClockSampled = false;
+}
+
+
 status_t
 UVCDeframer::Flush()
 {
 	// First call base class to clear queued frames
 	status_t err = CamDeframer::Flush();
 
-	// Also clear our local input buffer
-	fInputBuffer.Seek(0, SEEK_SET);
-	fInputBuffer.SetSize(0);
-	fFixedBufferPos = 0;  // Reset fixed buffer too
-
 	// Reset UVC-specific state
 	fID = 0;
 	fPacketsThisFrame = 0;
+	fHaveFramePTS = false;
+	fFrameClockSampled = false;
+	fBulkPayloadPos = 0;
+	fFrameBad = false;
+	fPayloadLost = false;
+	fSawEOF = false;
 
-	syslog(LOG_INFO, "UVCDeframer: Flush complete (completed=%d, incomplete=%d)\n",
-		(int)fFramesCompleted, (int)fFramesIncomplete);
+	syslog(LOG_INFO, "UVCDeframer: Flush complete (completed=%d, incomplete=%d, "
+		"discarded=%d)\n", (int)fFramesCompleted, (int)fFramesIncomplete,
+		(int)fFramesDiscarded);
 
 	return err;
 }
@@ -111,11 +149,166 @@ UVCDeframer::Flush()
 ssize_t
 UVCDeframer::Write(const void* buffer, size_t size)
 {
-	const uint8* buf = (const uint8*)buffer;
+	ssize_t result = _WritePayload((const uint8*)buffer, size);
+	_IndexCurrentFrame();
+	_ReportStats();
+	return result;
+}
 
-	// Track packets for this frame
-	fPacketsThisFrame++;
 
+/* The whole transfer in one pass: per transfer work (marker indexing, the
+ * statistics report) is done once instead of per packet. */
+int32
+UVCDeframer::WritePackets(const uint8* buffer, size_t slotSize,
+	const usb_iso_packet_descriptor* packets, int32 packetCount)
+{
+	int32 written = 0;
+	for (int32 i = 0; i < packetCount; i++) {
+		size_t length = packets[i].actual_length;
+		if (packets[i].status != B_OK || length > slotSize) {
+			// Whichever frame the next payload belongs to has a hole
+			fPayloadLost = true;
+			continue;
+		}
+		if (length == 0)
+			continue;
+		_WritePayload(buffer + i * slotSize, length);
+		written++;
+	}
+	_IndexCurrentFrame();
+	_ReportStats();
+	return written;
+}
+
+
+void
+UVCDeframer::SetBulkPayloadSize(size_t size)
+{
+	fBulkPayloadSize = size;
+	fBulkPayloadPos = 0;
+}
+
+
+/* A bulk transfer: one header per payload, and a payload runs for
+ * dwMaxPayloadTransferSize bytes or until a short transfer ends it, so it
+ * can start in one transfer and end in the next. Every part goes in as it
+ * is, only the header is kept for the parts that follow. */
+int32
+UVCDeframer::WriteBulk(const uint8* buffer, size_t length, bool shortTransfer)
+{
+	int32 parts = 0;
+	size_t pos = 0;
+	while (pos < length) {
+		if (fBulkPayloadPos == 0 && buffer[pos] < 2) {
+			// Not a header: resynchronize with the next transfer
+			static int32 sBulkHeaderErrors = 0;
+			if (++sBulkHeaderErrors <= 5)
+				syslog(LOG_WARNING, "UVCDeframer: Invalid bulk header "
+					"hdr[0]=%d at %zu of %zu\n", buffer[pos], pos, length);
+			fPacketsThisFrame++;
+			break;
+		}
+
+		// The header, which may itself be split across transfers
+		if (fBulkPayloadPos == 0 || fBulkPayloadPos < fBulkHeader[0]) {
+			size_t headerLength = fBulkPayloadPos == 0
+				? buffer[pos] : fBulkHeader[0];
+			size_t count = headerLength - fBulkPayloadPos;
+			if (count > length - pos)
+				count = length - pos;
+			memcpy(fBulkHeader + fBulkPayloadPos, buffer + pos, count);
+			fBulkPayloadPos += count;
+			pos += count;
+			if (fBulkPayloadPos < headerLength)
+				break;
+		}
+
+		size_t count = length - pos;
+		if (fBulkPayloadSize > 0) {
+			size_t left = fBulkPayloadSize > fBulkPayloadPos
+				? fBulkPayloadSize - fBulkPayloadPos : 0;
+			if (count > left)
+				count = left;
+		}
+		fBulkPayloadPos += count;
+		bool last = fBulkPayloadSize == 0 || fBulkPayloadPos >= fBulkPayloadSize
+			|| (pos + count == length && shortTransfer);
+
+		uint8 flags = fBulkHeader[1];
+		if (!last)
+			flags &= ~0x02;
+		_AddPayload(fBulkHeader, flags, buffer + pos, count);
+		parts++;
+		pos += count;
+		if (last)
+			fBulkPayloadPos = 0;
+	}
+
+	// Without a payload size every transfer is one payload, and a short
+	// one ends whatever it cut off
+	if (shortTransfer || fBulkPayloadSize == 0)
+		fBulkPayloadPos = 0;
+
+	_IndexCurrentFrame();
+	_ReportStats();
+	return parts;
+}
+
+
+void
+UVCDeframer::_MarkFrameBad(const char* reason)
+{
+	if (fFrameBad)
+		return;
+	fFrameBad = true;
+	fFrameBadReason = reason;
+}
+
+
+/* Ends a damaged frame: what was stored is dropped and the frame is kept,
+ * emptied, for the next one, so the USB thread takes no pool lock. No
+ * frame is queued in its place. Delivery follows frame arrival, so the
+ * consumer keeps the last good picture until the next one, instead of a
+ * half-decoded or black padded frame. */
+void
+UVCDeframer::_DiscardFrame()
+{
+	fFramesDiscarded++;
+	_CountMetric(CAM_METRIC_ERROR_DROPS);
+	size_t size = fCurrentFrame != NULL ? fCurrentFrame->Position() : 0;
+	if (fFramesDiscarded <= 10 || (fFramesDiscarded % 100) == 0)
+		syslog(LOG_WARNING, "UVCDeframer: Discarded frame #%d (%s) after "
+			"%zu bytes, %d packets\n", (int)fFramesDiscarded, fFrameBadReason,
+			size, (int)fPacketsThisFrame);
+	WEBCAM_TRACE_EVENT(WEBCAM_TRACE_FRAME_DROPPED, size, fPacketsThisFrame);
+
+	if (fCurrentFrame != NULL) {
+		fCurrentFrame->Seek(0, SEEK_SET);
+		fCurrentFrame->SetSize(0);
+		fCurrentFrame->fStamp = system_time();
+	}
+	fFrameBad = false;
+	fHaveFramePTS = false;
+	fFrameClockSampled = false;
+	fPacketsThisFrame = 0;
+}
+
+
+/* MJPEG: indexes the markers that arrived since the last call, while they
+ * are still in cache, and before a frame is queued. */
+void
+UVCDeframer::_IndexCurrentFrame()
+{
+	if (fExpectedFrameSize != 0 || fCurrentFrame == NULL)
+		return;
+	cam_jpeg_index_update(&fCurrentFrame->fJpegIndex,
+		(const uint8*)fCurrentFrame->Buffer(), fCurrentFrame->BufferLength());
+}
+
+
+ssize_t
+UVCDeframer::_WritePayload(const uint8* buf, size_t size)
+{
 	// Validate buffer and header length
 	// UVC header requires at least 2 bytes: length byte + flags byte
 	if (size < 2 || buf[0] < 2 || buf[0] > size) {
@@ -124,45 +317,68 @@ UVCDeframer::Write(const void* buffer, size_t size)
 		if (++sHeaderErrors <= 5)
 			syslog(LOG_WARNING, "UVCDeframer: Invalid header size=%zu hdr[0]=%d\n",
 				size, size > 0 ? buf[0] : -1);
+		fPacketsThisFrame++;
 		return B_ERROR;
 	}
 
-	int payloadSize = size - buf[0];
+	_AddPayload(buf, buf[1], buf + buf[0], size - buf[0]);
+	return size;
+}
 
-	// Header-only packet
-	if (payloadSize == 0)
-		return size;
 
-	// Check for UVC error bit (bit 6 of header byte 1)
-	if (buf[1] & 0x40) {
-		static int32 sUvcErrors = 0;
-		if (++sUvcErrors <= 10)
-			syslog(LOG_WARNING, "UVCDeframer: UVC error bit set in header\n");
+/* One payload, or the part of it that is in this transfer: 'header' is
+ * the payload header it came with, 'flags' its flags byte, which for a
+ * bulk payload has EOF only on the last part. */
+void
+UVCDeframer::_AddPayload(const uint8* header, uint8 flags, const uint8* data,
+	size_t dataSize)
+{
+	// Track packets for this frame
+	fPacketsThisFrame++;
+
+	int payloadSize = dataSize;
+
+	// Header-only packet; it may still end a still image
+	if (payloadSize == 0) {
+		if ((flags & 0x22) == 0x22)
+			_AddStillPayload(data, 0, false, true);
+		else if ((flags & 0x40) != 0)
+			fPayloadLost = true;
+		return;
 	}
 
+	// PTS (4 bytes) and SCR (4 byte STC + 2 byte SOF) follow the flags,
+	// in that order, when their bits are set
+	bool hasPTS = (flags & 0x04) != 0;
+	bool hasSCR = (flags & 0x08) != 0;
+	int expectedHeaderLen = 2 + (hasPTS ? 4 : 0) + (hasSCR ? 6 : 0);
+	bool headerValid = header[0] >= expectedHeaderLen;
+	uint32 pts = 0;
+	if (hasPTS && headerValid)
+		pts = header[2] | (header[3] << 8) | (header[4] << 16)
+			| ((uint32)header[5] << 24);
+
 	// Debug: Log first few packets of first few frames to check header structure
 	static int32 sDebugFrames = 0;
 	static int32 sDebugPackets = 0;
 	if (sDebugFrames < 3 && sDebugPackets < 15) {
-		bool hasPTS = (buf[1] & 0x04) != 0;
-		bool hasSCR = (buf[1] & 0x08) != 0;
-		int expectedHeaderLen = 2 + (hasPTS ? 4 : 0) + (hasSCR ? 6 : 0);
-		if (buf[0] != expectedHeaderLen) {
+		if (header[0] != expectedHeaderLen) {
 			syslog(LOG_WARNING, "UVCDeframer: Header mismatch! bHeaderLength=%d expected=%d (PTS=%d SCR=%d) pkt=%zu\n",
-				buf[0], expectedHeaderLen, hasPTS ? 1 : 0, hasSCR ? 1 : 0, size);
+				header[0], expectedHeaderLen, hasPTS ? 1 : 0, hasSCR ? 1 : 0,
+				header[0] + dataSize);
 		}
 		sDebugPackets++;
 	}
 
 	// Detect FID (Frame ID) changes for BOTH YUY2 and MJPEG
 	// FID bit toggles when a new frame starts
-	bool eof = (buf[1] & 0x02) != 0;
-	bool fidChanged = (buf[1] & 0x01) != fID;
+	bool eof = (flags & 0x02) != 0;
+	bool fidChanged = (flags & 0x01) != fID;
 
 	// If FID changed, this is start of a NEW frame
 	if (fidChanged) {
 		fFIDChanges++;
-		fID = buf[1] & 0x01;
+		fID = flags & 0x01;
 
 		// Log previous frame's total bytes (before reset)
 		static int32 sBytesLog = 0;
@@ -172,98 +388,119 @@ UVCDeframer::Write(const void* buffer, size_t size)
 				(int)((ssize_t)fTotalBytesThisFrame - (ssize_t)fExpectedFrameSize));
 		}
 
-		// Track debug frames and dump first packet header
-		if (sDebugFrames < 3) {
+		if (sDebugFrames < 3)
 			sDebugFrames++;
-			syslog(LOG_INFO, "UVCDeframer: New frame #%d started (FID=%d pkts=%d bufSize=%zu)\n",
-				(int)sDebugFrames, fID, (int)fPacketsThisFrame, fFixedBufferPos);
-			// Dump first 16 bytes of this packet (header + start of payload)
-			char hexbuf[80];
-			int dumpLen = (size < 16) ? size : 16;
-			snprintf(hexbuf, sizeof(hexbuf),
-				"First pkt header[%d]: %02x %02x %02x %02x %02x %02x %02x %02x "
-				"%02x %02x %02x %02x %02x %02x %02x %02x",
-				(int)size,
-				dumpLen > 0 ? buf[0] : 0, dumpLen > 1 ? buf[1] : 0,
-				dumpLen > 2 ? buf[2] : 0, dumpLen > 3 ? buf[3] : 0,
-				dumpLen > 4 ? buf[4] : 0, dumpLen > 5 ? buf[5] : 0,
-				dumpLen > 6 ? buf[6] : 0, dumpLen > 7 ? buf[7] : 0,
-				dumpLen > 8 ? buf[8] : 0, dumpLen > 9 ? buf[9] : 0,
-				dumpLen > 10 ? buf[10] : 0, dumpLen > 11 ? buf[11] : 0,
-				dumpLen > 12 ? buf[12] : 0, dumpLen > 13 ? buf[13] : 0,
-				dumpLen > 14 ? buf[14] : 0, dumpLen > 15 ? buf[15] : 0);
-			syslog(LOG_INFO, "UVCDeframer: %s\n", hexbuf);
-		}
+
+		// A frame still open here did not end by EOF or size: a payload
+		// lost since belonged to it, and with a camera that sets EOF, that
+		// payload was its last one
+		bool open = fCurrentFrame != NULL && fCurrentFrame->Position() > 0;
+		if (open && fPayloadLost) {
+			_MarkFrameBad("payload lost");
+			fPayloadLost = false;
+		} else if (open && fExpectedFrameSize == 0 && fSawEOF)
+			_MarkFrameBad("FID gap");
 
 		// For YUY2: discard incomplete previous frame data and start fresh
 		// For MJPEG: complete previous frame if we have data
-		if (fExpectedFrameSize == 0 && fInputBuffer.BufferLength() > 0) {
-			// MJPEG: complete previous frame
-			BAutolock l(fLocker);
-			int32 queueCount = fFrames.CountItems();
-
-			if (queueCount >= MAXFRAMEBUF) {
-				fQueueOverflows++;
-				if (fQueueOverflows <= 10 || (fQueueOverflows % 100) == 0)
-					syslog(LOG_WARNING, "UVCDeframer: Queue overflow #%d (MAXFRAMEBUF=%d)\n",
-						(int)fQueueOverflows, MAXFRAMEBUF);
+		// The payload is assembled in place in fCurrentFrame, so completing
+		// hands the frame itself to the queue instead of copying it.
+		if (fFrameBad)
+			_DiscardFrame();
+		else if (open) {
+			if (fExpectedFrameSize == 0) {
+				_IndexCurrentFrame();
+				_StampFrame(fCurrentFrame);
 			}
-
-			if (fCurrentFrame == NULL && queueCount < MAXFRAMEBUF)
-				fCurrentFrame = AllocFrame();
-
-			if (fCurrentFrame != NULL) {
-				const uint8* frameData = (const uint8*)fInputBuffer.Buffer();
-				size_t frameSize = fInputBuffer.BufferLength();
-
+			if (fExpectedFrameSize == 0 && QueueFrame(fCurrentFrame)) {
+				// MJPEG: complete previous frame
+				WEBCAM_TRACE_EVENT(WEBCAM_TRACE_FRAME_COMPLETE,
+					fCurrentFrame->Position(), fPacketsThisFrame - 1);
 				fFrameCount++;
 				fFramesCompleted++;
-
-				if (frameData != NULL && frameSize > 0)
-					fCurrentFrame->Write(frameData, frameSize);
-
-				fFrames.AddItem(fCurrentFrame);
-				release_sem(fFrameSem);
 				fCurrentFrame = NULL;
+			} else {
+				WEBCAM_TRACE_EVENT(WEBCAM_TRACE_FRAME_DROPPED,
+					fCurrentFrame->Position(), fPacketsThisFrame - 1);
+				if (fExpectedFrameSize == 0) {
+					fQueueOverflows++;
+					if (fQueueOverflows <= 10 || (fQueueOverflows % 100) == 0)
+						syslog(LOG_WARNING, "UVCDeframer: Queue overflow #%d (MAXFRAMEBUF=%d)\n",
+							(int)fQueueOverflows, MAXFRAMEBUF);
+				}
+				// Reuse the frame (and its storage) for the new one
+				fCurrentFrame->Seek(0, SEEK_SET);
+				fCurrentFrame->SetSize(0);
+				fCurrentFrame->fStamp = system_time();
 			}
 		}
+		fHaveFramePTS = false;
+		fFrameClockSampled = false;
 
-		// Reset buffer for new frame (both YUY2 and MJPEG)
-		fInputBuffer.Seek(0, SEEK_SET);
-		fInputBuffer.SetSize(0);
-		fFixedBufferPos = 0;  // Also reset fixed buffer
 		fPacketsThisFrame = 1;
 		fTotalBytesThisFrame = 0;  // Reset byte counter for new frame
 	}
 
+	// STI: a still image, in its own size, sent between two video frames
+	if ((flags & 0x20) != 0) {
+		_AddStillPayload(data, payloadSize, fidChanged, eof);
+		return;
+	}
+
+	// Damaged frames are found from the header alone: past the error bit
+	// or a lost payload, nothing more of the frame is stored
+	if ((flags & 0x40) != 0)
+		_MarkFrameBad("error bit");
+	else if (fPayloadLost)
+		_MarkFrameBad("payload lost");
+	fPayloadLost = false;
+	if (fFrameBad) {
+		if (eof)
+			_DiscardFrame();
+		return;
+	}
+
 	// Allocate frame if needed
 	if (fCurrentFrame == NULL) {
-		BAutolock l(fLocker);
-		if (fFrames.CountItems() < MAXFRAMEBUF)
+		if (QueuedFrames() < MAXFRAMEBUF)
 			fCurrentFrame = AllocFrame();
 		else {
 			fQueueOverflows++;
-			return size;  // Drop - queue full
+			return;  // Drop - queue full
 		}
+		if (fCurrentFrame == NULL) {
+			// Every arena frame is queued or being decoded
+			fQueueOverflows++;
+			return;
+		}
+		if (fExpectedFrameSize > 0)
+			fCurrentFrame->Reserve(fExpectedFrameSize);
+	}
+
+	// Every packet of a frame carries the same PTS; keep the first
+	if (hasPTS && headerValid && !fHaveFramePTS) {
+		fFramePTS = pts;
+		fHaveFramePTS = true;
+	}
+
+	// One clock sample per frame is plenty for the fit and keeps the
+	// per-packet cost to the flag test
+	if (hasSCR && headerValid && !fFrameClockSampled) {
+		const uint8* scr = &header[hasPTS ? 6 : 2];
+		fClock.AddSample(scr[0] | (scr[1] << 8) | (scr[2] << 16)
+			| ((uint32)scr[3] << 24), system_time());
+		fFrameClockSampled = true;
 	}
 
 	// Track total payload bytes received (before truncation)
 	fTotalBytesThisFrame += payloadSize;
 
-	// Log packet details for first frame to analyze assembly
-	static int32 sPacketLog = 0;
-	static size_t sRunningOffset = 0;
-	if (sPacketLog < 50) {  // Log first 50 packets
-		syslog(LOG_INFO, "PKT#%d: hdr=%d payload=%d offset=%zu total=%zu\n",
-			(int)sPacketLog, buf[0], payloadSize, sRunningOffset, fTotalBytesThisFrame);
-		sPacketLog++;
-	}
-	sRunningOffset += payloadSize;
+	WEBCAM_TRACE_EVENT(WEBCAM_TRACE_PACKET, payloadSize, flags);
 
 	// For YUY2 (fixed size), truncate payload if it would exceed expected size
 	size_t bytesToWrite = payloadSize;
 	if (fExpectedFrameSize > 0) {
-		size_t currentSize = fFixedBufferPos;  // Use fixed buffer position
+		size_t currentSize = fCurrentFrame->Position();
 		size_t spaceLeft = (currentSize < fExpectedFrameSize)
 			? (fExpectedFrameSize - currentSize) : 0;
 		if (bytesToWrite > spaceLeft) {
@@ -276,30 +513,20 @@ UVCDeframer::Write(const void* buffer, size_t size)
 		}
 	}
 
-	// Write payload to FIXED BUFFER (bypassing BMallocIO to test if it's causing corruption)
-	if (bytesToWrite > 0 && fFixedBuffer != NULL) {
-		// Direct memcpy to fixed buffer - no BMallocIO involved
-		if (fFixedBufferPos + bytesToWrite <= fFixedBufferSize) {
-			memcpy(fFixedBuffer + fFixedBufferPos, &buf[buf[0]], bytesToWrite);
-
-			// Debug: Log first few writes
-			static int32 sWriteDebug = 0;
-			if (++sWriteDebug <= 10) {
-				syslog(LOG_INFO, "FixedBuf Write #%d: pos %zu->%zu, bytes=%zu, first4=[%02x %02x %02x %02x]\n",
-					(int)sWriteDebug, fFixedBufferPos, fFixedBufferPos + bytesToWrite, bytesToWrite,
-					buf[buf[0]], buf[buf[0]+1], buf[buf[0]+2], buf[buf[0]+3]);
-			}
-
-			fFixedBufferPos += bytesToWrite;
-		} else {
-			syslog(LOG_ERR, "UVCDeframer: Fixed buffer overflow! pos=%zu + write=%zu > size=%zu\n",
-				fFixedBufferPos, bytesToWrite, fFixedBufferSize);
+	// Write payload straight into the pooled frame - this is the only copy
+	// between the USB transfer buffer and the frame queue
+	if (bytesToWrite > 0) {
+		size_t pos = fCurrentFrame->Position();
+		ssize_t written = fCurrentFrame->Write(data, bytesToWrite);
+		if (written < (ssize_t)bytesToWrite) {
+			syslog(LOG_ERR, "UVCDeframer: Frame write failed at pos=%zu (%zu bytes): %s\n",
+				pos, bytesToWrite, strerror(written < 0 ? written : B_NO_MEMORY));
 		}
 	}
 
 	// Determine if frame is complete
 	bool frameComplete = false;
-	size_t currentSize = fFixedBufferPos;  // Use fixed buffer position
+	size_t currentSize = fCurrentFrame->Position();
 
 	// Size-based detection (for YUY2)
 	if (fExpectedFrameSize > 0) {
@@ -319,7 +546,7 @@ UVCDeframer::Write(const void* buffer, size_t size)
 		// If EOF arrives before expected size, pad with zeros to maintain
 		// correct row alignment.
 		if (eof) {
-			if (currentSize < fExpectedFrameSize && fFixedBuffer != NULL) {
+			if (currentSize < fExpectedFrameSize) {
 				// Pad incomplete frame with zeros (black in YUY2: Y=0, U=128, V=128)
 				// Pattern: 0x00 0x80 0x00 0x80 for black pixels
 				size_t paddingNeeded = fExpectedFrameSize - currentSize;
@@ -328,20 +555,27 @@ UVCDeframer::Write(const void* buffer, size_t size)
 					syslog(LOG_INFO, "UVCDeframer: Padding YUY2 frame with %zu bytes (%.1f%% complete)\n",
 						paddingNeeded, 100.0f * currentSize / fExpectedFrameSize);
 				}
-				// Write padding pattern directly to fixed buffer
-				uint8 padPattern[4] = {0x00, 0x80, 0x00, 0x80};  // Y U Y V for 2 black pixels
-				while (fFixedBufferPos < fExpectedFrameSize) {
-					size_t remaining = fExpectedFrameSize - fFixedBufferPos;
-					size_t toWrite = (remaining < 4) ? remaining : 4;
-					memcpy(fFixedBuffer + fFixedBufferPos, padPattern, toWrite);
-					fFixedBufferPos += toWrite;
+				// Write padding pattern into the frame in blocks
+				// Pattern: Y U Y V for 2 black pixels, repeated
+				uint8 padBlock[256];
+				for (size_t i = 0; i < sizeof(padBlock); i += 4) {
+					padBlock[i] = 0x00;
+					padBlock[i + 1] = 0x80;
+					padBlock[i + 2] = 0x00;
+					padBlock[i + 3] = 0x80;
+				}
+				while ((size_t)fCurrentFrame->Position() < fExpectedFrameSize) {
+					size_t remaining = fExpectedFrameSize - fCurrentFrame->Position();
+					size_t toWrite = (remaining < sizeof(padBlock)) ? remaining : sizeof(padBlock);
+					if (fCurrentFrame->Write(padBlock, toWrite) < (ssize_t)toWrite)
+						break;
 				}
 			}
 			frameComplete = true;
 			static int32 sEofComplete = 0;
 			if (++sEofComplete <= 5)
 				syslog(LOG_INFO, "UVCDeframer: YUY2 frame complete by EOF! size=%zu expected=%zu\n",
-					fFixedBufferPos, fExpectedFrameSize);
+					(size_t)fCurrentFrame->Position(), fExpectedFrameSize);
 		} else if (currentSize >= fExpectedFrameSize) {
 			frameComplete = true;
 			// Log first few frame completions
@@ -355,6 +589,7 @@ UVCDeframer::Write(const void* buffer, size_t size)
 	// Don't complete if we just processed a FID change (frame was already completed above)
 	else if (eof && !fidChanged) {
 		frameComplete = true;
+		fSawEOF = true;
 	}
 
 	// Complete frame - add to queue
@@ -362,55 +597,8 @@ UVCDeframer::Write(const void* buffer, size_t size)
 		fFrameCount++;
 		fFramesCompleted++;
 
-		// Use fixed buffer for YUY2, BMallocIO for MJPEG
-		const uint8* frameData;
-		size_t frameSize;
-		if (fExpectedFrameSize > 0 && fFixedBuffer != NULL) {
-			// YUY2: read from fixed buffer
-			frameData = fFixedBuffer;
-			frameSize = fFixedBufferPos;
-		} else {
-			// MJPEG: read from BMallocIO (backwards compat)
-			frameData = (const uint8*)fInputBuffer.Buffer();
-			frameSize = fInputBuffer.BufferLength();
-		}
-
-		// Debug: dump first frame to file for analysis
-		static int32 sDumpCount = 0;
-		if (++sDumpCount == 1 && frameData != NULL && frameSize > 0) {
-			// Save raw YUY2 frame to file
-			FILE* f = fopen("/boot/home/Desktop/frame_dump.yuv", "wb");
-			if (f) {
-				fwrite(frameData, 1, frameSize, f);
-				fclose(f);
-				syslog(LOG_INFO, "UVCDeframer: Saved frame to /boot/home/Desktop/frame_dump.yuv (%zu bytes) [FixedBuffer]\n", frameSize);
-			}
-			// Also log first 64 bytes
-			char hexbuf[256];
-			snprintf(hexbuf, sizeof(hexbuf),
-				"Frame first 64 bytes:\n"
-				"%02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n"
-				"%02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n"
-				"%02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n"
-				"%02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
-				frameData[0], frameData[1], frameData[2], frameData[3],
-				frameData[4], frameData[5], frameData[6], frameData[7],
-				frameData[8], frameData[9], frameData[10], frameData[11],
-				frameData[12], frameData[13], frameData[14], frameData[15],
-				frameData[16], frameData[17], frameData[18], frameData[19],
-				frameData[20], frameData[21], frameData[22], frameData[23],
-				frameData[24], frameData[25], frameData[26], frameData[27],
-				frameData[28], frameData[29], frameData[30], frameData[31],
-				frameData[32], frameData[33], frameData[34], frameData[35],
-				frameData[36], frameData[37], frameData[38], frameData[39],
-				frameData[40], frameData[41], frameData[42], frameData[43],
-				frameData[44], frameData[45], frameData[46], frameData[47],
-				frameData[48], frameData[49], frameData[50], frameData[51],
-				frameData[52], frameData[53], frameData[54], frameData[55],
-				frameData[56], frameData[57], frameData[58], frameData[59],
-				frameData[60], frameData[61], frameData[62], frameData[63]);
-			syslog(LOG_INFO, "UVCDeframer: %s\n", hexbuf);
-		}
+		// Both YUY2 and MJPEG are already assembled in fCurrentFrame
+		size_t frameSize = fCurrentFrame->BufferLength();
 
 		// Validate YUY2 frame completeness
 		if (fExpectedFrameSize > 0 && frameSize < fExpectedFrameSize) {
@@ -421,20 +609,105 @@ UVCDeframer::Write(const void* buffer, size_t size)
 					100.0f * frameSize / fExpectedFrameSize);
 		}
 
-		if (frameData != NULL && frameSize > 0)
-			fCurrentFrame->Write(frameData, frameSize);
-
-		fFrames.AddItem(fCurrentFrame);
-		release_sem(fFrameSem);
-		fCurrentFrame = NULL;
+		_IndexCurrentFrame();
+		_StampFrame(fCurrentFrame);
+		if (QueueFrame(fCurrentFrame)) {
+			WEBCAM_TRACE_EVENT(WEBCAM_TRACE_FRAME_COMPLETE, frameSize,
+				fPacketsThisFrame);
+			fCurrentFrame = NULL;
+		} else {
+			WEBCAM_TRACE_EVENT(WEBCAM_TRACE_FRAME_DROPPED, frameSize,
+				fPacketsThisFrame);
+			// Reader fell behind: reuse the frame rather than block
+			fQueueOverflows++;
+			fCurrentFrame->Seek(0, SEEK_SET);
+			fCurrentFrame->SetSize(0);
+		}
 
 		// Reset for next frame
-		fInputBuffer.Seek(0, SEEK_SET);
-		fInputBuffer.SetSize(0);
-		fFixedBufferPos = 0;  // Also reset fixed buffer
 		fPacketsThisFrame = 0;
 	}
+}
+
+
+void
+UVCDeframer::ExpectStill(bool expect)
+{
+	BAutolock _(fStillLock);
+	atomic_set(&fExpectStill, expect ? 1 : 0);
+	// One left from a request that timed out is not this one's
+	delete fStillDone;
+	fStillDone = NULL;
+	while (acquire_sem_etc(fStillSem, 1, B_RELATIVE_TIMEOUT, 0) == B_OK)
+		;
+}
+
+
+status_t
+UVCDeframer::WaitStill(bigtime_t timeout, CamFrame** _still)
+{
+	status_t err = acquire_sem_etc(fStillSem, 1, B_RELATIVE_TIMEOUT, timeout);
+	if (err != B_OK)
+		return err;
+
+	BAutolock _(fStillLock);
+	if (fStillDone == NULL)
+		return B_ERROR;
+	*_still = fStillDone;
+	fStillDone = NULL;
+	return B_OK;
+}
+
+
+/* A still arrives once per request, so its frame is allocated here rather
+ * than taken from the arena; it can be many times a video frame. */
+void
+UVCDeframer::_AddStillPayload(const uint8* data, size_t size, bool first,
+	bool eof)
+{
+	if (atomic_get(&fExpectStill) == 0) {
+		// From the camera's button, or after the request gave up
+		if (fStill != NULL)
+			fStill->SetSize(0);
+		return;
+	}
+
+	if (fStill == NULL) {
+		fStill = new(std::nothrow) CamFrame();
+		if (fStill == NULL)
+			return;
+	}
+	if (first || fStill->Position() == 0) {
+		fStill->Seek(0, SEEK_SET);
+		fStill->SetSize(0);
+		fStill->fStamp = system_time();
+	}
+	if (size > 0 && fStill->Write(data, size) != (ssize_t)size) {
+		syslog(LOG_WARNING, "UVCDeframer: still image dropped at %lld "
+			"bytes, out of memory\n", (long long)fStill->Position());
+		fStill->Seek(0, SEEK_SET);
+		fStill->SetSize(0);
+		return;
+	}
+	if (!eof || fStill->Position() == 0)
+		return;
+
+	BAutolock _(fStillLock);
+	if (fStillDone != NULL || atomic_get(&fExpectStill) == 0) {
+		fStill->Seek(0, SEEK_SET);
+		fStill->SetSize(0);
+		return;
+	}
+	fStillDone = fStill;
+	fStill = NULL;
+	atomic_set(&fExpectStill, 0);
+	release_sem_etc(fStillSem, 1, B_DO_NOT_RESCHEDULE);
+}
+
 
+void
+UVCDeframer::_ReportStats()
+{
 	// Periodic diagnostic report (every 30 seconds)
 	bigtime_t now = system_time();
 	if (now - fLastDiagReport > 30000000) {
@@ -442,12 +715,10 @@ UVCDeframer::Write(const void* buffer, size_t size)
 			float incompleteRate = fFramesCompleted > 0
 				? 100.0f * fFramesIncomplete / (fFramesCompleted + fFramesIncomplete)
 				: 0.0f;
-			syslog(LOG_INFO, "UVCDeframer stats: completed=%d incomplete=%d (%.1f%%) FID=%d overflow=%d\n",
+			syslog(LOG_INFO, "UVCDeframer stats: completed=%d incomplete=%d (%.1f%%) FID=%d overflow=%d discarded=%d\n",
 				(int)fFramesCompleted, (int)fFramesIncomplete, incompleteRate,
-				(int)fFIDChanges, (int)fQueueOverflows);
+				(int)fFIDChanges, (int)fQueueOverflows, (int)fFramesDiscarded);
 		}
 		fLastDiagReport = now;
 	}
-
-	return size;
 }
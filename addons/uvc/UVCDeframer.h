@@ -7,6 +7,7 @@
 
 
 #include "CamDeframer.h"
+#include "UVCClock.h"
 
 #include <USB3.h>
 
@@ -20,6 +21,7 @@ struct deframer_stats {
 	uint32		frames_incomplete;
 	uint32		fid_changes;
 	uint32		queue_overflows;
+	uint32		frames_discarded;	// damaged in transfer, never queued
 	bigtime_t	last_report_time;
 	size_t		expected_frame_size;
 
@@ -46,9 +48,30 @@ public:
 					// BPositionIO interface
 					// write from usb transfers
 	virtual ssize_t				Write(const void *buffer, size_t size);
-	virtual status_t			Flush();  // Override to also clear input buffer
+	virtual int32				WritePackets(const uint8 *buffer,
+									size_t slotSize,
+									const usb_iso_packet_descriptor *packets,
+									int32 packetCount);
+					// Bulk streaming: payloads of up to 'size' bytes that may
+					// span transfers, 0 for one payload per transfer
+			void				SetBulkPayloadSize(size_t size);
+	virtual int32				WriteBulk(const uint8 *buffer, size_t length,
+									bool shortTransfer);
+	virtual status_t			Flush();  // Override to also reset FID state
 					// Set expected frame size for frame boundary detection
 			void				SetExpectedFrameSize(size_t size);
+					// dwClockFrequency of the PTS/SCR fields, 0 if unknown
+			void				SetClockFrequency(uint32 hz);
+			uint32				ClockFrequency() const
+									{ return fClock.Frequency(); }
+
+					// Still method 2: payloads with STI set are a still
+					// image, never a video frame. They are collected while
+					// a still is expected and dropped otherwise.
+			void				ExpectStill(bool expect);
+					// The still, the caller's to delete
+			status_t			WaitStill(bigtime_t timeout,
+									CamFrame** _still);
 
 					// Statistics methods (Group 6: Deframer Optimization)
 			deframer_stats		GetStats() const;
@@ -56,17 +79,21 @@ public:
 
 private:
 	void						_PrintBuffer(const void* buffer, size_t size);
+	ssize_t						_WritePayload(const uint8* buf, size_t size);
+	void						_AddPayload(const uint8* header, uint8 flags,
+									const uint8* data, size_t dataSize);
+	void						_IndexCurrentFrame();
+	void						_MarkFrameBad(const char* reason);
+	void						_DiscardFrame();
+	void						_ReportStats();
+	void						_StampFrame(CamFrame* frame);
+	void						_AddStillPayload(const uint8* data,
+									size_t size, bool first, bool eof);
 
 	int32						fFrameCount;
 	int32						fID;
-	BMallocIO					fInputBuffer;
 	size_t						fExpectedFrameSize;  // Expected size for complete frame
 
-	// FIX: Simple fixed buffer to bypass potential BMallocIO issues
-	uint8*						fFixedBuffer;
-	size_t						fFixedBufferSize;
-	size_t						fFixedBufferPos;
-
 	// Frame quality diagnostics
 	int32						fFramesCompleted;
 	int32						fFramesIncomplete;
@@ -75,6 +102,36 @@ private:
 	int32						fPacketsThisFrame;
 	size_t						fTotalBytesThisFrame;  // Total payload bytes (including truncated)
 	bigtime_t					fLastDiagReport;
+
+	// The frame being received is damaged: its payloads are skipped and
+	// it goes back to the pool instead of the queue when it ends
+	bool						fFrameBad;
+	const char*					fFrameBadReason;
+	int32						fFramesDiscarded;
+	// A payload was lost or flagged in error before the next one showed
+	// which frame it belonged to
+	bool						fPayloadLost;
+	// The camera sets EOF, so a frame ending without it lost its tail
+	bool						fSawEOF;
+
+	// Capture timestamps from the payload header PTS/SCR
+	UVCClockRecovery			fClock;
+	uint32						fFramePTS;
+	bool						fHaveFramePTS;
+	bool						fFrameClockSampled;
+
+	// Bulk payload being taken apart, its header from the first part
+	size_t						fBulkPayloadSize;
+	size_t						fBulkPayloadPos;
+	uint8						fBulkHeader[256];
+
+	// Still image being received (USB thread), and the last one complete,
+	// until WaitStill() takes it (under fStillLock)
+	CamFrame*					fStill;
+	CamFrame*					fStillDone;
+	int32						fExpectStill;
+	sem_id						fStillSem;
+	BLocker						fStillLock;
 };
 
 #endif /* _UVC_DEFRAMER_H */
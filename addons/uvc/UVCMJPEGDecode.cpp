@@ -0,0 +1,460 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * MJPEG frame parsing and RGB and YCbCr decoding, without device state.
+ */
+
+
+#include "UVCMJPEGDecode.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Largest TurboJPEG scaling factor (n/8, at most 1) at which the JPEG fits
+ * maxWidth x maxHeight */
+static bool
+jpeg_scale_to_fit(int width, int height, int maxWidth, int maxHeight,
+	int* scaledWidth, int* scaledHeight, tjscalingfactor* scaling)
+{
+	int count = 0;
+	tjscalingfactor* factors = tjGetScalingFactors(&count);
+	if (factors == NULL)
+		return false;
+
+	bool found = false;
+	tjscalingfactor best = { 0, 1 };
+	for (int i = 0; i < count; i++) {
+		const tjscalingfactor& factor = factors[i];
+		if (factor.num > factor.denom)
+			continue;
+		if (TJSCALED(width, factor) > maxWidth
+			|| TJSCALED(height, factor) > maxHeight)
+			continue;
+		if (!found || factor.num * best.denom > best.num * factor.denom) {
+			best = factor;
+			found = true;
+		}
+	}
+
+	if (found) {
+		*scaledWidth = TJSCALED(width, best);
+		*scaledHeight = TJSCALED(height, best);
+		*scaling = best;
+	}
+	return found;
+}
+
+
+/* TJSAMP_* and TJCS_* of an indexed frame header, false for layouts
+ * TurboJPEG has to look at itself */
+static bool
+index_subsampling(const cam_jpeg_index& index, int* subsampling,
+	int* colorspace)
+{
+	if (index.components == 1) {
+		*subsampling = TJSAMP_GRAY;
+		*colorspace = TJCS_GRAY;
+		return true;
+	}
+	// Three components with full chroma sampling factors; the luma
+	// factors give the subsampling. An Adobe RGB JPEG is not something a
+	// UVC camera sends.
+	if (index.components != 3 || index.sampling[1] != 0x11
+		|| index.sampling[2] != 0x11)
+		return false;
+
+	switch (index.sampling[0]) {
+		case 0x11: *subsampling = TJSAMP_444; break;
+		case 0x21: *subsampling = TJSAMP_422; break;
+		case 0x22: *subsampling = TJSAMP_420; break;
+		case 0x12: *subsampling = TJSAMP_440; break;
+		case 0x41: *subsampling = TJSAMP_411; break;
+		default: return false;
+	}
+	*colorspace = TJCS_YCbCr;
+	return true;
+}
+
+
+mjpeg_parse_result
+mjpeg_parse_frame(tjhandle decompressor, const uint8* src, size_t srcSize,
+	int32 maxWidth, int32 maxHeight, mjpeg_frame_info* info,
+	const cam_jpeg_index* index)
+{
+	info->jpeg = src;
+	info->jpeg_size = srcSize;
+	info->width = 0;
+	info->height = 0;
+	info->subsampling = 0;
+	info->colorspace = 0;
+
+	bool parsed = false;
+	if (index != NULL && index->state != CAM_JPEG_SCAN_SOI) {
+		if (index->soi_offset == CAM_JPEG_NONE || index->soi_offset >= srcSize)
+			return MJPEG_PARSE_NO_SOI;
+		info->jpeg = src + index->soi_offset;
+		info->jpeg_size = srcSize - index->soi_offset;
+		if (index->sof_offset != CAM_JPEG_NONE && index->width > 0
+			&& index->height > 0
+			&& index_subsampling(*index, &info->subsampling,
+				&info->colorspace)) {
+			info->width = index->width;
+			info->height = index->height;
+			parsed = true;
+		}
+	} else {
+		// Find JPEG SOI marker (0xFF 0xD8) - UVC may have header before JPEG data
+		size_t scanLimit = srcSize < 2048 ? srcSize : 2048;
+
+		for (size_t i = 0; i + 1 < scanLimit; i++) {
+			if (src[i] == 0xFF && src[i + 1] == 0xD8) {
+				info->jpeg = src + i;
+				info->jpeg_size = srcSize - i;
+				break;
+			}
+		}
+	}
+
+	if (info->jpeg_size < 2 || info->jpeg[0] != 0xFF || info->jpeg[1] != 0xD8)
+		return MJPEG_PARSE_NO_SOI;
+
+	if (!parsed && tjDecompressHeader3(decompressor, info->jpeg,
+			info->jpeg_size, &info->width, &info->height, &info->subsampling,
+			&info->colorspace) != 0)
+		return MJPEG_PARSE_BAD_HEADER;
+
+	/* Decode at full size, or - when the camera mode is larger than the
+	 * connected format - let the IDCT scale it down so it fits the buffer.
+	 * That also saves most of the IDCT work and memory bandwidth. */
+	info->decode_width = info->width;
+	info->decode_height = info->height;
+	info->scaling.num = 1;
+	info->scaling.denom = 1;
+	if ((info->width > maxWidth || info->height > maxHeight)
+		&& !jpeg_scale_to_fit(info->width, info->height, maxWidth, maxHeight,
+			&info->decode_width, &info->decode_height, &info->scaling))
+		return MJPEG_PARSE_TOO_LARGE;
+
+	return MJPEG_PARSE_OK;
+}
+
+
+bool
+mjpeg_decode_supports(color_space space)
+{
+	return space == B_RGB32 || space == B_RGB24;
+}
+
+
+/* 'region' cut to a width x height buffer; false if nothing is left */
+static bool
+clip_region(const clipping_rect* region, int32 width, int32 height,
+	clipping_rect* clipped)
+{
+	clipped->left = 0;
+	clipped->top = 0;
+	clipped->right = width - 1;
+	clipped->bottom = height - 1;
+	if (region != NULL) {
+		if (region->left > clipped->left)
+			clipped->left = region->left;
+		if (region->top > clipped->top)
+			clipped->top = region->top;
+		if (region->right < clipped->right)
+			clipped->right = region->right;
+		if (region->bottom < clipped->bottom)
+			clipped->bottom = region->bottom;
+	}
+	return clipped->left <= clipped->right && clipped->top <= clipped->bottom;
+}
+
+
+/* Decodes the 'picture' part of the image to where it goes in the buffer */
+static int
+decode_rgb_region(tjhandle decompressor, const mjpeg_frame_info& info,
+	uint8* dst, int pitch, int pixelFormat, int bytesPerPixel,
+	const clipping_rect& picture)
+{
+#ifdef TJ_NUMINIT
+	// TurboJPEG 3 can crop the decode
+	if (picture.left != 0 || picture.top != 0
+		|| picture.right != info.decode_width - 1
+		|| picture.bottom != info.decode_height - 1) {
+		// The left edge on an iMCU boundary, as TurboJPEG wants it
+		int mcuWidth = TJSCALED(tjMCUWidth[info.subsampling], info.scaling);
+		int left = picture.left - picture.left % mcuWidth;
+		tjregion crop = { left, picture.top, picture.right - left + 1,
+			picture.bottom - picture.top + 1 };
+
+		int result = tj3DecompressHeader(decompressor, info.jpeg,
+			info.jpeg_size);
+		if (result == 0)
+			result = tj3SetScalingFactor(decompressor, info.scaling);
+		if (result == 0)
+			result = tj3SetCroppingRegion(decompressor, crop);
+		if (result == 0)
+			result = tj3Set(decompressor, TJPARAM_FASTDCT, 1);
+		if (result == 0) {
+			result = tj3Decompress8(decompressor, info.jpeg, info.jpeg_size,
+				dst + (size_t)crop.y * pitch + (size_t)left * bytesPerPixel,
+				pitch, pixelFormat);
+		}
+
+		// The full frame decodes use the same handle
+		tj3SetCroppingRegion(decompressor, TJUNCROPPED);
+		tj3SetScalingFactor(decompressor, TJUNSCALED);
+		return result;
+	}
+#else
+	(void)picture;
+	(void)bytesPerPixel;
+#endif
+
+	return tjDecompress2(decompressor, info.jpeg, info.jpeg_size, dst,
+		info.decode_width, pitch, info.decode_height, pixelFormat,
+		TJFLAG_FASTDCT);
+}
+
+
+int
+mjpeg_decode_rgb(tjhandle decompressor, const mjpeg_frame_info& info,
+	uint8* dst, int32 width, int32 height, color_space space,
+	const clipping_rect* region)
+{
+	if (!mjpeg_decode_supports(space))
+		return -1;
+
+	clipping_rect area;
+	if (!clip_region(region, width, height, &area))
+		return 0;
+
+	/* The image goes in the top-left corner, rows at the buffer's stride.
+	 * (Earlier code used the JPEG width as pitch for smaller JPEGs, which
+	 * packed the rows and skewed the picture against the buffer stride.) */
+	int bytesPerPixel = space == B_RGB24 ? 3 : 4;
+	int pitch = width * bytesPerPixel;
+
+	// Decompress directly to BGRA (RGB32 on Haiku) or BGR (RGB24)
+	clipping_rect picture;
+	if (clip_region(&area, info.decode_width, info.decode_height, &picture)) {
+		int result = decode_rgb_region(decompressor, info, dst, pitch,
+			space == B_RGB24 ? TJPF_BGR : TJPF_BGRA, bytesPerPixel, picture);
+		if (result != 0)
+			return result;
+	}
+
+	// Black out what the picture does not cover (valid frames are not
+	// pre-filled)
+	if (area.right >= info.decode_width) {
+		int32 left = area.left > info.decode_width
+			? area.left : info.decode_width;
+		for (int32 y = area.top; y <= area.bottom && y < info.decode_height;
+				y++) {
+			memset(dst + (size_t)y * pitch + left * bytesPerPixel, 0,
+				(area.right - left + 1) * bytesPerPixel);
+		}
+	}
+	int32 top = area.top > info.decode_height ? area.top : info.decode_height;
+	for (int32 y = top; y <= area.bottom; y++) {
+		memset(dst + (size_t)y * pitch + area.left * bytesPerPixel, 0,
+			(area.right - area.left + 1) * bytesPerPixel);
+	}
+	return 0;
+}
+
+
+// =============================================================================
+// YCbCr Planes
+// =============================================================================
+
+// JFIF full range to video range, Y 16..235 and Cb/Cr 16..240
+struct jpeg_range_tables {
+	uint8	luma[256];
+	uint8	chroma[256];
+
+	jpeg_range_tables()
+	{
+		for (int i = 0; i < 256; i++) {
+			luma[i] = (uint8)(16 + (i * 219 + 127) / 255);
+			chroma[i] = (uint8)(16 + (i * 224 + 127) / 255);
+		}
+	}
+};
+
+static const jpeg_range_tables sRange;
+
+
+void
+mjpeg_yuv_scratch_free(mjpeg_yuv_scratch* scratch)
+{
+	free(scratch->data);
+	scratch->data = NULL;
+	scratch->size = 0;
+}
+
+
+bool
+mjpeg_decode_yuv_supports(color_space space)
+{
+	return space == B_YCbCr422 || space == B_YCbCr420;
+}
+
+
+size_t
+mjpeg_yuv_bytes_per_row(color_space space, int32 width)
+{
+	size_t pairs = (width + 1) / 2;
+	return space == B_YCbCr420 ? pairs * 3 : pairs * 4;
+}
+
+
+/* Pairs [firstPair, endPair) of one output row from the planes. The chroma
+ * plane is chromaWidth samples wide for a width pixel row; 4:2:2 and 4:2:0
+ * (one sample per pair) take the direct path, other subsamplings pick the
+ * sample under each pair. */
+static void
+pack_yuv_row(uint8* out, color_space space, bool oddRow, const uint8* y,
+	const uint8* cb, const uint8* cr, int32 width, int32 chromaWidth,
+	int32 firstPair, int32 endPair)
+{
+	const uint8* luma = sRange.luma;
+	const uint8* chroma = sRange.chroma;
+	int32 pairs = width / 2;
+	bool direct = chromaWidth == (width + 1) / 2;
+	bool oddLast = (width & 1) != 0 && endPair > pairs;
+	if (endPair > pairs)
+		endPair = pairs;
+
+	if (space == B_YCbCr420) {
+		// Cb (even rows) or Cr (odd rows), then the pair's two lumas
+		const uint8* c = oddRow ? cr : cb;
+		for (int32 i = firstPair; i < endPair; i++) {
+			int32 cx = direct ? i : (int32)((int64)i * 2 * chromaWidth / width);
+			out[i * 3] = c != NULL ? chroma[c[cx]] : 128;
+			out[i * 3 + 1] = luma[y[i * 2]];
+			out[i * 3 + 2] = luma[y[i * 2 + 1]];
+		}
+		if (oddLast) {
+			int32 cx = direct ? pairs : chromaWidth - 1;
+			out[pairs * 3] = c != NULL ? chroma[c[cx]] : 128;
+			out[pairs * 3 + 1] = out[pairs * 3 + 2] = luma[y[width - 1]];
+		}
+		return;
+	}
+
+	// B_YCbCr422: Y0 Cb Y1 Cr
+	for (int32 i = firstPair; i < endPair; i++) {
+		int32 cx = direct ? i : (int32)((int64)i * 2 * chromaWidth / width);
+		out[i * 4] = luma[y[i * 2]];
+		out[i * 4 + 1] = cb != NULL ? chroma[cb[cx]] : 128;
+		out[i * 4 + 2] = luma[y[i * 2 + 1]];
+		out[i * 4 + 3] = cr != NULL ? chroma[cr[cx]] : 128;
+	}
+	if (oddLast) {
+		int32 cx = direct ? pairs : chromaWidth - 1;
+		out[pairs * 4] = out[pairs * 4 + 2] = luma[y[width - 1]];
+		out[pairs * 4 + 1] = cb != NULL ? chroma[cb[cx]] : 128;
+		out[pairs * 4 + 3] = cr != NULL ? chroma[cr[cx]] : 128;
+	}
+}
+
+
+static void
+black_yuv_row(uint8* out, color_space space, int32 firstPair, int32 pairs)
+{
+	for (int32 i = firstPair; i < pairs; i++) {
+		if (space == B_YCbCr420) {
+			out[i * 3] = 128;
+			out[i * 3 + 1] = out[i * 3 + 2] = 16;
+		} else {
+			out[i * 4] = out[i * 4 + 2] = 16;
+			out[i * 4 + 1] = out[i * 4 + 3] = 128;
+		}
+	}
+}
+
+
+int
+mjpeg_decode_yuv(tjhandle decompressor, const mjpeg_frame_info& info,
+	mjpeg_yuv_scratch* scratch, uint8* dst, int32 width, int32 height,
+	color_space space, const clipping_rect* region)
+{
+	if (!mjpeg_decode_yuv_supports(space))
+		return -1;
+
+	clipping_rect area;
+	if (!clip_region(region, width, height, &area))
+		return 0;
+
+	bool gray = info.subsampling == TJSAMP_GRAY;
+	int planeWidth[3];
+	int planeHeight[3];
+	size_t planeSize[3];
+	size_t total = 0;
+	for (int i = 0; i < 3; i++) {
+		if (i > 0 && gray) {
+			planeSize[i] = 0;
+			continue;
+		}
+		planeWidth[i] = tjPlaneWidth(i, info.decode_width, info.subsampling);
+		planeHeight[i] = tjPlaneHeight(i, info.decode_height,
+			info.subsampling);
+		if (planeWidth[i] <= 0 || planeHeight[i] <= 0)
+			return -1;
+		planeSize[i] = (size_t)planeWidth[i] * planeHeight[i];
+		total += planeSize[i];
+	}
+
+	if (scratch->size < total) {
+		uint8* data = (uint8*)realloc(scratch->data, total);
+		if (data == NULL)
+			return -1;
+		scratch->data = data;
+		scratch->size = total;
+	}
+
+	unsigned char* planes[3] = { scratch->data, NULL, NULL };
+	if (!gray) {
+		planes[1] = planes[0] + planeSize[0];
+		planes[2] = planes[1] + planeSize[1];
+	}
+	int result = tjDecompressToYUVPlanes(decompressor, info.jpeg,
+		info.jpeg_size, planes, info.decode_width, planeWidth,
+		info.decode_height, TJFLAG_FASTDCT);
+	if (result != 0)
+		return result;
+
+	size_t pitch = mjpeg_yuv_bytes_per_row(space, width);
+	int32 firstPair = area.left / 2;
+	int32 endPair = area.right / 2 + 1;
+	int32 coveredPairs = (info.decode_width + 1) / 2;
+	int32 packedPairs = endPair < coveredPairs ? endPair : coveredPairs;
+	for (int32 row = area.top; row <= area.bottom; row++) {
+		uint8* out = dst + row * pitch;
+		if (row >= info.decode_height) {
+			black_yuv_row(out, space, firstPair, endPair);
+			continue;
+		}
+
+		const uint8* cb = NULL;
+		const uint8* cr = NULL;
+		int32 chromaWidth = 0;
+		if (!gray) {
+			int32 chromaRow = (int32)((int64)row * planeHeight[1]
+				/ info.decode_height);
+			cb = planes[1] + (size_t)chromaRow * planeWidth[1];
+			cr = planes[2] + (size_t)chromaRow * planeWidth[2];
+			chromaWidth = planeWidth[1];
+		}
+		if (firstPair < packedPairs) {
+			pack_yuv_row(out, space, (row & 1) != 0,
+				planes[0] + (size_t)row * planeWidth[0], cb, cr,
+				info.decode_width, chromaWidth, firstPair, packedPairs);
+		}
+		black_yuv_row(out, space,
+			firstPair > coveredPairs ? firstPair : coveredPairs, endPair);
+	}
+	return 0;
+}
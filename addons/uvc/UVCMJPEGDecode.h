@@ -0,0 +1,106 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * MJPEG frame parsing and RGB and YCbCr decoding, without device state.
+ */
+#ifndef _UVC_MJPEG_DECODE_H
+#define _UVC_MJPEG_DECODE_H
+
+
+#include <GraphicsDefs.h>
+#include <SupportDefs.h>
+#include <turbojpeg.h>
+
+#include "CamJpegIndex.h"
+
+
+// =============================================================================
+// MJPEG -> RGB32 / RGB24
+// =============================================================================
+// The decode core of UVCCamDevice::_DecompressMJPEG(), split from its
+// counters and logging so the benchmark runs the same code. Both calls only
+// touch the given decompressor, so they may run on several threads at once.
+
+enum mjpeg_parse_result {
+	MJPEG_PARSE_OK = 0,
+	MJPEG_PARSE_NO_SOI,			// no JPEG start of image in the first 2 KB
+	MJPEG_PARSE_BAD_HEADER,		// TurboJPEG could not read the header
+	MJPEG_PARSE_TOO_LARGE		// no IDCT scaling makes it fit the buffer
+};
+
+struct mjpeg_frame_info {
+	const uint8*	jpeg;			// SOI marker, within the source
+	size_t			jpeg_size;
+	int				width;			// as coded
+	int				height;
+	int				subsampling;	// TJSAMP_*
+	int				colorspace;		// TJCS_*
+	int				decode_width;	// after IDCT scaling to fit the buffer
+	int				decode_height;
+	tjscalingfactor	scaling;		// that scaling, 1/1 if none
+};
+
+// Finds the JPEG in a raw frame and picks the decode size for a
+// maxWidth x maxHeight buffer. With the frame's marker index (from the
+// deframer) neither the SOI search nor TurboJPEG's header parse run.
+mjpeg_parse_result	mjpeg_parse_frame(tjhandle decompressor,
+						const uint8* src, size_t srcSize, int32 maxWidth,
+						int32 maxHeight, mjpeg_frame_info* info,
+						const cam_jpeg_index* index = NULL);
+
+// Whether mjpeg_decode_rgb() writes 'space' (B_RGB32 or B_RGB24)
+bool				mjpeg_decode_supports(color_space space);
+
+// Decodes into the top-left corner of a width x height buffer of 'space'
+// and blacks out what the picture does not cover. Returns the TurboJPEG
+// result, -1 for a color space it cannot write.
+//
+// With a region (buffer pixels, inclusive) only that part of the buffer is
+// written. TurboJPEG 3 then decodes little more than the region: the rows
+// below it are not decoded at all, those above are only entropy decoded,
+// and the columns are cut to whole iMCUs around it. Older TurboJPEG
+// decodes the whole picture.
+int					mjpeg_decode_rgb(tjhandle decompressor,
+						const mjpeg_frame_info& info, uint8* dst,
+						int32 width, int32 height,
+						color_space space = B_RGB32,
+						const clipping_rect* region = NULL);
+
+
+// =============================================================================
+// MJPEG -> B_YCbCr422 / B_YCbCr420
+// =============================================================================
+// For consumers that encode YCbCr anyway: TurboJPEG stops before its color
+// conversion and leaves the planes, which are packed into the BBuffer with
+// the JFIF full range scaled to the video range YUY2 cameras send. No RGB
+// frame is written or read, and 4:2:0 stays 12 bits per pixel.
+
+// Planes of one decode, grown on demand; one per decompressor, since the
+// decodes run at the same time
+struct mjpeg_yuv_scratch {
+	uint8*			data;
+	size_t			size;
+};
+
+void				mjpeg_yuv_scratch_free(mjpeg_yuv_scratch* scratch);
+
+// Whether mjpeg_decode_yuv() writes 'space'
+bool				mjpeg_decode_yuv_supports(color_space space);
+
+// Bytes per row of a width pixel wide 'space' buffer: Haiku's B_YCbCr420
+// has Cb Y Y on even and Cr Y Y on odd rows
+size_t				mjpeg_yuv_bytes_per_row(color_space space, int32 width);
+
+// As mjpeg_decode_rgb(), uncovered parts are black. Returns the TurboJPEG
+// result, -1 for a color space it cannot write or no memory for the planes.
+// TurboJPEG cannot crop a decode to planes, so a region only saves the
+// packing of the rows and columns outside it.
+int					mjpeg_decode_yuv(tjhandle decompressor,
+						const mjpeg_frame_info& info,
+						mjpeg_yuv_scratch* scratch, uint8* dst,
+						int32 width, int32 height, color_space space,
+						const clipping_rect* region = NULL);
+
+
+#endif /* _UVC_MJPEG_DECODE_H */
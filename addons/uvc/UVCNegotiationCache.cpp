@@ -0,0 +1,286 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Probe/commit results and the alternate picked for them, remembered per
+ * device identity so a restart skips the negotiation.
+ */
+
+
+#include "UVCNegotiationCache.h"
+
+#include <Autolock.h>
+#include <Directory.h>
+#include <File.h>
+#include <FindDirectory.h>
+#include <Message.h>
+#include <Path.h>
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "CamConfig.h"
+
+
+static const uint32 kNegotiationCacheWhat = 'uvNC';
+
+
+UVCNegotiationCache&
+UVCNegotiationCache::Default()
+{
+	static UVCNegotiationCache sCache;
+	return sCache;
+}
+
+
+UVCNegotiationCache::UVCNegotiationCache()
+	:
+	fLock("uvc negotiation cache"),
+	fPersistent(false),
+	fLoaded(false)
+{
+	const char* mode = getenv("WEBCAM_NEGOTIATION_CACHE");
+	fPersistent = mode != NULL && strcmp(mode, "disk") == 0;
+}
+
+
+UVCNegotiationCache::~UVCNegotiationCache()
+{
+	for (int32 i = 0; i < fEntries.CountItems(); i++)
+		delete (entry*)fEntries.ItemAt(i);
+	fEntries.MakeEmpty();
+}
+
+
+bool
+UVCNegotiationCache::Lookup(const uvc_negotiation_key& key,
+	uvc_negotiation* negotiation)
+{
+	BAutolock lock(fLock);
+	if (fPersistent && !fLoaded)
+		_Load();
+
+	entry* found = _Find(key);
+	if (found == NULL)
+		return false;
+
+	found->last_used = system_time();
+	*negotiation = found->negotiation;
+	return true;
+}
+
+
+void
+UVCNegotiationCache::Store(const uvc_negotiation_key& key,
+	const uvc_negotiation& negotiation)
+{
+	BAutolock lock(fLock);
+	if (fPersistent && !fLoaded)
+		_Load();
+
+	entry* found = _Find(key);
+	if (found == NULL) {
+		if (fEntries.CountItems() >= CamConfig::kNegotiationCacheEntries)
+			_EvictOldest();
+		found = new(std::nothrow) entry;
+		if (found == NULL)
+			return;
+		found->key = key;
+		if (!fEntries.AddItem(found)) {
+			delete found;
+			return;
+		}
+	} else if (memcmp(&found->negotiation, &negotiation,
+			sizeof(negotiation)) == 0) {
+		found->last_used = system_time();
+		return;
+	}
+
+	found->negotiation = negotiation;
+	found->last_used = system_time();
+
+	if (fPersistent)
+		_Save();
+}
+
+
+void
+UVCNegotiationCache::Remove(const uvc_negotiation_key& key)
+{
+	BAutolock lock(fLock);
+
+	entry* found = _Find(key);
+	if (found == NULL)
+		return;
+
+	fEntries.RemoveItem(found);
+	delete found;
+
+	if (fPersistent)
+		_Save();
+}
+
+
+int32
+UVCNegotiationCache::CountEntries()
+{
+	BAutolock lock(fLock);
+	return fEntries.CountItems();
+}
+
+
+UVCNegotiationCache::entry*
+UVCNegotiationCache::_Find(const uvc_negotiation_key& key)
+{
+	for (int32 i = 0; i < fEntries.CountItems(); i++) {
+		entry* candidate = (entry*)fEntries.ItemAt(i);
+		if (candidate->key == key)
+			return candidate;
+	}
+	return NULL;
+}
+
+
+void
+UVCNegotiationCache::_EvictOldest()
+{
+	int32 oldest = -1;
+	for (int32 i = 0; i < fEntries.CountItems(); i++) {
+		entry* candidate = (entry*)fEntries.ItemAt(i);
+		if (oldest < 0 || candidate->last_used
+				< ((entry*)fEntries.ItemAt(oldest))->last_used)
+			oldest = i;
+	}
+	if (oldest >= 0)
+		delete (entry*)fEntries.RemoveItem(oldest);
+}
+
+
+// Settings file: one flattened BMessage, entries as parallel arrays
+static status_t
+negotiation_cache_path(BPath& path)
+{
+	status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+	if (status != B_OK)
+		return status;
+	return path.Append(CamConfig::kNegotiationCacheFile);
+}
+
+
+void
+UVCNegotiationCache::_Load()
+{
+	fLoaded = true;
+
+	BPath path;
+	if (negotiation_cache_path(path) != B_OK)
+		return;
+
+	BFile file(path.Path(), B_READ_ONLY);
+	BMessage archive;
+	if (file.InitCheck() != B_OK || archive.Unflatten(&file) != B_OK
+		|| archive.what != kNegotiationCacheWhat)
+		return;
+
+	// A short or damaged entry ends the list
+	for (int32 i = 0; i < CamConfig::kNegotiationCacheEntries; i++) {
+		int32 vendor, product, version, format, frame, interval, policy;
+		int32 length, alternate, endpoint, bandwidth;
+		bool highBandwidth;
+		const char* serial;
+		const void* committed;
+		ssize_t committedSize;
+		if (archive.FindInt32("vendor", i, &vendor) != B_OK
+			|| archive.FindInt32("product", i, &product) != B_OK
+			|| archive.FindString("serial", i, &serial) != B_OK
+			|| archive.FindInt32("version", i, &version) != B_OK
+			|| archive.FindInt32("format", i, &format) != B_OK
+			|| archive.FindInt32("frame", i, &frame) != B_OK
+			|| archive.FindInt32("interval", i, &interval) != B_OK
+			|| archive.FindBool("high bandwidth", i, &highBandwidth) != B_OK
+			|| archive.FindInt32("policy", i, &policy) != B_OK
+			|| archive.FindData("committed", B_RAW_TYPE, i, &committed,
+				&committedSize) != B_OK
+			|| archive.FindInt32("length", i, &length) != B_OK
+			|| archive.FindInt32("alternate", i, &alternate) != B_OK
+			|| archive.FindInt32("endpoint", i, &endpoint) != B_OK
+			|| archive.FindInt32("bandwidth", i, &bandwidth) != B_OK)
+			break;
+
+		if (committedSize != (ssize_t)sizeof(usb_video_probe_and_commit_controls)
+			|| length <= 0
+			|| length > (int32)sizeof(usb_video_probe_and_commit_controls))
+			continue;
+
+		entry* loaded = new(std::nothrow) entry;
+		if (loaded == NULL)
+			break;
+		loaded->key.identity.vendor_id = (uint16)vendor;
+		loaded->key.identity.product_id = (uint16)product;
+		loaded->key.identity.serial_number = serial;
+		loaded->key.device_version = (uint16)version;
+		loaded->key.format_index = (uint8)format;
+		loaded->key.frame_index = (uint8)frame;
+		loaded->key.frame_interval = (uint32)interval;
+		loaded->key.high_bandwidth = highBandwidth;
+		loaded->key.alternate_policy = (uint8)policy;
+		memcpy(&loaded->negotiation.committed, committed, committedSize);
+		loaded->negotiation.length = length;
+		loaded->negotiation.alternate = alternate;
+		loaded->negotiation.endpoint = endpoint;
+		loaded->negotiation.bandwidth = bandwidth;
+		loaded->last_used = 0;
+		if (!fEntries.AddItem(loaded))
+			delete loaded;
+	}
+
+	syslog(LOG_INFO, "UVCNegotiationCache: loaded %d entries from %s\n",
+		(int)fEntries.CountItems(), path.Path());
+}
+
+
+void
+UVCNegotiationCache::_Save()
+{
+	BPath path;
+	if (negotiation_cache_path(path) != B_OK)
+		return;
+
+	BMessage archive(kNegotiationCacheWhat);
+	for (int32 i = 0; i < fEntries.CountItems(); i++) {
+		const entry* saved = (const entry*)fEntries.ItemAt(i);
+		archive.AddInt32("vendor", saved->key.identity.vendor_id);
+		archive.AddInt32("product", saved->key.identity.product_id);
+		archive.AddString("serial", saved->key.identity.serial_number);
+		archive.AddInt32("version", saved->key.device_version);
+		archive.AddInt32("format", saved->key.format_index);
+		archive.AddInt32("frame", saved->key.frame_index);
+		archive.AddInt32("interval", (int32)saved->key.frame_interval);
+		archive.AddBool("high bandwidth", saved->key.high_bandwidth);
+		archive.AddInt32("policy", saved->key.alternate_policy);
+		archive.AddData("committed", B_RAW_TYPE, &saved->negotiation.committed,
+			sizeof(saved->negotiation.committed), false);
+		archive.AddInt32("length", saved->negotiation.length);
+		archive.AddInt32("alternate", saved->negotiation.alternate);
+		archive.AddInt32("endpoint", saved->negotiation.endpoint);
+		archive.AddInt32("bandwidth", saved->negotiation.bandwidth);
+	}
+
+	BPath parent;
+	if (path.GetParent(&parent) == B_OK)
+		create_directory(parent.Path(), 0755);
+
+	BFile file(path.Path(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+	status_t status = file.InitCheck();
+	if (status == B_OK)
+		status = archive.Flatten(&file);
+	if (status != B_OK) {
+		static int32 sSaveFailuresLogged = 0;
+		if (atomic_add(&sSaveFailuresLogged, 1) < 1) {
+			syslog(LOG_WARNING, "UVCNegotiationCache: cannot write %s: %s\n",
+				path.Path(), strerror(status));
+		}
+	}
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Probe/commit results and the alternate picked for them, remembered per
+ * device identity so a restart skips the negotiation.
+ */
+#ifndef _UVC_NEGOTIATION_CACHE_H
+#define _UVC_NEGOTIATION_CACHE_H
+
+
+#include <List.h>
+#include <Locker.h>
+#include <usb/USB_video.h>
+
+#include "CamRoster.h"
+
+
+// =============================================================================
+// Negotiation Cache
+// =============================================================================
+// StartTransfer() normally probes, reads back, commits and then scans every
+// alternate, which is a few hundred milliseconds of control transfers. The
+// outcome only depends on what is asked for, so it is looked up by that:
+// the device, the format and frame, the requested interval and what the
+// alternate scan was allowed to pick. A hit is one COMMIT and one
+// SET_INTERFACE.
+//
+// Entries live for the add-on's lifetime, so they survive a replug. With
+// WEBCAM_NEGOTIATION_CACHE=disk they are also kept in the user settings
+// directory across restarts. A hit that the device rejects is dropped and
+// the full negotiation runs.
+
+struct uvc_negotiation_key {
+	device_identity	identity;
+	uint16			device_version;		// bcdDevice, firmware changes
+	uint8			format_index;
+	uint8			frame_index;
+	uint32			frame_interval;		// as requested, 100 ns units
+	bool			high_bandwidth;		// multi-transaction alternates allowed
+	uint8			alternate_policy;	// uvc_alternate_policy
+
+	bool operator==(const uvc_negotiation_key& other) const {
+		return identity == other.identity
+			&& device_version == other.device_version
+			&& format_index == other.format_index
+			&& frame_index == other.frame_index
+			&& frame_interval == other.frame_interval
+			&& high_bandwidth == other.high_bandwidth
+			&& alternate_policy == other.alternate_policy;
+	}
+};
+
+struct uvc_negotiation {
+	usb_video_probe_and_commit_controls	committed;	// as read back from probe
+	uint32			length;				// 26 (UVC 1.0) or 34 bytes
+	uint32			alternate;
+	uint32			endpoint;
+	uint32			bandwidth;			// bytes per (micro)frame
+};
+
+
+class UVCNegotiationCache {
+public:
+	static	UVCNegotiationCache&	Default();
+
+			bool				Lookup(const uvc_negotiation_key& key,
+									uvc_negotiation* negotiation);
+			void				Store(const uvc_negotiation_key& key,
+									const uvc_negotiation& negotiation);
+			void				Remove(const uvc_negotiation_key& key);
+
+			int32				CountEntries();
+
+private:
+	struct entry {
+		uvc_negotiation_key	key;
+		uvc_negotiation		negotiation;
+		bigtime_t			last_used;
+	};
+
+								UVCNegotiationCache();
+								~UVCNegotiationCache();
+
+			entry*				_Find(const uvc_negotiation_key& key);
+			void				_EvictOldest();
+			void				_Load();
+			void				_Save();
+
+			BLocker				fLock;
+			BList				fEntries;		// entry*
+			bool				fPersistent;
+			bool				fLoaded;
+};
+
+
+#endif /* _UVC_NEGOTIATION_CACHE_H */
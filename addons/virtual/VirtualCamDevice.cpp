@@ -0,0 +1,349 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * A camera without hardware, for load-testing the media graph.
+ */
+
+
+#include "VirtualCamDevice.h"
+
+#include "CamDebug.h"
+#include "UVCColorConvert.h"
+#include "UVCDeframer.h"
+#include "UVCMJPEGDecode.h"
+
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <media/Buffer.h>
+
+
+// PTS and SCR count a 48 MHz device clock, like most cameras
+static const uint32 kClockFrequency = 48000000;
+// Packets per transfer, as the isochronous ring queues them
+static const int32 kTransferPackets = 32;
+// Raw frames in the arena, as UVCCamDevice lays it out
+static const int32 kArenaRawFrameSlots = 10;
+
+
+static inline uint32
+device_clock(bigtime_t time)
+{
+	return (uint32)(time * (kClockFrequency / 1000000));
+}
+
+
+// =============================================================================
+// Virtual Camera
+// =============================================================================
+
+
+VirtualCamDevice::VirtualCamDevice(CamDeviceAddon& addon,
+	const virtual_cam_config& config)
+	: CamDevice(addon, NULL),
+	  fUVCDeframer(NULL),
+	  fFrameArena("virtual camera frames"),
+	  fDecompressor(NULL),
+	  fKernel(yuy2_rgb32_best_kernel()),
+	  fFillSequence(0),
+	  fFillTimeouts(0)
+{
+	virtual_cam_describe(config, fModelName, sizeof(fModelName));
+	fFlavorInfoNameStr = "Virtual Camera ";
+	fFlavorInfoNameStr << fThreadPolicy.CameraIndex() + 1 << " ("
+		<< fModelName << ")";
+	fFlavorInfoInfoStr = fFlavorInfoNameStr;
+	fFlavorInfo.name = fFlavorInfoNameStr.String();
+	fFlavorInfo.info = fFlavorInfoInfoStr.String();
+
+	status_t status = virtual_cam_stream_build(&fStream, config);
+	if (status != B_OK) {
+		syslog(LOG_ERR, "VirtualCam: no stream for %s: %s\n", fModelName,
+			strerror(status));
+		fInitStatus = status;
+		return;
+	}
+
+	fUVCDeframer = new(std::nothrow) UVCDeframer(this);
+	if (fUVCDeframer == NULL) {
+		fInitStatus = B_NO_MEMORY;
+		return;
+	}
+	fDeframer = fUVCDeframer;
+	SetDataInput(fDeframer);
+	fUVCDeframer->SetClockFrequency(kClockFrequency);
+
+	size_t rawSize = (size_t)fStream.width * fStream.height * 2;
+	if (fStream.fourcc == 'YUY2')
+		fUVCDeframer->SetExpectedFrameSize(rawSize);
+	else {
+		fDecompressor = tjInitDecompress();
+		if (fDecompressor == NULL) {
+			fInitStatus = B_NO_MEMORY;
+			return;
+		}
+	}
+
+	// Raw frames from a locked arena, as a camera's; heap frames otherwise
+	int32 slots = kArenaRawFrameSlots;
+	if (fFrameArena.SetLayout(&rawSize, &slots, 1) == B_OK)
+		fDeframer->SetFrameArena(&fFrameArena, 0);
+
+	SetVideoFrame(BRect(0, 0, fStream.width - 1, fStream.height - 1));
+	fFrameRate = fStream.fps;
+	SetExpectedFrameRate(fStream.fps);
+
+	syslog(LOG_INFO, "VirtualCam: %s, %ux%u %.4s at %.2f fps, %d frames in "
+		"%d packets\n", fFlavorInfoNameStr.String(), (unsigned)fStream.width,
+		(unsigned)fStream.height, (const char*)&fStream.fourcc, fStream.fps,
+		(int)fStream.frame_count, (int)fStream.packet_count);
+	fInitStatus = B_OK;
+}
+
+
+VirtualCamDevice::~VirtualCamDevice()
+{
+	// The pump sends from fStream, and the deframer's frames come from
+	// fFrameArena: both go before the base class would get to them
+	if (TransferEnabled())
+		StopTransfer();
+	delete fDeframer;
+	fDeframer = NULL;
+	fUVCDeframer = NULL;
+	fDataInput = NULL;
+	fPacketInput = NULL;
+	fFrameArena.Unset();
+
+	if (fDecompressor != NULL)
+		tjDestroy(fDecompressor);
+	virtual_cam_stream_free(&fStream);
+}
+
+
+bool
+VirtualCamDevice::IsPlugged()
+{
+	return true;
+}
+
+
+const char*
+VirtualCamDevice::BrandName()
+{
+	return "Virtual";
+}
+
+
+const char*
+VirtualCamDevice::ModelName()
+{
+	return fModelName;
+}
+
+
+status_t
+VirtualCamDevice::SuggestVideoFrame(uint32& width, uint32& height)
+{
+	if (fInitStatus != B_OK)
+		return fInitStatus;
+	width = fStream.width;
+	height = fStream.height;
+	return B_OK;
+}
+
+
+status_t
+VirtualCamDevice::AcceptVideoFrame(uint32& width, uint32& height)
+{
+	// One mode, whatever is asked for
+	status_t status = SuggestVideoFrame(width, height);
+	if (status == B_OK)
+		SetVideoFrame(BRect(0, 0, width - 1, height - 1));
+	return status;
+}
+
+
+status_t
+VirtualCamDevice::AcceptFrameRate(float& fps)
+{
+	fps = fStream.fps;
+	fFrameRate = fps;
+	return B_OK;
+}
+
+
+/* Sends the stream's frames in a loop, each one's transfers spread evenly
+ * over its frame interval. A pump that falls behind by more than a frame
+ * starts over from now: the frames it missed are lost, as they are when a
+ * camera finds no transfer queued. */
+status_t
+VirtualCamDevice::DataPumpThread()
+{
+	if (fPacketInput == NULL || fStream.frame_count == 0)
+		return B_NO_INIT;
+
+	bigtime_t interval = (bigtime_t)(1000000 / fStream.fps);
+	fTransferStartTime = system_time();
+	fPumpSchedule.Reset();
+
+	bigtime_t start = system_time();
+	int32 frame = 0;
+	int32 lateFrames = 0;
+	while (atomic_get(&fTransferEnabled)) {
+		if (_SendFrame(frame, start, interval) != B_OK)
+			break;
+		frame = (frame + 1) % fStream.frame_count;
+		start += interval;
+
+		bigtime_t now = system_time();
+		if (now - start > interval) {
+			lateFrames += (now - start) / interval;
+			start = now;
+			if (lateFrames <= 5 || (lateFrames % 100) == 0) {
+				syslog(LOG_WARNING, "VirtualCam: %s pump behind, %d frames "
+					"not sent\n", fModelName, (int)lateFrames);
+			}
+		}
+	}
+	return B_OK;
+}
+
+
+status_t
+VirtualCamDevice::_SendFrame(int32 frame, bigtime_t start,
+	bigtime_t interval)
+{
+	int32 first;
+	int32 count;
+	virtual_cam_stream_frame(fStream, frame, &first, &count);
+	int32 transfers = (count + kTransferPackets - 1) / kTransferPackets;
+	bigtime_t spacing = interval / (transfers > 0 ? transfers : 1);
+	uint32 pts = device_clock(start);
+
+	for (int32 t = 0; t < transfers; t++) {
+		bigtime_t due = start + spacing * t;
+		snooze_until(due, B_SYSTEM_TIMEBASE);
+		if (!atomic_get(&fTransferEnabled))
+			return B_INTERRUPTED;
+
+		bigtime_t now = system_time();
+		fPumpSchedule.Record(now - due, spacing);
+
+		int32 packet = first + t * kTransferPackets;
+		int32 packets = first + count - packet;
+		if (packets > kTransferPackets)
+			packets = kTransferPackets;
+		virtual_cam_stream_stamp(&fStream, packet, packets, pts,
+			device_clock(now), (uint16)((now / 1000) & 0x7ff));
+
+		int64 bytes = 0;
+		for (int32 i = packet; i < packet + packets; i++)
+			bytes += fStream.packets[i].actual_length;
+		fMetrics.Add(CAM_METRIC_TRANSFERS);
+		fMetrics.Add(CAM_METRIC_PACKETS, packets);
+		fMetrics.Add(CAM_METRIC_BYTES, bytes);
+
+		fPacketSuccessCount += fPacketInput->WritePackets(
+			fStream.data + packet * fStream.slot_size, fStream.slot_size,
+			fStream.packets + packet, packets);
+	}
+	return B_OK;
+}
+
+
+status_t
+VirtualCamDevice::FillFrameBuffer(BBuffer* buffer, bigtime_t* stamp,
+	uint32* sequence, cam_frame_times* times)
+{
+	if (fDeframer == NULL)
+		return B_NO_INIT;
+
+	status_t status = fDeframer->WaitFrame(2000000);
+	if (status < B_OK) {
+		fFillTimeouts++;
+		if (fFillTimeouts <= 5 || (fFillTimeouts % 10) == 0) {
+			syslog(LOG_WARNING, "VirtualCam: %s WaitFrame timeout #%d (%s)\n",
+				fModelName, (int)fFillTimeouts, strerror(status));
+		}
+		return status;
+	}
+
+	CamFrame* frame;
+	bigtime_t frameStamp;
+	status = fDeframer->GetFrame(&frame, &frameStamp);
+	if (status < B_OK)
+		return status;
+	if (stamp != NULL)
+		*stamp = frameStamp;
+	if (sequence != NULL)
+		*sequence = fFillSequence;
+	fFillSequence++;
+	if (times != NULL) {
+		times->arrival = frame->fArrival;
+		times->completed = frame->fCompleted;
+	}
+
+	int32 width = fVideoFrame.IntegerWidth() + 1;
+	int32 height = fVideoFrame.IntegerHeight() + 1;
+	uint8* dst = (uint8*)buffer->Data();
+	const uint8* src = (const uint8*)frame->Buffer();
+	size_t srcSize = frame->BufferLength();
+
+	if (buffer->SizeAvailable() < (size_t)width * height * 4)
+		status = B_BAD_VALUE;
+	else if (fStream.fourcc == 'YUY2')
+		yuy2_to_rgb32_frame(fKernel, dst, src, srcSize, width, height);
+	else {
+		mjpeg_frame_info info;
+		if (mjpeg_parse_frame(fDecompressor, src, srcSize, width, height,
+				&info, &frame->fJpegIndex) != MJPEG_PARSE_OK
+			|| mjpeg_decode_rgb(fDecompressor, info, dst, width, height,
+				B_RGB32) != 0)
+			status = B_BAD_DATA;
+	}
+
+	bigtime_t completed = frame->fCompleted;
+	fDeframer->RecycleFrame(frame);
+	fMetrics.RecordLatency(CAM_LATENCY_DECODE, system_time() - completed);
+	return status;
+}
+
+
+// =============================================================================
+// Add-on
+// =============================================================================
+
+
+VirtualCamDeviceAddon::VirtualCamDeviceAddon(WebCamMediaAddOn* webcam)
+	: CamDeviceAddon(webcam)
+{
+}
+
+
+VirtualCamDeviceAddon::~VirtualCamDeviceAddon()
+{
+}
+
+
+const char*
+VirtualCamDeviceAddon::BrandName()
+{
+	return "Virtual";
+}
+
+
+status_t
+VirtualCamDeviceAddon::Sniff(BUSBDevice* device)
+{
+	return ENODEV;
+}
+
+
+VirtualCamDevice*
+VirtualCamDeviceAddon::InstantiateVirtual(CamRoster& roster,
+	const virtual_cam_config& config)
+{
+	return new(std::nothrow) VirtualCamDevice(*this, config);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * A camera without hardware, for load-testing the media graph.
+ */
+#ifndef _VIRTUAL_CAM_DEVICE_H
+#define _VIRTUAL_CAM_DEVICE_H
+
+
+#include "CamDevice.h"
+#include "VirtualCamSource.h"
+
+#include <turbojpeg.h>
+
+class UVCDeframer;
+struct yuy2_rgb32_kernel;
+
+
+// =============================================================================
+// Virtual Camera
+// =============================================================================
+// Shows up through the roster and the add-on like a USB camera, and its
+// data pump hands UVC payload packets to the production UVCDeframer at the
+// configured rate, a transfer of 32 at a time spread over each frame
+// interval; FillFrameBuffer() converts them with the production YUY2 and
+// MJPEG code. Everything downstream of the USB stack runs as with a
+// camera, and every instance has its own pipeline, threads and metrics,
+// so several of them measure how the pipeline scales. Output is B_RGB32.
+
+class VirtualCamDevice : public CamDevice {
+public:
+								VirtualCamDevice(CamDeviceAddon& addon,
+									const virtual_cam_config& config);
+	virtual						~VirtualCamDevice();
+
+	virtual bool				IsPlugged();
+	virtual const char*			BrandName();
+	virtual const char*			ModelName();
+
+	virtual status_t			SuggestVideoFrame(uint32& width,
+									uint32& height);
+	virtual status_t			AcceptVideoFrame(uint32& width,
+									uint32& height);
+	virtual status_t			AcceptFrameRate(float& fps);
+
+	virtual status_t			DataPumpThread();
+	virtual status_t			FillFrameBuffer(BBuffer* buffer,
+									bigtime_t* stamp = NULL,
+									uint32* sequence = NULL,
+									cam_frame_times* times = NULL);
+
+private:
+			status_t			_SendFrame(int32 frame, bigtime_t start,
+									bigtime_t interval);
+
+			virtual_cam_stream	fStream;
+			char				fModelName[64];
+			UVCDeframer*		fUVCDeframer;
+			CamFrameArena		fFrameArena;
+			tjhandle			fDecompressor;
+			const yuy2_rgb32_kernel*	fKernel;
+			uint32				fFillSequence;
+			int32				fFillTimeouts;
+};
+
+
+class VirtualCamDeviceAddon : public CamDeviceAddon {
+public:
+								VirtualCamDeviceAddon(
+									WebCamMediaAddOn* webcam);
+	virtual						~VirtualCamDeviceAddon();
+
+	virtual const char*			BrandName();
+								// Never a USB device
+	virtual status_t			Sniff(BUSBDevice* device);
+
+			VirtualCamDevice*	InstantiateVirtual(CamRoster& roster,
+									const virtual_cam_config& config);
+};
+
+
+#endif /* _VIRTUAL_CAM_DEVICE_H */
@@ -0,0 +1,544 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * What a virtual camera sends: its configuration and its packet stream.
+ */
+
+
+#include "VirtualCamSource.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <turbojpeg.h>
+
+#include "CamCapture.h"
+
+
+// High-bandwidth isochronous packet, 3 x 1024 byte transactions
+static const size_t kPacketSize = 3072;
+static const size_t kHeaderSize = 12;
+// Distinct synthetic frames, sent in a loop; even, so the FID toggles
+// across the loop as well
+static const int32 kStreamFrames = 4;
+static const float kDefaultFPS = 30.0f;
+
+// UVC payload header bits
+static const uint8 kHeaderFID = 0x01;
+static const uint8 kHeaderEOF = 0x02;
+static const uint8 kHeaderPTS = 0x04;
+static const uint8 kHeaderSCR = 0x08;
+static const uint8 kHeaderEOH = 0x80;
+
+
+// =============================================================================
+// Configuration
+// =============================================================================
+
+
+static bool
+parse_entry(const char* entry, virtual_cam_config* config)
+{
+	memset(config, 0, sizeof(*config));
+
+	const char* colon = strchr(entry, ':');
+	if (colon == NULL)
+		return false;
+	size_t kindLength = colon - entry;
+	const char* value = colon + 1;
+
+	if (kindLength == 6 && strncasecmp(entry, "replay", 6) == 0) {
+		config->source = VIRTUAL_CAM_REPLAY;
+		// A rate after the last '@', if what follows it is one
+		strlcpy(config->path, value, sizeof(config->path));
+		char* at = strrchr(config->path, '@');
+		if (at != NULL) {
+			char* end;
+			float fps = strtof(at + 1, &end);
+			if (end != at + 1 && *end == '\0' && fps > 0) {
+				*at = '\0';
+				config->fps = fps;
+			}
+		}
+		return config->path[0] != '\0' && config->fps <= VIRTUAL_CAM_MAX_FPS;
+	}
+
+	if (kindLength == 4 && strncasecmp(entry, "yuy2", 4) == 0)
+		config->source = VIRTUAL_CAM_YUY2;
+	else if (kindLength == 5 && strncasecmp(entry, "mjpeg", 5) == 0)
+		config->source = VIRTUAL_CAM_MJPEG;
+	else
+		return false;
+
+	unsigned width;
+	unsigned height;
+	float fps = kDefaultFPS;
+	int fields = sscanf(value, "%ux%u@%f", &width, &height, &fps);
+	if (fields < 2)
+		return false;
+	// Whole macro-pixels, and within what a camera of the kind streams
+	if (width < 2 || height < 1 || (width & 1) != 0
+		|| width > VIRTUAL_CAM_MAX_WIDTH || height > VIRTUAL_CAM_MAX_HEIGHT
+		|| fps <= 0 || fps > VIRTUAL_CAM_MAX_FPS)
+		return false;
+
+	config->width = width;
+	config->height = height;
+	config->fps = fps;
+	return true;
+}
+
+
+int32
+virtual_cam_parse_config(const char* spec, virtual_cam_config* configs,
+	int32 maxConfigs)
+{
+	if (spec == NULL)
+		return 0;
+
+	int32 count = 0;
+	const char* next = spec;
+	while (*next != '\0' && count < maxConfigs) {
+		const char* end = strchr(next, ';');
+		size_t length = end != NULL ? (size_t)(end - next) : strlen(next);
+
+		char entry[300];
+		if (length >= sizeof(entry))
+			length = sizeof(entry) - 1;
+		memcpy(entry, next, length);
+		entry[length] = '\0';
+		next = end != NULL ? end + 1 : next + strlen(next);
+
+		// Leading and trailing blanks
+		char* start = entry;
+		while (*start == ' ' || *start == '\t')
+			start++;
+		char* last = start + strlen(start);
+		while (last > start && (last[-1] == ' ' || last[-1] == '\t'))
+			*--last = '\0';
+		if (*start == '\0')
+			continue;
+
+		int32 copies = 1;
+		char* star = strchr(start, '*');
+		char* colon = strchr(start, ':');
+		if (star != NULL && (colon == NULL || star < colon)) {
+			copies = atoi(start);
+			start = star + 1;
+		}
+
+		virtual_cam_config config;
+		if (copies < 1 || !parse_entry(start, &config)) {
+			syslog(LOG_WARNING, "WEBCAM_VIRTUAL: cannot read '%s'\n", entry);
+			continue;
+		}
+		while (copies-- > 0 && count < maxConfigs)
+			configs[count++] = config;
+	}
+
+	if (*next != '\0') {
+		syslog(LOG_WARNING, "WEBCAM_VIRTUAL: more than %d cameras, the rest "
+			"are left out\n", (int)maxConfigs);
+	}
+	return count;
+}
+
+
+void
+virtual_cam_describe(const virtual_cam_config& config, char* buffer,
+	size_t size)
+{
+	if (config.source == VIRTUAL_CAM_REPLAY) {
+		const char* name = strrchr(config.path, '/');
+		snprintf(buffer, size, "replay of %s", name != NULL ? name + 1
+			: config.path);
+		return;
+	}
+	snprintf(buffer, size, "%s %ux%u@%g",
+		config.source == VIRTUAL_CAM_MJPEG ? "MJPEG" : "YUY2",
+		(unsigned)config.width, (unsigned)config.height, config.fps);
+}
+
+
+// =============================================================================
+// Packet Stream
+// =============================================================================
+
+
+static bool
+stream_reserve(virtual_cam_stream* stream, int32 packetCount,
+	size_t slotSize)
+{
+	stream->data = (uint8*)malloc((size_t)packetCount * slotSize);
+	stream->packets = (usb_iso_packet_descriptor*)malloc(
+		sizeof(usb_iso_packet_descriptor) * packetCount);
+	stream->frame_starts = (int32*)malloc(sizeof(int32) * packetCount);
+	stream->slot_size = slotSize;
+	stream->packet_count = 0;
+	return stream->data != NULL && stream->packets != NULL
+		&& stream->frame_starts != NULL;
+}
+
+
+static void
+stream_add(virtual_cam_stream* stream, const uint8* packet, size_t length)
+{
+	int32 index = stream->packet_count++;
+	memcpy(stream->data + index * stream->slot_size, packet, length);
+	stream->packets[index].request_length = stream->slot_size;
+	stream->packets[index].actual_length = length;
+	stream->packets[index].status = B_OK;
+}
+
+
+// A frame starts where the FID toggles or after an EOF. A loop must toggle
+// as well: a last frame with the first one's FID is left out, it would run
+// into the first.
+static void
+stream_index_frames(virtual_cam_stream* stream)
+{
+	stream->frame_count = 0;
+	int fid = -1;
+	bool ended = true;
+	for (int32 i = 0; i < stream->packet_count; i++) {
+		const uint8* header = stream->data + i * stream->slot_size;
+		if (stream->packets[i].actual_length < 2 || header[0] < 2)
+			continue;
+		int packetFID = header[1] & kHeaderFID;
+		if (ended || packetFID != fid)
+			stream->frame_starts[stream->frame_count++] = i;
+		fid = packetFID;
+		ended = (header[1] & kHeaderEOF) != 0;
+	}
+
+	if (stream->frame_count > 1) {
+		const uint8* first = stream->data
+			+ stream->frame_starts[0] * stream->slot_size;
+		if ((first[1] & kHeaderFID) == fid) {
+			stream->frame_count--;
+			stream->packet_count = stream->frame_starts[stream->frame_count];
+		}
+	}
+}
+
+
+// Cuts one frame's payload into packets the way a camera sends it
+static void
+packetize_frame(virtual_cam_stream* stream, const uint8* payload,
+	size_t size, int32 frameNumber)
+{
+	uint8 packet[kPacketSize];
+	uint8 fid = frameNumber & 1;
+
+	for (size_t offset = 0; offset < size; ) {
+		size_t chunk = size - offset;
+		if (chunk > kPacketSize - kHeaderSize)
+			chunk = kPacketSize - kHeaderSize;
+		bool last = offset + chunk == size;
+
+		// PTS and SCR are stamped as the packets go out
+		memset(packet, 0, kHeaderSize);
+		packet[0] = kHeaderSize;
+		packet[1] = kHeaderEOH | kHeaderSCR | kHeaderPTS
+			| (last ? kHeaderEOF : 0) | fid;
+		memcpy(&packet[kHeaderSize], payload + offset, chunk);
+		stream_add(stream, packet, kHeaderSize + chunk);
+		offset += chunk;
+	}
+}
+
+
+static int32
+packets_for(size_t payloadSize)
+{
+	return (payloadSize + kPacketSize - kHeaderSize - 1)
+		/ (kPacketSize - kHeaderSize);
+}
+
+
+static void
+fill_pattern_yuy2(uint8* yuy2, int32 width, int32 height, int32 frameNumber)
+{
+	for (int32 y = 0; y < height; y++) {
+		uint8* row = yuy2 + (size_t)y * width * 2;
+		for (int32 x = 0; x < width; x += 2) {
+			row[x * 2] = (uint8)(x + y + frameNumber * 8);
+			row[x * 2 + 1] = (uint8)(128 + (x >> 3) - (y >> 4));
+			row[x * 2 + 2] = (uint8)(x + 1 + y + frameNumber * 8);
+			row[x * 2 + 3] = (uint8)(128 - (x >> 4) + (y >> 3));
+		}
+	}
+}
+
+
+static void
+fill_pattern_rgb32(uint8* bgra, int32 width, int32 height, int32 frameNumber)
+{
+	for (int32 y = 0; y < height; y++) {
+		uint8* row = bgra + (size_t)y * width * 4;
+		for (int32 x = 0; x < width; x++) {
+			row[x * 4] = (uint8)(x + frameNumber * 8);
+			row[x * 4 + 1] = (uint8)(y * 2);
+			row[x * 4 + 2] = (uint8)((x ^ y) + frameNumber * 4);
+			row[x * 4 + 3] = 255;
+		}
+	}
+}
+
+
+static status_t
+build_yuy2(virtual_cam_stream* stream, int32 width, int32 height)
+{
+	size_t size = (size_t)width * height * 2;
+	uint8* frame = (uint8*)malloc(size);
+	if (frame == NULL
+		|| !stream_reserve(stream, packets_for(size) * kStreamFrames,
+			kPacketSize)) {
+		free(frame);
+		return B_NO_MEMORY;
+	}
+
+	for (int32 i = 0; i < kStreamFrames; i++) {
+		fill_pattern_yuy2(frame, width, height, i);
+		packetize_frame(stream, frame, size, i);
+	}
+	free(frame);
+	stream->fourcc = 'YUY2';
+	return B_OK;
+}
+
+
+static status_t
+build_mjpeg(virtual_cam_stream* stream, int32 width, int32 height)
+{
+	tjhandle compressor = tjInitCompress();
+	uint8* picture = (uint8*)malloc((size_t)width * height * 4);
+	unsigned char* jpegs[kStreamFrames] = {};
+	unsigned long jpegSizes[kStreamFrames] = {};
+	status_t status = compressor != NULL && picture != NULL
+		? B_OK : B_NO_MEMORY;
+
+	// 4:2:2 at quality 85, about what cameras send
+	int32 packetCount = 0;
+	for (int32 i = 0; i < kStreamFrames && status == B_OK; i++) {
+		fill_pattern_rgb32(picture, width, height, i);
+		if (tjCompress2(compressor, picture, width, width * 4, height,
+				TJPF_BGRA, &jpegs[i], &jpegSizes[i], TJSAMP_422, 85,
+				TJFLAG_FASTDCT) != 0) {
+			syslog(LOG_ERR, "VirtualCam: tjCompress2: %s\n",
+				tjGetErrorStr2(compressor));
+			status = B_ERROR;
+		} else
+			packetCount += packets_for(jpegSizes[i]);
+	}
+
+	if (status == B_OK && !stream_reserve(stream, packetCount, kPacketSize))
+		status = B_NO_MEMORY;
+	for (int32 i = 0; i < kStreamFrames && status == B_OK; i++)
+		packetize_frame(stream, jpegs[i], jpegSizes[i], i);
+
+	for (int32 i = 0; i < kStreamFrames; i++)
+		tjFree(jpegs[i]);
+	free(picture);
+	if (compressor != NULL)
+		tjDestroy(compressor);
+	stream->fourcc = 'MJPG';
+	return status;
+}
+
+
+// The video packets of a WEBCAM_CAPTURE file's first session, as the
+// isochronous pump handed them to the deframer. 'copy' false only counts
+// them.
+static bool
+scan_capture(virtual_cam_stream* stream, const uint8* base, size_t size,
+	cam_capture_stream_info* info, bool copy)
+{
+	bool started = false;
+	size_t offset = 0;
+	const cam_capture_record* record;
+	while ((record = cam_capture_next_record(base, size, &offset)) != NULL) {
+		if (record->stream != CAM_CAPTURE_VIDEO)
+			continue;
+
+		const uint8* data = cam_capture_data(record);
+		if (record->type == CAM_CAPTURE_STREAM_START) {
+			// A later session may stream another format
+			if (started)
+				break;
+			if (record->data_size < sizeof(*info))
+				return false;
+			memcpy(info, data, sizeof(*info));
+			started = true;
+			continue;
+		}
+		if (!started)
+			continue;
+
+		// Bulk transfers hold payloads back to back, not one per packet
+		if (record->packet_count == 0)
+			continue;
+
+		// Failed and empty packets are skipped, like the pump does
+		const cam_capture_packet* packets = cam_capture_packets(record);
+		for (uint32 i = 0; i < record->packet_count; i++) {
+			uint32 length = packets[i].actual_length;
+			if (length > record->slot_size)
+				length = record->slot_size;
+			if (packets[i].status == B_OK && length > 0) {
+				if (copy)
+					stream_add(stream, data, length);
+				else {
+					stream->packet_count++;
+					if (length > stream->slot_size)
+						stream->slot_size = length;
+				}
+			}
+			data += length;
+		}
+	}
+	return started;
+}
+
+
+static status_t
+build_replay(virtual_cam_stream* stream, const virtual_cam_config& config)
+{
+	int fd = open(config.path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		status_t status = errno;
+		if (fd >= 0)
+			close(fd);
+		return status;
+	}
+
+	const uint8* base = NULL;
+	if ((size_t)st.st_size >= sizeof(cam_capture_file_header)) {
+		void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED)
+			base = (const uint8*)mapped;
+	}
+	close(fd);
+	if (base == NULL)
+		return B_BAD_DATA;
+
+	size_t size = st.st_size;
+	cam_capture_stream_info info;
+	status_t status = B_OK;
+	if (memcmp(base, CAM_CAPTURE_MAGIC, 8) != 0
+		|| !scan_capture(stream, base, size, &info, false)
+		|| stream->packet_count == 0)
+		status = B_BAD_DATA;
+	else if (info.fourcc != 'YUY2' && info.fourcc != 'MJPG')
+		status = B_NOT_SUPPORTED;
+	else if (!stream_reserve(stream, stream->packet_count, stream->slot_size))
+		status = B_NO_MEMORY;
+	else
+		scan_capture(stream, base, size, &info, true);
+
+	munmap((void*)base, size);
+	if (status != B_OK)
+		return status;
+
+	stream->fourcc = info.fourcc;
+	stream->width = info.width;
+	stream->height = info.height;
+	stream->fps = info.frame_interval > 0
+		? 10000000.0f / info.frame_interval : kDefaultFPS;
+	return B_OK;
+}
+
+
+status_t
+virtual_cam_stream_build(virtual_cam_stream* stream,
+	const virtual_cam_config& config)
+{
+	memset(stream, 0, sizeof(*stream));
+
+	status_t status;
+	switch (config.source) {
+		case VIRTUAL_CAM_YUY2:
+			status = build_yuy2(stream, config.width, config.height);
+			break;
+		case VIRTUAL_CAM_MJPEG:
+			status = build_mjpeg(stream, config.width, config.height);
+			break;
+		case VIRTUAL_CAM_REPLAY:
+			status = build_replay(stream, config);
+			break;
+		default:
+			status = B_BAD_VALUE;
+			break;
+	}
+	if (status == B_OK) {
+		if (config.source != VIRTUAL_CAM_REPLAY) {
+			stream->width = config.width;
+			stream->height = config.height;
+		}
+		if (config.fps > 0)
+			stream->fps = config.fps;
+		stream_index_frames(stream);
+		if (stream->frame_count == 0)
+			status = B_BAD_DATA;
+	}
+
+	if (status != B_OK)
+		virtual_cam_stream_free(stream);
+	return status;
+}
+
+
+void
+virtual_cam_stream_free(virtual_cam_stream* stream)
+{
+	free(stream->data);
+	free(stream->packets);
+	free(stream->frame_starts);
+	memset(stream, 0, sizeof(*stream));
+}
+
+
+void
+virtual_cam_stream_frame(const virtual_cam_stream& stream, int32 frame,
+	int32* first, int32* count)
+{
+	*first = stream.frame_starts[frame];
+	int32 end = frame + 1 < stream.frame_count
+		? stream.frame_starts[frame + 1] : stream.packet_count;
+	*count = end - *first;
+}
+
+
+void
+virtual_cam_stream_stamp(virtual_cam_stream* stream, int32 first,
+	int32 count, uint32 pts, uint32 stc, uint16 sof)
+{
+	for (int32 i = first; i < first + count; i++) {
+		uint8* header = stream->data + i * stream->slot_size;
+		size_t headerLength = header[0];
+		if ((size_t)stream->packets[i].actual_length < headerLength
+			|| headerLength < 2)
+			continue;
+
+		size_t offset = 2;
+		if ((header[1] & kHeaderPTS) != 0) {
+			if (offset + 4 > headerLength)
+				continue;
+			memcpy(header + offset, &pts, 4);
+			offset += 4;
+		}
+		if ((header[1] & kHeaderSCR) != 0 && offset + 6 <= headerLength) {
+			memcpy(header + offset, &stc, 4);
+			memcpy(header + offset + 4, &sof, 2);
+		}
+	}
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * What a virtual camera sends: its configuration and its packet stream.
+ */
+#ifndef _VIRTUAL_CAM_SOURCE_H
+#define _VIRTUAL_CAM_SOURCE_H
+
+
+#include <SupportDefs.h>
+#include <USB3.h>
+
+
+// =============================================================================
+// Configuration
+// =============================================================================
+// WEBCAM_VIRTUAL lists the virtual cameras, separated by ';':
+//
+//   yuy2:640x480@30           a moving test pattern, uncompressed
+//   mjpeg:1920x1080@60        the same pattern, JPEG compressed
+//   replay:/path/capture      a WEBCAM_CAPTURE file of an isochronous
+//                             camera, in a loop, at the rate and size it
+//                             was recorded with
+//   4*mjpeg:1280x720@30       four cameras alike
+//
+// The rate may be left out (30 fps); replay takes one after its path too.
+
+#define VIRTUAL_CAM_MAX_CAMERAS	16
+#define VIRTUAL_CAM_MAX_WIDTH	1920
+#define VIRTUAL_CAM_MAX_HEIGHT	1080
+#define VIRTUAL_CAM_MAX_FPS		120
+
+enum virtual_cam_source {
+	VIRTUAL_CAM_YUY2 = 0,
+	VIRTUAL_CAM_MJPEG,
+	VIRTUAL_CAM_REPLAY
+};
+
+struct virtual_cam_config {
+	virtual_cam_source	source;
+	uint32				width;		// 0 for a replay: as recorded
+	uint32				height;
+	float				fps;		// 0 for a replay: as recorded
+	char				path[256];	// of a replay
+};
+
+// Fills in up to 'maxConfigs' cameras from 'spec'; entries it cannot read
+// are logged and left out. Returns the number of cameras.
+int32	virtual_cam_parse_config(const char* spec,
+			virtual_cam_config* configs, int32 maxConfigs);
+
+// "MJPEG 1920x1080@60" and the like, for names and logs
+void	virtual_cam_describe(const virtual_cam_config& config, char* buffer,
+			size_t size);
+
+
+// =============================================================================
+// Packet Stream
+// =============================================================================
+// The packets of a few frames, built once and sent in a loop so the load a
+// virtual camera puts on the machine is the pipeline's, not the pattern
+// generator's. Packet i lies at data + i * slot_size, as an isochronous
+// transfer leaves it, with a descriptor the deframer's WritePackets() takes.
+// Synthetic frames go in 3072 byte high-bandwidth packets with PTS and SCR,
+// like a camera cuts them.
+
+struct virtual_cam_stream {
+	uint8*						data;
+	usb_iso_packet_descriptor*	packets;
+	size_t						slot_size;
+	int32						packet_count;
+	int32*						frame_starts;	// first packet of each frame
+	int32						frame_count;
+	uint32						fourcc;			// 'YUY2' or 'MJPG'
+	uint32						width;
+	uint32						height;
+	float						fps;
+};
+
+// B_OK, or why there is no stream: no memory, an unreadable capture, one
+// without isochronous video or in a format other than YUY2 or MJPEG
+status_t	virtual_cam_stream_build(virtual_cam_stream* stream,
+				const virtual_cam_config& config);
+void		virtual_cam_stream_free(virtual_cam_stream* stream);
+
+// Packets of frame 'frame': [*first, *first + *count)
+void		virtual_cam_stream_frame(const virtual_cam_stream& stream,
+				int32 frame, int32* first, int32* count);
+
+// Rewrites the PTS and SCR of 'count' packets from 'first', where their
+// headers have them, so a replay keeps the clock of the running machine
+// (device clock 'pts' when the frame started, 'stc' and USB frame 'sof'
+// now)
+void		virtual_cam_stream_stamp(virtual_cam_stream* stream, int32 first,
+				int32 count, uint32 pts, uint32 stc, uint16 sof);
+
+
+#endif /* _VIRTUAL_CAM_SOURCE_H */
@@ -0,0 +1,723 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Micro-benchmarks for the driver's hot loops
+ *
+ * Links the production sources and times their kernels one at a time, on
+ * the main thread, with nothing else in the loop:
+ *
+ *   yuy2_rgb32   YUY2 -> RGB32 frame conversion, per kernel the CPU has
+ *   yuv422       the other stream formats and destinations, per kernel
+ *   nv12         NV12 through the best YUYV -> RGB32 kernel
+ *   jpeg_index   cam_jpeg_index_update() over a frame, in payload steps
+ *   find_tags    CamDeframer::FindTags() over a payload without a match
+ *   frame_pool   CamDeframer AllocFrame() + RecycleFrame(), heap and arena
+ *   ring_index   RingBufferIndex write + read, as the frame queue uses it
+ *   audio        every AudioDSP kernel set, and the resampler
+ *
+ * Each benchmark is run for a few warmup batches, then timed over a number
+ * of repetitions, each a batch of at least 2 ms. Reported per unit (output
+ * pixel, byte, operation, sample or frame): the median, the fastest and the
+ * 90th percentile repetition, and the spread (p90 - min) / median.
+ *
+ * Baselines: --save writes the medians to a file, --compare reads one and
+ * fails (exit 1) if a benchmark's median is more than --tolerance percent
+ * (default 10) slower than its baseline. Benchmarks missing from the
+ * baseline are reported and pass. Baselines only compare on the machine
+ * they were saved on.
+ *
+ * Build:
+ *   make bench-kernels [BENCH_KERNEL_ARGS="--filter yuy2"]
+ *   make bench-kernels-baseline      saves tests/kernel_baseline.txt
+ *   make bench-kernels-compare       compares against it
+ * or
+ *   g++ -O2 -I.. -I../addons/uvc -o bench_kernels bench_kernels.cpp \
+ *       ../AudioDSP.cpp ../CamDeframer.cpp ../CamDebug.cpp \
+ *       ../CamFilterInterface.cpp ../CamFrameArena.cpp ../CamJpegIndex.cpp \
+ *       ../CamTagSearch.cpp ../addons/uvc/UVCColorConvert.cpp -lbe
+ *
+ * Run:
+ *   ./bench_kernels [--filter text] [--reps N] [--quick]
+ *                   [--save file | --compare file [--tolerance percent]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <OS.h>
+
+#include "AudioDSP.h"
+#include "CamDeframer.h"
+#include "CamFrameArena.h"
+#include "CamJpegIndex.h"
+#include "CamUtils.h"
+#include "UVCColorConvert.h"
+
+
+// =============================================================================
+// Measurement
+// =============================================================================
+
+static const int32 kMaxRepetitions = 101;
+static const int32 kWarmupBatches = 3;
+static const bigtime_t kBatchTime = 2000;		// us, at least
+static const int32 kMaxResults = 256;
+
+// Runs the benchmark 'iterations' times
+typedef void (*bench_body)(void* cookie, int32 iterations);
+
+struct bench_result {
+	char	name[64];
+	double	median;			// ns per unit
+	double	min;
+	double	p90;
+	double	spread;
+};
+
+struct bench_options {
+	const char*	filter;
+	int32		repetitions;
+	bigtime_t	batchTime;
+};
+
+static bench_options sOptions = { NULL, 15, kBatchTime };
+static bench_result sResults[kMaxResults];
+static int32 sResultCount = 0;
+
+// Keeps results of loops that would otherwise be optimized away
+static volatile uint32 sSink;
+
+
+static int
+compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+/* Times 'body', 'units' units of work per iteration, unless the filter
+ * leaves it out */
+static void
+measure(const char* name, const char* unit, double units, bench_body body,
+	void* cookie)
+{
+	if (sOptions.filter != NULL && strstr(name, sOptions.filter) == NULL)
+		return;
+	if (sResultCount == kMaxResults)
+		return;
+
+	// Calibrate: grow the iterations until a batch takes long enough
+	int32 iterations = 1;
+	for (;;) {
+		bigtime_t start = system_time();
+		body(cookie, iterations);
+		bigtime_t elapsed = system_time() - start;
+		if (elapsed >= sOptions.batchTime || iterations >= (1 << 24))
+			break;
+		int32 factor = elapsed > 0
+			? (int32)(sOptions.batchTime / elapsed) + 1 : 16;
+		iterations *= factor < 2 ? 2 : factor > 16 ? 16 : factor;
+	}
+
+	for (int32 i = 0; i < kWarmupBatches; i++)
+		body(cookie, iterations);
+
+	double samples[kMaxRepetitions];
+	int32 repetitions = sOptions.repetitions;
+	for (int32 i = 0; i < repetitions; i++) {
+		bigtime_t start = system_time();
+		body(cookie, iterations);
+		bigtime_t elapsed = system_time() - start;
+		samples[i] = elapsed * 1000.0 / ((double)iterations * units);
+	}
+	qsort(samples, repetitions, sizeof(double), compare_doubles);
+
+	bench_result& result = sResults[sResultCount++];
+	strlcpy(result.name, name, sizeof(result.name));
+	result.median = samples[repetitions / 2];
+	result.min = samples[0];
+	result.p90 = samples[(repetitions * 9) / 10 < repetitions
+		? (repetitions * 9) / 10 : repetitions - 1];
+	result.spread = result.median > 0
+		? (result.p90 - result.min) / result.median : 0;
+
+	printf("%-44s %10.3f %10.3f %10.3f %6.1f%%  ns/%s\n", result.name,
+		result.median, result.min, result.p90, result.spread * 100, unit);
+}
+
+
+// =============================================================================
+// Test Data
+// =============================================================================
+
+struct bench_resolution {
+	int32	width;
+	int32	height;
+};
+
+static const bench_resolution kResolutions[] = {
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 }
+};
+
+static const int32 kResolutionCount
+	= sizeof(kResolutions) / sizeof(kResolutions[0]);
+
+static const size_t kPayloadSize = 3072;
+
+
+static void
+fill_random(uint8* data, size_t size, uint32 seed)
+{
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = (uint8)(seed >> 16);
+	}
+}
+
+
+/* A 4:2:2 baseline JPEG of about 'size' bytes: headers, then entropy data
+ * with stuffed bytes and a restart marker every 4 KB, then EOI */
+static size_t
+build_jpeg(uint8* out, size_t size)
+{
+	static const uint8 header[] = {
+		0xff, 0xd8,
+		0xff, 0xdb, 0x00, 0x43, 0x00,
+	};
+	size_t pos = 0;
+	memcpy(out, header, sizeof(header));
+	pos += sizeof(header);
+	memset(out + pos, 1, 64);
+	pos += 64;
+
+	static const uint8 frame[] = {
+		0xff, 0xc0, 0x00, 0x11, 0x08, 0x02, 0xd0, 0x05, 0x00, 0x03,
+		0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+		0xff, 0xdd, 0x00, 0x04, 0x00, 0x50,
+		0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11,
+		0x00, 0x3f, 0x00
+	};
+	memcpy(out + pos, frame, sizeof(frame));
+	pos += sizeof(frame);
+
+	uint32 seed = 4711;
+	int32 restart = 0;
+	while (pos + 4 < size) {
+		seed = seed * 1103515245 + 12345;
+		uint8 value = (uint8)(seed >> 16);
+		out[pos++] = value;
+		if (value == 0xff)
+			out[pos++] = 0x00;
+		if (pos % 4096 == 0) {
+			out[pos++] = 0xff;
+			out[pos++] = (uint8)(0xd0 + (restart++ & 7));
+		}
+	}
+	out[pos++] = 0xff;
+	out[pos++] = 0xd9;
+	return pos;
+}
+
+
+// =============================================================================
+// Colour Conversion
+// =============================================================================
+
+struct convert_job {
+	const yuy2_rgb32_kernel*	yuy2;		// NULL: use 'kernel'
+	yuv422_rgb_kernel			kernel;
+	bool						nv12;
+	const uint8*				src;
+	size_t						srcSize;
+	uint8*						dst;
+	int32						width;
+	int32						height;
+};
+
+
+static void
+convert_body(void* cookie, int32 iterations)
+{
+	convert_job* job = (convert_job*)cookie;
+	for (int32 i = 0; i < iterations; i++) {
+		if (job->yuy2 != NULL) {
+			yuy2_to_rgb32_frame(job->yuy2, job->dst, job->src, job->srcSize,
+				job->width, job->height);
+		} else if (job->nv12) {
+			nv12_to_rgb_frame(job->kernel, job->dst, job->src, job->srcSize,
+				job->width, job->height);
+		} else {
+			yuv422_to_rgb_frame(job->kernel, job->dst, job->src,
+				job->srcSize, job->width, job->height);
+		}
+	}
+}
+
+
+static const char*
+destination_name(color_space destination)
+{
+	switch (destination) {
+		case B_RGB32:
+			return "rgb32";
+		case B_RGB24:
+			return "rgb24";
+		case B_RGB16:
+			return "rgb16";
+		default:
+			return "other";
+	}
+}
+
+
+static void
+bench_conversion()
+{
+	static const yuv422_format kFormats[] = {
+		{ YUV422_YUYV, YUV_MATRIX_BT601, YUV_RANGE_LIMITED, B_RGB24 },
+		{ YUV422_YUYV, YUV_MATRIX_BT601, YUV_RANGE_LIMITED, B_RGB16 },
+		{ YUV422_UYVY, YUV_MATRIX_BT709, YUV_RANGE_FULL, B_RGB32 }
+	};
+
+	for (int32 r = 0; r < kResolutionCount; r++) {
+		int32 width = kResolutions[r].width;
+		int32 height = kResolutions[r].height;
+		size_t srcSize = (size_t)width * height * 2;
+		uint8* src = (uint8*)malloc(srcSize);
+		uint8* dst = (uint8*)malloc((size_t)width * height * 4);
+		if (src == NULL || dst == NULL) {
+			free(src);
+			free(dst);
+			continue;
+		}
+		fill_random(src, srcSize, width);
+		double pixels = (double)width * height;
+		char name[64];
+
+		convert_job job;
+		memset(&job, 0, sizeof(job));
+		job.src = src;
+		job.srcSize = srcSize;
+		job.dst = dst;
+		job.width = width;
+		job.height = height;
+
+		const yuy2_rgb32_kernel* kernels[8];
+		int32 count = yuy2_rgb32_available_kernels(kernels, 8);
+		for (int32 i = 0; i < count; i++) {
+			job.yuy2 = kernels[i];
+			snprintf(name, sizeof(name), "yuy2_rgb32/%s/%dx%d",
+				kernels[i]->name, (int)width, (int)height);
+			measure(name, "px", pixels, convert_body, &job);
+		}
+		job.yuy2 = NULL;
+
+		for (size_t f = 0; f < sizeof(kFormats) / sizeof(kFormats[0]); f++) {
+			const yuv422_format& format = kFormats[f];
+			yuv422_rgb_kernel formatKernels[8];
+			count = yuv422_rgb_available_kernels(format, formatKernels, 8);
+			for (int32 i = 0; i < count; i++) {
+				job.kernel = formatKernels[i];
+				snprintf(name, sizeof(name), "yuv422/%s-%s-%s/%s/%dx%d",
+					format.layout == YUV422_UYVY ? "uyvy" : "yuyv",
+					yuv_matrix_name(format.matrix),
+					destination_name(format.destination),
+					formatKernels[i].name, (int)width, (int)height);
+				measure(name, "px", pixels, convert_body, &job);
+			}
+		}
+
+		yuv422_format nv12 = { YUV422_YUYV, YUV_MATRIX_BT601,
+			YUV_RANGE_LIMITED, B_RGB32 };
+		if (yuv422_rgb_best_kernel(nv12, &job.kernel)) {
+			job.nv12 = true;
+			job.srcSize = nv12_frame_size(width, height);
+			snprintf(name, sizeof(name), "nv12/%s/%dx%d", job.kernel.name,
+				(int)width, (int)height);
+			measure(name, "px", pixels, convert_body, &job);
+		}
+
+		free(src);
+		free(dst);
+	}
+}
+
+
+// =============================================================================
+// Deframer
+// =============================================================================
+
+// Exposes the deframer's protected parts to the benchmarks
+class BenchDeframer : public CamDeframer {
+public:
+	BenchDeframer() : CamDeframer(NULL) {}
+
+	using CamDeframer::FindTags;
+	using CamDeframer::AllocFrame;
+};
+
+
+struct jpeg_job {
+	const uint8*	frame;
+	size_t			size;
+};
+
+
+static void
+jpeg_index_body(void* cookie, int32 iterations)
+{
+	jpeg_job* job = (jpeg_job*)cookie;
+	for (int32 i = 0; i < iterations; i++) {
+		cam_jpeg_index index;
+		cam_jpeg_index_reset(&index);
+		// Updated as each payload lands, like the deframer does
+		for (size_t length = kPayloadSize; ; length += kPayloadSize) {
+			if (length > job->size)
+				length = job->size;
+			cam_jpeg_index_update(&index, job->frame, length);
+			if (length == job->size)
+				break;
+		}
+		sSink += index.restart_count;
+	}
+}
+
+
+struct tags_job {
+	BenchDeframer*	deframer;
+	const uint8*	payload;
+	const uint8*	tags[2];
+};
+
+
+static void
+find_tags_body(void* cookie, int32 iterations)
+{
+	tags_job* job = (tags_job*)cookie;
+	for (int32 i = 0; i < iterations; i++) {
+		sSink += job->deframer->FindTags(job->payload, kPayloadSize,
+			job->tags, 2, 4, 0);
+	}
+}
+
+
+static void
+frame_pool_body(void* cookie, int32 iterations)
+{
+	BenchDeframer* deframer = (BenchDeframer*)cookie;
+	for (int32 i = 0; i < iterations; i++) {
+		CamFrame* frame = deframer->AllocFrame();
+		if (frame != NULL)
+			deframer->RecycleFrame(frame);
+	}
+}
+
+
+static void
+ring_index_body(void* cookie, int32 iterations)
+{
+	RingBufferIndex* ring = (RingBufferIndex*)cookie;
+	for (int32 i = 0; i < iterations; i++) {
+		int32 slot = ring->ReserveWrite();
+		ring->CommitWrite();
+		slot += ring->ReserveRead();
+		ring->CommitRead();
+		sSink += slot;
+	}
+}
+
+
+static void
+bench_deframer()
+{
+	char name[64];
+
+	static const size_t kJpegSizes[] = { 64 * 1024, 256 * 1024 };
+	uint8* frame = (uint8*)malloc(kJpegSizes[1] + 4096);
+	if (frame != NULL) {
+		for (size_t i = 0; i < sizeof(kJpegSizes) / sizeof(kJpegSizes[0]);
+				i++) {
+			jpeg_job job = { frame, build_jpeg(frame, kJpegSizes[i]) };
+			snprintf(name, sizeof(name), "jpeg_index/%zuk",
+				kJpegSizes[i] / 1024);
+			measure(name, "byte", job.size, jpeg_index_body, &job);
+		}
+		free(frame);
+	}
+
+	BenchDeframer deframer;
+
+	// Tags that almost match, so the compare runs, but never do
+	static const uint8 kTag0[] = { 0xff, 0xff, 0x00, 0x01 };
+	static const uint8 kTag1[] = { 0xff, 0xfe, 0x00, 0x02 };
+	uint8 payload[kPayloadSize];
+	for (size_t i = 0; i < kPayloadSize; i++)
+		payload[i] = (i & 1) != 0 ? 0xff : (uint8)i;
+	tags_job tags = { &deframer, payload, { kTag0, kTag1 } };
+	measure("find_tags/3072", "byte", kPayloadSize, find_tags_body, &tags);
+
+	measure("frame_pool/heap", "op", 1, frame_pool_body, &deframer);
+
+	CamFrameArena arena("bench arena");
+	size_t slotSize = 640 * 480 * 2;
+	int32 slotCount = 10;
+	BenchDeframer arenaDeframer;
+	if (arena.SetLayout(&slotSize, &slotCount, 1) == B_OK
+		&& arenaDeframer.SetFrameArena(&arena, 0) == B_OK)
+		measure("frame_pool/arena", "op", 1, frame_pool_body, &arenaDeframer);
+	arenaDeframer.SetFrameArena(NULL, 0);
+
+	RingBufferIndex ring(CAMDEFRAMER_MAX_QUEUED_FRAMES + 1);
+	measure("ring_index/write_read", "op", 1, ring_index_body, &ring);
+}
+
+
+// =============================================================================
+// Audio
+// =============================================================================
+
+static const int32 kAudioFrames = 480;		// 10 ms at 48 kHz
+
+struct audio_job {
+	const audio_dsp_kernels*	kernels;
+	AudioResampler*				resampler;
+	int16*						s16;
+	int16*						s16Out;
+	float*						input;
+	float*						output;
+};
+
+
+static void
+audio_s16_to_float_body(void* cookie, int32 iterations)
+{
+	audio_job* job = (audio_job*)cookie;
+	for (int32 i = 0; i < iterations; i++)
+		job->kernels->s16_to_float(job->input, job->s16, kAudioFrames * 2,
+			1.0f / 32768);
+}
+
+
+static void
+audio_float_to_s16_body(void* cookie, int32 iterations)
+{
+	audio_job* job = (audio_job*)cookie;
+	for (int32 i = 0; i < iterations; i++)
+		job->kernels->float_to_s16(job->s16Out, job->input, kAudioFrames * 2);
+}
+
+
+static void
+audio_gain_body(void* cookie, int32 iterations)
+{
+	audio_job* job = (audio_job*)cookie;
+	for (int32 i = 0; i < iterations; i++)
+		job->kernels->s16_gain(job->s16Out, job->s16, kAudioFrames * 2, 0.8f);
+}
+
+
+static void
+audio_mono_to_stereo_body(void* cookie, int32 iterations)
+{
+	audio_job* job = (audio_job*)cookie;
+	for (int32 i = 0; i < iterations; i++)
+		job->kernels->mono_to_stereo(job->output, job->input, kAudioFrames);
+}
+
+
+static void
+audio_resample_body(void* cookie, int32 iterations)
+{
+	audio_job* job = (audio_job*)cookie;
+	for (int32 i = 0; i < iterations; i++) {
+		int32 inputFrames = job->resampler->InputFramesFor(kAudioFrames);
+		if (inputFrames > kAudioFrames * 2)
+			inputFrames = kAudioFrames * 2;
+		job->resampler->Process(job->input, inputFrames, job->output,
+			kAudioFrames);
+	}
+}
+
+
+static void
+bench_audio()
+{
+	int16 s16[kAudioFrames * 2];
+	int16 s16Out[kAudioFrames * 2];
+	float input[kAudioFrames * 4];
+	float output[kAudioFrames * 4];
+	for (int32 i = 0; i < kAudioFrames * 2; i++)
+		s16[i] = (int16)(sinf(i * 0.05f) * 20000);
+	for (int32 i = 0; i < kAudioFrames * 4; i++)
+		input[i] = sinf(i * 0.03f) * 0.6f;
+
+	audio_job job = { NULL, NULL, s16, s16Out, input, output };
+	char name[64];
+
+	const audio_dsp_kernels* kernels[8];
+	int32 count = audio_dsp_available_kernels(kernels, 8);
+	for (int32 i = 0; i < count; i++) {
+		job.kernels = kernels[i];
+		snprintf(name, sizeof(name), "audio/s16_to_float/%s", kernels[i]->name);
+		measure(name, "sample", kAudioFrames * 2, audio_s16_to_float_body,
+			&job);
+		snprintf(name, sizeof(name), "audio/float_to_s16/%s", kernels[i]->name);
+		measure(name, "sample", kAudioFrames * 2, audio_float_to_s16_body,
+			&job);
+		snprintf(name, sizeof(name), "audio/s16_gain/%s", kernels[i]->name);
+		measure(name, "sample", kAudioFrames * 2, audio_gain_body, &job);
+		snprintf(name, sizeof(name), "audio/mono_to_stereo/%s",
+			kernels[i]->name);
+		measure(name, "frame", kAudioFrames, audio_mono_to_stereo_body, &job);
+	}
+
+	AudioResampler resampler;
+	if (resampler.SetRates(48000, 44100, 2) == B_OK) {
+		job.resampler = &resampler;
+		measure("audio/resample/48000-44100", "frame", kAudioFrames,
+			audio_resample_body, &job);
+	}
+}
+
+
+// =============================================================================
+// Baselines
+// =============================================================================
+
+static bool
+save_baseline(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "cannot write %s\n", path);
+		return false;
+	}
+	fprintf(file, "# bench_kernels medians, ns per unit\n");
+	for (int32 i = 0; i < sResultCount; i++)
+		fprintf(file, "%s %.4f\n", sResults[i].name, sResults[i].median);
+	fclose(file);
+	printf("\nBaseline of %d benchmarks saved to %s\n", (int)sResultCount,
+		path);
+	return true;
+}
+
+
+/* Exit status: 0 if nothing regressed */
+static int
+compare_baseline(const char* path, double tolerance)
+{
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "cannot read %s\n", path);
+		return 1;
+	}
+
+	printf("\n%-44s %10s %10s %8s\n", "compared to baseline", "baseline",
+		"now", "change");
+
+	bool found[kMaxResults];
+	memset(found, 0, sizeof(found));
+	int32 regressions = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char name[64];
+		double baseline;
+		if (line[0] == '#' || sscanf(line, "%63s %lf", name, &baseline) != 2
+			|| baseline <= 0)
+			continue;
+		for (int32 i = 0; i < sResultCount; i++) {
+			if (strcmp(sResults[i].name, name) != 0)
+				continue;
+			found[i] = true;
+			double change = sResults[i].median / baseline - 1;
+			bool regressed = change * 100 > tolerance;
+			if (regressed)
+				regressions++;
+			printf("%-44s %10.3f %10.3f %+7.1f%%%s\n", name, baseline,
+				sResults[i].median, change * 100,
+				regressed ? "  REGRESSED" : "");
+		}
+	}
+	fclose(file);
+
+	for (int32 i = 0; i < sResultCount; i++) {
+		if (!found[i])
+			printf("%-44s %10s %10.3f      new\n", sResults[i].name, "-",
+				sResults[i].median);
+	}
+
+	printf("\n%d regression(s) beyond %.0f%%\n", (int)regressions, tolerance);
+	return regressions > 0 ? 1 : 0;
+}
+
+
+static void
+usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [--filter text] [--reps N] [--quick]\n"
+		"       [--save file | --compare file [--tolerance percent]]\n",
+		name);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	const char* savePath = NULL;
+	const char* comparePath = NULL;
+	double tolerance = 10;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			sOptions.filter = argv[++i];
+		else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+			sOptions.repetitions = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--quick") == 0) {
+			sOptions.repetitions = 5;
+			sOptions.batchTime = kBatchTime / 4;
+		} else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+			savePath = argv[++i];
+		else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+			comparePath = argv[++i];
+		else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+			tolerance = atof(argv[++i]);
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (sOptions.repetitions < 1 || sOptions.repetitions > kMaxRepetitions
+		|| tolerance < 0 || (savePath != NULL && comparePath != NULL)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	gYuvRgbTables.Initialize();
+
+	printf("=== Kernel Micro-Benchmarks ===\n\n");
+	printf("%d repetitions of %lld us batches after %d warmup batches\n\n",
+		(int)sOptions.repetitions, sOptions.batchTime, (int)kWarmupBatches);
+	printf("%-44s %10s %10s %10s %7s\n", "benchmark", "median", "min", "p90",
+		"spread");
+
+	bench_conversion();
+	bench_deframer();
+	bench_audio();
+
+	if (sResultCount == 0) {
+		fprintf(stderr, "no benchmark matches the filter\n");
+		return 1;
+	}
+	if (savePath != NULL)
+		return save_baseline(savePath) ? 0 : 1;
+	if (comparePath != NULL)
+		return compare_baseline(comparePath, tolerance);
+	return 0;
+}
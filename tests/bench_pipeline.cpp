@@ -0,0 +1,894 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Replay benchmark for the capture pipeline
+ *
+ * Feeds UVC payload packets through the driver's UVCDeframer and then the
+ * YUY2 or MJPEG -> RGB32 conversion the producer uses, as fast as the CPU
+ * allows, and reports per format and resolution:
+ *
+ *   fps          frames through deframer + conversion per second
+ *   ns/px        total, deframe and conversion time per output pixel
+ *   copy KB/f    payload copied into deframer frames, per frame
+ *   out KB/f     RGB32 written by the conversion, per frame
+ *   allocs/f     heap allocations per frame once warmed up: operator new
+ *                calls plus storage growth of heap frames (allocations made
+ *                inside libturbojpeg are not seen)
+ *
+ * Without arguments every format is run at every resolution in the table
+ * below, on a synthetic stream: a moving test pattern cut into 3072 byte
+ * high-bandwidth packets with 12 byte PTS/SCR headers and a toggling FID,
+ * JPEG compressed (4:2:2) first for MJPEG.
+ *
+ * Packets go to the deframer a transfer of 32 at a time through
+ * WritePackets(), laid out in slots as the controller leaves them, or one
+ * Write() each with --per-packet. --bulk puts them back to back in bulk
+ * transfers of 32 payloads for WriteBulk(), a transfer ending short at the
+ * end of a frame.
+ *
+ * A recorded stream is replayed with --replay: a WEBCAM_CAPTURE file (see
+ * CamCapture.h), whose stream record gives format and size, or a sequence
+ * of packets, each a little-endian uint32 length followed by the packet as
+ * it came off the wire, UVC header included.
+ *
+ * Build:
+ *   make benchmark [BENCH_ARGS="--frames 300"]
+ * or
+ *   g++ -O2 -I.. -I../addons/uvc -o bench_pipeline bench_pipeline.cpp \
+ *       ../CamDeframer.cpp ../CamDebug.cpp ../CamFilterInterface.cpp \
+ *       ../CamFrameArena.cpp ../CamJpegIndex.cpp ../CamTagSearch.cpp \
+ *       ../addons/uvc/UVCDeframer.cpp \
+ *       ../addons/uvc/UVCClock.cpp ../addons/uvc/UVCColorConvert.cpp \
+ *       ../addons/uvc/UVCMJPEGDecode.cpp -lbe -lturbojpeg
+ *
+ * Run:
+ *   ./bench_pipeline [--frames N] [--heap] [--per-packet | --bulk]
+ *   ./bench_pipeline --replay capture [--format yuy2|mjpeg --size WxH]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <OS.h>
+
+#include <turbojpeg.h>
+
+#include "CamCapture.h"
+#include "CamFrameArena.h"
+#include "UVCColorConvert.h"
+#include "UVCDeframer.h"
+#include "UVCMJPEGDecode.h"
+
+
+// =============================================================================
+// Allocation Counting
+// =============================================================================
+// Everything runs on the main thread, so a plain counter will do.
+
+static int64 sAllocations = 0;
+
+void*
+operator new(size_t size)
+{
+	sAllocations++;
+	void* memory = malloc(size > 0 ? size : 1);
+	if (memory == NULL)
+		throw std::bad_alloc();
+	return memory;
+}
+
+
+void*
+operator new[](size_t size)
+{
+	sAllocations++;
+	void* memory = malloc(size > 0 ? size : 1);
+	if (memory == NULL)
+		throw std::bad_alloc();
+	return memory;
+}
+
+
+void*
+operator new(size_t size, const std::nothrow_t&) throw()
+{
+	sAllocations++;
+	return malloc(size > 0 ? size : 1);
+}
+
+
+void*
+operator new[](size_t size, const std::nothrow_t&) throw()
+{
+	sAllocations++;
+	return malloc(size > 0 ? size : 1);
+}
+
+
+void operator delete(void* memory) throw() { free(memory); }
+void operator delete[](void* memory) throw() { free(memory); }
+
+
+// Heap frames grow with realloc(); seen as a changed capacity
+struct frame_capacity {
+	const CamFrame*	frame;
+	size_t			capacity;
+};
+
+static frame_capacity sFrameCapacities[64];
+static int32 sFrameCapacityCount = 0;
+
+
+static void
+note_frame_storage(const CamFrame* frame)
+{
+	if (frame->Arena() != NULL)
+		return;
+
+	for (int32 i = 0; i < sFrameCapacityCount; i++) {
+		if (sFrameCapacities[i].frame == frame) {
+			if (sFrameCapacities[i].capacity != frame->Capacity()) {
+				sFrameCapacities[i].capacity = frame->Capacity();
+				sAllocations++;
+			}
+			return;
+		}
+	}
+
+	if (sFrameCapacityCount < 64) {
+		sFrameCapacities[sFrameCapacityCount].frame = frame;
+		sFrameCapacities[sFrameCapacityCount].capacity = frame->Capacity();
+		sFrameCapacityCount++;
+	}
+	sAllocations++;
+}
+
+
+// =============================================================================
+// Packet Streams
+// =============================================================================
+
+enum bench_format {
+	BENCH_YUY2 = 0,
+	BENCH_MJPEG
+};
+
+static const char* const kFormatNames[] = { "YUY2", "MJPEG" };
+
+struct bench_resolution {
+	int32	width;
+	int32	height;
+};
+
+static const bench_resolution kResolutions[] = {
+	{ 160, 120 },
+	{ 320, 240 },
+	{ 640, 480 },
+	{ 800, 600 },
+	{ 1280, 720 },
+	{ 1920, 1080 }
+};
+
+static const int32 kResolutionCount
+	= sizeof(kResolutions) / sizeof(kResolutions[0]);
+
+// High-bandwidth isochronous packet, 3 x 1024 byte transactions
+static const size_t kPacketSize = 3072;
+static const size_t kHeaderSize = 12;
+// Distinct frames in a synthetic stream, replayed in a loop
+static const int32 kStreamFrames = 4;
+// Slots per raw frame class, as UVCCamDevice lays out its arena
+static const int32 kRawFrameSlots = 10;
+static const int32 kWarmupFrames = 8;
+// Packets per isochronous transfer, as the data pump queues them
+static const int32 kTransferPackets = 32;
+
+// How the replay hands packets to the deframer
+enum bench_feed {
+	BENCH_FEED_TRANSFERS = 0,	// WritePackets(), an ISO transfer at a time
+	BENCH_FEED_PACKETS,			// Write() per packet
+	BENCH_FEED_BULK				// WriteBulk(), as bulk transfers
+};
+
+static const char* const kFeedNames[] = {
+	"WritePackets() per transfer",
+	"one Write() per packet",
+	"WriteBulk() per bulk transfer"
+};
+
+
+struct packet_stream {
+	uint8*		data;
+	size_t		size;
+	size_t		capacity;
+	size_t*		offsets;		// start of each [length][packet] record
+	int32		count;
+	int32		allocated;
+};
+
+
+static bool
+stream_add(packet_stream& stream, const uint8* packet, uint32 length)
+{
+	if (stream.count == stream.allocated) {
+		int32 allocated = stream.allocated > 0 ? stream.allocated * 2 : 1024;
+		size_t* offsets = (size_t*)realloc(stream.offsets,
+			allocated * sizeof(size_t));
+		if (offsets == NULL)
+			return false;
+		stream.offsets = offsets;
+		stream.allocated = allocated;
+	}
+	if (stream.size + sizeof(uint32) + length > stream.capacity) {
+		size_t capacity = stream.capacity > 0 ? stream.capacity * 2 : 1 << 20;
+		while (capacity < stream.size + sizeof(uint32) + length)
+			capacity *= 2;
+		uint8* data = (uint8*)realloc(stream.data, capacity);
+		if (data == NULL)
+			return false;
+		stream.data = data;
+		stream.capacity = capacity;
+	}
+
+	stream.offsets[stream.count++] = stream.size;
+	memcpy(stream.data + stream.size, &length, sizeof(uint32));
+	memcpy(stream.data + stream.size + sizeof(uint32), packet, length);
+	stream.size += sizeof(uint32) + length;
+	return true;
+}
+
+
+static void
+stream_free(packet_stream& stream)
+{
+	free(stream.data);
+	free(stream.offsets);
+	memset(&stream, 0, sizeof(stream));
+}
+
+
+// The packets of a stream laid out in transfer buffers: packet i in slot i,
+// of the largest packet size, with the controller's packet descriptors
+struct transfer_stream {
+	uint8*						data;
+	usb_iso_packet_descriptor*	packets;
+	size_t						slotSize;
+	int32						count;
+};
+
+
+static bool
+build_transfers(transfer_stream& transfers, const packet_stream& stream)
+{
+	memset(&transfers, 0, sizeof(transfers));
+	for (int32 i = 0; i < stream.count; i++) {
+		uint32 length;
+		memcpy(&length, stream.data + stream.offsets[i], sizeof(length));
+		if (length > transfers.slotSize)
+			transfers.slotSize = length;
+	}
+
+	transfers.data = (uint8*)malloc(transfers.slotSize * stream.count);
+	transfers.packets = (usb_iso_packet_descriptor*)malloc(
+		sizeof(usb_iso_packet_descriptor) * stream.count);
+	if (transfers.data == NULL || transfers.packets == NULL) {
+		free(transfers.data);
+		free(transfers.packets);
+		return false;
+	}
+
+	for (int32 i = 0; i < stream.count; i++) {
+		const uint8* record = stream.data + stream.offsets[i];
+		uint32 length;
+		memcpy(&length, record, sizeof(length));
+		memcpy(transfers.data + i * transfers.slotSize,
+			record + sizeof(length), length);
+		transfers.packets[i].request_length = transfers.slotSize;
+		transfers.packets[i].actual_length = length;
+		transfers.packets[i].status = B_OK;
+	}
+	transfers.count = stream.count;
+	return true;
+}
+
+
+static void
+transfers_free(transfer_stream& transfers)
+{
+	free(transfers.data);
+	free(transfers.packets);
+	memset(&transfers, 0, sizeof(transfers));
+}
+
+
+// The packets of a stream as a bulk endpoint delivers them: payloads back
+// to back, kTransferPackets of the largest size per transfer, and a
+// transfer ending short after a payload that is
+struct bulk_stream {
+	uint8*		data;
+	size_t*		offsets;		// start of each transfer, and the end
+	size_t		payloadSize;
+	size_t		transferSize;
+	int32		count;
+};
+
+
+static bool
+build_bulk_transfers(bulk_stream& bulk, const packet_stream& stream)
+{
+	memset(&bulk, 0, sizeof(bulk));
+	size_t total = 0;
+	for (int32 i = 0; i < stream.count; i++) {
+		uint32 length;
+		memcpy(&length, stream.data + stream.offsets[i], sizeof(length));
+		if (length > bulk.payloadSize)
+			bulk.payloadSize = length;
+		total += length;
+	}
+	bulk.transferSize = bulk.payloadSize * kTransferPackets;
+
+	bulk.data = (uint8*)malloc(total);
+	bulk.offsets = (size_t*)malloc(sizeof(size_t) * (stream.count + 1));
+	if (bulk.data == NULL || bulk.offsets == NULL) {
+		free(bulk.data);
+		free(bulk.offsets);
+		return false;
+	}
+
+	size_t pos = 0;
+	size_t transferStart = 0;
+	bulk.offsets[0] = 0;
+	for (int32 i = 0; i < stream.count; i++) {
+		const uint8* record = stream.data + stream.offsets[i];
+		uint32 length;
+		memcpy(&length, record, sizeof(length));
+		memcpy(bulk.data + pos, record + sizeof(length), length);
+		pos += length;
+		if (length < bulk.payloadSize
+			|| pos - transferStart == bulk.transferSize) {
+			bulk.offsets[++bulk.count] = pos;
+			transferStart = pos;
+		}
+	}
+	if (pos > transferStart)
+		bulk.offsets[++bulk.count] = pos;
+	return true;
+}
+
+
+static void
+bulk_free(bulk_stream& bulk)
+{
+	free(bulk.data);
+	free(bulk.offsets);
+	memset(&bulk, 0, sizeof(bulk));
+}
+
+
+// Cuts one frame's payload into packets the way a camera sends it
+static bool
+packetize_frame(packet_stream& stream, const uint8* payload, size_t size,
+	int32 frameNumber, uint32* clock)
+{
+	uint8 packet[kPacketSize];
+	uint8 fid = frameNumber & 1;
+	uint32 pts = *clock;
+
+	for (size_t offset = 0; offset < size; ) {
+		size_t chunk = size - offset;
+		if (chunk > kPacketSize - kHeaderSize)
+			chunk = kPacketSize - kHeaderSize;
+		bool last = offset + chunk == size;
+
+		// EOH | SCR | PTS, EOF on the last packet
+		packet[0] = kHeaderSize;
+		packet[1] = 0x80 | 0x08 | 0x04 | (last ? 0x02 : 0) | fid;
+		memcpy(&packet[2], &pts, 4);
+		uint32 stc = *clock;
+		memcpy(&packet[6], &stc, 4);
+		packet[10] = 0;
+		packet[11] = 0;
+		memcpy(&packet[kHeaderSize], payload + offset, chunk);
+
+		if (!stream_add(stream, packet, kHeaderSize + chunk))
+			return false;
+
+		offset += chunk;
+		// 48 MHz device clock, one packet per 125 us microframe
+		*clock += 6000;
+	}
+	return true;
+}
+
+
+static void
+fill_pattern_yuy2(uint8* yuy2, int32 width, int32 height, int32 frameNumber)
+{
+	for (int32 y = 0; y < height; y++) {
+		uint8* row = yuy2 + (size_t)y * width * 2;
+		for (int32 x = 0; x < width; x += 2) {
+			row[x * 2] = (uint8)(x + y + frameNumber * 8);
+			row[x * 2 + 1] = (uint8)(128 + (x >> 3) - (y >> 4));
+			row[x * 2 + 2] = (uint8)(x + 1 + y + frameNumber * 8);
+			row[x * 2 + 3] = (uint8)(128 - (x >> 4) + (y >> 3));
+		}
+	}
+}
+
+
+static void
+fill_pattern_rgb32(uint8* bgra, int32 width, int32 height, int32 frameNumber)
+{
+	for (int32 y = 0; y < height; y++) {
+		uint8* row = bgra + (size_t)y * width * 4;
+		for (int32 x = 0; x < width; x++) {
+			row[x * 4] = (uint8)(x + frameNumber * 8);
+			row[x * 4 + 1] = (uint8)(y * 2);
+			row[x * 4 + 2] = (uint8)((x ^ y) + frameNumber * 4);
+			row[x * 4 + 3] = 255;
+		}
+	}
+}
+
+
+static bool
+build_synthetic_stream(packet_stream& stream, bench_format format,
+	int32 width, int32 height)
+{
+	uint32 clock = 0;
+	bool ok = true;
+
+	if (format == BENCH_YUY2) {
+		size_t size = (size_t)width * height * 2;
+		uint8* frame = (uint8*)malloc(size);
+		if (frame == NULL)
+			return false;
+		for (int32 i = 0; i < kStreamFrames && ok; i++) {
+			fill_pattern_yuy2(frame, width, height, i);
+			ok = packetize_frame(stream, frame, size, i, &clock);
+		}
+		free(frame);
+		return ok;
+	}
+
+	tjhandle compressor = tjInitCompress();
+	uint8* picture = (uint8*)malloc((size_t)width * height * 4);
+	if (compressor == NULL || picture == NULL) {
+		if (compressor != NULL)
+			tjDestroy(compressor);
+		free(picture);
+		return false;
+	}
+
+	for (int32 i = 0; i < kStreamFrames && ok; i++) {
+		fill_pattern_rgb32(picture, width, height, i);
+		unsigned char* jpeg = NULL;
+		unsigned long jpegSize = 0;
+		if (tjCompress2(compressor, picture, width, width * 4, height,
+				TJPF_BGRA, &jpeg, &jpegSize, TJSAMP_422, 85,
+				TJFLAG_FASTDCT) != 0) {
+			fprintf(stderr, "tjCompress2: %s\n", tjGetErrorStr2(compressor));
+			ok = false;
+		} else
+			ok = packetize_frame(stream, jpeg, jpegSize, i, &clock);
+		tjFree(jpeg);
+	}
+
+	free(picture);
+	tjDestroy(compressor);
+	return ok;
+}
+
+
+// The video packets of a WEBCAM_CAPTURE file, as the data pump hands them
+// to the deframer; the stream record fills in the format if not given
+static bool
+load_capture(packet_stream& stream, const uint8* base, size_t size,
+	int32* format, int* width, int* height)
+{
+	size_t offset = 0;
+	const cam_capture_record* record;
+	while ((record = cam_capture_next_record(base, size, &offset)) != NULL) {
+		if (record->stream != CAM_CAPTURE_VIDEO)
+			continue;
+
+		const uint8* data = cam_capture_data(record);
+		if (record->type == CAM_CAPTURE_STREAM_START) {
+			cam_capture_stream_info info;
+			if (record->data_size < sizeof(info))
+				continue;
+			memcpy(&info, data, sizeof(info));
+			if (*format < 0 && info.fourcc == 'YUY2')
+				*format = BENCH_YUY2;
+			else if (*format < 0 && info.fourcc == 'MJPG')
+				*format = BENCH_MJPEG;
+			if (*width <= 0 || *height <= 0) {
+				*width = info.width;
+				*height = info.height;
+			}
+			continue;
+		}
+
+		// Bulk: the whole transfer is one payload
+		if (record->packet_count == 0) {
+			if (record->data_size > 0
+				&& !stream_add(stream, data, record->data_size))
+				return false;
+			continue;
+		}
+
+		// ISO: failed and empty packets are skipped, like the pump does
+		const cam_capture_packet* packets = cam_capture_packets(record);
+		for (uint32 i = 0; i < record->packet_count; i++) {
+			uint32 length = packets[i].actual_length;
+			if (length > record->slot_size)
+				length = record->slot_size;
+			if (packets[i].status == B_OK && length > 0
+				&& !stream_add(stream, data, length))
+				return false;
+			data += length;
+		}
+	}
+	return true;
+}
+
+
+static bool
+load_recorded_stream(packet_stream& stream, const char* path, int32* format,
+	int* width, int* height)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	const uint8* base = NULL;
+	if (st.st_size > 0) {
+		void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED)
+			base = (const uint8*)mapped;
+	}
+	close(fd);
+	if (base == NULL) {
+		fprintf(stderr, "%s: cannot map the file\n", path);
+		return false;
+	}
+
+	size_t size = st.st_size;
+	bool ok;
+	if (size >= sizeof(cam_capture_file_header)
+		&& memcmp(base, CAM_CAPTURE_MAGIC, 8) == 0)
+		ok = load_capture(stream, base, size, format, width, height);
+	else {
+		// Length-prefixed packets
+		ok = true;
+		size_t offset = 0;
+		uint32 length;
+		while (ok && offset + sizeof(length) <= size) {
+			memcpy(&length, base + offset, sizeof(length));
+			offset += sizeof(length);
+			if (length == 0 || length > size - offset) {
+				fprintf(stderr, "%s: damaged record after %d packets\n", path,
+					(int)stream.count);
+				break;
+			}
+			ok = stream_add(stream, base + offset, length);
+			offset += length;
+		}
+	}
+
+	munmap((void*)base, size);
+	return ok && stream.count > 0;
+}
+
+
+// =============================================================================
+// Replay
+// =============================================================================
+
+struct bench_result {
+	int32		frames;
+	bigtime_t	total;
+	bigtime_t	convert;
+	uint64		copied;
+	uint64		written;
+	int64		allocations;
+	int32		failures;
+};
+
+
+struct bench_pipeline {
+	UVCDeframer*				deframer;
+	bench_format				format;
+	int32						width;
+	int32						height;
+	uint8*						output;
+	tjhandle					decompressor;
+	const yuy2_rgb32_kernel*	kernel;
+};
+
+
+static bool
+convert_frame(bench_pipeline& pipeline, CamFrame* frame, bench_result& result)
+{
+	const uint8* src = (const uint8*)frame->Buffer();
+	size_t size = frame->BufferLength();
+	result.copied += size;
+
+	bigtime_t start = system_time();
+	bool ok = true;
+	if (pipeline.format == BENCH_YUY2) {
+		yuy2_to_rgb32_frame(pipeline.kernel, pipeline.output, src, size,
+			pipeline.width, pipeline.height);
+	} else {
+		mjpeg_frame_info info;
+		ok = mjpeg_parse_frame(pipeline.decompressor, src, size,
+				pipeline.width, pipeline.height, &info, &frame->fJpegIndex)
+				== MJPEG_PARSE_OK
+			&& mjpeg_decode_rgb(pipeline.decompressor, info,
+				pipeline.output, pipeline.width, pipeline.height) == 0;
+	}
+	result.convert += system_time() - start;
+	result.written += (size_t)pipeline.width * pipeline.height * 4;
+	return ok;
+}
+
+
+// Replays 'stream' in a loop until 'frames' frames came out converted,
+// a transfer at a time if 'transfers' or 'bulk' is given
+static void
+replay(bench_pipeline& pipeline, const packet_stream& stream,
+	const transfer_stream* transfers, const bulk_stream* bulk, int32 frames,
+	bench_result& result)
+{
+	memset(&result, 0, sizeof(result));
+	int64 allocationsBefore = sAllocations;
+	uint32 completed = pipeline.deframer->GetStats().frames_completed;
+	int32 seenAtPassStart = 0;
+	bigtime_t start = system_time();
+
+	int32 step = transfers != NULL ? kTransferPackets : 1;
+	int32 units = bulk != NULL ? bulk->count : stream.count;
+	for (int32 packet = 0; result.frames < frames; packet += step) {
+		if (packet >= units) {
+			// A whole pass without a frame, the stream is unusable
+			if (result.frames + result.failures == seenAtPassStart)
+				break;
+			seenAtPassStart = result.frames + result.failures;
+			packet = 0;
+		}
+
+		if (transfers != NULL) {
+			int32 count = stream.count - packet < kTransferPackets
+				? stream.count - packet : kTransferPackets;
+			pipeline.deframer->WritePackets(
+				transfers->data + packet * transfers->slotSize,
+				transfers->slotSize, transfers->packets + packet, count);
+		} else if (bulk != NULL) {
+			size_t length = bulk->offsets[packet + 1] - bulk->offsets[packet];
+			pipeline.deframer->WriteBulk(bulk->data + bulk->offsets[packet],
+				length, length < bulk->transferSize);
+		} else {
+			const uint8* record = stream.data + stream.offsets[packet];
+			uint32 length;
+			memcpy(&length, record, sizeof(length));
+			pipeline.deframer->Write(record + sizeof(length), length);
+		}
+
+		// The producer would be woken here; only ask when one completed
+		uint32 nowCompleted = pipeline.deframer->GetStats().frames_completed;
+		if (nowCompleted == completed)
+			continue;
+		completed = nowCompleted;
+
+		while (pipeline.deframer->WaitFrame(0) == B_OK) {
+			CamFrame* frame;
+			bigtime_t stamp;
+			if (pipeline.deframer->GetFrame(&frame, &stamp) != B_OK)
+				break;
+			note_frame_storage(frame);
+			if (convert_frame(pipeline, frame, result))
+				result.frames++;
+			else
+				result.failures++;
+			pipeline.deframer->RecycleFrame(frame);
+		}
+	}
+
+	result.total = system_time() - start;
+	result.allocations = sAllocations - allocationsBefore;
+}
+
+
+static bool
+run(bench_format format, int32 width, int32 height,
+	const packet_stream& stream, int32 frames, bool useArena, bench_feed feed)
+{
+	bench_pipeline pipeline;
+	pipeline.format = format;
+	pipeline.width = width;
+	pipeline.height = height;
+	pipeline.kernel = yuy2_rgb32_best_kernel();
+	pipeline.output = (uint8*)malloc((size_t)width * height * 4);
+	pipeline.decompressor = format == BENCH_MJPEG ? tjInitDecompress() : NULL;
+	pipeline.deframer = new UVCDeframer(NULL);
+
+	// Set up like UVCCamDevice's StartTransfer
+	pipeline.deframer->SetExpectedFrameSize(
+		format == BENCH_YUY2 ? (size_t)width * height * 2 : 0);
+	pipeline.deframer->SetClockFrequency(48000000);
+
+	CamFrameArena arena("bench arena");
+	if (useArena) {
+		size_t size = (size_t)width * height * 2;
+		if (arena.SetLayout(&size, &kRawFrameSlots, 1) != B_OK
+			|| pipeline.deframer->SetFrameArena(&arena, 0) != B_OK)
+			useArena = false;
+	}
+
+	transfer_stream transfers;
+	memset(&transfers, 0, sizeof(transfers));
+	bulk_stream bulk;
+	memset(&bulk, 0, sizeof(bulk));
+	bool ok = pipeline.output != NULL
+		&& (format == BENCH_YUY2 || pipeline.decompressor != NULL)
+		&& (feed != BENCH_FEED_TRANSFERS || build_transfers(transfers, stream))
+		&& (feed != BENCH_FEED_BULK || build_bulk_transfers(bulk, stream));
+	if (feed == BENCH_FEED_BULK)
+		pipeline.deframer->SetBulkPayloadSize(bulk.payloadSize);
+	bench_result result;
+	if (ok) {
+		const transfer_stream* batches
+			= feed == BENCH_FEED_TRANSFERS ? &transfers : NULL;
+		const bulk_stream* bulkBatches = feed == BENCH_FEED_BULK ? &bulk : NULL;
+		replay(pipeline, stream, batches, bulkBatches, kWarmupFrames, result);
+		replay(pipeline, stream, batches, bulkBatches, frames, result);
+		ok = result.frames > 0;
+	}
+	transfers_free(transfers);
+	bulk_free(bulk);
+
+	if (ok) {
+		double pixels = (double)result.frames * width * height;
+		double totalNs = result.total * 1000.0;
+		double convertNs = result.convert * 1000.0;
+		printf("%-6s %4dx%-4d %6d %9.1f %7.2f %7.2f %7.2f %9.1f %8.1f %8.2f"
+			"%s\n",
+			kFormatNames[format], (int)width, (int)height, (int)result.frames,
+			result.total > 0 ? result.frames * 1000000.0 / result.total : 0.0,
+			totalNs / pixels, (totalNs - convertNs) / pixels,
+			convertNs / pixels,
+			result.copied / 1024.0 / result.frames,
+			result.written / 1024.0 / result.frames,
+			(double)result.allocations / result.frames,
+			result.failures > 0 ? "  (decode failures)" : "");
+	} else {
+		printf("%-6s %4dx%-4d  no frames came out of the stream\n",
+			kFormatNames[format], (int)width, (int)height);
+	}
+
+	// Frames built on the arena go back to it before it is freed
+	delete pipeline.deframer;
+	if (pipeline.decompressor != NULL)
+		tjDestroy(pipeline.decompressor);
+	free(pipeline.output);
+	return ok;
+}
+
+
+static void
+print_header(bool useArena, bench_feed feed)
+{
+	printf("YUY2 kernel: %s, raw frames from the %s, %s\n\n",
+		yuy2_rgb32_best_kernel()->name, useArena ? "arena" : "heap",
+		kFeedNames[feed]);
+	printf("%-6s %-9s %6s %9s %7s %7s %7s %9s %8s %8s\n", "format",
+		"size", "frames", "fps", "ns/px", "defrm", "convert", "copy KB/f",
+		"out KB/f", "allocs/f");
+}
+
+
+static void
+usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [--frames N] [--heap] [--per-packet | --bulk]\n"
+		"       %s --replay capture [--format yuy2|mjpeg --size WxH] "
+		"[--frames N] [--heap] [--per-packet | --bulk]\n", name, name);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	int32 frames = 120;
+	bool useArena = true;
+	bench_feed feed = BENCH_FEED_TRANSFERS;
+	const char* replayPath = NULL;
+	int32 replayFormat = -1;
+	int replayWidth = 0;
+	int replayHeight = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--heap") == 0)
+			useArena = false;
+		else if (strcmp(argv[i], "--per-packet") == 0)
+			feed = BENCH_FEED_PACKETS;
+		else if (strcmp(argv[i], "--bulk") == 0)
+			feed = BENCH_FEED_BULK;
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replayPath = argv[++i];
+		else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "yuy2") == 0)
+				replayFormat = BENCH_YUY2;
+			else if (strcmp(argv[i], "mjpeg") == 0)
+				replayFormat = BENCH_MJPEG;
+		} else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+			sscanf(argv[++i], "%dx%d", &replayWidth, &replayHeight);
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (frames <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	gYuvRgbTables.Initialize();
+
+	printf("=== Capture Pipeline Replay Benchmark ===\n\n");
+	print_header(useArena, feed);
+
+	int failures = 0;
+	if (replayPath != NULL) {
+		packet_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		if (!load_recorded_stream(stream, replayPath, &replayFormat,
+				&replayWidth, &replayHeight))
+			return 1;
+		if (replayFormat < 0 || replayWidth <= 0 || replayHeight <= 0) {
+			fprintf(stderr, "%s: give --format and --size\n", replayPath);
+			stream_free(stream);
+			return 1;
+		}
+		if (!run((bench_format)replayFormat, replayWidth, replayHeight,
+				stream, frames, useArena, feed))
+			failures++;
+		stream_free(stream);
+		return failures > 0 ? 1 : 0;
+	}
+
+	for (int32 format = BENCH_YUY2; format <= BENCH_MJPEG; format++) {
+		for (int32 i = 0; i < kResolutionCount; i++) {
+			packet_stream stream;
+			memset(&stream, 0, sizeof(stream));
+			int32 width = kResolutions[i].width;
+			int32 height = kResolutions[i].height;
+			if (!build_synthetic_stream(stream, (bench_format)format, width,
+					height)) {
+				printf("%-6s %4dx%-4d  cannot build a synthetic stream\n",
+					kFormatNames[format], (int)width, (int)height);
+				failures++;
+			} else if (!run((bench_format)format, width, height, stream,
+					frames, useArena, feed))
+				failures++;
+			stream_free(stream);
+		}
+	}
+
+	return failures > 0 ? 1 : 0;
+}
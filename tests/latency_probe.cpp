@@ -0,0 +1,252 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Live latency distributions of every webcam, from the latency probe
+ *
+ * Finds the video nodes of the webcam add-on, turns their latency probe
+ * on (see CamLatencyProbe.h) and reads the frames each one sent, once a
+ * second. Prints, per camera, p50/p95/p99/max in milliseconds of:
+ *
+ *   usb		capture to the frame's last transfer done
+ *   queue		done to a decoder taking it
+ *   decode		decoding, or converting
+ *   deliver	decoded to SendBuffer()
+ *   total		capture to SendBuffer()
+ *
+ * since the start, or the last report with -r. Repeated frames only count
+ * in deliver and total. "lost" is frames the tool was too slow to read.
+ * With -n the probe is turned off again at the end.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o latency_probe latency_probe.cpp ../CamLatencyProbe.cpp \
+ *       ../CamMetrics.cpp -lbe -lmedia
+ *
+ * Run:
+ *   ./latency_probe [-i seconds] [-n reports] [-r]
+ *     -r  starts the distributions over with every report
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Application.h>
+#include <MediaRoster.h>
+#include <Message.h>
+#include <OS.h>
+
+#include "CamLatencyProbe.h"
+#include "CamMetrics.h"
+
+
+enum {
+	STAGE_USB,
+	STAGE_QUEUE,
+	STAGE_DECODE,
+	STAGE_DELIVER,
+	STAGE_TOTAL,
+	STAGE_COUNT
+};
+
+static const char* kStageNames[STAGE_COUNT] = {
+	"usb", "queue", "decode", "deliver", "total"
+};
+
+static const int32 kMaxCameras = 16;
+
+struct camera {
+	media_node		node;
+	char			name[B_MEDIA_NAME_LENGTH];
+	uint32			after;
+	int64			frames;
+	int64			lost;
+	CamHistogram	stages[STAGE_COUNT];
+};
+
+
+static void
+record_stage(CamHistogram& histogram, bigtime_t from, bigtime_t to)
+{
+	if (from > 0 && to >= from)
+		histogram.Record(to - from);
+}
+
+
+static void
+add_frame(camera& cam, const cam_frame_times& times)
+{
+	record_stage(cam.stages[STAGE_USB], times.capture, times.completed);
+	record_stage(cam.stages[STAGE_QUEUE], times.completed,
+		times.completed > 0 ? times.decode_start : 0);
+	if (times.completed > 0)
+		record_stage(cam.stages[STAGE_DECODE], times.decode_start,
+			times.decoded);
+	record_stage(cam.stages[STAGE_DELIVER], times.decoded, times.sent);
+	record_stage(cam.stages[STAGE_TOTAL], times.capture, times.sent);
+	cam.frames++;
+}
+
+
+/* Asks one node for the frames after the last one read; false if it did
+ * not answer */
+static bool
+poll_camera(camera& cam, port_id replyPort, uint32 flags)
+{
+	static int32 sCookie = 0;
+	int32 cookie = ++sCookie;
+
+	cam_probe_request request;
+	request.reply_port = replyPort;
+	request.cookie = cookie;
+	request.after = cam.after;
+	request.flags = flags;
+	if (write_port_etc(cam.node.port, WEBCAM_MSG_GET_LATENCY_PROBE, &request,
+			sizeof(request), B_RELATIVE_TIMEOUT, 500000) != B_OK)
+		return false;
+
+	// Replies to an earlier request that timed out may still be queued
+	for (;;) {
+		ssize_t size = port_buffer_size_etc(replyPort, B_RELATIVE_TIMEOUT,
+			500000);
+		if (size < 0)
+			return false;
+		char* buffer = new char[size];
+		int32 code;
+		read_port(replyPort, &code, buffer, size);
+		BMessage reply;
+		status_t status = reply.Unflatten(buffer);
+		delete[] buffer;
+		if (status != B_OK || code != WEBCAM_MSG_LATENCY_PROBE
+			|| reply.GetInt32("cookie", -1) != cookie)
+			continue;
+
+		uint32 newest = (uint32)reply.GetInt32("newest", 0);
+		if ((int32)(newest - cam.after) < 0) {
+			// The node started over
+			cam.after = 0;
+			return true;
+		}
+
+		const cam_frame_times* times;
+		ssize_t bytes;
+		int32 count = reply.GetInt32("count", 0);
+		if (count <= 0 || reply.FindData("frames", B_RAW_TYPE,
+				(const void**)&times, &bytes) != B_OK
+			|| bytes < (ssize_t)(count * sizeof(cam_frame_times)))
+			return true;
+
+		if (cam.after != 0 && times[0].sequence - cam.after > 1)
+			cam.lost += times[0].sequence - cam.after - 1;
+		for (int32 i = 0; i < count; i++)
+			add_frame(cam, times[i]);
+		cam.after = times[count - 1].sequence;
+		return true;
+	}
+}
+
+
+static void
+print_camera(camera& cam, bool reset)
+{
+	printf("%s (node %d): %lld frames, %lld lost\n", cam.name,
+		(int)cam.node.node, (long long)cam.frames, (long long)cam.lost);
+	for (int32 i = 0; i < STAGE_COUNT; i++) {
+		cam_latency_summary summary;
+		cam.stages[i].Summarize(&summary);
+		if (summary.count == 0)
+			continue;
+		printf("  %-8s p50 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f ms\n",
+			kStageNames[i], summary.p50 / 1000.0, summary.p95 / 1000.0,
+			summary.p99 / 1000.0, summary.max / 1000.0);
+		if (reset)
+			cam.stages[i].Reset();
+	}
+	if (reset) {
+		cam.frames = 0;
+		cam.lost = 0;
+	}
+}
+
+
+int
+main(int argc, char** argv)
+{
+	bigtime_t interval = 1000000;
+	int32 reports = -1;
+	bool reset = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			interval = (bigtime_t)(atof(argv[++i]) * 1000000);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			reports = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0)
+			reset = true;
+		else {
+			fprintf(stderr, "usage: %s [-i seconds] [-n reports] [-r]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	BApplication app("application/x-vnd.Haiku-webcam-latency-probe");
+	BMediaRoster* roster = BMediaRoster::Roster();
+	if (roster == NULL) {
+		fprintf(stderr, "No media roster, is the media server running?\n");
+		return 1;
+	}
+
+	live_node_info nodes[kMaxCameras];
+	int32 nodeCount = kMaxCameras;
+	if (roster->GetLiveNodes(nodes, &nodeCount, NULL, NULL, NULL,
+			B_BUFFER_PRODUCER | B_PHYSICAL_INPUT) != B_OK)
+		nodeCount = 0;
+
+	port_id replyPort = create_port(4, "latency probe reply");
+	if (replyPort < B_OK) {
+		fprintf(stderr, "Could not create a port: %s\n", strerror(replyPort));
+		return 1;
+	}
+
+	// Other capture nodes, and the webcam audio nodes, do not answer
+	camera* cameras = new camera[nodeCount > 0 ? nodeCount : 1];
+	int32 cameraCount = 0;
+	for (int32 i = 0; i < nodeCount; i++) {
+		camera& cam = cameras[cameraCount];
+		cam.node = nodes[i].node;
+		strlcpy(cam.name, nodes[i].name, sizeof(cam.name));
+		cam.after = 0;
+		cam.frames = 0;
+		cam.lost = 0;
+		if (poll_camera(cam, replyPort, CAM_PROBE_ENABLE))
+			cameraCount++;
+	}
+	if (cameraCount == 0) {
+		fprintf(stderr, "No webcam video node answered\n");
+		delete[] cameras;
+		delete_port(replyPort);
+		return 1;
+	}
+	printf("Probing %d camera(s)\n\n", (int)cameraCount);
+
+	for (int32 report = 0; reports < 0 || report < reports; report++) {
+		snooze(interval);
+		for (int32 i = 0; i < cameraCount; i++) {
+			if (!poll_camera(cameras[i], replyPort, CAM_PROBE_ENABLE))
+				printf("%s: no answer\n", cameras[i].name);
+			else
+				print_camera(cameras[i], reset);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	// Leave the nodes as they were, unless WEBCAM_LATENCY_PROBE is set
+	if (getenv("WEBCAM_LATENCY_PROBE") == NULL) {
+		for (int32 i = 0; i < cameraCount; i++)
+			poll_camera(cameras[i], replyPort, CAM_PROBE_DISABLE);
+	}
+
+	delete[] cameras;
+	delete_port(replyPort);
+	return 0;
+}
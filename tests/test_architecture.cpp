@@ -397,6 +397,73 @@ test_ring_buffer_index()
 }
 
 
+// =============================================================================
+// Test 6b: RingBufferIndex Single Producer / Single Consumer
+// =============================================================================
+
+// The deframer hands frames from the USB thread to the reader through a
+// RingBufferIndex with no lock; check values arrive complete and in order.
+static const int32 kSPSCItems = 200000;
+static int32 sSPSCSlots[8];
+static RingBufferIndex sSPSCRing(8);
+
+
+static int32
+spsc_producer_thread(void* data)
+{
+	(void)data;
+	for (int32 i = 0; i < kSPSCItems; i++) {
+		int32 idx;
+		while ((idx = sSPSCRing.ReserveWrite()) < 0)
+			snooze(0);
+		sSPSCSlots[idx] = i;
+		sSPSCRing.CommitWrite();
+	}
+	return 0;
+}
+
+
+static bool
+test_ring_buffer_spsc()
+{
+	printf("Test: RingBufferIndex producer/consumer threads... ");
+
+	sSPSCRing.Reset();
+	thread_id producer = spawn_thread(spsc_producer_thread, "spsc_producer",
+		B_NORMAL_PRIORITY, NULL);
+	if (producer < 0) {
+		printf("FAIL (spawn_thread)\\n");
+		return false;
+	}
+	resume_thread(producer);
+
+	int32 expected = 0;
+	bool inOrder = true;
+	while (expected < kSPSCItems) {
+		int32 idx = sSPSCRing.ReserveRead();
+		if (idx < 0) {
+			snooze(0);
+			continue;
+		}
+		if (sSPSCSlots[idx] != expected)
+			inOrder = false;
+		sSPSCRing.CommitRead();
+		expected++;
+	}
+
+	status_t result;
+	wait_for_thread(producer, &result);
+
+	if (!inOrder || !sSPSCRing.IsEmpty()) {
+		printf("FAIL (items out of order or left over)\\n");
+		return false;
+	}
+
+	printf("OK (%d items)\\n", (int)kSPSCItems);
+	return true;
+}
+
+
 // =============================================================================
 // Test 7: Result<T> Type
 // =============================================================================
@@ -623,6 +690,11 @@ main(int argc, char** argv)
 	else
 		failed++;
 
+	if (test_ring_buffer_spsc())
+		passed++;
+	else
+		failed++;
+
 	if (test_result_type())
 		passed++;
 	else
@@ -106,6 +106,52 @@ struct audio_timing_stats {
 };
 
 
+// =============================================================================
+// Audio Transfer Layout (matches uvc_audio_layout_for() in UVCCamDevice.cpp)
+// =============================================================================
+
+#ifndef max_c
+#define max_c(a, b) ((a) > (b) ? (a) : (b))
+#define min_c(a, b) ((a) > (b) ? (b) : (a))
+#endif
+
+static const int32 kAudioMaxPacketsPerTransfer = 16;
+static const int32 kAudioMaxTransfersInFlight = 8;
+static const int32 kAudioMaxRingBlocks = 64;
+
+struct uvc_audio_layout {
+	int32	packets_per_transfer;
+	int32	transfers_in_flight;
+	int32	ring_blocks;
+};
+
+static void
+uvc_audio_layout_for(bigtime_t bufferDuration, bigtime_t downstreamLatency,
+	uvc_audio_layout* layout)
+{
+	const int32 kQueuedMilliseconds = 24;
+	const int32 kRingMilliseconds = 256;
+
+	int32 packets = 8;
+	if (downstreamLatency > 0) {
+		packets = (int32)((downstreamLatency + bufferDuration) / 4000);
+		packets = max_c(4, min_c(packets, kAudioMaxPacketsPerTransfer));
+	}
+
+	int32 inFlight = (kQueuedMilliseconds + packets - 1) / packets + 1;
+	inFlight = max_c(2, min_c(inFlight, kAudioMaxTransfersInFlight));
+
+	int32 consumed = (int32)((bufferDuration + packets * 1000 - 1)
+		/ (packets * 1000));
+	int32 blocks = max_c(kRingMilliseconds / packets, 2 * consumed + inFlight);
+	blocks = max_c(inFlight + 2, min_c(blocks, kAudioMaxRingBlocks));
+
+	layout->packets_per_transfer = packets;
+	layout->transfers_in_flight = inFlight;
+	layout->ring_blocks = blocks;
+}
+
+
 // =============================================================================
 // Test 1: Buffer Rate Calculation
 // =============================================================================
@@ -401,6 +447,76 @@ test_buffer_sizes()
 }
 
 
+// =============================================================================
+// Test 9: Audio Transfer Layout From Latency
+// =============================================================================
+
+static bool
+test_transfer_layout()
+{
+	printf("Test: Audio transfer layout from latency... ");
+
+	// Unknown latency: 8ms transfers, 4 in flight, 256ms ring
+	uvc_audio_layout layout;
+	uvc_audio_layout_for(0, 0, &layout);
+	if (layout.packets_per_transfer != 8 || layout.transfers_in_flight != 4
+		|| layout.ring_blocks != 32) {
+		printf("FAIL (default %d/%d/%d)\n", (int)layout.packets_per_transfer,
+			(int)layout.transfers_in_flight, (int)layout.ring_blocks);
+		return false;
+	}
+
+	// Low latency: 128 frames at 48kHz and a 10ms consumer
+	uvc_audio_layout_for(2666, 10000, &layout);
+	if (layout.packets_per_transfer != 4 || layout.transfers_in_flight != 7
+		|| layout.ring_blocks != 64) {
+		printf("FAIL (low latency %d/%d/%d)\n",
+			(int)layout.packets_per_transfer, (int)layout.transfers_in_flight,
+			(int)layout.ring_blocks);
+		return false;
+	}
+
+	// Relaxed consumer with large buffers: long transfers, and a ring that
+	// still holds two buffers besides the queued transfers
+	bigtime_t buffers[] = { 2666, 10000, 50000, 170666 };
+	bigtime_t latencies[] = { 1000, 20000, 100000, 500000 };
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			uvc_audio_layout_for(buffers[i], latencies[j], &layout);
+			int32 packets = layout.packets_per_transfer;
+			if (packets < 4 || packets > kAudioMaxPacketsPerTransfer
+				|| layout.transfers_in_flight < 2
+				|| layout.transfers_in_flight > kAudioMaxTransfersInFlight
+				|| layout.ring_blocks > kAudioMaxRingBlocks
+				|| layout.ring_blocks < layout.transfers_in_flight + 2) {
+				printf("FAIL (out of bounds for %lld/%lld us)\n",
+					(long long)buffers[i], (long long)latencies[j]);
+				return false;
+			}
+			// Transfers never add more than a quarter of a long latency
+			if (latencies[j] >= 16000
+				&& packets * 1000 > (latencies[j] + buffers[i]) / 4) {
+				printf("FAIL (%d ms transfers for %lld us)\n", (int)packets,
+					(long long)latencies[j]);
+				return false;
+			}
+		}
+	}
+
+	uvc_audio_layout_for(170666, 500000, &layout);
+	if (layout.packets_per_transfer != 16
+		|| layout.ring_blocks * 16 < 2 * 170 + 16 * layout.transfers_in_flight) {
+		printf("FAIL (large buffers %d/%d/%d)\n",
+			(int)layout.packets_per_transfer, (int)layout.transfers_in_flight,
+			(int)layout.ring_blocks);
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
 // =============================================================================
 // Main
 // =============================================================================
@@ -456,6 +572,11 @@ main(int argc, char** argv)
 	else
 		failed++;
 
+	if (test_transfer_layout())
+		passed++;
+	else
+		failed++;
+
 	printf("\\n");
 	printf("===========================================\\n");
 	printf("Results: %d passed, %d failed\\n", passed, failed);
@@ -0,0 +1,293 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the audio processing stage
+ *
+ * Links the driver's AudioDSP.cpp, checks every kernel set the CPU
+ * supports against the scalar one and the resampler's block handling
+ * and quality.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_audio_dsp test_audio_dsp.cpp ../AudioDSP.cpp -lbe
+ *
+ * Run:
+ *   ./test_audio_dsp
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <OS.h>
+
+#include "AudioDSP.h"
+
+
+static const int32 kSamples = 1027;	// odd, so every kernel runs its tail
+
+
+static void
+fill_samples(int16* samples, int32 count)
+{
+	srand(17);
+	for (int32 i = 0; i < count; i++)
+		samples[i] = (int16)((rand() & 0xffff) - 32768);
+	// The extremes, for saturation
+	samples[0] = -32768;
+	samples[1] = 32767;
+}
+
+
+// =============================================================================
+// Test 1: Kernels Match Scalar
+// =============================================================================
+
+static bool
+test_kernels_match_scalar()
+{
+	printf("Test: Every kernel set matches scalar...\n");
+
+	const audio_dsp_kernels* kernels[8];
+	int32 count = audio_dsp_available_kernels(kernels, 8);
+	const audio_dsp_kernels* scalar = kernels[0];
+
+	int16 input[kSamples];
+	fill_samples(input, kSamples);
+
+	static float floatRef[kSamples], floatOut[kSamples];
+	static int16 s16Ref[kSamples], s16Out[kSamples];
+	static float mixRef[2 * kSamples], mixOut[2 * kSamples];
+
+	bool ok = true;
+	for (int32 k = 1; k < count; k++) {
+		const audio_dsp_kernels* kernel = kernels[k];
+		int32 worst = 0;
+
+		// Gain above 1 saturates
+		const float gains[] = { 0.0f, 0.37f, 1.0f, 2.5f };
+		for (size_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+			scalar->s16_to_float(floatRef, input, kSamples,
+				gains[g] / 32768.0f);
+			kernel->s16_to_float(floatOut, input, kSamples,
+				gains[g] / 32768.0f);
+			for (int32 i = 0; i < kSamples; i++) {
+				if (fabsf(floatRef[i] - floatOut[i]) > 1e-6f) {
+					printf("  %s: s16_to_float differs at %d\n",
+						kernel->name, (int)i);
+					ok = false;
+					break;
+				}
+			}
+
+			scalar->s16_gain(s16Ref, input, kSamples, gains[g]);
+			kernel->s16_gain(s16Out, input, kSamples, gains[g]);
+			for (int32 i = 0; i < kSamples; i++) {
+				int32 diff = abs(s16Ref[i] - s16Out[i]);
+				if (diff > worst)
+					worst = diff;
+			}
+
+			// Round trip through the float kernels
+			scalar->float_to_s16(s16Ref, floatRef, kSamples);
+			kernel->float_to_s16(s16Out, floatRef, kSamples);
+			for (int32 i = 0; i < kSamples; i++) {
+				int32 diff = abs(s16Ref[i] - s16Out[i]);
+				if (diff > worst)
+					worst = diff;
+			}
+		}
+
+		scalar->mono_to_stereo(mixRef, floatRef, kSamples);
+		kernel->mono_to_stereo(mixOut, floatRef, kSamples);
+		if (memcmp(mixRef, mixOut, 2 * kSamples * sizeof(float)) != 0) {
+			printf("  %s: mono_to_stereo differs\n", kernel->name);
+			ok = false;
+		}
+		scalar->stereo_to_mono(floatRef, mixRef, kSamples);
+		kernel->stereo_to_mono(floatOut, mixRef, kSamples);
+		for (int32 i = 0; i < kSamples; i++) {
+			if (fabsf(floatRef[i] - floatOut[i]) > 1e-6f) {
+				printf("  %s: stereo_to_mono differs at %d\n", kernel->name,
+					(int)i);
+				ok = false;
+				break;
+			}
+		}
+
+		// Only extended precision rounding may move a sample by one
+		if (worst > 1) {
+			printf("  %s: int16 output off by %d\n", kernel->name,
+				(int)worst);
+			ok = false;
+		} else
+			printf("  %s: OK (max int16 diff %d)\n", kernel->name, (int)worst);
+	}
+
+	// Saturation and rounding of the reference itself
+	float edge[4] = { 2.0f, -2.0f, 0.5f / 32768.0f, 1.5f / 32768.0f };
+	int16 edgeOut[4];
+	scalar->float_to_s16(edgeOut, edge, 4);
+	if (edgeOut[0] != 32767 || edgeOut[1] != -32768 || edgeOut[2] != 0
+		|| edgeOut[3] != 2) {
+		printf("  scalar: bad saturation/rounding %d %d %d %d\n",
+			edgeOut[0], edgeOut[1], edgeOut[2], edgeOut[3]);
+		ok = false;
+	}
+
+	printf("%s (%d kernel sets)\n", ok ? "OK" : "FAIL", (int)count);
+	return ok;
+}
+
+
+// =============================================================================
+// Test 2: Resampler Blocks Are Seamless
+// =============================================================================
+
+static bool
+test_resampler_blocks()
+{
+	printf("Test: Resampler output does not depend on block sizes... ");
+
+	const int32 kTotal = 4410;
+	static float input[20000 * 2];
+	static float whole[kTotal * 2], pieces[kTotal * 2];
+	for (int32 i = 0; i < 20000 * 2; i++)
+		input[i] = sinf(i * 0.01f) * 0.5f;
+
+	// One block
+	AudioResampler resampler;
+	resampler.SetRates(48000, 44100, 2);
+	int32 needed = resampler.InputFramesFor(kTotal);
+	resampler.Process(input, needed, whole, kTotal);
+
+	// Odd sized blocks, each fed exactly what it asks for
+	resampler.Reset();
+	int32 consumed = 0;
+	int32 produced = 0;
+	int32 block = 1;
+	while (produced < kTotal) {
+		int32 frames = min_c(block, kTotal - produced);
+		int32 inputFrames = resampler.InputFramesFor(frames);
+		resampler.Process(input + consumed * 2, inputFrames,
+			pieces + produced * 2, frames);
+		consumed += inputFrames;
+		produced += frames;
+		block = block * 3 % 257 + 1;
+	}
+
+	for (int32 i = 0; i < kTotal * 2; i++) {
+		if (fabsf(whole[i] - pieces[i]) > 1e-5f) {
+			printf("FAIL (sample %d: %f vs %f)\n", (int)i, whole[i],
+				pieces[i]);
+			return false;
+		}
+	}
+
+	// Over a long run, input is consumed at the rate ratio
+	double ratio = (double)consumed / produced;
+	if (fabs(ratio - 48000.0 / 44100.0) > 0.002) {
+		printf("FAIL (consumed %d for %d)\n", (int)consumed, (int)produced);
+		return false;
+	}
+
+	printf("OK (%d in, %d out)\n", (int)consumed, (int)produced);
+	return true;
+}
+
+
+// =============================================================================
+// Test 3: Resampled Sine Stays Clean
+// =============================================================================
+
+static bool
+test_resampler_quality()
+{
+	printf("Test: 1 kHz sine resampled 48000 -> 44100 and 16000 -> 48000...\n");
+
+	struct { double in, out; } cases[] = { { 48000, 44100 }, { 16000, 48000 } };
+	bool ok = true;
+
+	for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+		const double kFrequency = 1000.0;
+		const int32 kOutput = 4000;
+
+		AudioResampler resampler;
+		resampler.SetRates(cases[c].in, cases[c].out, 1);
+		int32 needed = resampler.InputFramesFor(kOutput);
+		float* input = new float[needed];
+		float* output = new float[kOutput];
+		for (int32 i = 0; i < needed; i++)
+			input[i] = (float)sin(2 * M_PI * kFrequency * i / cases[c].in);
+		resampler.Process(input, needed, output, kOutput);
+
+		// Output j is input position j * step; skip the start-up frames
+		double signal = 0, noise = 0;
+		for (int32 j = 16; j < kOutput; j++) {
+			double expected = sin(2 * M_PI * kFrequency * j / cases[c].out);
+			signal += expected * expected;
+			noise += (output[j] - expected) * (output[j] - expected);
+		}
+		double snr = 10 * log10(signal / noise);
+		printf("  %.0f -> %.0f: SNR %.1f dB\n", cases[c].in, cases[c].out, snr);
+		if (snr < 40.0)
+			ok = false;
+
+		delete[] input;
+		delete[] output;
+	}
+
+	// Equal rates pass through untouched
+	AudioResampler passthrough;
+	passthrough.SetRates(48000, 48000, 2);
+	float in[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	float out[8];
+	if (!passthrough.IsPassthrough() || passthrough.InputFramesFor(4) != 4) {
+		ok = false;
+	} else {
+		passthrough.Process(in, 4, out, 4);
+		ok = ok && memcmp(in, out, sizeof(in)) == 0;
+	}
+
+	printf("%s\n", ok ? "OK" : "FAIL");
+	return ok;
+}
+
+
+// =============================================================================
+// Main
+// =============================================================================
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Audio Processing Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_kernels_match_scalar())
+		passed++;
+	else
+		failed++;
+
+	if (test_resampler_blocks())
+		passed++;
+	else
+		failed++;
+
+	if (test_resampler_quality())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for UVC PTS/SCR device clock recovery
+ *
+ * Links the driver's UVCClock.cpp and feeds it a simulated device clock
+ * with drift and USB delivery jitter.
+ *
+ * Build:
+ *   g++ -O2 -I../addons/uvc -o test_clock_recovery test_clock_recovery.cpp \
+ *       ../addons/uvc/UVCClock.cpp -lbe
+ *
+ * Run:
+ *   ./test_clock_recovery
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <OS.h>
+
+#include "UVCClock.h"
+
+
+// =============================================================================
+// Simulated Camera
+// =============================================================================
+
+struct simulated_camera {
+	uint32		frequency;		// nominal dwClockFrequency
+	double		drift;			// actual rate error (e.g. 50e-6)
+	uint32		stcBase;		// STC at system time 0
+	bigtime_t	maxDelay;		// USB completion delay, 0..maxDelay
+
+	uint32 STCAt(bigtime_t systemTime) const
+	{
+		double ticks = systemTime * (frequency / 1000000.0) * (1.0 + drift);
+		return stcBase + (uint32)(uint64)ticks;
+	}
+
+	bigtime_t Delay() const
+	{
+		return maxDelay > 0 ? rand() % (maxDelay + 1) : 0;
+	}
+};
+
+
+// Run 'frames' frames at 30fps; the PTS of each frame is mapped and
+// compared against the real capture time. Returns the worst error seen
+// after the first 'settle' frames.
+static bigtime_t
+run_camera(UVCClockRecovery& clock, const simulated_camera& camera,
+	bigtime_t start, int32 frames, int32 settle, int32* unlocked)
+{
+	bigtime_t worst = 0;
+	*unlocked = 0;
+
+	for (int32 i = 0; i < frames; i++) {
+		bigtime_t capture = start + i * 33333;
+		uint32 pts = camera.STCAt(capture);
+
+		// The first packet goes out ~2ms after capture and arrives late
+		bigtime_t sent = capture + 2000;
+		clock.AddSample(camera.STCAt(sent), sent + camera.Delay());
+
+		bigtime_t mapped;
+		if (!clock.DeviceToSystem(pts, &mapped)) {
+			(*unlocked)++;
+			continue;
+		}
+		if (i < settle)
+			continue;
+
+		bigtime_t error = mapped > capture ? mapped - capture
+			: capture - mapped;
+		if (error > worst)
+			worst = error;
+	}
+
+	return worst;
+}
+
+
+// =============================================================================
+// Test 1: Exact Clock
+// =============================================================================
+
+static bool
+test_exact_clock()
+{
+	printf("Test: Jitter free clock maps exactly... ");
+
+	simulated_camera camera = { 30000000, 0.0, 12345, 0 };
+	UVCClockRecovery clock;
+	clock.SetFrequency(camera.frequency);
+
+	int32 unlocked;
+	bigtime_t worst = run_camera(clock, camera, 1000000, 300, 0, &unlocked);
+
+	if (unlocked > 4 || worst > 2) {
+		printf("FAIL (unlocked=%d worst=%lld us)\n", (int)unlocked, worst);
+		return false;
+	}
+
+	printf("OK (worst %lld us)\n", worst);
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Drift and Jitter
+// =============================================================================
+
+static bool
+test_drift_and_jitter()
+{
+	printf("Test: 80ppm drift with 0-3ms USB delay... ");
+
+	srand(42);
+	simulated_camera camera = { 48000000, 80e-6, 777, 3000 };
+	UVCClockRecovery clock;
+	clock.SetFrequency(camera.frequency);
+
+	int32 unlocked;
+	bigtime_t worst = run_camera(clock, camera, 5000000, 900, 120,
+		&unlocked);
+
+	int32 ppm = clock.DriftPPM();
+	if (worst > 500 || ppm < 0 || ppm > 200) {
+		printf("FAIL (worst=%lld us, drift=%d ppm)\n", worst, (int)ppm);
+		return false;
+	}
+
+	printf("OK (worst %lld us, drift %d ppm)\n", worst, (int)ppm);
+	return true;
+}
+
+
+// =============================================================================
+// Test 3: STC Wrap-around
+// =============================================================================
+
+static bool
+test_stc_wrap()
+{
+	printf("Test: STC wrap-around... ");
+
+	// Start just before the 32-bit STC wraps
+	simulated_camera camera = { 30000000, 0.0, 0xffffffff - 30000000, 0 };
+	UVCClockRecovery clock;
+	clock.SetFrequency(camera.frequency);
+
+	int32 unlocked;
+	bigtime_t worst = run_camera(clock, camera, 0, 120, 0, &unlocked);
+
+	if (unlocked > 4 || worst > 2) {
+		printf("FAIL (unlocked=%d worst=%lld us)\n", (int)unlocked, worst);
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 4: Clock Discontinuity
+// =============================================================================
+
+static bool
+test_discontinuity()
+{
+	printf("Test: Resync after device clock jump... ");
+
+	simulated_camera camera = { 30000000, 0.0, 1000, 0 };
+	UVCClockRecovery clock;
+	clock.SetFrequency(camera.frequency);
+
+	int32 unlocked;
+	run_camera(clock, camera, 0, 60, 0, &unlocked);
+
+	// Device restarted its clock: same host timeline, new STC origin
+	camera.stcBase = 500000000;
+	bigtime_t worst = run_camera(clock, camera, 2000000, 60, 8, &unlocked);
+
+	if (worst > 2) {
+		printf("FAIL (worst=%lld us after jump)\n", worst);
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 5: Unknown Frequency
+// =============================================================================
+
+static bool
+test_no_frequency()
+{
+	printf("Test: No mapping without dwClockFrequency... ");
+
+	UVCClockRecovery clock;
+	for (int32 i = 0; i < 20; i++)
+		clock.AddSample(i * 1000000, i * 33333);
+
+	bigtime_t mapped;
+	if (clock.DeviceToSystem(5000000, &mapped)) {
+		printf("FAIL (mapped without a frequency)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Main
+// =============================================================================
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("UVC Clock Recovery Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_exact_clock())
+		passed++;
+	else
+		failed++;
+
+	if (test_drift_and_jitter())
+		passed++;
+	else
+		failed++;
+
+	if (test_stc_wrap())
+		passed++;
+	else
+		failed++;
+
+	if (test_discontinuity())
+		passed++;
+	else
+		failed++;
+
+	if (test_no_frequency())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return (failed == 0) ? 0 : 1;
+}
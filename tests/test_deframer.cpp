@@ -27,6 +27,7 @@ struct deframer_stats {
 	uint32		frames_incomplete;
 	uint32		fid_changes;
 	uint32		queue_overflows;
+	uint32		frames_discarded;	// damaged in transfer, never queued
 	bigtime_t	last_report_time;
 	size_t		expected_frame_size;
 
@@ -318,13 +319,13 @@ test_stats_memory()
 
 	if (stats.frames_completed != 0 || stats.frames_incomplete != 0 ||
 		stats.fid_changes != 0 || stats.queue_overflows != 0 ||
-		stats.last_report_time != 0 || stats.expected_frame_size != 0) {
+		stats.frames_discarded != 0 || stats.last_report_time != 0 || stats.expected_frame_size != 0) {
 		printf("FAIL (not properly zeroed)\\n");
 		return false;
 	}
 
 	// Verify reasonable structure size (should be compact)
-	// uint32 * 4 + bigtime_t + size_t = ~32 bytes on 64-bit
+	// uint32 * 5 + bigtime_t + size_t = ~32 bytes on 64-bit
 	if (sizeof(stats) > 64) {
 		printf("FAIL (size %zu > 64 bytes)\\n", sizeof(stats));
 		return false;
@@ -335,6 +336,138 @@ test_stats_memory()
 }
 
 
+// =============================================================================
+// Test 8: Damaged Frame Discard
+// =============================================================================
+
+// One payload as UVCDeframer::_AddPayload() sees it
+struct payload {
+	int		fid;
+	bool	eof;
+	bool	error;		// ERR bit in the header
+	bool	lostBefore;	// an iso packet failed just before it
+};
+
+// The damaged frame fast path of the driver, for MJPEG (frames end by EOF
+// or by the next FID): returns the frames queued, counts the discarded
+struct discard_model {
+	int		fid;
+	bool	open;		// data stored for the current frame
+	bool	bad;
+	bool	lost;
+	bool	sawEOF;
+	int		queued;
+	int		discarded;
+	int		stored;		// payloads written into frames
+
+	discard_model()
+		: fid(0), open(false), bad(false), lost(false), sawEOF(false),
+		queued(0), discarded(0), stored(0) {}
+
+	void Discard()
+	{
+		discarded++;
+		open = false;
+		bad = false;
+	}
+
+	void Add(const payload& p)
+	{
+		if (p.lostBefore)
+			lost = true;
+		bool eof = p.eof;
+		bool fidChanged = p.fid != fid;
+		if (fidChanged) {
+			fid = p.fid;
+			if (open && lost) {
+				bad = true;
+				lost = false;
+			} else if (open && sawEOF)
+				bad = true;
+			if (bad)
+				Discard();
+			else if (open) {
+				queued++;
+				open = false;
+			}
+		}
+
+		if (p.error || lost)
+			bad = true;
+		lost = false;
+		if (bad) {
+			if (eof)
+				Discard();
+			return;
+		}
+
+		stored++;
+		open = true;
+		if (eof && !fidChanged) {
+			sawEOF = true;
+			queued++;
+			open = false;
+		}
+	}
+};
+
+
+static bool
+test_error_discard()
+{
+	printf("Test: Damaged frame discard... ");
+
+	// Five frames of three payloads each, with EOF on the last
+	payload stream[15];
+	for (int i = 0; i < 15; i++) {
+		stream[i].fid = (i / 3) % 2;
+		stream[i].eof = (i % 3) == 2;
+		stream[i].error = false;
+		stream[i].lostBefore = false;
+	}
+	stream[4].error = true;			// frame 1: error bit mid-frame
+	stream[11].lostBefore = true;	// frame 3: its EOF payload was lost
+
+	discard_model model;
+	for (int i = 0; i < 15; i++) {
+		if (i == 11)
+			continue;	// the lost one never arrives
+		model.Add(stream[i]);
+	}
+
+	// Frames 0, 2 and 4 whole; 1 by the error bit, 3 at the next FID
+	if (model.queued != 3 || model.discarded != 2) {
+		printf("FAIL (queued %d, discarded %d, expected 3 and 2)\n",
+			model.queued, model.discarded);
+		return false;
+	}
+
+	// Nothing of frame 1 after its error is stored
+	if (model.stored != 3 + 1 + 3 + 2 + 3) {
+		printf("FAIL (%d payloads stored)\n", model.stored);
+		return false;
+	}
+
+	// A loss before a frame's first payload damages that frame, not the
+	// one before, which ended by EOF
+	discard_model second;
+	for (int i = 0; i < 15; i++) {
+		payload p = stream[i];
+		p.error = false;
+		p.lostBefore = i == 6;
+		second.Add(p);
+	}
+	if (second.queued != 4 || second.discarded != 1) {
+		printf("FAIL (lost first payload: queued %d, discarded %d)\n",
+			second.queued, second.discarded);
+		return false;
+	}
+
+	printf("OK (discarded: %d)\n", model.discarded);
+	return true;
+}
+
+
 // =============================================================================
 // Main
 // =============================================================================
@@ -385,6 +518,11 @@ main(int argc, char** argv)
 	else
 		failed++;
 
+	if (test_error_discard())
+		passed++;
+	else
+		failed++;
+
 	printf("\\n");
 	printf("===========================================\\n");
 	printf("Results: %d passed, %d failed\\n", passed, failed);
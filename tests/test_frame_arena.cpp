@@ -0,0 +1,164 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the preallocated frame arena
+ *
+ * Links the driver's CamFrameArena.cpp.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_frame_arena test_frame_arena.cpp \
+ *       ../CamFrameArena.cpp -lbe
+ *
+ * Run:
+ *   ./test_frame_arena
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <OS.h>
+
+#include "CamFrameArena.h"
+
+
+// =============================================================================
+// Test 1: Layout Follows the Format
+// =============================================================================
+
+static bool
+test_layout_follows_format()
+{
+	printf("Test: Footprint follows the negotiated frame size... ");
+
+	CamFrameArena arena("test arena");
+
+	// 320x240 YUY2 frames, RGB32 decoded frames
+	size_t small[2] = { 320 * 240 * 2, 320 * 240 * 4 };
+	int32 counts[2] = { 10, 3 };
+	if (arena.SetLayout(small, counts, 2) != B_OK) {
+		printf("FAIL (small layout)\n");
+		return false;
+	}
+	size_t smallFootprint = arena.Footprint();
+
+	size_t large[2] = { 1920 * 1080 * 2, 1920 * 1080 * 4 };
+	if (arena.SetLayout(large, counts, 2) != B_OK) {
+		printf("FAIL (large layout)\n");
+		return false;
+	}
+	size_t largeFootprint = arena.Footprint();
+
+	if (smallFootprint >= 4 * 1024 * 1024
+		|| largeFootprint < 10 * 1920 * 1080 * 2
+		|| arena.SlotSize(0) % B_PAGE_SIZE != 0
+		|| arena.SlotSize(0) < 1920 * 1080 * 2) {
+		printf("FAIL (small=%zu large=%zu slot=%zu)\n", smallFootprint,
+			largeFootprint, arena.SlotSize(0));
+		return false;
+	}
+
+	printf("OK (%zu KB vs %zu KB)\n", smallFootprint / 1024,
+		largeFootprint / 1024);
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Slots Are Distinct and Recycled
+// =============================================================================
+
+static bool
+test_slots()
+{
+	printf("Test: Slots are distinct, bounded and recycled... ");
+
+	CamFrameArena arena("test arena");
+	size_t sizes[2] = { 5000, 9000 };
+	int32 counts[2] = { 4, 2 };
+	if (arena.SetLayout(sizes, counts, 2) != B_OK) {
+		printf("FAIL (layout)\n");
+		return false;
+	}
+
+	void* raw[4];
+	for (int32 i = 0; i < 4; i++) {
+		raw[i] = arena.AcquireSlot(0);
+		if (raw[i] == NULL) {
+			printf("FAIL (slot %d missing)\n", (int)i);
+			return false;
+		}
+		// Touch the whole slot; overlapping slots show up below
+		memset(raw[i], 0x10 + i, arena.SlotSize(0));
+	}
+	for (int32 i = 0; i < 4; i++) {
+		const uint8* data = (const uint8*)raw[i];
+		if (data[0] != 0x10 + i || data[arena.SlotSize(0) - 1] != 0x10 + i) {
+			printf("FAIL (slot %d overlaps)\n", (int)i);
+			return false;
+		}
+	}
+
+	if (arena.AcquireSlot(0) != NULL || arena.FreeSlots(1) != 2) {
+		printf("FAIL (class not bounded or classes share slots)\n");
+		return false;
+	}
+
+	// A busy arena cannot be laid out again
+	size_t other[1] = { 100000 };
+	int32 otherCount[1] = { 2 };
+	if (arena.SetLayout(other, otherCount, 1) != B_BUSY) {
+		printf("FAIL (relayout with slots out)\n");
+		return false;
+	}
+
+	arena.ReleaseSlot(raw[2]);
+	if (arena.AcquireSlot(0) != raw[2]) {
+		printf("FAIL (released slot not reused)\n");
+		return false;
+	}
+
+	for (int32 i = 0; i < 4; i++)
+		arena.ReleaseSlot(raw[i]);
+	if (arena.FreeSlots(0) != 4 || arena.Unset() != B_OK) {
+		printf("FAIL (slots not all returned)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Main
+// =============================================================================
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Frame Arena Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_layout_follows_format())
+		passed++;
+	else
+		failed++;
+
+	if (test_slots())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,322 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the scaler feeding the producer's extra outputs
+ *
+ * Links the driver's CamFrameScaler.cpp: every output pixel must be the
+ * rounded average of the source pixels under it, in every color space
+ * pair the scaler takes, and formats it cannot do must be refused.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_frame_scaler test_frame_scaler.cpp \
+ *       ../CamFrameScaler.cpp -lbe
+ *
+ * Run:
+ *   ./test_frame_scaler
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <OS.h>
+
+#include "CamFrameScaler.h"
+
+
+static uint8
+rounded_average(uint32 sum, uint32 count)
+{
+	return (uint8)((2 * sum + count) / (2 * count));
+}
+
+
+// The source span under output index i of n, at least one wide
+static void
+source_span(int32 i, int32 n, int32 sourceN, int32* first, int32* end)
+{
+	*first = i * sourceN / n;
+	*end = (i + 1) * sourceN / n;
+	if (*end <= *first)
+		*end = *first + 1;
+}
+
+
+static int32
+pixel_bytes(color_space space)
+{
+	return space == B_RGB32 ? 4 : space == B_RGB24 ? 3 : 2;
+}
+
+
+// B, G, R of an RGB pixel, 8 bits each
+static void
+read_rgb(const uint8* pixel, color_space space, uint32 bgr[3])
+{
+	if (space == B_RGB16) {
+		uint16 value = pixel[0] | (pixel[1] << 8);
+		uint32 b = value & 0x1f, g = (value >> 5) & 0x3f, r = value >> 11;
+		bgr[0] = (b << 3) | (b >> 2);
+		bgr[1] = (g << 2) | (g >> 4);
+		bgr[2] = (r << 3) | (r >> 2);
+		return;
+	}
+	bgr[0] = pixel[0];
+	bgr[1] = pixel[1];
+	bgr[2] = pixel[2];
+}
+
+
+// =============================================================================
+// Test 1: RGB Spaces
+// =============================================================================
+
+static bool
+test_rgb_scaling()
+{
+	printf("Test: RGB frames against a plain box filter... ");
+
+	static const color_space kSpaces[] = { B_RGB32, B_RGB24, B_RGB16 };
+	static const int32 kSizes[][4] = {
+		{ 640, 480, 320, 240 }, { 1280, 720, 424, 240 }, { 96, 64, 12, 8 },
+		{ 50, 30, 50, 30 }, { 40, 20, 80, 30 }
+	};
+
+	// Padded rows, as a consumer's buffers may have
+	const size_t kPadding = 12;
+	uint8* source = (uint8*)malloc((1280 * 4 + kPadding) * 720);
+	uint8* output = (uint8*)malloc((424 * 4 + kPadding) * 240);
+	bool ok = source != NULL && output != NULL;
+
+	srand(97531);
+	for (size_t a = 0; ok && a < 3; a++)
+	for (size_t b = 0; ok && b < 3; b++)
+	for (size_t s = 0; ok && s < sizeof(kSizes) / sizeof(kSizes[0]); s++) {
+		color_space sourceSpace = kSpaces[a];
+		color_space space = kSpaces[b];
+		int32 sourceWidth = kSizes[s][0], sourceHeight = kSizes[s][1];
+		int32 width = kSizes[s][2], height = kSizes[s][3];
+		size_t sourceRow = sourceWidth * pixel_bytes(sourceSpace) + kPadding;
+		size_t row = width * pixel_bytes(space) + kPadding;
+		size_t sourceSize = sourceRow * sourceHeight;
+		for (size_t i = 0; i < sourceSize; i++)
+			source[i] = (uint8)rand();
+
+		CamFrameScaler scaler;
+		if (scaler.SetFormat(sourceSpace, sourceWidth, sourceHeight, space,
+				width, height) != B_OK
+			|| scaler.Scale(source, sourceSize, sourceRow, output, row)
+				!= B_OK) {
+			printf("FAIL (%dx%d -> %dx%d refused)\n", (int)sourceWidth,
+				(int)sourceHeight, (int)width, (int)height);
+			ok = false;
+			break;
+		}
+
+		for (int32 y = 0; ok && y < height; y++)
+		for (int32 x = 0; ok && x < width; x++) {
+			int32 x0, x1, y0, y1;
+			source_span(x, width, sourceWidth, &x0, &x1);
+			source_span(y, height, sourceHeight, &y0, &y1);
+			uint32 sums[3] = { 0, 0, 0 };
+			for (int32 sy = y0; sy < y1; sy++)
+			for (int32 sx = x0; sx < x1; sx++) {
+				uint32 bgr[3];
+				read_rgb(source + sy * sourceRow
+					+ sx * pixel_bytes(sourceSpace), sourceSpace, bgr);
+				for (int c = 0; c < 3; c++)
+					sums[c] += bgr[c];
+			}
+			uint32 count = (x1 - x0) * (y1 - y0);
+			uint8 expected[4];
+			for (int c = 0; c < 3; c++)
+				expected[c] = rounded_average(sums[c], count);
+			expected[3] = 255;
+
+			const uint8* pixel = output + y * row + x * pixel_bytes(space);
+			bool match;
+			if (space == B_RGB16) {
+				uint16 value = (uint16)(((expected[2] >> 3) << 11)
+					| ((expected[1] >> 2) << 5) | (expected[0] >> 3));
+				match = pixel[0] == (value & 0xff) && pixel[1] == (value >> 8);
+			} else
+				match = memcmp(pixel, expected, pixel_bytes(space)) == 0;
+			if (!match) {
+				printf("FAIL (space %d -> %d, %dx%d -> %dx%d, pixel %d,%d)\n",
+					(int)a, (int)b, (int)sourceWidth, (int)sourceHeight,
+					(int)width, (int)height, (int)x, (int)y);
+				ok = false;
+			}
+		}
+	}
+
+	free(source);
+	free(output);
+	if (ok)
+		printf("OK\n");
+	return ok;
+}
+
+
+// =============================================================================
+// Test 2: YCbCr 4:2:2
+// =============================================================================
+
+static bool
+test_ycbcr_scaling()
+{
+	printf("Test: YCbCr 4:2:2 frames keep luma per pixel, chroma per pair... ");
+
+	static const int32 kSizes[][4] = {
+		{ 1280, 720, 640, 360 }, { 640, 480, 212, 160 }, { 64, 16, 8, 2 }
+	};
+
+	uint8* source = (uint8*)malloc(1280 * 720 * 2);
+	uint8* output = (uint8*)malloc(640 * 360 * 2);
+	bool ok = source != NULL && output != NULL;
+
+	srand(8642);
+	for (size_t s = 0; ok && s < sizeof(kSizes) / sizeof(kSizes[0]); s++) {
+		int32 sourceWidth = kSizes[s][0], sourceHeight = kSizes[s][1];
+		int32 width = kSizes[s][2], height = kSizes[s][3];
+		size_t sourceSize = (size_t)sourceWidth * sourceHeight * 2;
+		for (size_t i = 0; i < sourceSize; i++)
+			source[i] = (uint8)rand();
+
+		CamFrameScaler scaler;
+		if (scaler.SetFormat(B_YCbCr422, sourceWidth, sourceHeight,
+				B_YCbCr422, width, height) != B_OK
+			|| scaler.Scale(source, sourceSize, sourceWidth * 2, output,
+				width * 2) != B_OK) {
+			printf("FAIL (%dx%d -> %dx%d refused)\n", (int)sourceWidth,
+				(int)sourceHeight, (int)width, (int)height);
+			ok = false;
+			break;
+		}
+
+		for (int32 y = 0; ok && y < height; y++)
+		for (int32 x = 0; ok && x < width; x++) {
+			int32 x0, x1, y0, y1, right0, right1;
+			source_span(x, width, sourceWidth, &x0, &x1);
+			source_span(y, height, sourceHeight, &y0, &y1);
+			// Chroma of every source pair under the output pair
+			int32 left = x & ~1;
+			int32 pairFirst, pairEnd;
+			source_span(left, width, sourceWidth, &pairFirst, &right0);
+			source_span(left + 1, width, sourceWidth, &right0, &right1);
+			pairFirst /= 2;
+			pairEnd = (right1 + 1) / 2;
+
+			uint32 luma = 0, chroma = 0;
+			for (int32 sy = y0; sy < y1; sy++) {
+				const uint8* line = source + (size_t)sy * sourceWidth * 2;
+				for (int32 sx = x0; sx < x1; sx++)
+					luma += line[sx * 2];
+				for (int32 q = pairFirst; q < pairEnd; q++)
+					chroma += line[q * 4 + 1 + (x & 1) * 2];
+			}
+			const uint8* pixel = output + (size_t)y * width * 2 + x * 2;
+			if (pixel[0] != rounded_average(luma, (x1 - x0) * (y1 - y0))
+				|| pixel[1] != rounded_average(chroma,
+					(pairEnd - pairFirst) * (y1 - y0))) {
+				printf("FAIL (%dx%d -> %dx%d, pixel %d,%d)\n",
+					(int)sourceWidth, (int)sourceHeight, (int)width,
+					(int)height, (int)x, (int)y);
+				ok = false;
+			}
+		}
+	}
+
+	free(source);
+	free(output);
+	if (ok)
+		printf("OK\n");
+	return ok;
+}
+
+
+// =============================================================================
+// Test 3: Refused Formats
+// =============================================================================
+
+static bool
+test_refused_formats()
+{
+	printf("Test: Formats the scaler cannot do are refused... ");
+
+	CamFrameScaler scaler;
+	struct {
+		color_space	sourceSpace;
+		int32		sourceWidth, sourceHeight;
+		color_space	space;
+		int32		width, height;
+	} refused[] = {
+		{ B_RGB32, 640, 480, B_YCbCr422, 320, 240 },	// no conversion
+		{ B_YCbCr422, 640, 480, B_RGB32, 320, 240 },
+		{ B_YCbCr420, 640, 480, B_YCbCr420, 320, 240 },
+		{ B_RGB32, 1920, 1080, B_RGB32, 160, 90 },		// over 8:1
+		{ B_YCbCr422, 640, 480, B_YCbCr422, 321, 240 },	// odd width
+		{ B_RGB32, 8192, 16, B_RGB32, 2048, 4 },		// too wide
+		{ B_RGB32, 640, 480, B_RGB32, 0, 240 }
+	};
+	for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+		if (scaler.SetFormat(refused[i].sourceSpace, refused[i].sourceWidth,
+				refused[i].sourceHeight, refused[i].space, refused[i].width,
+				refused[i].height) == B_OK || scaler.IsSet()) {
+			printf("FAIL (format %d accepted)\n", (int)i);
+			return false;
+		}
+	}
+
+	// A short source is not read past its end
+	if (scaler.SetFormat(B_RGB32, 64, 64, B_RGB32, 32, 32) != B_OK
+		|| !scaler.Matches(B_RGB32, 64, 64) || scaler.Matches(B_RGB24, 64, 64)) {
+		printf("FAIL (format)\n");
+		return false;
+	}
+	uint8 source[64 * 4 * 10];
+	uint8 output[32 * 32 * 4];
+	if (scaler.Scale(source, sizeof(source), 64 * 4, output, 32 * 4)
+			!= B_BAD_DATA) {
+		printf("FAIL (short source scaled)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Frame Scaler Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_rgb_scaling())
+		passed++;
+	else
+		failed++;
+
+	if (test_ycbcr_scaling())
+		passed++;
+	else
+		failed++;
+
+	if (test_refused_formats())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return failed > 0 ? 1 : 0;
+}
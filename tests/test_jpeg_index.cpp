@@ -0,0 +1,432 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the JPEG marker index the deframer builds per frame
+ *
+ * Links the driver's CamJpegIndex.cpp: a synthetic JPEG is fed in payload
+ * sized pieces, split at every kind of boundary, and the index has to come
+ * out the same as for the whole frame at once.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_jpeg_index test_jpeg_index.cpp ../CamJpegIndex.cpp -lbe
+ *
+ * Run:
+ *   ./test_jpeg_index
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <OS.h>
+
+#include "CamJpegIndex.h"
+
+
+// =============================================================================
+// Synthetic Frames
+// =============================================================================
+
+static size_t
+put_segment(uint8* out, uint8 marker, const uint8* payload, size_t size)
+{
+	out[0] = 0xff;
+	out[1] = marker;
+	out[2] = (uint8)((size + 2) >> 8);
+	out[3] = (uint8)(size + 2);
+	memcpy(out + 4, payload, size);
+	return size + 4;
+}
+
+
+/* A 640x480 4:2:2 frame with DRI, 'restarts' RSTn markers in entropy data
+ * full of stuffed bytes, after 'junk' bytes of padding */
+static size_t
+build_frame(uint8* out, size_t junk, int restarts, bool dht, bool eoi)
+{
+	size_t pos = 0;
+	for (size_t i = 0; i < junk; i++)
+		out[pos++] = (uint8)(0x10 + i);
+
+	out[pos++] = 0xff;
+	out[pos++] = 0xd8;
+
+	const uint8 app0[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+	pos += put_segment(out + pos, 0xe0, app0, sizeof(app0));
+
+	uint8 dqt[65];
+	memset(dqt, 1, sizeof(dqt));
+	dqt[0] = 0;
+	pos += put_segment(out + pos, 0xdb, dqt, sizeof(dqt));
+
+	const uint8 sof[15] = { 8, 0x01, 0xe0, 0x02, 0x80, 3,
+		1, 0x21, 0, 2, 0x11, 1, 3, 0x11, 1 };
+	pos += put_segment(out + pos, 0xc0, sof, sizeof(sof));
+
+	if (dht) {
+		uint8 table[29];
+		memset(table, 0, sizeof(table));
+		table[1] = 1;
+		pos += put_segment(out + pos, 0xc4, table, sizeof(table));
+	}
+
+	const uint8 dri[2] = { 0, 40 };
+	pos += put_segment(out + pos, 0xdd, dri, sizeof(dri));
+
+	// Fill bytes before a marker are allowed
+	out[pos++] = 0xff;
+
+	const uint8 sos[10] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+	pos += put_segment(out + pos, 0xda, sos, sizeof(sos));
+
+	for (int r = 0; r <= restarts; r++) {
+		for (int i = 0; i < 300; i++) {
+			uint8 value = (uint8)(i * 37 + r);
+			out[pos++] = value;
+			if (value == 0xff)
+				out[pos++] = 0x00;
+		}
+		if (r < restarts) {
+			out[pos++] = 0xff;
+			out[pos++] = (uint8)(0xd0 + (r & 7));
+		}
+	}
+
+	if (eoi) {
+		out[pos++] = 0xff;
+		out[pos++] = 0xd9;
+	}
+	return pos;
+}
+
+
+static bool
+same_index(const cam_jpeg_index& a, const cam_jpeg_index& b)
+{
+	return a.soi_offset == b.soi_offset && a.eoi_offset == b.eoi_offset
+		&& a.sof_offset == b.sof_offset && a.sos_offset == b.sos_offset
+		&& a.width == b.width && a.height == b.height
+		&& a.components == b.components
+		&& memcmp(a.sampling, b.sampling, sizeof(a.sampling)) == 0
+		&& a.has_dht == b.has_dht && a.restart_interval == b.restart_interval
+		&& a.restart_count == b.restart_count
+		&& memcmp(a.restarts, b.restarts, sizeof(uint32)
+			* (a.restart_count < CAM_JPEG_MAX_RESTARTS
+				? a.restart_count : CAM_JPEG_MAX_RESTARTS)) == 0
+		&& a.state == b.state;
+}
+
+
+// =============================================================================
+// Test 1: Whole Frame
+// =============================================================================
+
+static bool
+test_whole_frame()
+{
+	printf("Test: Index of a whole frame... ");
+
+	static uint8 frame[16384];
+	size_t size = build_frame(frame, 0, 5, true, true);
+
+	cam_jpeg_index index;
+	cam_jpeg_index_reset(&index);
+	cam_jpeg_index_update(&index, frame, size);
+
+	if (!cam_jpeg_index_complete(index) || index.soi_offset != 0
+		|| index.eoi_offset != size - 2) {
+		printf("FAIL (state %d, SOI %u, EOI %u of %zu)\n", index.state,
+			(unsigned)index.soi_offset, (unsigned)index.eoi_offset, size);
+		return false;
+	}
+	if (index.width != 640 || index.height != 480 || index.components != 3
+		|| index.sampling[0] != 0x21 || index.sampling[1] != 0x11
+		|| index.sof_marker != 0xc0) {
+		printf("FAIL (SOF %ux%u, %u components, sampling %02x)\n",
+			index.width, index.height, index.components, index.sampling[0]);
+		return false;
+	}
+	if (!index.has_dht || index.restart_interval != 40
+		|| index.restart_count != 5) {
+		printf("FAIL (DHT %d, DRI %u, %u restarts)\n", index.has_dht,
+			index.restart_interval, index.restart_count);
+		return false;
+	}
+	for (uint16 i = 0; i < index.restart_count; i++) {
+		uint32 offset = index.restarts[i];
+		if (frame[offset] != 0xff || frame[offset + 1] != 0xd0 + (i & 7)) {
+			printf("FAIL (restart %u at %u is not RST%u)\n", i,
+				(unsigned)offset, i & 7);
+			return false;
+		}
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Payload Splits
+// =============================================================================
+
+static bool
+test_split_payloads()
+{
+	printf("Test: Any payload split gives the same index... ");
+
+	static uint8 frame[16384];
+	size_t size = build_frame(frame, 7, 9, false, true);
+
+	cam_jpeg_index whole;
+	cam_jpeg_index_reset(&whole);
+	cam_jpeg_index_update(&whole, frame, size);
+
+	// Every split point once, then random payload sizes
+	for (size_t split = 1; split < size; split++) {
+		cam_jpeg_index index;
+		cam_jpeg_index_reset(&index);
+		cam_jpeg_index_update(&index, frame, split);
+		cam_jpeg_index_update(&index, frame, size);
+		if (!same_index(index, whole)) {
+			printf("FAIL (split at %zu)\n", split);
+			return false;
+		}
+	}
+
+	srand(1357);
+	for (int run = 0; run < 200; run++) {
+		cam_jpeg_index index;
+		cam_jpeg_index_reset(&index);
+		size_t length = 0;
+		while (length < size) {
+			length += 1 + rand() % 64;
+			if (length > size)
+				length = size;
+			cam_jpeg_index_update(&index, frame, length);
+		}
+		if (!same_index(index, whole)) {
+			printf("FAIL (run %d)\n", run);
+			return false;
+		}
+	}
+
+	if (whole.soi_offset != 7 || whole.has_dht || whole.restart_count != 9) {
+		printf("FAIL (SOI %u, DHT %d, %u restarts)\n",
+			(unsigned)whole.soi_offset, whole.has_dht, whole.restart_count);
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 3: Damaged Frames
+// =============================================================================
+
+static bool
+test_damaged_frames()
+{
+	printf("Test: Missing SOI and EOI... ");
+
+	static uint8 frame[16384];
+
+	// Cut off before EOI: indexed, but not complete
+	size_t size = build_frame(frame, 0, 2, true, false);
+	cam_jpeg_index index;
+	cam_jpeg_index_reset(&index);
+	cam_jpeg_index_update(&index, frame, size);
+	if (index.state != CAM_JPEG_SCAN_ENTROPY
+		|| index.eoi_offset != CAM_JPEG_NONE
+		|| cam_jpeg_index_complete(index)) {
+		printf("FAIL (truncated frame in state %d)\n", index.state);
+		return false;
+	}
+
+	// No SOI within the window
+	memset(frame, 0x55, CAM_JPEG_SOI_WINDOW + 16);
+	cam_jpeg_index_reset(&index);
+	cam_jpeg_index_update(&index, frame, 100);
+	if (index.state != CAM_JPEG_SCAN_SOI) {
+		printf("FAIL (gave up on SOI after 100 bytes)\n");
+		return false;
+	}
+	cam_jpeg_index_update(&index, frame, CAM_JPEG_SOI_WINDOW + 16);
+	if (index.state != CAM_JPEG_SCAN_BROKEN
+		|| index.soi_offset != CAM_JPEG_NONE) {
+		printf("FAIL (no SOI, state %d)\n", index.state);
+		return false;
+	}
+
+	// Garbage where a marker segment should start
+	size = build_frame(frame, 0, 0, false, true);
+	frame[2] = 0x42;
+	cam_jpeg_index_reset(&index);
+	cam_jpeg_index_update(&index, frame, size);
+	if (index.state != CAM_JPEG_SCAN_BROKEN) {
+		printf("FAIL (bad segment, state %d)\n", index.state);
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 4: Copy With Huffman Tables
+// =============================================================================
+
+static bool
+test_copy_with_tables()
+{
+	printf("Test: Frames copied as-is, with the standard DHT if missing... ");
+
+	static uint8 frame[16384];
+	static uint8 copy[16384 + CAM_JPEG_DHT_SIZE];
+
+	// Junk before SOI and padding after EOI stay behind
+	size_t junk = 5;
+	size_t size = build_frame(frame, junk, 2, false, true);
+	memset(frame + size, 0, 8);
+	cam_jpeg_index index;
+	cam_jpeg_index_reset(&index);
+	cam_jpeg_index_update(&index, frame, size + 8);
+	size_t length = size - junk;
+	size_t copied = cam_jpeg_copy_with_tables(index, frame, copy,
+		sizeof(copy));
+	size_t head = index.sos_offset - junk;
+	if (copied != length + CAM_JPEG_DHT_SIZE
+		|| memcmp(copy, frame + junk, head) != 0
+		|| copy[head] != 0xff || copy[head + 1] != 0xc4
+		|| memcmp(copy + head + CAM_JPEG_DHT_SIZE, frame + index.sos_offset,
+			length - head) != 0) {
+		printf("FAIL (DHT not put in before SOS, %zu bytes)\n", copied);
+		return false;
+	}
+
+	// The segment is well formed: one length, four tables that fill it
+	cam_jpeg_index copied_index;
+	cam_jpeg_index_reset(&copied_index);
+	cam_jpeg_index_update(&copied_index, copy, copied);
+	size_t dht = head + 4;
+	for (int table = 0; table < 4; table++) {
+		size_t codes = 0;
+		for (int i = 1; i <= 16; i++)
+			codes += copy[dht + i];
+		dht += 17 + codes;
+	}
+	if (!copied_index.has_dht || !cam_jpeg_index_complete(copied_index)
+		|| (size_t)(copy[head + 2] << 8 | copy[head + 3]) + 2
+			!= CAM_JPEG_DHT_SIZE
+		|| dht != head + CAM_JPEG_DHT_SIZE) {
+		printf("FAIL (bad DHT segment)\n");
+		return false;
+	}
+
+	// A frame with its own tables is copied unchanged
+	size = build_frame(frame, 0, 2, true, true);
+	cam_jpeg_index_reset(&index);
+	cam_jpeg_index_update(&index, frame, size);
+	copied = cam_jpeg_copy_with_tables(index, frame, copy, sizeof(copy));
+	if (copied != size || memcmp(copy, frame, size) != 0) {
+		printf("FAIL (frame with DHT changed, %zu bytes)\n", copied);
+		return false;
+	}
+
+	// Nothing is written that does not fit, nor for an incomplete frame
+	if (cam_jpeg_copy_with_tables(index, frame, copy, size - 1) != 0) {
+		printf("FAIL (copied past the capacity)\n");
+		return false;
+	}
+	size = build_frame(frame, 0, 2, false, false);
+	cam_jpeg_index_reset(&index);
+	cam_jpeg_index_update(&index, frame, size);
+	if (cam_jpeg_copy_with_tables(index, frame, copy, sizeof(copy)) != 0) {
+		printf("FAIL (copied a frame without EOI)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 5: Throughput
+// =============================================================================
+
+static bool
+test_index_performance()
+{
+	printf("Test: Index throughput...\n");
+
+	static uint8 frame[16384];
+	size_t size = build_frame(frame, 0, 20, true, true);
+
+	const int kIterations = 20000;
+	bigtime_t start = system_time();
+	for (int i = 0; i < kIterations; i++) {
+		cam_jpeg_index index;
+		cam_jpeg_index_reset(&index);
+		// 3 KB payloads, like a high-bandwidth ISO transfer slot
+		for (size_t length = 3072; ; length += 3072) {
+			cam_jpeg_index_update(&index, frame, length < size ? length : size);
+			if (length >= size)
+				break;
+		}
+	}
+	bigtime_t elapsed = system_time() - start;
+
+	printf("  %zu byte frame: %.2f us per frame (%.0f MB/s)\n", size,
+		(double)elapsed / kIterations,
+		(double)size * kIterations / (elapsed > 0 ? elapsed : 1));
+	return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("JPEG Frame Index Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_whole_frame())
+		passed++;
+	else
+		failed++;
+
+	if (test_split_payloads())
+		passed++;
+	else
+		failed++;
+
+	if (test_damaged_frames())
+		passed++;
+	else
+		failed++;
+
+	if (test_copy_with_tables())
+		passed++;
+	else
+		failed++;
+
+	if (test_index_performance())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the table of frame times the latency probe keeps
+ *
+ * Links the driver's CamLatencyProbe.cpp: a reader gets the frames sent
+ * after the last one it saw, oldest first, also across the wrap of the
+ * table and of the frame numbers; the table holds the last kFrames only,
+ * and turning the probe on starts it over.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_latency_probe test_latency_probe.cpp \
+ *       ../CamLatencyProbe.cpp -lbe
+ *
+ * Run:
+ *   ./test_latency_probe
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <OS.h>
+
+#include "CamLatencyProbe.h"
+
+
+static const int32 kFrames = CamLatencyProbe::kFrames;
+
+
+static void
+record_frames(CamLatencyProbe& probe, uint32 first, int32 count)
+{
+	for (int32 i = 0; i < count; i++) {
+		cam_frame_times times;
+		memset(&times, 0, sizeof(times));
+		times.sequence = first + i;
+		times.capture = 1000000 + (bigtime_t)i * 33333;
+		times.sent = times.capture + 40000;
+		probe.Record(times);
+	}
+}
+
+
+// =============================================================================
+// Test 1: Reading After A Frame
+// =============================================================================
+
+static bool
+test_read_after()
+{
+	printf("Test: Frames after the last one read... ");
+
+	CamLatencyProbe probe;
+	cam_frame_times times[kFrames];
+	uint32 newest;
+	if (probe.Read(0, times, kFrames, &newest) != 0 || newest != 0) {
+		printf("FAIL (frames in an empty table)\n");
+		return false;
+	}
+
+	record_frames(probe, 1, 100);
+	int32 count = probe.Read(0, times, kFrames, &newest);
+	if (count != 100 || newest != 100 || times[0].sequence != 1
+		|| times[99].sequence != 100) {
+		printf("FAIL (%d frames, newest %u)\n", (int)count,
+			(unsigned)newest);
+		return false;
+	}
+
+	count = probe.Read(60, times, kFrames, &newest);
+	if (count != 40 || times[0].sequence != 61
+		|| times[0].sent - times[0].capture != 40000) {
+		printf("FAIL (%d frames after 60, first %u)\n", (int)count,
+			(unsigned)times[0].sequence);
+		return false;
+	}
+
+	// No more than asked for, the oldest first
+	count = probe.Read(60, times, 10, &newest);
+	if (count != 10 || times[9].sequence != 70) {
+		printf("FAIL (%d frames of 10)\n", (int)count);
+		return false;
+	}
+
+	if (probe.Read(100, times, kFrames, &newest) != 0) {
+		printf("FAIL (frames after the newest)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Wrapping
+// =============================================================================
+
+static bool
+test_wrap()
+{
+	printf("Test: The last frames, across the wraps... ");
+
+	CamLatencyProbe probe;
+	cam_frame_times times[kFrames];
+	uint32 newest;
+
+	// The table keeps only the last kFrames
+	record_frames(probe, 1, kFrames + 200);
+	int32 count = probe.Read(0, times, kFrames, &newest);
+	if (count != kFrames || times[0].sequence != 201
+		|| times[kFrames - 1].sequence != (uint32)kFrames + 200) {
+		printf("FAIL (%d frames from %u)\n", (int)count,
+			(unsigned)times[0].sequence);
+		return false;
+	}
+	for (int32 i = 1; i < count; i++) {
+		if (times[i].sequence != times[i - 1].sequence + 1) {
+			printf("FAIL (out of order at %d)\n", (int)i);
+			return false;
+		}
+	}
+
+	// Frame numbers wrap too
+	CamLatencyProbe wrapped;
+	record_frames(wrapped, 0xfffffff0, 32);
+	count = wrapped.Read(0xfffffffa, times, kFrames, &newest);
+	if (count != 21 || times[0].sequence != 0xfffffffb || newest != 15) {
+		printf("FAIL (%d frames across the number wrap, newest %u)\n",
+			(int)count, (unsigned)newest);
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 3: Turning It On
+// =============================================================================
+
+static bool
+test_enable()
+{
+	printf("Test: Turning the probe on starts over... ");
+
+	CamLatencyProbe probe;
+	probe.SetEnabled(true);
+	if (!probe.IsEnabled()) {
+		printf("FAIL (not on)\n");
+		return false;
+	}
+	record_frames(probe, 1, 50);
+
+	// On again keeps the table, off and on clears it
+	probe.SetEnabled(true);
+	cam_frame_times times[kFrames];
+	uint32 newest;
+	if (probe.Read(0, times, kFrames, &newest) != 50) {
+		printf("FAIL (table cleared while on)\n");
+		return false;
+	}
+	probe.SetEnabled(false);
+	if (probe.IsEnabled()) {
+		printf("FAIL (not off)\n");
+		return false;
+	}
+	probe.SetEnabled(true);
+	if (probe.Read(0, times, kFrames, &newest) != 0 || newest != 0) {
+		printf("FAIL (frames from before)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Latency Probe Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_read_after())
+		passed++;
+	else
+		failed++;
+
+	if (test_wrap())
+		passed++;
+	else
+		failed++;
+
+	if (test_enable())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return failed > 0 ? 1 : 0;
+}
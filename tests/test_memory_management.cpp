@@ -25,12 +25,99 @@
 // Simulated CamFrame class (matches driver implementation)
 // =============================================================================
 
-class CamFrame : public BMallocIO {
+class CamFrame : public BPositionIO {
 public:
-	CamFrame() : BMallocIO() { fStamp = system_time(); }
-	virtual ~CamFrame() {}
+	CamFrame()
+		:
+		fData(NULL),
+		fCapacity(0),
+		fLength(0),
+		fPosition(0)
+	{
+		fStamp = system_time();
+	}
+
+	virtual ~CamFrame() { free(fData); }
+
+	status_t Reserve(size_t capacity)
+	{
+		if (capacity <= fCapacity)
+			return B_OK;
+		uint8* data = (uint8*)realloc(fData, capacity);
+		if (data == NULL)
+			return B_NO_MEMORY;
+		fData = data;
+		fCapacity = capacity;
+		return B_OK;
+	}
+
+	virtual ssize_t ReadAt(off_t pos, void* buffer, size_t size)
+	{
+		if (pos < 0)
+			return B_BAD_VALUE;
+		if ((size_t)pos >= fLength)
+			return 0;
+		if (size > fLength - (size_t)pos)
+			size = fLength - (size_t)pos;
+		memcpy(buffer, fData + pos, size);
+		return size;
+	}
+
+	virtual ssize_t WriteAt(off_t pos, const void* buffer, size_t size)
+	{
+		if (pos < 0)
+			return B_BAD_VALUE;
+		size_t end = (size_t)pos + size;
+		if (end > fCapacity) {
+			size_t capacity = fCapacity * 2;
+			if (capacity < end)
+				capacity = end;
+			if (Reserve(capacity) != B_OK)
+				return B_NO_MEMORY;
+		}
+		memcpy(fData + pos, buffer, size);
+		if (end > fLength)
+			fLength = end;
+		return size;
+	}
+
+	virtual off_t Seek(off_t position, uint32 seekMode)
+	{
+		switch (seekMode) {
+			case SEEK_SET: fPosition = position; break;
+			case SEEK_CUR: fPosition += position; break;
+			case SEEK_END: fPosition = fLength + position; break;
+			default: return B_BAD_VALUE;
+		}
+		if (fPosition < 0)
+			fPosition = 0;
+		return fPosition;
+	}
+
+	virtual off_t Position() const { return fPosition; }
+
+	virtual status_t SetSize(off_t size)
+	{
+		if (size < 0)
+			return B_BAD_VALUE;
+		if ((size_t)size > fCapacity && Reserve(size) != B_OK)
+			return B_NO_MEMORY;
+		fLength = size;
+		return B_OK;
+	}
+
+	const void* Buffer() const { return fData; }
+	size_t BufferLength() const { return fLength; }
+	size_t Capacity() const { return fCapacity; }
+
 	bigtime_t Stamp() const { return fStamp; }
 	bigtime_t fStamp;
+
+private:
+	uint8*		fData;
+	size_t		fCapacity;
+	size_t		fLength;
+	off_t		fPosition;
 };
 
 
@@ -248,6 +335,68 @@ test_pool_capacity()
 }
 
 
+// =============================================================================
+// Test 3b: Recycled Frames Keep Their Storage
+// =============================================================================
+
+static bool
+test_pool_retains_storage()
+{
+	printf("Test: Recycled frames keep their storage... ");
+
+	const size_t kFrameSize = 640 * 480 * 2;  // VGA YUY2
+	const size_t kPacketSize = 3060;          // typical ISO payload
+
+	FramePool pool;
+	uint8 packet[kPacketSize];
+	memset(packet, 0x80, sizeof(packet));
+
+	// First frame grows to the full frame size
+	CamFrame* frame = pool.Alloc();
+	frame->Reserve(kFrameSize);
+	const void* storage = frame->Buffer();
+	while (frame->Position() < (off_t)kFrameSize) {
+		size_t left = kFrameSize - frame->Position();
+		frame->Write(packet, left < kPacketSize ? left : kPacketSize);
+	}
+	if (frame->BufferLength() != kFrameSize) {
+		printf("FAIL (length %zu, expected %zu)\n", frame->BufferLength(),
+			kFrameSize);
+		delete frame;
+		return false;
+	}
+	pool.Recycle(frame);
+
+	// Reused frame must be empty but keep the same allocation
+	frame = pool.Alloc();
+	bool ok = frame->BufferLength() == 0 && frame->Position() == 0
+		&& frame->Capacity() >= kFrameSize && frame->Buffer() == storage;
+	if (!ok) {
+		printf("FAIL (length %zu, capacity %zu, storage %s)\n",
+			frame->BufferLength(), frame->Capacity(),
+			frame->Buffer() == storage ? "kept" : "reallocated");
+		delete frame;
+		return false;
+	}
+
+	// Filling it again must not reallocate
+	while (frame->Position() < (off_t)kFrameSize) {
+		size_t left = kFrameSize - frame->Position();
+		frame->Write(packet, left < kPacketSize ? left : kPacketSize);
+	}
+	ok = frame->Buffer() == storage;
+	pool.Recycle(frame);
+
+	if (!ok) {
+		printf("FAIL (storage reallocated on refill)\n");
+		return false;
+	}
+
+	printf("OK (%zu byte frame reused without reallocation)\n", kFrameSize);
+	return true;
+}
+
+
 // =============================================================================
 // Test 4: Conditional Pre-fill Performance
 // =============================================================================
@@ -418,6 +567,11 @@ main(int argc, char** argv)
 	else
 		failed++;
 
+	if (test_pool_retains_storage())
+		passed++;
+	else
+		failed++;
+
 	if (test_conditional_prefill())
 		passed++;
 	else
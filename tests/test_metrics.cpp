@@ -0,0 +1,356 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the live metrics every stage of the pipeline counts into
+ *
+ * Links the driver's CamMetrics.cpp: counters bumped from several threads
+ * at once must add up, the maxima must hold the largest value, the latency
+ * percentiles must be within a bucket of the exact ones, and the frames
+ * per second gauge and the archived reply must match what was fed.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_metrics test_metrics.cpp ../CamMetrics.cpp -lbe
+ *
+ * Run:
+ *   ./test_metrics
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <Message.h>
+#include <OS.h>
+
+#include "CamMetrics.h"
+
+
+static const int32 kThreads = 4;
+static const int32 kAddsPerThread = 200000;
+
+
+struct worker_args {
+	CamMetrics*	metrics;
+	int32		index;
+};
+
+
+static int32
+counting_worker(void* data)
+{
+	worker_args* args = (worker_args*)data;
+	for (int32 i = 0; i < kAddsPerThread; i++) {
+		args->metrics->Add(CAM_METRIC_PACKETS);
+		args->metrics->Add(CAM_METRIC_BYTES, 3);
+		args->metrics->RecordMax(CAM_METRIC_DECODE_TIME_MAX,
+			(int64)i * kThreads + args->index);
+		args->metrics->RecordLatency(CAM_LATENCY_DECODE, i % 1000);
+	}
+	return 0;
+}
+
+
+// =============================================================================
+// Test 1: Concurrent Counters
+// =============================================================================
+
+static bool
+test_concurrent_counters()
+{
+	printf("Test: Counters and maxima from %d threads... ", (int)kThreads);
+
+	CamMetrics metrics;
+	worker_args args[kThreads];
+	thread_id threads[kThreads];
+	for (int32 i = 0; i < kThreads; i++) {
+		args[i].metrics = &metrics;
+		args[i].index = i;
+		threads[i] = spawn_thread(counting_worker, "metrics worker",
+			B_NORMAL_PRIORITY, &args[i]);
+		resume_thread(threads[i]);
+	}
+	for (int32 i = 0; i < kThreads; i++) {
+		status_t result;
+		wait_for_thread(threads[i], &result);
+	}
+
+	int64 expected = (int64)kThreads * kAddsPerThread;
+	if (metrics.Get(CAM_METRIC_PACKETS) != expected
+		|| metrics.Get(CAM_METRIC_BYTES) != expected * 3) {
+		printf("FAIL (%lld packets, %lld bytes, expected %lld)\n",
+			metrics.Get(CAM_METRIC_PACKETS), metrics.Get(CAM_METRIC_BYTES),
+			expected);
+		return false;
+	}
+	if (metrics.Get(CAM_METRIC_DECODE_TIME_MAX) != expected - 1) {
+		printf("FAIL (max %lld, expected %lld)\n",
+			metrics.Get(CAM_METRIC_DECODE_TIME_MAX), expected - 1);
+		return false;
+	}
+
+	const CamHistogram& decode = metrics.Latency(CAM_LATENCY_DECODE);
+	if (decode.Count() != expected || decode.Max() != 999) {
+		printf("FAIL (histogram holds %lld, max %lld)\n", decode.Count(),
+			decode.Max());
+		return false;
+	}
+
+	// A smaller value leaves the maximum alone
+	metrics.RecordMax(CAM_METRIC_DECODE_TIME_MAX, 5);
+	if (metrics.Get(CAM_METRIC_DECODE_TIME_MAX) != expected - 1) {
+		printf("FAIL (max lowered to %lld)\n",
+			metrics.Get(CAM_METRIC_DECODE_TIME_MAX));
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Latency Percentiles
+// =============================================================================
+
+static bool
+within_bucket(bigtime_t value, bigtime_t exact)
+{
+	// Reported as the top of the bucket: never low, at most 1/8 high
+	return value >= exact && value <= exact + exact / 8 + 1;
+}
+
+
+static bool
+test_latency_percentiles()
+{
+	printf("Test: Latency percentiles... ");
+
+	CamHistogram histogram;
+	if (histogram.Percentile(50) != 0 || histogram.Count() != 0) {
+		printf("FAIL (empty histogram)\n");
+		return false;
+	}
+
+	// 1..10000 us, once each
+	for (bigtime_t value = 1; value <= 10000; value++)
+		histogram.Record(value);
+	cam_latency_summary summary;
+	histogram.Summarize(&summary);
+	if (summary.count != 10000 || summary.max != 10000
+		|| !within_bucket(summary.p50, 5000)
+		|| !within_bucket(summary.p95, 9500)
+		|| !within_bucket(summary.p99, 9900)) {
+		printf("FAIL (p50 %lld p95 %lld p99 %lld max %lld)\n", summary.p50,
+			summary.p95, summary.p99, summary.max);
+		return false;
+	}
+
+	// A tail the average would hide: 2% of frames take 40 ms
+	histogram.Reset();
+	for (int32 i = 0; i < 980; i++)
+		histogram.Record(3000);
+	for (int32 i = 0; i < 20; i++)
+		histogram.Record(40000);
+	if (!within_bucket(histogram.Percentile(95), 3000)
+		|| !within_bucket(histogram.Percentile(99), 40000)
+		|| histogram.Percentile(99) > histogram.Max()) {
+		printf("FAIL (tail: p95 %lld p99 %lld)\n", histogram.Percentile(95),
+			histogram.Percentile(99));
+		return false;
+	}
+
+	// Small values are exact, huge ones land in the last bucket
+	histogram.Reset();
+	histogram.Record(3);
+	histogram.Record(-5);
+	if (histogram.Percentile(100) != 3 || histogram.Percentile(1) != 0) {
+		printf("FAIL (small values %lld %lld)\n", histogram.Percentile(100),
+			histogram.Percentile(1));
+		return false;
+	}
+	histogram.Record(1LL << 40);
+	if (histogram.Percentile(100) <= 0 || histogram.Max() != 1LL << 40) {
+		printf("FAIL (huge value %lld)\n", histogram.Percentile(100));
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 3: Frame Rate Gauge
+// =============================================================================
+
+static bool
+test_frame_rate()
+{
+	printf("Test: Frame rate gauge... ");
+
+	CamMetrics metrics;
+	// 30 fps for three seconds of made up time
+	bigtime_t now = 1000000;
+	for (int32 i = 0; i <= 90; i++)
+		metrics.RecordFrameSent(now + i * 1000000LL / 30);
+
+	int64 fps = metrics.Get(CAM_METRIC_OUTPUT_FPS);
+	if (fps < 29900 || fps > 30100) {
+		printf("FAIL (%lld frames per 1000 s)\n", fps);
+		return false;
+	}
+	if (metrics.Get(CAM_METRIC_FRAMES_SENT) != 91) {
+		printf("FAIL (%lld frames sent)\n",
+			metrics.Get(CAM_METRIC_FRAMES_SENT));
+		return false;
+	}
+
+	// Gauges take the last value, whatever it was
+	metrics.Set(CAM_METRIC_OUTPUT_QUEUE_DEPTH, 3);
+	metrics.Set(CAM_METRIC_OUTPUT_QUEUE_DEPTH, 1);
+	if (metrics.Get(CAM_METRIC_OUTPUT_QUEUE_DEPTH) != 1) {
+		printf("FAIL (queue depth %lld)\n",
+			metrics.Get(CAM_METRIC_OUTPUT_QUEUE_DEPTH));
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 4: Snapshot and Reply
+// =============================================================================
+
+static bool
+test_archive()
+{
+	printf("Test: Snapshot archived for a reply... ");
+
+	// Every metric has a name of its own
+	for (int32 i = 0; i < CAM_METRIC_COUNT; i++) {
+		if (CamMetrics::Name((cam_metric)i) == NULL) {
+			printf("FAIL (metric %d has no name)\n", (int)i);
+			return false;
+		}
+		for (int32 j = i + 1; j < CAM_METRIC_COUNT; j++) {
+			if (strcmp(CamMetrics::Name((cam_metric)i),
+					CamMetrics::Name((cam_metric)j)) == 0) {
+				printf("FAIL (%s twice)\n", CamMetrics::Name((cam_metric)i));
+				return false;
+			}
+		}
+	}
+
+	for (int32 i = 0; i < CAM_LATENCY_COUNT; i++) {
+		if (CamMetrics::Name((cam_latency_stage)i) == NULL) {
+			printf("FAIL (stage %d has no name)\n", (int)i);
+			return false;
+		}
+	}
+
+	CamMetrics metrics;
+	metrics.Add(CAM_METRIC_PACKETS, 1000);
+	metrics.Add(CAM_METRIC_PACKET_ERRORS, 25);
+	metrics.Add(CAM_METRIC_FRAMES_DECODED, 10);
+	metrics.Add(CAM_METRIC_DECODE_TIME, 42000);
+	metrics.Add(CAM_METRIC_POOL_HITS, 3);
+	metrics.Add(CAM_METRIC_POOL_MISSES, 1);
+	for (int32 i = 0; i < 100; i++)
+		metrics.RecordLatency(CAM_LATENCY_END_TO_END, 20000 + i * 100);
+	metrics.Set(CAM_METRIC_FIRST_FRAME_TIME, 48000);
+	metrics.RecordLatency(CAM_LATENCY_FIRST_FRAME, 48000);
+
+	cam_metrics_snapshot snapshot;
+	metrics.Snapshot(&snapshot);
+	if (snapshot.values[CAM_METRIC_PACKETS] != 1000
+		|| snapshot.when < snapshot.since
+		|| snapshot.latency[CAM_LATENCY_END_TO_END].count != 100
+		|| snapshot.latency[CAM_LATENCY_END_TO_END].max != 29900
+		|| snapshot.latency[CAM_LATENCY_DECODE].count != 0) {
+		printf("FAIL (snapshot)\n");
+		return false;
+	}
+
+	BMessage message(WEBCAM_MSG_METRICS);
+	if (CamMetrics::Archive(snapshot, &message) != B_OK) {
+		printf("FAIL (archive)\n");
+		return false;
+	}
+	int64 packets = 0;
+	float loss = 0, decodeAverage = 0, hitRate = 0;
+	message.FindInt64("usb.packets", &packets);
+	message.FindFloat("usb.packet_loss", &loss);
+	message.FindFloat("decode.time_avg_us", &decodeAverage);
+	message.FindFloat("deframer.pool_hit_rate", &hitRate);
+	int64 endToEndMax = 0;
+	message.FindInt64("latency.end_to_end.max", &endToEndMax);
+	if (endToEndMax != 29900) {
+		printf("FAIL (end to end max %lld)\n", endToEndMax);
+		return false;
+	}
+	int64 firstFrame = 0, firstFrameStarts = 0;
+	message.FindInt64("video.first_frame_us", &firstFrame);
+	message.FindInt64("latency.first_frame.count", &firstFrameStarts);
+	if (firstFrame != 48000 || firstFrameStarts != 1) {
+		printf("FAIL (first frame %lld us, %lld starts)\n", firstFrame,
+			firstFrameStarts);
+		return false;
+	}
+	if (packets != 1000 || loss < 0.0249f || loss > 0.0251f
+		|| decodeAverage != 4200.0f || hitRate != 0.75f) {
+		printf("FAIL (%lld packets, loss %.4f, decode %.1f us, hits %.2f)\n",
+			packets, loss, decodeAverage, hitRate);
+		return false;
+	}
+
+	metrics.ResetLatency();
+	if (metrics.Latency(CAM_LATENCY_END_TO_END).Count() != 0
+		|| metrics.Get(CAM_METRIC_PACKETS) != 1000) {
+		printf("FAIL (latency reset)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Live Metrics Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_concurrent_counters())
+		passed++;
+	else
+		failed++;
+
+	if (test_latency_percentiles())
+		passed++;
+	else
+		failed++;
+
+	if (test_frame_rate())
+		passed++;
+	else
+		failed++;
+
+	if (test_archive())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the order the transfer rings submit in
+ *
+ * Links the driver's CamThreading.cpp and runs its CamSubmitOrder the way
+ * the rings do: one thread per slot, handed its slot in ring order by a
+ * pump, blocking in its "transfer" (a snooze) for a while. The slot
+ * threads are held up at random before they submit, yet every submission
+ * must reach the transfer call in ticket order, and Uninit() must free
+ * the threads still waiting for their turn.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_submit_order test_submit_order.cpp \
+ *       ../CamThreading.cpp -lbe
+ *
+ * Run:
+ *   ./test_submit_order
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <OS.h>
+
+#include "CamThreading.h"
+
+
+static const int32 kSlots = 4;
+static const int32 kSubmissions = 400;
+
+
+struct test_slot {
+	thread_id		thread;
+	sem_id			submit;
+	sem_id			complete;
+	uint32			ticket;
+	uint32			seed;
+};
+
+static CamSubmitOrder sOrder;
+static test_slot sSlots[kSlots];
+static int32 sCalls[kSubmissions + kSlots];	// tickets, in call order
+static int32 sCallCount;
+
+
+static int32
+slot_thread(void* data)
+{
+	test_slot* slot = (test_slot*)data;
+	while (acquire_sem(slot->submit) == B_OK) {
+		// Scheduling delay: a later slot may well get here first
+		snooze(rand_r(&slot->seed) % 300);
+		if (sOrder.Enter(slot->ticket) != B_OK)
+			break;
+		sCalls[atomic_add(&sCallCount, 1)] = (int32)slot->ticket;
+		snooze(200 + rand_r(&slot->seed) % 400);
+		sOrder.Leave();
+		release_sem(slot->complete);
+	}
+	return B_OK;
+}
+
+
+// =============================================================================
+// Test 1: Ring Order
+// =============================================================================
+
+static bool
+test_ring_order()
+{
+	printf("Test: Submissions reach the stack in ring order... ");
+
+	if (sOrder.Init("test turn") != B_OK) {
+		printf("FAIL (Init)\n");
+		return false;
+	}
+	sCallCount = 0;
+	for (int32 i = 0; i < kSlots; i++) {
+		sSlots[i].submit = create_sem(0, "test submit");
+		sSlots[i].complete = create_sem(0, "test complete");
+		sSlots[i].seed = 17 + i;
+		sSlots[i].thread = spawn_thread(slot_thread, "test slot",
+			B_NORMAL_PRIORITY, &sSlots[i]);
+		resume_thread(sSlots[i].thread);
+	}
+
+	// The pump: every slot queued, then each one re-armed as it completes
+	for (int32 i = 0; i < kSlots; i++) {
+		sSlots[i].ticket = sOrder.Take();
+		release_sem(sSlots[i].submit);
+	}
+	for (int32 i = kSlots; i < kSubmissions; i++) {
+		test_slot& slot = sSlots[i % kSlots];
+		acquire_sem(slot.complete);
+		slot.ticket = sOrder.Take();
+		release_sem(slot.submit);
+	}
+	for (int32 i = kSubmissions; i < kSubmissions + kSlots; i++)
+		acquire_sem(sSlots[i % kSlots].complete);
+
+	sOrder.Uninit();
+	for (int32 i = 0; i < kSlots; i++) {
+		delete_sem(sSlots[i].submit);
+		status_t result;
+		wait_for_thread(sSlots[i].thread, &result);
+		delete_sem(sSlots[i].complete);
+	}
+
+	if (sCallCount != kSubmissions) {
+		printf("FAIL (%d of %d submissions)\n", (int)sCallCount,
+			(int)kSubmissions);
+		return false;
+	}
+	for (int32 i = 0; i < kSubmissions; i++) {
+		if (sCalls[i] != i) {
+			printf("FAIL (call %d was ticket %d)\n", (int)i, (int)sCalls[i]);
+			return false;
+		}
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Stopping
+// =============================================================================
+
+static bool
+test_uninit()
+{
+	printf("Test: Uninit() frees threads waiting for their turn... ");
+
+	if (sOrder.Init("test turn") != B_OK) {
+		printf("FAIL (Init)\n");
+		return false;
+	}
+	sCallCount = 0;
+
+	// Ticket 1 waits for ticket 0, which is never submitted
+	sOrder.Take();
+	test_slot& slot = sSlots[0];
+	slot.submit = create_sem(0, "test submit");
+	slot.complete = create_sem(0, "test complete");
+	slot.seed = 5;
+	slot.ticket = sOrder.Take();
+	slot.thread = spawn_thread(slot_thread, "test slot", B_NORMAL_PRIORITY,
+		&slot);
+	resume_thread(slot.thread);
+	release_sem(slot.submit);
+	snooze(20000);
+
+	sOrder.Uninit();
+	status_t result;
+	wait_for_thread(slot.thread, &result);
+	delete_sem(slot.submit);
+	delete_sem(slot.complete);
+
+	if (sCallCount != 0) {
+		printf("FAIL (ticket 1 went before ticket 0)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Submission Order Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_ring_order())
+		passed++;
+	else
+		failed++;
+
+	if (test_uninit())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return failed > 0 ? 1 : 0;
+}
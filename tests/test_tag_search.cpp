@@ -0,0 +1,339 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the frame tag search of the legacy deframers
+ *
+ * Links the driver's CamTagSearch.cpp and checks cam_tag_find() against
+ * the byte by byte compare CamDeframer::FindTags() used to do, on tag sets
+ * sharing their first byte (the memchr() path) and not (the table path).
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_tag_search test_tag_search.cpp ../CamTagSearch.cpp -lbe
+ *
+ * Run:
+ *   ./test_tag_search
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <OS.h>
+
+#include "CamTagSearch.h"
+
+
+// =============================================================================
+// Reference
+// =============================================================================
+
+// The old FindTags(), bounded so a tag never reads past the data
+static int
+reference_find(const uint8* data, size_t size, const uint8** tags, int count,
+	size_t length, size_t skip, int* which)
+{
+	if (size < skip)
+		return -1;
+	for (size_t i = 0; i + skip <= size && i + length <= size; i++) {
+		for (int t = 0; t < count; t++) {
+			if (memcmp(data + i, tags[t], length) == 0) {
+				*which = t;
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+
+static const uint8 kShared0[] = { 0xff, 0xff, 0x00, 0xff, 0x96 };
+static const uint8 kShared1[] = { 0xff, 0xff, 0x00, 0xff, 0x97 };
+static const uint8 kShared2[] = { 0xff, 0xfe, 0x00, 0x01, 0x02 };
+static const uint8* kSharedTags[] = { kShared0, kShared1, kShared2 };
+
+static const uint8 kMixed0[] = { 0x12, 0x34, 0x56, 0x78 };
+static const uint8 kMixed1[] = { 0xab, 0x34, 0x56, 0x78 };
+static const uint8 kMixed2[] = { 0x12, 0x35, 0x56, 0x79 };
+static const uint8* kMixedTags[] = { kMixed0, kMixed1, kMixed2 };
+
+
+// Finds every tag in 'data' with both, restarting after each match
+static bool
+compare_all(const cam_tag_set& set, const uint8* data, size_t size,
+	size_t skip)
+{
+	size_t offset = 0;
+	while (true) {
+		int which = -1;
+		int expectedWhich = -1;
+		int found = cam_tag_find(set, data + offset, size - offset, skip,
+			&which);
+		int expected = reference_find(data + offset, size - offset, set.tags,
+			set.count, set.length, skip, &expectedWhich);
+		if (found != expected || which != expectedWhich) {
+			printf("FAILED (at %zu: %d/%d, expected %d/%d)\n", offset, found,
+				which, expected, expectedWhich);
+			return false;
+		}
+		if (found < 0)
+			return true;
+		offset += found + 1;
+	}
+}
+
+
+// =============================================================================
+// Test 1: Tags at Known Places
+// =============================================================================
+
+static bool
+test_known_offsets()
+{
+	printf("Test: Tags at known offsets... ");
+
+	cam_tag_set set;
+	if (!cam_tag_set_init(&set, kSharedTags, 3, sizeof(kShared0))
+		|| set.first_byte != 0xff) {
+		printf("FAILED (shared first byte not seen)\n");
+		return false;
+	}
+
+	uint8 data[256];
+	memset(data, 0xff, sizeof(data));
+	memcpy(data + 100, kShared2, sizeof(kShared2));
+	memcpy(data + 200, kShared1, sizeof(kShared1));
+
+	int which = -1;
+	int found = cam_tag_find(set, data, sizeof(data), 0, &which);
+	if (found != 100 || which != 2) {
+		printf("FAILED (first: %d/%d)\n", found, which);
+		return false;
+	}
+	found = cam_tag_find(set, data + 101, sizeof(data) - 101, 0, &which);
+	if (found != 99 || which != 1) {
+		printf("FAILED (second: %d/%d)\n", found, which);
+		return false;
+	}
+
+	// A tag cut off by the end of the data is not there
+	found = cam_tag_find(set, data, 203, 0, &which);
+	if (found != 100) {
+		printf("FAILED (cut off: %d)\n", found);
+		return false;
+	}
+	found = cam_tag_find(set, data + 101, 102, 0, &which);
+	if (found != -1) {
+		printf("FAILED (cut off tag found at %d)\n", found);
+		return false;
+	}
+
+	// Nor one starting in the last 'skip' bytes
+	found = cam_tag_find(set, data + 101, sizeof(data) - 101, 60, &which);
+	if (found != -1) {
+		printf("FAILED (tag in the skip found at %d)\n", found);
+		return false;
+	}
+
+	printf("PASSED\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Same Results as the Byte by Byte Compare
+// =============================================================================
+
+static bool
+test_matches_reference()
+{
+	printf("Test: Same results as the byte by byte compare... ");
+
+	cam_tag_set shared;
+	cam_tag_set mixed;
+	if (!cam_tag_set_init(&shared, kSharedTags, 3, sizeof(kShared0))
+		|| !cam_tag_set_init(&mixed, kMixedTags, 3, sizeof(kMixed0))
+		|| mixed.first_byte != -1) {
+		printf("FAILED (init)\n");
+		return false;
+	}
+
+	const size_t kSize = 8192;
+	uint8* data = (uint8*)malloc(kSize);
+	if (data == NULL) {
+		printf("FAILED (no memory)\n");
+		return false;
+	}
+
+	srand(42);
+	for (int round = 0; round < 50; round++) {
+		// Few byte values, so prefixes of the tags are everywhere
+		static const uint8 kAlphabet[] = { 0x00, 0x12, 0x34, 0x35, 0x56,
+			0x78, 0x79, 0xab, 0xfe, 0xff };
+		for (size_t i = 0; i < kSize; i++)
+			data[i] = kAlphabet[rand() % sizeof(kAlphabet)];
+		for (int n = 0; n < 8; n++) {
+			size_t at = rand() % (kSize - 8);
+			if (n & 1)
+				memcpy(data + at, kSharedTags[n % 3], sizeof(kShared0));
+			else
+				memcpy(data + at, kMixedTags[n % 3], sizeof(kMixed0));
+		}
+
+		size_t skip = round % 7;
+		if (!compare_all(shared, data, kSize, skip)
+			|| !compare_all(mixed, data, kSize, skip)) {
+			free(data);
+			return false;
+		}
+	}
+
+	free(data);
+	printf("PASSED\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 3: Short Tags and Limits
+// =============================================================================
+
+static bool
+test_short_tags()
+{
+	printf("Test: Short tags and limits... ");
+
+	static const uint8 kOne0[] = { 0x42 };
+	static const uint8 kOne1[] = { 0x17 };
+	static const uint8* kOneTags[] = { kOne0, kOne1 };
+	cam_tag_set set;
+	if (!cam_tag_set_init(&set, kOneTags, 2, 1)) {
+		printf("FAILED (one byte tags refused)\n");
+		return false;
+	}
+
+	uint8 data[] = { 0x00, 0x01, 0x17, 0x42 };
+	int which = -1;
+	int found = cam_tag_find(set, data, sizeof(data), 0, &which);
+	if (found != 2 || which != 1) {
+		printf("FAILED (one byte: %d/%d)\n", found, which);
+		return false;
+	}
+	if (!compare_all(set, data, sizeof(data), 1))
+		return false;
+
+	// One bit per tag: 17 do not fit, nor do tags of no length
+	const uint8* many[CAM_TAG_MAX_TAGS + 1];
+	for (int i = 0; i <= CAM_TAG_MAX_TAGS; i++)
+		many[i] = kOne0;
+	if (cam_tag_set_init(&set, many, CAM_TAG_MAX_TAGS + 1, 1)
+		|| cam_tag_set_init(&set, kOneTags, 2, 0)) {
+		printf("FAILED (limits not enforced)\n");
+		return false;
+	}
+	if (!cam_tag_set_init(&set, many, CAM_TAG_MAX_TAGS, 1)) {
+		printf("FAILED (%d tags refused)\n", CAM_TAG_MAX_TAGS);
+		return false;
+	}
+
+	// Less data than a tag
+	cam_tag_set shared;
+	cam_tag_set_init(&shared, kSharedTags, 3, sizeof(kShared0));
+	if (cam_tag_find(shared, kShared0, 4, 0, &which) != -1) {
+		printf("FAILED (tag found in fewer bytes)\n");
+		return false;
+	}
+
+	printf("PASSED\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 4: Search Speed
+// =============================================================================
+
+static bool
+test_search_performance()
+{
+	printf("Test: Search speed against the byte by byte compare... ");
+
+	// Every other byte starts a tag, as in the kernel benchmark
+	const size_t kSize = 3072;
+	uint8 data[kSize];
+	for (size_t i = 0; i < kSize; i++)
+		data[i] = (i & 1) != 0 ? 0xff : (uint8)i;
+
+	cam_tag_set set;
+	cam_tag_set_init(&set, kSharedTags, 3, sizeof(kShared0));
+
+	const int kIterations = 2000;
+	int sink = 0;
+	int which;
+	bigtime_t start = system_time();
+	for (int i = 0; i < kIterations; i++)
+		sink += reference_find(data, kSize, kSharedTags, 3, 5, 0, &which);
+	bigtime_t reference = system_time() - start;
+
+	start = system_time();
+	for (int i = 0; i < kIterations; i++)
+		sink += cam_tag_find(set, data, kSize, 0, &which);
+	bigtime_t indexed = system_time() - start;
+
+	printf("%.1fx (%lld vs %lld us) ", indexed > 0
+		? (double)reference / indexed : 0.0, (long long)reference,
+		(long long)indexed);
+	if (sink == 1)
+		printf("\n");
+
+	// Timing is not checked on a loaded machine, only that it is not slower
+	if (indexed > reference * 2) {
+		printf("FAILED (slower)\n");
+		return false;
+	}
+
+	printf("PASSED\n");
+	return true;
+}
+
+
+// =============================================================================
+// Main
+// =============================================================================
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Frame Tag Search Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_known_offsets())
+		passed++;
+	else
+		failed++;
+
+	if (test_matches_reference())
+		passed++;
+	else
+		failed++;
+
+	if (test_short_tags())
+		passed++;
+	else
+		failed++;
+
+	if (test_search_performance())
+		passed++;
+	else
+		failed++;
+
+	printf("\n===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the timebase grouped cameras share
+ *
+ * Links the driver's CamTimebase.cpp: members come and go with the
+ * reference moving to the first one left, every member is stamped with
+ * the longest capture delay of the group, a grouped start falls on a
+ * millisecond, and the skew against the reference camera's nearest frame
+ * is right either side of it, for cameras at other rates too.
+ *
+ * Build:
+ *   g++ -O2 -I.. -o test_timebase test_timebase.cpp ../CamTimebase.cpp -lbe
+ *
+ * Run:
+ *   ./test_timebase
+ */
+
+#include <stdio.h>
+#include <OS.h>
+
+#include "CamTimebase.h"
+
+
+static const bigtime_t kInterval = 33333;	// 30 fps
+
+
+// =============================================================================
+// Test 1: Members
+// =============================================================================
+
+static bool
+test_members()
+{
+	printf("Test: Joining and leaving... ");
+
+	CamTimebase timebase;
+	int32 members[CamTimebase::kMaxMembers];
+	for (int32 i = 0; i < CamTimebase::kMaxMembers; i++) {
+		members[i] = timebase.Join();
+		if (members[i] != i) {
+			printf("FAIL (member %d got index %d)\n", (int)i,
+				(int)members[i]);
+			return false;
+		}
+	}
+	if (timebase.Join() != -1) {
+		printf("FAIL (joined a full group)\n");
+		return false;
+	}
+
+	timebase.Leave(members[3]);
+	if (timebase.CountMembers() != CamTimebase::kMaxMembers - 1
+		|| timebase.Join() != 3) {
+		printf("FAIL (a freed index is not reused)\n");
+		return false;
+	}
+
+	// Without member 0, member 1 is the reference: no skew for it
+	timebase.Leave(members[0]);
+	bigtime_t skew;
+	if (timebase.AddFrame(1, 1000000, kInterval, &skew)) {
+		printf("FAIL (the new reference reported a skew)\n");
+		return false;
+	}
+	if (!timebase.AddFrame(2, 1000000 + 5000, kInterval, &skew)
+		|| skew != 5000) {
+		printf("FAIL (skew against the new reference)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Shared Capture Latency
+// =============================================================================
+
+static bool
+test_capture_latency()
+{
+	printf("Test: Longest capture delay of the group... ");
+
+	CamTimebase timebase;
+	int32 a = timebase.Join();
+	int32 b = timebase.Join();
+	int32 c = timebase.Join();
+
+	timebase.SetCaptureLatency(a, 12000);
+	timebase.SetCaptureLatency(b, 41000);
+	timebase.SetCaptureLatency(c, 25000);
+	if (timebase.CaptureLatency() != 41000) {
+		printf("FAIL (%lld, expected 41000)\n",
+			(long long)timebase.CaptureLatency());
+		return false;
+	}
+
+	// Frames captured together get the same send time on every camera
+	bigtime_t capture = 5000000;
+	bigtime_t sendA = capture + timebase.CaptureLatency();
+	timebase.SetCaptureLatency(a, 13000);
+	bigtime_t sendB = capture + timebase.CaptureLatency();
+	if (sendA != sendB) {
+		printf("FAIL (send times %lld and %lld)\n", (long long)sendA,
+			(long long)sendB);
+		return false;
+	}
+
+	// A camera that left no longer holds the others back
+	timebase.Leave(b);
+	if (timebase.CaptureLatency() != 25000) {
+		printf("FAIL (%lld after leaving, expected 25000)\n",
+			(long long)timebase.CaptureLatency());
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 3: Grouped Start
+// =============================================================================
+
+static bool
+test_grouped_start()
+{
+	printf("Test: Grouped start on a millisecond... ");
+
+	CamTimebase timebase;
+	for (int32 i = 0; i < 100; i++) {
+		bigtime_t before = system_time();
+		bigtime_t start = timebase.ScheduleStart(200000 + i * 37);
+		if (start % 1000 != 0 || start < before + 200000 + i * 37
+			|| start > system_time() + 200000 + i * 37 + 1000
+			|| timebase.StartTime() != start) {
+			printf("FAIL (start %lld for a lead of %d)\n", (long long)start,
+				(int)(200000 + i * 37));
+			return false;
+		}
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 4: Frame Skew
+// =============================================================================
+
+static bool
+test_skew()
+{
+	printf("Test: Skew against the nearest reference frame... ");
+
+	CamTimebase timebase;
+	int32 reference = timebase.Join();
+	int32 member = timebase.Join();
+
+	bigtime_t skew;
+	if (timebase.AddFrame(member, 1000000, kInterval, &skew)) {
+		printf("FAIL (skew before the reference had a frame)\n");
+		return false;
+	}
+
+	// The other camera runs 7 ms behind, 4 ms ahead, then half a frame
+	// off; its frame may come before or after the reference's
+	bigtime_t offsets[] = { 7000, -4000, 16000, -16000 };
+	for (int32 i = 0; i < 4; i++) {
+		for (int32 frame = 0; frame < 10; frame++) {
+			bigtime_t captured = 2000000 + i * 1000000 + frame * kInterval;
+			bool before = (frame % 2) == 0;
+			if (before)
+				timebase.AddFrame(reference, captured, kInterval, &skew);
+			bool reported = timebase.AddFrame(member, captured + offsets[i],
+				kInterval, &skew);
+			if (!before)
+				timebase.AddFrame(reference, captured, kInterval, &skew);
+			if (!reported || skew != offsets[i]) {
+				printf("FAIL (offset %lld, frame %d: %s %lld)\n",
+					(long long)offsets[i], (int)frame,
+					reported ? "skew" : "none", (long long)skew);
+				return false;
+			}
+		}
+	}
+
+	// A 15 fps camera against the 30 fps reference
+	timebase.AddFrame(reference, 9000000, kInterval, &skew);
+	if (!timebase.AddFrame(member, 9000000 + 2 * kInterval + 3000,
+			2 * kInterval, &skew) || skew != 3000) {
+		printf("FAIL (15 fps member: %lld)\n", (long long)skew);
+		return false;
+	}
+
+	// A reference that stopped has nothing to compare with
+	if (timebase.AddFrame(member, 20000000, kInterval, &skew)) {
+		printf("FAIL (skew against a stale reference)\n");
+		return false;
+	}
+
+	printf("OK\n");
+	return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Shared Timebase Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_members())
+		passed++;
+	else
+		failed++;
+
+	if (test_capture_latency())
+		passed++;
+	else
+		failed++;
+
+	if (test_grouped_start())
+		passed++;
+	else
+		failed++;
+
+	if (test_skew())
+		passed++;
+	else
+		failed++;
+
+	printf("\n");
+	printf("===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return failed > 0 ? 1 : 0;
+}
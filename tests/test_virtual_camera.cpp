@@ -0,0 +1,414 @@
+/*
+ * Copyright 2024, Haiku USB Webcam Driver Project
+ * Distributed under the terms of the MIT License.
+ *
+ * Test suite for the virtual camera's configuration and packet stream
+ *
+ * Links the driver's VirtualCamSource.cpp: WEBCAM_VIRTUAL parsing, the
+ * synthetic YUY2 stream cut into packets, PTS/SCR stamping and the replay
+ * of a WEBCAM_CAPTURE file written here.
+ *
+ * Build:
+ *   g++ -O2 -I.. -I../addons/virtual -o test_virtual_camera \
+ *       test_virtual_camera.cpp ../addons/virtual/VirtualCamSource.cpp \
+ *       -lbe -lturbojpeg
+ *
+ * Run:
+ *   ./test_virtual_camera
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <OS.h>
+
+#include "CamCapture.h"
+#include "VirtualCamSource.h"
+
+
+// Payload of one packet of the stream, header and all
+static const uint8*
+packet_data(const virtual_cam_stream& stream, int32 i)
+{
+	return stream.data + i * stream.slot_size;
+}
+
+
+// Payload bytes of a frame, headers left out, and whether only its last
+// packet has EOF
+static size_t
+frame_payload(const virtual_cam_stream& stream, int32 frame, bool* eofLast)
+{
+	int32 first;
+	int32 count;
+	virtual_cam_stream_frame(stream, frame, &first, &count);
+	size_t size = 0;
+	*eofLast = true;
+	for (int32 i = first; i < first + count; i++) {
+		const uint8* header = packet_data(stream, i);
+		size += stream.packets[i].actual_length - header[0];
+		bool eof = (header[1] & 0x02) != 0;
+		if (eof != (i == first + count - 1))
+			*eofLast = false;
+	}
+	return size;
+}
+
+
+// =============================================================================
+// Test 1: WEBCAM_VIRTUAL Parsing
+// =============================================================================
+
+static bool
+test_parse_config()
+{
+	printf("Test: WEBCAM_VIRTUAL parsing... ");
+
+	virtual_cam_config configs[VIRTUAL_CAM_MAX_CAMERAS];
+	int32 count = virtual_cam_parse_config(
+		"mjpeg:1920x1080@60; yuy2:640x480 ;2*MJPEG:1280x720@15;"
+		"replay:/tmp/a@b/capture@25", configs, VIRTUAL_CAM_MAX_CAMERAS);
+	if (count != 5) {
+		printf("FAIL (%d cameras)\n", (int)count);
+		return false;
+	}
+	if (configs[0].source != VIRTUAL_CAM_MJPEG || configs[0].width != 1920
+		|| configs[0].height != 1080 || configs[0].fps != 60.0f
+		|| configs[1].source != VIRTUAL_CAM_YUY2 || configs[1].fps != 30.0f
+		|| configs[2].width != 1280 || configs[3].width != 1280
+		|| configs[3].fps != 15.0f) {
+		printf("FAIL (synthetic entries)\n");
+		return false;
+	}
+	// The rate comes off the path only after its last '@'
+	if (configs[4].source != VIRTUAL_CAM_REPLAY
+		|| strcmp(configs[4].path, "/tmp/a@b/capture") != 0
+		|| configs[4].fps != 25.0f) {
+		printf("FAIL (replay '%s' at %g)\n", configs[4].path, configs[4].fps);
+		return false;
+	}
+
+	// Entries it cannot read are left out, the others still count
+	count = virtual_cam_parse_config("h264:640x480;yuy2:641x480;"
+		"mjpeg:3840x2160@30;yuy2:640x480@500;0*yuy2:320x240;mjpeg;"
+		"yuy2:320x240", configs, VIRTUAL_CAM_MAX_CAMERAS);
+	if (count != 1 || configs[0].width != 320) {
+		printf("FAIL (%d cameras from bad entries)\n", (int)count);
+		return false;
+	}
+
+	// No more than asked for
+	count = virtual_cam_parse_config("20*yuy2:320x240", configs, 3);
+	if (count != 3 || virtual_cam_parse_config(NULL, configs, 3) != 0
+		|| virtual_cam_parse_config("", configs, 3) != 0) {
+		printf("FAIL (limits: %d)\n", (int)count);
+		return false;
+	}
+
+	printf("PASSED\n");
+	return true;
+}
+
+
+// =============================================================================
+// Test 2: Synthetic Stream
+// =============================================================================
+
+static bool
+test_synthetic_stream()
+{
+	printf("Test: Synthetic YUY2 stream... ");
+
+	virtual_cam_config config;
+	memset(&config, 0, sizeof(config));
+	config.source = VIRTUAL_CAM_YUY2;
+	config.width = 320;
+	config.height = 240;
+	config.fps = 30;
+
+	virtual_cam_stream stream;
+	if (virtual_cam_stream_build(&stream, config) != B_OK) {
+		printf("FAIL (build)\n");
+		return false;
+	}
+
+	bool ok = true;
+	if (stream.fourcc != 'YUY2' || stream.width != 320 || stream.fps != 30
+		|| stream.frame_count != 4 || stream.slot_size != 3072) {
+		printf("FAIL (stream %d frames, slot %zu)\n", (int)stream.frame_count,
+			stream.slot_size);
+		ok = false;
+	}
+
+	// Whole frames, EOF on the last packet, the FID toggling between them
+	for (int32 frame = 0; ok && frame < stream.frame_count; frame++) {
+		bool eofLast;
+		size_t size = frame_payload(stream, frame, &eofLast);
+		int32 first;
+		int32 count;
+		virtual_cam_stream_frame(stream, frame, &first, &count);
+		uint8 fid = packet_data(stream, first)[1] & 0x01;
+		if (size != 320 * 240 * 2 || !eofLast || fid != (frame & 1)) {
+			printf("FAIL (frame %d: %zu bytes, fid %d)\n", (int)frame, size,
+				fid);
+			ok = false;
+		}
+	}
+
+	virtual_cam_stream_free(&stream);
+	if (ok)
+		printf("PASSED\n");
+	return ok;
+}
+
+
+// =============================================================================
+// Test 3: PTS and SCR Stamping
+// =============================================================================
+
+static bool
+test_stamping()
+{
+	printf("Test: PTS and SCR stamped as packets go out... ");
+
+	virtual_cam_config config;
+	memset(&config, 0, sizeof(config));
+	config.source = VIRTUAL_CAM_YUY2;
+	config.width = 64;
+	config.height = 48;
+	config.fps = 30;
+
+	virtual_cam_stream stream;
+	if (virtual_cam_stream_build(&stream, config) != B_OK) {
+		printf("FAIL (build)\n");
+		return false;
+	}
+
+	int32 first;
+	int32 count;
+	virtual_cam_stream_frame(stream, 1, &first, &count);
+	virtual_cam_stream_stamp(&stream, first, count, 0x11223344, 0x55667788,
+		0x0123);
+
+	bool ok = true;
+	for (int32 i = 0; i < stream.packet_count && ok; i++) {
+		const uint8* header = packet_data(stream, i);
+		uint32 pts;
+		uint32 stc;
+		uint16 sof;
+		memcpy(&pts, header + 2, 4);
+		memcpy(&stc, header + 6, 4);
+		memcpy(&sof, header + 10, 2);
+		bool stamped = i >= first && i < first + count;
+		if (stamped != (pts == 0x11223344 && stc == 0x55667788
+				&& sof == 0x0123)
+			|| (!stamped && (pts != 0 || stc != 0))) {
+			printf("FAIL (packet %d)\n", (int)i);
+			ok = false;
+		}
+	}
+
+	virtual_cam_stream_free(&stream);
+	if (ok)
+		printf("PASSED\n");
+	return ok;
+}
+
+
+// =============================================================================
+// Test 4: Replay of a Capture
+// =============================================================================
+
+static void
+write_record(FILE* file, uint8 type, const void* packets, uint32 packetCount,
+	uint32 slotSize, const void* data, uint32 dataSize)
+{
+	cam_capture_record record;
+	memset(&record, 0, sizeof(record));
+	record.magic = CAM_CAPTURE_RECORD_MAGIC;
+	uint32 size = sizeof(record) + packetCount * sizeof(cam_capture_packet)
+		+ dataSize;
+	record.size = (size + 7) & ~7;
+	record.type = type;
+	record.stream = CAM_CAPTURE_VIDEO;
+	record.endpoint = 0x81;
+	record.packet_count = packetCount;
+	record.slot_size = slotSize;
+	record.data_size = dataSize;
+
+	static const uint8 kPadding[8] = {};
+	fwrite(&record, sizeof(record), 1, file);
+	fwrite(packets, sizeof(cam_capture_packet), packetCount, file);
+	fwrite(data, 1, dataSize, file);
+	fwrite(kPadding, 1, record.size - size, file);
+}
+
+
+static bool
+test_replay()
+{
+	printf("Test: Replay of a WEBCAM_CAPTURE file... ");
+
+	// Three frames of a synthetic stream, as a camera would have sent them
+	virtual_cam_config config;
+	memset(&config, 0, sizeof(config));
+	config.source = VIRTUAL_CAM_YUY2;
+	config.width = 160;
+	config.height = 120;
+	config.fps = 30;
+	virtual_cam_stream source;
+	if (virtual_cam_stream_build(&source, config) != B_OK) {
+		printf("FAIL (source)\n");
+		return false;
+	}
+
+	char path[] = "/tmp/test_virtual_camera_XXXXXX";
+	int fd = mkstemp(path);
+	FILE* file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (file == NULL) {
+		printf("FAIL (no capture file)\n");
+		virtual_cam_stream_free(&source);
+		return false;
+	}
+
+	cam_capture_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CAM_CAPTURE_MAGIC, 8);
+	header.version = CAM_CAPTURE_VERSION;
+	header.header_size = sizeof(header);
+	fwrite(&header, sizeof(header), 1, file);
+
+	cam_capture_stream_info info;
+	memset(&info, 0, sizeof(info));
+	info.fourcc = 'YUY2';
+	info.width = 160;
+	info.height = 120;
+	info.frame_interval = 400000;	// 25 fps
+	write_record(file, CAM_CAPTURE_STREAM_START, NULL, 0, 0, &info,
+		sizeof(info));
+
+	// Transfers of 8 packets, a failed and an empty one in between
+	int32 last;
+	int32 lastCount;
+	virtual_cam_stream_frame(source, 2, &last, &lastCount);
+	int32 end = last + lastCount;
+	for (int32 first = 0; first < end; first += 8) {
+		cam_capture_packet packets[10];
+		uint8 data[10 * 3072];
+		uint32 dataSize = 0;
+		uint32 count = 0;
+		for (int32 i = first; i < first + 8 && i < end; i++) {
+			packets[count].status = B_OK;
+			packets[count].request_length = 3072;
+			packets[count].actual_length = source.packets[i].actual_length;
+			memcpy(data + dataSize, packet_data(source, i),
+				source.packets[i].actual_length);
+			dataSize += source.packets[i].actual_length;
+			count++;
+		}
+		packets[count].status = B_DEV_CRC_ERROR;
+		packets[count].request_length = 3072;
+		packets[count].actual_length = 0;
+		count++;
+		packets[count].status = B_OK;
+		packets[count].request_length = 3072;
+		packets[count].actual_length = 0;
+		count++;
+		write_record(file, CAM_CAPTURE_TRANSFER, packets, count, 3072, data,
+			dataSize);
+	}
+	fclose(file);
+
+	memset(&config, 0, sizeof(config));
+	config.source = VIRTUAL_CAM_REPLAY;
+	strlcpy(config.path, path, sizeof(config.path));
+	virtual_cam_stream stream;
+	status_t status = virtual_cam_stream_build(&stream, config);
+	unlink(path);
+
+	bool ok = true;
+	if (status != B_OK) {
+		printf("FAIL (build: %s)\n", strerror(status));
+		ok = false;
+	} else if (stream.fourcc != 'YUY2' || stream.width != 160
+		|| stream.height != 120 || stream.fps != 25.0f) {
+		printf("FAIL (format %ux%u at %g)\n", (unsigned)stream.width,
+			(unsigned)stream.height, stream.fps);
+		ok = false;
+	} else if (stream.frame_count != 2) {
+		// The third frame has the first one's FID, it would run into it
+		printf("FAIL (%d frames)\n", (int)stream.frame_count);
+		ok = false;
+	}
+
+	for (int32 frame = 0; ok && frame < stream.frame_count; frame++) {
+		bool eofLast;
+		if (frame_payload(stream, frame, &eofLast) != 160 * 120 * 2
+			|| !eofLast) {
+			printf("FAIL (frame %d)\n", (int)frame);
+			ok = false;
+		}
+	}
+
+	// Not a capture
+	config.source = VIRTUAL_CAM_REPLAY;
+	strlcpy(config.path, "/tmp/test_virtual_camera_missing",
+		sizeof(config.path));
+	virtual_cam_stream missing;
+	if (ok && virtual_cam_stream_build(&missing, config) == B_OK) {
+		printf("FAIL (missing file replayed)\n");
+		virtual_cam_stream_free(&missing);
+		ok = false;
+	}
+
+	if (status == B_OK)
+		virtual_cam_stream_free(&stream);
+	virtual_cam_stream_free(&source);
+	if (ok)
+		printf("PASSED\n");
+	return ok;
+}
+
+
+// =============================================================================
+// Main
+// =============================================================================
+
+int
+main(int argc, char** argv)
+{
+	printf("\n");
+	printf("===========================================\n");
+	printf("Virtual Camera Tests\n");
+	printf("===========================================\n\n");
+
+	int passed = 0;
+	int failed = 0;
+
+	if (test_parse_config())
+		passed++;
+	else
+		failed++;
+
+	if (test_synthetic_stream())
+		passed++;
+	else
+		failed++;
+
+	if (test_stamping())
+		passed++;
+	else
+		failed++;
+
+	if (test_replay())
+		passed++;
+	else
+		failed++;
+
+	printf("\n===========================================\n");
+	printf("Results: %d passed, %d failed\n", passed, failed);
+	printf("===========================================\n\n");
+
+	return failed > 0 ? 1 : 0;
+}